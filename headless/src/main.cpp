@@ -6,10 +6,87 @@
 
 #include <vulkan/vulkan.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
 #include <vector>
 
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define TILE_TARGET_MILLISECONDS 50.0
+
+// Leaves of the host renderer's bounding volume hierarchy hold at most this
+// many triangles
+#define HOST_BVH_LEAF_PRIMITIVE_COUNT 4
+
+// Triangle bounds for the host bounding volume hierarchy are computed in tasks
+// of this many triangles
+#define HOST_BVH_TASK_PRIMITIVE_COUNT (1024 * 1024)
+
+// The scene is uploaded through this many staging slots of
+// SCENE_STAGING_SLOT_SIZE bytes, so staging memory does not grow with the
+// scene
+#define SCENE_STAGING_SLOT_COUNT 4
+#define SCENE_STAGING_SLOT_SIZE (8 * 1024 * 1024)
+
+// Tiles kept for the rolling device timing statistics
+#define TIMESTAMP_WINDOW_SIZE 256
+
+// Trace events kept for TRACE_FILE, later events are dropped
+#define TRACE_EVENT_LIMIT 1000000
+
+// Acceleration structure build presets, one per class of geometry. Default
+// leaves the trace and build tradeoff to the driver. Static geometry is built
+// once for fast tracing and compacted, dynamic geometry is rebuilt often and
+// built fast, refit geometry allows update builds.
+#define BUILD_PRESET_DEFAULT 0
+#define BUILD_PRESET_STATIC 1
+#define BUILD_PRESET_DYNAMIC 2
+#define BUILD_PRESET_REFIT 3
+
+// Presets of the scene's bottom level and of the top level acceleration
+// structures
+#if !defined(BOTTOM_LEVEL_BUILD_PRESET)
+#define BOTTOM_LEVEL_BUILD_PRESET BUILD_PRESET_DEFAULT
+#endif
+
+#if !defined(TOP_LEVEL_BUILD_PRESET)
+#define TOP_LEVEL_BUILD_PRESET BUILD_PRESET_DEFAULT
+#endif
+
+// Whole image traces timed with each preset by BUILD_PRESET_BENCHMARK_ENABLED
+#define BENCHMARK_TRACE_COUNT 8
+
+// The acceleration structure command helpers are built when an option uses
+// them
+#if BOTTOM_LEVEL_BUILD_PRESET == BUILD_PRESET_STATIC ||                     \
+    defined(BUILD_PRESET_BENCHMARK_ENABLED) || defined(HOST_BUILD_ENABLED)
+#define ACCELERATION_STRUCTURE_COMMANDS_ENABLED
+#endif
+
 #if defined(VALIDATION_ENABLED)
 #define STRING_RESET "\033[0m"
 #define STRING_INFO "\033[37m"
@@ -24,149 +101,2563 @@ debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
 
   std::string message = pCallbackData->pMessage;
 
-  if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
-    message = STRING_INFO + message + STRING_RESET;
-    std::cout << message.c_str() << std::endl;
+  if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
+    message = STRING_INFO + message + STRING_RESET;
+    std::cout << message.c_str() << std::endl;
+  }
+
+  if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+    message = STRING_WARNING + message + STRING_RESET;
+    std::cerr << message.c_str() << std::endl;
+  }
+
+  if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+    message = STRING_ERROR + message + STRING_RESET;
+    std::cerr << message.c_str() << std::endl;
+  }
+
+  return VK_FALSE;
+}
+#endif
+
+void throwExceptionVulkanAPI(VkResult result, const std::string &functionName) {
+  std::string message = "Vulkan API exception: return code " +
+                        std::to_string(result) + " (" + functionName + ")";
+
+  std::cerr << message.c_str() << std::endl;
+
+  throw std::runtime_error(message);
+}
+
+// Rolling window of device timings, reported as min, average and 99th
+// percentile in milliseconds
+struct TimestampStatistics {
+  std::vector<double> millisecondsList;
+  uint32_t nextIndex = 0;
+};
+
+void addTimestampSample(TimestampStatistics &timestampStatistics,
+                        double milliseconds) {
+  if (timestampStatistics.millisecondsList.size() < TIMESTAMP_WINDOW_SIZE) {
+    timestampStatistics.millisecondsList.push_back(milliseconds);
+  } else {
+    timestampStatistics.millisecondsList[timestampStatistics.nextIndex] =
+        milliseconds;
+  }
+
+  timestampStatistics.nextIndex =
+      (timestampStatistics.nextIndex + 1) % TIMESTAMP_WINDOW_SIZE;
+}
+
+void printTimestampStatistics(const std::string &name,
+                              const TimestampStatistics &timestampStatistics) {
+  if (timestampStatistics.millisecondsList.empty()) {
+    return;
+  }
+
+  std::vector<double> sortedMillisecondsList =
+      timestampStatistics.millisecondsList;
+  std::sort(sortedMillisecondsList.begin(), sortedMillisecondsList.end());
+
+  double totalMilliseconds = 0.0;
+  for (double milliseconds : sortedMillisecondsList) {
+    totalMilliseconds += milliseconds;
+  }
+
+  size_t percentileIndex = std::min(sortedMillisecondsList.size() - 1,
+                                    sortedMillisecondsList.size() * 99 / 100);
+
+  std::cout << name << ": min " << sortedMillisecondsList.front()
+            << " ms, avg " << totalMilliseconds / sortedMillisecondsList.size()
+            << " ms, p99 " << sortedMillisecondsList[percentileIndex] << " ms"
+            << std::endl;
+}
+
+// Chrome trace events, collected when TRACE_FILE is set and written to that
+// path on exit for loading into Perfetto or chrome://tracing. Times are in
+// microseconds since startup, each track shows as one thread.
+struct TraceEvent {
+  std::string name;
+  uint32_t trackIndex;
+  double startMicroseconds;
+  double durationMicroseconds;
+};
+
+struct TraceRecorder {
+  const char *filePath = getenv("TRACE_FILE");
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+  std::vector<std::string> trackNameList;
+  std::vector<double> trackEndMicrosecondsList;
+  std::vector<TraceEvent> eventList;
+  std::mutex mutex;
+};
+
+static TraceRecorder traceRecorder;
+
+double getTraceMicroseconds() {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - traceRecorder.startTimePoint)
+      .count();
+}
+
+uint32_t addTraceTrack(const std::string &name) {
+  std::lock_guard<std::mutex> traceRecorderLock(traceRecorder.mutex);
+  traceRecorder.trackNameList.push_back(name);
+  traceRecorder.trackEndMicrosecondsList.push_back(0.0);
+  return (uint32_t)traceRecorder.trackNameList.size() - 1;
+}
+
+void addTraceEvent(const std::string &name, uint32_t trackIndex,
+                   double startMicroseconds, double durationMicroseconds) {
+  if (traceRecorder.filePath == NULL) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> traceRecorderLock(traceRecorder.mutex);
+  if (traceRecorder.eventList.size() < TRACE_EVENT_LIMIT) {
+    traceRecorder.eventList.push_back({.name = name,
+                                       .trackIndex = trackIndex,
+                                       .startMicroseconds = startMicroseconds,
+                                       .durationMicroseconds =
+                                           durationMicroseconds});
+  }
+}
+
+// Device timestamps share no clock with the host, so device work is placed
+// at its submission time, or after the previous work on the same queue track
+void addQueueTraceEvent(const std::string &name, uint32_t trackIndex,
+                        double submitMicroseconds,
+                        double durationMicroseconds) {
+  double startMicroseconds = 0.0;
+  {
+    std::lock_guard<std::mutex> traceRecorderLock(traceRecorder.mutex);
+    double &trackEndMicroseconds =
+        traceRecorder.trackEndMicrosecondsList[trackIndex];
+
+    startMicroseconds = std::max(submitMicroseconds, trackEndMicroseconds);
+    trackEndMicroseconds = startMicroseconds + durationMicroseconds;
+  }
+
+  addTraceEvent(name, trackIndex, startMicroseconds, durationMicroseconds);
+}
+
+// Consecutive sections of one function on one track, beginning a section
+// ends the one before it
+struct TraceSection {
+  uint32_t trackIndex = 0;
+  std::string name;
+  double startMicroseconds = 0.0;
+};
+
+void endTraceSection(TraceSection &traceSection) {
+  if (traceSection.name.empty()) {
+    return;
+  }
+
+  addTraceEvent(traceSection.name, traceSection.trackIndex,
+                traceSection.startMicroseconds,
+                getTraceMicroseconds() - traceSection.startMicroseconds);
+  traceSection.name.clear();
+}
+
+void beginTraceSection(TraceSection &traceSection, const std::string &name) {
+  if (traceRecorder.filePath == NULL) {
+    return;
+  }
+
+  endTraceSection(traceSection);
+  traceSection.name = name;
+  traceSection.startMicroseconds = getTraceMicroseconds();
+}
+
+// Escapes quotes, backslashes and control characters, such as in device
+// names, for a JSON string
+std::string getJSONString(const std::string &value) {
+  std::string jsonString;
+  for (char character : value) {
+    if (character == '"' || character == '\\') {
+      jsonString += '\\';
+      jsonString += character;
+    } else if ((unsigned char)character < 0x20) {
+      char escapeString[7];
+      snprintf(escapeString, sizeof(escapeString), "\\u%04x",
+               (unsigned char)character);
+      jsonString += escapeString;
+    } else {
+      jsonString += character;
+    }
+  }
+
+  return jsonString;
+}
+
+// Times are written in microseconds with fixed nanosecond precision, so long
+// sessions keep their spans apart
+void writeTraceFile() {
+  if (traceRecorder.filePath == NULL) {
+    return;
+  }
+
+  std::ofstream traceFile(traceRecorder.filePath);
+  traceFile << std::fixed << std::setprecision(3);
+  traceFile << "{\"traceEvents\": [\n";
+
+  for (uint32_t x = 0; x < traceRecorder.trackNameList.size(); x++) {
+    traceFile << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+              << "\"tid\": " << x << ", \"args\": {\"name\": \""
+              << getJSONString(traceRecorder.trackNameList[x]) << "\"}},\n";
+  }
+
+  for (uint32_t x = 0; x < traceRecorder.eventList.size(); x++) {
+    const TraceEvent &traceEvent = traceRecorder.eventList[x];
+    traceFile << "{\"name\": \"" << getJSONString(traceEvent.name)
+              << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": "
+              << traceEvent.trackIndex
+              << ", \"ts\": " << traceEvent.startMicroseconds
+              << ", \"dur\": " << traceEvent.durationMicroseconds << "}"
+              << (x + 1 < traceRecorder.eventList.size() ? ",\n" : "\n");
+  }
+
+  traceFile << "]}" << std::endl;
+}
+
+#if defined(RAY_COUNTERS_ENABLED)
+// Order of the counters in the RayCounter block of the shaders
+const std::vector<std::string> rayTypeNameList = {"Primary", "Extension",
+                                                  "Shadow"};
+
+void printRayThroughput(const std::string &name, uint64_t rayCount,
+                        double traceMilliseconds) {
+  if (traceMilliseconds <= 0.0) {
+    return;
+  }
+
+  std::cout << name << " rays: " << rayCount / (traceMilliseconds * 1000.0)
+            << " Mrays/s" << std::endl;
+}
+#endif
+
+bool isDeviceExtensionSupported(VkPhysicalDevice physicalDeviceHandle,
+                                const char *extensionName) {
+  uint32_t extensionPropertyCount = 0;
+  VkResult result = vkEnumerateDeviceExtensionProperties(
+      physicalDeviceHandle, NULL, &extensionPropertyCount, NULL);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEnumerateDeviceExtensionProperties");
+  }
+
+  std::vector<VkExtensionProperties> extensionPropertiesList(
+      extensionPropertyCount);
+  result = vkEnumerateDeviceExtensionProperties(
+      physicalDeviceHandle, NULL, &extensionPropertyCount,
+      extensionPropertiesList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEnumerateDeviceExtensionProperties");
+  }
+
+  for (VkExtensionProperties &extensionProperties : extensionPropertiesList) {
+    if (strcmp(extensionProperties.extensionName, extensionName) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Device memory allocated by the example, by category. Allocations go through
+// allocateDeviceMemory, and memory released before shutdown goes through
+// freeDeviceMemory so the ledger stays current.
+struct MemoryAllocation {
+  VkDeviceMemory memoryHandle;
+  std::string category;
+  uint32_t heapIndex;
+  VkDeviceSize size;
+};
+
+struct MemoryLedger {
+  VkPhysicalDevice physicalDeviceHandle = VK_NULL_HANDLE;
+  bool isMemoryBudgetSupported = false;
+  std::vector<MemoryAllocation> allocationList;
+};
+
+double getMebibytes(VkDeviceSize size) { return size / (1024.0 * 1024.0); }
+
+VkDeviceSize getLedgerHeapSize(const MemoryLedger &memoryLedger,
+                               uint32_t heapIndex) {
+  VkDeviceSize heapSize = 0;
+  for (const MemoryAllocation &memoryAllocation :
+       memoryLedger.allocationList) {
+    if (memoryAllocation.heapIndex == heapIndex) {
+      heapSize += memoryAllocation.size;
+    }
+  }
+
+  return heapSize;
+}
+
+// Heap budgets and usage of the whole process from VK_EXT_memory_budget.
+// Without it the budget is the heap size and the usage is the ledger's.
+VkPhysicalDeviceMemoryBudgetPropertiesEXT
+getMemoryBudget(const MemoryLedger &memoryLedger,
+                VkPhysicalDeviceMemoryProperties &memoryProperties) {
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT memoryBudgetProperties = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+      .pNext = NULL};
+
+  VkPhysicalDeviceMemoryProperties2 memoryProperties2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+      .pNext = memoryLedger.isMemoryBudgetSupported ? &memoryBudgetProperties
+                                                    : NULL};
+
+  vkGetPhysicalDeviceMemoryProperties2(memoryLedger.physicalDeviceHandle,
+                                       &memoryProperties2);
+
+  memoryProperties = memoryProperties2.memoryProperties;
+
+  if (!memoryLedger.isMemoryBudgetSupported) {
+    for (uint32_t x = 0; x < memoryProperties.memoryHeapCount; x++) {
+      memoryBudgetProperties.heapBudget[x] =
+          memoryProperties.memoryHeaps[x].size;
+      memoryBudgetProperties.heapUsage[x] = getLedgerHeapSize(memoryLedger, x);
+    }
+  }
+
+  return memoryBudgetProperties;
+}
+
+void printMemoryReport(const std::string &name,
+                       const MemoryLedger &memoryLedger) {
+  std::cout << name << " memory:" << std::endl;
+
+  std::vector<std::string> categoryList;
+  for (const MemoryAllocation &memoryAllocation :
+       memoryLedger.allocationList) {
+    if (std::find(categoryList.begin(), categoryList.end(),
+                  memoryAllocation.category) == categoryList.end()) {
+      categoryList.push_back(memoryAllocation.category);
+    }
+  }
+
+  for (const std::string &category : categoryList) {
+    VkDeviceSize categorySize = 0;
+    uint32_t categoryAllocationCount = 0;
+    for (const MemoryAllocation &memoryAllocation :
+         memoryLedger.allocationList) {
+      if (memoryAllocation.category == category) {
+        categorySize += memoryAllocation.size;
+        categoryAllocationCount += 1;
+      }
+    }
+
+    std::cout << "  " << category << ": " << getMebibytes(categorySize)
+              << " MiB in " << categoryAllocationCount << " allocations"
+              << std::endl;
+  }
+
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT memoryBudgetProperties =
+      getMemoryBudget(memoryLedger, memoryProperties);
+
+  for (uint32_t x = 0; x < memoryProperties.memoryHeapCount; x++) {
+    VkDeviceSize ledgerHeapSize = getLedgerHeapSize(memoryLedger, x);
+    if (ledgerHeapSize == 0) {
+      continue;
+    }
+
+    VkDeviceSize heapBudget = memoryBudgetProperties.heapBudget[x];
+    VkDeviceSize heapUsage = memoryBudgetProperties.heapUsage[x];
+
+    std::cout << "  Heap " << x
+              << ((memoryProperties.memoryHeaps[x].flags &
+                   VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+                      ? " (device local): "
+                      : " (host): ")
+              << getMebibytes(ledgerHeapSize) << " MiB allocated, "
+              << getMebibytes(heapUsage) << " MiB used of "
+              << getMebibytes(heapBudget) << " MiB budget, "
+              << getMebibytes(heapBudget - std::min(heapUsage, heapBudget))
+              << " MiB headroom" << std::endl;
+  }
+}
+
+// Warns before an allocation that would exceed its heap's budget, where the
+// driver may start evicting or fail, and prints the report if it does fail
+VkResult allocateDeviceMemory(VkDevice deviceHandle,
+                              MemoryLedger &memoryLedger,
+                              const std::string &category,
+                              const VkMemoryAllocateInfo *memoryAllocateInfoPtr,
+                              VkDeviceMemory *memoryHandlePtr) {
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT memoryBudgetProperties =
+      getMemoryBudget(memoryLedger, memoryProperties);
+
+  uint32_t heapIndex = 0;
+  if (memoryAllocateInfoPtr->memoryTypeIndex <
+      memoryProperties.memoryTypeCount) {
+    heapIndex =
+        memoryProperties.memoryTypes[memoryAllocateInfoPtr->memoryTypeIndex]
+            .heapIndex;
+
+    VkDeviceSize heapBudget = memoryBudgetProperties.heapBudget[heapIndex];
+    VkDeviceSize heapUsage = memoryBudgetProperties.heapUsage[heapIndex];
+
+    if (heapUsage + memoryAllocateInfoPtr->allocationSize > heapBudget) {
+      std::cerr << "Warning: " << category << " allocation of "
+                << getMebibytes(memoryAllocateInfoPtr->allocationSize)
+                << " MiB exceeds the "
+                << getMebibytes(heapBudget - std::min(heapUsage, heapBudget))
+                << " MiB left in the budget of heap " << heapIndex
+                << std::endl;
+    }
+  }
+
+  VkResult result = vkAllocateMemory(deviceHandle, memoryAllocateInfoPtr, NULL,
+                                     memoryHandlePtr);
+
+  if (result == VK_SUCCESS) {
+    memoryLedger.allocationList.push_back(
+        {.memoryHandle = *memoryHandlePtr,
+         .category = category,
+         .heapIndex = heapIndex,
+         .size = memoryAllocateInfoPtr->allocationSize});
+  } else if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY ||
+             result == VK_ERROR_OUT_OF_HOST_MEMORY) {
+    printMemoryReport("Out of memory allocating " + category, memoryLedger);
+  }
+
+  return result;
+}
+
+void freeDeviceMemory(VkDevice deviceHandle, MemoryLedger &memoryLedger,
+                      VkDeviceMemory memoryHandle) {
+  for (uint32_t x = 0; x < memoryLedger.allocationList.size(); x++) {
+    if (memoryLedger.allocationList[x].memoryHandle == memoryHandle) {
+      memoryLedger.allocationList.erase(memoryLedger.allocationList.begin() +
+                                        x);
+      break;
+    }
+  }
+
+  vkFreeMemory(deviceHandle, memoryHandle, NULL);
+}
+
+// Order of the BUILD_PRESET values
+const std::vector<std::string> buildPresetNameList = {"default", "static",
+                                                      "dynamic", "refit"};
+
+VkBuildAccelerationStructureFlagsKHR getBuildPresetFlags(uint32_t buildPreset) {
+  switch (buildPreset) {
+  case BUILD_PRESET_STATIC:
+    return VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+           VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+  case BUILD_PRESET_DYNAMIC:
+    return VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR;
+  case BUILD_PRESET_REFIT:
+    return VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+  default:
+    return 0;
+  }
+}
+
+#if defined(HEATMAP_ENABLED)
+// Order of the channels written to heatmapImage by the ray generation shader
+const std::vector<std::string> heatmapNameList = {"bounces", "shadow_rays",
+                                                  "clock"};
+
+// Writes one channel of an RGBA32UI heatmap as heatmap_<name>.png, colored
+// from blue at zero through green to red at the channel's maximum. Channels
+// that are zero everywhere, such as the clock without VK_KHR_shader_clock,
+// are skipped.
+void writeHeatmapImage(const uint32_t *heatmapBuffer, uint32_t channel,
+                       uint32_t width, uint32_t height) {
+  uint32_t maxValue = 0;
+  for (uint32_t x = 0; x < width * height; x++) {
+    maxValue = std::max(maxValue, heatmapBuffer[x * 4 + channel]);
+  }
+
+  if (maxValue == 0) {
+    return;
+  }
+
+  std::vector<uint8_t> colorBuffer(width * height * 4);
+  for (uint32_t x = 0; x < width * height; x++) {
+    float value = (float)heatmapBuffer[x * 4 + channel] / maxValue;
+
+    colorBuffer[x * 4 + 0] =
+        (uint8_t)(255.0f * std::clamp(2.0f * value - 1.0f, 0.0f, 1.0f));
+    colorBuffer[x * 4 + 1] =
+        (uint8_t)(255.0f * std::min(2.0f * value, 2.0f - 2.0f * value));
+    colorBuffer[x * 4 + 2] =
+        (uint8_t)(255.0f * std::clamp(1.0f - 2.0f * value, 0.0f, 1.0f));
+    colorBuffer[x * 4 + 3] = 255;
+  }
+
+  std::string fileName = "heatmap_" + heatmapNameList[channel] + ".png";
+  stbi_write_png(fileName.c_str(), width, height, 4, colorBuffer.data(),
+                 4 * width);
+
+  std::cout << fileName << ": " << heatmapNameList[channel] << " max "
+            << maxValue << std::endl;
+}
+#endif
+
+// Magic ("RTSC") and version at the start of the scene cache, see loadScene
+#define SCENE_CACHE_MAGIC 0x43535452
+#define SCENE_CACHE_VERSION 3
+
+// Sections of the scene cache start on this boundary, so a mapped section can
+// be copied into a mapped buffer without realignment
+#define SCENE_CACHE_ALIGNMENT 256
+
+// OBJ files are parsed in line aligned chunks of about this many bytes
+#define OBJ_CHUNK_SIZE (16 * 1024 * 1024)
+
+// Vertices in the same grid cell of this size are welded into one when the
+// cache is written. Zero welds only vertices at exactly the same position.
+#if !defined(SCENE_WELD_EPSILON)
+#define SCENE_WELD_EPSILON 0.0f
+#endif
+
+// Layout of the device vertex buffer. Quantized positions are four signed
+// normalized 16 bit values each, the last unused, and follow the row major
+// 3x4 transform decoding them.
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+#define SCENE_VERTEX_FORMAT VK_FORMAT_R16G16B16A16_SNORM
+#define SCENE_VERTEX_STRIDE (sizeof(int16_t) * 4)
+#define SCENE_VERTEX_DATA_OFFSET (sizeof(float) * 12)
+#else
+#define SCENE_VERTEX_FORMAT VK_FORMAT_R32G32B32_SFLOAT
+#define SCENE_VERTEX_STRIDE (sizeof(float) * 3)
+#define SCENE_VERTEX_DATA_OFFSET 0
+#endif
+
+// Vertices quantized by one task
+#define QUANTIZATION_TASK_VERTEX_COUNT (1024 * 1024)
+
+// Triangles per bottom level acceleration structure when the scene is split
+// into spatial clusters
+#if !defined(SCENE_CLUSTER_PRIMITIVE_COUNT)
+#define SCENE_CLUSTER_PRIMITIVE_COUNT (64 * 1024)
+#endif
+
+// Triangles given a Morton code by one clustering task
+#define CLUSTERING_TASK_PRIMITIVE_COUNT (1024 * 1024)
+
+struct Material {
+  float ambient[4] = {0, 0, 0, 0};
+  float diffuse[4] = {0, 0, 0, 0};
+  float specular[4] = {0, 0, 0, 0};
+  float emission[4] = {0, 0, 0, 0};
+};
+
+// Offsets are in bytes from the start of the file, counts in elements. The
+// source size and write time identify the OBJ the cache was generated from,
+// and weldEpsilon the SCENE_WELD_EPSILON its vertices were welded with.
+// Indices are indexSize (2 or 4) bytes each.
+struct SceneCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceFileSize;
+  int64_t sourceWriteTime;
+  double weldEpsilon;
+  uint64_t fileSize;
+  uint64_t vertexCount;
+  uint64_t vertexOffset;
+  uint64_t indexCount;
+  uint64_t indexSize;
+  uint64_t indexOffset;
+  uint64_t primitiveCount;
+  uint64_t materialIndexOffset;
+  uint64_t materialCount;
+  uint64_t materialOffset;
+};
+
+// Vertices and triangles written by one parse task
+struct SceneRange {
+  uint64_t vertexOffset;
+  uint64_t vertexCount;
+  uint64_t primitiveOffset;
+  uint64_t primitiveCount;
+};
+
+// Vertex positions (three floats each), triangle indices, one material index
+// per triangle and the materials, laid out as the device buffers expect them.
+// Indices are 16 bit when indexSize is 2, 32 bit otherwise. The data pointers
+// point into the mapped cache, or into the lists when the cache cannot be
+// written.
+struct Scene {
+  uint64_t vertexCount = 0;
+  const float *vertexData = NULL;
+  uint64_t indexCount = 0;
+  uint32_t indexSize = sizeof(uint32_t);
+  const void *indexData = NULL;
+  uint64_t primitiveCount = 0;
+  const uint32_t *materialIndexData = NULL;
+  uint64_t materialCount = 0;
+  const Material *materialData = NULL;
+
+  std::vector<float> vertexList;
+  std::vector<uint32_t> indexList;
+  std::vector<uint32_t> materialIndexList;
+  std::vector<Material> materialList;
+
+  void *mappedFileBuffer = NULL;
+  uint64_t mappedFileSize = 0;
+
+  // The unoptimized scene a first run renders is parsed into this file,
+  // deleted by unloadScene
+  std::string temporaryFileName;
+
+  // Quantized positions in the SCENE_VERTEX_FORMAT layout and the transform
+  // decoding them, set once isQuantized is. Only built with
+  // VERTEX_QUANTIZATION_ENABLED.
+  std::vector<int16_t> quantizedVertexList;
+  float quantizationTransform[3][4] = {};
+  bool isQuantized = false;
+
+  // The triangles sorted along a Morton curve through their centroids, as
+  // indices (indexSize each) and as scene primitive indices. Every
+  // SCENE_CLUSTER_PRIMITIVE_COUNT of them form one cluster. Set once
+  // isClustered is. Only built with BLAS_CLUSTERING_ENABLED.
+  std::vector<uint32_t> clusterIndexList;
+  std::vector<uint32_t> clusterPrimitiveIndexList;
+  uint64_t clusterCount = 0;
+  bool isClustered = false;
+
+  // Lets other threads upload the scene while it is parsed. The counts, the
+  // materials and rangeList are set once isSizeKnown is, the data of each
+  // range once it is marked ready. isLoadFailed wakes every wait to throw.
+  std::mutex mutex;
+  std::condition_variable conditionVariable;
+  bool isSizeKnown = false;
+  bool isLoadFailed = false;
+  std::vector<SceneRange> rangeList;
+  std::vector<bool> isRangeReadyList;
+};
+
+uint64_t alignSceneCacheOffset(uint64_t offset) {
+  return (offset + SCENE_CACHE_ALIGNMENT - 1) &
+         ~(uint64_t)(SCENE_CACHE_ALIGNMENT - 1);
+}
+
+// Indices are 16 bit when every vertex can be addressed with them
+uint32_t getSceneIndexSize(uint64_t vertexCount) {
+  return vertexCount <= 0x10000 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+uint32_t getSceneIndex(const void *indexData, uint32_t indexSize,
+                       uint64_t position) {
+  return indexSize == sizeof(uint16_t)
+             ? ((const uint16_t *)indexData)[position]
+             : ((const uint32_t *)indexData)[position];
+}
+
+void setSceneIndex(void *indexData, uint32_t indexSize, uint64_t position,
+                   uint32_t index) {
+  if (indexSize == sizeof(uint16_t)) {
+    ((uint16_t *)indexData)[position] = index;
+  } else {
+    ((uint32_t *)indexData)[position] = index;
+  }
+}
+
+uint64_t getSceneVertexBufferSize(const Scene &scene) {
+  return SCENE_VERTEX_DATA_OFFSET + SCENE_VERTEX_STRIDE * scene.vertexCount;
+}
+
+// Size of the indices, padded to whole 32 bit words for the shaders that read
+// 16 bit indices in pairs
+uint64_t getSceneIndexDataSize(const Scene &scene) {
+  return (scene.indexSize * scene.indexCount + 3) / 4 * 4;
+}
+
+// With BLAS_CLUSTERING_ENABLED the index buffer continues with the cluster
+// indices and then the scene primitive index of each clustered triangle
+uint64_t getSceneIndexBufferSize(const Scene &scene) {
+#if defined(BLAS_CLUSTERING_ENABLED)
+  return 2 * getSceneIndexDataSize(scene) +
+         sizeof(uint32_t) * scene.primitiveCount;
+#else
+  return getSceneIndexDataSize(scene);
+#endif
+}
+
+// Maps a whole file read only, returns NULL if it cannot be mapped
+void *mapFile(const std::string &fileName, uint64_t &fileSize) {
+  void *fileBuffer = NULL;
+
+#if defined(_WIN32)
+  HANDLE fileHandle =
+      CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (fileHandle == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  LARGE_INTEGER largeFileSize;
+  HANDLE fileMappingHandle = NULL;
+  if (GetFileSizeEx(fileHandle, &largeFileSize) &&
+      largeFileSize.QuadPart > 0) {
+    fileSize = largeFileSize.QuadPart;
+    fileMappingHandle =
+        CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+  }
+
+  // The view keeps the mapping alive after both handles are closed
+  if (fileMappingHandle != NULL) {
+    fileBuffer = MapViewOfFile(fileMappingHandle, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(fileMappingHandle);
+  }
+  CloseHandle(fileHandle);
+#else
+  int fileDescriptor = open(fileName.c_str(), O_RDONLY);
+  if (fileDescriptor == -1) {
+    return NULL;
+  }
+
+  struct stat fileStat;
+  if (fstat(fileDescriptor, &fileStat) == 0 && fileStat.st_size > 0) {
+    fileSize = fileStat.st_size;
+    fileBuffer = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE,
+                      fileDescriptor, 0);
+
+    if (fileBuffer == MAP_FAILED) {
+      fileBuffer = NULL;
+    } else {
+      madvise(fileBuffer, fileSize, MADV_SEQUENTIAL);
+    }
+  }
+  close(fileDescriptor);
+#endif
+
+  return fileBuffer;
+}
+
+void unmapFile(void *fileBuffer, uint64_t fileSize) {
+#if defined(_WIN32)
+  UnmapViewOfFile(fileBuffer);
+#else
+  munmap(fileBuffer, fileSize);
+#endif
+}
+
+// Creates a file of fileSize bytes, replacing any existing one, and maps it
+// for writing. Returns NULL if it cannot be created.
+void *createMappedFile(const std::string &fileName, uint64_t fileSize) {
+  void *fileBuffer = NULL;
+
+#if defined(_WIN32)
+  HANDLE fileHandle =
+      CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                  CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (fileHandle == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  HANDLE fileMappingHandle =
+      CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE,
+                         (DWORD)(fileSize >> 32), (DWORD)fileSize, NULL);
+  if (fileMappingHandle != NULL) {
+    fileBuffer = MapViewOfFile(fileMappingHandle, FILE_MAP_WRITE, 0, 0, 0);
+    CloseHandle(fileMappingHandle);
+  }
+  CloseHandle(fileHandle);
+#else
+  int fileDescriptor =
+      open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fileDescriptor == -1) {
+    return NULL;
+  }
+
+  if (ftruncate(fileDescriptor, fileSize) == 0) {
+    fileBuffer = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fileDescriptor, 0);
+
+    if (fileBuffer == MAP_FAILED) {
+      fileBuffer = NULL;
+    }
+  }
+  close(fileDescriptor);
+#endif
+
+  return fileBuffer;
+}
+
+// Maps the cache and points the scene at its sections. Returns false, leaving
+// the scene empty, when the cache is missing, was generated from a different
+// OBJ or with a different SCENE_WELD_EPSILON, or is truncated.
+bool loadSceneCache(const std::string &cacheFileName, uint64_t sourceFileSize,
+                    int64_t sourceWriteTime, Scene &scene) {
+  uint64_t fileSize = 0;
+  void *fileBuffer = mapFile(cacheFileName, fileSize);
+  if (fileBuffer == NULL) {
+    return false;
+  }
+
+  SceneCacheHeader header = {};
+  if (fileSize >= sizeof(SceneCacheHeader)) {
+    memcpy(&header, fileBuffer, sizeof(SceneCacheHeader));
+  }
+
+  auto isSectionInFile = [&](uint64_t offset, uint64_t count,
+                             uint64_t elementSize) {
+    return offset % SCENE_CACHE_ALIGNMENT == 0 && offset <= fileSize &&
+           count <= (fileSize - offset) / elementSize;
+  };
+
+  if (header.magic != SCENE_CACHE_MAGIC ||
+      header.version != SCENE_CACHE_VERSION ||
+      (header.indexSize != sizeof(uint16_t) &&
+       header.indexSize != sizeof(uint32_t)) ||
+      header.sourceFileSize != sourceFileSize ||
+      header.sourceWriteTime != sourceWriteTime ||
+      header.weldEpsilon != (double)SCENE_WELD_EPSILON ||
+      header.fileSize != fileSize ||
+      !isSectionInFile(header.vertexOffset, header.vertexCount,
+                       sizeof(float) * 3) ||
+      !isSectionInFile(header.indexOffset, header.indexCount,
+                       header.indexSize) ||
+      !isSectionInFile(header.materialIndexOffset, header.primitiveCount,
+                       sizeof(uint32_t)) ||
+      !isSectionInFile(header.materialOffset, header.materialCount,
+                       sizeof(Material))) {
+    unmapFile(fileBuffer, fileSize);
+    return false;
+  }
+
+  const char *cacheBuffer = (const char *)fileBuffer;
+
+  scene.vertexCount = header.vertexCount;
+  scene.vertexData = (const float *)(cacheBuffer + header.vertexOffset);
+  scene.indexCount = header.indexCount;
+  scene.indexSize = header.indexSize;
+  scene.indexData = cacheBuffer + header.indexOffset;
+  scene.primitiveCount = header.primitiveCount;
+  scene.materialIndexData =
+      (const uint32_t *)(cacheBuffer + header.materialIndexOffset);
+  scene.materialCount = header.materialCount;
+  scene.materialData = (const Material *)(cacheBuffer + header.materialOffset);
+
+  scene.mappedFileBuffer = fileBuffer;
+  scene.mappedFileSize = fileSize;
+
+  return true;
+}
+
+// Lays out the sections of a cache for the given counts
+SceneCacheHeader getSceneCacheHeader(uint64_t sourceFileSize,
+                                     int64_t sourceWriteTime,
+                                     uint64_t vertexCount,
+                                     uint32_t indexSize,
+                                     uint64_t primitiveCount,
+                                     uint64_t materialCount) {
+  SceneCacheHeader header = {
+      .magic = SCENE_CACHE_MAGIC,
+      .version = SCENE_CACHE_VERSION,
+      .sourceFileSize = sourceFileSize,
+      .sourceWriteTime = sourceWriteTime,
+      .weldEpsilon = SCENE_WELD_EPSILON,
+      .fileSize = 0,
+      .vertexCount = vertexCount,
+      .vertexOffset = alignSceneCacheOffset(sizeof(SceneCacheHeader)),
+      .indexCount = primitiveCount * 3,
+      .indexSize = indexSize,
+      .indexOffset = 0,
+      .primitiveCount = primitiveCount,
+      .materialIndexOffset = 0,
+      .materialCount = materialCount,
+      .materialOffset = 0};
+
+  header.indexOffset = alignSceneCacheOffset(
+      header.vertexOffset + sizeof(float) * 3 * header.vertexCount);
+  header.materialIndexOffset = alignSceneCacheOffset(
+      header.indexOffset + header.indexSize * header.indexCount);
+  header.materialOffset = alignSceneCacheOffset(
+      header.materialIndexOffset + sizeof(uint32_t) * header.primitiveCount);
+  header.fileSize =
+      header.materialOffset + sizeof(Material) * header.materialCount;
+
+  return header;
+}
+
+// Runs taskFunction for every task index on up to one thread per hardware
+// thread, each thread claiming the next task that has not started. Returns
+// the number of threads used.
+uint32_t runTasksInParallel(uint32_t taskCount,
+                            const std::function<void(uint32_t)> &taskFunction) {
+  std::atomic<uint32_t> nextTaskIndex = 0;
+
+  auto workerFunction = [&]() {
+    for (uint32_t taskIndex = nextTaskIndex++; taskIndex < taskCount;
+         taskIndex = nextTaskIndex++) {
+      taskFunction(taskIndex);
+    }
+  };
+
+  uint32_t threadCount =
+      std::min(std::max(std::thread::hardware_concurrency(), 1u), taskCount);
+
+  std::vector<std::thread> threadList;
+  for (uint32_t x = 1; x < threadCount; x++) {
+    threadList.emplace_back(workerFunction);
+  }
+
+  workerFunction();
+
+  for (std::thread &thread : threadList) {
+    thread.join();
+  }
+
+  return threadCount;
+}
+
+// One line aligned range of an OBJ file. The first pass counts what the
+// range contains, so the second pass can write it straight to its offsets in
+// the scene lists.
+struct OBJChunk {
+  const char *begin;
+  const char *end;
+
+  uint64_t vertexCount = 0;
+  uint64_t primitiveCount = 0;
+  std::vector<std::string> materialLibraryList;
+  std::string lastMaterialName;
+  bool isMaterialNameSet = false;
+
+  uint64_t vertexOffset = 0;
+  uint64_t primitiveOffset = 0;
+  uint32_t initialMaterialIndex = -1;
+};
+
+// Returns the next whitespace separated token before lineEnd and moves
+// linePosition past it. The token is empty at the end of the line.
+std::string_view getOBJToken(const char *&linePosition, const char *lineEnd) {
+  while (linePosition < lineEnd &&
+         (*linePosition == ' ' || *linePosition == '\t' ||
+          *linePosition == '\r')) {
+    linePosition++;
+  }
+
+  const char *tokenBegin = linePosition;
+  while (linePosition < lineEnd && *linePosition != ' ' &&
+         *linePosition != '\t' && *linePosition != '\r') {
+    linePosition++;
+  }
+
+  return std::string_view(tokenBegin, linePosition - tokenBegin);
+}
+
+// Calls lineFunction with the keyword of every line in the chunk and the
+// position after it
+void forEachOBJLine(const OBJChunk &chunk,
+                    const std::function<void(std::string_view, const char *,
+                                             const char *)> &lineFunction) {
+  const char *lineBegin = chunk.begin;
+  while (lineBegin < chunk.end) {
+    const char *lineEnd =
+        (const char *)memchr(lineBegin, '\n', chunk.end - lineBegin);
+    if (lineEnd == NULL) {
+      lineEnd = chunk.end;
+    }
+
+    const char *linePosition = lineBegin;
+    std::string_view keyword = getOBJToken(linePosition, lineEnd);
+    if (!keyword.empty() && keyword[0] != '#') {
+      lineFunction(keyword, linePosition, lineEnd);
+    }
+
+    lineBegin = lineEnd + 1;
+  }
+}
+
+// Parses the OBJ in line aligned chunks of OBJ_CHUNK_SIZE on every hardware
+// thread, straight into the sections of a temporary file laid out like the
+// cache. Only positions, faces, usemtl and mtllib are read. Polygons are split
+// into triangle fans. Materials are read with tinyobj::LoadMtl.
+void parseSceneOBJ(const std::string &objFileName,
+                   const std::string &temporaryFileName, Scene &scene) {
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+
+  uint64_t fileSize = 0;
+  const char *fileBuffer = (const char *)mapFile(objFileName, fileSize);
+  if (fileBuffer == NULL) {
+    throw std::runtime_error("OBJ: could not open " + objFileName);
+  }
+
+  std::vector<OBJChunk> chunkList;
+  for (uint64_t chunkBegin = 0; chunkBegin < fileSize;) {
+    uint64_t chunkEnd = std::min(chunkBegin + OBJ_CHUNK_SIZE, fileSize);
+    while (chunkEnd < fileSize && fileBuffer[chunkEnd - 1] != '\n') {
+      chunkEnd++;
+    }
+
+    chunkList.push_back(
+        {.begin = fileBuffer + chunkBegin, .end = fileBuffer + chunkEnd});
+    chunkBegin = chunkEnd;
+  }
+
+  // Count every chunk's vertices and triangles
+  runTasksInParallel(chunkList.size(), [&](uint32_t chunkIndex) {
+    OBJChunk &chunk = chunkList[chunkIndex];
+
+    forEachOBJLine(chunk, [&](std::string_view keyword,
+                              const char *linePosition, const char *lineEnd) {
+      if (keyword == "v") {
+        chunk.vertexCount += 1;
+      } else if (keyword == "f") {
+        uint32_t faceVertexCount = 0;
+        while (!getOBJToken(linePosition, lineEnd).empty()) {
+          faceVertexCount += 1;
+        }
+
+        if (faceVertexCount >= 3) {
+          chunk.primitiveCount += faceVertexCount - 2;
+        }
+      } else if (keyword == "usemtl") {
+        chunk.lastMaterialName = getOBJToken(linePosition, lineEnd);
+        chunk.isMaterialNameSet = true;
+      } else if (keyword == "mtllib") {
+        for (std::string_view token = getOBJToken(linePosition, lineEnd);
+             !token.empty(); token = getOBJToken(linePosition, lineEnd)) {
+          chunk.materialLibraryList.push_back(std::string(token));
+        }
+      }
+    });
+  });
+
+  std::map<std::string, int> materialMap;
+  std::vector<tinyobj::material_t> materials;
+  std::vector<std::string> loadedMaterialLibraryList;
+
+  uint64_t vertexCount = 0;
+  uint64_t primitiveCount = 0;
+  for (OBJChunk &chunk : chunkList) {
+    chunk.vertexOffset = vertexCount;
+    chunk.primitiveOffset = primitiveCount;
+    vertexCount += chunk.vertexCount;
+    primitiveCount += chunk.primitiveCount;
+
+    for (const std::string &materialLibrary : chunk.materialLibraryList) {
+      if (std::find(loadedMaterialLibraryList.begin(),
+                    loadedMaterialLibraryList.end(),
+                    materialLibrary) != loadedMaterialLibraryList.end()) {
+        continue;
+      }
+      loadedMaterialLibraryList.push_back(materialLibrary);
+
+      std::ifstream materialFile(
+          std::filesystem::path(objFileName).parent_path() / materialLibrary);
+      if (!materialFile.is_open()) {
+        std::cout << "OBJ: could not open " << materialLibrary << std::endl;
+        continue;
+      }
+
+      std::string warning;
+      std::string error;
+      tinyobj::LoadMtl(&materialMap, &materials, &materialFile, &warning,
+                       &error);
+
+      if (!warning.empty()) {
+        std::cout << "TinyObjReader: " << warning;
+      }
+      if (!error.empty()) {
+        std::cerr << "TinyObjReader: " << error;
+      }
+    }
+  }
+
+  auto getMaterialIndex = [&](std::string_view materialName) {
+    auto materialIterator = materialMap.find(std::string(materialName));
+    return materialIterator == materialMap.end()
+               ? (uint32_t)-1
+               : (uint32_t)materialIterator->second;
+  };
+
+  // A chunk starts with the material of the last usemtl before it
+  uint32_t materialIndex = -1;
+  for (OBJChunk &chunk : chunkList) {
+    chunk.initialMaterialIndex = materialIndex;
+    if (chunk.isMaterialNameSet) {
+      materialIndex = getMaterialIndex(chunk.lastMaterialName);
+    }
+  }
+
+  std::vector<Material> materialList(materials.size());
+  for (uint32_t x = 0; x < materials.size(); x++) {
+    memcpy(materialList[x].ambient, materials[x].ambient, sizeof(float) * 3);
+    memcpy(materialList[x].diffuse, materials[x].diffuse, sizeof(float) * 3);
+    memcpy(materialList[x].specular, materials[x].specular, sizeof(float) * 3);
+    memcpy(materialList[x].emission, materials[x].emission, sizeof(float) * 3);
+  }
+
+  uint32_t indexSize = getSceneIndexSize(vertexCount);
+  SceneCacheHeader header = getSceneCacheHeader(
+      0, 0, vertexCount, indexSize, primitiveCount, materialList.size());
+
+  char *cacheBuffer =
+      (char *)createMappedFile(temporaryFileName, header.fileSize);
+
+  float *vertexData = NULL;
+  void *indexData = NULL;
+  uint32_t *materialIndexData = NULL;
+  Material *materialData = NULL;
+
+  if (cacheBuffer != NULL) {
+    vertexData = (float *)(cacheBuffer + header.vertexOffset);
+    indexData = cacheBuffer + header.indexOffset;
+    materialIndexData = (uint32_t *)(cacheBuffer + header.materialIndexOffset);
+    materialData = (Material *)(cacheBuffer + header.materialOffset);
+
+    memcpy(materialData, materialList.data(),
+           sizeof(Material) * materialList.size());
+  } else {
+    std::cerr << "Scene cache: could not write " << temporaryFileName
+              << std::endl;
+
+    scene.vertexList.resize(vertexCount * 3);
+    scene.indexList.resize((indexSize * primitiveCount * 3 + 3) / 4);
+    scene.materialIndexList.resize(primitiveCount);
+    scene.materialList = materialList;
+
+    vertexData = scene.vertexList.data();
+    indexData = scene.indexList.data();
+    materialIndexData = scene.materialIndexList.data();
+    materialData = scene.materialList.data();
+  }
+
+  {
+    std::lock_guard<std::mutex> sceneLock(scene.mutex);
+
+    scene.vertexCount = vertexCount;
+    scene.vertexData = vertexData;
+    scene.indexCount = primitiveCount * 3;
+    scene.indexSize = indexSize;
+    scene.indexData = indexData;
+    scene.primitiveCount = primitiveCount;
+    scene.materialIndexData = materialIndexData;
+    scene.materialCount = materialList.size();
+    scene.materialData = materialData;
+
+    scene.mappedFileBuffer = cacheBuffer;
+    scene.mappedFileSize = header.fileSize;
+    if (cacheBuffer != NULL) {
+      scene.temporaryFileName = temporaryFileName;
+    }
+
+    for (const OBJChunk &chunk : chunkList) {
+      scene.rangeList.push_back({.vertexOffset = chunk.vertexOffset,
+                                 .vertexCount = chunk.vertexCount,
+                                 .primitiveOffset = chunk.primitiveOffset,
+                                 .primitiveCount = chunk.primitiveCount});
+    }
+    scene.isRangeReadyList.resize(chunkList.size(), false);
+    scene.isSizeKnown = true;
+  }
+  scene.conditionVariable.notify_all();
+
+  std::atomic<bool> isFaceInvalid = false;
+  std::atomic<uint64_t> parsedByteCount = 0;
+  std::atomic<uint32_t> printedPercent = 0;
+
+  // Parse every chunk into its range of the scene
+  uint32_t threadCount =
+      runTasksInParallel(chunkList.size(), [&](uint32_t chunkIndex) {
+        const OBJChunk &chunk = chunkList[chunkIndex];
+
+        float *chunkVertexData = vertexData + chunk.vertexOffset * 3;
+        uint64_t chunkIndexPosition = chunk.primitiveOffset * 3;
+        uint32_t *chunkMaterialIndexData =
+            materialIndexData + chunk.primitiveOffset;
+
+        uint64_t chunkVertexCount = 0;
+        uint32_t chunkMaterialIndex = chunk.initialMaterialIndex;
+        std::vector<uint32_t> faceIndexList;
+        bool isChunkFaceInvalid = false;
+
+        forEachOBJLine(chunk, [&](std::string_view keyword,
+                                  const char *linePosition,
+                                  const char *lineEnd) {
+          if (keyword == "v") {
+            for (uint32_t x = 0; x < 3; x++) {
+              std::string_view token = getOBJToken(linePosition, lineEnd);
+              if (!token.empty() && token[0] == '+') {
+                token.remove_prefix(1);
+              }
+
+              float value = 0.0f;
+              std::from_chars(token.data(), token.data() + token.size(),
+                              value);
+              chunkVertexData[chunkVertexCount * 3 + x] = value;
+            }
+
+            chunkVertexCount += 1;
+          } else if (keyword == "f") {
+            faceIndexList.clear();
+            for (std::string_view token = getOBJToken(linePosition, lineEnd);
+                 !token.empty(); token = getOBJToken(linePosition, lineEnd)) {
+
+              // Positive indices count from one, negative ones back from
+              // the last vertex read
+              int64_t index = 0;
+              std::from_chars(token.data(), token.data() + token.size(),
+                              index);
+              if (index < 0) {
+                index += chunk.vertexOffset + chunkVertexCount;
+              } else {
+                index -= 1;
+              }
+
+              if (index < 0 || index >= (int64_t)vertexCount) {
+                isChunkFaceInvalid = true;
+                index = 0;
+              }
+
+              faceIndexList.push_back(index);
+            }
+
+            for (uint32_t x = 2; x < faceIndexList.size(); x++) {
+              setSceneIndex(indexData, indexSize, chunkIndexPosition++,
+                            faceIndexList[0]);
+              setSceneIndex(indexData, indexSize, chunkIndexPosition++,
+                            faceIndexList[x - 1]);
+              setSceneIndex(indexData, indexSize, chunkIndexPosition++,
+                            faceIndexList[x]);
+
+              *chunkMaterialIndexData++ = chunkMaterialIndex;
+            }
+          } else if (keyword == "usemtl") {
+            chunkMaterialIndex =
+                getMaterialIndex(getOBJToken(linePosition, lineEnd));
+          }
+        });
+
+        // An invalid range is never marked ready, so no device uploads it
+        if (isChunkFaceInvalid) {
+          isFaceInvalid = true;
+          return;
+        }
+
+        {
+          std::lock_guard<std::mutex> sceneLock(scene.mutex);
+          scene.isRangeReadyList[chunkIndex] = true;
+        }
+        scene.conditionVariable.notify_all();
+
+        uint64_t chunkSize = chunk.end - chunk.begin;
+        uint32_t percent =
+            (parsedByteCount += chunkSize) * 10 / fileSize * 10;
+        uint32_t previousPercent = printedPercent;
+
+        if (chunkList.size() > 1 && percent > previousPercent &&
+            printedPercent.compare_exchange_strong(previousPercent, percent)) {
+          std::cout << "OBJ: " << percent << "%" << std::endl;
+        }
+      });
+
+  unmapFile((void *)fileBuffer, fileSize);
+
+  if (isFaceInvalid) {
+    throw std::runtime_error("OBJ: face with invalid vertex index in " +
+                             objFileName);
+  }
+
+  double parseMilliseconds = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() -
+                                 startTimePoint)
+                                 .count();
+
+  std::cout << "OBJ: " << fileSize / (1024.0 * 1024.0) << " MiB in "
+            << parseMilliseconds << " ms ("
+            << fileSize / (1024.0 * 1024.0) / (parseMilliseconds / 1000.0)
+            << " MiB/s) on " << threadCount << " threads" << std::endl;
+}
+
+// Welds the vertices of each SCENE_WELD_EPSILON grid cell, or at each exact
+// position, into the first of them, drops vertices no triangle uses and
+// numbers the rest in the order the triangles first use them, so the vertices
+// of nearby triangles are stored together. Triangles keep their order, as the
+// shaders and the material indices address them by primitive index. The
+// result is written to the cache with 16 bit indices when the remaining
+// vertices allow. The header is written last, so a cache left incomplete is
+// never loaded.
+void writeOptimizedSceneCache(const std::string &cacheFileName,
+                              uint64_t sourceFileSize, int64_t sourceWriteTime,
+                              const Scene &scene) {
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+
+  // Grid cells, or the bits of each coordinate with -0 folded into 0
+  std::vector<std::array<int64_t, 3>> weldKeyList(scene.vertexCount);
+  std::vector<uint32_t> sortedVertexIndexList(scene.vertexCount);
+  for (uint64_t x = 0; x < scene.vertexCount; x++) {
+    for (uint32_t y = 0; y < 3; y++) {
+      float value = scene.vertexData[x * 3 + y] + 0.0f;
+
+      if (SCENE_WELD_EPSILON > 0.0f) {
+        weldKeyList[x][y] = (int64_t)std::floor(value / SCENE_WELD_EPSILON);
+      } else {
+        uint32_t valueBits;
+        memcpy(&valueBits, &value, sizeof(float));
+        weldKeyList[x][y] = valueBits;
+      }
+    }
+    sortedVertexIndexList[x] = x;
+  }
+
+  std::sort(sortedVertexIndexList.begin(), sortedVertexIndexList.end(),
+            [&](uint32_t vertexIndexA, uint32_t vertexIndexB) {
+              if (weldKeyList[vertexIndexA] != weldKeyList[vertexIndexB]) {
+                return weldKeyList[vertexIndexA] < weldKeyList[vertexIndexB];
+              }
+              return vertexIndexA < vertexIndexB;
+            });
+
+  std::vector<uint32_t> weldedVertexIndexList(scene.vertexCount);
+  for (uint64_t x = 0; x < scene.vertexCount; x++) {
+    uint32_t vertexIndex = sortedVertexIndexList[x];
+    weldedVertexIndexList[vertexIndex] = vertexIndex;
+
+    if (x > 0) {
+      uint32_t previousVertexIndex = sortedVertexIndexList[x - 1];
+      if (weldKeyList[vertexIndex] == weldKeyList[previousVertexIndex]) {
+        weldedVertexIndexList[vertexIndex] =
+            weldedVertexIndexList[previousVertexIndex];
+      }
+    }
+  }
+
+  // Old index of every new vertex and new index of every old one
+  std::vector<uint32_t> sourceVertexIndexList;
+  std::vector<uint32_t> remappedVertexIndexList(scene.vertexCount, -1);
+  for (uint64_t x = 0; x < scene.indexCount; x++) {
+    uint32_t vertexIndex = weldedVertexIndexList[getSceneIndex(
+        scene.indexData, scene.indexSize, x)];
+
+    if (remappedVertexIndexList[vertexIndex] == (uint32_t)-1) {
+      remappedVertexIndexList[vertexIndex] = sourceVertexIndexList.size();
+      sourceVertexIndexList.push_back(vertexIndex);
+    }
+  }
+
+  uint32_t indexSize = getSceneIndexSize(sourceVertexIndexList.size());
+  SceneCacheHeader header = getSceneCacheHeader(
+      sourceFileSize, sourceWriteTime, sourceVertexIndexList.size(),
+      indexSize, scene.primitiveCount, scene.materialCount);
+
+  char *cacheBuffer = (char *)createMappedFile(cacheFileName, header.fileSize);
+  if (cacheBuffer == NULL) {
+    std::cerr << "Scene cache: could not write " << cacheFileName
+              << std::endl;
+    return;
+  }
+
+  float *vertexData = (float *)(cacheBuffer + header.vertexOffset);
+  for (uint64_t x = 0; x < sourceVertexIndexList.size(); x++) {
+    memcpy(vertexData + x * 3,
+           scene.vertexData + (uint64_t)sourceVertexIndexList[x] * 3,
+           sizeof(float) * 3);
+  }
+
+  void *indexData = cacheBuffer + header.indexOffset;
+  for (uint64_t x = 0; x < scene.indexCount; x++) {
+    uint32_t vertexIndex = weldedVertexIndexList[getSceneIndex(
+        scene.indexData, scene.indexSize, x)];
+    setSceneIndex(indexData, indexSize, x,
+                  remappedVertexIndexList[vertexIndex]);
+  }
+
+  memcpy(cacheBuffer + header.materialIndexOffset, scene.materialIndexData,
+         sizeof(uint32_t) * scene.primitiveCount);
+  memcpy(cacheBuffer + header.materialOffset, scene.materialData,
+         sizeof(Material) * scene.materialCount);
+  memcpy(cacheBuffer, &header, sizeof(SceneCacheHeader));
+
+  unmapFile(cacheBuffer, header.fileSize);
+
+  double optimizeMilliseconds = std::chrono::duration<double, std::milli>(
+                                    std::chrono::steady_clock::now() -
+                                    startTimePoint)
+                                    .count();
+
+  std::cout << "Scene cache: " << scene.vertexCount << " vertices welded to "
+            << sourceVertexIndexList.size() << ", " << 8 * indexSize
+            << " bit indices, in " << optimizeMilliseconds << " ms"
+            << std::endl;
+}
+
+// Quantizes the positions relative to the scene bounds and reports how far
+// the decoded positions are from the float ones
+void quantizeSceneVertices(Scene &scene) {
+  float boundsMin[3] = {0.0f, 0.0f, 0.0f};
+  float boundsMax[3] = {0.0f, 0.0f, 0.0f};
+  for (uint64_t x = 0; x < scene.vertexCount; x++) {
+    for (uint32_t y = 0; y < 3; y++) {
+      float value = scene.vertexData[x * 3 + y];
+      boundsMin[y] = x == 0 ? value : std::min(boundsMin[y], value);
+      boundsMax[y] = x == 0 ? value : std::max(boundsMax[y], value);
+    }
+  }
+
+  // A flat axis keeps a scale of one, as every value on it encodes to zero
+  float center[3];
+  float extent[3];
+  float boundsSize = 0.0f;
+  for (uint32_t y = 0; y < 3; y++) {
+    center[y] = 0.5f * (boundsMin[y] + boundsMax[y]);
+    extent[y] = 0.5f * (boundsMax[y] - boundsMin[y]);
+    if (extent[y] == 0.0f) {
+      extent[y] = 1.0f;
+    }
+
+    boundsSize += (boundsMax[y] - boundsMin[y]) * (boundsMax[y] - boundsMin[y]);
+  }
+  boundsSize = std::sqrt(boundsSize);
+
+  uint32_t taskCount =
+      (scene.vertexCount + QUANTIZATION_TASK_VERTEX_COUNT - 1) /
+      QUANTIZATION_TASK_VERTEX_COUNT;
+  std::vector<double> taskErrorSumList(taskCount, 0.0);
+  std::vector<double> taskErrorMaxList(taskCount, 0.0);
+  std::vector<int16_t> quantizedVertexList(scene.vertexCount * 4);
+
+  runTasksInParallel(taskCount, [&](uint32_t taskIndex) {
+    uint64_t vertexBegin = (uint64_t)taskIndex * QUANTIZATION_TASK_VERTEX_COUNT;
+    uint64_t vertexEnd = std::min<uint64_t>(
+        vertexBegin + QUANTIZATION_TASK_VERTEX_COUNT, scene.vertexCount);
+
+    for (uint64_t x = vertexBegin; x < vertexEnd; x++) {
+      double errorSquared = 0.0;
+      for (uint32_t y = 0; y < 3; y++) {
+        float value = scene.vertexData[x * 3 + y];
+        float normalized =
+            std::clamp((value - center[y]) / extent[y], -1.0f, 1.0f);
+        int16_t quantized = (int16_t)std::lround(normalized * 32767.0f);
+
+        // As the device decodes it
+        float decoded = extent[y] * (quantized / 32767.0f) + center[y];
+        errorSquared += (decoded - value) * (decoded - value);
+
+        quantizedVertexList[x * 4 + y] = quantized;
+      }
+      quantizedVertexList[x * 4 + 3] = 0;
+
+      double error = std::sqrt(errorSquared);
+      taskErrorSumList[taskIndex] += error;
+      taskErrorMaxList[taskIndex] =
+          std::max(taskErrorMaxList[taskIndex], error);
+    }
+  });
+
+  double errorSum = 0.0;
+  double errorMax = 0.0;
+  for (uint32_t x = 0; x < taskCount; x++) {
+    errorSum += taskErrorSumList[x];
+    errorMax = std::max(errorMax, taskErrorMaxList[x]);
+  }
+
+  {
+    std::lock_guard<std::mutex> sceneLock(scene.mutex);
+
+    scene.quantizedVertexList = std::move(quantizedVertexList);
+    for (uint32_t y = 0; y < 3; y++) {
+      for (uint32_t x = 0; x < 4; x++) {
+        scene.quantizationTransform[y][x] =
+            x == y ? extent[y] : (x == 3 ? center[y] : 0.0f);
+      }
+    }
+    scene.isQuantized = true;
+  }
+  scene.conditionVariable.notify_all();
+
+  double errorMean = scene.vertexCount > 0 ? errorSum / scene.vertexCount : 0;
+  std::cout << "Vertex quantization: " << SCENE_VERTEX_STRIDE
+            << " bytes per vertex instead of " << sizeof(float) * 3
+            << ", error mean " << errorMean << " max " << errorMax << " ("
+            << (boundsSize > 0.0f ? 100.0 * errorMax / boundsSize : 0.0)
+            << "% of the scene size)" << std::endl;
+}
+
+// Spreads the low 10 bits of value out to every third bit
+uint32_t expandMortonBits(uint32_t value) {
+  value &= 0x3FF;
+  value = (value | value << 16) & 0x030000FF;
+  value = (value | value << 8) & 0x0300F00F;
+  value = (value | value << 4) & 0x030C30C3;
+  value = (value | value << 2) & 0x09249249;
+  return value;
+}
+
+// Sorts the triangles along a Morton curve through their centroids and splits
+// them into clusters of SCENE_CLUSTER_PRIMITIVE_COUNT, each built into its own
+// bottom level acceleration structure. The scene keeps its triangle order,
+// the shaders look up the scene primitive index of a clustered triangle.
+// Reports how much the cluster bounds add up to against the scene bounds.
+void clusterScenePrimitives(Scene &scene) {
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+
+  float boundsMin[3] = {0.0f, 0.0f, 0.0f};
+  float boundsMax[3] = {0.0f, 0.0f, 0.0f};
+  for (uint64_t x = 0; x < scene.vertexCount; x++) {
+    for (uint32_t y = 0; y < 3; y++) {
+      float value = scene.vertexData[x * 3 + y];
+      boundsMin[y] = x == 0 ? value : std::min(boundsMin[y], value);
+      boundsMax[y] = x == 0 ? value : std::max(boundsMax[y], value);
+    }
+  }
+
+  auto getSurfaceArea = [](const float *minimum, const float *maximum) {
+    float size[3] = {maximum[0] - minimum[0], maximum[1] - minimum[1],
+                     maximum[2] - minimum[2]};
+    return 2.0f * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+  };
+
+  uint32_t taskCount =
+      (scene.primitiveCount + CLUSTERING_TASK_PRIMITIVE_COUNT - 1) /
+      CLUSTERING_TASK_PRIMITIVE_COUNT;
+
+  // The Morton code of each centroid above its primitive index, so sorting
+  // keeps triangles with the same code in scene order
+  std::vector<uint64_t> primitiveKeyList(scene.primitiveCount);
+
+  runTasksInParallel(taskCount, [&](uint32_t taskIndex) {
+    uint64_t primitiveBegin =
+        (uint64_t)taskIndex * CLUSTERING_TASK_PRIMITIVE_COUNT;
+    uint64_t primitiveEnd = std::min<uint64_t>(
+        primitiveBegin + CLUSTERING_TASK_PRIMITIVE_COUNT, scene.primitiveCount);
+
+    for (uint64_t x = primitiveBegin; x < primitiveEnd; x++) {
+      uint32_t mortonCode = 0;
+      for (uint32_t y = 0; y < 3; y++) {
+        float centroid = 0.0f;
+        for (uint32_t z = 0; z < 3; z++) {
+          uint32_t index =
+              getSceneIndex(scene.indexData, scene.indexSize, x * 3 + z);
+          centroid += scene.vertexData[index * 3 + y] / 3.0f;
+        }
+
+        float extent = boundsMax[y] - boundsMin[y];
+        float normalized =
+            extent > 0.0f ? (centroid - boundsMin[y]) / extent : 0.0f;
+        uint32_t cell =
+            (uint32_t)std::clamp(normalized * 1024.0f, 0.0f, 1023.0f);
+
+        mortonCode |= expandMortonBits(cell) << y;
+      }
+
+      primitiveKeyList[x] = (uint64_t)mortonCode << 32 | x;
+    }
+  });
+
+  std::sort(primitiveKeyList.begin(), primitiveKeyList.end());
+
+  uint64_t clusterCount =
+      (scene.primitiveCount + SCENE_CLUSTER_PRIMITIVE_COUNT - 1) /
+      SCENE_CLUSTER_PRIMITIVE_COUNT;
+
+  std::vector<uint32_t> clusterIndexList(
+      (scene.indexSize * scene.indexCount + 3) / 4);
+  std::vector<uint32_t> clusterPrimitiveIndexList(scene.primitiveCount);
+  std::vector<float> clusterSurfaceAreaList(clusterCount, 0.0f);
+
+  // Copy each cluster's triangles in sorted order and measure its bounds
+  runTasksInParallel(clusterCount, [&](uint32_t clusterIndex) {
+    uint64_t primitiveBegin =
+        (uint64_t)clusterIndex * SCENE_CLUSTER_PRIMITIVE_COUNT;
+    uint64_t primitiveEnd = std::min<uint64_t>(
+        primitiveBegin + SCENE_CLUSTER_PRIMITIVE_COUNT, scene.primitiveCount);
+
+    float clusterMin[3] = {0.0f, 0.0f, 0.0f};
+    float clusterMax[3] = {0.0f, 0.0f, 0.0f};
+    for (uint64_t x = primitiveBegin; x < primitiveEnd; x++) {
+      uint32_t primitiveIndex = (uint32_t)primitiveKeyList[x];
+      clusterPrimitiveIndexList[x] = primitiveIndex;
+
+      for (uint32_t z = 0; z < 3; z++) {
+        uint32_t index = getSceneIndex(scene.indexData, scene.indexSize,
+                                       (uint64_t)primitiveIndex * 3 + z);
+        setSceneIndex(clusterIndexList.data(), scene.indexSize, x * 3 + z,
+                      index);
+
+        bool isFirst = x == primitiveBegin && z == 0;
+        for (uint32_t y = 0; y < 3; y++) {
+          float value = scene.vertexData[index * 3 + y];
+          clusterMin[y] = isFirst ? value : std::min(clusterMin[y], value);
+          clusterMax[y] = isFirst ? value : std::max(clusterMax[y], value);
+        }
+      }
+    }
+
+    clusterSurfaceAreaList[clusterIndex] =
+        getSurfaceArea(clusterMin, clusterMax);
+  });
+
+  float clusterSurfaceArea = 0.0f;
+  for (float surfaceArea : clusterSurfaceAreaList) {
+    clusterSurfaceArea += surfaceArea;
+  }
+  float sceneSurfaceArea = getSurfaceArea(boundsMin, boundsMax);
+
+  {
+    std::lock_guard<std::mutex> sceneLock(scene.mutex);
+
+    scene.clusterIndexList = std::move(clusterIndexList);
+    scene.clusterPrimitiveIndexList = std::move(clusterPrimitiveIndexList);
+    scene.clusterCount = clusterCount;
+    scene.isClustered = true;
+  }
+  scene.conditionVariable.notify_all();
+
+  double clusterMilliseconds = std::chrono::duration<double, std::milli>(
+                                   std::chrono::steady_clock::now() -
+                                   startTimePoint)
+                                   .count();
+
+  std::cout << "Clusters: " << clusterCount << " of up to "
+            << SCENE_CLUSTER_PRIMITIVE_COUNT << " triangles, bounds surface "
+            << (sceneSurfaceArea > 0.0f ? clusterSurfaceArea / sceneSurfaceArea
+                                        : 0.0f)
+            << " times the scene's, in " << clusterMilliseconds << " ms"
+            << std::endl;
+}
+
+// Loads the scene from <objFileName>.cache when the cache was generated from
+// an OBJ of the same size and write time. Otherwise parses the OBJ, renders
+// it as parsed and writes the optimized cache for the next run. Changes to the
+// MTL alone need the cache deleted.
+// Other threads can wait for parts of the scene while this runs, see
+// waitForSceneSize and waitForSceneRange.
+void loadScene(const std::string &objFileName, Scene &scene) {
+  std::string cacheFileName = objFileName + ".cache";
+
+  std::error_code errorCode;
+  uint64_t sourceFileSize = std::filesystem::file_size(objFileName, errorCode);
+  int64_t sourceWriteTime =
+      std::filesystem::last_write_time(objFileName, errorCode)
+          .time_since_epoch()
+          .count();
+
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  if (loadSceneCache(cacheFileName, sourceFileSize, sourceWriteTime, scene)) {
+    scene.rangeList = {{.vertexOffset = 0,
+                        .vertexCount = scene.vertexCount,
+                        .primitiveOffset = 0,
+                        .primitiveCount = scene.primitiveCount}};
+    scene.isRangeReadyList = {true};
+    scene.isSizeKnown = true;
+
+    sceneLock.unlock();
+    scene.conditionVariable.notify_all();
+
+    std::cout << "Scene: " << scene.primitiveCount << " triangles from "
+              << cacheFileName << std::endl;
+
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+    quantizeSceneVertices(scene);
+#endif
+#if defined(BLAS_CLUSTERING_ENABLED)
+    clusterScenePrimitives(scene);
+#endif
+    return;
+  }
+  sceneLock.unlock();
+
+  parseSceneOBJ(objFileName, cacheFileName + ".tmp", scene);
+
+  std::cout << "Scene: " << scene.primitiveCount << " triangles from "
+            << objFileName << std::endl;
+
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+  quantizeSceneVertices(scene);
+#endif
+#if defined(BLAS_CLUSTERING_ENABLED)
+  clusterScenePrimitives(scene);
+#endif
+
+  writeOptimizedSceneCache(cacheFileName, sourceFileSize, sourceWriteTime,
+                           scene);
+}
+
+// Called by the thread loading the scene when loadScene throws, so that the
+// threads waiting on the scene throw instead of blocking
+void failSceneLoad(Scene &scene) {
+  {
+    std::lock_guard<std::mutex> sceneLock(scene.mutex);
+    scene.isLoadFailed = true;
+  }
+  scene.conditionVariable.notify_all();
+}
+
+// Throws from a wait that was woken by failSceneLoad, with the scene locked
+void checkSceneLoad(const Scene &scene) {
+  if (scene.isLoadFailed) {
+    throw std::runtime_error("Scene: loading failed");
+  }
+}
+
+// Blocks until the scene's counts, materials and ranges are known
+void waitForSceneSize(Scene &scene) {
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  scene.conditionVariable.wait(
+      sceneLock, [&]() { return scene.isSizeKnown || scene.isLoadFailed; });
+  checkSceneLoad(scene);
+}
+
+// Blocks until the data of one range of the scene has been written
+void waitForSceneRange(Scene &scene, uint32_t rangeIndex) {
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  scene.conditionVariable.wait(sceneLock, [&]() {
+    return scene.isRangeReadyList[rangeIndex] || scene.isLoadFailed;
+  });
+  checkSceneLoad(scene);
+}
+
+// Blocks until the quantized positions have been written
+void waitForSceneQuantization(Scene &scene) {
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  scene.conditionVariable.wait(
+      sceneLock, [&]() { return scene.isQuantized || scene.isLoadFailed; });
+  checkSceneLoad(scene);
+}
+
+// Blocks until the triangles have been sorted into clusters
+void waitForSceneClusters(Scene &scene) {
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  scene.conditionVariable.wait(
+      sceneLock, [&]() { return scene.isClustered || scene.isLoadFailed; });
+  checkSceneLoad(scene);
+}
+
+void unloadScene(Scene &scene) {
+  if (scene.mappedFileBuffer != NULL) {
+    unmapFile(scene.mappedFileBuffer, scene.mappedFileSize);
+    scene.mappedFileBuffer = NULL;
+  }
+
+  if (!scene.temporaryFileName.empty()) {
+    std::error_code errorCode;
+    std::filesystem::remove(scene.temporaryFileName, errorCode);
+    scene.temporaryFileName.clear();
+  }
+}
+
+std::string getPhysicalDeviceUUIDString(VkPhysicalDevice physicalDeviceHandle) {
+  VkPhysicalDeviceIDProperties physicalDeviceIDProperties = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+      .pNext = NULL};
+
+  VkPhysicalDeviceProperties2 physicalDeviceProperties2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &physicalDeviceIDProperties};
+
+  vkGetPhysicalDeviceProperties2(physicalDeviceHandle,
+                                 &physicalDeviceProperties2);
+
+  std::string uuidString;
+  for (uint32_t x = 0; x < VK_UUID_SIZE; x++) {
+    char hexString[3];
+    snprintf(hexString, sizeof(hexString), "%02x",
+             physicalDeviceIDProperties.deviceUUID[x]);
+    uuidString += hexString;
+  }
+
+  return uuidString;
+}
+
+// Returns -1 if the device is missing a required extension, feature or queue
+// family. Otherwise devices are ranked by type, then device local memory, then
+// ray tracing properties.
+int64_t scorePhysicalDevice(
+    VkPhysicalDevice physicalDeviceHandle,
+    const std::vector<const char *> &deviceExtensionList) {
+
+  VkResult result;
+
+  uint32_t extensionPropertyCount = 0;
+  result = vkEnumerateDeviceExtensionProperties(
+      physicalDeviceHandle, NULL, &extensionPropertyCount, NULL);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEnumerateDeviceExtensionProperties");
+  }
+
+  std::vector<VkExtensionProperties> extensionPropertiesList(
+      extensionPropertyCount);
+  result = vkEnumerateDeviceExtensionProperties(
+      physicalDeviceHandle, NULL, &extensionPropertyCount,
+      extensionPropertiesList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEnumerateDeviceExtensionProperties");
+  }
+
+  for (const char *extensionName : deviceExtensionList) {
+    bool isExtensionSupported = false;
+    for (VkExtensionProperties &extensionProperties : extensionPropertiesList) {
+      if (strcmp(extensionProperties.extensionName, extensionName) == 0) {
+        isExtensionSupported = true;
+        break;
+      }
+    }
+
+    if (!isExtensionSupported) {
+      return -1;
+    }
+  }
+
+  VkPhysicalDeviceTimelineSemaphoreFeatures
+      physicalDeviceTimelineSemaphoreFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+          .pNext = NULL};
+
+  VkPhysicalDeviceBufferDeviceAddressFeatures
+      physicalDeviceBufferDeviceAddressFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES,
+          .pNext = &physicalDeviceTimelineSemaphoreFeatures};
+
+  VkPhysicalDeviceAccelerationStructureFeaturesKHR
+      physicalDeviceAccelerationStructureFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+          .pNext = &physicalDeviceBufferDeviceAddressFeatures};
+
+  VkPhysicalDeviceRayTracingPipelineFeaturesKHR
+      physicalDeviceRayTracingPipelineFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR,
+          .pNext = &physicalDeviceAccelerationStructureFeatures};
+
+  VkPhysicalDeviceFeatures2 physicalDeviceFeatures2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &physicalDeviceRayTracingPipelineFeatures};
+
+  vkGetPhysicalDeviceFeatures2(physicalDeviceHandle, &physicalDeviceFeatures2);
+
+  if (!physicalDeviceTimelineSemaphoreFeatures.timelineSemaphore ||
+      !physicalDeviceBufferDeviceAddressFeatures.bufferDeviceAddress ||
+      !physicalDeviceAccelerationStructureFeatures.accelerationStructure ||
+      !physicalDeviceRayTracingPipelineFeatures.rayTracingPipeline ||
+      !physicalDeviceFeatures2.features.geometryShader) {
+    return -1;
+  }
+
+  uint32_t queueFamilyPropertyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDeviceHandle,
+                                           &queueFamilyPropertyCount, NULL);
+
+  std::vector<VkQueueFamilyProperties> queueFamilyPropertiesList(
+      queueFamilyPropertyCount);
+
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDeviceHandle,
+                                           &queueFamilyPropertyCount,
+                                           queueFamilyPropertiesList.data());
+
+  bool isQueueFamilyFound = false;
+  for (uint32_t x = 0; x < queueFamilyPropertiesList.size(); x++) {
+    if (queueFamilyPropertiesList[x].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+      isQueueFamilyFound = true;
+      break;
+    }
+  }
+
+  if (!isQueueFamilyFound) {
+    return -1;
+  }
+
+  VkPhysicalDeviceRayTracingPipelinePropertiesKHR
+      physicalDeviceRayTracingPipelineProperties = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR,
+          .pNext = NULL};
+
+  VkPhysicalDeviceProperties2 physicalDeviceProperties2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &physicalDeviceRayTracingPipelineProperties};
+
+  vkGetPhysicalDeviceProperties2(physicalDeviceHandle,
+                                 &physicalDeviceProperties2);
+
+  VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDeviceHandle,
+                                      &physicalDeviceMemoryProperties);
+
+  int64_t deviceTypeScore = 0;
+  switch (physicalDeviceProperties2.properties.deviceType) {
+  case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+    deviceTypeScore = 4;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+    deviceTypeScore = 3;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+    deviceTypeScore = 2;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_CPU:
+    deviceTypeScore = 1;
+    break;
+  default:
+    break;
+  }
+
+  VkDeviceSize deviceLocalHeapSize = 0;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryHeapCount;
+       x++) {
+    if (physicalDeviceMemoryProperties.memoryHeaps[x].flags &
+        VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      deviceLocalHeapSize =
+          std::max(deviceLocalHeapSize,
+                   physicalDeviceMemoryProperties.memoryHeaps[x].size);
+    }
+  }
+
+  int64_t deviceLocalHeapScore =
+      std::min<int64_t>(deviceLocalHeapSize / (1024 * 1024), 0xFFFFFFFF);
+  int64_t rayRecursionDepthScore = std::min<int64_t>(
+      physicalDeviceRayTracingPipelineProperties.maxRayRecursionDepth, 0xFF);
+  int64_t shaderGroupHandleSizeScore =
+      0xFF -
+      std::min<int64_t>(
+          physicalDeviceRayTracingPipelineProperties.shaderGroupHandleSize, 0xFF);
+
+  return (deviceTypeScore << 48) | (deviceLocalHeapScore << 16) |
+         (rayRecursionDepthScore << 8) | shaderGroupHandleSizeScore;
+}
+
+// Camera block of the ray generation and closest hit shaders, also read by
+// the host renderer
+struct UniformStructure {
+  float cameraPosition[4] = {-1.433908, 3.579997, 5.812919, 1};
+  float cameraRight[4] = {0.928479, 0, 0.371385, 1};
+  float cameraUp[4] = {0, 1, 0, 1};
+  float cameraForward[4] = {0.371385, 0, -0.928479, 1};
+
+  uint32_t frameCount = 0;
+};
+
+// Every tile but the last has a multiple of rowAlignment rows, so every tile
+// starts on a row each device's transfer family can copy from
+struct TileScheduler {
+  std::mutex mutex;
+  uint32_t nextRow = 0;
+  uint32_t rowCount = 0;
+  uint32_t rowAlignment = 1;
+};
+
+// Bounding volume hierarchy over the scene's triangles for the host renderer.
+// An interior node's children are the nodes at childIndex and childIndex + 1.
+// A leaf has primitiveCount entries of primitiveIndexList from
+// firstPrimitive.
+struct HostBVHNode {
+  float bounds[6];
+  uint32_t childIndex;
+  uint32_t firstPrimitive;
+  uint32_t primitiveCount;
+};
+
+struct HostBVH {
+  std::vector<HostBVHNode> nodeList;
+  std::vector<uint32_t> primitiveIndexList;
+};
+
+// Closest triangle along a host ray, with the barycentric coordinates of its
+// second and third vertices as in the shaders' hitCoordinate
+struct HostHit {
+  uint32_t primitiveIndex = -1;
+  float distance = 0.0f;
+  float barycentric[2] = {0.0f, 0.0f};
+};
+
+float dotVector3(const float *a, const float *b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+void crossVector3(const float *a, const float *b, float *result) {
+  result[0] = a[1] * b[2] - a[2] * b[1];
+  result[1] = a[2] * b[0] - a[0] * b[2];
+  result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+void normalizeVector3(float *vector) {
+  float length = sqrtf(dotVector3(vector, vector));
+  for (uint32_t x = 0; x < 3; x++) {
+    vector[x] /= length;
+  }
+}
+
+const float *getSceneTriangleVertex(const Scene &scene, uint64_t primitiveIndex,
+                                    uint32_t corner) {
+  return &scene.vertexData[3 * (uint64_t)getSceneIndex(scene.indexData,
+                                                       scene.indexSize,
+                                                       primitiveIndex * 3 +
+                                                           corner)];
+}
+
+// Splits the triangles at the median centroid along the longest axis of the
+// centroids' bounds until a node has at most HOST_BVH_LEAF_PRIMITIVE_COUNT
+void buildHostBVH(const Scene &scene, HostBVH &hostBVH) {
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+
+  std::vector<float> centroidList(scene.primitiveCount * 3);
+  std::vector<float> primitiveBoundsList(scene.primitiveCount * 6);
+
+  runTasksInParallel(
+      (scene.primitiveCount + HOST_BVH_TASK_PRIMITIVE_COUNT - 1) /
+          HOST_BVH_TASK_PRIMITIVE_COUNT,
+      [&](uint32_t taskIndex) {
+        uint64_t primitiveBegin =
+            (uint64_t)taskIndex * HOST_BVH_TASK_PRIMITIVE_COUNT;
+        uint64_t primitiveEnd = std::min<uint64_t>(
+            primitiveBegin + HOST_BVH_TASK_PRIMITIVE_COUNT,
+            scene.primitiveCount);
+
+        for (uint64_t x = primitiveBegin; x < primitiveEnd; x++) {
+          float *primitiveBounds = &primitiveBoundsList[x * 6];
+          for (uint32_t y = 0; y < 3; y++) {
+            primitiveBounds[y] = INFINITY;
+            primitiveBounds[y + 3] = -INFINITY;
+          }
+
+          for (uint32_t y = 0; y < 3; y++) {
+            const float *vertex = getSceneTriangleVertex(scene, x, y);
+            for (uint32_t z = 0; z < 3; z++) {
+              primitiveBounds[z] = std::min(primitiveBounds[z], vertex[z]);
+              primitiveBounds[z + 3] =
+                  std::max(primitiveBounds[z + 3], vertex[z]);
+            }
+          }
+
+          for (uint32_t y = 0; y < 3; y++) {
+            centroidList[x * 3 + y] =
+                (primitiveBounds[y] + primitiveBounds[y + 3]) * 0.5f;
+          }
+        }
+      });
+
+  hostBVH.primitiveIndexList.resize(scene.primitiveCount);
+  for (uint32_t x = 0; x < scene.primitiveCount; x++) {
+    hostBVH.primitiveIndexList[x] = x;
+  }
+
+  hostBVH.nodeList.clear();
+  hostBVH.nodeList.push_back({});
+
+  // Node index, first and end entry of primitiveIndexList
+  std::vector<std::array<uint32_t, 3>> nodeStack = {
+      {0, 0, (uint32_t)scene.primitiveCount}};
+
+  while (!nodeStack.empty()) {
+    auto [nodeIndex, primitiveBegin, primitiveEnd] = nodeStack.back();
+    nodeStack.pop_back();
+
+    HostBVHNode node = {.bounds = {INFINITY, INFINITY, INFINITY, -INFINITY,
+                                   -INFINITY, -INFINITY},
+                        .childIndex = 0,
+                        .firstPrimitive = primitiveBegin,
+                        .primitiveCount = primitiveEnd - primitiveBegin};
+
+    float centroidBounds[6] = {INFINITY,  INFINITY,  INFINITY,
+                               -INFINITY, -INFINITY, -INFINITY};
+
+    for (uint32_t x = primitiveBegin; x < primitiveEnd; x++) {
+      uint32_t primitiveIndex = hostBVH.primitiveIndexList[x];
+      const float *primitiveBounds = &primitiveBoundsList[primitiveIndex * 6];
+      const float *centroid = &centroidList[primitiveIndex * 3];
+
+      for (uint32_t y = 0; y < 3; y++) {
+        node.bounds[y] = std::min(node.bounds[y], primitiveBounds[y]);
+        node.bounds[y + 3] =
+            std::max(node.bounds[y + 3], primitiveBounds[y + 3]);
+
+        centroidBounds[y] = std::min(centroidBounds[y], centroid[y]);
+        centroidBounds[y + 3] = std::max(centroidBounds[y + 3], centroid[y]);
+      }
+    }
+
+    if (node.primitiveCount > HOST_BVH_LEAF_PRIMITIVE_COUNT) {
+      uint32_t axis = 0;
+      for (uint32_t y = 1; y < 3; y++) {
+        if (centroidBounds[y + 3] - centroidBounds[y] >
+            centroidBounds[axis + 3] - centroidBounds[axis]) {
+          axis = y;
+        }
+      }
+
+      uint32_t primitiveMiddle = primitiveBegin + node.primitiveCount / 2;
+      std::nth_element(hostBVH.primitiveIndexList.begin() + primitiveBegin,
+                       hostBVH.primitiveIndexList.begin() + primitiveMiddle,
+                       hostBVH.primitiveIndexList.begin() + primitiveEnd,
+                       [&](uint32_t a, uint32_t b) {
+                         return centroidList[a * 3 + axis] <
+                                centroidList[b * 3 + axis];
+                       });
+
+      node.childIndex = (uint32_t)hostBVH.nodeList.size();
+      node.primitiveCount = 0;
+
+      hostBVH.nodeList.push_back({});
+      hostBVH.nodeList.push_back({});
+
+      nodeStack.push_back({node.childIndex + 1, primitiveMiddle, primitiveEnd});
+      nodeStack.push_back({node.childIndex, primitiveBegin, primitiveMiddle});
+    }
+
+    hostBVH.nodeList[nodeIndex] = node;
+  }
+
+  double buildMilliseconds = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() -
+                                 startTimePoint)
+                                 .count();
+
+  std::cout << "Host BVH: " << hostBVH.nodeList.size() << " nodes in "
+            << buildMilliseconds << " ms" << std::endl;
+}
+
+// Finds the closest triangle hit between minimumDistance and maximumDistance
+// along direction, which need not be normalized. Triangles are hit from both
+// sides, as the device instance disables facing culling. With isAnyHit the
+// first hit found is returned, as for the shadow rays.
+bool traceHostRay(const Scene &scene, const HostBVH &hostBVH,
+                  const float *origin, const float *direction,
+                  float minimumDistance, float maximumDistance, bool isAnyHit,
+                  HostHit &hit) {
+  float inverseDirection[3] = {1.0f / direction[0], 1.0f / direction[1],
+                               1.0f / direction[2]};
+
+  bool isHit = false;
+  float closestDistance = maximumDistance;
+
+  uint32_t nodeStack[64];
+  uint32_t nodeStackSize = 0;
+  nodeStack[nodeStackSize++] = 0;
+
+  while (nodeStackSize > 0) {
+    const HostBVHNode &node = hostBVH.nodeList[nodeStack[--nodeStackSize]];
+
+    float entryDistance = minimumDistance;
+    float exitDistance = closestDistance;
+    for (uint32_t x = 0; x < 3; x++) {
+      float nearDistance = (node.bounds[x] - origin[x]) * inverseDirection[x];
+      float farDistance =
+          (node.bounds[x + 3] - origin[x]) * inverseDirection[x];
+
+      if (nearDistance > farDistance) {
+        std::swap(nearDistance, farDistance);
+      }
+
+      entryDistance = std::max(entryDistance, nearDistance);
+      exitDistance = std::min(exitDistance, farDistance);
+    }
+
+    if (entryDistance > exitDistance) {
+      continue;
+    }
+
+    if (node.primitiveCount == 0) {
+      nodeStack[nodeStackSize++] = node.childIndex + 1;
+      nodeStack[nodeStackSize++] = node.childIndex;
+      continue;
+    }
+
+    for (uint32_t x = node.firstPrimitive;
+         x < node.firstPrimitive + node.primitiveCount; x++) {
+      uint32_t primitiveIndex = hostBVH.primitiveIndexList[x];
+
+      const float *vertexA = getSceneTriangleVertex(scene, primitiveIndex, 0);
+      const float *vertexB = getSceneTriangleVertex(scene, primitiveIndex, 1);
+      const float *vertexC = getSceneTriangleVertex(scene, primitiveIndex, 2);
+
+      float edgeB[3];
+      float edgeC[3];
+      float originOffset[3];
+      for (uint32_t y = 0; y < 3; y++) {
+        edgeB[y] = vertexB[y] - vertexA[y];
+        edgeC[y] = vertexC[y] - vertexA[y];
+        originOffset[y] = origin[y] - vertexA[y];
+      }
+
+      float directionCrossEdgeC[3];
+      crossVector3(direction, edgeC, directionCrossEdgeC);
+
+      float determinant = dotVector3(edgeB, directionCrossEdgeC);
+      if (determinant == 0.0f) {
+        continue;
+      }
+
+      float inverseDeterminant = 1.0f / determinant;
+      float u = dotVector3(originOffset, directionCrossEdgeC) *
+                inverseDeterminant;
+      if (u < 0.0f || u > 1.0f) {
+        continue;
+      }
+
+      float originCrossEdgeB[3];
+      crossVector3(originOffset, edgeB, originCrossEdgeB);
+
+      float v = dotVector3(direction, originCrossEdgeB) * inverseDeterminant;
+      if (v < 0.0f || u + v > 1.0f) {
+        continue;
+      }
+
+      float distance = dotVector3(edgeC, originCrossEdgeB) * inverseDeterminant;
+      if (distance < minimumDistance || distance > closestDistance) {
+        continue;
+      }
+
+      isHit = true;
+      closestDistance = distance;
+      hit = {.primitiveIndex = primitiveIndex,
+             .distance = distance,
+             .barycentric = {u, v}};
+
+      if (isAnyHit) {
+        return true;
+      }
+    }
+  }
+
+  return isHit;
+}
+
+// random() of the ray tracing shaders, in 32 bit floats with GLSL's mod and
+// fract
+float getShaderRandom(float u, float v, float seed) {
+  float value = u * 12.9898f + v * 78.233f + 1113.1f * seed;
+  value -= (float)M_PI * floorf(value / (float)M_PI);
+
+  value = sinf(value) * 43758.5453f;
+  return value - floorf(value);
+}
+
+const Material &getSceneTriangleMaterial(const Scene &scene,
+                                         uint32_t primitiveIndex) {
+  static const Material emptyMaterial;
+
+  uint32_t materialIndex = scene.materialIndexData[primitiveIndex];
+  return materialIndex < scene.materialCount
+             ? scene.materialData[materialIndex]
+             : emptyMaterial;
+}
+
+// Follows shader.rgen, shader.rchit and the miss shaders for one pixel of a
+// width by height image. The random numbers are seeded with the pixel as on
+// the device, so the result is a reference to diff the device image against.
+void traceHostPixel(const Scene &scene, const HostBVH &hostBVH,
+                    const UniformStructure &uniformStructure, uint32_t pixelX,
+                    uint32_t pixelY, uint32_t width, uint32_t height,
+                    float *color) {
+  float frameSeed = (float)uniformStructure.frameCount;
+
+  float uv[2] = {
+      (pixelX + getShaderRandom(pixelX, pixelY, 0.0f)) / width * 2.0f - 1.0f,
+      -((pixelY + getShaderRandom(pixelX, pixelY, 1.0f)) / height * 2.0f -
+        1.0f)};
+
+  // The camera vectors are normalized with their w component, as in the ray
+  // generation shader
+  float primaryDirection[4];
+  for (uint32_t x = 0; x < 4; x++) {
+    primaryDirection[x] = uv[0] * uniformStructure.cameraRight[x] +
+                          uv[1] * uniformStructure.cameraUp[x] +
+                          uniformStructure.cameraForward[x];
+  }
+
+  float primaryDirectionLength =
+      sqrtf(dotVector3(primaryDirection, primaryDirection) +
+            primaryDirection[3] * primaryDirection[3]);
+
+  float rayOrigin[3];
+  float rayDirection[3];
+  float previousNormal[3] = {0.0f, 0.0f, 0.0f};
+  for (uint32_t x = 0; x < 3; x++) {
+    rayOrigin[x] = uniformStructure.cameraPosition[x];
+    rayDirection[x] = primaryDirection[x] / primaryDirectionLength;
+  }
+
+  float directColor[3] = {0.0f, 0.0f, 0.0f};
+  float indirectColor[3] = {0.0f, 0.0f, 0.0f};
+  int rayDepth = 0;
+
+  float hitRandom[2] = {getShaderRandom(pixelX, pixelY, frameSeed),
+                        getShaderRandom(pixelX, pixelY, frameSeed + 1.0f)};
+
+  for (uint32_t x = 0; x < 16; x++) {
+    HostHit hit;
+    if (!traceHostRay(scene, hostBVH, rayOrigin, rayDirection, 0.001f,
+                      10000.0f, false, hit)) {
+      break;
+    }
+
+    uint32_t primitiveIndex = hit.primitiveIndex;
+    float barycentric[3] = {1.0f - hit.barycentric[0] - hit.barycentric[1],
+                            hit.barycentric[0], hit.barycentric[1]};
+
+    const float *vertexA = getSceneTriangleVertex(scene, primitiveIndex, 0);
+    const float *vertexB = getSceneTriangleVertex(scene, primitiveIndex, 1);
+    const float *vertexC = getSceneTriangleVertex(scene, primitiveIndex, 2);
+
+    float position[3];
+    float edgeB[3];
+    float edgeC[3];
+    for (uint32_t y = 0; y < 3; y++) {
+      position[y] = vertexA[y] * barycentric[0] + vertexB[y] * barycentric[1] +
+                    vertexC[y] * barycentric[2];
+      edgeB[y] = vertexB[y] - vertexA[y];
+      edgeC[y] = vertexC[y] - vertexA[y];
+    }
+
+    float geometricNormal[3];
+    crossVector3(edgeB, edgeC, geometricNormal);
+    normalizeVector3(geometricNormal);
+
+    const Material &material = getSceneTriangleMaterial(scene, primitiveIndex);
+    bool isRayActive = true;
+
+    // 40 & 41 == light
+    if (primitiveIndex == 40 || primitiveIndex == 41) {
+      for (uint32_t y = 0; y < 3; y++) {
+        if (rayDepth == 0) {
+          directColor[y] = material.emission[y];
+        } else {
+          indirectColor[y] += (1.0f / rayDepth) * material.emission[y] *
+                              dotVector3(previousNormal, rayDirection);
+        }
+      }
+    } else {
+      uint32_t lightPrimitiveIndex = (uint32_t)(hitRandom[0] * 2 + 40);
+      float lightColor[3] = {0.6f, 0.6f, 0.6f};
+
+      const float *lightVertexA =
+          getSceneTriangleVertex(scene, lightPrimitiveIndex, 0);
+      const float *lightVertexB =
+          getSceneTriangleVertex(scene, lightPrimitiveIndex, 1);
+      const float *lightVertexC =
+          getSceneTriangleVertex(scene, lightPrimitiveIndex, 2);
+
+      float lightUV[2] = {hitRandom[0], hitRandom[1]};
+      if (lightUV[0] + lightUV[1] > 1.0f) {
+        lightUV[0] = 1.0f - lightUV[0];
+        lightUV[1] = 1.0f - lightUV[1];
+      }
+
+      float positionToLightDirection[3];
+      for (uint32_t y = 0; y < 3; y++) {
+        float lightPosition =
+            lightVertexA[y] * (1.0f - lightUV[0] - lightUV[1]) +
+            lightVertexB[y] * lightUV[0] + lightVertexC[y] * lightUV[1];
+        positionToLightDirection[y] = lightPosition - position[y];
+      }
+
+      float shadowRayDistance =
+          sqrtf(dotVector3(positionToLightDirection,
+                           positionToLightDirection)) -
+          0.001f;
+      normalizeVector3(positionToLightDirection);
+
+      HostHit shadowHit;
+      bool isShadow =
+          traceHostRay(scene, hostBVH, position, positionToLightDirection,
+                       0.001f, shadowRayDistance, true, shadowHit);
+
+      float lightCosine =
+          dotVector3(geometricNormal, positionToLightDirection);
+
+      for (uint32_t y = 0; y < 3; y++) {
+        if (!isShadow) {
+          if (rayDepth == 0) {
+            directColor[y] = material.diffuse[y] * lightColor[y] * lightCosine;
+          } else {
+            indirectColor[y] += (1.0f / rayDepth) * material.diffuse[y] *
+                                lightColor[y] *
+                                dotVector3(previousNormal, rayDirection) *
+                                lightCosine;
+          }
+        } else if (rayDepth == 0) {
+          directColor[y] = 0.0f;
+        }
+      }
+
+      isRayActive = !isShadow || rayDepth == 0;
+    }
+
+    if (!isRayActive) {
+      break;
+    }
+
+    // uniformSampleHemisphere and alignHemisphereWithCoordinateSystem
+    float hemisphereRadius =
+        sqrtf(std::max(0.0f, 1.0f - hitRandom[0] * hitRandom[0]));
+    float hemispherePhi = 2.0f * (float)M_PI * hitRandom[1];
+    float hemisphere[3] = {hemisphereRadius * cosf(hemispherePhi),
+                           hitRandom[0],
+                           hemisphereRadius * sinf(hemispherePhi)};
+
+    float hemisphereReference[3] = {0.0072f, 1.0f, 0.0034f};
+    float hemisphereRight[3];
+    crossVector3(geometricNormal, hemisphereReference, hemisphereRight);
+    normalizeVector3(hemisphereRight);
+
+    float hemisphereForward[3];
+    crossVector3(hemisphereRight, geometricNormal, hemisphereForward);
+
+    for (uint32_t y = 0; y < 3; y++) {
+      rayOrigin[y] = position[y];
+      rayDirection[y] = hemisphere[0] * hemisphereRight[y] +
+                        hemisphere[1] * geometricNormal[y] +
+                        hemisphere[2] * hemisphereForward[y];
+      previousNormal[y] = geometricNormal[y];
+    }
+
+    rayDepth += 1;
   }
 
-  if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
-    message = STRING_WARNING + message + STRING_RESET;
-    std::cerr << message.c_str() << std::endl;
+  for (uint32_t x = 0; x < 3; x++) {
+    color[x] = directColor[x] + indirectColor[x];
   }
+}
 
-  if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
-    message = STRING_ERROR + message + STRING_RESET;
-    std::cerr << message.c_str() << std::endl;
-  }
+// Renders the row tiles left in the scheduler on every hardware thread, the
+// same image renderTiles traces on a device. The scene must be fully loaded.
+void renderTilesOnHost(const Scene &scene, TileScheduler &tileScheduler,
+                       std::vector<uint8_t> &hostImageBuffer) {
+  TraceSection hostTraceSection = {.trackIndex = addTraceTrack("Host")};
 
-  return VK_FALSE;
-}
-#endif
+  beginTraceSection(hostTraceSection, "Host Bounding Volume Hierarchy");
 
-void throwExceptionVulkanAPI(VkResult result, const std::string &functionName) {
-  std::string message = "Vulkan API exception: return code " +
-                        std::to_string(result) + " (" + functionName + ")";
+  HostBVH hostBVH;
+  buildHostBVH(scene, hostBVH);
 
-  std::cerr << message.c_str() << std::endl;
+  beginTraceSection(hostTraceSection, "Host Trace");
 
-  throw std::runtime_error(message);
-}
+  UniformStructure uniformStructure;
 
-int main() {
-  VkResult result;
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
 
-  // =========================================================================
-  // Vulkan Instance
+  std::atomic<uint32_t> renderedRowCount = 0;
 
-  VkDebugUtilsMessengerCreateInfoEXT *debugUtilsMessengerCreateInfoPtr = NULL;
+  uint32_t threadCount =
+      runTasksInParallel(tileScheduler.rowCount, [&](uint32_t) {
+        uint32_t row = 0;
+        {
+          std::lock_guard<std::mutex> tileSchedulerLock(tileScheduler.mutex);
 
-#if defined(VALIDATION_ENABLED)
-  std::vector<VkValidationFeatureEnableEXT> validationFeatureEnableList = {
-      // VK_VALIDATION_FEATURE_ENABLE_BEST_PRACTICES_EXT,
-      VK_VALIDATION_FEATURE_ENABLE_DEBUG_PRINTF_EXT,
-      VK_VALIDATION_FEATURE_ENABLE_SYNCHRONIZATION_VALIDATION_EXT};
+          if (tileScheduler.nextRow >= tileScheduler.rowCount) {
+            return;
+          }
 
-  VkDebugUtilsMessageSeverityFlagBitsEXT debugUtilsMessageSeverityFlagBits =
-      (VkDebugUtilsMessageSeverityFlagBitsEXT)(
-          // VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-          VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
-          VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-          VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT);
+          row = tileScheduler.nextRow++;
+        }
 
-  VkDebugUtilsMessageTypeFlagBitsEXT debugUtilsMessageTypeFlagBits =
-      (VkDebugUtilsMessageTypeFlagBitsEXT)(
-          // VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-          VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-          VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT);
+        for (uint32_t x = 0; x < 800; x++) {
+          float color[3];
+          traceHostPixel(scene, hostBVH, uniformStructure, x, row, 800,
+                         tileScheduler.rowCount, color);
 
-  VkValidationFeaturesEXT validationFeatures = {
-      .sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT,
-      .pNext = NULL,
-      .enabledValidationFeatureCount =
-          (uint32_t)validationFeatureEnableList.size(),
-      .pEnabledValidationFeatures = validationFeatureEnableList.data(),
-      .disabledValidationFeatureCount = 0,
-      .pDisabledValidationFeatures = NULL};
+          // Stored like the R8G8B8A8_UNORM storage image
+          uint8_t *pixel = &hostImageBuffer[((size_t)row * 800 + x) * 4];
+          for (uint32_t y = 0; y < 3; y++) {
+            pixel[y] = (uint8_t)(
+                (color[y] > 0.0f ? std::min(color[y], 1.0f) : 0.0f) * 255.0f +
+                0.5f);
+          }
+          pixel[3] = 255;
+        }
 
-  VkDebugUtilsMessengerCreateInfoEXT debugUtilsMessengerCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
-      .pNext = &validationFeatures,
-      .flags = 0,
-      .messageSeverity =
-          (VkDebugUtilsMessageSeverityFlagsEXT)debugUtilsMessageSeverityFlagBits,
-      .messageType =
-          (VkDebugUtilsMessageTypeFlagsEXT)debugUtilsMessageTypeFlagBits,
-      .pfnUserCallback = &debugCallback,
-      .pUserData = NULL};
+        renderedRowCount += 1;
+      });
 
-  debugUtilsMessengerCreateInfoPtr = &debugUtilsMessengerCreateInfo;
-#endif
+  double traceMilliseconds = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() -
+                                 startTimePoint)
+                                 .count();
 
-  VkApplicationInfo applicationInfo = {
-      .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-      .pNext = NULL,
-      .pApplicationName = "Ray Tracing Pipeline Example",
-      .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
-      .pEngineName = "",
-      .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-      .apiVersion = VK_API_VERSION_1_3};
+  std::cout << "Host: " << renderedRowCount << " rows in "
+            << traceMilliseconds << " ms on " << threadCount << " threads"
+            << std::endl;
 
-  std::vector<const char *> instanceLayerList = {};
-  std::vector<const char *> instanceExtensionList = {"VK_KHR_get_physical_device_properties2"};
+  endTraceSection(hostTraceSection);
+}
 
-#if defined(VALIDATION_ENABLED)
-  instanceLayerList.push_back("VK_LAYER_KHRONOS_validation");
-  instanceExtensionList.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-#endif
+// Returns a transfer only queue family, which usually maps to a dedicated copy
+// engine, or -1 if the device has none that can copy row tiles of an image.
+// Tiles span the whole width and depth of the image, so only the row
+// granularity of image copies matters. tileRowAlignment is set to it, or to
+// 1 without such a family.
+uint32_t findTransferQueueFamilyIndex(VkPhysicalDevice physicalDeviceHandle,
+                                      uint32_t &tileRowAlignment) {
+  uint32_t queueFamilyPropertyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDeviceHandle,
+                                           &queueFamilyPropertyCount, NULL);
 
-  VkInstanceCreateInfo instanceCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-      .pNext = debugUtilsMessengerCreateInfoPtr,
-      .flags = 0,
-      .pApplicationInfo = &applicationInfo,
-      .enabledLayerCount = (uint32_t)instanceLayerList.size(),
-      .ppEnabledLayerNames = instanceLayerList.data(),
-      .enabledExtensionCount = (uint32_t)instanceExtensionList.size(),
-      .ppEnabledExtensionNames = instanceExtensionList.data(),
-  };
+  std::vector<VkQueueFamilyProperties> queueFamilyPropertiesList(
+      queueFamilyPropertyCount);
 
-  VkInstance instanceHandle = VK_NULL_HANDLE;
-  result = vkCreateInstance(&instanceCreateInfo, NULL, &instanceHandle);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDeviceHandle,
+                                           &queueFamilyPropertyCount,
+                                           queueFamilyPropertiesList.data());
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateInstance");
-  }
+  tileRowAlignment = 1;
+  for (uint32_t x = 0; x < queueFamilyPropertiesList.size(); x++) {
+    if (!(queueFamilyPropertiesList[x].queueFlags & VK_QUEUE_TRANSFER_BIT) ||
+        (queueFamilyPropertiesList[x].queueFlags &
+         (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+      continue;
+    }
 
-  // =========================================================================
-  // Physical Device
+    // A zero granularity only allows copying whole images
+    VkExtent3D minImageTransferGranularity =
+        queueFamilyPropertiesList[x].minImageTransferGranularity;
 
-  uint32_t physicalDeviceCount = 0;
-  result =
-      vkEnumeratePhysicalDevices(instanceHandle, &physicalDeviceCount, NULL);
+    if (minImageTransferGranularity.height == 0) {
+      continue;
+    }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkEnumeratePhysicalDevices");
+    tileRowAlignment = minImageTransferGranularity.height;
+    return x;
   }
 
-  std::vector<VkPhysicalDevice> physicalDeviceHandleList(physicalDeviceCount);
-  result = vkEnumeratePhysicalDevices(instanceHandle, &physicalDeviceCount,
-                                      physicalDeviceHandleList.data());
+  return -1;
+}
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkEnumeratePhysicalDevices");
-  }
+// Creates a logical device on the physical device, uploads the scene as it is
+// loaded, builds the acceleration structures, then traces row tiles claimed
+// from the scheduler until the image is complete. With HEATMAP_ENABLED the
+// tiles' heatmap texels are read back into hostHeatmapBuffer as well.
+void renderTiles(VkPhysicalDevice activePhysicalDeviceHandle,
+                 const std::vector<const char *> &deviceExtensionList,
+                 Scene &scene, TileScheduler &tileScheduler,
+#if defined(HEATMAP_ENABLED)
+                 std::vector<uint32_t> &hostHeatmapBuffer,
+#endif
+                 std::vector<uint8_t> &hostImageBuffer) {
+  VkResult result;
 
-  VkPhysicalDevice activePhysicalDeviceHandle = physicalDeviceHandleList[0];
+  // =========================================================================
+  // Physical Device Properties
 
   VkPhysicalDeviceProperties physicalDeviceProperties;
   vkGetPhysicalDeviceProperties(activePhysicalDeviceHandle,
                                 &physicalDeviceProperties);
 
+  VkPhysicalDeviceAccelerationStructurePropertiesKHR
+      physicalDeviceAccelerationStructureProperties = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR,
+          .pNext = NULL};
+
   VkPhysicalDeviceRayTracingPipelinePropertiesKHR
       physicalDeviceRayTracingPipelineProperties = {
           .sType =
               VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR,
-          .pNext = NULL};
+          .pNext = &physicalDeviceAccelerationStructureProperties};
 
   VkPhysicalDeviceProperties2 physicalDeviceProperties2 = {
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
@@ -182,14 +2673,31 @@ int main() {
 
   std::cout << physicalDeviceProperties.deviceName << std::endl;
 
+  // One trace track for this device's thread and one for each of its queues
+  std::string deviceName = physicalDeviceProperties.deviceName;
+  TraceSection deviceTraceSection = {.trackIndex = addTraceTrack(deviceName)};
+  uint32_t graphicsQueueTraceTrackIndex =
+      addTraceTrack(deviceName + " graphics queue");
+  uint32_t transferQueueTraceTrackIndex =
+      addTraceTrack(deviceName + " transfer queue");
+
   // =========================================================================
   // Physical Device Features
 
+  beginTraceSection(deviceTraceSection, "Physical Device Features");
+
+  VkPhysicalDeviceTimelineSemaphoreFeatures
+      physicalDeviceTimelineSemaphoreFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+          .pNext = NULL,
+          .timelineSemaphore = VK_TRUE};
+
   VkPhysicalDeviceBufferDeviceAddressFeatures
       physicalDeviceBufferDeviceAddressFeatures = {
           .sType =
               VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES,
-          .pNext = NULL,
+          .pNext = &physicalDeviceTimelineSemaphoreFeatures,
           .bufferDeviceAddress = VK_TRUE,
           .bufferDeviceAddressCaptureReplay = VK_FALSE,
           .bufferDeviceAddressMultiDevice = VK_FALSE};
@@ -217,9 +2725,68 @@ int main() {
           .rayTraversalPrimitiveCulling = VK_FALSE};
   VkPhysicalDeviceFeatures deviceFeatures = {.geometryShader = VK_TRUE};
 
+#if defined(HEATMAP_ENABLED)
+  // The shader clock is optional, without it the heatmap has no clock channel
+  VkPhysicalDeviceShaderClockFeaturesKHR physicalDeviceShaderClockFeatures = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_CLOCK_FEATURES_KHR,
+      .pNext = NULL,
+      .shaderSubgroupClock = VK_FALSE,
+      .shaderDeviceClock = VK_FALSE};
+
+  bool isShaderClockSupported = false;
+  if (isDeviceExtensionSupported(activePhysicalDeviceHandle,
+                                 "VK_KHR_shader_clock")) {
+    VkPhysicalDeviceFeatures2 physicalDeviceFeatures2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &physicalDeviceShaderClockFeatures};
+
+    vkGetPhysicalDeviceFeatures2(activePhysicalDeviceHandle,
+                                 &physicalDeviceFeatures2);
+
+    isShaderClockSupported =
+        physicalDeviceShaderClockFeatures.shaderSubgroupClock;
+  }
+
+  physicalDeviceShaderClockFeatures.pNext = NULL;
+  physicalDeviceShaderClockFeatures.shaderDeviceClock = VK_FALSE;
+#endif
+
+#if defined(HOST_BUILD_ENABLED)
+  // Host commands are optional, without them the bottom level acceleration
+  // structure is built on the device
+  VkPhysicalDeviceAccelerationStructureFeaturesKHR
+      supportedAccelerationStructureFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+          .pNext = NULL};
+
+  VkPhysicalDeviceFeatures2 accelerationStructurePhysicalDeviceFeatures2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &supportedAccelerationStructureFeatures};
+
+  vkGetPhysicalDeviceFeatures2(activePhysicalDeviceHandle,
+                               &accelerationStructurePhysicalDeviceFeatures2);
+
+  bool isHostBuildSupported =
+      supportedAccelerationStructureFeatures.accelerationStructureHostCommands;
+
+  physicalDeviceAccelerationStructureFeatures
+      .accelerationStructureHostCommands = isHostBuildSupported;
+#endif
+
+  // VK_EXT_memory_budget is optional, it reports the heap budgets the memory
+  // ledger is checked against
+  MemoryLedger memoryLedger = {
+      .physicalDeviceHandle = activePhysicalDeviceHandle,
+      .isMemoryBudgetSupported = isDeviceExtensionSupported(
+          activePhysicalDeviceHandle, "VK_EXT_memory_budget")};
+
   // =========================================================================
   // Physical Device Submission Queue Families
 
+  beginTraceSection(deviceTraceSection,
+                    "Physical Device Submission Queue Families");
+
   uint32_t queueFamilyPropertyCount = 0;
   vkGetPhysicalDeviceQueueFamilyProperties(activePhysicalDeviceHandle,
                                            &queueFamilyPropertyCount, NULL);
@@ -239,38 +2806,71 @@ int main() {
     }
   }
 
+  // A transfer only family lets uploads and readback run alongside tracing.
+  // Falls back to the graphics family when the device has none that can copy
+  // row tiles. The scheduler's row alignment already covers the family's.
+  uint32_t transferTileRowAlignment = 1;
+  uint32_t transferQueueFamilyIndex = findTransferQueueFamilyIndex(
+      activePhysicalDeviceHandle, transferTileRowAlignment);
+
+  if (transferQueueFamilyIndex == (uint32_t)-1) {
+    transferQueueFamilyIndex = queueFamilyIndex;
+  }
+
+  std::vector<uint32_t> queueFamilyIndexList = {queueFamilyIndex};
+  if (transferQueueFamilyIndex != queueFamilyIndex) {
+    queueFamilyIndexList.push_back(transferQueueFamilyIndex);
+  }
+
   std::vector<float> queuePrioritiesList = {1.0f};
-  VkDeviceQueueCreateInfo deviceQueueCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .queueFamilyIndex = queueFamilyIndex,
-      .queueCount = 1,
-      .pQueuePriorities = queuePrioritiesList.data()};
+  std::vector<VkDeviceQueueCreateInfo> deviceQueueCreateInfoList;
+  for (uint32_t queueFamilyIndexItem : queueFamilyIndexList) {
+    deviceQueueCreateInfoList.push_back(
+        {.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+         .pNext = NULL,
+         .flags = 0,
+         .queueFamilyIndex = queueFamilyIndexItem,
+         .queueCount = 1,
+         .pQueuePriorities = queuePrioritiesList.data()});
+  }
 
   // =========================================================================
   // Logical Device
 
-  std::vector<const char *> deviceExtensionList = {
-      "VK_KHR_ray_tracing_pipeline",
-      "VK_KHR_acceleration_structure",
-      "VK_EXT_descriptor_indexing",
-      "VK_KHR_maintenance3",
-      "VK_KHR_buffer_device_address",
-      "VK_KHR_deferred_host_operations"};
+  beginTraceSection(deviceTraceSection, "Logical Device");
+
+  // Optional extensions are appended to the ones every device requires
+  std::vector<const char *> enabledDeviceExtensionList = deviceExtensionList;
+
+  if (memoryLedger.isMemoryBudgetSupported) {
+    enabledDeviceExtensionList.push_back("VK_EXT_memory_budget");
+  }
+
+#if defined(HEATMAP_ENABLED)
+  if (isShaderClockSupported) {
+    enabledDeviceExtensionList.push_back("VK_KHR_shader_clock");
+  }
+#endif
 
   VkDeviceCreateInfo deviceCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
       .pNext = &physicalDeviceRayTracingPipelineFeatures,
       .flags = 0,
-      .queueCreateInfoCount = 1,
-      .pQueueCreateInfos = &deviceQueueCreateInfo,
+      .queueCreateInfoCount = (uint32_t)deviceQueueCreateInfoList.size(),
+      .pQueueCreateInfos = deviceQueueCreateInfoList.data(),
       .enabledLayerCount = 0,
       .ppEnabledLayerNames = NULL,
-      .enabledExtensionCount = (uint32_t)deviceExtensionList.size(),
-      .ppEnabledExtensionNames = deviceExtensionList.data(),
+      .enabledExtensionCount = (uint32_t)enabledDeviceExtensionList.size(),
+      .ppEnabledExtensionNames = enabledDeviceExtensionList.data(),
       .pEnabledFeatures = &deviceFeatures};
 
+#if defined(HEATMAP_ENABLED)
+  if (isShaderClockSupported) {
+    physicalDeviceShaderClockFeatures.pNext = (void *)deviceCreateInfo.pNext;
+    deviceCreateInfo.pNext = &physicalDeviceShaderClockFeatures;
+  }
+#endif
+
   VkDevice deviceHandle = VK_NULL_HANDLE;
   result = vkCreateDevice(activePhysicalDeviceHandle, &deviceCreateInfo, NULL,
                           &deviceHandle);
@@ -282,12 +2882,20 @@ int main() {
   // =========================================================================
   // Submission Queue
 
+  beginTraceSection(deviceTraceSection, "Submission Queue");
+
   VkQueue queueHandle = VK_NULL_HANDLE;
   vkGetDeviceQueue(deviceHandle, queueFamilyIndex, 0, &queueHandle);
 
+  VkQueue transferQueueHandle = VK_NULL_HANDLE;
+  vkGetDeviceQueue(deviceHandle, transferQueueFamilyIndex, 0,
+                   &transferQueueHandle);
+
   // =========================================================================
   // Device Pointer Functions
 
+  beginTraceSection(deviceTraceSection, "Device Pointer Functions");
+
   PFN_vkGetBufferDeviceAddressKHR pvkGetBufferDeviceAddressKHR =
       (PFN_vkGetBufferDeviceAddressKHR)vkGetDeviceProcAddr(
           deviceHandle, "vkGetBufferDeviceAddressKHR");
@@ -318,6 +2926,45 @@ int main() {
       (PFN_vkCmdBuildAccelerationStructuresKHR)vkGetDeviceProcAddr(
           deviceHandle, "vkCmdBuildAccelerationStructuresKHR");
 
+#if defined(ACCELERATION_STRUCTURE_COMMANDS_ENABLED)
+  PFN_vkCmdWriteAccelerationStructuresPropertiesKHR
+      pvkCmdWriteAccelerationStructuresPropertiesKHR =
+          (PFN_vkCmdWriteAccelerationStructuresPropertiesKHR)
+              vkGetDeviceProcAddr(deviceHandle,
+                                  "vkCmdWriteAccelerationStructuresPropertiesKHR");
+
+  PFN_vkCmdCopyAccelerationStructureKHR pvkCmdCopyAccelerationStructureKHR =
+      (PFN_vkCmdCopyAccelerationStructureKHR)vkGetDeviceProcAddr(
+          deviceHandle, "vkCmdCopyAccelerationStructureKHR");
+#endif
+
+#if defined(HOST_BUILD_ENABLED)
+  PFN_vkBuildAccelerationStructuresKHR pvkBuildAccelerationStructuresKHR =
+      (PFN_vkBuildAccelerationStructuresKHR)vkGetDeviceProcAddr(
+          deviceHandle, "vkBuildAccelerationStructuresKHR");
+
+  PFN_vkCreateDeferredOperationKHR pvkCreateDeferredOperationKHR =
+      (PFN_vkCreateDeferredOperationKHR)vkGetDeviceProcAddr(
+          deviceHandle, "vkCreateDeferredOperationKHR");
+
+  PFN_vkDestroyDeferredOperationKHR pvkDestroyDeferredOperationKHR =
+      (PFN_vkDestroyDeferredOperationKHR)vkGetDeviceProcAddr(
+          deviceHandle, "vkDestroyDeferredOperationKHR");
+
+  PFN_vkGetDeferredOperationMaxConcurrencyKHR
+      pvkGetDeferredOperationMaxConcurrencyKHR =
+          (PFN_vkGetDeferredOperationMaxConcurrencyKHR)vkGetDeviceProcAddr(
+              deviceHandle, "vkGetDeferredOperationMaxConcurrencyKHR");
+
+  PFN_vkGetDeferredOperationResultKHR pvkGetDeferredOperationResultKHR =
+      (PFN_vkGetDeferredOperationResultKHR)vkGetDeviceProcAddr(
+          deviceHandle, "vkGetDeferredOperationResultKHR");
+
+  PFN_vkDeferredOperationJoinKHR pvkDeferredOperationJoinKHR =
+      (PFN_vkDeferredOperationJoinKHR)vkGetDeviceProcAddr(
+          deviceHandle, "vkDeferredOperationJoinKHR");
+#endif
+
   PFN_vkGetRayTracingShaderGroupHandlesKHR
       pvkGetRayTracingShaderGroupHandlesKHR =
           (PFN_vkGetRayTracingShaderGroupHandlesKHR)vkGetDeviceProcAddr(
@@ -334,45 +2981,224 @@ int main() {
       .deviceMask = 0};
 
   // =========================================================================
-  // Command Pool
+  // Command Pool
+
+  beginTraceSection(deviceTraceSection, "Command Pool");
+
+  VkCommandPoolCreateInfo commandPoolCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .pNext = NULL,
+      .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = queueFamilyIndex};
+
+  VkCommandPool commandPoolHandle = VK_NULL_HANDLE;
+  result = vkCreateCommandPool(deviceHandle, &commandPoolCreateInfo, NULL,
+                               &commandPoolHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateCommandPool");
+  }
+
+  // =========================================================================
+  // Command Buffers
+
+  beginTraceSection(deviceTraceSection, "Command Buffers");
+
+  VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .pNext = NULL,
+      .commandPool = commandPoolHandle,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 16};
+
+  std::vector<VkCommandBuffer> commandBufferHandleList =
+      std::vector<VkCommandBuffer>(16, VK_NULL_HANDLE);
+
+  result = vkAllocateCommandBuffers(deviceHandle, &commandBufferAllocateInfo,
+                                    commandBufferHandleList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateCommandBuffers");
+  }
+
+  // =========================================================================
+  // Transfer Command Pool
+
+  beginTraceSection(deviceTraceSection, "Transfer Command Pool");
+
+  VkCommandPoolCreateInfo transferCommandPoolCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .pNext = NULL,
+      .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = transferQueueFamilyIndex};
+
+  VkCommandPool transferCommandPoolHandle = VK_NULL_HANDLE;
+  result = vkCreateCommandPool(deviceHandle, &transferCommandPoolCreateInfo,
+                               NULL, &transferCommandPoolHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateCommandPool");
+  }
+
+  // =========================================================================
+  // Transfer Command Buffers
+
+  beginTraceSection(deviceTraceSection, "Transfer Command Buffers");
+
+  VkCommandBufferAllocateInfo transferCommandBufferAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .pNext = NULL,
+      .commandPool = transferCommandPoolHandle,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 3};
+
+  std::vector<VkCommandBuffer> transferCommandBufferHandleList =
+      std::vector<VkCommandBuffer>(3, VK_NULL_HANDLE);
+
+  result = vkAllocateCommandBuffers(deviceHandle,
+                                    &transferCommandBufferAllocateInfo,
+                                    transferCommandBufferHandleList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateCommandBuffers");
+  }
+
+  // =========================================================================
+  // Scene Upload Command Buffers
+
+  beginTraceSection(deviceTraceSection, "Scene Upload Command Buffers");
+
+  VkCommandBufferAllocateInfo sceneUploadCommandBufferAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .pNext = NULL,
+      .commandPool = transferCommandPoolHandle,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = SCENE_STAGING_SLOT_COUNT};
+
+  std::vector<VkCommandBuffer> sceneUploadCommandBufferHandleList =
+      std::vector<VkCommandBuffer>(SCENE_STAGING_SLOT_COUNT, VK_NULL_HANDLE);
+
+  result = vkAllocateCommandBuffers(deviceHandle,
+                                    &sceneUploadCommandBufferAllocateInfo,
+                                    sceneUploadCommandBufferHandleList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateCommandBuffers");
+  }
+
+  // =========================================================================
+  // Timeline Semaphores
 
-  VkCommandPoolCreateInfo commandPoolCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+  beginTraceSection(deviceTraceSection, "Timeline Semaphores");
+
+  VkSemaphoreTypeCreateInfo timelineSemaphoreTypeCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
       .pNext = NULL,
-      .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-      .queueFamilyIndex = queueFamilyIndex};
+      .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+      .initialValue = 0};
 
-  VkCommandPool commandPoolHandle = VK_NULL_HANDLE;
-  result = vkCreateCommandPool(deviceHandle, &commandPoolCreateInfo, NULL,
-                               &commandPoolHandle);
+  VkSemaphoreCreateInfo timelineSemaphoreCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      .pNext = &timelineSemaphoreTypeCreateInfo,
+      .flags = 0};
+
+  // Signalled by the graphics queue after each trace
+  VkSemaphore renderTimelineSemaphoreHandle = VK_NULL_HANDLE;
+  result = vkCreateSemaphore(deviceHandle, &timelineSemaphoreCreateInfo, NULL,
+                             &renderTimelineSemaphoreHandle);
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateCommandPool");
+    throwExceptionVulkanAPI(result, "vkCreateSemaphore");
   }
 
-  // =========================================================================
-  // Command Buffers
+  // Signalled by the transfer queue after each upload or readback
+  VkSemaphore transferTimelineSemaphoreHandle = VK_NULL_HANDLE;
+  result = vkCreateSemaphore(deviceHandle, &timelineSemaphoreCreateInfo, NULL,
+                             &transferTimelineSemaphoreHandle);
 
-  VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateSemaphore");
+  }
+
+  uint64_t renderTimelineValue = 0;
+  uint64_t transferTimelineValue = 0;
+
+  // =========================================================================
+  // Timestamp Query Pools
+
+  beginTraceSection(deviceTraceSection, "Timestamp Query Pools");
+
+  // Each tile slot brackets its trace on the graphics queue and its readback
+  // on the transfer queue with two timestamps. The startup bottom and top
+  // level builds take two each. Transfer only families may not support
+  // timestamps, in which case the readback goes untimed.
+  bool isTimestampSupported =
+      queueFamilyPropertiesList[queueFamilyIndex].timestampValidBits > 0;
+  bool isTransferTimestampSupported =
+      queueFamilyPropertiesList[transferQueueFamilyIndex].timestampValidBits >
+      0;
+
+  VkQueryPoolCreateInfo timestampQueryPoolCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
       .pNext = NULL,
-      .commandPool = commandPoolHandle,
-      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-      .commandBufferCount = 16};
+      .flags = 0,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = 2 * 2 + 6,
+      .pipelineStatistics = 0};
 
-  std::vector<VkCommandBuffer> commandBufferHandleList =
-      std::vector<VkCommandBuffer>(16, VK_NULL_HANDLE);
+  VkQueryPool timestampQueryPoolHandle = VK_NULL_HANDLE;
+  result = vkCreateQueryPool(deviceHandle, &timestampQueryPoolCreateInfo, NULL,
+                             &timestampQueryPoolHandle);
 
-  result = vkAllocateCommandBuffers(deviceHandle, &commandBufferAllocateInfo,
-                                    commandBufferHandleList.data());
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateQueryPool");
+  }
+
+  VkQueryPoolCreateInfo transferTimestampQueryPoolCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = 2 * 2,
+      .pipelineStatistics = 0};
+
+  VkQueryPool transferTimestampQueryPoolHandle = VK_NULL_HANDLE;
+  result =
+      vkCreateQueryPool(deviceHandle, &transferTimestampQueryPoolCreateInfo,
+                        NULL, &transferTimestampQueryPoolHandle);
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkAllocateCommandBuffers");
+    throwExceptionVulkanAPI(result, "vkCreateQueryPool");
   }
 
+  // Queries 4 to 9 of the graphics pool hold the acceleration structure builds
+  uint32_t bottomLevelTimestampQueryIndex = 4;
+  uint32_t topLevelTimestampQueryIndex = 6;
+
+  TimestampStatistics traceTimestampStatistics;
+  TimestampStatistics readbackTimestampStatistics;
+
+  // Milliseconds between two consecutive timestamps of a pool
+  auto getTimestampMilliseconds = [&](VkQueryPool queryPoolHandle,
+                                      uint32_t firstQuery) {
+    uint64_t timestampList[2];
+    result = vkGetQueryPoolResults(deviceHandle, queryPoolHandle, firstQuery,
+                                   2, sizeof(timestampList), timestampList,
+                                   sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkGetQueryPoolResults");
+    }
+
+    return (timestampList[1] - timestampList[0]) *
+           (double)physicalDeviceProperties.limits.timestampPeriod / 1000000.0;
+  };
+
   // =========================================================================
   // Descriptor Pool
 
+  beginTraceSection(deviceTraceSection, "Descriptor Pool");
+
   std::vector<VkDescriptorPoolSize> descriptorPoolSizeList = {
       {.type = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
        .descriptorCount = 1},
@@ -380,11 +3206,40 @@ int main() {
       {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 4},
       {.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, .descriptorCount = 1}};
 
+#if defined(RAY_COUNTERS_ENABLED)
+  descriptorPoolSizeList.push_back(
+      {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 1});
+#endif
+
+#if defined(HEATMAP_ENABLED)
+  descriptorPoolSizeList.push_back(
+      {.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, .descriptorCount = 1});
+#endif
+
+  // Further copies of set 0 bind the top level acceleration structure of the
+  // clusters and that of the build preset benchmark. Multiplying every size
+  // by the number of set 0 copies leaves room for them.
+  uint32_t descriptorSetCopyCount = 1;
+
+#if defined(BLAS_CLUSTERING_ENABLED)
+  descriptorSetCopyCount += 1;
+#endif
+
+#if defined(BUILD_PRESET_BENCHMARK_ENABLED)
+  descriptorSetCopyCount += 1;
+#endif
+
+  for (VkDescriptorPoolSize &descriptorPoolSize : descriptorPoolSizeList) {
+    descriptorPoolSize.descriptorCount *= descriptorSetCopyCount;
+  }
+
+  uint32_t descriptorPoolMaxSetCount = descriptorSetCopyCount + 1;
+
   VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
       .pNext = NULL,
       .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
-      .maxSets = 2,
+      .maxSets = descriptorPoolMaxSetCount,
       .poolSizeCount = (uint32_t)descriptorPoolSizeList.size(),
       .pPoolSizes = descriptorPoolSizeList.data()};
 
@@ -399,6 +3254,8 @@ int main() {
   // =========================================================================
   // Descriptor Set Layout
 
+  beginTraceSection(deviceTraceSection, "Descriptor Set Layout");
+
   std::vector<VkDescriptorSetLayoutBinding> descriptorSetLayoutBindingList = {
       {.binding = 0,
        .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
@@ -428,6 +3285,25 @@ int main() {
        .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
        .pImmutableSamplers = NULL}};
 
+#if defined(RAY_COUNTERS_ENABLED)
+  descriptorSetLayoutBindingList.push_back(
+      {.binding = 5,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+       .descriptorCount = 1,
+       .stageFlags =
+           VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+       .pImmutableSamplers = NULL});
+#endif
+
+#if defined(HEATMAP_ENABLED)
+  descriptorSetLayoutBindingList.push_back(
+      {.binding = 6,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+       .descriptorCount = 1,
+       .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+       .pImmutableSamplers = NULL});
+#endif
+
   VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
       .pNext = NULL,
@@ -447,6 +3323,8 @@ int main() {
   // =========================================================================
   // Material Descriptor Set Layout
 
+  beginTraceSection(deviceTraceSection, "Material Descriptor Set Layout");
+
   std::vector<VkDescriptorSetLayoutBinding>
       materialDescriptorSetLayoutBindingList = {
           {.binding = 0,
@@ -479,6 +3357,8 @@ int main() {
   // =========================================================================
   // Allocate Descriptor Sets
 
+  beginTraceSection(deviceTraceSection, "Allocate Descriptor Sets");
+
   std::vector<VkDescriptorSetLayout> descriptorSetLayoutHandleList = {
       descriptorSetLayoutHandle, materialDescriptorSetLayoutHandle};
 
@@ -499,17 +3379,61 @@ int main() {
     throwExceptionVulkanAPI(result, "vkAllocateDescriptorSets");
   }
 
+#if defined(BLAS_CLUSTERING_ENABLED)
+  VkDescriptorSetAllocateInfo clusterDescriptorSetAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .pNext = NULL,
+      .descriptorPool = descriptorPoolHandle,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &descriptorSetLayoutHandle};
+
+  VkDescriptorSet clusterDescriptorSetHandle = VK_NULL_HANDLE;
+  result = vkAllocateDescriptorSets(deviceHandle,
+                                    &clusterDescriptorSetAllocateInfo,
+                                    &clusterDescriptorSetHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateDescriptorSets");
+  }
+#endif
+
+#if defined(BUILD_PRESET_BENCHMARK_ENABLED)
+  VkDescriptorSetAllocateInfo benchmarkDescriptorSetAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .pNext = NULL,
+      .descriptorPool = descriptorPoolHandle,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &descriptorSetLayoutHandle};
+
+  VkDescriptorSet benchmarkDescriptorSetHandle = VK_NULL_HANDLE;
+  result = vkAllocateDescriptorSets(deviceHandle,
+                                    &benchmarkDescriptorSetAllocateInfo,
+                                    &benchmarkDescriptorSetHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateDescriptorSets");
+  }
+#endif
+
   // =========================================================================
   // Pipeline Layout
 
+  beginTraceSection(deviceTraceSection, "Pipeline Layout");
+
+  VkPushConstantRange tilePushConstantRange = {
+      .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR |
+                    VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+      .offset = 0,
+      .size = sizeof(uint32_t) * 2};
+
   VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
       .setLayoutCount = (uint32_t)descriptorSetLayoutHandleList.size(),
       .pSetLayouts = descriptorSetLayoutHandleList.data(),
-      .pushConstantRangeCount = 0,
-      .pPushConstantRanges = NULL};
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &tilePushConstantRange};
 
   VkPipelineLayout pipelineLayoutHandle = VK_NULL_HANDLE;
   result = vkCreatePipelineLayout(deviceHandle, &pipelineLayoutCreateInfo, NULL,
@@ -522,6 +3446,8 @@ int main() {
   // =========================================================================
   // Ray Closest Hit Shader Module
 
+  beginTraceSection(deviceTraceSection, "Ray Closest Hit Shader Module");
+
   std::ifstream rayClosestHitFile("shaders/shader.rchit.spv",
                                   std::ios::binary | std::ios::ate);
   std::streamsize rayClosestHitFileSize = rayClosestHitFile.tellg();
@@ -554,7 +3480,17 @@ int main() {
   // =========================================================================
   // Ray Generate Shader Module
 
-  std::ifstream rayGenerateFile("shaders/shader.rgen.spv",
+  beginTraceSection(deviceTraceSection, "Ray Generate Shader Module");
+
+  std::string rayGenerateFileName = "shaders/shader.rgen.spv";
+
+#if defined(HEATMAP_ENABLED)
+  if (isShaderClockSupported) {
+    rayGenerateFileName = "shaders/shader_clock.rgen.spv";
+  }
+#endif
+
+  std::ifstream rayGenerateFile(rayGenerateFileName,
                                 std::ios::binary | std::ios::ate);
   std::streamsize rayGenerateFileSize = rayGenerateFile.tellg();
   rayGenerateFile.seekg(0, std::ios::beg);
@@ -585,6 +3521,8 @@ int main() {
   // =========================================================================
   // Ray Miss Shader Module
 
+  beginTraceSection(deviceTraceSection, "Ray Miss Shader Module");
+
   std::ifstream rayMissFile("shaders/shader.rmiss.spv",
                             std::ios::binary | std::ios::ate);
   std::streamsize rayMissFileSize = rayMissFile.tellg();
@@ -614,6 +3552,8 @@ int main() {
   // =========================================================================
   // Ray Miss Shader Module (Shadow)
 
+  beginTraceSection(deviceTraceSection, "Ray Miss Shader Module (Shadow)");
+
   std::ifstream rayMissShadowFile("shaders/shader_shadow.rmiss.spv",
                                   std::ios::binary | std::ios::ate);
   std::streamsize rayMissShadowFileSize = rayMissShadowFile.tellg();
@@ -646,6 +3586,31 @@ int main() {
   // =========================================================================
   // Ray Tracing Pipeline
 
+  beginTraceSection(deviceTraceSection, "Ray Tracing Pipeline");
+
+  // The closest hit shader reads 16 bit indices when its constant 0 is set,
+  // so the pipeline waits for the scene's index size. Constants 1 and 2 are
+  // the triangles per cluster and the 32 bit word where the scene primitive
+  // indices of the clustered triangles start in the index buffer.
+  waitForSceneSize(scene);
+
+  uint32_t indexSpecializationData[3] = {
+      scene.indexSize == sizeof(uint16_t), SCENE_CLUSTER_PRIMITIVE_COUNT,
+      (uint32_t)(2 * getSceneIndexDataSize(scene) / sizeof(uint32_t))};
+
+  std::vector<VkSpecializationMapEntry> indexSpecializationMapEntryList = {
+      {.constantID = 0, .offset = 0, .size = sizeof(VkBool32)},
+      {.constantID = 1, .offset = sizeof(uint32_t), .size = sizeof(uint32_t)},
+      {.constantID = 2,
+       .offset = sizeof(uint32_t) * 2,
+       .size = sizeof(uint32_t)}};
+
+  VkSpecializationInfo indexSpecializationInfo = {
+      .mapEntryCount = (uint32_t)indexSpecializationMapEntryList.size(),
+      .pMapEntries = indexSpecializationMapEntryList.data(),
+      .dataSize = sizeof(indexSpecializationData),
+      .pData = indexSpecializationData};
+
   std::vector<VkPipelineShaderStageCreateInfo>
       pipelineShaderStageCreateInfoList = {
           {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -654,7 +3619,7 @@ int main() {
            .stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
            .module = rayClosestHitShaderModuleHandle,
            .pName = "main",
-           .pSpecializationInfo = NULL},
+           .pSpecializationInfo = &indexSpecializationInfo},
           {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
            .pNext = NULL,
            .flags = 0,
@@ -738,49 +3703,94 @@ int main() {
   }
 
   // =========================================================================
-  // OBJ Model
+  // Scene Staging Buffer
 
-  tinyobj::ObjReaderConfig reader_config;
-  tinyobj::ObjReader reader;
+  beginTraceSection(deviceTraceSection, "Scene Staging Buffer");
 
-  if (!reader.ParseFromFile("resources/cube_scene.obj", reader_config)) {
-    if (!reader.Error().empty()) {
-      std::cerr << "TinyObjReader: " << reader.Error();
-    }
-    exit(1);
+  VkBufferCreateInfo sceneStagingBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = SCENE_STAGING_SLOT_SIZE * SCENE_STAGING_SLOT_COUNT,
+      .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = 1,
+      .pQueueFamilyIndices = &transferQueueFamilyIndex};
+
+  VkBuffer sceneStagingBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &sceneStagingBufferCreateInfo, NULL,
+                          &sceneStagingBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
   }
 
-  if (!reader.Warning().empty()) {
-    std::cout << "TinyObjReader: " << reader.Warning();
+  VkMemoryRequirements sceneStagingMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, sceneStagingBufferHandle,
+                                &sceneStagingMemoryRequirements);
+
+  uint32_t sceneStagingMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+    if ((sceneStagingMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) ==
+            (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+
+      sceneStagingMemoryTypeIndex = x;
+      break;
+    }
   }
 
-  const tinyobj::attrib_t &attrib = reader.GetAttrib();
-  const std::vector<tinyobj::shape_t> &shapes = reader.GetShapes();
-  const std::vector<tinyobj::material_t> &materials = reader.GetMaterials();
+  VkMemoryAllocateInfo sceneStagingMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = NULL,
+      .allocationSize = sceneStagingMemoryRequirements.size,
+      .memoryTypeIndex = sceneStagingMemoryTypeIndex};
 
-  uint32_t primitiveCount = 0;
-  std::vector<uint32_t> indexList;
-  for (tinyobj::shape_t shape : shapes) {
+  VkDeviceMemory sceneStagingDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Staging",
+                                &sceneStagingMemoryAllocateInfo,
+                                &sceneStagingDeviceMemoryHandle);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(deviceHandle, sceneStagingBufferHandle,
+                              sceneStagingDeviceMemoryHandle, 0);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
 
-    primitiveCount += shape.mesh.num_face_vertices.size();
+  void *hostSceneStagingMemoryBuffer;
+  result = vkMapMemory(deviceHandle, sceneStagingDeviceMemoryHandle, 0,
+                       SCENE_STAGING_SLOT_SIZE * SCENE_STAGING_SLOT_COUNT, 0,
+                       &hostSceneStagingMemoryBuffer);
 
-    for (tinyobj::index_t index : shape.mesh.indices) {
-      indexList.push_back(index.vertex_index);
-    }
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkMapMemory");
   }
 
   // =========================================================================
   // Vertex Buffer
 
+  beginTraceSection(deviceTraceSection, "Vertex Buffer");
+
+  VkDeviceSize vertexBufferSize = getSceneVertexBufferSize(scene);
+  VkDeviceSize indexBufferSize = getSceneIndexBufferSize(scene);
+
   VkBufferCreateInfo vertexBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = sizeof(float) * attrib.vertices.size() * 3,
+      .size = vertexBufferSize,
       .usage =
           VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
           VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
-          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
       .pQueueFamilyIndices = &queueFamilyIndex};
@@ -802,8 +3812,8 @@ int main() {
        x++) {
     if ((vertexMemoryRequirements.memoryTypeBits & (1 << x)) &&
         (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
 
       vertexMemoryTypeIndex = x;
       break;
@@ -817,8 +3827,9 @@ int main() {
       .memoryTypeIndex = vertexMemoryTypeIndex};
 
   VkDeviceMemory vertexDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &vertexMemoryAllocateInfo, NULL,
-                            &vertexDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Vertex",
+                                &vertexMemoryAllocateInfo,
+                                &vertexDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
@@ -829,20 +3840,6 @@ int main() {
     throwExceptionVulkanAPI(result, "vkBindBufferMemory");
   }
 
-  void *hostVertexMemoryBuffer;
-  result = vkMapMemory(deviceHandle, vertexDeviceMemoryHandle, 0,
-                       sizeof(float) * attrib.vertices.size() * 3, 0,
-                       &hostVertexMemoryBuffer);
-
-  memcpy(hostVertexMemoryBuffer, attrib.vertices.data(),
-         sizeof(float) * attrib.vertices.size() * 3);
-
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkMapMemory");
-  }
-
-  vkUnmapMemory(deviceHandle, vertexDeviceMemoryHandle);
-
   VkBufferDeviceAddressInfo vertexBufferDeviceAddressInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
       .pNext = NULL,
@@ -854,15 +3851,18 @@ int main() {
   // =========================================================================
   // Index Buffer
 
+  beginTraceSection(deviceTraceSection, "Index Buffer");
+
   VkBufferCreateInfo indexBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = sizeof(uint32_t) * indexList.size(),
+      .size = indexBufferSize,
       .usage =
           VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
           VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
-          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
       .pQueueFamilyIndices = &queueFamilyIndex};
@@ -884,8 +3884,8 @@ int main() {
        x++) {
     if ((indexMemoryRequirements.memoryTypeBits & (1 << x)) &&
         (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
 
       indexMemoryTypeIndex = x;
       break;
@@ -899,8 +3899,9 @@ int main() {
       .memoryTypeIndex = indexMemoryTypeIndex};
 
   VkDeviceMemory indexDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &indexMemoryAllocateInfo, NULL,
-                            &indexDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Index",
+                                &indexMemoryAllocateInfo,
+                                &indexDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
@@ -908,47 +3909,754 @@ int main() {
   result = vkBindBufferMemory(deviceHandle, indexBufferHandle,
                               indexDeviceMemoryHandle, 0);
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  VkBufferDeviceAddressInfo indexBufferDeviceAddressInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .pNext = NULL,
+      .buffer = indexBufferHandle};
+
+  VkDeviceAddress indexBufferDeviceAddress =
+      pvkGetBufferDeviceAddressKHR(deviceHandle, &indexBufferDeviceAddressInfo);
+
+#if defined(ACCELERATION_STRUCTURE_COMMANDS_ENABLED)
+  // =========================================================================
+  // Acceleration Structure Commands
+
+  beginTraceSection(deviceTraceSection, "Acceleration Structure Commands");
+
+  VkFenceCreateInfo accelerationStructureCommandFenceCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, .pNext = NULL, .flags = 0};
+
+  VkFence accelerationStructureCommandFenceHandle = VK_NULL_HANDLE;
+  result = vkCreateFence(deviceHandle,
+                         &accelerationStructureCommandFenceCreateInfo, NULL,
+                         &accelerationStructureCommandFenceHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateFence");
+  }
+
+  VkQueryPoolCreateInfo compactedSizeQueryPoolCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+      .queryCount = 1,
+      .pipelineStatistics = 0};
+
+  VkQueryPool compactedSizeQueryPoolHandle = VK_NULL_HANDLE;
+  result = vkCreateQueryPool(deviceHandle, &compactedSizeQueryPoolCreateInfo,
+                             NULL, &compactedSizeQueryPoolHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateQueryPool");
+  }
+
+  // Records commands into the last command buffer, submits them and waits for
+  // them. Earlier builds and traces are made visible to them first. Returns
+  // their milliseconds, timed with queries 0 and 1, which are free until the
+  // tiles start, or zero without timestamps.
+  auto submitAccelerationStructureCommands =
+      [&](const std::function<void(VkCommandBuffer)> &recordFunction) {
+        VkCommandBufferBeginInfo commandBufferBeginInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .pNext = NULL,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+            .pInheritanceInfo = NULL};
+
+        result = vkBeginCommandBuffer(commandBufferHandleList.back(),
+                                      &commandBufferBeginInfo);
+
+        if (result != VK_SUCCESS) {
+          throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+        }
+
+        VkMemoryBarrier memoryBarrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .pNext = NULL,
+            .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR |
+                             VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+                             VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR |
+                             VK_ACCESS_SHADER_READ_BIT |
+                             VK_ACCESS_SHADER_WRITE_BIT};
+
+        vkCmdPipelineBarrier(
+            commandBufferHandleList.back(),
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR |
+                VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR |
+                VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            0, 1, &memoryBarrier, 0, NULL, 0, NULL);
+
+        if (isTimestampSupported) {
+          vkCmdResetQueryPool(commandBufferHandleList.back(),
+                              timestampQueryPoolHandle, 0, 2);
+
+          vkCmdWriteTimestamp(commandBufferHandleList.back(),
+                              VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                              timestampQueryPoolHandle, 0);
+        }
+
+        recordFunction(commandBufferHandleList.back());
+
+        if (isTimestampSupported) {
+          vkCmdWriteTimestamp(commandBufferHandleList.back(),
+                              VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                              timestampQueryPoolHandle, 1);
+        }
+
+        result = vkEndCommandBuffer(commandBufferHandleList.back());
+
+        if (result != VK_SUCCESS) {
+          throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+        }
+
+        VkSubmitInfo submitInfo = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = NULL,
+            .waitSemaphoreCount = 0,
+            .pWaitSemaphores = NULL,
+            .pWaitDstStageMask = NULL,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &commandBufferHandleList.back(),
+            .signalSemaphoreCount = 0,
+            .pSignalSemaphores = NULL};
+
+        result = vkQueueSubmit(queueHandle, 1, &submitInfo,
+                               accelerationStructureCommandFenceHandle);
+
+        if (result != VK_SUCCESS) {
+          throwExceptionVulkanAPI(result, "vkQueueSubmit");
+        }
+
+        result = vkWaitForFences(deviceHandle, 1,
+                                 &accelerationStructureCommandFenceHandle, true,
+                                 UINT32_MAX);
+
+        if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+          throwExceptionVulkanAPI(result, "vkWaitForFences");
+        }
+
+        result = vkResetFences(deviceHandle, 1,
+                               &accelerationStructureCommandFenceHandle);
+
+        if (result != VK_SUCCESS) {
+          throwExceptionVulkanAPI(result, "vkResetFences");
+        }
+
+        return isTimestampSupported
+                   ? getTimestampMilliseconds(timestampQueryPoolHandle, 0)
+                   : 0.0;
+      };
+
+  // Creates a buffer bound to a dedicated allocation of the first memory type
+  // with every one of memoryPropertyFlags
+  auto createAccelerationStructureBuffer =
+      [&](VkDeviceSize size, VkBufferUsageFlags usage,
+          VkMemoryPropertyFlags memoryPropertyFlags,
+          const std::string &category, VkBuffer &bufferHandle,
+          VkDeviceMemory &deviceMemoryHandle) {
+        VkBufferCreateInfo bufferCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .size = size,
+            .usage = usage,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = 1,
+            .pQueueFamilyIndices = &queueFamilyIndex};
+
+        result = vkCreateBuffer(deviceHandle, &bufferCreateInfo, NULL,
+                                &bufferHandle);
+
+        if (result != VK_SUCCESS) {
+          throwExceptionVulkanAPI(result, "vkCreateBuffer");
+        }
+
+        VkMemoryRequirements memoryRequirements;
+        vkGetBufferMemoryRequirements(deviceHandle, bufferHandle,
+                                      &memoryRequirements);
+
+        uint32_t memoryTypeIndex = -1;
+        for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+             x++) {
+
+          if ((memoryRequirements.memoryTypeBits & (1 << x)) &&
+              (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+               memoryPropertyFlags) == memoryPropertyFlags) {
+
+            memoryTypeIndex = x;
+            break;
+          }
+        }
+
+        VkMemoryAllocateInfo memoryAllocateInfo = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .pNext = &memoryAllocateFlagsInfo,
+            .allocationSize = memoryRequirements.size,
+            .memoryTypeIndex = memoryTypeIndex};
+
+        result = allocateDeviceMemory(deviceHandle, memoryLedger, category,
+                                      &memoryAllocateInfo, &deviceMemoryHandle);
+
+        if (result != VK_SUCCESS) {
+          throwExceptionVulkanAPI(result, "vkAllocateMemory");
+        }
+
+        result = vkBindBufferMemory(deviceHandle, bufferHandle,
+                                    deviceMemoryHandle, 0);
+
+        if (result != VK_SUCCESS) {
+          throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+        }
+      };
+
+  // Copies an acceleration structure built with ALLOW_COMPACTION into a buffer
+  // of its compacted size and replaces it, its buffer and its memory with the
+  // copy. Returns the milliseconds of the copy and sets compactedSize.
+  auto compactAccelerationStructure =
+      [&](VkAccelerationStructureTypeKHR type,
+          VkAccelerationStructureKHR &accelerationStructureHandle,
+          VkBuffer &bufferHandle, VkDeviceMemory &deviceMemoryHandle,
+          VkDeviceSize &compactedSize) {
+        submitAccelerationStructureCommands(
+            [&](VkCommandBuffer commandBufferHandle) {
+              vkCmdResetQueryPool(commandBufferHandle,
+                                  compactedSizeQueryPoolHandle, 0, 1);
+
+              pvkCmdWriteAccelerationStructuresPropertiesKHR(
+                  commandBufferHandle, 1, &accelerationStructureHandle,
+                  VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+                  compactedSizeQueryPoolHandle, 0);
+            });
+
+        result = vkGetQueryPoolResults(
+            deviceHandle, compactedSizeQueryPoolHandle, 0, 1,
+            sizeof(VkDeviceSize), &compactedSize, sizeof(VkDeviceSize),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+        if (result != VK_SUCCESS) {
+          throwExceptionVulkanAPI(result, "vkGetQueryPoolResults");
+        }
+
+        VkBuffer compactedBufferHandle = VK_NULL_HANDLE;
+        VkDeviceMemory compactedDeviceMemoryHandle = VK_NULL_HANDLE;
+        createAccelerationStructureBuffer(
+            compactedSize,
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, "Acceleration structure",
+            compactedBufferHandle, compactedDeviceMemoryHandle);
+
+        VkAccelerationStructureCreateInfoKHR
+            compactedAccelerationStructureCreateInfo = {
+                .sType =
+                    VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+                .pNext = NULL,
+                .createFlags = 0,
+                .buffer = compactedBufferHandle,
+                .offset = 0,
+                .size = compactedSize,
+                .type = type,
+                .deviceAddress = 0};
+
+        VkAccelerationStructureKHR compactedAccelerationStructureHandle =
+            VK_NULL_HANDLE;
+
+        result = pvkCreateAccelerationStructureKHR(
+            deviceHandle, &compactedAccelerationStructureCreateInfo, NULL,
+            &compactedAccelerationStructureHandle);
+
+        if (result != VK_SUCCESS) {
+          throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
+        }
+
+        VkCopyAccelerationStructureInfoKHR copyAccelerationStructureInfo = {
+            .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+            .pNext = NULL,
+            .src = accelerationStructureHandle,
+            .dst = compactedAccelerationStructureHandle,
+            .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR};
+
+        double compactionMilliseconds = submitAccelerationStructureCommands(
+            [&](VkCommandBuffer commandBufferHandle) {
+              pvkCmdCopyAccelerationStructureKHR(
+                  commandBufferHandle, &copyAccelerationStructureInfo);
+            });
+
+        pvkDestroyAccelerationStructureKHR(deviceHandle,
+                                           accelerationStructureHandle, NULL);
+        vkDestroyBuffer(deviceHandle, bufferHandle, NULL);
+        freeDeviceMemory(deviceHandle, memoryLedger, deviceMemoryHandle);
+
+        accelerationStructureHandle = compactedAccelerationStructureHandle;
+        bufferHandle = compactedBufferHandle;
+        deviceMemoryHandle = compactedDeviceMemoryHandle;
+
+        return compactionMilliseconds;
+      };
+#endif
+
+#if defined(HOST_BUILD_ENABLED)
+  // =========================================================================
+  // Host Bottom Level Acceleration Structure
+
+  beginTraceSection(deviceTraceSection,
+                    "Host Bottom Level Acceleration Structure");
+
+  // Where the device supports host commands, the CPU builds the bottom level
+  // acceleration structure from the scene in host memory into host visible
+  // memory while the scene uploads. The build is deferred and joined by one
+  // worker per hardware thread. The device later clones it into device local
+  // memory in place of its own build.
+  VkAccelerationStructureGeometryKHR hostBottomLevelGeometry = {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+      .pNext = NULL,
+      .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+      .geometry =
+          {.triangles =
+               {.sType =
+                    VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+                .pNext = NULL,
+                .vertexFormat = SCENE_VERTEX_FORMAT,
+                .vertexData = {.hostAddress = NULL},
+                .vertexStride = SCENE_VERTEX_STRIDE,
+                .maxVertex = (uint32_t)scene.vertexCount,
+                .indexType = scene.indexSize == sizeof(uint16_t)
+                                 ? VK_INDEX_TYPE_UINT16
+                                 : VK_INDEX_TYPE_UINT32,
+                .indexData = {.hostAddress = NULL},
+                .transformData = {.hostAddress = NULL}}},
+      .flags = VK_GEOMETRY_OPAQUE_BIT_KHR};
+
+  VkAccelerationStructureBuildGeometryInfoKHR
+      hostBottomLevelBuildGeometryInfo = {
+          .sType =
+              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+          .pNext = NULL,
+          .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+          .flags = getBuildPresetFlags(BOTTOM_LEVEL_BUILD_PRESET),
+          .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+          .srcAccelerationStructure = VK_NULL_HANDLE,
+          .dstAccelerationStructure = VK_NULL_HANDLE,
+          .geometryCount = 1,
+          .pGeometries = &hostBottomLevelGeometry,
+          .ppGeometries = NULL,
+          .scratchData = {.hostAddress = NULL}};
+
+  VkAccelerationStructureBuildSizesInfoKHR hostBottomLevelBuildSizesInfo = {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+      .pNext = NULL,
+      .accelerationStructureSize = 0,
+      .updateScratchSize = 0,
+      .buildScratchSize = 0};
+
+  VkAccelerationStructureKHR hostBottomLevelAccelerationStructureHandle =
+      VK_NULL_HANDLE;
+  VkBuffer hostBottomLevelBufferHandle = VK_NULL_HANDLE;
+  VkDeviceMemory hostBottomLevelDeviceMemoryHandle = VK_NULL_HANDLE;
+
+  std::thread hostBottomLevelBuildThread;
+  std::exception_ptr hostBottomLevelBuildException;
+  double hostBottomLevelBuildMilliseconds = 0.0;
+  uint32_t hostBottomLevelBuildThreadCount = 0;
+
+  if (isHostBuildSupported) {
+    uint32_t hostPrimitiveCount = (uint32_t)scene.primitiveCount;
+    pvkGetAccelerationStructureBuildSizesKHR(
+        deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR,
+        &hostBottomLevelBuildGeometryInfo, &hostPrimitiveCount,
+        &hostBottomLevelBuildSizesInfo);
+
+    createAccelerationStructureBuffer(
+        hostBottomLevelBuildSizesInfo.accelerationStructureSize,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        "Acceleration structure", hostBottomLevelBufferHandle,
+        hostBottomLevelDeviceMemoryHandle);
+
+    VkAccelerationStructureCreateInfoKHR hostBottomLevelCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+        .pNext = NULL,
+        .createFlags = 0,
+        .buffer = hostBottomLevelBufferHandle,
+        .offset = 0,
+        .size = hostBottomLevelBuildSizesInfo.accelerationStructureSize,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .deviceAddress = 0};
+
+    result = pvkCreateAccelerationStructureKHR(
+        deviceHandle, &hostBottomLevelCreateInfo, NULL,
+        &hostBottomLevelAccelerationStructureHandle);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
+    }
+
+    hostBottomLevelBuildThread = std::thread([&]() {
+      TraceSection hostBuildTraceSection = {
+          .trackIndex = addTraceTrack(std::string(
+                            physicalDeviceProperties.deviceName) +
+                        " host build")};
+      beginTraceSection(hostBuildTraceSection, "Host Bottom Level Build");
+
+      try {
+        // The whole scene has to be in host memory
+        for (uint32_t x = 0; x < scene.rangeList.size(); x++) {
+          waitForSceneRange(scene, x);
+        }
+
+        VkAccelerationStructureGeometryTrianglesDataKHR &hostTrianglesData =
+            hostBottomLevelGeometry.geometry.triangles;
+
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+        waitForSceneQuantization(scene);
+
+        hostTrianglesData.vertexData.hostAddress =
+            scene.quantizedVertexList.data();
+        hostTrianglesData.transformData.hostAddress =
+            scene.quantizationTransform;
+#else
+        hostTrianglesData.vertexData.hostAddress = scene.vertexData;
+#endif
+        hostTrianglesData.indexData.hostAddress = scene.indexData;
+
+        std::vector<uint8_t> hostScratchBuffer(
+            hostBottomLevelBuildSizesInfo.buildScratchSize);
+
+        hostBottomLevelBuildGeometryInfo.dstAccelerationStructure =
+            hostBottomLevelAccelerationStructureHandle;
+        hostBottomLevelBuildGeometryInfo.scratchData = {
+            .hostAddress = hostScratchBuffer.data()};
+
+        VkAccelerationStructureBuildRangeInfoKHR hostBuildRangeInfo = {
+            .primitiveCount = (uint32_t)scene.primitiveCount,
+            .primitiveOffset = 0,
+            .firstVertex = 0,
+            .transformOffset = 0};
+
+        const VkAccelerationStructureBuildRangeInfoKHR *hostBuildRangeInfos =
+            &hostBuildRangeInfo;
+
+        std::chrono::steady_clock::time_point startTimePoint =
+            std::chrono::steady_clock::now();
+
+        VkDeferredOperationKHR deferredOperationHandle = VK_NULL_HANDLE;
+        VkResult hostResult = pvkCreateDeferredOperationKHR(
+            deviceHandle, NULL, &deferredOperationHandle);
+
+        if (hostResult != VK_SUCCESS) {
+          throwExceptionVulkanAPI(hostResult, "vkCreateDeferredOperationKHR");
+        }
+
+        hostResult = pvkBuildAccelerationStructuresKHR(
+            deviceHandle, deferredOperationHandle, 1,
+            &hostBottomLevelBuildGeometryInfo, &hostBuildRangeInfos);
+
+        if (hostResult == VK_OPERATION_DEFERRED_KHR) {
+          // Every worker joins until the operation has no more work for it.
+          // An idle join means others hold the remaining work for now.
+          uint32_t joinThreadCount = std::min(
+              pvkGetDeferredOperationMaxConcurrencyKHR(deviceHandle,
+                                                       deferredOperationHandle),
+              std::max(std::thread::hardware_concurrency(), 1u));
+
+          hostBottomLevelBuildThreadCount = runTasksInParallel(
+              std::max(joinThreadCount, 1u), [&](uint32_t) {
+                while (pvkDeferredOperationJoinKHR(deviceHandle,
+                                                   deferredOperationHandle) ==
+                       VK_THREAD_IDLE_KHR) {
+                  std::this_thread::yield();
+                }
+              });
+
+          hostResult = pvkGetDeferredOperationResultKHR(
+              deviceHandle, deferredOperationHandle);
+        } else if (hostResult == VK_OPERATION_NOT_DEFERRED_KHR) {
+          hostBottomLevelBuildThreadCount = 1;
+          hostResult = VK_SUCCESS;
+        }
+
+        pvkDestroyDeferredOperationKHR(deviceHandle, deferredOperationHandle,
+                                       NULL);
+
+        if (hostResult != VK_SUCCESS) {
+          throwExceptionVulkanAPI(hostResult,
+                                  "vkBuildAccelerationStructuresKHR");
+        }
+
+        hostBottomLevelBuildMilliseconds =
+            std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - startTimePoint)
+                .count();
+      } catch (...) {
+        hostBottomLevelBuildException = std::current_exception();
+      }
+
+      endTraceSection(hostBuildTraceSection);
+    });
+  } else {
+    std::lock_guard<std::mutex> tileSchedulerLock(tileScheduler.mutex);
+    std::cout << physicalDeviceProperties.deviceName
+              << ": host acceleration structure builds not supported, "
+                 "building on the device"
+              << std::endl;
+  }
+#endif
+
+  // =========================================================================
+  // Upload Scene Buffers
+
+  beginTraceSection(deviceTraceSection, "Upload Scene Buffers");
+
+  VkCommandBufferBeginInfo uploadCommandBufferBeginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .pNext = NULL,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+      .pInheritanceInfo = NULL};
+
+  // Transfer timeline value that frees each staging slot
+  std::vector<uint64_t> sceneStagingTimelineValueList(SCENE_STAGING_SLOT_COUNT,
+                                                      0);
+  uint32_t sceneStagingSlotIndex = 0;
+
+  // Copies data through the staging slots into dstBufferHandle at dstOffset,
+  // one slot sized transfer submission at a time. A slot is refilled once the
+  // transfer queue has finished copying out of it.
+  auto uploadSceneData = [&](const void *data, VkDeviceSize size,
+                             VkBuffer dstBufferHandle, VkDeviceSize dstOffset) {
+    for (VkDeviceSize copyOffset = 0; copyOffset < size;
+         copyOffset += SCENE_STAGING_SLOT_SIZE) {
+      VkDeviceSize copySize =
+          std::min<VkDeviceSize>(size - copyOffset, SCENE_STAGING_SLOT_SIZE);
+
+      VkSemaphoreWaitInfo stagingSemaphoreWaitInfo = {
+          .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+          .pNext = NULL,
+          .flags = 0,
+          .semaphoreCount = 1,
+          .pSemaphores = &transferTimelineSemaphoreHandle,
+          .pValues = &sceneStagingTimelineValueList[sceneStagingSlotIndex]};
+
+      result = vkWaitSemaphores(deviceHandle, &stagingSemaphoreWaitInfo,
+                                UINT64_MAX);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkWaitSemaphores");
+      }
+
+      VkDeviceSize stagingOffset =
+          SCENE_STAGING_SLOT_SIZE * sceneStagingSlotIndex;
+
+      memcpy((char *)hostSceneStagingMemoryBuffer + stagingOffset,
+             (const char *)data + copyOffset, copySize);
+
+      VkCommandBuffer sceneUploadCommandBufferHandle =
+          sceneUploadCommandBufferHandleList[sceneStagingSlotIndex];
+
+      result = vkBeginCommandBuffer(sceneUploadCommandBufferHandle,
+                                    &uploadCommandBufferBeginInfo);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+      }
+
+      VkBufferCopy bufferCopy = {.srcOffset = stagingOffset,
+                                 .dstOffset = dstOffset + copyOffset,
+                                 .size = copySize};
+
+      vkCmdCopyBuffer(sceneUploadCommandBufferHandle, sceneStagingBufferHandle,
+                      dstBufferHandle, 1, &bufferCopy);
+
+      result = vkEndCommandBuffer(sceneUploadCommandBufferHandle);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+      }
+
+      uint64_t stagingTimelineValue = ++transferTimelineValue;
+
+      VkTimelineSemaphoreSubmitInfo stagingTimelineSemaphoreSubmitInfo = {
+          .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+          .pNext = NULL,
+          .waitSemaphoreValueCount = 0,
+          .pWaitSemaphoreValues = NULL,
+          .signalSemaphoreValueCount = 1,
+          .pSignalSemaphoreValues = &stagingTimelineValue};
+
+      VkSubmitInfo stagingSubmitInfo = {
+          .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+          .pNext = &stagingTimelineSemaphoreSubmitInfo,
+          .waitSemaphoreCount = 0,
+          .pWaitSemaphores = NULL,
+          .pWaitDstStageMask = NULL,
+          .commandBufferCount = 1,
+          .pCommandBuffers = &sceneUploadCommandBufferHandle,
+          .signalSemaphoreCount = 1,
+          .pSignalSemaphores = &transferTimelineSemaphoreHandle};
+
+      result = vkQueueSubmit(transferQueueHandle, 1, &stagingSubmitInfo,
+                             VK_NULL_HANDLE);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkQueueSubmit");
+      }
+
+      sceneStagingTimelineValueList[sceneStagingSlotIndex] =
+          stagingTimelineValue;
+      sceneStagingSlotIndex =
+          (sceneStagingSlotIndex + 1) % SCENE_STAGING_SLOT_COUNT;
+    }
+  };
+
+  // Each range is uploaded as soon as the scene loader has written it, so
+  // parsing and transfers overlap
+  for (uint32_t x = 0; x < scene.rangeList.size(); x++) {
+    waitForSceneRange(scene, x);
+
+    const SceneRange &sceneRange = scene.rangeList[x];
+
+#if !defined(VERTEX_QUANTIZATION_ENABLED)
+    uploadSceneData(scene.vertexData + sceneRange.vertexOffset * 3,
+                    sizeof(float) * 3 * sceneRange.vertexCount,
+                    vertexBufferHandle,
+                    sizeof(float) * 3 * sceneRange.vertexOffset);
+#endif
+
+    uploadSceneData((const char *)scene.indexData +
+                        scene.indexSize * 3 * sceneRange.primitiveOffset,
+                    scene.indexSize * 3 * sceneRange.primitiveCount,
+                    indexBufferHandle,
+                    scene.indexSize * 3 * sceneRange.primitiveOffset);
+  }
+
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+  // Positions are quantized against the bounds of the whole scene, so they
+  // follow the last range
+  waitForSceneQuantization(scene);
+
+  uploadSceneData(scene.quantizationTransform,
+                  sizeof(scene.quantizationTransform), vertexBufferHandle, 0);
+  uploadSceneData(scene.quantizedVertexList.data(),
+                  SCENE_VERTEX_STRIDE * scene.vertexCount, vertexBufferHandle,
+                  SCENE_VERTEX_DATA_OFFSET);
+#endif
+
+#if defined(BLAS_CLUSTERING_ENABLED)
+  // Clusters are sorted over the whole scene, so they follow the last range
+  waitForSceneClusters(scene);
+
+  uploadSceneData(scene.clusterIndexList.data(),
+                  scene.indexSize * scene.indexCount, indexBufferHandle,
+                  getSceneIndexDataSize(scene));
+  uploadSceneData(scene.clusterPrimitiveIndexList.data(),
+                  sizeof(uint32_t) * scene.primitiveCount, indexBufferHandle,
+                  2 * getSceneIndexDataSize(scene));
+#endif
+
+  vkUnmapMemory(deviceHandle, sceneStagingDeviceMemoryHandle);
+
+  result = vkBeginCommandBuffer(transferCommandBufferHandleList.back(),
+                                &uploadCommandBufferBeginInfo);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
   }
 
-  void *hostIndexMemoryBuffer;
-  result = vkMapMemory(deviceHandle, indexDeviceMemoryHandle, 0,
-                       sizeof(uint32_t) * indexList.size(), 0,
-                       &hostIndexMemoryBuffer);
+  // Release the scene buffers to the graphics family, the matching acquire
+  // is recorded with the bottom level acceleration structure build
+  std::vector<VkBufferMemoryBarrier> sceneReleaseBufferMemoryBarrierList = {
+      {.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+       .pNext = NULL,
+       .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+       .dstAccessMask = 0,
+       .srcQueueFamilyIndex = transferQueueFamilyIndex,
+       .dstQueueFamilyIndex = queueFamilyIndex,
+       .buffer = vertexBufferHandle,
+       .offset = 0,
+       .size = VK_WHOLE_SIZE},
+      {.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+       .pNext = NULL,
+       .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+       .dstAccessMask = 0,
+       .srcQueueFamilyIndex = transferQueueFamilyIndex,
+       .dstQueueFamilyIndex = queueFamilyIndex,
+       .buffer = indexBufferHandle,
+       .offset = 0,
+       .size = VK_WHOLE_SIZE}};
+
+  vkCmdPipelineBarrier(
+      transferCommandBufferHandleList.back(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL,
+      (uint32_t)sceneReleaseBufferMemoryBarrierList.size(),
+      sceneReleaseBufferMemoryBarrierList.data(), 0, NULL);
 
-  memcpy(hostIndexMemoryBuffer, indexList.data(),
-         sizeof(uint32_t) * indexList.size());
+  result = vkEndCommandBuffer(transferCommandBufferHandleList.back());
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkMapMemory");
+    throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
   }
 
-  vkUnmapMemory(deviceHandle, indexDeviceMemoryHandle);
+  uint64_t sceneUploadTimelineValue = ++transferTimelineValue;
 
-  VkBufferDeviceAddressInfo indexBufferDeviceAddressInfo = {
-      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+  VkTimelineSemaphoreSubmitInfo uploadTimelineSemaphoreSubmitInfo = {
+      .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
       .pNext = NULL,
-      .buffer = indexBufferHandle};
+      .waitSemaphoreValueCount = 0,
+      .pWaitSemaphoreValues = NULL,
+      .signalSemaphoreValueCount = 1,
+      .pSignalSemaphoreValues = &sceneUploadTimelineValue};
 
-  VkDeviceAddress indexBufferDeviceAddress =
-      pvkGetBufferDeviceAddressKHR(deviceHandle, &indexBufferDeviceAddressInfo);
+  VkSubmitInfo uploadSubmitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .pNext = &uploadTimelineSemaphoreSubmitInfo,
+      .waitSemaphoreCount = 0,
+      .pWaitSemaphores = NULL,
+      .pWaitDstStageMask = NULL,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &transferCommandBufferHandleList.back(),
+      .signalSemaphoreCount = 1,
+      .pSignalSemaphores = &transferTimelineSemaphoreHandle};
+
+  result = vkQueueSubmit(transferQueueHandle, 1, &uploadSubmitInfo,
+                         VK_NULL_HANDLE);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkQueueSubmit");
+  }
 
   // =========================================================================
   // Bottom Level Acceleration Structure
 
+  beginTraceSection(deviceTraceSection, "Bottom Level Acceleration Structure");
+
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+  // The transform decoding the quantized positions starts the vertex buffer
+  VkDeviceAddress vertexTransformDeviceAddress = vertexBufferDeviceAddress;
+#else
+  VkDeviceAddress vertexTransformDeviceAddress = 0;
+#endif
+
   VkAccelerationStructureGeometryDataKHR
       bottomLevelAccelerationStructureGeometryData = {
           .triangles = {
               .sType =
                   VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
               .pNext = NULL,
-              .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
-              .vertexData = {.deviceAddress = vertexBufferDeviceAddress},
-              .vertexStride = sizeof(float) * 3,
-              .maxVertex = (uint32_t)attrib.vertices.size(),
-              .indexType = VK_INDEX_TYPE_UINT32,
+              .vertexFormat = SCENE_VERTEX_FORMAT,
+              .vertexData = {.deviceAddress = vertexBufferDeviceAddress +
+                                              SCENE_VERTEX_DATA_OFFSET},
+              .vertexStride = SCENE_VERTEX_STRIDE,
+              .maxVertex = (uint32_t)scene.vertexCount,
+              .indexType = scene.indexSize == sizeof(uint16_t)
+                               ? VK_INDEX_TYPE_UINT16
+                               : VK_INDEX_TYPE_UINT32,
               .indexData = {.deviceAddress = indexBufferDeviceAddress},
-              .transformData = {.deviceAddress = 0}}};
+              .transformData = {.deviceAddress =
+                                    vertexTransformDeviceAddress}}};
 
   VkAccelerationStructureGeometryKHR bottomLevelAccelerationStructureGeometry =
       {.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
@@ -963,7 +4671,7 @@ int main() {
               VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
           .pNext = NULL,
           .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-          .flags = 0,
+          .flags = getBuildPresetFlags(BOTTOM_LEVEL_BUILD_PRESET),
           .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
           .srcAccelerationStructure = VK_NULL_HANDLE,
           .dstAccelerationStructure = VK_NULL_HANDLE,
@@ -981,7 +4689,8 @@ int main() {
           .updateScratchSize = 0,
           .buildScratchSize = 0};
 
-  std::vector<uint32_t> bottomLevelMaxPrimitiveCountList = {primitiveCount};
+  std::vector<uint32_t> bottomLevelMaxPrimitiveCountList = {
+      (uint32_t)scene.primitiveCount};
 
   pvkGetAccelerationStructureBuildSizesKHR(
       deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
@@ -989,6 +4698,15 @@ int main() {
       bottomLevelMaxPrimitiveCountList.data(),
       &bottomLevelAccelerationStructureBuildSizesInfo);
 
+#if defined(HOST_BUILD_ENABLED)
+  // A clone needs at least the size of the host built structure
+  bottomLevelAccelerationStructureBuildSizesInfo.accelerationStructureSize =
+      std::max(
+          bottomLevelAccelerationStructureBuildSizesInfo
+              .accelerationStructureSize,
+          hostBottomLevelBuildSizesInfo.accelerationStructureSize);
+#endif
+
   VkBufferCreateInfo bottomLevelAccelerationStructureBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
@@ -1038,8 +4756,9 @@ int main() {
   VkDeviceMemory bottomLevelAccelerationStructureDeviceMemoryHandle =
       VK_NULL_HANDLE;
 
-  result = vkAllocateMemory(
-      deviceHandle, &bottomLevelAccelerationStructureMemoryAllocateInfo, NULL,
+  result = allocateDeviceMemory(
+      deviceHandle, memoryLedger, "Acceleration structure",
+      &bottomLevelAccelerationStructureMemoryAllocateInfo,
       &bottomLevelAccelerationStructureDeviceMemoryHandle);
 
   if (result != VK_SUCCESS) {
@@ -1080,6 +4799,9 @@ int main() {
   // =========================================================================
   // Build Bottom Level Acceleration Structure
 
+  beginTraceSection(deviceTraceSection,
+                    "Build Bottom Level Acceleration Structure");
+
   VkAccelerationStructureDeviceAddressInfoKHR
       bottomLevelAccelerationStructureDeviceAddressInfo = {
           .sType =
@@ -1117,84 +4839,573 @@ int main() {
       deviceHandle, bottomLevelAccelerationStructureScratchBufferHandle,
       &bottomLevelAccelerationStructureScratchMemoryRequirements);
 
-  uint32_t bottomLevelAccelerationStructureScratchMemoryTypeIndex = -1;
+  uint32_t bottomLevelAccelerationStructureScratchMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+
+    if ((bottomLevelAccelerationStructureScratchMemoryRequirements
+             .memoryTypeBits &
+         (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+      bottomLevelAccelerationStructureScratchMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo
+      bottomLevelAccelerationStructureScratchMemoryAllocateInfo = {
+          .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+          .pNext = &memoryAllocateFlagsInfo,
+          .allocationSize =
+              bottomLevelAccelerationStructureScratchMemoryRequirements.size,
+          .memoryTypeIndex =
+              bottomLevelAccelerationStructureScratchMemoryTypeIndex};
+
+  VkDeviceMemory bottomLevelAccelerationStructureDeviceScratchMemoryHandle =
+      VK_NULL_HANDLE;
+
+  result = allocateDeviceMemory(
+      deviceHandle, memoryLedger, "Scratch",
+      &bottomLevelAccelerationStructureScratchMemoryAllocateInfo,
+      &bottomLevelAccelerationStructureDeviceScratchMemoryHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(
+      deviceHandle, bottomLevelAccelerationStructureScratchBufferHandle,
+      bottomLevelAccelerationStructureDeviceScratchMemoryHandle, 0);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  VkBufferDeviceAddressInfo
+      bottomLevelAccelerationStructureScratchBufferDeviceAddressInfo = {
+          .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+          .pNext = NULL,
+          .buffer = bottomLevelAccelerationStructureScratchBufferHandle};
+
+  VkDeviceAddress bottomLevelAccelerationStructureScratchBufferDeviceAddress =
+      pvkGetBufferDeviceAddressKHR(
+          deviceHandle,
+          &bottomLevelAccelerationStructureScratchBufferDeviceAddressInfo);
+
+  bottomLevelAccelerationStructureBuildGeometryInfo.dstAccelerationStructure =
+      bottomLevelAccelerationStructureHandle;
+
+  bottomLevelAccelerationStructureBuildGeometryInfo.scratchData = {
+      .deviceAddress =
+          bottomLevelAccelerationStructureScratchBufferDeviceAddress};
+
+  VkAccelerationStructureBuildRangeInfoKHR
+      bottomLevelAccelerationStructureBuildRangeInfo = {
+          .primitiveCount = (uint32_t)scene.primitiveCount,
+          .primitiveOffset = 0,
+          .firstVertex = 0,
+          .transformOffset = 0};
+
+  const VkAccelerationStructureBuildRangeInfoKHR
+      *bottomLevelAccelerationStructureBuildRangeInfos =
+          &bottomLevelAccelerationStructureBuildRangeInfo;
+
+  VkCommandBufferBeginInfo bottomLevelCommandBufferBeginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .pNext = NULL,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+      .pInheritanceInfo = NULL};
+
+  result = vkBeginCommandBuffer(commandBufferHandleList.back(),
+                                &bottomLevelCommandBufferBeginInfo);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+  }
+
+  std::vector<VkBufferMemoryBarrier> sceneAcquireBufferMemoryBarrierList =
+      sceneReleaseBufferMemoryBarrierList;
+
+  for (VkBufferMemoryBarrier &bufferMemoryBarrier :
+       sceneAcquireBufferMemoryBarrierList) {
+    bufferMemoryBarrier.srcAccessMask = 0;
+    bufferMemoryBarrier.dstAccessMask =
+        VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+        VK_ACCESS_SHADER_READ_BIT;
+  }
+
+  vkCmdPipelineBarrier(
+      commandBufferHandleList.back(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+      VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR |
+          VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+      0, 0, NULL, (uint32_t)sceneAcquireBufferMemoryBarrierList.size(),
+      sceneAcquireBufferMemoryBarrierList.data(), 0, NULL);
+
+  if (isTimestampSupported) {
+    vkCmdResetQueryPool(commandBufferHandleList.back(),
+                        timestampQueryPoolHandle,
+                        bottomLevelTimestampQueryIndex, 2);
+
+    vkCmdWriteTimestamp(commandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        timestampQueryPoolHandle,
+                        bottomLevelTimestampQueryIndex);
+  }
+
+#if defined(HOST_BUILD_ENABLED)
+  if (isHostBuildSupported) {
+    // The host build overlapped the upload, the device only clones its result
+    hostBottomLevelBuildThread.join();
+
+    if (hostBottomLevelBuildException) {
+      std::rethrow_exception(hostBottomLevelBuildException);
+    }
+
+    {
+      std::lock_guard<std::mutex> tileSchedulerLock(tileScheduler.mutex);
+      std::cout << physicalDeviceProperties.deviceName
+                << ": bottom level acceleration structure host build: "
+                << hostBottomLevelBuildMilliseconds << " ms on "
+                << hostBottomLevelBuildThreadCount
+                << " threads, cloned on the device" << std::endl;
+    }
+
+    VkCopyAccelerationStructureInfoKHR hostBottomLevelCopyInfo = {
+        .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+        .pNext = NULL,
+        .src = hostBottomLevelAccelerationStructureHandle,
+        .dst = bottomLevelAccelerationStructureHandle,
+        .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_CLONE_KHR};
+
+    pvkCmdCopyAccelerationStructureKHR(commandBufferHandleList.back(),
+                                       &hostBottomLevelCopyInfo);
+  } else {
+    pvkCmdBuildAccelerationStructuresKHR(
+        commandBufferHandleList.back(), 1,
+        &bottomLevelAccelerationStructureBuildGeometryInfo,
+        &bottomLevelAccelerationStructureBuildRangeInfos);
+  }
+#else
+  pvkCmdBuildAccelerationStructuresKHR(
+      commandBufferHandleList.back(), 1,
+      &bottomLevelAccelerationStructureBuildGeometryInfo,
+      &bottomLevelAccelerationStructureBuildRangeInfos);
+#endif
+
+  if (isTimestampSupported) {
+    vkCmdWriteTimestamp(commandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                        timestampQueryPoolHandle,
+                        bottomLevelTimestampQueryIndex + 1);
+  }
+
+  result = vkEndCommandBuffer(commandBufferHandleList.back());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+  }
+
+  VkTimelineSemaphoreSubmitInfo
+      bottomLevelAccelerationStructureBuildTimelineSemaphoreSubmitInfo = {
+          .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+          .pNext = NULL,
+          .waitSemaphoreValueCount = 1,
+          .pWaitSemaphoreValues = &sceneUploadTimelineValue,
+          .signalSemaphoreValueCount = 0,
+          .pSignalSemaphoreValues = NULL};
+
+  VkPipelineStageFlags bottomLevelAccelerationStructureBuildWaitStageFlags =
+      VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
+
+  VkSubmitInfo bottomLevelAccelerationStructureBuildSubmitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .pNext = &bottomLevelAccelerationStructureBuildTimelineSemaphoreSubmitInfo,
+      .waitSemaphoreCount = 1,
+      .pWaitSemaphores = &transferTimelineSemaphoreHandle,
+      .pWaitDstStageMask = &bottomLevelAccelerationStructureBuildWaitStageFlags,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &commandBufferHandleList.back(),
+      .signalSemaphoreCount = 0,
+      .pSignalSemaphores = NULL};
+
+  VkFenceCreateInfo bottomLevelAccelerationStructureBuildFenceCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, .pNext = NULL, .flags = 0};
+
+  VkFence bottomLevelAccelerationStructureBuildFenceHandle = VK_NULL_HANDLE;
+  result = vkCreateFence(
+      deviceHandle, &bottomLevelAccelerationStructureBuildFenceCreateInfo, NULL,
+      &bottomLevelAccelerationStructureBuildFenceHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateFence");
+  }
+
+  double bottomLevelSubmitMicroseconds = getTraceMicroseconds();
+  result = vkQueueSubmit(queueHandle, 1,
+                         &bottomLevelAccelerationStructureBuildSubmitInfo,
+                         bottomLevelAccelerationStructureBuildFenceHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkQueueSubmit");
+  }
+
+  result = vkWaitForFences(deviceHandle, 1,
+                           &bottomLevelAccelerationStructureBuildFenceHandle,
+                           true, UINT32_MAX);
+
+  if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+    throwExceptionVulkanAPI(result, "vkWaitForFences");
+  }
+
+  if (isTimestampSupported) {
+    double bottomLevelBuildMilliseconds = getTimestampMilliseconds(
+        timestampQueryPoolHandle, bottomLevelTimestampQueryIndex);
+
+    addQueueTraceEvent("Bottom level build", graphicsQueueTraceTrackIndex,
+                       bottomLevelSubmitMicroseconds,
+                       bottomLevelBuildMilliseconds * 1000.0);
+
+    std::lock_guard<std::mutex> tileSchedulerLock(tileScheduler.mutex);
+    std::cout << physicalDeviceProperties.deviceName
+              << ": bottom level acceleration structure build: "
+              << bottomLevelBuildMilliseconds << " ms" << std::endl;
+  }
+
+#if defined(HOST_BUILD_ENABLED)
+  if (isHostBuildSupported) {
+    // The clone has completed, the host built structure is no longer needed
+    pvkDestroyAccelerationStructureKHR(
+        deviceHandle, hostBottomLevelAccelerationStructureHandle, NULL);
+    vkDestroyBuffer(deviceHandle, hostBottomLevelBufferHandle, NULL);
+    freeDeviceMemory(deviceHandle, memoryLedger,
+                     hostBottomLevelDeviceMemoryHandle);
+  }
+#endif
+
+#if BOTTOM_LEVEL_BUILD_PRESET == BUILD_PRESET_STATIC
+  // =========================================================================
+  // Compact Bottom Level Acceleration Structure
+
+  beginTraceSection(deviceTraceSection,
+                    "Compact Bottom Level Acceleration Structure");
+
+  VkDeviceSize bottomLevelCompactedSize = 0;
+  double bottomLevelCompactionMilliseconds = compactAccelerationStructure(
+      VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+      bottomLevelAccelerationStructureHandle,
+      bottomLevelAccelerationStructureBufferHandle,
+      bottomLevelAccelerationStructureDeviceMemoryHandle,
+      bottomLevelCompactedSize);
+
+  bottomLevelAccelerationStructureDeviceAddressInfo.accelerationStructure =
+      bottomLevelAccelerationStructureHandle;
+
+  bottomLevelAccelerationStructureDeviceAddress =
+      pvkGetAccelerationStructureDeviceAddressKHR(
+          deviceHandle, &bottomLevelAccelerationStructureDeviceAddressInfo);
+
+  {
+    std::lock_guard<std::mutex> tileSchedulerLock(tileScheduler.mutex);
+    std::cout << physicalDeviceProperties.deviceName
+              << ": bottom level acceleration structure compacted from "
+              << getMebibytes(bottomLevelAccelerationStructureBuildSizesInfo
+                                  .accelerationStructureSize)
+              << " MiB to " << getMebibytes(bottomLevelCompactedSize)
+              << " MiB in " << bottomLevelCompactionMilliseconds << " ms"
+              << std::endl;
+  }
+#endif
+
+#if defined(BLAS_CLUSTERING_ENABLED)
+  // =========================================================================
+  // Cluster Bottom Level Acceleration Structures
+
+  beginTraceSection(deviceTraceSection,
+                    "Cluster Bottom Level Acceleration Structures");
+
+  // Every cluster reads its triangles from the cluster indices, which follow
+  // the scene indices in the index buffer. The build range offset selects the
+  // cluster.
+  VkAccelerationStructureGeometryKHR
+      clusterAccelerationStructureGeometry =
+          bottomLevelAccelerationStructureGeometry;
+
+  clusterAccelerationStructureGeometry.geometry.triangles.indexData = {
+      .deviceAddress =
+          indexBufferDeviceAddress + getSceneIndexDataSize(scene)};
+
+  // Clusters share one buffer at fixed offsets, so they are not compacted
+  std::vector<VkAccelerationStructureBuildGeometryInfoKHR>
+      clusterAccelerationStructureBuildGeometryInfoList(
+          scene.clusterCount,
+          {.sType =
+               VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+           .pNext = NULL,
+           .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+           .flags = getBuildPresetFlags(BOTTOM_LEVEL_BUILD_PRESET) &
+                    ~VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR,
+           .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+           .srcAccelerationStructure = VK_NULL_HANDLE,
+           .dstAccelerationStructure = VK_NULL_HANDLE,
+           .geometryCount = 1,
+           .pGeometries = &clusterAccelerationStructureGeometry,
+           .ppGeometries = NULL,
+           .scratchData = {.deviceAddress = 0}});
+
+  std::vector<VkAccelerationStructureBuildRangeInfoKHR>
+      clusterAccelerationStructureBuildRangeInfoList(scene.clusterCount);
+
+  // The acceleration structures share one buffer and the builds one scratch
+  // buffer, each at its own aligned offset
+  std::vector<VkDeviceSize> clusterAccelerationStructureOffsetList(
+      scene.clusterCount);
+  std::vector<VkDeviceSize> clusterAccelerationStructureSizeList(
+      scene.clusterCount);
+  std::vector<VkDeviceSize> clusterScratchOffsetList(scene.clusterCount);
+
+  VkDeviceSize clusterAccelerationStructureBufferSize = 0;
+  VkDeviceSize clusterScratchBufferSize = 0;
+  VkDeviceSize clusterScratchAlignment =
+      physicalDeviceAccelerationStructureProperties
+          .minAccelerationStructureScratchOffsetAlignment;
+
+  for (uint32_t x = 0; x < scene.clusterCount; x++) {
+    uint32_t clusterPrimitiveCount = (uint32_t)std::min<uint64_t>(
+        SCENE_CLUSTER_PRIMITIVE_COUNT,
+        scene.primitiveCount - (uint64_t)x * SCENE_CLUSTER_PRIMITIVE_COUNT);
+
+    clusterAccelerationStructureBuildRangeInfoList[x] = {
+        .primitiveCount = clusterPrimitiveCount,
+        .primitiveOffset = (uint32_t)(scene.indexSize * 3 *
+                                      (uint64_t)x *
+                                      SCENE_CLUSTER_PRIMITIVE_COUNT),
+        .firstVertex = 0,
+        .transformOffset = 0};
+
+    VkAccelerationStructureBuildSizesInfoKHR
+        clusterAccelerationStructureBuildSizesInfo = {
+            .sType =
+                VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+            .pNext = NULL,
+            .accelerationStructureSize = 0,
+            .updateScratchSize = 0,
+            .buildScratchSize = 0};
+
+    pvkGetAccelerationStructureBuildSizesKHR(
+        deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+        &clusterAccelerationStructureBuildGeometryInfoList[x],
+        &clusterPrimitiveCount, &clusterAccelerationStructureBuildSizesInfo);
+
+    clusterAccelerationStructureOffsetList[x] =
+        clusterAccelerationStructureBufferSize;
+    clusterAccelerationStructureSizeList[x] =
+        clusterAccelerationStructureBuildSizesInfo.accelerationStructureSize;
+    clusterAccelerationStructureBufferSize +=
+        (clusterAccelerationStructureBuildSizesInfo.accelerationStructureSize +
+         255) /
+        256 * 256;
+
+    clusterScratchOffsetList[x] = clusterScratchBufferSize;
+    clusterScratchBufferSize +=
+        (clusterAccelerationStructureBuildSizesInfo.buildScratchSize +
+         clusterScratchAlignment - 1) /
+        clusterScratchAlignment * clusterScratchAlignment;
+  }
+
+  VkBufferCreateInfo clusterAccelerationStructureBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = clusterAccelerationStructureBufferSize,
+      .usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = 1,
+      .pQueueFamilyIndices = &queueFamilyIndex};
+
+  VkBuffer clusterAccelerationStructureBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle,
+                          &clusterAccelerationStructureBufferCreateInfo, NULL,
+                          &clusterAccelerationStructureBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements clusterAccelerationStructureMemoryRequirements;
+  vkGetBufferMemoryRequirements(
+      deviceHandle, clusterAccelerationStructureBufferHandle,
+      &clusterAccelerationStructureMemoryRequirements);
+
+  uint32_t clusterAccelerationStructureMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+
+    if ((clusterAccelerationStructureMemoryRequirements.memoryTypeBits &
+         (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+      clusterAccelerationStructureMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo clusterAccelerationStructureMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = NULL,
+      .allocationSize = clusterAccelerationStructureMemoryRequirements.size,
+      .memoryTypeIndex = clusterAccelerationStructureMemoryTypeIndex};
+
+  VkDeviceMemory clusterAccelerationStructureDeviceMemoryHandle =
+      VK_NULL_HANDLE;
+
+  result = allocateDeviceMemory(
+      deviceHandle, memoryLedger, "Acceleration structure",
+      &clusterAccelerationStructureMemoryAllocateInfo,
+      &clusterAccelerationStructureDeviceMemoryHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(
+      deviceHandle, clusterAccelerationStructureBufferHandle,
+      clusterAccelerationStructureDeviceMemoryHandle, 0);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  VkBufferCreateInfo clusterScratchBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = clusterScratchBufferSize,
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = 1,
+      .pQueueFamilyIndices = &queueFamilyIndex};
+
+  VkBuffer clusterScratchBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &clusterScratchBufferCreateInfo, NULL,
+                          &clusterScratchBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements clusterScratchMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, clusterScratchBufferHandle,
+                                &clusterScratchMemoryRequirements);
+
+  uint32_t clusterScratchMemoryTypeIndex = -1;
   for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
        x++) {
 
-    if ((bottomLevelAccelerationStructureScratchMemoryRequirements
-             .memoryTypeBits &
-         (1 << x)) &&
+    if ((clusterScratchMemoryRequirements.memoryTypeBits & (1 << x)) &&
         (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
 
-      bottomLevelAccelerationStructureScratchMemoryTypeIndex = x;
+      clusterScratchMemoryTypeIndex = x;
       break;
     }
   }
 
-  VkMemoryAllocateInfo
-      bottomLevelAccelerationStructureScratchMemoryAllocateInfo = {
-          .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-          .pNext = &memoryAllocateFlagsInfo,
-          .allocationSize =
-              bottomLevelAccelerationStructureScratchMemoryRequirements.size,
-          .memoryTypeIndex =
-              bottomLevelAccelerationStructureScratchMemoryTypeIndex};
+  VkMemoryAllocateInfo clusterScratchMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = &memoryAllocateFlagsInfo,
+      .allocationSize = clusterScratchMemoryRequirements.size,
+      .memoryTypeIndex = clusterScratchMemoryTypeIndex};
 
-  VkDeviceMemory bottomLevelAccelerationStructureDeviceScratchMemoryHandle =
-      VK_NULL_HANDLE;
+  VkDeviceMemory clusterScratchDeviceMemoryHandle = VK_NULL_HANDLE;
 
-  result = vkAllocateMemory(
-      deviceHandle, &bottomLevelAccelerationStructureScratchMemoryAllocateInfo,
-      NULL, &bottomLevelAccelerationStructureDeviceScratchMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Scratch",
+                                &clusterScratchMemoryAllocateInfo,
+                                &clusterScratchDeviceMemoryHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
 
-  result = vkBindBufferMemory(
-      deviceHandle, bottomLevelAccelerationStructureScratchBufferHandle,
-      bottomLevelAccelerationStructureDeviceScratchMemoryHandle, 0);
+  result = vkBindBufferMemory(deviceHandle, clusterScratchBufferHandle,
+                              clusterScratchDeviceMemoryHandle, 0);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkBindBufferMemory");
   }
 
-  VkBufferDeviceAddressInfo
-      bottomLevelAccelerationStructureScratchBufferDeviceAddressInfo = {
-          .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-          .pNext = NULL,
-          .buffer = bottomLevelAccelerationStructureScratchBufferHandle};
-
-  VkDeviceAddress bottomLevelAccelerationStructureScratchBufferDeviceAddress =
-      pvkGetBufferDeviceAddressKHR(
-          deviceHandle,
-          &bottomLevelAccelerationStructureScratchBufferDeviceAddressInfo);
+  VkBufferDeviceAddressInfo clusterScratchBufferDeviceAddressInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .pNext = NULL,
+      .buffer = clusterScratchBufferHandle};
 
-  bottomLevelAccelerationStructureBuildGeometryInfo.dstAccelerationStructure =
-      bottomLevelAccelerationStructureHandle;
+  VkDeviceAddress clusterScratchBufferDeviceAddress =
+      pvkGetBufferDeviceAddressKHR(deviceHandle,
+                                   &clusterScratchBufferDeviceAddressInfo);
+
+  std::vector<VkAccelerationStructureKHR>
+      clusterAccelerationStructureHandleList(scene.clusterCount,
+                                             VK_NULL_HANDLE);
+  std::vector<VkDeviceAddress> clusterAccelerationStructureDeviceAddressList(
+      scene.clusterCount);
+  std::vector<const VkAccelerationStructureBuildRangeInfoKHR *>
+      clusterAccelerationStructureBuildRangeInfoPointerList(scene.clusterCount);
+
+  for (uint32_t x = 0; x < scene.clusterCount; x++) {
+    VkAccelerationStructureCreateInfoKHR
+        clusterAccelerationStructureCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+            .pNext = NULL,
+            .createFlags = 0,
+            .buffer = clusterAccelerationStructureBufferHandle,
+            .offset = clusterAccelerationStructureOffsetList[x],
+            .size = clusterAccelerationStructureSizeList[x],
+            .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            .deviceAddress = 0};
+
+    result = pvkCreateAccelerationStructureKHR(
+        deviceHandle, &clusterAccelerationStructureCreateInfo, NULL,
+        &clusterAccelerationStructureHandleList[x]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
+    }
 
-  bottomLevelAccelerationStructureBuildGeometryInfo.scratchData = {
-      .deviceAddress =
-          bottomLevelAccelerationStructureScratchBufferDeviceAddress};
+    VkAccelerationStructureDeviceAddressInfoKHR
+        clusterAccelerationStructureDeviceAddressInfo = {
+            .sType =
+                VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+            .pNext = NULL,
+            .accelerationStructure = clusterAccelerationStructureHandleList[x]};
+
+    clusterAccelerationStructureDeviceAddressList[x] =
+        pvkGetAccelerationStructureDeviceAddressKHR(
+            deviceHandle, &clusterAccelerationStructureDeviceAddressInfo);
+
+    clusterAccelerationStructureBuildGeometryInfoList[x]
+        .dstAccelerationStructure = clusterAccelerationStructureHandleList[x];
+    clusterAccelerationStructureBuildGeometryInfoList[x].scratchData = {
+        .deviceAddress =
+            clusterScratchBufferDeviceAddress + clusterScratchOffsetList[x]};
+
+    clusterAccelerationStructureBuildRangeInfoPointerList[x] =
+        &clusterAccelerationStructureBuildRangeInfoList[x];
+  }
 
-  VkAccelerationStructureBuildRangeInfoKHR
-      bottomLevelAccelerationStructureBuildRangeInfo = {.primitiveCount =
-                                                            primitiveCount,
-                                                        .primitiveOffset = 0,
-                                                        .firstVertex = 0,
-                                                        .transformOffset = 0};
+  // =========================================================================
+  // Build Cluster Bottom Level Acceleration Structures
 
-  const VkAccelerationStructureBuildRangeInfoKHR
-      *bottomLevelAccelerationStructureBuildRangeInfos =
-          &bottomLevelAccelerationStructureBuildRangeInfo;
+  beginTraceSection(deviceTraceSection,
+                    "Build Cluster Bottom Level Acceleration Structures");
 
-  VkCommandBufferBeginInfo bottomLevelCommandBufferBeginInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-      .pNext = NULL,
-      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-      .pInheritanceInfo = NULL};
+  // Queries 8 and 9 of the graphics pool, after the top level build's
+  uint32_t clusterBottomLevelTimestampQueryIndex = 8;
 
   result = vkBeginCommandBuffer(commandBufferHandleList.back(),
                                 &bottomLevelCommandBufferBeginInfo);
@@ -1203,10 +5414,29 @@ int main() {
     throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
   }
 
+  if (isTimestampSupported) {
+    vkCmdResetQueryPool(commandBufferHandleList.back(),
+                        timestampQueryPoolHandle,
+                        clusterBottomLevelTimestampQueryIndex, 2);
+
+    vkCmdWriteTimestamp(commandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        timestampQueryPoolHandle,
+                        clusterBottomLevelTimestampQueryIndex);
+  }
+
+  // The scene buffers were acquired by the single bottom level build
   pvkCmdBuildAccelerationStructuresKHR(
-      commandBufferHandleList.back(), 1,
-      &bottomLevelAccelerationStructureBuildGeometryInfo,
-      &bottomLevelAccelerationStructureBuildRangeInfos);
+      commandBufferHandleList.back(), (uint32_t)scene.clusterCount,
+      clusterAccelerationStructureBuildGeometryInfoList.data(),
+      clusterAccelerationStructureBuildRangeInfoPointerList.data());
+
+  if (isTimestampSupported) {
+    vkCmdWriteTimestamp(commandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                        timestampQueryPoolHandle,
+                        clusterBottomLevelTimestampQueryIndex + 1);
+  }
 
   result = vkEndCommandBuffer(commandBufferHandleList.back());
 
@@ -1214,7 +5444,7 @@ int main() {
     throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
   }
 
-  VkSubmitInfo bottomLevelAccelerationStructureBuildSubmitInfo = {
+  VkSubmitInfo clusterAccelerationStructureBuildSubmitInfo = {
       .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
       .pNext = NULL,
       .waitSemaphoreCount = 0,
@@ -1225,37 +5455,57 @@ int main() {
       .signalSemaphoreCount = 0,
       .pSignalSemaphores = NULL};
 
-  VkFenceCreateInfo bottomLevelAccelerationStructureBuildFenceCreateInfo = {
+  VkFenceCreateInfo clusterAccelerationStructureBuildFenceCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, .pNext = NULL, .flags = 0};
 
-  VkFence bottomLevelAccelerationStructureBuildFenceHandle = VK_NULL_HANDLE;
-  result = vkCreateFence(
-      deviceHandle, &bottomLevelAccelerationStructureBuildFenceCreateInfo, NULL,
-      &bottomLevelAccelerationStructureBuildFenceHandle);
+  VkFence clusterAccelerationStructureBuildFenceHandle = VK_NULL_HANDLE;
+  result = vkCreateFence(deviceHandle,
+                         &clusterAccelerationStructureBuildFenceCreateInfo,
+                         NULL, &clusterAccelerationStructureBuildFenceHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkCreateFence");
   }
 
+  double clusterBottomLevelSubmitMicroseconds = getTraceMicroseconds();
   result = vkQueueSubmit(queueHandle, 1,
-                         &bottomLevelAccelerationStructureBuildSubmitInfo,
-                         bottomLevelAccelerationStructureBuildFenceHandle);
+                         &clusterAccelerationStructureBuildSubmitInfo,
+                         clusterAccelerationStructureBuildFenceHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkQueueSubmit");
   }
 
   result = vkWaitForFences(deviceHandle, 1,
-                           &bottomLevelAccelerationStructureBuildFenceHandle,
-                           true, UINT32_MAX);
+                           &clusterAccelerationStructureBuildFenceHandle, true,
+                           UINT32_MAX);
 
   if (result != VK_SUCCESS && result != VK_TIMEOUT) {
     throwExceptionVulkanAPI(result, "vkWaitForFences");
   }
 
+  if (isTimestampSupported) {
+    double clusterBottomLevelBuildMilliseconds = getTimestampMilliseconds(
+        timestampQueryPoolHandle, clusterBottomLevelTimestampQueryIndex);
+
+    addQueueTraceEvent("Cluster bottom level build",
+                       graphicsQueueTraceTrackIndex,
+                       clusterBottomLevelSubmitMicroseconds,
+                       clusterBottomLevelBuildMilliseconds * 1000.0);
+
+    std::lock_guard<std::mutex> tileSchedulerLock(tileScheduler.mutex);
+    std::cout << physicalDeviceProperties.deviceName
+              << ": cluster bottom level acceleration structure builds: "
+              << scene.clusterCount << " in "
+              << clusterBottomLevelBuildMilliseconds << " ms" << std::endl;
+  }
+#endif
+
   // =========================================================================
   // Top Level Acceleration Structure
 
+  beginTraceSection(deviceTraceSection, "Top Level Acceleration Structure");
+
   VkAccelerationStructureInstanceKHR bottomLevelAccelerationStructureInstance =
       {.transform = {.matrix = {{1.0, 0.0, 0.0, 0.0},
                                 {0.0, 1.0, 0.0, 0.0},
@@ -1267,11 +5517,35 @@ int main() {
        .accelerationStructureReference =
            bottomLevelAccelerationStructureDeviceAddress};
 
+  std::vector<VkAccelerationStructureInstanceKHR>
+      bottomLevelAccelerationStructureInstanceList = {
+          bottomLevelAccelerationStructureInstance};
+
+#if defined(BLAS_CLUSTERING_ENABLED)
+  // The cluster instances follow the single one and are built into a top
+  // level acceleration structure of their own. Their custom index is the
+  // cluster index plus one, zero marks the single bottom level structure.
+  for (uint32_t x = 0; x < scene.clusterCount; x++) {
+    VkAccelerationStructureInstanceKHR clusterAccelerationStructureInstance =
+        bottomLevelAccelerationStructureInstance;
+    clusterAccelerationStructureInstance.instanceCustomIndex = x + 1;
+    clusterAccelerationStructureInstance.accelerationStructureReference =
+        clusterAccelerationStructureDeviceAddressList[x];
+
+    bottomLevelAccelerationStructureInstanceList.push_back(
+        clusterAccelerationStructureInstance);
+  }
+#endif
+
+  VkDeviceSize bottomLevelGeometryInstanceBufferSize =
+      sizeof(VkAccelerationStructureInstanceKHR) *
+      bottomLevelAccelerationStructureInstanceList.size();
+
   VkBufferCreateInfo bottomLevelGeometryInstanceBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = sizeof(VkAccelerationStructureInstanceKHR),
+      .size = bottomLevelGeometryInstanceBufferSize,
       .usage =
           VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
           VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
@@ -1316,9 +5590,9 @@ int main() {
 
   VkDeviceMemory bottomLevelGeometryInstanceDeviceMemoryHandle = VK_NULL_HANDLE;
 
-  result = vkAllocateMemory(
-      deviceHandle, &bottomLevelGeometryInstanceMemoryAllocateInfo, NULL,
-      &bottomLevelGeometryInstanceDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Instance",
+                                &bottomLevelGeometryInstanceMemoryAllocateInfo,
+                                &bottomLevelGeometryInstanceDeviceMemoryHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
@@ -1335,12 +5609,12 @@ int main() {
   void *hostbottomLevelGeometryInstanceMemoryBuffer;
   result =
       vkMapMemory(deviceHandle, bottomLevelGeometryInstanceDeviceMemoryHandle,
-                  0, sizeof(VkAccelerationStructureInstanceKHR), 0,
+                  0, bottomLevelGeometryInstanceBufferSize, 0,
                   &hostbottomLevelGeometryInstanceMemoryBuffer);
 
   memcpy(hostbottomLevelGeometryInstanceMemoryBuffer,
-         &bottomLevelAccelerationStructureInstance,
-         sizeof(VkAccelerationStructureInstanceKHR));
+         bottomLevelAccelerationStructureInstanceList.data(),
+         bottomLevelGeometryInstanceBufferSize);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkMapMemory");
@@ -1373,13 +5647,16 @@ int main() {
       .geometry = topLevelAccelerationStructureGeometryData,
       .flags = VK_GEOMETRY_OPAQUE_BIT_KHR};
 
+  // The top level structures share one buffer and are small next to the
+  // bottom level, so they are not compacted
   VkAccelerationStructureBuildGeometryInfoKHR
       topLevelAccelerationStructureBuildGeometryInfo = {
           .sType =
               VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
           .pNext = NULL,
           .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
-          .flags = 0,
+          .flags = getBuildPresetFlags(TOP_LEVEL_BUILD_PRESET) &
+                   ~VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR,
           .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
           .srcAccelerationStructure = VK_NULL_HANDLE,
           .dstAccelerationStructure = VK_NULL_HANDLE,
@@ -1397,7 +5674,9 @@ int main() {
           .updateScratchSize = 0,
           .buildScratchSize = 0};
 
-  std::vector<uint32_t> topLevelMaxPrimitiveCountList = {1};
+  // Sized for every instance, which covers each top level build
+  std::vector<uint32_t> topLevelMaxPrimitiveCountList = {
+      (uint32_t)bottomLevelAccelerationStructureInstanceList.size()};
 
   pvkGetAccelerationStructureBuildSizesKHR(
       deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
@@ -1405,12 +5684,23 @@ int main() {
       topLevelMaxPrimitiveCountList.data(),
       &topLevelAccelerationStructureBuildSizesInfo);
 
+  VkDeviceSize topLevelAccelerationStructureBufferSize =
+      topLevelAccelerationStructureBuildSizesInfo.accelerationStructureSize;
+
+#if defined(BLAS_CLUSTERING_ENABLED)
+  // The clusters' top level acceleration structure follows in the same buffer
+  VkDeviceSize clusterTopLevelAccelerationStructureOffset =
+      (topLevelAccelerationStructureBufferSize + 255) / 256 * 256;
+  topLevelAccelerationStructureBufferSize =
+      clusterTopLevelAccelerationStructureOffset +
+      topLevelAccelerationStructureBuildSizesInfo.accelerationStructureSize;
+#endif
+
   VkBufferCreateInfo topLevelAccelerationStructureBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size =
-          topLevelAccelerationStructureBuildSizesInfo.accelerationStructureSize,
+      .size = topLevelAccelerationStructureBufferSize,
       .usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
@@ -1454,8 +5744,9 @@ int main() {
   VkDeviceMemory topLevelAccelerationStructureDeviceMemoryHandle =
       VK_NULL_HANDLE;
 
-  result = vkAllocateMemory(
-      deviceHandle, &topLevelAccelerationStructureMemoryAllocateInfo, NULL,
+  result = allocateDeviceMemory(
+      deviceHandle, memoryLedger, "Acceleration structure",
+      &topLevelAccelerationStructureMemoryAllocateInfo,
       &topLevelAccelerationStructureDeviceMemoryHandle);
 
   if (result != VK_SUCCESS) {
@@ -1492,9 +5783,31 @@ int main() {
     throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
   }
 
+#if defined(BLAS_CLUSTERING_ENABLED)
+  VkAccelerationStructureCreateInfoKHR
+      clusterTopLevelAccelerationStructureCreateInfo =
+          topLevelAccelerationStructureCreateInfo;
+  clusterTopLevelAccelerationStructureCreateInfo.offset =
+      clusterTopLevelAccelerationStructureOffset;
+
+  VkAccelerationStructureKHR clusterTopLevelAccelerationStructureHandle =
+      VK_NULL_HANDLE;
+
+  result = pvkCreateAccelerationStructureKHR(
+      deviceHandle, &clusterTopLevelAccelerationStructureCreateInfo, NULL,
+      &clusterTopLevelAccelerationStructureHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
+  }
+#endif
+
   // =========================================================================
   // Build Top Level Acceleration Structure
 
+  beginTraceSection(deviceTraceSection,
+                    "Build Top Level Acceleration Structure");
+
   VkAccelerationStructureDeviceAddressInfoKHR
       topLevelAccelerationStructureDeviceAddressInfo = {
           .sType =
@@ -1556,9 +5869,10 @@ int main() {
   VkDeviceMemory topLevelAccelerationStructureDeviceScratchMemoryHandle =
       VK_NULL_HANDLE;
 
-  result = vkAllocateMemory(
-      deviceHandle, &topLevelAccelerationStructureScratchMemoryAllocateInfo,
-      NULL, &topLevelAccelerationStructureDeviceScratchMemoryHandle);
+  result = allocateDeviceMemory(
+      deviceHandle, memoryLedger, "Scratch",
+      &topLevelAccelerationStructureScratchMemoryAllocateInfo,
+      &topLevelAccelerationStructureDeviceScratchMemoryHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
@@ -1612,11 +5926,66 @@ int main() {
     throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
   }
 
+  if (isTimestampSupported) {
+    vkCmdResetQueryPool(commandBufferHandleList.back(),
+                        timestampQueryPoolHandle,
+                        topLevelTimestampQueryIndex, 2);
+
+    vkCmdWriteTimestamp(commandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        timestampQueryPoolHandle,
+                        topLevelTimestampQueryIndex);
+  }
+
   pvkCmdBuildAccelerationStructuresKHR(
       commandBufferHandleList.back(), 1,
       &topLevelAccelerationStructureBuildGeometryInfo,
       &topLevelAccelerationStructureBuildRangeInfos);
 
+#if defined(BLAS_CLUSTERING_ENABLED)
+  // The clusters' build reuses the scratch buffer once the first is done
+  VkMemoryBarrier topLevelScratchMemoryBarrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .pNext = NULL,
+      .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+      .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+                       VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR};
+
+  vkCmdPipelineBarrier(commandBufferHandleList.back(),
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       0, 1, &topLevelScratchMemoryBarrier, 0, NULL, 0, NULL);
+
+  VkAccelerationStructureBuildGeometryInfoKHR
+      clusterTopLevelAccelerationStructureBuildGeometryInfo =
+          topLevelAccelerationStructureBuildGeometryInfo;
+  clusterTopLevelAccelerationStructureBuildGeometryInfo
+      .dstAccelerationStructure = clusterTopLevelAccelerationStructureHandle;
+
+  VkAccelerationStructureBuildRangeInfoKHR
+      clusterTopLevelAccelerationStructureBuildRangeInfo = {
+          .primitiveCount = (uint32_t)scene.clusterCount,
+          .primitiveOffset = sizeof(VkAccelerationStructureInstanceKHR),
+          .firstVertex = 0,
+          .transformOffset = 0};
+
+  const VkAccelerationStructureBuildRangeInfoKHR
+      *clusterTopLevelAccelerationStructureBuildRangeInfos =
+          &clusterTopLevelAccelerationStructureBuildRangeInfo;
+
+  pvkCmdBuildAccelerationStructuresKHR(
+      commandBufferHandleList.back(), 1,
+      &clusterTopLevelAccelerationStructureBuildGeometryInfo,
+      &clusterTopLevelAccelerationStructureBuildRangeInfos);
+#endif
+
+  if (isTimestampSupported) {
+    vkCmdWriteTimestamp(commandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                        timestampQueryPoolHandle,
+                        topLevelTimestampQueryIndex + 1);
+  }
+
   result = vkEndCommandBuffer(commandBufferHandleList.back());
 
   if (result != VK_SUCCESS) {
@@ -1646,6 +6015,7 @@ int main() {
     throwExceptionVulkanAPI(result, "vkCreateFence");
   }
 
+  double topLevelSubmitMicroseconds = getTraceMicroseconds();
   result = vkQueueSubmit(queueHandle, 1,
                          &topLevelAccelerationStructureBuildSubmitInfo,
                          topLevelAccelerationStructureBuildFenceHandle);
@@ -1662,17 +6032,26 @@ int main() {
     throwExceptionVulkanAPI(result, "vkWaitForFences");
   }
 
+  if (isTimestampSupported) {
+    double topLevelBuildMilliseconds = getTimestampMilliseconds(
+        timestampQueryPoolHandle, topLevelTimestampQueryIndex);
+
+    addQueueTraceEvent("Top level build", graphicsQueueTraceTrackIndex,
+                       topLevelSubmitMicroseconds,
+                       topLevelBuildMilliseconds * 1000.0);
+
+    std::lock_guard<std::mutex> tileSchedulerLock(tileScheduler.mutex);
+    std::cout << physicalDeviceProperties.deviceName
+              << ": top level acceleration structure build: "
+              << topLevelBuildMilliseconds << " ms" << std::endl;
+  }
+
   // =========================================================================
   // Uniform Buffer
 
-  struct UniformStructure {
-    float cameraPosition[4] = {-1.433908, 3.579997, 5.812919, 1};
-    float cameraRight[4] = {0.928479, 0, 0.371385, 1};
-    float cameraUp[4] = {0, 1, 0, 1};
-    float cameraForward[4] = {0.371385, 0, -0.928479, 1};
+  beginTraceSection(deviceTraceSection, "Uniform Buffer");
 
-    uint32_t frameCount = 0;
-  } uniformStructure;
+  UniformStructure uniformStructure;
 
   VkBufferCreateInfo uniformBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
@@ -1716,8 +6095,9 @@ int main() {
       .memoryTypeIndex = uniformMemoryTypeIndex};
 
   VkDeviceMemory uniformDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &uniformMemoryAllocateInfo, NULL,
-                            &uniformDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Uniform",
+                                &uniformMemoryAllocateInfo,
+                                &uniformDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
@@ -1738,20 +6118,214 @@ int main() {
     throwExceptionVulkanAPI(result, "vkMapMemory");
   }
 
-  vkUnmapMemory(deviceHandle, uniformDeviceMemoryHandle);
-
+  vkUnmapMemory(deviceHandle, uniformDeviceMemoryHandle);
+
+#if defined(RAY_COUNTERS_ENABLED)
+  // =========================================================================
+  // Ray Counter Buffer
+
+  beginTraceSection(deviceTraceSection, "Ray Counter Buffer");
+
+  // Counters are shared by both tile slots and never cleared, the totals are
+  // read once every tile has been read back
+
+  VkBufferCreateInfo rayCounterBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = rayTypeNameList.size() * sizeof(uint32_t),
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = 1,
+      .pQueueFamilyIndices = &queueFamilyIndex};
+
+  VkBuffer rayCounterBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &rayCounterBufferCreateInfo, NULL,
+                          &rayCounterBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements rayCounterMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, rayCounterBufferHandle,
+                                &rayCounterMemoryRequirements);
+
+  uint32_t rayCounterMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+    if ((rayCounterMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) ==
+            (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+
+      rayCounterMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo rayCounterMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = NULL,
+      .allocationSize = rayCounterMemoryRequirements.size,
+      .memoryTypeIndex = rayCounterMemoryTypeIndex};
+
+  VkDeviceMemory rayCounterDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Ray counter",
+                                &rayCounterMemoryAllocateInfo,
+                                &rayCounterDeviceMemoryHandle);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(deviceHandle, rayCounterBufferHandle,
+                              rayCounterDeviceMemoryHandle, 0);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  // Left mapped, read after the last tile
+  void *hostRayCounterMemoryBuffer;
+  result = vkMapMemory(deviceHandle, rayCounterDeviceMemoryHandle, 0,
+                       VK_WHOLE_SIZE, 0, &hostRayCounterMemoryBuffer);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkMapMemory");
+  }
+
+  memset(hostRayCounterMemoryBuffer, 0, rayCounterBufferCreateInfo.size);
+
+  VkDescriptorBufferInfo rayCounterDescriptorInfo = {
+      .buffer = rayCounterBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
+
+  VkWriteDescriptorSet rayCounterWriteDescriptorSet = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .pNext = NULL,
+      .dstSet = descriptorSetHandleList[0],
+      .dstBinding = 5,
+      .dstArrayElement = 0,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pImageInfo = NULL,
+      .pBufferInfo = &rayCounterDescriptorInfo,
+      .pTexelBufferView = NULL};
+
+  vkUpdateDescriptorSets(deviceHandle, 1, &rayCounterWriteDescriptorSet, 0,
+                         NULL);
+#endif
+
+  // =========================================================================
+  // Ray Trace Image
+
+  beginTraceSection(deviceTraceSection, "Ray Trace Image");
+
+  VkImageCreateInfo rayTraceImageCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = VK_FORMAT_R8G8B8A8_UNORM,
+      .extent = {.width = 800,
+                 .height = 600,
+                 .depth = 1},
+      .mipLevels = 1,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      .sharingMode = queueFamilyIndexList.size() > 1
+                         ? VK_SHARING_MODE_CONCURRENT
+                         : VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = (uint32_t)queueFamilyIndexList.size(),
+      .pQueueFamilyIndices = queueFamilyIndexList.data(),
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
+
+  VkImage rayTraceImageHandle = VK_NULL_HANDLE;
+  result = vkCreateImage(deviceHandle, &rayTraceImageCreateInfo, NULL,
+                         &rayTraceImageHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateImage");
+  }
+
+  VkMemoryRequirements rayTraceImageMemoryRequirements;
+  vkGetImageMemoryRequirements(deviceHandle, rayTraceImageHandle,
+                               &rayTraceImageMemoryRequirements);
+
+  uint32_t rayTraceImageMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+    if ((rayTraceImageMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+      rayTraceImageMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo rayTraceImageMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = NULL,
+      .allocationSize = rayTraceImageMemoryRequirements.size,
+      .memoryTypeIndex = rayTraceImageMemoryTypeIndex};
+
+  VkDeviceMemory rayTraceImageDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Image",
+                                &rayTraceImageMemoryAllocateInfo,
+                                &rayTraceImageDeviceMemoryHandle);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindImageMemory(deviceHandle, rayTraceImageHandle,
+                             rayTraceImageDeviceMemoryHandle, 0);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindImageMemory");
+  }
+
+  VkImageViewCreateInfo rayTraceImageViewCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .image = rayTraceImageHandle,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = VK_FORMAT_R8G8B8A8_UNORM,
+      .components = {.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                     .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                     .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                     .a = VK_COMPONENT_SWIZZLE_IDENTITY},
+      .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                           .baseMipLevel = 0,
+                           .levelCount = 1,
+                           .baseArrayLayer = 0,
+                           .layerCount = 1}};
+
+  VkImageView rayTraceImageViewHandle = VK_NULL_HANDLE;
+  result = vkCreateImageView(deviceHandle, &rayTraceImageViewCreateInfo, NULL,
+                             &rayTraceImageViewHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateImageView");
+  }
+
+#if defined(HEATMAP_ENABLED)
   // =========================================================================
-  // Ray Trace Image
+  // Heatmap Image
 
-  VkImageCreateInfo rayTraceImageCreateInfo = {
+  beginTraceSection(deviceTraceSection, "Heatmap Image");
+
+  // Only used on the graphics queue, read back once after the last tile
+  VkImageCreateInfo heatmapImageCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
       .imageType = VK_IMAGE_TYPE_2D,
-      .format = VK_FORMAT_R8G8B8A8_UNORM,
-      .extent = {.width = 800,
-                 .height = 600,
-                 .depth = 1},
+      .format = VK_FORMAT_R32G32B32A32_UINT,
+      .extent = {.width = 800, .height = 600, .depth = 1},
       .mipLevels = 1,
       .arrayLayers = 1,
       .samples = VK_SAMPLE_COUNT_1_BIT,
@@ -1762,57 +6336,58 @@ int main() {
       .pQueueFamilyIndices = &queueFamilyIndex,
       .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
 
-  VkImage rayTraceImageHandle = VK_NULL_HANDLE;
-  result = vkCreateImage(deviceHandle, &rayTraceImageCreateInfo, NULL,
-                         &rayTraceImageHandle);
+  VkImage heatmapImageHandle = VK_NULL_HANDLE;
+  result = vkCreateImage(deviceHandle, &heatmapImageCreateInfo, NULL,
+                         &heatmapImageHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkCreateImage");
   }
 
-  VkMemoryRequirements rayTraceImageMemoryRequirements;
-  vkGetImageMemoryRequirements(deviceHandle, rayTraceImageHandle,
-                               &rayTraceImageMemoryRequirements);
+  VkMemoryRequirements heatmapImageMemoryRequirements;
+  vkGetImageMemoryRequirements(deviceHandle, heatmapImageHandle,
+                               &heatmapImageMemoryRequirements);
 
-  uint32_t rayTraceImageMemoryTypeIndex = -1;
+  uint32_t heatmapImageMemoryTypeIndex = -1;
   for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
        x++) {
-    if ((rayTraceImageMemoryRequirements.memoryTypeBits & (1 << x)) &&
+    if ((heatmapImageMemoryRequirements.memoryTypeBits & (1 << x)) &&
         (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
 
-      rayTraceImageMemoryTypeIndex = x;
+      heatmapImageMemoryTypeIndex = x;
       break;
     }
   }
 
-  VkMemoryAllocateInfo rayTraceImageMemoryAllocateInfo = {
+  VkMemoryAllocateInfo heatmapImageMemoryAllocateInfo = {
       .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
       .pNext = NULL,
-      .allocationSize = rayTraceImageMemoryRequirements.size,
-      .memoryTypeIndex = rayTraceImageMemoryTypeIndex};
+      .allocationSize = heatmapImageMemoryRequirements.size,
+      .memoryTypeIndex = heatmapImageMemoryTypeIndex};
 
-  VkDeviceMemory rayTraceImageDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &rayTraceImageMemoryAllocateInfo,
-                            NULL, &rayTraceImageDeviceMemoryHandle);
+  VkDeviceMemory heatmapImageDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Image",
+                                &heatmapImageMemoryAllocateInfo,
+                                &heatmapImageDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
 
-  result = vkBindImageMemory(deviceHandle, rayTraceImageHandle,
-                             rayTraceImageDeviceMemoryHandle, 0);
+  result = vkBindImageMemory(deviceHandle, heatmapImageHandle,
+                             heatmapImageDeviceMemoryHandle, 0);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkBindImageMemory");
   }
 
-  VkImageViewCreateInfo rayTraceImageViewCreateInfo = {
+  VkImageViewCreateInfo heatmapImageViewCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .image = rayTraceImageHandle,
+      .image = heatmapImageHandle,
       .viewType = VK_IMAGE_VIEW_TYPE_2D,
-      .format = VK_FORMAT_R8G8B8A8_UNORM,
+      .format = VK_FORMAT_R32G32B32A32_UINT,
       .components = {.r = VK_COMPONENT_SWIZZLE_IDENTITY,
                      .g = VK_COMPONENT_SWIZZLE_IDENTITY,
                      .b = VK_COMPONENT_SWIZZLE_IDENTITY,
@@ -1823,16 +6398,19 @@ int main() {
                            .baseArrayLayer = 0,
                            .layerCount = 1}};
 
-  VkImageView rayTraceImageViewHandle = VK_NULL_HANDLE;
-  result = vkCreateImageView(deviceHandle, &rayTraceImageViewCreateInfo, NULL,
-                             &rayTraceImageViewHandle);
+  VkImageView heatmapImageViewHandle = VK_NULL_HANDLE;
+  result = vkCreateImageView(deviceHandle, &heatmapImageViewCreateInfo, NULL,
+                             &heatmapImageViewHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkCreateImageView");
   }
+#endif
 
   // =========================================================================
   // Ray Trace Image Barrier
+
+  beginTraceSection(deviceTraceSection, "Ray Trace Image Barrier");
   // (VK_IMAGE_LAYOUT_UNDEFINED -> VK_IMAGE_LAYOUT_GENERAL)
 
   VkCommandBufferBeginInfo rayTraceImageBarrierCommandBufferBeginInfo = {
@@ -1855,8 +6433,8 @@ int main() {
       .dstAccessMask = 0,
       .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
       .newLayout = VK_IMAGE_LAYOUT_GENERAL,
-      .srcQueueFamilyIndex = queueFamilyIndex,
-      .dstQueueFamilyIndex = queueFamilyIndex,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
       .image = rayTraceImageHandle,
       .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                            .baseMipLevel = 0,
@@ -1864,10 +6442,22 @@ int main() {
                            .baseArrayLayer = 0,
                            .layerCount = 1}};
 
+  std::vector<VkImageMemoryBarrier> generalMemoryBarrierList = {
+      rayTraceGeneralMemoryBarrier};
+
+#if defined(HEATMAP_ENABLED)
+  VkImageMemoryBarrier heatmapGeneralMemoryBarrier =
+      rayTraceGeneralMemoryBarrier;
+  heatmapGeneralMemoryBarrier.image = heatmapImageHandle;
+
+  generalMemoryBarrierList.push_back(heatmapGeneralMemoryBarrier);
+#endif
+
   vkCmdPipelineBarrier(commandBufferHandleList.back(),
                        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
                        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0, NULL,
-                       1, &rayTraceGeneralMemoryBarrier);
+                       (uint32_t)generalMemoryBarrierList.size(),
+                       generalMemoryBarrierList.data());
 
   result = vkEndCommandBuffer(commandBufferHandleList.back());
 
@@ -1923,6 +6513,8 @@ int main() {
   // =========================================================================
   // Result Buffer
 
+  beginTraceSection(deviceTraceSection, "Result Buffer");
+
   VkBufferCreateInfo resultBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
@@ -1932,7 +6524,7 @@ int main() {
                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
-      .pQueueFamilyIndices = &queueFamilyIndex};
+      .pQueueFamilyIndices = &transferQueueFamilyIndex};
 
   VkBuffer resultBufferHandle = VK_NULL_HANDLE;
   result = vkCreateBuffer(deviceHandle, &resultBufferCreateInfo, NULL,
@@ -1966,8 +6558,9 @@ int main() {
       .memoryTypeIndex = resultMemoryTypeIndex};
 
   VkDeviceMemory resultDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &resultMemoryAllocateInfo, NULL,
-                            &resultDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Readback",
+                                &resultMemoryAllocateInfo,
+                                &resultDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
@@ -1981,6 +6574,8 @@ int main() {
   // =========================================================================
   // Update Descriptor Set
 
+  beginTraceSection(deviceTraceSection, "Update Descriptor Set");
+
   VkWriteDescriptorSetAccelerationStructureKHR
       accelerationStructureDescriptorInfo = {
           .sType =
@@ -2055,24 +6650,105 @@ int main() {
        .pBufferInfo = NULL,
        .pTexelBufferView = NULL}};
 
+#if defined(HEATMAP_ENABLED)
+  VkDescriptorImageInfo heatmapImageDescriptorInfo = {
+      .sampler = VK_NULL_HANDLE,
+      .imageView = heatmapImageViewHandle,
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+
+  writeDescriptorSetList.push_back(
+      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+       .pNext = NULL,
+       .dstSet = descriptorSetHandleList[0],
+       .dstBinding = 6,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+       .pImageInfo = &heatmapImageDescriptorInfo,
+       .pBufferInfo = NULL,
+       .pTexelBufferView = NULL});
+#endif
+
   vkUpdateDescriptorSets(deviceHandle, writeDescriptorSetList.size(),
                          writeDescriptorSetList.data(), 0, NULL);
 
-  // =========================================================================
-  // Material Index Buffer
+#if defined(BLAS_CLUSTERING_ENABLED)
+  // The clusters' set 0 copies every binding but the top level acceleration
+  // structure from set 0
+  std::vector<VkCopyDescriptorSet> clusterCopyDescriptorSetList;
+  for (VkDescriptorSetLayoutBinding &descriptorSetLayoutBinding :
+       descriptorSetLayoutBindingList) {
+    if (descriptorSetLayoutBinding.binding == 0) {
+      continue;
+    }
 
-  std::vector<uint32_t> materialIndexList;
-  for (tinyobj::shape_t shape : shapes) {
-    for (int index : shape.mesh.material_ids) {
-      materialIndexList.push_back(index);
+    clusterCopyDescriptorSetList.push_back(
+        {.sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET,
+         .pNext = NULL,
+         .srcSet = descriptorSetHandleList[0],
+         .srcBinding = descriptorSetLayoutBinding.binding,
+         .srcArrayElement = 0,
+         .dstSet = clusterDescriptorSetHandle,
+         .dstBinding = descriptorSetLayoutBinding.binding,
+         .dstArrayElement = 0,
+         .descriptorCount = descriptorSetLayoutBinding.descriptorCount});
+  }
+
+  VkWriteDescriptorSetAccelerationStructureKHR
+      clusterAccelerationStructureDescriptorInfo = {
+          .sType =
+              VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR,
+          .pNext = NULL,
+          .accelerationStructureCount = 1,
+          .pAccelerationStructures =
+              &clusterTopLevelAccelerationStructureHandle};
+
+  VkWriteDescriptorSet clusterWriteDescriptorSet = writeDescriptorSetList[0];
+  clusterWriteDescriptorSet.pNext = &clusterAccelerationStructureDescriptorInfo;
+  clusterWriteDescriptorSet.dstSet = clusterDescriptorSetHandle;
+
+  vkUpdateDescriptorSets(deviceHandle, 1, &clusterWriteDescriptorSet,
+                         (uint32_t)clusterCopyDescriptorSetList.size(),
+                         clusterCopyDescriptorSetList.data());
+#endif
+
+#if defined(BUILD_PRESET_BENCHMARK_ENABLED)
+  // The benchmark's set 0 copies the same bindings. Its top level acceleration
+  // structure is written by each benchmark run.
+  std::vector<VkCopyDescriptorSet> benchmarkCopyDescriptorSetList;
+  for (VkDescriptorSetLayoutBinding &descriptorSetLayoutBinding :
+       descriptorSetLayoutBindingList) {
+    if (descriptorSetLayoutBinding.binding == 0) {
+      continue;
     }
+
+    benchmarkCopyDescriptorSetList.push_back(
+        {.sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET,
+         .pNext = NULL,
+         .srcSet = descriptorSetHandleList[0],
+         .srcBinding = descriptorSetLayoutBinding.binding,
+         .srcArrayElement = 0,
+         .dstSet = benchmarkDescriptorSetHandle,
+         .dstBinding = descriptorSetLayoutBinding.binding,
+         .dstArrayElement = 0,
+         .descriptorCount = descriptorSetLayoutBinding.descriptorCount});
   }
 
+  vkUpdateDescriptorSets(deviceHandle, 0, NULL,
+                         (uint32_t)benchmarkCopyDescriptorSetList.size(),
+                         benchmarkCopyDescriptorSetList.data());
+#endif
+
+  // =========================================================================
+  // Material Index Buffer
+
+  beginTraceSection(deviceTraceSection, "Material Index Buffer");
+
   VkBufferCreateInfo materialIndexBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = sizeof(uint32_t) * materialIndexList.size(),
+      .size = sizeof(uint32_t) * scene.primitiveCount,
       .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
@@ -2110,8 +6786,9 @@ int main() {
       .memoryTypeIndex = materialIndexMemoryTypeIndex};
 
   VkDeviceMemory materialIndexDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &materialIndexMemoryAllocateInfo,
-                            NULL, &materialIndexDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Material",
+                                &materialIndexMemoryAllocateInfo,
+                                &materialIndexDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
@@ -2124,11 +6801,11 @@ int main() {
 
   void *hostMaterialIndexMemoryBuffer;
   result = vkMapMemory(deviceHandle, materialIndexDeviceMemoryHandle, 0,
-                       sizeof(uint32_t) * materialIndexList.size(), 0,
+                       sizeof(uint32_t) * scene.primitiveCount, 0,
                        &hostMaterialIndexMemoryBuffer);
 
-  memcpy(hostMaterialIndexMemoryBuffer, materialIndexList.data(),
-         sizeof(uint32_t) * materialIndexList.size());
+  memcpy(hostMaterialIndexMemoryBuffer, scene.materialIndexData,
+         sizeof(uint32_t) * scene.primitiveCount);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkMapMemory");
@@ -2139,26 +6816,13 @@ int main() {
   // =========================================================================
   // Material Buffer
 
-  struct Material {
-    float ambient[4] = {0, 0, 0, 0};
-    float diffuse[4] = {0, 0, 0, 0};
-    float specular[4] = {0, 0, 0, 0};
-    float emission[4] = {0, 0, 0, 0};
-  };
-
-  std::vector<Material> materialList(materials.size());
-  for (uint32_t x = 0; x < materials.size(); x++) {
-    memcpy(materialList[x].ambient, materials[x].ambient, sizeof(float) * 3);
-    memcpy(materialList[x].diffuse, materials[x].diffuse, sizeof(float) * 3);
-    memcpy(materialList[x].specular, materials[x].specular, sizeof(float) * 3);
-    memcpy(materialList[x].emission, materials[x].emission, sizeof(float) * 3);
-  }
+  beginTraceSection(deviceTraceSection, "Material Buffer");
 
   VkBufferCreateInfo materialBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = sizeof(Material) * materialList.size(),
+      .size = sizeof(Material) * scene.materialCount,
       .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
@@ -2196,8 +6860,9 @@ int main() {
       .memoryTypeIndex = materialMemoryTypeIndex};
 
   VkDeviceMemory materialDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &materialMemoryAllocateInfo, NULL,
-                            &materialDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Material",
+                                &materialMemoryAllocateInfo,
+                                &materialDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
@@ -2210,11 +6875,11 @@ int main() {
 
   void *hostMaterialMemoryBuffer;
   result = vkMapMemory(deviceHandle, materialDeviceMemoryHandle, 0,
-                       sizeof(Material) * materialList.size(), 0,
+                       sizeof(Material) * scene.materialCount, 0,
                        &hostMaterialMemoryBuffer);
 
-  memcpy(hostMaterialMemoryBuffer, materialList.data(),
-         sizeof(Material) * materialList.size());
+  memcpy(hostMaterialMemoryBuffer, scene.materialData,
+         sizeof(Material) * scene.materialCount);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkMapMemory");
@@ -2225,6 +6890,8 @@ int main() {
   // =========================================================================
   // Update Material Descriptor Set
 
+  beginTraceSection(deviceTraceSection, "Update Material Descriptor Set");
+
   VkDescriptorBufferInfo materialIndexDescriptorInfo = {
       .buffer = materialIndexBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
 
@@ -2259,6 +6926,8 @@ int main() {
   // =========================================================================
   // Shader Binding Table
 
+  beginTraceSection(deviceTraceSection, "Shader Binding Table");
+
   VkDeviceSize progSize =
       physicalDeviceRayTracingPipelineProperties.shaderGroupBaseAlignment;
 
@@ -2307,8 +6976,10 @@ int main() {
       .memoryTypeIndex = shaderBindingTableMemoryTypeIndex};
 
   VkDeviceMemory shaderBindingTableDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &shaderBindingTableMemoryAllocateInfo,
-                            NULL, &shaderBindingTableDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger,
+                                "Shader binding table",
+                                &shaderBindingTableMemoryAllocateInfo,
+                                &shaderBindingTableDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
@@ -2380,58 +7051,836 @@ int main() {
 
   const VkStridedDeviceAddressRegionKHR callableShaderBindingTable = {};
 
+#if defined(BUILD_PRESET_BENCHMARK_ENABLED)
   // =========================================================================
-  // Record Render Pass Command Buffer
+  // Build Preset Benchmark
+
+  beginTraceSection(deviceTraceSection, "Build Preset Benchmark");
+
+  // Every preset builds the scene into a bottom level acceleration structure
+  // of its own, instanced once by a top level structure, and traces the whole
+  // image with it BENCHMARK_TRACE_COUNT times
+  VkBuffer benchmarkInstanceBufferHandle = VK_NULL_HANDLE;
+  VkDeviceMemory benchmarkInstanceDeviceMemoryHandle = VK_NULL_HANDLE;
+  createAccelerationStructureBuffer(
+      sizeof(VkAccelerationStructureInstanceKHR),
+      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      "Instance", benchmarkInstanceBufferHandle,
+      benchmarkInstanceDeviceMemoryHandle);
 
-  VkCommandBufferBeginInfo renderCommandBufferBeginInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+  void *hostBenchmarkInstanceMemoryBuffer;
+  result = vkMapMemory(deviceHandle, benchmarkInstanceDeviceMemoryHandle, 0,
+                       VK_WHOLE_SIZE, 0, &hostBenchmarkInstanceMemoryBuffer);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkMapMemory");
+  }
+
+  VkBufferDeviceAddressInfo benchmarkInstanceBufferDeviceAddressInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
       .pNext = NULL,
-      .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
-      .pInheritanceInfo = NULL};
+      .buffer = benchmarkInstanceBufferHandle};
+
+  VkAccelerationStructureGeometryKHR benchmarkTopLevelGeometry =
+      topLevelAccelerationStructureGeometry;
+  benchmarkTopLevelGeometry.geometry.instances.data.deviceAddress =
+      pvkGetBufferDeviceAddressKHR(deviceHandle,
+                                   &benchmarkInstanceBufferDeviceAddressInfo);
+
+  std::vector<uint32_t> benchmarkTopLevelMaxPrimitiveCountList = {1};
 
-  result = vkBeginCommandBuffer(commandBufferHandleList[0],
-                                &renderCommandBufferBeginInfo);
+  VkAccelerationStructureBuildRangeInfoKHR benchmarkTopLevelBuildRangeInfo = {
+      .primitiveCount = 1,
+      .primitiveOffset = 0,
+      .firstVertex = 0,
+      .transformOffset = 0};
+
+  const VkAccelerationStructureBuildRangeInfoKHR
+      *benchmarkTopLevelBuildRangeInfos = &benchmarkTopLevelBuildRangeInfo;
+
+  for (uint32_t buildPreset = 0; buildPreset < buildPresetNameList.size();
+       buildPreset++) {
+    VkBuildAccelerationStructureFlagsKHR buildFlags =
+        getBuildPresetFlags(buildPreset);
+
+    VkAccelerationStructureBuildGeometryInfoKHR
+        benchmarkBottomLevelBuildGeometryInfo =
+            bottomLevelAccelerationStructureBuildGeometryInfo;
+    benchmarkBottomLevelBuildGeometryInfo.flags = buildFlags;
+
+    VkAccelerationStructureBuildGeometryInfoKHR
+        benchmarkTopLevelBuildGeometryInfo =
+            topLevelAccelerationStructureBuildGeometryInfo;
+    benchmarkTopLevelBuildGeometryInfo.flags =
+        buildFlags & ~VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+    benchmarkTopLevelBuildGeometryInfo.pGeometries = &benchmarkTopLevelGeometry;
+
+    VkAccelerationStructureBuildSizesInfoKHR
+        benchmarkBottomLevelBuildSizesInfo = {
+            .sType =
+                VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+            .pNext = NULL,
+            .accelerationStructureSize = 0,
+            .updateScratchSize = 0,
+            .buildScratchSize = 0};
+
+    pvkGetAccelerationStructureBuildSizesKHR(
+        deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+        &benchmarkBottomLevelBuildGeometryInfo,
+        bottomLevelMaxPrimitiveCountList.data(),
+        &benchmarkBottomLevelBuildSizesInfo);
+
+    VkAccelerationStructureBuildSizesInfoKHR benchmarkTopLevelBuildSizesInfo =
+        benchmarkBottomLevelBuildSizesInfo;
+
+    pvkGetAccelerationStructureBuildSizesKHR(
+        deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+        &benchmarkTopLevelBuildGeometryInfo,
+        benchmarkTopLevelMaxPrimitiveCountList.data(),
+        &benchmarkTopLevelBuildSizesInfo);
+
+    // One scratch buffer serves the build and update of the bottom level and
+    // the build of the top level
+    VkBuffer benchmarkScratchBufferHandle = VK_NULL_HANDLE;
+    VkDeviceMemory benchmarkScratchDeviceMemoryHandle = VK_NULL_HANDLE;
+    createAccelerationStructureBuffer(
+        std::max({benchmarkBottomLevelBuildSizesInfo.buildScratchSize,
+                  benchmarkBottomLevelBuildSizesInfo.updateScratchSize,
+                  benchmarkTopLevelBuildSizesInfo.buildScratchSize}),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, "Scratch",
+        benchmarkScratchBufferHandle, benchmarkScratchDeviceMemoryHandle);
+
+    VkBufferDeviceAddressInfo benchmarkScratchBufferDeviceAddressInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .pNext = NULL,
+        .buffer = benchmarkScratchBufferHandle};
+
+    VkDeviceAddress benchmarkScratchBufferDeviceAddress =
+        pvkGetBufferDeviceAddressKHR(deviceHandle,
+                                     &benchmarkScratchBufferDeviceAddressInfo);
+
+    VkBuffer benchmarkBottomLevelBufferHandle = VK_NULL_HANDLE;
+    VkDeviceMemory benchmarkBottomLevelDeviceMemoryHandle = VK_NULL_HANDLE;
+    createAccelerationStructureBuffer(
+        benchmarkBottomLevelBuildSizesInfo.accelerationStructureSize,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, "Acceleration structure",
+        benchmarkBottomLevelBufferHandle,
+        benchmarkBottomLevelDeviceMemoryHandle);
+
+    VkAccelerationStructureCreateInfoKHR benchmarkBottomLevelCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+        .pNext = NULL,
+        .createFlags = 0,
+        .buffer = benchmarkBottomLevelBufferHandle,
+        .offset = 0,
+        .size = benchmarkBottomLevelBuildSizesInfo.accelerationStructureSize,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .deviceAddress = 0};
+
+    VkAccelerationStructureKHR benchmarkBottomLevelHandle = VK_NULL_HANDLE;
+    result = pvkCreateAccelerationStructureKHR(
+        deviceHandle, &benchmarkBottomLevelCreateInfo, NULL,
+        &benchmarkBottomLevelHandle);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
+    }
+
+    benchmarkBottomLevelBuildGeometryInfo.dstAccelerationStructure =
+        benchmarkBottomLevelHandle;
+    benchmarkBottomLevelBuildGeometryInfo.scratchData = {
+        .deviceAddress = benchmarkScratchBufferDeviceAddress};
+
+    double bottomLevelBuildMilliseconds = submitAccelerationStructureCommands(
+        [&](VkCommandBuffer commandBufferHandle) {
+          pvkCmdBuildAccelerationStructuresKHR(
+              commandBufferHandle, 1, &benchmarkBottomLevelBuildGeometryInfo,
+              &bottomLevelAccelerationStructureBuildRangeInfos);
+        });
+
+    VkDeviceSize bottomLevelSize =
+        benchmarkBottomLevelBuildSizesInfo.accelerationStructureSize;
+
+    double compactionMilliseconds = 0.0;
+    if (buildFlags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) {
+      compactionMilliseconds = compactAccelerationStructure(
+          VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+          benchmarkBottomLevelHandle, benchmarkBottomLevelBufferHandle,
+          benchmarkBottomLevelDeviceMemoryHandle, bottomLevelSize);
+    }
+
+    // An update in place over unchanged vertices measures the refit cost
+    double updateMilliseconds = 0.0;
+    if (buildFlags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR) {
+      VkAccelerationStructureBuildGeometryInfoKHR
+          benchmarkBottomLevelUpdateGeometryInfo =
+              benchmarkBottomLevelBuildGeometryInfo;
+      benchmarkBottomLevelUpdateGeometryInfo.mode =
+          VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+      benchmarkBottomLevelUpdateGeometryInfo.srcAccelerationStructure =
+          benchmarkBottomLevelHandle;
+
+      updateMilliseconds = submitAccelerationStructureCommands(
+          [&](VkCommandBuffer commandBufferHandle) {
+            pvkCmdBuildAccelerationStructuresKHR(
+                commandBufferHandle, 1, &benchmarkBottomLevelUpdateGeometryInfo,
+                &bottomLevelAccelerationStructureBuildRangeInfos);
+          });
+    }
+
+    VkAccelerationStructureDeviceAddressInfoKHR
+        benchmarkBottomLevelDeviceAddressInfo = {
+            .sType =
+                VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+            .pNext = NULL,
+            .accelerationStructure = benchmarkBottomLevelHandle};
+
+    VkAccelerationStructureInstanceKHR benchmarkInstance =
+        bottomLevelAccelerationStructureInstance;
+    benchmarkInstance.accelerationStructureReference =
+        pvkGetAccelerationStructureDeviceAddressKHR(
+            deviceHandle, &benchmarkBottomLevelDeviceAddressInfo);
+
+    memcpy(hostBenchmarkInstanceMemoryBuffer, &benchmarkInstance,
+           sizeof(VkAccelerationStructureInstanceKHR));
+
+    VkBuffer benchmarkTopLevelBufferHandle = VK_NULL_HANDLE;
+    VkDeviceMemory benchmarkTopLevelDeviceMemoryHandle = VK_NULL_HANDLE;
+    createAccelerationStructureBuffer(
+        benchmarkTopLevelBuildSizesInfo.accelerationStructureSize,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, "Acceleration structure",
+        benchmarkTopLevelBufferHandle, benchmarkTopLevelDeviceMemoryHandle);
+
+    VkAccelerationStructureCreateInfoKHR benchmarkTopLevelCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+        .pNext = NULL,
+        .createFlags = 0,
+        .buffer = benchmarkTopLevelBufferHandle,
+        .offset = 0,
+        .size = benchmarkTopLevelBuildSizesInfo.accelerationStructureSize,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+        .deviceAddress = 0};
+
+    VkAccelerationStructureKHR benchmarkTopLevelHandle = VK_NULL_HANDLE;
+    result = pvkCreateAccelerationStructureKHR(
+        deviceHandle, &benchmarkTopLevelCreateInfo, NULL,
+        &benchmarkTopLevelHandle);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
+    }
+
+    benchmarkTopLevelBuildGeometryInfo.dstAccelerationStructure =
+        benchmarkTopLevelHandle;
+    benchmarkTopLevelBuildGeometryInfo.scratchData = {
+        .deviceAddress = benchmarkScratchBufferDeviceAddress};
+
+    double topLevelBuildMilliseconds = submitAccelerationStructureCommands(
+        [&](VkCommandBuffer commandBufferHandle) {
+          pvkCmdBuildAccelerationStructuresKHR(
+              commandBufferHandle, 1, &benchmarkTopLevelBuildGeometryInfo,
+              &benchmarkTopLevelBuildRangeInfos);
+        });
+
+    VkWriteDescriptorSetAccelerationStructureKHR
+        benchmarkAccelerationStructureDescriptorInfo = {
+            .sType =
+                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR,
+            .pNext = NULL,
+            .accelerationStructureCount = 1,
+            .pAccelerationStructures = &benchmarkTopLevelHandle};
+
+    VkWriteDescriptorSet benchmarkWriteDescriptorSet =
+        writeDescriptorSetList[0];
+    benchmarkWriteDescriptorSet.pNext =
+        &benchmarkAccelerationStructureDescriptorInfo;
+    benchmarkWriteDescriptorSet.dstSet = benchmarkDescriptorSetHandle;
+
+    vkUpdateDescriptorSets(deviceHandle, 1, &benchmarkWriteDescriptorSet, 0,
+                           NULL);
+
+    std::vector<VkDescriptorSet> benchmarkDescriptorSetHandleList =
+        descriptorSetHandleList;
+    benchmarkDescriptorSetHandleList[0] = benchmarkDescriptorSetHandle;
+
+    double traceMilliseconds =
+        submitAccelerationStructureCommands([&](VkCommandBuffer
+                                                    commandBufferHandle) {
+          vkCmdBindPipeline(commandBufferHandle,
+                            VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
+                            rayTracingPipelineHandle);
+
+          vkCmdBindDescriptorSets(
+              commandBufferHandle, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
+              pipelineLayoutHandle, 0,
+              (uint32_t)benchmarkDescriptorSetHandleList.size(),
+              benchmarkDescriptorSetHandleList.data(), 0, NULL);
+
+          uint32_t tileOffset[2] = {0, 0};
+          vkCmdPushConstants(commandBufferHandle, pipelineLayoutHandle,
+                             tilePushConstantRange.stageFlags, 0,
+                             sizeof(tileOffset), tileOffset);
+
+          // Each trace overwrites the image written by the one before
+          VkMemoryBarrier traceMemoryBarrier = {
+              .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+              .pNext = NULL,
+              .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+              .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT};
+
+          for (uint32_t x = 0; x < BENCHMARK_TRACE_COUNT; x++) {
+            if (x > 0) {
+              vkCmdPipelineBarrier(commandBufferHandle,
+                                   VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                                   VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                                   0, 1, &traceMemoryBarrier, 0, NULL, 0, NULL);
+            }
+
+            pvkCmdTraceRaysKHR(commandBufferHandle, &rgenShaderBindingTable,
+                               &rmissShaderBindingTable,
+                               &rchitShaderBindingTable,
+                               &callableShaderBindingTable, 800, 600, 1);
+          }
+        }) /
+        BENCHMARK_TRACE_COUNT;
+
+    {
+      std::lock_guard<std::mutex> tileSchedulerLock(tileScheduler.mutex);
+      std::cout << physicalDeviceProperties.deviceName << ": build preset "
+                << buildPresetNameList[buildPreset]
+                << ": bottom level build " << bottomLevelBuildMilliseconds
+                << " ms, " << getMebibytes(bottomLevelSize) << " MiB";
+
+      if (buildFlags &
+          VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) {
+        std::cout << " after compaction in " << compactionMilliseconds
+                  << " ms";
+      }
+
+      if (buildFlags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR) {
+        std::cout << ", update " << updateMilliseconds << " ms";
+      }
+
+      std::cout << ", top level build " << topLevelBuildMilliseconds
+                << " ms, trace " << traceMilliseconds << " ms" << std::endl;
+    }
+
+    pvkDestroyAccelerationStructureKHR(deviceHandle, benchmarkTopLevelHandle,
+                                       NULL);
+    vkDestroyBuffer(deviceHandle, benchmarkTopLevelBufferHandle, NULL);
+    freeDeviceMemory(deviceHandle, memoryLedger,
+                     benchmarkTopLevelDeviceMemoryHandle);
+
+    pvkDestroyAccelerationStructureKHR(deviceHandle,
+                                       benchmarkBottomLevelHandle, NULL);
+    vkDestroyBuffer(deviceHandle, benchmarkBottomLevelBufferHandle, NULL);
+    freeDeviceMemory(deviceHandle, memoryLedger,
+                     benchmarkBottomLevelDeviceMemoryHandle);
+
+    vkDestroyBuffer(deviceHandle, benchmarkScratchBufferHandle, NULL);
+    freeDeviceMemory(deviceHandle, memoryLedger,
+                     benchmarkScratchDeviceMemoryHandle);
+  }
+
+  vkUnmapMemory(deviceHandle, benchmarkInstanceDeviceMemoryHandle);
+  vkDestroyBuffer(deviceHandle, benchmarkInstanceBufferHandle, NULL);
+  freeDeviceMemory(deviceHandle, memoryLedger,
+                   benchmarkInstanceDeviceMemoryHandle);
+
+#if defined(RAY_COUNTERS_ENABLED)
+  // The rendered image alone is counted
+  memset(hostRayCounterMemoryBuffer, 0, rayCounterBufferCreateInfo.size);
+#endif
+#endif
+
+  // =========================================================================
+  // Render Tiles
+
+  beginTraceSection(deviceTraceSection, "Render Tiles");
+
+  {
+    std::lock_guard<std::mutex> tileSchedulerLock(tileScheduler.mutex);
+    printMemoryReport(physicalDeviceProperties.deviceName, memoryLedger);
+  }
+
+  void *hostResultMemoryBuffer;
+  result = vkMapMemory(deviceHandle, resultDeviceMemoryHandle, 0,
+                       rayTraceImageMemoryRequirements.size, 0,
+                       &hostResultMemoryBuffer);
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+    throwExceptionVulkanAPI(result, "vkMapMemory");
+  }
+
+  struct PendingTile {
+    uint32_t rowOffset;
+    uint32_t rowCount;
+    uint32_t tileSlot;
+    uint64_t transferTimelineValue;
+    double submitMicroseconds;
+  };
+
+  // Tiles are double buffered: the transfer queue reads back tile N while
+  // the graphics queue traces tile N + 1
+  std::vector<PendingTile> pendingTileList;
+
+  uint32_t tileRowCount = 8;
+  uint32_t renderedRowCount = 0;
+  uint32_t renderedTileCount = 0;
+  uint32_t submittedTileCount = 0;
+
+  std::chrono::steady_clock::time_point renderStartTime =
+      std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point previousTileFinishTime =
+      renderStartTime;
+
+#if defined(RAY_COUNTERS_ENABLED)
+  double totalTraceMilliseconds = 0.0;
+#endif
+
+#if defined(BLAS_CLUSTERING_ENABLED)
+  // Trace time and rows of the tiles traced against the single bottom level
+  // acceleration structure and of those traced against the clusters
+  double singleTraceMilliseconds = 0.0;
+  uint32_t singleTraceRowCount = 0;
+  double clusterTraceMilliseconds = 0.0;
+  uint32_t clusterTraceRowCount = 0;
+#endif
+
+#if defined(HEATMAP_ENABLED)
+  // Rows traced by this device, the only ones it contributes to the heatmap
+  std::vector<PendingTile> finishedTileList;
+#endif
+
+  auto finishPendingTile = [&]() {
+    PendingTile pendingTile = pendingTileList.front();
+    pendingTileList.erase(pendingTileList.begin());
+
+    VkSemaphoreWaitInfo semaphoreWaitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .semaphoreCount = 1,
+        .pSemaphores = &transferTimelineSemaphoreHandle,
+        .pValues = &pendingTile.transferTimelineValue};
+
+    double waitStartMicroseconds = getTraceMicroseconds();
+    result = vkWaitSemaphores(deviceHandle, &semaphoreWaitInfo, UINT64_MAX);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkWaitSemaphores");
+    }
+
+    addTraceEvent("Tile wait", deviceTraceSection.trackIndex,
+                  waitStartMicroseconds,
+                  getTraceMicroseconds() - waitStartMicroseconds);
+
+    // The readback starts once the trace is done, so it is placed after it
+    double readbackSubmitMicroseconds = pendingTile.submitMicroseconds;
+
+    // The transfer timeline waits on the trace, so both are complete here
+    if (isTimestampSupported) {
+      double traceMilliseconds = getTimestampMilliseconds(
+          timestampQueryPoolHandle, pendingTile.tileSlot * 2);
+
+      addTimestampSample(traceTimestampStatistics, traceMilliseconds);
+
+#if defined(BLAS_CLUSTERING_ENABLED)
+      if (pendingTile.tileSlot == 1) {
+        clusterTraceMilliseconds += traceMilliseconds;
+        clusterTraceRowCount += pendingTile.rowCount;
+      } else {
+        singleTraceMilliseconds += traceMilliseconds;
+        singleTraceRowCount += pendingTile.rowCount;
+      }
+#endif
+
+      addQueueTraceEvent("Trace", graphicsQueueTraceTrackIndex,
+                         pendingTile.submitMicroseconds,
+                         traceMilliseconds * 1000.0);
+      readbackSubmitMicroseconds += traceMilliseconds * 1000.0;
+
+#if defined(RAY_COUNTERS_ENABLED)
+      totalTraceMilliseconds += traceMilliseconds;
+#endif
+    }
+
+    if (isTransferTimestampSupported) {
+      double readbackMilliseconds = getTimestampMilliseconds(
+          transferTimestampQueryPoolHandle, pendingTile.tileSlot * 2);
+
+      addTimestampSample(readbackTimestampStatistics, readbackMilliseconds);
+
+      addQueueTraceEvent("Readback", transferQueueTraceTrackIndex,
+                         readbackSubmitMicroseconds,
+                         readbackMilliseconds * 1000.0);
+    }
+
+    VkDeviceSize tileBufferOffset =
+        (VkDeviceSize)pendingTile.rowOffset * 800 * 4;
+    memcpy(hostImageBuffer.data() + tileBufferOffset,
+           (char *)hostResultMemoryBuffer + tileBufferOffset,
+           (size_t)pendingTile.rowCount * 800 * 4);
+
+    renderedRowCount += pendingTile.rowCount;
+    renderedTileCount += 1;
+
+#if defined(HEATMAP_ENABLED)
+    finishedTileList.push_back(pendingTile);
+#endif
+
+    // Size the next tile from this device's measured throughput so that
+    // faster devices claim more rows per trip to the scheduler
+    std::chrono::steady_clock::time_point tileFinishTime =
+        std::chrono::steady_clock::now();
+    double tileSeconds =
+        std::chrono::duration<double>(tileFinishTime - previousTileFinishTime)
+            .count();
+    previousTileFinishTime = tileFinishTime;
+
+    double rowsPerSecond = pendingTile.rowCount / std::max(tileSeconds, 1e-6);
+
+    tileRowCount = std::clamp(
+        (uint32_t)(rowsPerSecond * TILE_TARGET_MILLISECONDS / 1000.0), 1u,
+        tileScheduler.rowCount);
+  };
+
+  while (true) {
+    uint32_t tileRowOffset = 0;
+    {
+      std::lock_guard<std::mutex> tileSchedulerLock(tileScheduler.mutex);
+
+      if (tileScheduler.nextRow >= tileScheduler.rowCount) {
+        break;
+      }
+
+      tileRowOffset = tileScheduler.nextRow;
+      tileRowCount = std::min((tileRowCount + tileScheduler.rowAlignment - 1) /
+                                  tileScheduler.rowAlignment *
+                                  tileScheduler.rowAlignment,
+                              tileScheduler.rowCount - tileRowOffset);
+      tileScheduler.nextRow += tileRowCount;
+    }
+
+    // The command buffers in this slot were last used two tiles ago
+    uint32_t tileSlot = submittedTileCount % 2;
+    if (pendingTileList.size() == 2) {
+      finishPendingTile();
+    }
+
+    VkCommandBufferBeginInfo renderCommandBufferBeginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = NULL};
+
+    result = vkBeginCommandBuffer(commandBufferHandleList[tileSlot],
+                                  &renderCommandBufferBeginInfo);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+    }
+
+    vkCmdBindPipeline(commandBufferHandleList[tileSlot],
+                      VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
+                      rayTracingPipelineHandle);
+
+    // With BLAS_CLUSTERING_ENABLED the tiles in slot 1 trace the clusters,
+    // so both layouts are measured on interleaved rows of the same image
+    std::vector<VkDescriptorSet> tileDescriptorSetHandleList =
+        descriptorSetHandleList;
+
+#if defined(BLAS_CLUSTERING_ENABLED)
+    if (tileSlot == 1) {
+      tileDescriptorSetHandleList[0] = clusterDescriptorSetHandle;
+    }
+#endif
+
+    vkCmdBindDescriptorSets(
+        commandBufferHandleList[tileSlot],
+        VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipelineLayoutHandle, 0,
+        (uint32_t)tileDescriptorSetHandleList.size(),
+        tileDescriptorSetHandleList.data(), 0, NULL);
+
+    uint32_t tileOffset[2] = {0, tileRowOffset};
+    vkCmdPushConstants(commandBufferHandleList[tileSlot], pipelineLayoutHandle,
+                       tilePushConstantRange.stageFlags, 0, sizeof(tileOffset),
+                       tileOffset);
+
+    if (isTimestampSupported) {
+      vkCmdResetQueryPool(commandBufferHandleList[tileSlot],
+                          timestampQueryPoolHandle, tileSlot * 2, 2);
+
+      vkCmdWriteTimestamp(commandBufferHandleList[tileSlot],
+                          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          timestampQueryPoolHandle, tileSlot * 2);
+    }
+
+    pvkCmdTraceRaysKHR(commandBufferHandleList[tileSlot],
+                       &rgenShaderBindingTable, &rmissShaderBindingTable,
+                       &rchitShaderBindingTable, &callableShaderBindingTable,
+                       800, tileRowCount, 1);
+
+    if (isTimestampSupported) {
+      vkCmdWriteTimestamp(commandBufferHandleList[tileSlot],
+                          VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                          timestampQueryPoolHandle, tileSlot * 2 + 1);
+    }
+
+#if defined(RAY_COUNTERS_ENABLED)
+    VkMemoryBarrier rayCounterMemoryBarrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT};
+
+    vkCmdPipelineBarrier(commandBufferHandleList[tileSlot],
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1,
+                         &rayCounterMemoryBarrier, 0, NULL, 0, NULL);
+#endif
+
+    result = vkEndCommandBuffer(commandBufferHandleList[tileSlot]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+    }
+
+    uint64_t renderSignalValue = ++renderTimelineValue;
+
+    VkTimelineSemaphoreSubmitInfo renderTimelineSemaphoreSubmitInfo = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .pNext = NULL,
+        .waitSemaphoreValueCount = 0,
+        .pWaitSemaphoreValues = NULL,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &renderSignalValue};
+
+    VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &renderTimelineSemaphoreSubmitInfo,
+        .waitSemaphoreCount = 0,
+        .pWaitSemaphores = NULL,
+        .pWaitDstStageMask = NULL,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBufferHandleList[tileSlot],
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &renderTimelineSemaphoreHandle};
+
+    double tileSubmitMicroseconds = getTraceMicroseconds();
+    result = vkQueueSubmit(queueHandle, 1, &submitInfo, VK_NULL_HANDLE);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkQueueSubmit");
+    }
+
+    // Readback on the transfer queue, the ray trace image is shared between
+    // both families so only the semaphore is needed to order the copy
+    VkCommandBufferBeginInfo readbackCommandBufferBeginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = NULL};
+
+    result = vkBeginCommandBuffer(transferCommandBufferHandleList[tileSlot],
+                                  &readbackCommandBufferBeginInfo);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+    }
+
+    VkBufferImageCopy imageCopy = {
+        .bufferOffset = (VkDeviceSize)tileRowOffset * 800 * 4,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .mipLevel = 0,
+                             .baseArrayLayer = 0,
+                             .layerCount = 1},
+        .imageOffset = {.x = 0, .y = (int32_t)tileRowOffset, .z = 0},
+        .imageExtent = {.width = 800,
+                        .height = tileRowCount,
+                        .depth = 1}};
+
+    if (isTransferTimestampSupported) {
+      vkCmdResetQueryPool(transferCommandBufferHandleList[tileSlot],
+                          transferTimestampQueryPoolHandle, tileSlot * 2, 2);
+
+      vkCmdWriteTimestamp(transferCommandBufferHandleList[tileSlot],
+                          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          transferTimestampQueryPoolHandle, tileSlot * 2);
+    }
+
+    vkCmdCopyImageToBuffer(transferCommandBufferHandleList[tileSlot],
+                           rayTraceImageHandle, VK_IMAGE_LAYOUT_GENERAL,
+                           resultBufferHandle, 1, &imageCopy);
+
+    if (isTransferTimestampSupported) {
+      vkCmdWriteTimestamp(transferCommandBufferHandleList[tileSlot],
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          transferTimestampQueryPoolHandle, tileSlot * 2 + 1);
+    }
+
+    VkMemoryBarrier readbackMemoryBarrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT};
+
+    vkCmdPipelineBarrier(transferCommandBufferHandleList[tileSlot],
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1,
+                         &readbackMemoryBarrier, 0, NULL, 0, NULL);
+
+    result = vkEndCommandBuffer(transferCommandBufferHandleList[tileSlot]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+    }
+
+    uint64_t readbackSignalValue = ++transferTimelineValue;
+
+    VkTimelineSemaphoreSubmitInfo readbackTimelineSemaphoreSubmitInfo = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .pNext = NULL,
+        .waitSemaphoreValueCount = 1,
+        .pWaitSemaphoreValues = &renderSignalValue,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &readbackSignalValue};
+
+    VkPipelineStageFlags readbackWaitStageFlags =
+        VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    VkSubmitInfo readbackSubmitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &readbackTimelineSemaphoreSubmitInfo,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &renderTimelineSemaphoreHandle,
+        .pWaitDstStageMask = &readbackWaitStageFlags,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &transferCommandBufferHandleList[tileSlot],
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &transferTimelineSemaphoreHandle};
+
+    result = vkQueueSubmit(transferQueueHandle, 1, &readbackSubmitInfo,
+                           VK_NULL_HANDLE);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkQueueSubmit");
+    }
+
+    pendingTileList.push_back({.rowOffset = tileRowOffset,
+                               .rowCount = tileRowCount,
+                               .tileSlot = tileSlot,
+                               .transferTimelineValue = readbackSignalValue,
+                               .submitMicroseconds = tileSubmitMicroseconds});
+    submittedTileCount += 1;
+  }
+
+  while (!pendingTileList.empty()) {
+    finishPendingTile();
+  }
+
+  vkUnmapMemory(deviceHandle, resultDeviceMemoryHandle);
+
+#if defined(HEATMAP_ENABLED)
+  // =========================================================================
+  // Heatmap Readback
+
+  beginTraceSection(deviceTraceSection, "Heatmap Readback");
+
+  VkDeviceSize heatmapBufferSize = (VkDeviceSize)800 * 600 * 4 *
+                                   sizeof(uint32_t);
+
+  VkBufferCreateInfo heatmapBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = heatmapBufferSize,
+      .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = 1,
+      .pQueueFamilyIndices = &queueFamilyIndex};
+
+  VkBuffer heatmapBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &heatmapBufferCreateInfo, NULL,
+                          &heatmapBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements heatmapMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, heatmapBufferHandle,
+                                &heatmapMemoryRequirements);
+
+  uint32_t heatmapMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+    if ((heatmapMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) ==
+            (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+
+      heatmapMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo heatmapMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = NULL,
+      .allocationSize = heatmapMemoryRequirements.size,
+      .memoryTypeIndex = heatmapMemoryTypeIndex};
+
+  VkDeviceMemory heatmapDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Readback",
+                                &heatmapMemoryAllocateInfo,
+                                &heatmapDeviceMemoryHandle);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(deviceHandle, heatmapBufferHandle,
+                              heatmapDeviceMemoryHandle, 0);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
   }
 
-  vkCmdBindPipeline(commandBufferHandleList[0],
-                    VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
-                    rayTracingPipelineHandle);
+  VkCommandBufferBeginInfo heatmapCommandBufferBeginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .pNext = NULL,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+      .pInheritanceInfo = NULL};
 
-  vkCmdBindDescriptorSets(
-      commandBufferHandleList[0], VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
-      pipelineLayoutHandle, 0, (uint32_t)descriptorSetHandleList.size(),
-      descriptorSetHandleList.data(), 0, NULL);
+  result = vkBeginCommandBuffer(commandBufferHandleList.back(),
+                                &heatmapCommandBufferBeginInfo);
 
-  pvkCmdTraceRaysKHR(commandBufferHandleList[0], &rgenShaderBindingTable,
-                     &rmissShaderBindingTable, &rchitShaderBindingTable,
-                     &callableShaderBindingTable,
-                     800, 600, 1);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+  }
 
-  VkImageMemoryBarrier rayTraceCopyMemoryBarrier = {
-      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+  VkMemoryBarrier heatmapTraceMemoryBarrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
       .pNext = NULL,
-      .srcAccessMask = 0,
-      .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
-      .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
-      .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-      .srcQueueFamilyIndex = queueFamilyIndex,
-      .dstQueueFamilyIndex = queueFamilyIndex,
-      .image = rayTraceImageHandle,
-      .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                           .baseMipLevel = 0,
-                           .levelCount = 1,
-                           .baseArrayLayer = 0,
-                           .layerCount = 1}};
+      .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT};
 
-  vkCmdPipelineBarrier(commandBufferHandleList[0],
-                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0,
-                       NULL, 1, &rayTraceCopyMemoryBarrier);
+  vkCmdPipelineBarrier(commandBufferHandleList.back(),
+                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+                       &heatmapTraceMemoryBarrier, 0, NULL, 0, NULL);
 
-  VkBufferImageCopy imageCopy = {
+  VkBufferImageCopy heatmapImageCopy = {
       .bufferOffset = 0,
       .bufferRowLength = 0,
       .bufferImageHeight = 0,
@@ -2439,91 +7888,149 @@ int main() {
                            .mipLevel = 0,
                            .baseArrayLayer = 0,
                            .layerCount = 1},
-      .imageOffset = 0,
-      .imageExtent = {.width = 800,
-                      .height = 600,
-                      .depth = 1}};
-
-  vkCmdCopyImageToBuffer(commandBufferHandleList[0], rayTraceImageHandle,
-                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                         resultBufferHandle,
-                         1, &imageCopy);
-
-  result = vkEndCommandBuffer(commandBufferHandleList[0]);
-
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
-  }
-
-  // =========================================================================
-  // Fence
+      .imageOffset = {.x = 0, .y = 0, .z = 0},
+      .imageExtent = {.width = 800, .height = 600, .depth = 1}};
 
-  VkFence imageAvailableFenceHandle;
+  vkCmdCopyImageToBuffer(commandBufferHandleList.back(), heatmapImageHandle,
+                         VK_IMAGE_LAYOUT_GENERAL, heatmapBufferHandle, 1,
+                         &heatmapImageCopy);
 
-  VkFenceCreateInfo imageAvailableFenceCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+  VkMemoryBarrier heatmapReadbackMemoryBarrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
       .pNext = NULL,
-      .flags = 0};
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_HOST_READ_BIT};
+
+  vkCmdPipelineBarrier(commandBufferHandleList.back(),
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1,
+                       &heatmapReadbackMemoryBarrier, 0, NULL, 0, NULL);
 
-  result = vkCreateFence(deviceHandle, &imageAvailableFenceCreateInfo, NULL,
-                         &imageAvailableFenceHandle);
+  result = vkEndCommandBuffer(commandBufferHandleList.back());
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateFence");
+    throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
   }
 
-  // =========================================================================
-  // Submit Command Buffer
-
-  VkPipelineStageFlags pipelineStageFlags =
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-
-  VkSubmitInfo submitInfo = {
+  VkSubmitInfo heatmapSubmitInfo = {
       .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
       .pNext = NULL,
       .waitSemaphoreCount = 0,
       .pWaitSemaphores = NULL,
-      .pWaitDstStageMask = &pipelineStageFlags,
+      .pWaitDstStageMask = NULL,
       .commandBufferCount = 1,
-      .pCommandBuffers = &commandBufferHandleList[0],
+      .pCommandBuffers = &commandBufferHandleList.back(),
       .signalSemaphoreCount = 0,
       .pSignalSemaphores = NULL};
 
-  result = vkQueueSubmit(queueHandle, 1, &submitInfo,
-                         imageAvailableFenceHandle);
+  result = vkResetFences(
+      deviceHandle, 1,
+      &rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkResetFences");
+  }
+
+  result = vkQueueSubmit(
+      queueHandle, 1, &heatmapSubmitInfo,
+      rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkQueueSubmit");
   }
 
-  // =========================================================================
-  // Read Image From Buffer
-
-  vkWaitForFences(deviceHandle, 1, &imageAvailableFenceHandle, VK_TRUE, 0);
+  result = vkWaitForFences(
+      deviceHandle, 1,
+      &rayTraceImageBarrierAccelerationStructureBuildFenceHandle, true,
+      UINT32_MAX);
 
-  void *hostResultMemoryBuffer;
-  result = vkMapMemory(deviceHandle, resultDeviceMemoryHandle, 0,
-                       rayTraceImageMemoryRequirements.size, 0,
-                       &hostResultMemoryBuffer);
+  if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+    throwExceptionVulkanAPI(result, "vkWaitForFences");
+  }
 
-  stbi_write_png("result.png", 800, 600, 4, hostResultMemoryBuffer, 4 * 800);
+  void *hostHeatmapMemoryBuffer;
+  result = vkMapMemory(deviceHandle, heatmapDeviceMemoryHandle, 0,
+                       heatmapBufferSize, 0, &hostHeatmapMemoryBuffer);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkMapMemory");
   }
 
-  vkUnmapMemory(deviceHandle, resultDeviceMemoryHandle);
+  // Devices own disjoint rows, so no lock is needed to merge them
+  for (PendingTile &finishedTile : finishedTileList) {
+    size_t heatmapRowOffset = (size_t)finishedTile.rowOffset * 800 * 4;
+    memcpy(hostHeatmapBuffer.data() + heatmapRowOffset,
+           (uint32_t *)hostHeatmapMemoryBuffer + heatmapRowOffset,
+           (size_t)finishedTile.rowCount * 800 * 4 * sizeof(uint32_t));
+  }
+
+  vkUnmapMemory(deviceHandle, heatmapDeviceMemoryHandle);
+#endif
+
+  double renderSeconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - renderStartTime)
+                             .count();
+
+  {
+    std::lock_guard<std::mutex> tileSchedulerLock(tileScheduler.mutex);
+    std::cout << physicalDeviceProperties.deviceName << ": "
+              << renderedRowCount << " rows in " << renderedTileCount
+              << " tiles, "
+              << renderedRowCount / std::max(renderSeconds, 1e-6)
+              << " rows/s" << std::endl;
+
+    printTimestampStatistics(
+        std::string(physicalDeviceProperties.deviceName) + ": trace",
+        traceTimestampStatistics);
+    printTimestampStatistics(
+        std::string(physicalDeviceProperties.deviceName) + ": readback",
+        readbackTimestampStatistics);
+
+#if defined(BLAS_CLUSTERING_ENABLED)
+    if (singleTraceRowCount > 0 && clusterTraceRowCount > 0) {
+      double singleRowMilliseconds =
+          singleTraceMilliseconds / singleTraceRowCount;
+      double clusterRowMilliseconds =
+          clusterTraceMilliseconds / clusterTraceRowCount;
+
+      std::cout << physicalDeviceProperties.deviceName
+                << ": trace per row, single bottom level: "
+                << singleRowMilliseconds << " ms, " << scene.clusterCount
+                << " clusters: " << clusterRowMilliseconds << " ms ("
+                << 100.0 * (clusterRowMilliseconds / singleRowMilliseconds -
+                            1.0)
+                << "%)" << std::endl;
+    }
+#endif
+
+#if defined(RAY_COUNTERS_ENABLED)
+    for (uint32_t x = 0; x < rayTypeNameList.size(); x++) {
+      printRayThroughput(std::string(physicalDeviceProperties.deviceName) +
+                             ": " + rayTypeNameList[x],
+                         ((uint32_t *)hostRayCounterMemoryBuffer)[x],
+                         totalTraceMilliseconds);
+    }
+#endif
+  }
 
   // =========================================================================
   // Cleanup
 
+  beginTraceSection(deviceTraceSection, "Cleanup");
+
   result = vkDeviceWaitIdle(deviceHandle);
+#if defined(RAY_COUNTERS_ENABLED)
+  vkUnmapMemory(deviceHandle, rayCounterDeviceMemoryHandle);
+  vkFreeMemory(deviceHandle, rayCounterDeviceMemoryHandle, NULL);
+  vkDestroyBuffer(deviceHandle, rayCounterBufferHandle, NULL);
+#endif
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkDeviceWaitIdle");
   }
 
-  vkDestroyFence(deviceHandle, imageAvailableFenceHandle, NULL);
+  vkDestroySemaphore(deviceHandle, transferTimelineSemaphoreHandle, NULL);
+  vkDestroySemaphore(deviceHandle, renderTimelineSemaphoreHandle, NULL);
 
   delete[] shaderHandleBuffer;
   vkFreeMemory(deviceHandle, shaderBindingTableDeviceMemoryHandle, NULL);
@@ -2537,6 +8044,14 @@ int main() {
   vkFreeMemory(deviceHandle, resultDeviceMemoryHandle, NULL);
   vkDestroyBuffer(deviceHandle, resultBufferHandle, NULL);
 
+#if defined(HEATMAP_ENABLED)
+  vkFreeMemory(deviceHandle, heatmapDeviceMemoryHandle, NULL);
+  vkDestroyBuffer(deviceHandle, heatmapBufferHandle, NULL);
+  vkDestroyImageView(deviceHandle, heatmapImageViewHandle, NULL);
+  vkFreeMemory(deviceHandle, heatmapImageDeviceMemoryHandle, NULL);
+  vkDestroyImage(deviceHandle, heatmapImageHandle, NULL);
+#endif
+
   vkDestroyFence(deviceHandle,
                  rayTraceImageBarrierAccelerationStructureBuildFenceHandle,
                  NULL);
@@ -2549,6 +8064,11 @@ int main() {
   vkDestroyFence(deviceHandle, topLevelAccelerationStructureBuildFenceHandle,
                  NULL);
 
+#if defined(BLAS_CLUSTERING_ENABLED)
+  pvkDestroyAccelerationStructureKHR(
+      deviceHandle, clusterTopLevelAccelerationStructureHandle, NULL);
+#endif
+
   vkFreeMemory(deviceHandle,
                topLevelAccelerationStructureDeviceScratchMemoryHandle, NULL);
 
@@ -2568,9 +8088,33 @@ int main() {
                NULL);
 
   vkDestroyBuffer(deviceHandle, bottomLevelGeometryInstanceBufferHandle, NULL);
+
+#if defined(BLAS_CLUSTERING_ENABLED)
+  vkDestroyFence(deviceHandle, clusterAccelerationStructureBuildFenceHandle,
+                 NULL);
+  vkFreeMemory(deviceHandle, clusterScratchDeviceMemoryHandle, NULL);
+  vkDestroyBuffer(deviceHandle, clusterScratchBufferHandle, NULL);
+
+  for (VkAccelerationStructureKHR clusterAccelerationStructureHandle :
+       clusterAccelerationStructureHandleList) {
+    pvkDestroyAccelerationStructureKHR(
+        deviceHandle, clusterAccelerationStructureHandle, NULL);
+  }
+
+  vkFreeMemory(deviceHandle, clusterAccelerationStructureDeviceMemoryHandle,
+               NULL);
+  vkDestroyBuffer(deviceHandle, clusterAccelerationStructureBufferHandle,
+                  NULL);
+#endif
+
   vkDestroyFence(deviceHandle, bottomLevelAccelerationStructureBuildFenceHandle,
                  NULL);
 
+#if defined(ACCELERATION_STRUCTURE_COMMANDS_ENABLED)
+  vkDestroyQueryPool(deviceHandle, compactedSizeQueryPoolHandle, NULL);
+  vkDestroyFence(deviceHandle, accelerationStructureCommandFenceHandle, NULL);
+#endif
+
   vkFreeMemory(deviceHandle,
                bottomLevelAccelerationStructureDeviceScratchMemoryHandle, NULL);
 
@@ -2590,6 +8134,8 @@ int main() {
   vkDestroyBuffer(deviceHandle, indexBufferHandle, NULL);
   vkFreeMemory(deviceHandle, vertexDeviceMemoryHandle, NULL);
   vkDestroyBuffer(deviceHandle, vertexBufferHandle, NULL);
+  vkFreeMemory(deviceHandle, sceneStagingDeviceMemoryHandle, NULL);
+  vkDestroyBuffer(deviceHandle, sceneStagingBufferHandle, NULL);
   vkDestroyPipeline(deviceHandle, rayTracingPipelineHandle, NULL);
   vkDestroyShaderModule(deviceHandle, rayMissShadowShaderModuleHandle, NULL);
   vkDestroyShaderModule(deviceHandle, rayMissShaderModuleHandle, NULL);
@@ -2602,9 +8148,370 @@ int main() {
   vkDestroyDescriptorSetLayout(deviceHandle, descriptorSetLayoutHandle, NULL);
   vkDestroyDescriptorPool(deviceHandle, descriptorPoolHandle, NULL);
 
+  vkDestroyQueryPool(deviceHandle, transferTimestampQueryPoolHandle, NULL);
+  vkDestroyQueryPool(deviceHandle, timestampQueryPoolHandle, NULL);
+
+  vkDestroyCommandPool(deviceHandle, transferCommandPoolHandle, NULL);
   vkDestroyCommandPool(deviceHandle, commandPoolHandle, NULL);
   vkDestroyDevice(deviceHandle, NULL);
+
+  endTraceSection(deviceTraceSection);
+}
+
+int main() {
+  VkResult result;
+
+  TraceSection mainTraceSection = {.trackIndex = addTraceTrack("Main thread")};
+
+  // =========================================================================
+  // Vulkan Instance
+
+  beginTraceSection(mainTraceSection, "Vulkan Instance");
+
+  VkDebugUtilsMessengerCreateInfoEXT *debugUtilsMessengerCreateInfoPtr = NULL;
+
+#if defined(VALIDATION_ENABLED)
+  std::vector<VkValidationFeatureEnableEXT> validationFeatureEnableList = {
+      // VK_VALIDATION_FEATURE_ENABLE_BEST_PRACTICES_EXT,
+      VK_VALIDATION_FEATURE_ENABLE_DEBUG_PRINTF_EXT,
+      VK_VALIDATION_FEATURE_ENABLE_SYNCHRONIZATION_VALIDATION_EXT};
+
+  VkDebugUtilsMessageSeverityFlagBitsEXT debugUtilsMessageSeverityFlagBits =
+      (VkDebugUtilsMessageSeverityFlagBitsEXT)(
+          // VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+          VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
+          VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+          VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT);
+
+  VkDebugUtilsMessageTypeFlagBitsEXT debugUtilsMessageTypeFlagBits =
+      (VkDebugUtilsMessageTypeFlagBitsEXT)(
+          // VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+          VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+          VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT);
+
+  VkValidationFeaturesEXT validationFeatures = {
+      .sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT,
+      .pNext = NULL,
+      .enabledValidationFeatureCount =
+          (uint32_t)validationFeatureEnableList.size(),
+      .pEnabledValidationFeatures = validationFeatureEnableList.data(),
+      .disabledValidationFeatureCount = 0,
+      .pDisabledValidationFeatures = NULL};
+
+  VkDebugUtilsMessengerCreateInfoEXT debugUtilsMessengerCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
+      .pNext = &validationFeatures,
+      .flags = 0,
+      .messageSeverity =
+          (VkDebugUtilsMessageSeverityFlagsEXT)debugUtilsMessageSeverityFlagBits,
+      .messageType =
+          (VkDebugUtilsMessageTypeFlagsEXT)debugUtilsMessageTypeFlagBits,
+      .pfnUserCallback = &debugCallback,
+      .pUserData = NULL};
+
+  debugUtilsMessengerCreateInfoPtr = &debugUtilsMessengerCreateInfo;
+#endif
+
+  VkApplicationInfo applicationInfo = {
+      .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+      .pNext = NULL,
+      .pApplicationName = "Ray Tracing Pipeline Example",
+      .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+      .pEngineName = "",
+      .engineVersion = VK_MAKE_VERSION(1, 0, 0),
+      .apiVersion = VK_API_VERSION_1_3};
+
+  std::vector<const char *> instanceLayerList = {};
+  std::vector<const char *> instanceExtensionList = {"VK_KHR_get_physical_device_properties2"};
+
+#if defined(VALIDATION_ENABLED)
+  instanceLayerList.push_back("VK_LAYER_KHRONOS_validation");
+  instanceExtensionList.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+#endif
+
+  VkInstanceCreateInfo instanceCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+      .pNext = debugUtilsMessengerCreateInfoPtr,
+      .flags = 0,
+      .pApplicationInfo = &applicationInfo,
+      .enabledLayerCount = (uint32_t)instanceLayerList.size(),
+      .ppEnabledLayerNames = instanceLayerList.data(),
+      .enabledExtensionCount = (uint32_t)instanceExtensionList.size(),
+      .ppEnabledExtensionNames = instanceExtensionList.data(),
+  };
+
+  VkInstance instanceHandle = VK_NULL_HANDLE;
+  result = vkCreateInstance(&instanceCreateInfo, NULL, &instanceHandle);
+
+  // Without a Vulkan driver there are no physical devices, and the image is
+  // rendered on the host
+  if (result == VK_ERROR_INCOMPATIBLE_DRIVER) {
+    std::cout << "No Vulkan driver found" << std::endl;
+  } else if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateInstance");
+  }
+
+  // =========================================================================
+  // Physical Device
+
+  beginTraceSection(mainTraceSection, "Physical Device");
+
+  uint32_t physicalDeviceCount = 0;
+  if (instanceHandle != VK_NULL_HANDLE) {
+    result =
+        vkEnumeratePhysicalDevices(instanceHandle, &physicalDeviceCount, NULL);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkEnumeratePhysicalDevices");
+    }
+  }
+
+  std::vector<VkPhysicalDevice> physicalDeviceHandleList(physicalDeviceCount);
+  if (physicalDeviceCount > 0) {
+    result = vkEnumeratePhysicalDevices(instanceHandle, &physicalDeviceCount,
+                                        physicalDeviceHandleList.data());
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkEnumeratePhysicalDevices");
+    }
+  }
+
+  std::vector<const char *> deviceExtensionList = {
+      "VK_KHR_ray_tracing_pipeline",
+      "VK_KHR_acceleration_structure",
+      "VK_EXT_descriptor_indexing",
+      "VK_KHR_maintenance3",
+      "VK_KHR_buffer_device_address",
+      "VK_KHR_deferred_host_operations"};
+
+  // PHYSICAL_DEVICE_INDEX or PHYSICAL_DEVICE_UUID select a device explicitly,
+  // otherwise the highest scoring capable device is used
+  const char *physicalDeviceIndexString = std::getenv("PHYSICAL_DEVICE_INDEX");
+  std::string physicalDeviceUUIDString =
+      std::getenv("PHYSICAL_DEVICE_UUID") != NULL
+          ? std::getenv("PHYSICAL_DEVICE_UUID")
+          : "";
+
+  physicalDeviceUUIDString.erase(std::remove(physicalDeviceUUIDString.begin(),
+                                             physicalDeviceUUIDString.end(),
+                                             '-'),
+                                 physicalDeviceUUIDString.end());
+  std::transform(physicalDeviceUUIDString.begin(),
+                 physicalDeviceUUIDString.end(),
+                 physicalDeviceUUIDString.begin(), ::tolower);
+
+  bool isPhysicalDeviceOverride =
+      physicalDeviceIndexString != NULL || !physicalDeviceUUIDString.empty();
+
+  // The whole index must parse and name an enumerated device
+  uint32_t physicalDeviceIndex = -1;
+  if (physicalDeviceIndexString != NULL) {
+    const char *physicalDeviceIndexStringEnd =
+        physicalDeviceIndexString + strlen(physicalDeviceIndexString);
+
+    std::from_chars_result fromCharsResult =
+        std::from_chars(physicalDeviceIndexString,
+                        physicalDeviceIndexStringEnd, physicalDeviceIndex);
+
+    if (fromCharsResult.ec != std::errc() ||
+        fromCharsResult.ptr != physicalDeviceIndexStringEnd ||
+        physicalDeviceIndex >= physicalDeviceHandleList.size()) {
+      throw std::runtime_error(
+          "PHYSICAL_DEVICE_INDEX " + std::string(physicalDeviceIndexString) +
+          " out of range (" + std::to_string(physicalDeviceHandleList.size()) +
+          " devices)");
+    }
+  }
+
+  VkPhysicalDevice activePhysicalDeviceHandle = VK_NULL_HANDLE;
+  int64_t activePhysicalDeviceScore = -1;
+
+  std::vector<VkPhysicalDevice> capablePhysicalDeviceHandleList;
+
+  for (uint32_t x = 0; x < physicalDeviceHandleList.size(); x++) {
+    VkPhysicalDeviceProperties candidatePhysicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDeviceHandleList[x],
+                                  &candidatePhysicalDeviceProperties);
+
+    std::string uuidString =
+        getPhysicalDeviceUUIDString(physicalDeviceHandleList[x]);
+    int64_t score =
+        scorePhysicalDevice(physicalDeviceHandleList[x], deviceExtensionList);
+
+    std::cout << "[" << x << "] "
+              << candidatePhysicalDeviceProperties.deviceName << " ("
+              << uuidString << ") score " << score << std::endl;
+
+    if (score >= 0) {
+      capablePhysicalDeviceHandleList.push_back(physicalDeviceHandleList[x]);
+    }
+
+    if (isPhysicalDeviceOverride) {
+      bool isMatch = physicalDeviceIndexString != NULL
+                         ? physicalDeviceIndex == x
+                         : physicalDeviceUUIDString == uuidString;
+
+      if (isMatch && score < 0) {
+        std::cerr << candidatePhysicalDeviceProperties.deviceName
+                  << " is missing a required extension, feature or queue"
+                  << std::endl;
+        throwExceptionVulkanAPI(VK_ERROR_FEATURE_NOT_PRESENT,
+                                "scorePhysicalDevice");
+      }
+
+      if (isMatch) {
+        activePhysicalDeviceHandle = physicalDeviceHandleList[x];
+      }
+    } else if (score > activePhysicalDeviceScore) {
+      activePhysicalDeviceHandle = physicalDeviceHandleList[x];
+      activePhysicalDeviceScore = score;
+    }
+  }
+
+  if (activePhysicalDeviceHandle == VK_NULL_HANDLE &&
+      isPhysicalDeviceOverride) {
+    throwExceptionVulkanAPI(VK_ERROR_INCOMPATIBLE_DRIVER,
+                            "vkEnumeratePhysicalDevices");
+  }
+
+  // HOST_RENDER renders the image on the host instead of a device, as does
+  // having no capable device
+  bool isHostRenderEnabled = std::getenv("HOST_RENDER") != NULL;
+
+  if (activePhysicalDeviceHandle == VK_NULL_HANDLE && !isHostRenderEnabled) {
+    std::cout << "No capable physical device, rendering on the host"
+              << std::endl;
+    isHostRenderEnabled = true;
+  }
+
+  // MULTI_DEVICE renders on every capable device, each one claiming row
+  // tiles from a shared scheduler as it finishes the previous tile
+  std::vector<VkPhysicalDevice> renderPhysicalDeviceHandleList = {
+      activePhysicalDeviceHandle};
+
+  if (std::getenv("MULTI_DEVICE") != NULL && !isPhysicalDeviceOverride) {
+    renderPhysicalDeviceHandleList = capablePhysicalDeviceHandleList;
+  }
+
+  if (isHostRenderEnabled) {
+    renderPhysicalDeviceHandleList.clear();
+  }
+
+  // =========================================================================
+  // Scene
+
+  beginTraceSection(mainTraceSection, "Scene");
+
+  // Loaded on its own thread while the render devices are created. Each
+  // device uploads ranges of the scene as they are parsed.
+  Scene scene;
+  std::exception_ptr sceneLoadException;
+  std::thread sceneLoadThread([&]() {
+    TraceSection sceneTraceSection = {.trackIndex =
+                                          addTraceTrack("Scene loader")};
+    beginTraceSection(sceneTraceSection, "Load Scene");
+
+    try {
+      loadScene("resources/cube_scene.obj", scene);
+    } catch (...) {
+      sceneLoadException = std::current_exception();
+      failSceneLoad(scene);
+    }
+
+    endTraceSection(sceneTraceSection);
+  });
+
+  // =========================================================================
+  // Render Devices
+
+  beginTraceSection(mainTraceSection, "Render Devices");
+
+  TileScheduler tileScheduler;
+  tileScheduler.rowCount = 600;
+
+  // Image transfer granularities are powers of two, so the largest is a
+  // multiple of every render device's
+  for (VkPhysicalDevice renderPhysicalDeviceHandle :
+       renderPhysicalDeviceHandleList) {
+    uint32_t tileRowAlignment = 1;
+    findTransferQueueFamilyIndex(renderPhysicalDeviceHandle, tileRowAlignment);
+
+    tileScheduler.rowAlignment =
+        std::max(tileScheduler.rowAlignment, tileRowAlignment);
+  }
+
+  std::vector<uint8_t> hostImageBuffer(800 * 600 * 4);
+
+#if defined(HEATMAP_ENABLED)
+  // One RGBA32UI texel per pixel
+  std::vector<uint32_t> hostHeatmapBuffer(800 * 600 * 4);
+#endif
+
+  std::vector<std::thread> renderThreadList;
+  std::vector<std::exception_ptr> renderExceptionList(
+      renderPhysicalDeviceHandleList.size());
+
+  for (uint32_t x = 0; x < renderPhysicalDeviceHandleList.size(); x++) {
+    renderThreadList.emplace_back([&, x]() {
+      try {
+        renderTiles(renderPhysicalDeviceHandleList[x], deviceExtensionList,
+                    scene, tileScheduler,
+#if defined(HEATMAP_ENABLED)
+                    hostHeatmapBuffer,
+#endif
+                    hostImageBuffer);
+      } catch (...) {
+        renderExceptionList[x] = std::current_exception();
+      }
+    });
+  }
+
+  for (std::thread &renderThread : renderThreadList) {
+    renderThread.join();
+  }
+
+  sceneLoadThread.join();
+
+  // Render threads waiting on a scene that failed to load throw as well, the
+  // load error is the one to report
+  if (sceneLoadException) {
+    std::rethrow_exception(sceneLoadException);
+  }
+
+  for (std::exception_ptr &renderException : renderExceptionList) {
+    if (renderException) {
+      std::rethrow_exception(renderException);
+    }
+  }
+
+  if (isHostRenderEnabled) {
+    renderTilesOnHost(scene, tileScheduler, hostImageBuffer);
+  }
+
+  // =========================================================================
+  // Write Image
+
+  beginTraceSection(mainTraceSection, "Write Image");
+
+  stbi_write_png("result.png", 800, 600, 4, hostImageBuffer.data(), 4 * 800);
+
+#if defined(HEATMAP_ENABLED)
+  for (uint32_t x = 0; x < heatmapNameList.size(); x++) {
+    writeHeatmapImage(hostHeatmapBuffer.data(), x, 800, 600);
+  }
+#endif
+
+  // =========================================================================
+  // Cleanup
+
+  beginTraceSection(mainTraceSection, "Cleanup");
+
+  unloadScene(scene);
+
   vkDestroyInstance(instanceHandle, NULL);
 
+  endTraceSection(mainTraceSection);
+  writeTraceFile();
+
   return 0;
 }
@@ -1,21 +1,120 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
+#if defined(HEATMAP_ENABLED)
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#endif
+
 #include <vulkan/vulkan.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #if defined(PLATFORM_LINUX)
 #include <X11/Xlib.h>
 #include <X11/keysym.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vulkan/vulkan_xlib.h>
 #elif defined(PLATFORM_WINDOWS)
 #include <windows.h>
 #include <vulkan/vulkan_win32.h>
 #endif
 
+// Accumulated frames after which an idle camera stops rendering and the loop
+// sleeps until the next input event
+#define CONVERGED_FRAME_COUNT 4096
+
+// Camera speed in units and radians per second
+#define CAMERA_MOVE_SPEED 1.5f
+#define CAMERA_TURN_SPEED 0.75f
+
+// Frames the host may record ahead of the device, each with its own uniform
+// slice, command buffer and fence. Independent of the swapchain image count.
+#if !defined(FRAMES_IN_FLIGHT)
+#define FRAMES_IN_FLIGHT 2
+#endif
+
+// Frames kept for the rolling device timing statistics, which are printed
+// each time the window fills
+#define TIMESTAMP_WINDOW_SIZE 256
+
+// Trace events kept for TRACE_FILE, later events are dropped
+#define TRACE_EVENT_LIMIT 1000000
+
+// Ray trace resolution relative to the swapchain extent. Accumulation happens
+// at this resolution and is scaled to the window when presenting.
+#if !defined(RENDER_SCALE)
+#define RENDER_SCALE 1.0f
+#endif
+
+// When defined, the trace is timed with device timestamps and the render
+// extent shrinks within the ray trace image whenever the trace exceeds this
+// budget, growing back once there is headroom
+#if defined(TARGET_FRAME_TIME_MS)
+#define MIN_DYNAMIC_RESOLUTION_SCALE 0.25f
+#endif
+
+// With RESIDENCY_ENABLED, device memory for the bottom level acceleration
+// structures of resident clusters, and the most clusters paged in or evicted
+// before each top level rebuild
+#if !defined(RESIDENCY_BUDGET_MEBIBYTES)
+#define RESIDENCY_BUDGET_MEBIBYTES 256
+#endif
+#if !defined(RESIDENCY_BUILDS_PER_UPDATE)
+#define RESIDENCY_BUILDS_PER_UPDATE 16
+#endif
+
+// Clusters entirely behind the camera rank as if this many times farther
+#define RESIDENCY_BEHIND_CAMERA_SCALE 4.0f
+
+// Set in the custom index of a cluster instance traced as its proxy box,
+// matches the closest hit shader
+#define RESIDENCY_PROXY_BIT 0x800000
+
+// The only instance mask bit of proxy boxes, left out of the shadow ray cull
+// mask in the closest hit shader
+#define RESIDENCY_PROXY_MASK 0x02
+
+// With LOD_ENABLED, levels of detail per cluster including the cluster itself,
+// and the most pixels a simplified level's grid cell may project to before a
+// finer level is selected
+#if !defined(LOD_COUNT)
+#define LOD_COUNT 4
+#endif
+#if !defined(LOD_PIXEL_ERROR)
+#define LOD_PIXEL_ERROR 1.0f
+#endif
+
+// Grid cells across a cluster's bounds that the first simplified level snaps
+// its vertices to, halved by each further level
+#define LOD_GRID_RESOLUTION 64
+
+#if defined(LOD_ENABLED) && defined(RESIDENCY_ENABLED)
+#error "LOD_ENABLED and RESIDENCY_ENABLED cannot be combined"
+#endif
+
 #if defined(VALIDATION_ENABLED)
 #define STRING_RESET "\033[0m"
 #define STRING_INFO "\033[37m"
@@ -58,2643 +157,7600 @@ void throwExceptionVulkanAPI(VkResult result, const std::string &functionName) {
   throw std::runtime_error(message);
 }
 
-bool exitWindow = false;
-static bool isMoveForward = false, isMoveBack = false;
-static bool isTurnLeft = false, isTurnRight = false;
-
-#if defined(PLATFORM_WINDOWS)
-LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
-{
-  if (uMsg == WM_KEYDOWN) {
-    switch (wParam) {
-    case VK_UP:
-      isMoveForward = true;
-      break;
-    case VK_DOWN:
-      isMoveBack = true;
-      break;
-    case VK_LEFT:
-      isTurnLeft = true;
-      break;
-    case VK_RIGHT:
-      isTurnRight = true;
-      break;
-    case VK_ESCAPE:
-      exitWindow = true;
-      break;
-    default:
-      break;
-    }
-  }
-  else if (uMsg == WM_KEYUP) {
-    switch (wParam) {
-    case VK_UP:
-      isMoveForward = false;
-      break;
-    case VK_DOWN:
-      isMoveBack = false;
-      break;
-    case VK_LEFT:
-      isTurnLeft = false;
-      break;
-    case VK_RIGHT:
-      isTurnRight = false;
-      break;
-    default:
-      break;
-    }
-  } else if (uMsg == WM_CLOSE) {
-    exitWindow = true;
+// Rolling window of device timings, reported as min, average and 99th
+// percentile in milliseconds
+struct TimestampStatistics {
+  std::vector<double> millisecondsList;
+  uint32_t nextIndex = 0;
+};
+
+void addTimestampSample(TimestampStatistics &timestampStatistics,
+                        double milliseconds) {
+  if (timestampStatistics.millisecondsList.size() < TIMESTAMP_WINDOW_SIZE) {
+    timestampStatistics.millisecondsList.push_back(milliseconds);
+  } else {
+    timestampStatistics.millisecondsList[timestampStatistics.nextIndex] =
+        milliseconds;
   }
 
-  return (DefWindowProc(hWnd, uMsg, wParam, lParam));
+  timestampStatistics.nextIndex =
+      (timestampStatistics.nextIndex + 1) % TIMESTAMP_WINDOW_SIZE;
 }
 
-_Use_decl_annotations_ int APIENTRY WinMain(HINSTANCE hInstance,
-                                            HINSTANCE hPrevInstance,
-                                            LPSTR pCmdLine,
-                                            int nCmdShow) {
-#else
-void handleEvent(Display *displayPtr, XEvent *eventPtr) {
-  if (eventPtr->type == KeyPress) {
-    int keySymCount = 0;
-    KeySym *keySym = XGetKeyboardMapping(displayPtr, eventPtr->xkey.keycode, 1,
-                                         &keySymCount);
-    switch (*keySym) {
-    case XK_Up:
-      isMoveForward = true;
-      break;
-    case XK_Down:
-      isMoveBack = true;
-      break;
-    case XK_Left:
-      isTurnLeft = true;
-      break;
-    case XK_Right:
-      isTurnRight = true;
-      break;
-    case XK_Escape:
-      exitWindow = true;
-      break;
-    default:
-      break;
-    }
-
-    free(keySym);
+void printTimestampStatistics(const std::string &name,
+                              const TimestampStatistics &timestampStatistics) {
+  if (timestampStatistics.millisecondsList.empty()) {
+    return;
   }
-  else if (eventPtr->type == KeyRelease) {
-    int keySymCount = 0;
-    KeySym *keySym = XGetKeyboardMapping(displayPtr, eventPtr->xkey.keycode, 1,
-                                         &keySymCount);
 
-    switch (*keySym) {
-    case XK_Up:
-      isMoveForward = false;
-      break;
-    case XK_Down:
-      isMoveBack = false;
-      break;
-    case XK_Left:
-      isTurnLeft = false;
-      break;
-    case XK_Right:
-      isTurnRight = false;
-      break;
-    default:
-      break;
-    }
+  std::vector<double> sortedMillisecondsList =
+      timestampStatistics.millisecondsList;
+  std::sort(sortedMillisecondsList.begin(), sortedMillisecondsList.end());
 
-    free(keySym);
+  double totalMilliseconds = 0.0;
+  for (double milliseconds : sortedMillisecondsList) {
+    totalMilliseconds += milliseconds;
   }
+
+  size_t percentileIndex = std::min(sortedMillisecondsList.size() - 1,
+                                    sortedMillisecondsList.size() * 99 / 100);
+
+  std::cout << name << ": min " << sortedMillisecondsList.front()
+            << " ms, avg " << totalMilliseconds / sortedMillisecondsList.size()
+            << " ms, p99 " << sortedMillisecondsList[percentileIndex] << " ms"
+            << std::endl;
 }
 
-int main() {
-#endif
-  VkResult result;
+// Chrome trace events, collected when TRACE_FILE is set and written to that
+// path on exit for loading into Perfetto or chrome://tracing. Times are in
+// microseconds since startup, each track shows as one thread.
+struct TraceEvent {
+  std::string name;
+  uint32_t trackIndex;
+  double startMicroseconds;
+  double durationMicroseconds;
+};
+
+struct TraceRecorder {
+  const char *filePath = getenv("TRACE_FILE");
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+  std::vector<std::string> trackNameList;
+  std::vector<double> trackEndMicrosecondsList;
+  std::vector<TraceEvent> eventList;
+};
+
+static TraceRecorder traceRecorder;
+
+double getTraceMicroseconds() {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - traceRecorder.startTimePoint)
+      .count();
+}
 
-  // =========================================================================
-  // Window
+uint32_t addTraceTrack(const std::string &name) {
+  traceRecorder.trackNameList.push_back(name);
+  traceRecorder.trackEndMicrosecondsList.push_back(0.0);
+  return (uint32_t)traceRecorder.trackNameList.size() - 1;
+}
 
-#if defined(PLATFORM_LINUX)
-  Display *displayPtr = XOpenDisplay(NULL);
-  int screen = DefaultScreen(displayPtr);
+void addTraceEvent(const std::string &name, uint32_t trackIndex,
+                   double startMicroseconds, double durationMicroseconds) {
+  if (traceRecorder.filePath == NULL) {
+    return;
+  }
 
-  Window windowLinux = XCreateSimpleWindow(
-      displayPtr, RootWindow(displayPtr, screen), 10, 10, 100, 100, 1,
-      BlackPixel(displayPtr, screen), WhitePixel(displayPtr, screen));
+  if (traceRecorder.eventList.size() < TRACE_EVENT_LIMIT) {
+    traceRecorder.eventList.push_back({.name = name,
+                                       .trackIndex = trackIndex,
+                                       .startMicroseconds = startMicroseconds,
+                                       .durationMicroseconds =
+                                           durationMicroseconds});
+  }
+}
 
-  XSelectInput(displayPtr, windowLinux, ExposureMask | KeyPressMask |
-                                        KeyReleaseMask);
-  XMapWindow(displayPtr, windowLinux);
-#elif defined(PLATFORM_WINDOWS)
-  WNDCLASS wc = {
-    .lpfnWndProc = WindowProc,
-    .hInstance = hInstance,
-    .lpszClassName = "WINDOW_CLASS"};
+// Device timestamps share no clock with the host, so device work is placed
+// at its submission time, or after the previous work on the same queue track
+void addQueueTraceEvent(const std::string &name, uint32_t trackIndex,
+                        double submitMicroseconds,
+                        double durationMicroseconds) {
+  double startMicroseconds = 0.0;
+  {
+    double &trackEndMicroseconds =
+        traceRecorder.trackEndMicrosecondsList[trackIndex];
+
+    startMicroseconds = std::max(submitMicroseconds, trackEndMicroseconds);
+    trackEndMicroseconds = startMicroseconds + durationMicroseconds;
+  }
 
-  if (!RegisterClass(&wc)) {
-    throwExceptionVulkanAPI((VkResult)0, "RegisterClass");
+  addTraceEvent(name, trackIndex, startMicroseconds, durationMicroseconds);
+}
+
+// Consecutive sections of one function on one track, beginning a section
+// ends the one before it
+struct TraceSection {
+  uint32_t trackIndex = 0;
+  std::string name;
+  double startMicroseconds = 0.0;
+};
+
+void endTraceSection(TraceSection &traceSection) {
+  if (traceSection.name.empty()) {
+    return;
   }
 
-  HWND windowWindows = CreateWindowEx(
-      0,
-      "WINDOW_CLASS",
-      "Triangle",
-      WS_OVERLAPPEDWINDOW | WS_CLIPSIBLINGS | WS_CLIPCHILDREN,
-      0, 0, 800, 600,
-      NULL,
-      NULL,
-      hInstance,
-      NULL);
+  addTraceEvent(traceSection.name, traceSection.trackIndex,
+                traceSection.startMicroseconds,
+                getTraceMicroseconds() - traceSection.startMicroseconds);
+  traceSection.name.clear();
+}
 
-  if (!windowWindows) {
-    throwExceptionVulkanAPI((VkResult)0, "CreateWindowEx");
+void beginTraceSection(TraceSection &traceSection, const std::string &name) {
+  if (traceRecorder.filePath == NULL) {
+    return;
   }
 
-  ShowWindow(windowWindows, SW_SHOW);
-  SetForegroundWindow(windowWindows);
-  SetFocus(windowWindows);
-#endif
+  endTraceSection(traceSection);
+  traceSection.name = name;
+  traceSection.startMicroseconds = getTraceMicroseconds();
+}
 
-  // =========================================================================
-  // Vulkan Instance
+// Escapes quotes, backslashes and control characters, such as in device
+// names, for a JSON string
+std::string getJSONString(const std::string &value) {
+  std::string jsonString;
+  for (char character : value) {
+    if (character == '"' || character == '\\') {
+      jsonString += '\\';
+      jsonString += character;
+    } else if ((unsigned char)character < 0x20) {
+      char escapeString[7];
+      snprintf(escapeString, sizeof(escapeString), "\\u%04x",
+               (unsigned char)character);
+      jsonString += escapeString;
+    } else {
+      jsonString += character;
+    }
+  }
 
-  VkDebugUtilsMessengerCreateInfoEXT *debugUtilsMessengerCreateInfoPtr = NULL;
+  return jsonString;
+}
 
-#if defined(VALIDATION_ENABLED)
-  std::vector<VkValidationFeatureEnableEXT> validationFeatureEnableList = {
-      // VK_VALIDATION_FEATURE_ENABLE_BEST_PRACTICES_EXT,
-      VK_VALIDATION_FEATURE_ENABLE_DEBUG_PRINTF_EXT,
-      VK_VALIDATION_FEATURE_ENABLE_SYNCHRONIZATION_VALIDATION_EXT};
+// Times are written in microseconds with fixed nanosecond precision, so long
+// sessions keep their spans apart
+void writeTraceFile() {
+  if (traceRecorder.filePath == NULL) {
+    return;
+  }
 
-  VkDebugUtilsMessageSeverityFlagBitsEXT debugUtilsMessageSeverityFlagBits =
-      (VkDebugUtilsMessageSeverityFlagBitsEXT)(
-          // VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-          VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
-          VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-          VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT);
+  std::ofstream traceFile(traceRecorder.filePath);
+  traceFile << std::fixed << std::setprecision(3);
+  traceFile << "{\"traceEvents\": [\n";
 
-  VkDebugUtilsMessageTypeFlagBitsEXT debugUtilsMessageTypeFlagBits =
-      (VkDebugUtilsMessageTypeFlagBitsEXT)(
-          // VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-          VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-          VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT);
+  for (uint32_t x = 0; x < traceRecorder.trackNameList.size(); x++) {
+    traceFile << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+              << "\"tid\": " << x << ", \"args\": {\"name\": \""
+              << getJSONString(traceRecorder.trackNameList[x]) << "\"}},\n";
+  }
 
-  VkValidationFeaturesEXT validationFeatures = {
-      .sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT,
-      .pNext = NULL,
-      .enabledValidationFeatureCount =
-          (uint32_t)validationFeatureEnableList.size(),
-      .pEnabledValidationFeatures = validationFeatureEnableList.data(),
-      .disabledValidationFeatureCount = 0,
-      .pDisabledValidationFeatures = NULL};
+  for (uint32_t x = 0; x < traceRecorder.eventList.size(); x++) {
+    const TraceEvent &traceEvent = traceRecorder.eventList[x];
+    traceFile << "{\"name\": \"" << getJSONString(traceEvent.name)
+              << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": "
+              << traceEvent.trackIndex
+              << ", \"ts\": " << traceEvent.startMicroseconds
+              << ", \"dur\": " << traceEvent.durationMicroseconds << "}"
+              << (x + 1 < traceRecorder.eventList.size() ? ",\n" : "\n");
+  }
 
-  VkDebugUtilsMessengerCreateInfoEXT debugUtilsMessengerCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
-      .pNext = &validationFeatures,
-      .flags = 0,
-      .messageSeverity =
-          (VkDebugUtilsMessageSeverityFlagsEXT)debugUtilsMessageSeverityFlagBits,
-      .messageType =
-          (VkDebugUtilsMessageTypeFlagsEXT)debugUtilsMessageTypeFlagBits,
-      .pfnUserCallback = &debugCallback,
-      .pUserData = NULL};
+  traceFile << "]}" << std::endl;
+}
 
-  debugUtilsMessengerCreateInfoPtr = &debugUtilsMessengerCreateInfo;
-#endif
+#if defined(RAY_COUNTERS_ENABLED)
+// Order of the counters in the RayCounter block of the shaders
+const std::vector<std::string> rayTypeNameList = {"Primary", "Extension",
+                                                  "Shadow"};
 
-  VkApplicationInfo applicationInfo = {
-      .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-      .pNext = NULL,
-      .pApplicationName = "Ray Tracing Pipeline Example",
-      .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
-      .pEngineName = "",
-      .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-      .apiVersion = VK_API_VERSION_1_3};
+void printRayThroughput(const std::string &name, uint64_t rayCount,
+                        double traceMilliseconds) {
+  if (traceMilliseconds <= 0.0) {
+    return;
+  }
 
-  std::vector<const char *> instanceLayerList = {};
-  std::vector<const char *> instanceExtensionList = {
-#if defined(PLATFORM_LINUX)
-      "VK_KHR_xlib_surface",
-#elif defined(PLATFORM_ANDROID)
-      "VK_KHR_android_surface",
-#elif defined(PLATFORM_WINDOWS)
-      "VK_KHR_win32_surface",
+  std::cout << name << " rays: " << rayCount / (traceMilliseconds * 1000.0)
+            << " Mrays/s" << std::endl;
+}
 #endif
-      "VK_KHR_surface"};
 
-#if defined(VALIDATION_ENABLED)
-  instanceLayerList.push_back("VK_LAYER_KHRONOS_validation");
-  instanceExtensionList.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-#endif
+bool isDeviceExtensionSupported(VkPhysicalDevice physicalDeviceHandle,
+                                const char *extensionName) {
+  uint32_t extensionPropertyCount = 0;
+  VkResult result = vkEnumerateDeviceExtensionProperties(
+      physicalDeviceHandle, NULL, &extensionPropertyCount, NULL);
 
-  VkInstanceCreateInfo instanceCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-      .pNext = debugUtilsMessengerCreateInfoPtr,
-      .flags = 0,
-      .pApplicationInfo = &applicationInfo,
-      .enabledLayerCount = (uint32_t)instanceLayerList.size(),
-      .ppEnabledLayerNames = instanceLayerList.data(),
-      .enabledExtensionCount = (uint32_t)instanceExtensionList.size(),
-      .ppEnabledExtensionNames = instanceExtensionList.data(),
-  };
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEnumerateDeviceExtensionProperties");
+  }
 
-  VkInstance instanceHandle = VK_NULL_HANDLE;
-  result = vkCreateInstance(&instanceCreateInfo, NULL, &instanceHandle);
+  std::vector<VkExtensionProperties> extensionPropertiesList(
+      extensionPropertyCount);
+  result = vkEnumerateDeviceExtensionProperties(
+      physicalDeviceHandle, NULL, &extensionPropertyCount,
+      extensionPropertiesList.data());
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateInstance");
+    throwExceptionVulkanAPI(result, "vkEnumerateDeviceExtensionProperties");
   }
 
-  // =========================================================================
-  // Window Surface
+  for (VkExtensionProperties &extensionProperties : extensionPropertiesList) {
+    if (strcmp(extensionProperties.extensionName, extensionName) == 0) {
+      return true;
+    }
+  }
 
-  VkSurfaceKHR surfaceHandle = VK_NULL_HANDLE;
+  return false;
+}
 
-#if defined(PLATFORM_LINUX)
-  VkXlibSurfaceCreateInfoKHR xlibSurfaceCreateInfo = {
-    .sType = VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR,
-    .pNext = NULL,
-    .flags = 0,
-    .dpy = displayPtr,
-    .window = windowLinux
-  };
+// Device memory allocated by the example, by category. Allocations go through
+// allocateDeviceMemory, and memory released before shutdown goes through
+// freeDeviceMemory so the ledger stays current.
+struct MemoryAllocation {
+  VkDeviceMemory memoryHandle;
+  std::string category;
+  uint32_t heapIndex;
+  VkDeviceSize size;
+};
+
+struct MemoryLedger {
+  VkPhysicalDevice physicalDeviceHandle = VK_NULL_HANDLE;
+  bool isMemoryBudgetSupported = false;
+  std::vector<MemoryAllocation> allocationList;
+};
+
+double getMebibytes(VkDeviceSize size) { return size / (1024.0 * 1024.0); }
+
+VkDeviceSize getLedgerHeapSize(const MemoryLedger &memoryLedger,
+                               uint32_t heapIndex) {
+  VkDeviceSize heapSize = 0;
+  for (const MemoryAllocation &memoryAllocation :
+       memoryLedger.allocationList) {
+    if (memoryAllocation.heapIndex == heapIndex) {
+      heapSize += memoryAllocation.size;
+    }
+  }
 
-  result = vkCreateXlibSurfaceKHR(instanceHandle, &xlibSurfaceCreateInfo, NULL,
-                                  &surfaceHandle);
+  return heapSize;
+}
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateXlibSurfaceKHR");
+// Heap budgets and usage of the whole process from VK_EXT_memory_budget.
+// Without it the budget is the heap size and the usage is the ledger's.
+VkPhysicalDeviceMemoryBudgetPropertiesEXT
+getMemoryBudget(const MemoryLedger &memoryLedger,
+                VkPhysicalDeviceMemoryProperties &memoryProperties) {
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT memoryBudgetProperties = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+      .pNext = NULL};
+
+  VkPhysicalDeviceMemoryProperties2 memoryProperties2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+      .pNext = memoryLedger.isMemoryBudgetSupported ? &memoryBudgetProperties
+                                                    : NULL};
+
+  vkGetPhysicalDeviceMemoryProperties2(memoryLedger.physicalDeviceHandle,
+                                       &memoryProperties2);
+
+  memoryProperties = memoryProperties2.memoryProperties;
+
+  if (!memoryLedger.isMemoryBudgetSupported) {
+    for (uint32_t x = 0; x < memoryProperties.memoryHeapCount; x++) {
+      memoryBudgetProperties.heapBudget[x] =
+          memoryProperties.memoryHeaps[x].size;
+      memoryBudgetProperties.heapUsage[x] = getLedgerHeapSize(memoryLedger, x);
+    }
   }
-#elif defined(PLATFORM_WINDOWS)
-  VkWin32SurfaceCreateInfoKHR windowsSurfaceCreateInfo {
-      .sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR,
-      .pNext = NULL,
-      .flags = 0,
-      .hinstance = hInstance,
-      .hwnd = windowWindows
-  };
 
-  result = vkCreateWin32SurfaceKHR(instanceHandle, &windowsSurfaceCreateInfo,
-                                   NULL, &surfaceHandle);
+  return memoryBudgetProperties;
+}
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateWin32SurfaceKHR");
+void printMemoryReport(const std::string &name,
+                       const MemoryLedger &memoryLedger) {
+  std::cout << name << " memory:" << std::endl;
+
+  std::vector<std::string> categoryList;
+  for (const MemoryAllocation &memoryAllocation :
+       memoryLedger.allocationList) {
+    if (std::find(categoryList.begin(), categoryList.end(),
+                  memoryAllocation.category) == categoryList.end()) {
+      categoryList.push_back(memoryAllocation.category);
+    }
   }
-#endif
 
-  // =========================================================================
-  // Physical Device
+  for (const std::string &category : categoryList) {
+    VkDeviceSize categorySize = 0;
+    uint32_t categoryAllocationCount = 0;
+    for (const MemoryAllocation &memoryAllocation :
+         memoryLedger.allocationList) {
+      if (memoryAllocation.category == category) {
+        categorySize += memoryAllocation.size;
+        categoryAllocationCount += 1;
+      }
+    }
 
-  uint32_t physicalDeviceCount = 0;
-  result =
-      vkEnumeratePhysicalDevices(instanceHandle, &physicalDeviceCount, NULL);
+    std::cout << "  " << category << ": " << getMebibytes(categorySize)
+              << " MiB in " << categoryAllocationCount << " allocations"
+              << std::endl;
+  }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkEnumeratePhysicalDevices");
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT memoryBudgetProperties =
+      getMemoryBudget(memoryLedger, memoryProperties);
+
+  for (uint32_t x = 0; x < memoryProperties.memoryHeapCount; x++) {
+    VkDeviceSize ledgerHeapSize = getLedgerHeapSize(memoryLedger, x);
+    if (ledgerHeapSize == 0) {
+      continue;
+    }
+
+    VkDeviceSize heapBudget = memoryBudgetProperties.heapBudget[x];
+    VkDeviceSize heapUsage = memoryBudgetProperties.heapUsage[x];
+
+    std::cout << "  Heap " << x
+              << ((memoryProperties.memoryHeaps[x].flags &
+                   VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+                      ? " (device local): "
+                      : " (host): ")
+              << getMebibytes(ledgerHeapSize) << " MiB allocated, "
+              << getMebibytes(heapUsage) << " MiB used of "
+              << getMebibytes(heapBudget) << " MiB budget, "
+              << getMebibytes(heapBudget - std::min(heapUsage, heapBudget))
+              << " MiB headroom" << std::endl;
   }
+}
 
-  std::vector<VkPhysicalDevice> physicalDeviceHandleList(physicalDeviceCount);
-  result = vkEnumeratePhysicalDevices(instanceHandle, &physicalDeviceCount,
-                                      physicalDeviceHandleList.data());
+// Warns before an allocation that would exceed its heap's budget, where the
+// driver may start evicting or fail, and prints the report if it does fail
+VkResult allocateDeviceMemory(VkDevice deviceHandle,
+                              MemoryLedger &memoryLedger,
+                              const std::string &category,
+                              const VkMemoryAllocateInfo *memoryAllocateInfoPtr,
+                              VkDeviceMemory *memoryHandlePtr) {
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT memoryBudgetProperties =
+      getMemoryBudget(memoryLedger, memoryProperties);
+
+  uint32_t heapIndex = 0;
+  if (memoryAllocateInfoPtr->memoryTypeIndex <
+      memoryProperties.memoryTypeCount) {
+    heapIndex =
+        memoryProperties.memoryTypes[memoryAllocateInfoPtr->memoryTypeIndex]
+            .heapIndex;
+
+    VkDeviceSize heapBudget = memoryBudgetProperties.heapBudget[heapIndex];
+    VkDeviceSize heapUsage = memoryBudgetProperties.heapUsage[heapIndex];
+
+    if (heapUsage + memoryAllocateInfoPtr->allocationSize > heapBudget) {
+      std::cerr << "Warning: " << category << " allocation of "
+                << getMebibytes(memoryAllocateInfoPtr->allocationSize)
+                << " MiB exceeds the "
+                << getMebibytes(heapBudget - std::min(heapUsage, heapBudget))
+                << " MiB left in the budget of heap " << heapIndex
+                << std::endl;
+    }
+  }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkEnumeratePhysicalDevices");
+  VkResult result = vkAllocateMemory(deviceHandle, memoryAllocateInfoPtr, NULL,
+                                     memoryHandlePtr);
+
+  if (result == VK_SUCCESS) {
+    memoryLedger.allocationList.push_back(
+        {.memoryHandle = *memoryHandlePtr,
+         .category = category,
+         .heapIndex = heapIndex,
+         .size = memoryAllocateInfoPtr->allocationSize});
+  } else if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY ||
+             result == VK_ERROR_OUT_OF_HOST_MEMORY) {
+    printMemoryReport("Out of memory allocating " + category, memoryLedger);
   }
 
-  VkPhysicalDevice activePhysicalDeviceHandle = physicalDeviceHandleList[0];
+  return result;
+}
 
-  VkPhysicalDeviceProperties physicalDeviceProperties;
-  vkGetPhysicalDeviceProperties(activePhysicalDeviceHandle,
-                                &physicalDeviceProperties);
+void freeDeviceMemory(VkDevice deviceHandle, MemoryLedger &memoryLedger,
+                      VkDeviceMemory memoryHandle) {
+  for (uint32_t x = 0; x < memoryLedger.allocationList.size(); x++) {
+    if (memoryLedger.allocationList[x].memoryHandle == memoryHandle) {
+      memoryLedger.allocationList.erase(memoryLedger.allocationList.begin() +
+                                        x);
+      break;
+    }
+  }
 
-  VkPhysicalDeviceRayTracingPipelinePropertiesKHR
-      physicalDeviceRayTracingPipelineProperties = {
-          .sType =
-              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR,
-          .pNext = NULL};
+  vkFreeMemory(deviceHandle, memoryHandle, NULL);
+}
 
-  VkPhysicalDeviceProperties2 physicalDeviceProperties2 = {
-      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
-      .pNext = &physicalDeviceRayTracingPipelineProperties,
-      .properties = physicalDeviceProperties};
+#if defined(HEATMAP_ENABLED)
+// Order of the channels written to heatmapImage by the ray generation shader
+const std::vector<std::string> heatmapNameList = {"bounces", "shadow_rays",
+                                                  "clock"};
+
+// Writes one channel of an RGBA32UI heatmap as heatmap_<name>.png, colored
+// from blue at zero through green to red at the channel's maximum. Channels
+// that are zero everywhere, such as the clock without VK_KHR_shader_clock,
+// are skipped.
+void writeHeatmapImage(const uint32_t *heatmapBuffer, uint32_t channel,
+                       uint32_t width, uint32_t height) {
+  uint32_t maxValue = 0;
+  for (uint32_t x = 0; x < width * height; x++) {
+    maxValue = std::max(maxValue, heatmapBuffer[x * 4 + channel]);
+  }
 
-  vkGetPhysicalDeviceProperties2(activePhysicalDeviceHandle,
-                                 &physicalDeviceProperties2);
+  if (maxValue == 0) {
+    return;
+  }
 
-  VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties;
-  vkGetPhysicalDeviceMemoryProperties(activePhysicalDeviceHandle,
-                                      &physicalDeviceMemoryProperties);
+  std::vector<uint8_t> colorBuffer(width * height * 4);
+  for (uint32_t x = 0; x < width * height; x++) {
+    float value = (float)heatmapBuffer[x * 4 + channel] / maxValue;
+
+    colorBuffer[x * 4 + 0] =
+        (uint8_t)(255.0f * std::clamp(2.0f * value - 1.0f, 0.0f, 1.0f));
+    colorBuffer[x * 4 + 1] =
+        (uint8_t)(255.0f * std::min(2.0f * value, 2.0f - 2.0f * value));
+    colorBuffer[x * 4 + 2] =
+        (uint8_t)(255.0f * std::clamp(1.0f - 2.0f * value, 0.0f, 1.0f));
+    colorBuffer[x * 4 + 3] = 255;
+  }
 
-  std::cout << physicalDeviceProperties.deviceName << std::endl;
+  std::string fileName = "heatmap_" + heatmapNameList[channel] + ".png";
+  stbi_write_png(fileName.c_str(), width, height, 4, colorBuffer.data(),
+                 4 * width);
 
-  // =========================================================================
-  // Physical Device Features
+  std::cout << fileName << ": " << heatmapNameList[channel] << " max "
+            << maxValue << std::endl;
+}
+#endif
 
-  VkPhysicalDeviceBufferDeviceAddressFeatures
-      physicalDeviceBufferDeviceAddressFeatures = {
-          .sType =
-              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES,
-          .pNext = NULL,
-          .bufferDeviceAddress = VK_TRUE,
-          .bufferDeviceAddressCaptureReplay = VK_FALSE,
-          .bufferDeviceAddressMultiDevice = VK_FALSE};
 
-  VkPhysicalDeviceAccelerationStructureFeaturesKHR
-      physicalDeviceAccelerationStructureFeatures = {
-          .sType =
-              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
-          .pNext = &physicalDeviceBufferDeviceAddressFeatures,
-          .accelerationStructure = VK_TRUE,
-          .accelerationStructureCaptureReplay = VK_FALSE,
-          .accelerationStructureIndirectBuild = VK_FALSE,
-          .accelerationStructureHostCommands = VK_FALSE,
-          .descriptorBindingAccelerationStructureUpdateAfterBind = VK_FALSE};
+// Magic ("RTSC") and version at the start of the scene cache, see loadScene
+#define SCENE_CACHE_MAGIC 0x43535452
+#define SCENE_CACHE_VERSION 3
 
-  VkPhysicalDeviceRayTracingPipelineFeaturesKHR
-      physicalDeviceRayTracingPipelineFeatures = {
-          .sType =
-              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR,
-          .pNext = &physicalDeviceAccelerationStructureFeatures,
-          .rayTracingPipeline = VK_TRUE,
-          .rayTracingPipelineShaderGroupHandleCaptureReplay = VK_FALSE,
-          .rayTracingPipelineShaderGroupHandleCaptureReplayMixed = VK_FALSE,
-          .rayTracingPipelineTraceRaysIndirect = VK_FALSE,
-          .rayTraversalPrimitiveCulling = VK_FALSE};
-  VkPhysicalDeviceFeatures deviceFeatures = {.geometryShader = VK_TRUE};
+// Sections of the scene cache start on this boundary, so a mapped section can
+// be copied into a mapped buffer without realignment
+#define SCENE_CACHE_ALIGNMENT 256
 
-  // =========================================================================
-  // Physical Device Submission Queue Families
+// OBJ files are parsed in line aligned chunks of about this many bytes
+#define OBJ_CHUNK_SIZE (16 * 1024 * 1024)
 
-  uint32_t queueFamilyPropertyCount = 0;
-  vkGetPhysicalDeviceQueueFamilyProperties(activePhysicalDeviceHandle,
-                                           &queueFamilyPropertyCount, NULL);
+// Vertices in the same grid cell of this size are welded into one when the
+// cache is written. Zero welds only vertices at exactly the same position.
+#if !defined(SCENE_WELD_EPSILON)
+#define SCENE_WELD_EPSILON 0.0f
+#endif
 
-  std::vector<VkQueueFamilyProperties> queueFamilyPropertiesList(
-      queueFamilyPropertyCount);
+// Layout of the device vertex buffer. Quantized positions are four signed
+// normalized 16 bit values each, the last unused, and follow the row major
+// 3x4 transform decoding them.
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+#define SCENE_VERTEX_FORMAT VK_FORMAT_R16G16B16A16_SNORM
+#define SCENE_VERTEX_STRIDE (sizeof(int16_t) * 4)
+#define SCENE_VERTEX_DATA_OFFSET (sizeof(float) * 12)
+#else
+#define SCENE_VERTEX_FORMAT VK_FORMAT_R32G32B32_SFLOAT
+#define SCENE_VERTEX_STRIDE (sizeof(float) * 3)
+#define SCENE_VERTEX_DATA_OFFSET 0
+#endif
 
-  vkGetPhysicalDeviceQueueFamilyProperties(activePhysicalDeviceHandle,
-                                           &queueFamilyPropertyCount,
-                                           queueFamilyPropertiesList.data());
+// Vertices quantized by one task
+#define QUANTIZATION_TASK_VERTEX_COUNT (1024 * 1024)
 
-  uint32_t queueFamilyIndex = -1;
-  for (uint32_t x = 0; x < queueFamilyPropertiesList.size(); x++) {
-    if (queueFamilyPropertiesList[x].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+// Triangles per bottom level acceleration structure when the scene is split
+// into spatial clusters
+#if !defined(SCENE_CLUSTER_PRIMITIVE_COUNT)
+#define SCENE_CLUSTER_PRIMITIVE_COUNT (64 * 1024)
+#endif
 
-      VkBool32 isPresentSupported = false;
-      result = vkGetPhysicalDeviceSurfaceSupportKHR(
-          activePhysicalDeviceHandle, x, surfaceHandle, &isPresentSupported);
+// Triangles given a Morton code by one clustering task
+#define CLUSTERING_TASK_PRIMITIVE_COUNT (1024 * 1024)
+
+struct Material {
+  float ambient[4] = {0, 0, 0, 0};
+  float diffuse[4] = {0, 0, 0, 0};
+  float specular[4] = {0, 0, 0, 0};
+  float emission[4] = {0, 0, 0, 0};
+};
+
+// Offsets are in bytes from the start of the file, counts in elements. The
+// source size and write time identify the OBJ the cache was generated from,
+// and weldEpsilon the SCENE_WELD_EPSILON its vertices were welded with.
+// Indices are indexSize (2 or 4) bytes each.
+struct SceneCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceFileSize;
+  int64_t sourceWriteTime;
+  double weldEpsilon;
+  uint64_t fileSize;
+  uint64_t vertexCount;
+  uint64_t vertexOffset;
+  uint64_t indexCount;
+  uint64_t indexSize;
+  uint64_t indexOffset;
+  uint64_t primitiveCount;
+  uint64_t materialIndexOffset;
+  uint64_t materialCount;
+  uint64_t materialOffset;
+};
+
+// Vertices and triangles written by one parse task
+struct SceneRange {
+  uint64_t vertexOffset;
+  uint64_t vertexCount;
+  uint64_t primitiveOffset;
+  uint64_t primitiveCount;
+};
+
+// Vertex positions (three floats each), triangle indices, one material index
+// per triangle and the materials, laid out as the device buffers expect them.
+// Indices are 16 bit when indexSize is 2, 32 bit otherwise. The data pointers
+// point into the mapped cache, or into the lists when the cache cannot be
+// written.
+struct Scene {
+  uint64_t vertexCount = 0;
+  const float *vertexData = NULL;
+  uint64_t indexCount = 0;
+  uint32_t indexSize = sizeof(uint32_t);
+  const void *indexData = NULL;
+  uint64_t primitiveCount = 0;
+  const uint32_t *materialIndexData = NULL;
+  uint64_t materialCount = 0;
+  const Material *materialData = NULL;
+
+  std::vector<float> vertexList;
+  std::vector<uint32_t> indexList;
+  std::vector<uint32_t> materialIndexList;
+  std::vector<Material> materialList;
+
+  void *mappedFileBuffer = NULL;
+  uint64_t mappedFileSize = 0;
+
+  // The unoptimized scene a first run renders is parsed into this file,
+  // deleted by unloadScene
+  std::string temporaryFileName;
+
+  // Quantized positions in the SCENE_VERTEX_FORMAT layout and the transform
+  // decoding them, set once isQuantized is. Only built with
+  // VERTEX_QUANTIZATION_ENABLED.
+  std::vector<int16_t> quantizedVertexList;
+  float quantizationTransform[3][4] = {};
+  bool isQuantized = false;
+
+  // The triangles sorted along a Morton curve through their centroids, as
+  // indices (indexSize each) and as scene primitive indices. Every
+  // SCENE_CLUSTER_PRIMITIVE_COUNT of them form one cluster. Set once
+  // isClustered is. Only built with BLAS_CLUSTERING_ENABLED.
+  std::vector<uint32_t> clusterIndexList;
+  std::vector<uint32_t> clusterPrimitiveIndexList;
+  uint64_t clusterCount = 0;
+  bool isClustered = false;
+
+  // Lets other threads upload the scene while it is parsed. The counts, the
+  // materials and rangeList are set once isSizeKnown is, the data of each
+  // range once it is marked ready. isLoadFailed wakes every wait to throw.
+  std::mutex mutex;
+  std::condition_variable conditionVariable;
+  bool isSizeKnown = false;
+  bool isLoadFailed = false;
+  std::vector<SceneRange> rangeList;
+  std::vector<bool> isRangeReadyList;
+};
+
+uint64_t alignSceneCacheOffset(uint64_t offset) {
+  return (offset + SCENE_CACHE_ALIGNMENT - 1) &
+         ~(uint64_t)(SCENE_CACHE_ALIGNMENT - 1);
+}
 
-      if (result != VK_SUCCESS) {
-        throwExceptionVulkanAPI(result, "vkGetPhysicalDeviceSurfaceSupportKHR");
-      }
+// Indices are 16 bit when every vertex can be addressed with them
+uint32_t getSceneIndexSize(uint64_t vertexCount) {
+  return vertexCount <= 0x10000 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
 
-      if (isPresentSupported) {
-        queueFamilyIndex = x;
-        break;
-      }
-    }
+uint32_t getSceneIndex(const void *indexData, uint32_t indexSize,
+                       uint64_t position) {
+  return indexSize == sizeof(uint16_t)
+             ? ((const uint16_t *)indexData)[position]
+             : ((const uint32_t *)indexData)[position];
+}
+
+void setSceneIndex(void *indexData, uint32_t indexSize, uint64_t position,
+                   uint32_t index) {
+  if (indexSize == sizeof(uint16_t)) {
+    ((uint16_t *)indexData)[position] = index;
+  } else {
+    ((uint32_t *)indexData)[position] = index;
   }
+}
 
-  std::vector<float> queuePrioritiesList = {1.0f};
-  VkDeviceQueueCreateInfo deviceQueueCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .queueFamilyIndex = queueFamilyIndex,
-      .queueCount = 1,
-      .pQueuePriorities = queuePrioritiesList.data()};
+uint64_t getSceneVertexBufferSize(const Scene &scene) {
+  return SCENE_VERTEX_DATA_OFFSET + SCENE_VERTEX_STRIDE * scene.vertexCount;
+}
 
-  // =========================================================================
-  // Logical Device
+// Size of the indices, padded to whole 32 bit words for the shaders that read
+// 16 bit indices in pairs
+uint64_t getSceneIndexDataSize(const Scene &scene) {
+  return (scene.indexSize * scene.indexCount + 3) / 4 * 4;
+}
 
-  std::vector<const char *> deviceExtensionList = {
-      "VK_KHR_ray_tracing_pipeline",
-      "VK_KHR_acceleration_structure",
-      "VK_EXT_descriptor_indexing",
-      "VK_KHR_maintenance3",
-      "VK_KHR_buffer_device_address",
-      "VK_KHR_deferred_host_operations",
-      "VK_KHR_swapchain"};
+// With BLAS_CLUSTERING_ENABLED the index buffer continues with the cluster
+// indices and then the scene primitive index of each clustered triangle
+uint64_t getSceneIndexBufferSize(const Scene &scene) {
+#if defined(BLAS_CLUSTERING_ENABLED)
+  return 2 * getSceneIndexDataSize(scene) +
+         sizeof(uint32_t) * scene.primitiveCount;
+#else
+  return getSceneIndexDataSize(scene);
+#endif
+}
 
-  VkDeviceCreateInfo deviceCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-      .pNext = &physicalDeviceRayTracingPipelineFeatures,
-      .flags = 0,
-      .queueCreateInfoCount = 1,
-      .pQueueCreateInfos = &deviceQueueCreateInfo,
-      .enabledLayerCount = 0,
-      .ppEnabledLayerNames = NULL,
-      .enabledExtensionCount = (uint32_t)deviceExtensionList.size(),
-      .ppEnabledExtensionNames = deviceExtensionList.data(),
-      .pEnabledFeatures = &deviceFeatures};
+// Maps a whole file read only, returns NULL if it cannot be mapped
+void *mapFile(const std::string &fileName, uint64_t &fileSize) {
+  void *fileBuffer = NULL;
 
-  VkDevice deviceHandle = VK_NULL_HANDLE;
-  result = vkCreateDevice(activePhysicalDeviceHandle, &deviceCreateInfo, NULL,
-                          &deviceHandle);
+#if defined(PLATFORM_WINDOWS)
+  HANDLE fileHandle =
+      CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (fileHandle == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateDevice");
+  LARGE_INTEGER largeFileSize;
+  HANDLE fileMappingHandle = NULL;
+  if (GetFileSizeEx(fileHandle, &largeFileSize) &&
+      largeFileSize.QuadPart > 0) {
+    fileSize = largeFileSize.QuadPart;
+    fileMappingHandle =
+        CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
   }
 
-  // =========================================================================
-  // Submission Queue
+  // The view keeps the mapping alive after both handles are closed
+  if (fileMappingHandle != NULL) {
+    fileBuffer = MapViewOfFile(fileMappingHandle, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(fileMappingHandle);
+  }
+  CloseHandle(fileHandle);
+#elif defined(PLATFORM_LINUX)
+  int fileDescriptor = open(fileName.c_str(), O_RDONLY);
+  if (fileDescriptor == -1) {
+    return NULL;
+  }
 
-  VkQueue queueHandle = VK_NULL_HANDLE;
-  vkGetDeviceQueue(deviceHandle, queueFamilyIndex, 0, &queueHandle);
+  struct stat fileStat;
+  if (fstat(fileDescriptor, &fileStat) == 0 && fileStat.st_size > 0) {
+    fileSize = fileStat.st_size;
+    fileBuffer = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE,
+                      fileDescriptor, 0);
 
-  // =========================================================================
-  // Device Pointer Functions
+    if (fileBuffer == MAP_FAILED) {
+      fileBuffer = NULL;
+    } else {
+      madvise(fileBuffer, fileSize, MADV_SEQUENTIAL);
+    }
+  }
+  close(fileDescriptor);
+#endif
 
-  PFN_vkGetBufferDeviceAddressKHR pvkGetBufferDeviceAddressKHR =
-      (PFN_vkGetBufferDeviceAddressKHR)vkGetDeviceProcAddr(
-          deviceHandle, "vkGetBufferDeviceAddressKHR");
+  return fileBuffer;
+}
 
-  PFN_vkCreateRayTracingPipelinesKHR pvkCreateRayTracingPipelinesKHR =
-      (PFN_vkCreateRayTracingPipelinesKHR)vkGetDeviceProcAddr(
-          deviceHandle, "vkCreateRayTracingPipelinesKHR");
+void unmapFile(void *fileBuffer, uint64_t fileSize) {
+#if defined(PLATFORM_WINDOWS)
+  UnmapViewOfFile(fileBuffer);
+#elif defined(PLATFORM_LINUX)
+  munmap(fileBuffer, fileSize);
+#endif
+}
 
-  PFN_vkGetAccelerationStructureBuildSizesKHR
-      pvkGetAccelerationStructureBuildSizesKHR =
-          (PFN_vkGetAccelerationStructureBuildSizesKHR)vkGetDeviceProcAddr(
-              deviceHandle, "vkGetAccelerationStructureBuildSizesKHR");
+// Creates a file of fileSize bytes, replacing any existing one, and maps it
+// for writing. Returns NULL if it cannot be created.
+void *createMappedFile(const std::string &fileName, uint64_t fileSize) {
+  void *fileBuffer = NULL;
 
-  PFN_vkCreateAccelerationStructureKHR pvkCreateAccelerationStructureKHR =
-      (PFN_vkCreateAccelerationStructureKHR)vkGetDeviceProcAddr(
-          deviceHandle, "vkCreateAccelerationStructureKHR");
+#if defined(PLATFORM_WINDOWS)
+  HANDLE fileHandle =
+      CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                  CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (fileHandle == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
 
-  PFN_vkDestroyAccelerationStructureKHR pvkDestroyAccelerationStructureKHR =
-      (PFN_vkDestroyAccelerationStructureKHR)vkGetDeviceProcAddr(
-          deviceHandle, "vkDestroyAccelerationStructureKHR");
+  HANDLE fileMappingHandle =
+      CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE,
+                         (DWORD)(fileSize >> 32), (DWORD)fileSize, NULL);
+  if (fileMappingHandle != NULL) {
+    fileBuffer = MapViewOfFile(fileMappingHandle, FILE_MAP_WRITE, 0, 0, 0);
+    CloseHandle(fileMappingHandle);
+  }
+  CloseHandle(fileHandle);
+#elif defined(PLATFORM_LINUX)
+  int fileDescriptor =
+      open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fileDescriptor == -1) {
+    return NULL;
+  }
 
-  PFN_vkGetAccelerationStructureDeviceAddressKHR
-      pvkGetAccelerationStructureDeviceAddressKHR =
-          (PFN_vkGetAccelerationStructureDeviceAddressKHR)vkGetDeviceProcAddr(
-              deviceHandle, "vkGetAccelerationStructureDeviceAddressKHR");
+  if (ftruncate(fileDescriptor, fileSize) == 0) {
+    fileBuffer = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fileDescriptor, 0);
 
-  PFN_vkCmdBuildAccelerationStructuresKHR pvkCmdBuildAccelerationStructuresKHR =
-      (PFN_vkCmdBuildAccelerationStructuresKHR)vkGetDeviceProcAddr(
-          deviceHandle, "vkCmdBuildAccelerationStructuresKHR");
+    if (fileBuffer == MAP_FAILED) {
+      fileBuffer = NULL;
+    }
+  }
+  close(fileDescriptor);
+#endif
 
-  PFN_vkGetRayTracingShaderGroupHandlesKHR
-      pvkGetRayTracingShaderGroupHandlesKHR =
-          (PFN_vkGetRayTracingShaderGroupHandlesKHR)vkGetDeviceProcAddr(
-              deviceHandle, "vkGetRayTracingShaderGroupHandlesKHR");
+  return fileBuffer;
+}
 
-  PFN_vkCmdTraceRaysKHR pvkCmdTraceRaysKHR =
-      (PFN_vkCmdTraceRaysKHR)vkGetDeviceProcAddr(deviceHandle,
-                                                 "vkCmdTraceRaysKHR");
+// Maps the cache and points the scene at its sections. Returns false, leaving
+// the scene empty, when the cache is missing, was generated from a different
+// OBJ or with a different SCENE_WELD_EPSILON, or is truncated.
+bool loadSceneCache(const std::string &cacheFileName, uint64_t sourceFileSize,
+                    int64_t sourceWriteTime, Scene &scene) {
+  uint64_t fileSize = 0;
+  void *fileBuffer = mapFile(cacheFileName, fileSize);
+  if (fileBuffer == NULL) {
+    return false;
+  }
 
-  VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo = {
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
-      .pNext = NULL,
-      .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
-      .deviceMask = 0};
+  SceneCacheHeader header = {};
+  if (fileSize >= sizeof(SceneCacheHeader)) {
+    memcpy(&header, fileBuffer, sizeof(SceneCacheHeader));
+  }
 
-  // =========================================================================
-  // Command Pool
+  auto isSectionInFile = [&](uint64_t offset, uint64_t count,
+                             uint64_t elementSize) {
+    return offset % SCENE_CACHE_ALIGNMENT == 0 && offset <= fileSize &&
+           count <= (fileSize - offset) / elementSize;
+  };
 
-  VkCommandPoolCreateInfo commandPoolCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-      .pNext = NULL,
-      .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-      .queueFamilyIndex = queueFamilyIndex};
-
-  VkCommandPool commandPoolHandle = VK_NULL_HANDLE;
-  result = vkCreateCommandPool(deviceHandle, &commandPoolCreateInfo, NULL,
-                               &commandPoolHandle);
-
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateCommandPool");
+  if (header.magic != SCENE_CACHE_MAGIC ||
+      header.version != SCENE_CACHE_VERSION ||
+      (header.indexSize != sizeof(uint16_t) &&
+       header.indexSize != sizeof(uint32_t)) ||
+      header.sourceFileSize != sourceFileSize ||
+      header.sourceWriteTime != sourceWriteTime ||
+      header.weldEpsilon != (double)SCENE_WELD_EPSILON ||
+      header.fileSize != fileSize ||
+      !isSectionInFile(header.vertexOffset, header.vertexCount,
+                       sizeof(float) * 3) ||
+      !isSectionInFile(header.indexOffset, header.indexCount,
+                       header.indexSize) ||
+      !isSectionInFile(header.materialIndexOffset, header.primitiveCount,
+                       sizeof(uint32_t)) ||
+      !isSectionInFile(header.materialOffset, header.materialCount,
+                       sizeof(Material))) {
+    unmapFile(fileBuffer, fileSize);
+    return false;
   }
 
-  // =========================================================================
-  // Command Buffers
+  const char *cacheBuffer = (const char *)fileBuffer;
 
-  VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-      .pNext = NULL,
-      .commandPool = commandPoolHandle,
-      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-      .commandBufferCount = 16};
+  scene.vertexCount = header.vertexCount;
+  scene.vertexData = (const float *)(cacheBuffer + header.vertexOffset);
+  scene.indexCount = header.indexCount;
+  scene.indexSize = header.indexSize;
+  scene.indexData = cacheBuffer + header.indexOffset;
+  scene.primitiveCount = header.primitiveCount;
+  scene.materialIndexData =
+      (const uint32_t *)(cacheBuffer + header.materialIndexOffset);
+  scene.materialCount = header.materialCount;
+  scene.materialData = (const Material *)(cacheBuffer + header.materialOffset);
 
-  std::vector<VkCommandBuffer> commandBufferHandleList =
-      std::vector<VkCommandBuffer>(16, VK_NULL_HANDLE);
+  scene.mappedFileBuffer = fileBuffer;
+  scene.mappedFileSize = fileSize;
 
-  result = vkAllocateCommandBuffers(deviceHandle, &commandBufferAllocateInfo,
-                                    commandBufferHandleList.data());
+  return true;
+}
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkAllocateCommandBuffers");
-  }
+// Lays out the sections of a cache for the given counts
+SceneCacheHeader getSceneCacheHeader(uint64_t sourceFileSize,
+                                     int64_t sourceWriteTime,
+                                     uint64_t vertexCount,
+                                     uint32_t indexSize,
+                                     uint64_t primitiveCount,
+                                     uint64_t materialCount) {
+  SceneCacheHeader header = {
+      .magic = SCENE_CACHE_MAGIC,
+      .version = SCENE_CACHE_VERSION,
+      .sourceFileSize = sourceFileSize,
+      .sourceWriteTime = sourceWriteTime,
+      .weldEpsilon = SCENE_WELD_EPSILON,
+      .fileSize = 0,
+      .vertexCount = vertexCount,
+      .vertexOffset = alignSceneCacheOffset(sizeof(SceneCacheHeader)),
+      .indexCount = primitiveCount * 3,
+      .indexSize = indexSize,
+      .indexOffset = 0,
+      .primitiveCount = primitiveCount,
+      .materialIndexOffset = 0,
+      .materialCount = materialCount,
+      .materialOffset = 0};
+
+  header.indexOffset = alignSceneCacheOffset(
+      header.vertexOffset + sizeof(float) * 3 * header.vertexCount);
+  header.materialIndexOffset = alignSceneCacheOffset(
+      header.indexOffset + header.indexSize * header.indexCount);
+  header.materialOffset = alignSceneCacheOffset(
+      header.materialIndexOffset + sizeof(uint32_t) * header.primitiveCount);
+  header.fileSize =
+      header.materialOffset + sizeof(Material) * header.materialCount;
+
+  return header;
+}
 
-  // =========================================================================
-  // Surface Features
+// Runs taskFunction for every task index on up to one thread per hardware
+// thread, each thread claiming the next task that has not started. Returns
+// the number of threads used.
+uint32_t runTasksInParallel(uint32_t taskCount,
+                            const std::function<void(uint32_t)> &taskFunction) {
+  std::atomic<uint32_t> nextTaskIndex = 0;
+
+  auto workerFunction = [&]() {
+    for (uint32_t taskIndex = nextTaskIndex++; taskIndex < taskCount;
+         taskIndex = nextTaskIndex++) {
+      taskFunction(taskIndex);
+    }
+  };
 
-  VkSurfaceCapabilitiesKHR surfaceCapabilities;
-  result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
-      activePhysicalDeviceHandle, surfaceHandle, &surfaceCapabilities);
+  uint32_t threadCount =
+      std::min(std::max(std::thread::hardware_concurrency(), 1u), taskCount);
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result,
-                            "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
+  std::vector<std::thread> threadList;
+  for (uint32_t x = 1; x < threadCount; x++) {
+    threadList.emplace_back(workerFunction);
   }
 
-  uint32_t surfaceFormatCount = 0;
-  result = vkGetPhysicalDeviceSurfaceFormatsKHR(
-      activePhysicalDeviceHandle, surfaceHandle, &surfaceFormatCount, NULL);
+  workerFunction();
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkGetPhysicalDeviceSurfaceFormatsKHR");
+  for (std::thread &thread : threadList) {
+    thread.join();
   }
 
-  std::vector<VkSurfaceFormatKHR> surfaceFormatList(surfaceFormatCount);
-  result = vkGetPhysicalDeviceSurfaceFormatsKHR(
-      activePhysicalDeviceHandle, surfaceHandle, &surfaceFormatCount,
-      surfaceFormatList.data());
+  return threadCount;
+}
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkGetPhysicalDeviceSurfaceFormatsKHR");
+// One line aligned range of an OBJ file. The first pass counts what the
+// range contains, so the second pass can write it straight to its offsets in
+// the scene lists.
+struct OBJChunk {
+  const char *begin;
+  const char *end;
+
+  uint64_t vertexCount = 0;
+  uint64_t primitiveCount = 0;
+  std::vector<std::string> materialLibraryList;
+  std::string lastMaterialName;
+  bool isMaterialNameSet = false;
+
+  uint64_t vertexOffset = 0;
+  uint64_t primitiveOffset = 0;
+  uint32_t initialMaterialIndex = -1;
+};
+
+// Returns the next whitespace separated token before lineEnd and moves
+// linePosition past it. The token is empty at the end of the line.
+std::string_view getOBJToken(const char *&linePosition, const char *lineEnd) {
+  while (linePosition < lineEnd &&
+         (*linePosition == ' ' || *linePosition == '\t' ||
+          *linePosition == '\r')) {
+    linePosition++;
   }
 
-  uint32_t presentModeCount = 0;
-  result = vkGetPhysicalDeviceSurfacePresentModesKHR(
-      activePhysicalDeviceHandle, surfaceHandle, &presentModeCount, NULL);
+  const char *tokenBegin = linePosition;
+  while (linePosition < lineEnd && *linePosition != ' ' &&
+         *linePosition != '\t' && *linePosition != '\r') {
+    linePosition++;
+  }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result,
-                            "vkGetPhysicalDeviceSurfacePresentModesKHR");
+  return std::string_view(tokenBegin, linePosition - tokenBegin);
+}
+
+// Calls lineFunction with the keyword of every line in the chunk and the
+// position after it
+void forEachOBJLine(const OBJChunk &chunk,
+                    const std::function<void(std::string_view, const char *,
+                                             const char *)> &lineFunction) {
+  const char *lineBegin = chunk.begin;
+  while (lineBegin < chunk.end) {
+    const char *lineEnd =
+        (const char *)memchr(lineBegin, '\n', chunk.end - lineBegin);
+    if (lineEnd == NULL) {
+      lineEnd = chunk.end;
+    }
+
+    const char *linePosition = lineBegin;
+    std::string_view keyword = getOBJToken(linePosition, lineEnd);
+    if (!keyword.empty() && keyword[0] != '#') {
+      lineFunction(keyword, linePosition, lineEnd);
+    }
+
+    lineBegin = lineEnd + 1;
   }
+}
 
-  std::vector<VkPresentModeKHR> presentModeList(presentModeCount);
-  result = vkGetPhysicalDeviceSurfacePresentModesKHR(
-      activePhysicalDeviceHandle, surfaceHandle, &presentModeCount,
-      presentModeList.data());
+// Parses the OBJ in line aligned chunks of OBJ_CHUNK_SIZE on every hardware
+// thread, straight into the sections of a temporary file laid out like the
+// cache. Only positions, faces, usemtl and mtllib are read. Polygons are split
+// into triangle fans. Materials are read with tinyobj::LoadMtl.
+void parseSceneOBJ(const std::string &objFileName,
+                   const std::string &temporaryFileName, Scene &scene) {
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+
+  uint64_t fileSize = 0;
+  const char *fileBuffer = (const char *)mapFile(objFileName, fileSize);
+  if (fileBuffer == NULL) {
+    throw std::runtime_error("OBJ: could not open " + objFileName);
+  }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result,
-                            "vkGetPhysicalDeviceSurfacePresentModesKHR");
+  std::vector<OBJChunk> chunkList;
+  for (uint64_t chunkBegin = 0; chunkBegin < fileSize;) {
+    uint64_t chunkEnd = std::min(chunkBegin + OBJ_CHUNK_SIZE, fileSize);
+    while (chunkEnd < fileSize && fileBuffer[chunkEnd - 1] != '\n') {
+      chunkEnd++;
+    }
+
+    chunkList.push_back(
+        {.begin = fileBuffer + chunkBegin, .end = fileBuffer + chunkEnd});
+    chunkBegin = chunkEnd;
   }
 
-  // =========================================================================
-  // Swapchain
+  // Count every chunk's vertices and triangles
+  runTasksInParallel(chunkList.size(), [&](uint32_t chunkIndex) {
+    OBJChunk &chunk = chunkList[chunkIndex];
+
+    forEachOBJLine(chunk, [&](std::string_view keyword,
+                              const char *linePosition, const char *lineEnd) {
+      if (keyword == "v") {
+        chunk.vertexCount += 1;
+      } else if (keyword == "f") {
+        uint32_t faceVertexCount = 0;
+        while (!getOBJToken(linePosition, lineEnd).empty()) {
+          faceVertexCount += 1;
+        }
+
+        if (faceVertexCount >= 3) {
+          chunk.primitiveCount += faceVertexCount - 2;
+        }
+      } else if (keyword == "usemtl") {
+        chunk.lastMaterialName = getOBJToken(linePosition, lineEnd);
+        chunk.isMaterialNameSet = true;
+      } else if (keyword == "mtllib") {
+        for (std::string_view token = getOBJToken(linePosition, lineEnd);
+             !token.empty(); token = getOBJToken(linePosition, lineEnd)) {
+          chunk.materialLibraryList.push_back(std::string(token));
+        }
+      }
+    });
+  });
+
+  std::map<std::string, int> materialMap;
+  std::vector<tinyobj::material_t> materials;
+  std::vector<std::string> loadedMaterialLibraryList;
+
+  uint64_t vertexCount = 0;
+  uint64_t primitiveCount = 0;
+  for (OBJChunk &chunk : chunkList) {
+    chunk.vertexOffset = vertexCount;
+    chunk.primitiveOffset = primitiveCount;
+    vertexCount += chunk.vertexCount;
+    primitiveCount += chunk.primitiveCount;
+
+    for (const std::string &materialLibrary : chunk.materialLibraryList) {
+      if (std::find(loadedMaterialLibraryList.begin(),
+                    loadedMaterialLibraryList.end(),
+                    materialLibrary) != loadedMaterialLibraryList.end()) {
+        continue;
+      }
+      loadedMaterialLibraryList.push_back(materialLibrary);
 
-  VkSwapchainCreateInfoKHR swapchainCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-      .pNext = NULL,
-      .flags = 0,
-      .surface = surfaceHandle,
-      .minImageCount = surfaceCapabilities.minImageCount + 1,
-      .imageFormat = surfaceFormatList[0].format,
-      .imageColorSpace = surfaceFormatList[0].colorSpace,
-      .imageExtent = surfaceCapabilities.currentExtent,
-      .imageArrayLayers = 1,
-      .imageUsage = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-      .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
-      .queueFamilyIndexCount = 1,
-      .pQueueFamilyIndices = &queueFamilyIndex,
-      .preTransform = surfaceCapabilities.currentTransform,
-      .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-      .presentMode = presentModeList[0],
-      .clipped = VK_TRUE,
-      .oldSwapchain = VK_NULL_HANDLE};
+      std::ifstream materialFile(
+          std::filesystem::path(objFileName).parent_path() / materialLibrary);
+      if (!materialFile.is_open()) {
+        std::cout << "OBJ: could not open " << materialLibrary << std::endl;
+        continue;
+      }
 
-  VkSwapchainKHR swapchainHandle = VK_NULL_HANDLE;
-  result = vkCreateSwapchainKHR(deviceHandle, &swapchainCreateInfo, NULL,
-                                &swapchainHandle);
+      std::string warning;
+      std::string error;
+      tinyobj::LoadMtl(&materialMap, &materials, &materialFile, &warning,
+                       &error);
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateSwapchainKHR");
+      if (!warning.empty()) {
+        std::cout << "TinyObjReader: " << warning;
+      }
+      if (!error.empty()) {
+        std::cerr << "TinyObjReader: " << error;
+      }
+    }
   }
 
-  // =========================================================================
-  // Swapchain Images
+  auto getMaterialIndex = [&](std::string_view materialName) {
+    auto materialIterator = materialMap.find(std::string(materialName));
+    return materialIterator == materialMap.end()
+               ? (uint32_t)-1
+               : (uint32_t)materialIterator->second;
+  };
 
-  uint32_t swapchainImageCount = 0;
-  result = vkGetSwapchainImagesKHR(deviceHandle, swapchainHandle,
-                                   &swapchainImageCount, NULL);
+  // A chunk starts with the material of the last usemtl before it
+  uint32_t materialIndex = -1;
+  for (OBJChunk &chunk : chunkList) {
+    chunk.initialMaterialIndex = materialIndex;
+    if (chunk.isMaterialNameSet) {
+      materialIndex = getMaterialIndex(chunk.lastMaterialName);
+    }
+  }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkGetSwapchainImagesKHR");
+  std::vector<Material> materialList(materials.size());
+  for (uint32_t x = 0; x < materials.size(); x++) {
+    memcpy(materialList[x].ambient, materials[x].ambient, sizeof(float) * 3);
+    memcpy(materialList[x].diffuse, materials[x].diffuse, sizeof(float) * 3);
+    memcpy(materialList[x].specular, materials[x].specular, sizeof(float) * 3);
+    memcpy(materialList[x].emission, materials[x].emission, sizeof(float) * 3);
   }
 
-  std::vector<VkImage> swapchainImageHandleList(swapchainImageCount);
-  result = vkGetSwapchainImagesKHR(deviceHandle, swapchainHandle,
-                                   &swapchainImageCount,
-                                   swapchainImageHandleList.data());
+  uint32_t indexSize = getSceneIndexSize(vertexCount);
+  SceneCacheHeader header = getSceneCacheHeader(
+      0, 0, vertexCount, indexSize, primitiveCount, materialList.size());
+
+  char *cacheBuffer =
+      (char *)createMappedFile(temporaryFileName, header.fileSize);
+
+  float *vertexData = NULL;
+  void *indexData = NULL;
+  uint32_t *materialIndexData = NULL;
+  Material *materialData = NULL;
+
+  if (cacheBuffer != NULL) {
+    vertexData = (float *)(cacheBuffer + header.vertexOffset);
+    indexData = cacheBuffer + header.indexOffset;
+    materialIndexData = (uint32_t *)(cacheBuffer + header.materialIndexOffset);
+    materialData = (Material *)(cacheBuffer + header.materialOffset);
+
+    memcpy(materialData, materialList.data(),
+           sizeof(Material) * materialList.size());
+  } else {
+    std::cerr << "Scene cache: could not write " << temporaryFileName
+              << std::endl;
+
+    scene.vertexList.resize(vertexCount * 3);
+    scene.indexList.resize((indexSize * primitiveCount * 3 + 3) / 4);
+    scene.materialIndexList.resize(primitiveCount);
+    scene.materialList = materialList;
+
+    vertexData = scene.vertexList.data();
+    indexData = scene.indexList.data();
+    materialIndexData = scene.materialIndexList.data();
+    materialData = scene.materialList.data();
+  }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkGetSwapchainImagesKHR");
+  {
+    std::lock_guard<std::mutex> sceneLock(scene.mutex);
+
+    scene.vertexCount = vertexCount;
+    scene.vertexData = vertexData;
+    scene.indexCount = primitiveCount * 3;
+    scene.indexSize = indexSize;
+    scene.indexData = indexData;
+    scene.primitiveCount = primitiveCount;
+    scene.materialIndexData = materialIndexData;
+    scene.materialCount = materialList.size();
+    scene.materialData = materialData;
+
+    scene.mappedFileBuffer = cacheBuffer;
+    scene.mappedFileSize = header.fileSize;
+    if (cacheBuffer != NULL) {
+      scene.temporaryFileName = temporaryFileName;
+    }
+
+    for (const OBJChunk &chunk : chunkList) {
+      scene.rangeList.push_back({.vertexOffset = chunk.vertexOffset,
+                                 .vertexCount = chunk.vertexCount,
+                                 .primitiveOffset = chunk.primitiveOffset,
+                                 .primitiveCount = chunk.primitiveCount});
+    }
+    scene.isRangeReadyList.resize(chunkList.size(), false);
+    scene.isSizeKnown = true;
+  }
+  scene.conditionVariable.notify_all();
+
+  std::atomic<bool> isFaceInvalid = false;
+  std::atomic<uint64_t> parsedByteCount = 0;
+  std::atomic<uint32_t> printedPercent = 0;
+
+  // Parse every chunk into its range of the scene
+  uint32_t threadCount =
+      runTasksInParallel(chunkList.size(), [&](uint32_t chunkIndex) {
+        const OBJChunk &chunk = chunkList[chunkIndex];
+
+        float *chunkVertexData = vertexData + chunk.vertexOffset * 3;
+        uint64_t chunkIndexPosition = chunk.primitiveOffset * 3;
+        uint32_t *chunkMaterialIndexData =
+            materialIndexData + chunk.primitiveOffset;
+
+        uint64_t chunkVertexCount = 0;
+        uint32_t chunkMaterialIndex = chunk.initialMaterialIndex;
+        std::vector<uint32_t> faceIndexList;
+        bool isChunkFaceInvalid = false;
+
+        forEachOBJLine(chunk, [&](std::string_view keyword,
+                                  const char *linePosition,
+                                  const char *lineEnd) {
+          if (keyword == "v") {
+            for (uint32_t x = 0; x < 3; x++) {
+              std::string_view token = getOBJToken(linePosition, lineEnd);
+              if (!token.empty() && token[0] == '+') {
+                token.remove_prefix(1);
+              }
+
+              float value = 0.0f;
+              std::from_chars(token.data(), token.data() + token.size(),
+                              value);
+              chunkVertexData[chunkVertexCount * 3 + x] = value;
+            }
+
+            chunkVertexCount += 1;
+          } else if (keyword == "f") {
+            faceIndexList.clear();
+            for (std::string_view token = getOBJToken(linePosition, lineEnd);
+                 !token.empty(); token = getOBJToken(linePosition, lineEnd)) {
+
+              // Positive indices count from one, negative ones back from
+              // the last vertex read
+              int64_t index = 0;
+              std::from_chars(token.data(), token.data() + token.size(),
+                              index);
+              if (index < 0) {
+                index += chunk.vertexOffset + chunkVertexCount;
+              } else {
+                index -= 1;
+              }
+
+              if (index < 0 || index >= (int64_t)vertexCount) {
+                isChunkFaceInvalid = true;
+                index = 0;
+              }
+
+              faceIndexList.push_back(index);
+            }
+
+            for (uint32_t x = 2; x < faceIndexList.size(); x++) {
+              setSceneIndex(indexData, indexSize, chunkIndexPosition++,
+                            faceIndexList[0]);
+              setSceneIndex(indexData, indexSize, chunkIndexPosition++,
+                            faceIndexList[x - 1]);
+              setSceneIndex(indexData, indexSize, chunkIndexPosition++,
+                            faceIndexList[x]);
+
+              *chunkMaterialIndexData++ = chunkMaterialIndex;
+            }
+          } else if (keyword == "usemtl") {
+            chunkMaterialIndex =
+                getMaterialIndex(getOBJToken(linePosition, lineEnd));
+          }
+        });
+
+        // An invalid range is never marked ready, so no device uploads it
+        if (isChunkFaceInvalid) {
+          isFaceInvalid = true;
+          return;
+        }
+
+        {
+          std::lock_guard<std::mutex> sceneLock(scene.mutex);
+          scene.isRangeReadyList[chunkIndex] = true;
+        }
+        scene.conditionVariable.notify_all();
+
+        uint64_t chunkSize = chunk.end - chunk.begin;
+        uint32_t percent =
+            (parsedByteCount += chunkSize) * 10 / fileSize * 10;
+        uint32_t previousPercent = printedPercent;
+
+        if (chunkList.size() > 1 && percent > previousPercent &&
+            printedPercent.compare_exchange_strong(previousPercent, percent)) {
+          std::cout << "OBJ: " << percent << "%" << std::endl;
+        }
+      });
+
+  unmapFile((void *)fileBuffer, fileSize);
+
+  if (isFaceInvalid) {
+    throw std::runtime_error("OBJ: face with invalid vertex index in " +
+                             objFileName);
   }
 
-  std::vector<VkImageView> swapchainImageViewHandleList(swapchainImageCount,
-                                                        VK_NULL_HANDLE);
+  double parseMilliseconds = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() -
+                                 startTimePoint)
+                                 .count();
 
-  for (uint32_t x = 0; x < swapchainImageCount; x++) {
-    VkImageViewCreateInfo imageViewCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0,
-        .image = swapchainImageHandleList[x],
-        .viewType = VK_IMAGE_VIEW_TYPE_2D,
-        .format = surfaceFormatList[0].format,
-        .components = {VK_COMPONENT_SWIZZLE_IDENTITY,
-                       VK_COMPONENT_SWIZZLE_IDENTITY,
-                       VK_COMPONENT_SWIZZLE_IDENTITY,
-                       VK_COMPONENT_SWIZZLE_IDENTITY},
-        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}};
+  std::cout << "OBJ: " << fileSize / (1024.0 * 1024.0) << " MiB in "
+            << parseMilliseconds << " ms ("
+            << fileSize / (1024.0 * 1024.0) / (parseMilliseconds / 1000.0)
+            << " MiB/s) on " << threadCount << " threads" << std::endl;
+}
 
-    result = vkCreateImageView(deviceHandle, &imageViewCreateInfo, NULL,
-                               &swapchainImageViewHandleList[x]);
+// Welds the vertices of each SCENE_WELD_EPSILON grid cell, or at each exact
+// position, into the first of them, drops vertices no triangle uses and
+// numbers the rest in the order the triangles first use them, so the vertices
+// of nearby triangles are stored together. Triangles keep their order, as the
+// shaders and the material indices address them by primitive index. The
+// result is written to the cache with 16 bit indices when the remaining
+// vertices allow. The header is written last, so a cache left incomplete is
+// never loaded.
+void writeOptimizedSceneCache(const std::string &cacheFileName,
+                              uint64_t sourceFileSize, int64_t sourceWriteTime,
+                              const Scene &scene) {
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+
+  // Grid cells, or the bits of each coordinate with -0 folded into 0
+  std::vector<std::array<int64_t, 3>> weldKeyList(scene.vertexCount);
+  std::vector<uint32_t> sortedVertexIndexList(scene.vertexCount);
+  for (uint64_t x = 0; x < scene.vertexCount; x++) {
+    for (uint32_t y = 0; y < 3; y++) {
+      float value = scene.vertexData[x * 3 + y] + 0.0f;
+
+      if (SCENE_WELD_EPSILON > 0.0f) {
+        weldKeyList[x][y] = (int64_t)std::floor(value / SCENE_WELD_EPSILON);
+      } else {
+        uint32_t valueBits;
+        memcpy(&valueBits, &value, sizeof(float));
+        weldKeyList[x][y] = valueBits;
+      }
+    }
+    sortedVertexIndexList[x] = x;
+  }
 
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkCreateImageView");
+  std::sort(sortedVertexIndexList.begin(), sortedVertexIndexList.end(),
+            [&](uint32_t vertexIndexA, uint32_t vertexIndexB) {
+              if (weldKeyList[vertexIndexA] != weldKeyList[vertexIndexB]) {
+                return weldKeyList[vertexIndexA] < weldKeyList[vertexIndexB];
+              }
+              return vertexIndexA < vertexIndexB;
+            });
+
+  std::vector<uint32_t> weldedVertexIndexList(scene.vertexCount);
+  for (uint64_t x = 0; x < scene.vertexCount; x++) {
+    uint32_t vertexIndex = sortedVertexIndexList[x];
+    weldedVertexIndexList[vertexIndex] = vertexIndex;
+
+    if (x > 0) {
+      uint32_t previousVertexIndex = sortedVertexIndexList[x - 1];
+      if (weldKeyList[vertexIndex] == weldKeyList[previousVertexIndex]) {
+        weldedVertexIndexList[vertexIndex] =
+            weldedVertexIndexList[previousVertexIndex];
+      }
     }
   }
 
-  // =========================================================================
-  // Descriptor Pool
+  // Old index of every new vertex and new index of every old one
+  std::vector<uint32_t> sourceVertexIndexList;
+  std::vector<uint32_t> remappedVertexIndexList(scene.vertexCount, -1);
+  for (uint64_t x = 0; x < scene.indexCount; x++) {
+    uint32_t vertexIndex = weldedVertexIndexList[getSceneIndex(
+        scene.indexData, scene.indexSize, x)];
 
-  std::vector<VkDescriptorPoolSize> descriptorPoolSizeList = {
-      {.type = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
-       .descriptorCount = 1},
-      {.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = 1},
-      {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 4},
-      {.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, .descriptorCount = 1}};
+    if (remappedVertexIndexList[vertexIndex] == (uint32_t)-1) {
+      remappedVertexIndexList[vertexIndex] = sourceVertexIndexList.size();
+      sourceVertexIndexList.push_back(vertexIndex);
+    }
+  }
 
-  VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-      .pNext = NULL,
-      .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
-      .maxSets = 2,
-      .poolSizeCount = (uint32_t)descriptorPoolSizeList.size(),
-      .pPoolSizes = descriptorPoolSizeList.data()};
+  uint32_t indexSize = getSceneIndexSize(sourceVertexIndexList.size());
+  SceneCacheHeader header = getSceneCacheHeader(
+      sourceFileSize, sourceWriteTime, sourceVertexIndexList.size(),
+      indexSize, scene.primitiveCount, scene.materialCount);
 
-  VkDescriptorPool descriptorPoolHandle = VK_NULL_HANDLE;
-  result = vkCreateDescriptorPool(deviceHandle, &descriptorPoolCreateInfo, NULL,
-                                  &descriptorPoolHandle);
+  char *cacheBuffer = (char *)createMappedFile(cacheFileName, header.fileSize);
+  if (cacheBuffer == NULL) {
+    std::cerr << "Scene cache: could not write " << cacheFileName
+              << std::endl;
+    return;
+  }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateDescriptorPool");
+  float *vertexData = (float *)(cacheBuffer + header.vertexOffset);
+  for (uint64_t x = 0; x < sourceVertexIndexList.size(); x++) {
+    memcpy(vertexData + x * 3,
+           scene.vertexData + (uint64_t)sourceVertexIndexList[x] * 3,
+           sizeof(float) * 3);
   }
 
-  // =========================================================================
-  // Descriptor Set Layout
+  void *indexData = cacheBuffer + header.indexOffset;
+  for (uint64_t x = 0; x < scene.indexCount; x++) {
+    uint32_t vertexIndex = weldedVertexIndexList[getSceneIndex(
+        scene.indexData, scene.indexSize, x)];
+    setSceneIndex(indexData, indexSize, x,
+                  remappedVertexIndexList[vertexIndex]);
+  }
 
-  std::vector<VkDescriptorSetLayoutBinding> descriptorSetLayoutBindingList = {
-      {.binding = 0,
-       .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
-       .descriptorCount = 1,
-       .stageFlags =
-           VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
-       .pImmutableSamplers = NULL},
-      {.binding = 1,
-       .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-       .descriptorCount = 1,
-       .stageFlags =
-           VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
-       .pImmutableSamplers = NULL},
-      {.binding = 2,
-       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-       .descriptorCount = 1,
-       .stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
-       .pImmutableSamplers = NULL},
-      {.binding = 3,
-       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-       .descriptorCount = 1,
-       .stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
-       .pImmutableSamplers = NULL},
-      {.binding = 4,
-       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-       .descriptorCount = 1,
-       .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
-       .pImmutableSamplers = NULL}};
+  memcpy(cacheBuffer + header.materialIndexOffset, scene.materialIndexData,
+         sizeof(uint32_t) * scene.primitiveCount);
+  memcpy(cacheBuffer + header.materialOffset, scene.materialData,
+         sizeof(Material) * scene.materialCount);
+  memcpy(cacheBuffer, &header, sizeof(SceneCacheHeader));
 
-  VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .bindingCount = (uint32_t)descriptorSetLayoutBindingList.size(),
-      .pBindings = descriptorSetLayoutBindingList.data()};
+  unmapFile(cacheBuffer, header.fileSize);
 
-  VkDescriptorSetLayout descriptorSetLayoutHandle = VK_NULL_HANDLE;
-  result =
-      vkCreateDescriptorSetLayout(deviceHandle, &descriptorSetLayoutCreateInfo,
-                                  NULL, &descriptorSetLayoutHandle);
+  double optimizeMilliseconds = std::chrono::duration<double, std::milli>(
+                                    std::chrono::steady_clock::now() -
+                                    startTimePoint)
+                                    .count();
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateDescriptorSetLayout");
+  std::cout << "Scene cache: " << scene.vertexCount << " vertices welded to "
+            << sourceVertexIndexList.size() << ", " << 8 * indexSize
+            << " bit indices, in " << optimizeMilliseconds << " ms"
+            << std::endl;
+}
+
+// Quantizes the positions relative to the scene bounds and reports how far
+// the decoded positions are from the float ones
+void quantizeSceneVertices(Scene &scene) {
+  float boundsMin[3] = {0.0f, 0.0f, 0.0f};
+  float boundsMax[3] = {0.0f, 0.0f, 0.0f};
+  for (uint64_t x = 0; x < scene.vertexCount; x++) {
+    for (uint32_t y = 0; y < 3; y++) {
+      float value = scene.vertexData[x * 3 + y];
+      boundsMin[y] = x == 0 ? value : std::min(boundsMin[y], value);
+      boundsMax[y] = x == 0 ? value : std::max(boundsMax[y], value);
+    }
   }
 
-  // =========================================================================
-  // Material Descriptor Set Layout
+  // A flat axis keeps a scale of one, as every value on it encodes to zero
+  float center[3];
+  float extent[3];
+  float boundsSize = 0.0f;
+  for (uint32_t y = 0; y < 3; y++) {
+    center[y] = 0.5f * (boundsMin[y] + boundsMax[y]);
+    extent[y] = 0.5f * (boundsMax[y] - boundsMin[y]);
+    if (extent[y] == 0.0f) {
+      extent[y] = 1.0f;
+    }
 
-  std::vector<VkDescriptorSetLayoutBinding>
-      materialDescriptorSetLayoutBindingList = {
-          {.binding = 0,
-           .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-           .descriptorCount = 1,
-           .stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
-           .pImmutableSamplers = NULL},
-          {.binding = 1,
-           .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-           .descriptorCount = 1,
-           .stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
-           .pImmutableSamplers = NULL}};
+    boundsSize += (boundsMax[y] - boundsMin[y]) * (boundsMax[y] - boundsMin[y]);
+  }
+  boundsSize = std::sqrt(boundsSize);
+
+  uint32_t taskCount =
+      (scene.vertexCount + QUANTIZATION_TASK_VERTEX_COUNT - 1) /
+      QUANTIZATION_TASK_VERTEX_COUNT;
+  std::vector<double> taskErrorSumList(taskCount, 0.0);
+  std::vector<double> taskErrorMaxList(taskCount, 0.0);
+  std::vector<int16_t> quantizedVertexList(scene.vertexCount * 4);
+
+  runTasksInParallel(taskCount, [&](uint32_t taskIndex) {
+    uint64_t vertexBegin = (uint64_t)taskIndex * QUANTIZATION_TASK_VERTEX_COUNT;
+    uint64_t vertexEnd = std::min<uint64_t>(
+        vertexBegin + QUANTIZATION_TASK_VERTEX_COUNT, scene.vertexCount);
+
+    for (uint64_t x = vertexBegin; x < vertexEnd; x++) {
+      double errorSquared = 0.0;
+      for (uint32_t y = 0; y < 3; y++) {
+        float value = scene.vertexData[x * 3 + y];
+        float normalized =
+            std::clamp((value - center[y]) / extent[y], -1.0f, 1.0f);
+        int16_t quantized = (int16_t)std::lround(normalized * 32767.0f);
+
+        // As the device decodes it
+        float decoded = extent[y] * (quantized / 32767.0f) + center[y];
+        errorSquared += (decoded - value) * (decoded - value);
+
+        quantizedVertexList[x * 4 + y] = quantized;
+      }
+      quantizedVertexList[x * 4 + 3] = 0;
 
-  VkDescriptorSetLayoutCreateInfo materialDescriptorSetLayoutCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .bindingCount = (uint32_t)materialDescriptorSetLayoutBindingList.size(),
-      .pBindings = materialDescriptorSetLayoutBindingList.data()};
+      double error = std::sqrt(errorSquared);
+      taskErrorSumList[taskIndex] += error;
+      taskErrorMaxList[taskIndex] =
+          std::max(taskErrorMaxList[taskIndex], error);
+    }
+  });
 
-  VkDescriptorSetLayout materialDescriptorSetLayoutHandle = VK_NULL_HANDLE;
-  result = vkCreateDescriptorSetLayout(
-      deviceHandle, &materialDescriptorSetLayoutCreateInfo, NULL,
-      &materialDescriptorSetLayoutHandle);
+  double errorSum = 0.0;
+  double errorMax = 0.0;
+  for (uint32_t x = 0; x < taskCount; x++) {
+    errorSum += taskErrorSumList[x];
+    errorMax = std::max(errorMax, taskErrorMaxList[x]);
+  }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateDescriptorSetLayout");
+  {
+    std::lock_guard<std::mutex> sceneLock(scene.mutex);
+
+    scene.quantizedVertexList = std::move(quantizedVertexList);
+    for (uint32_t y = 0; y < 3; y++) {
+      for (uint32_t x = 0; x < 4; x++) {
+        scene.quantizationTransform[y][x] =
+            x == y ? extent[y] : (x == 3 ? center[y] : 0.0f);
+      }
+    }
+    scene.isQuantized = true;
   }
+  scene.conditionVariable.notify_all();
+
+  double errorMean = scene.vertexCount > 0 ? errorSum / scene.vertexCount : 0;
+  std::cout << "Vertex quantization: " << SCENE_VERTEX_STRIDE
+            << " bytes per vertex instead of " << sizeof(float) * 3
+            << ", error mean " << errorMean << " max " << errorMax << " ("
+            << (boundsSize > 0.0f ? 100.0 * errorMax / boundsSize : 0.0)
+            << "% of the scene size)" << std::endl;
+}
 
-  // =========================================================================
-  // Allocate Descriptor Sets
+// Spreads the low 10 bits of value out to every third bit
+uint32_t expandMortonBits(uint32_t value) {
+  value &= 0x3FF;
+  value = (value | value << 16) & 0x030000FF;
+  value = (value | value << 8) & 0x0300F00F;
+  value = (value | value << 4) & 0x030C30C3;
+  value = (value | value << 2) & 0x09249249;
+  return value;
+}
 
-  std::vector<VkDescriptorSetLayout> descriptorSetLayoutHandleList = {
-      descriptorSetLayoutHandle, materialDescriptorSetLayoutHandle};
+// Sorts the triangles along a Morton curve through their centroids and splits
+// them into clusters of SCENE_CLUSTER_PRIMITIVE_COUNT, each built into its own
+// bottom level acceleration structure. The scene keeps its triangle order,
+// the shaders look up the scene primitive index of a clustered triangle.
+// Reports how much the cluster bounds add up to against the scene bounds.
+void clusterScenePrimitives(Scene &scene) {
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+
+  float boundsMin[3] = {0.0f, 0.0f, 0.0f};
+  float boundsMax[3] = {0.0f, 0.0f, 0.0f};
+  for (uint64_t x = 0; x < scene.vertexCount; x++) {
+    for (uint32_t y = 0; y < 3; y++) {
+      float value = scene.vertexData[x * 3 + y];
+      boundsMin[y] = x == 0 ? value : std::min(boundsMin[y], value);
+      boundsMax[y] = x == 0 ? value : std::max(boundsMax[y], value);
+    }
+  }
 
-  VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-      .pNext = NULL,
-      .descriptorPool = descriptorPoolHandle,
-      .descriptorSetCount = (uint32_t)descriptorSetLayoutHandleList.size(),
-      .pSetLayouts = descriptorSetLayoutHandleList.data()};
+  auto getSurfaceArea = [](const float *minimum, const float *maximum) {
+    float size[3] = {maximum[0] - minimum[0], maximum[1] - minimum[1],
+                     maximum[2] - minimum[2]};
+    return 2.0f * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+  };
 
-  std::vector<VkDescriptorSet> descriptorSetHandleList =
-      std::vector<VkDescriptorSet>(2, VK_NULL_HANDLE);
+  uint32_t taskCount =
+      (scene.primitiveCount + CLUSTERING_TASK_PRIMITIVE_COUNT - 1) /
+      CLUSTERING_TASK_PRIMITIVE_COUNT;
+
+  // The Morton code of each centroid above its primitive index, so sorting
+  // keeps triangles with the same code in scene order
+  std::vector<uint64_t> primitiveKeyList(scene.primitiveCount);
+
+  runTasksInParallel(taskCount, [&](uint32_t taskIndex) {
+    uint64_t primitiveBegin =
+        (uint64_t)taskIndex * CLUSTERING_TASK_PRIMITIVE_COUNT;
+    uint64_t primitiveEnd = std::min<uint64_t>(
+        primitiveBegin + CLUSTERING_TASK_PRIMITIVE_COUNT, scene.primitiveCount);
+
+    for (uint64_t x = primitiveBegin; x < primitiveEnd; x++) {
+      uint32_t mortonCode = 0;
+      for (uint32_t y = 0; y < 3; y++) {
+        float centroid = 0.0f;
+        for (uint32_t z = 0; z < 3; z++) {
+          uint32_t index =
+              getSceneIndex(scene.indexData, scene.indexSize, x * 3 + z);
+          centroid += scene.vertexData[index * 3 + y] / 3.0f;
+        }
+
+        float extent = boundsMax[y] - boundsMin[y];
+        float normalized =
+            extent > 0.0f ? (centroid - boundsMin[y]) / extent : 0.0f;
+        uint32_t cell =
+            (uint32_t)std::clamp(normalized * 1024.0f, 0.0f, 1023.0f);
+
+        mortonCode |= expandMortonBits(cell) << y;
+      }
 
-  result = vkAllocateDescriptorSets(deviceHandle, &descriptorSetAllocateInfo,
-                                    descriptorSetHandleList.data());
+      primitiveKeyList[x] = (uint64_t)mortonCode << 32 | x;
+    }
+  });
+
+  std::sort(primitiveKeyList.begin(), primitiveKeyList.end());
+
+  uint64_t clusterCount =
+      (scene.primitiveCount + SCENE_CLUSTER_PRIMITIVE_COUNT - 1) /
+      SCENE_CLUSTER_PRIMITIVE_COUNT;
+
+  std::vector<uint32_t> clusterIndexList(
+      (scene.indexSize * scene.indexCount + 3) / 4);
+  std::vector<uint32_t> clusterPrimitiveIndexList(scene.primitiveCount);
+  std::vector<float> clusterSurfaceAreaList(clusterCount, 0.0f);
+
+  // Copy each cluster's triangles in sorted order and measure its bounds
+  runTasksInParallel(clusterCount, [&](uint32_t clusterIndex) {
+    uint64_t primitiveBegin =
+        (uint64_t)clusterIndex * SCENE_CLUSTER_PRIMITIVE_COUNT;
+    uint64_t primitiveEnd = std::min<uint64_t>(
+        primitiveBegin + SCENE_CLUSTER_PRIMITIVE_COUNT, scene.primitiveCount);
+
+    float clusterMin[3] = {0.0f, 0.0f, 0.0f};
+    float clusterMax[3] = {0.0f, 0.0f, 0.0f};
+    for (uint64_t x = primitiveBegin; x < primitiveEnd; x++) {
+      uint32_t primitiveIndex = (uint32_t)primitiveKeyList[x];
+      clusterPrimitiveIndexList[x] = primitiveIndex;
+
+      for (uint32_t z = 0; z < 3; z++) {
+        uint32_t index = getSceneIndex(scene.indexData, scene.indexSize,
+                                       (uint64_t)primitiveIndex * 3 + z);
+        setSceneIndex(clusterIndexList.data(), scene.indexSize, x * 3 + z,
+                      index);
+
+        bool isFirst = x == primitiveBegin && z == 0;
+        for (uint32_t y = 0; y < 3; y++) {
+          float value = scene.vertexData[index * 3 + y];
+          clusterMin[y] = isFirst ? value : std::min(clusterMin[y], value);
+          clusterMax[y] = isFirst ? value : std::max(clusterMax[y], value);
+        }
+      }
+    }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkAllocateDescriptorSets");
-  }
+    clusterSurfaceAreaList[clusterIndex] =
+        getSurfaceArea(clusterMin, clusterMax);
+  });
 
-  // =========================================================================
-  // Pipeline Layout
+  float clusterSurfaceArea = 0.0f;
+  for (float surfaceArea : clusterSurfaceAreaList) {
+    clusterSurfaceArea += surfaceArea;
+  }
+  float sceneSurfaceArea = getSurfaceArea(boundsMin, boundsMax);
 
-  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .setLayoutCount = (uint32_t)descriptorSetLayoutHandleList.size(),
-      .pSetLayouts = descriptorSetLayoutHandleList.data(),
-      .pushConstantRangeCount = 0,
-      .pPushConstantRanges = NULL};
+  {
+    std::lock_guard<std::mutex> sceneLock(scene.mutex);
 
-  VkPipelineLayout pipelineLayoutHandle = VK_NULL_HANDLE;
-  result = vkCreatePipelineLayout(deviceHandle, &pipelineLayoutCreateInfo, NULL,
-                                  &pipelineLayoutHandle);
+    scene.clusterIndexList = std::move(clusterIndexList);
+    scene.clusterPrimitiveIndexList = std::move(clusterPrimitiveIndexList);
+    scene.clusterCount = clusterCount;
+    scene.isClustered = true;
+  }
+  scene.conditionVariable.notify_all();
+
+  double clusterMilliseconds = std::chrono::duration<double, std::milli>(
+                                   std::chrono::steady_clock::now() -
+                                   startTimePoint)
+                                   .count();
+
+  std::cout << "Clusters: " << clusterCount << " of up to "
+            << SCENE_CLUSTER_PRIMITIVE_COUNT << " triangles, bounds surface "
+            << (sceneSurfaceArea > 0.0f ? clusterSurfaceArea / sceneSurfaceArea
+                                        : 0.0f)
+            << " times the scene's, in " << clusterMilliseconds << " ms"
+            << std::endl;
+}
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreatePipelineLayout");
+// Loads the scene from <objFileName>.cache when the cache was generated from
+// an OBJ of the same size and write time. Otherwise parses the OBJ, renders
+// it as parsed and writes the optimized cache for the next run. Changes to the
+// MTL alone need the cache deleted.
+// Other threads can wait for parts of the scene while this runs, see
+// waitForSceneSize and waitForSceneRange.
+void loadScene(const std::string &objFileName, Scene &scene) {
+  std::string cacheFileName = objFileName + ".cache";
+
+  std::error_code errorCode;
+  uint64_t sourceFileSize = std::filesystem::file_size(objFileName, errorCode);
+  int64_t sourceWriteTime =
+      std::filesystem::last_write_time(objFileName, errorCode)
+          .time_since_epoch()
+          .count();
+
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  if (loadSceneCache(cacheFileName, sourceFileSize, sourceWriteTime, scene)) {
+    scene.rangeList = {{.vertexOffset = 0,
+                        .vertexCount = scene.vertexCount,
+                        .primitiveOffset = 0,
+                        .primitiveCount = scene.primitiveCount}};
+    scene.isRangeReadyList = {true};
+    scene.isSizeKnown = true;
+
+    sceneLock.unlock();
+    scene.conditionVariable.notify_all();
+
+    std::cout << "Scene: " << scene.primitiveCount << " triangles from "
+              << cacheFileName << std::endl;
+
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+    quantizeSceneVertices(scene);
+#endif
+#if defined(BLAS_CLUSTERING_ENABLED)
+    clusterScenePrimitives(scene);
+#endif
+    return;
   }
+  sceneLock.unlock();
 
-  // =========================================================================
-  // Ray Closest Hit Shader Module
+  parseSceneOBJ(objFileName, cacheFileName + ".tmp", scene);
 
-  std::ifstream rayClosestHitFile("shaders/shader.rchit.spv",
-                                  std::ios::binary | std::ios::ate);
-  std::streamsize rayClosestHitFileSize = rayClosestHitFile.tellg();
-  rayClosestHitFile.seekg(0, std::ios::beg);
-  std::vector<uint32_t> rayClosestHitShaderSource(rayClosestHitFileSize /
-                                                  sizeof(uint32_t));
-
-  rayClosestHitFile.read(
-      reinterpret_cast<char *>(rayClosestHitShaderSource.data()),
-      rayClosestHitFileSize);
+  std::cout << "Scene: " << scene.primitiveCount << " triangles from "
+            << objFileName << std::endl;
 
-  rayClosestHitFile.close();
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+  quantizeSceneVertices(scene);
+#endif
+#if defined(BLAS_CLUSTERING_ENABLED)
+  clusterScenePrimitives(scene);
+#endif
 
-  VkShaderModuleCreateInfo rayClosestHitShaderModuleCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .codeSize = (uint32_t)rayClosestHitShaderSource.size() * sizeof(uint32_t),
-      .pCode = rayClosestHitShaderSource.data()};
+  writeOptimizedSceneCache(cacheFileName, sourceFileSize, sourceWriteTime,
+                           scene);
+}
 
-  VkShaderModule rayClosestHitShaderModuleHandle = VK_NULL_HANDLE;
-  result =
-      vkCreateShaderModule(deviceHandle, &rayClosestHitShaderModuleCreateInfo,
-                           NULL, &rayClosestHitShaderModuleHandle);
+// Called by the thread loading the scene when loadScene throws, so that the
+// threads waiting on the scene throw instead of blocking
+void failSceneLoad(Scene &scene) {
+  {
+    std::lock_guard<std::mutex> sceneLock(scene.mutex);
+    scene.isLoadFailed = true;
+  }
+  scene.conditionVariable.notify_all();
+}
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateShaderModule");
+// Throws from a wait that was woken by failSceneLoad, with the scene locked
+void checkSceneLoad(const Scene &scene) {
+  if (scene.isLoadFailed) {
+    throw std::runtime_error("Scene: loading failed");
   }
+}
 
-  // =========================================================================
-  // Ray Generate Shader Module
+// Blocks until the scene's counts, materials and ranges are known
+void waitForSceneSize(Scene &scene) {
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  scene.conditionVariable.wait(
+      sceneLock, [&]() { return scene.isSizeKnown || scene.isLoadFailed; });
+  checkSceneLoad(scene);
+}
 
-  std::ifstream rayGenerateFile("shaders/shader.rgen.spv",
-                                std::ios::binary | std::ios::ate);
-  std::streamsize rayGenerateFileSize = rayGenerateFile.tellg();
-  rayGenerateFile.seekg(0, std::ios::beg);
-  std::vector<uint32_t> rayGenerateShaderSource(rayGenerateFileSize /
-                                                sizeof(uint32_t));
+// Blocks until the data of one range of the scene has been written
+void waitForSceneRange(Scene &scene, uint32_t rangeIndex) {
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  scene.conditionVariable.wait(sceneLock, [&]() {
+    return scene.isRangeReadyList[rangeIndex] || scene.isLoadFailed;
+  });
+  checkSceneLoad(scene);
+}
 
-  rayGenerateFile.read(reinterpret_cast<char *>(rayGenerateShaderSource.data()),
-                       rayGenerateFileSize);
+// Blocks until the quantized positions have been written
+void waitForSceneQuantization(Scene &scene) {
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  scene.conditionVariable.wait(
+      sceneLock, [&]() { return scene.isQuantized || scene.isLoadFailed; });
+  checkSceneLoad(scene);
+}
 
-  rayGenerateFile.close();
+// Blocks until the triangles have been sorted into clusters
+void waitForSceneClusters(Scene &scene) {
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  scene.conditionVariable.wait(
+      sceneLock, [&]() { return scene.isClustered || scene.isLoadFailed; });
+  checkSceneLoad(scene);
+}
 
-  VkShaderModuleCreateInfo rayGenerateShaderModuleCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .codeSize = (uint32_t)rayGenerateShaderSource.size() * sizeof(uint32_t),
-      .pCode = rayGenerateShaderSource.data()};
+void unloadScene(Scene &scene) {
+  if (scene.mappedFileBuffer != NULL) {
+    unmapFile(scene.mappedFileBuffer, scene.mappedFileSize);
+    scene.mappedFileBuffer = NULL;
+  }
 
-  VkShaderModule rayGenerateShaderModuleHandle = VK_NULL_HANDLE;
-  result =
-      vkCreateShaderModule(deviceHandle, &rayGenerateShaderModuleCreateInfo,
-                           NULL, &rayGenerateShaderModuleHandle);
+  if (!scene.temporaryFileName.empty()) {
+    std::error_code errorCode;
+    std::filesystem::remove(scene.temporaryFileName, errorCode);
+    scene.temporaryFileName.clear();
+  }
+}
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateShaderModule");
+// Model space bounds of one of the scene's clusters, minimum then maximum
+void getSceneClusterBounds(const Scene &scene, uint64_t clusterIndex,
+                           float *clusterBounds) {
+  uint64_t firstIndex = clusterIndex * SCENE_CLUSTER_PRIMITIVE_COUNT * 3;
+  uint64_t lastIndex = std::min<uint64_t>(
+      firstIndex + SCENE_CLUSTER_PRIMITIVE_COUNT * 3, scene.indexCount);
+
+  for (uint64_t x = firstIndex; x < lastIndex; x++) {
+    const float *vertex =
+        &scene.vertexData[3 * (uint64_t)getSceneIndex(
+                                  scene.clusterIndexList.data(),
+                                  scene.indexSize, x)];
+
+    for (uint32_t y = 0; y < 3; y++) {
+      clusterBounds[y] =
+          x == firstIndex ? vertex[y] : std::min(clusterBounds[y], vertex[y]);
+      clusterBounds[y + 3] = x == firstIndex
+                                 ? vertex[y]
+                                 : std::max(clusterBounds[y + 3], vertex[y]);
+    }
   }
+}
 
-  // =========================================================================
-  // Ray Miss Shader Module
+// Writes the center of a cluster's bounding sphere relative to the camera to
+// offset and returns the sphere's radius. The model is rotated by yaw about
+// the y axis, like the instance transform.
+float getClusterCameraOffset(const float *clusterBounds,
+                             const float *cameraPosition, float yaw,
+                             float *offset) {
+  float center[3];
+  float radius = 0.0f;
+  for (uint32_t x = 0; x < 3; x++) {
+    center[x] = (clusterBounds[x] + clusterBounds[x + 3]) * 0.5f;
+    radius += powf((clusterBounds[x + 3] - clusterBounds[x]) * 0.5f, 2);
+  }
 
-  std::ifstream rayMissFile("shaders/shader.rmiss.spv",
-                            std::ios::binary | std::ios::ate);
-  std::streamsize rayMissFileSize = rayMissFile.tellg();
-  rayMissFile.seekg(0, std::ios::beg);
-  std::vector<uint32_t> rayMissShaderSource(rayMissFileSize / sizeof(uint32_t));
+  offset[0] = cosf(yaw) * center[0] + sinf(yaw) * center[2] - cameraPosition[0];
+  offset[1] = center[1] - cameraPosition[1];
+  offset[2] =
+      -sinf(yaw) * center[0] + cosf(yaw) * center[2] - cameraPosition[2];
 
-  rayMissFile.read(reinterpret_cast<char *>(rayMissShaderSource.data()),
-                   rayMissFileSize);
+  return sqrtf(radius);
+}
 
-  rayMissFile.close();
+// Simplified versions of the scene's clusters for LOD_ENABLED. Mesh
+// level * clusterCount + cluster is one cluster at one level of detail. Level
+// 0 is the cluster itself, in the scene's cluster lists. Each further level
+// snaps the previous one's vertices to a grid half as fine and drops the
+// triangles that collapse, keeping the previous level if all of them do. Its
+// indices (indexSize each) reuse the scene's vertices, and its primitive
+// indices name the scene triangle each came from.
+struct SceneLevelsOfDetail {
+  std::vector<uint32_t> indexList;
+  std::vector<uint32_t> primitiveIndexList;
+
+  // First triangle of every mesh, in the scene's cluster lists for level 0 and
+  // in the lists above for the others, and its triangle count
+  std::vector<uint64_t> meshPrimitiveOffsetList;
+  std::vector<uint32_t> meshPrimitiveCountList;
+
+  // Model space bounds of every cluster, minimum then maximum
+  std::vector<float> clusterBoundsList;
+};
+
+// Simplifies every cluster on its own thread by vertex clustering. The first
+// simplified level has LOD_GRID_RESOLUTION cells across the cluster's bounds.
+void buildSceneLevelsOfDetail(const Scene &scene,
+                              SceneLevelsOfDetail &levelsOfDetail) {
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+
+  uint64_t meshCount = scene.clusterCount * LOD_COUNT;
+  levelsOfDetail.meshPrimitiveOffsetList.resize(meshCount);
+  levelsOfDetail.meshPrimitiveCountList.resize(meshCount);
+  levelsOfDetail.clusterBoundsList.resize(scene.clusterCount * 6);
+
+  // Full 32 bit indices and primitive indices of every simplified mesh,
+  // packed level by level once every cluster is done
+  std::vector<std::vector<uint32_t>> meshIndexListList(meshCount);
+  std::vector<std::vector<uint32_t>> meshPrimitiveIndexListList(meshCount);
+
+  uint32_t threadCount =
+      runTasksInParallel(scene.clusterCount, [&](uint32_t clusterIndex) {
+        float *clusterBounds =
+            &levelsOfDetail.clusterBoundsList[clusterIndex * 6];
+        getSceneClusterBounds(scene, clusterIndex, clusterBounds);
+
+        float diagonal = 0.0f;
+        for (uint32_t x = 0; x < 3; x++) {
+          diagonal += powf(clusterBounds[x + 3] - clusterBounds[x], 2);
+        }
+        diagonal = sqrtf(diagonal);
+
+        uint64_t firstPrimitive =
+            (uint64_t)clusterIndex * SCENE_CLUSTER_PRIMITIVE_COUNT;
+        uint32_t primitiveCount = (uint32_t)std::min<uint64_t>(
+            SCENE_CLUSTER_PRIMITIVE_COUNT,
+            scene.primitiveCount - firstPrimitive);
+
+        levelsOfDetail.meshPrimitiveOffsetList[clusterIndex] = firstPrimitive;
+        levelsOfDetail.meshPrimitiveCountList[clusterIndex] = primitiveCount;
+
+        std::vector<uint32_t> indexList(primitiveCount * 3);
+        std::vector<uint32_t> primitiveIndexList(primitiveCount);
+        for (uint32_t x = 0; x < primitiveCount; x++) {
+          for (uint32_t y = 0; y < 3; y++) {
+            indexList[x * 3 + y] =
+                getSceneIndex(scene.clusterIndexList.data(), scene.indexSize,
+                              (firstPrimitive + x) * 3 + y);
+          }
+          primitiveIndexList[x] =
+              scene.clusterPrimitiveIndexList[firstPrimitive + x];
+        }
+
+        // The first vertex found in a cell stands in for all of the cell's
+        std::unordered_map<uint64_t, uint32_t> cellVertexMap;
+
+        for (uint32_t level = 1; level < LOD_COUNT; level++) {
+          float cellSize =
+              diagonal / std::max(LOD_GRID_RESOLUTION >> (level - 1), 1);
+
+          std::vector<uint32_t> levelIndexList;
+          std::vector<uint32_t> levelPrimitiveIndexList;
+          cellVertexMap.clear();
+
+          for (uint32_t x = 0; cellSize > 0.0f && x < primitiveIndexList.size();
+               x++) {
+            uint32_t cellIndexList[3];
+            for (uint32_t y = 0; y < 3; y++) {
+              const float *vertex =
+                  &scene.vertexData[3 * (uint64_t)indexList[x * 3 + y]];
+
+              uint64_t cellKey = 0;
+              for (uint32_t z = 0; z < 3; z++) {
+                cellKey = cellKey << 21 |
+                          ((uint64_t)((vertex[z] - clusterBounds[z]) /
+                                      cellSize) &
+                           0x1FFFFF);
+              }
+
+              cellIndexList[y] =
+                  cellVertexMap.try_emplace(cellKey, indexList[x * 3 + y])
+                      .first->second;
+            }
+
+            if (cellIndexList[0] != cellIndexList[1] &&
+                cellIndexList[1] != cellIndexList[2] &&
+                cellIndexList[2] != cellIndexList[0]) {
+              levelIndexList.insert(levelIndexList.end(), cellIndexList,
+                                    cellIndexList + 3);
+              levelPrimitiveIndexList.push_back(primitiveIndexList[x]);
+            }
+          }
+
+          if (!levelPrimitiveIndexList.empty()) {
+            indexList.swap(levelIndexList);
+            primitiveIndexList.swap(levelPrimitiveIndexList);
+          }
+
+          uint64_t meshIndex = level * scene.clusterCount + clusterIndex;
+          meshIndexListList[meshIndex] = indexList;
+          meshPrimitiveIndexListList[meshIndex] = primitiveIndexList;
+        }
+      });
+
+  std::vector<uint64_t> levelPrimitiveCountList(LOD_COUNT, 0);
+  levelPrimitiveCountList[0] = scene.primitiveCount;
+
+  uint64_t primitiveCount = 0;
+  for (uint64_t x = scene.clusterCount; x < meshCount; x++) {
+    levelsOfDetail.meshPrimitiveOffsetList[x] = primitiveCount;
+    levelsOfDetail.meshPrimitiveCountList[x] =
+        (uint32_t)meshPrimitiveIndexListList[x].size();
+
+    primitiveCount += meshPrimitiveIndexListList[x].size();
+    levelPrimitiveCountList[x / scene.clusterCount] +=
+        meshPrimitiveIndexListList[x].size();
+  }
 
-  VkShaderModuleCreateInfo rayMissShaderModuleCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .codeSize = (uint32_t)rayMissShaderSource.size() * sizeof(uint32_t),
-      .pCode = rayMissShaderSource.data()};
+  levelsOfDetail.indexList.resize(
+      (scene.indexSize * primitiveCount * 3 + 3) / 4);
+  levelsOfDetail.primitiveIndexList.resize(primitiveCount);
 
-  VkShaderModule rayMissShaderModuleHandle = VK_NULL_HANDLE;
-  result = vkCreateShaderModule(deviceHandle, &rayMissShaderModuleCreateInfo,
-                                NULL, &rayMissShaderModuleHandle);
+  for (uint64_t x = scene.clusterCount; x < meshCount; x++) {
+    uint64_t meshPrimitiveOffset = levelsOfDetail.meshPrimitiveOffsetList[x];
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateShaderModule");
+    for (uint64_t y = 0; y < meshIndexListList[x].size(); y++) {
+      setSceneIndex(levelsOfDetail.indexList.data(), scene.indexSize,
+                    meshPrimitiveOffset * 3 + y, meshIndexListList[x][y]);
+    }
+
+    std::copy(meshPrimitiveIndexListList[x].begin(),
+              meshPrimitiveIndexListList[x].end(),
+              levelsOfDetail.primitiveIndexList.begin() + meshPrimitiveOffset);
   }
 
-  // =========================================================================
-  // Ray Miss Shader Module (Shadow)
+  double levelOfDetailMilliseconds = std::chrono::duration<double, std::milli>(
+                                         std::chrono::steady_clock::now() -
+                                         startTimePoint)
+                                         .count();
 
-  std::ifstream rayMissShadowFile("shaders/shader_shadow.rmiss.spv",
-                                  std::ios::binary | std::ios::ate);
-  std::streamsize rayMissShadowFileSize = rayMissShadowFile.tellg();
-  rayMissShadowFile.seekg(0, std::ios::beg);
-  std::vector<uint32_t> rayMissShadowShaderSource(rayMissShadowFileSize /
-                                                  sizeof(uint32_t));
+  std::cout << "LOD: " << LOD_COUNT << " levels of " << scene.clusterCount
+            << " clusters in " << levelOfDetailMilliseconds << " ms on "
+            << threadCount << " threads" << std::endl;
 
-  rayMissShadowFile.read(
-      reinterpret_cast<char *>(rayMissShadowShaderSource.data()),
-      rayMissShadowFileSize);
+  for (uint32_t x = 0; x < LOD_COUNT; x++) {
+    std::cout << "  level " << x << ": " << levelPrimitiveCountList[x]
+              << " triangles ("
+              << 100.0 * levelPrimitiveCountList[x] / scene.primitiveCount
+              << "%)" << std::endl;
+  }
+}
 
-  rayMissShadowFile.close();
+std::string getPhysicalDeviceUUIDString(VkPhysicalDevice physicalDeviceHandle) {
+  VkPhysicalDeviceIDProperties physicalDeviceIDProperties = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+      .pNext = NULL};
 
-  VkShaderModuleCreateInfo rayMissShadowShaderModuleCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .codeSize = (uint32_t)rayMissShadowShaderSource.size() * sizeof(uint32_t),
-      .pCode = rayMissShadowShaderSource.data()};
+  VkPhysicalDeviceProperties2 physicalDeviceProperties2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &physicalDeviceIDProperties};
 
-  VkShaderModule rayMissShadowShaderModuleHandle = VK_NULL_HANDLE;
-  result =
-      vkCreateShaderModule(deviceHandle, &rayMissShadowShaderModuleCreateInfo,
-                           NULL, &rayMissShadowShaderModuleHandle);
+  vkGetPhysicalDeviceProperties2(physicalDeviceHandle,
+                                 &physicalDeviceProperties2);
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateShaderModule");
+  std::string uuidString;
+  for (uint32_t x = 0; x < VK_UUID_SIZE; x++) {
+    char hexString[3];
+    snprintf(hexString, sizeof(hexString), "%02x",
+             physicalDeviceIDProperties.deviceUUID[x]);
+    uuidString += hexString;
   }
 
-  // =========================================================================
-  // Ray Tracing Pipeline
-
-  std::vector<VkPipelineShaderStageCreateInfo>
-      pipelineShaderStageCreateInfoList = {
-          {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-           .pNext = NULL,
-           .flags = 0,
-           .stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
-           .module = rayClosestHitShaderModuleHandle,
-           .pName = "main",
-           .pSpecializationInfo = NULL},
-          {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-           .pNext = NULL,
-           .flags = 0,
-           .stage = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
-           .module = rayGenerateShaderModuleHandle,
-           .pName = "main",
-           .pSpecializationInfo = NULL},
-          {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-           .pNext = NULL,
-           .flags = 0,
-           .stage = VK_SHADER_STAGE_MISS_BIT_KHR,
-           .module = rayMissShaderModuleHandle,
-           .pName = "main",
-           .pSpecializationInfo = NULL},
-          {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-           .pNext = NULL,
-           .flags = 0,
-           .stage = VK_SHADER_STAGE_MISS_BIT_KHR,
-           .module = rayMissShadowShaderModuleHandle,
-           .pName = "main",
-           .pSpecializationInfo = NULL}};
+  return uuidString;
+}
 
-  std::vector<VkRayTracingShaderGroupCreateInfoKHR>
-      rayTracingShaderGroupCreateInfoList = {
-          {.sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
-           .pNext = NULL,
-           .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR,
-           .generalShader = VK_SHADER_UNUSED_KHR,
-           .closestHitShader = 0,
-           .anyHitShader = VK_SHADER_UNUSED_KHR,
-           .intersectionShader = VK_SHADER_UNUSED_KHR,
-           .pShaderGroupCaptureReplayHandle = NULL},
-          {.sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
-           .pNext = NULL,
-           .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR,
-           .generalShader = 1,
-           .closestHitShader = VK_SHADER_UNUSED_KHR,
-           .anyHitShader = VK_SHADER_UNUSED_KHR,
-           .intersectionShader = VK_SHADER_UNUSED_KHR,
-           .pShaderGroupCaptureReplayHandle = NULL},
-          {.sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
-           .pNext = NULL,
-           .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR,
-           .generalShader = 2,
-           .closestHitShader = VK_SHADER_UNUSED_KHR,
-           .anyHitShader = VK_SHADER_UNUSED_KHR,
-           .intersectionShader = VK_SHADER_UNUSED_KHR,
-           .pShaderGroupCaptureReplayHandle = NULL},
-          {.sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
-           .pNext = NULL,
-           .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR,
-           .generalShader = 3,
-           .closestHitShader = VK_SHADER_UNUSED_KHR,
-           .anyHitShader = VK_SHADER_UNUSED_KHR,
-           .intersectionShader = VK_SHADER_UNUSED_KHR,
-           .pShaderGroupCaptureReplayHandle = NULL}};
+// Returns -1 if the device is missing a required extension, feature or queue
+// family. Otherwise devices are ranked by type, then device local memory, then
+// ray tracing properties.
+int64_t scorePhysicalDevice(
+    VkPhysicalDevice physicalDeviceHandle, VkSurfaceKHR surfaceHandle,
+    const std::vector<const char *> &deviceExtensionList) {
 
-  VkRayTracingPipelineCreateInfoKHR rayTracingPipelineCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR,
-      .pNext = NULL,
-      .flags = 0,
-      .stageCount = 4,
-      .pStages = pipelineShaderStageCreateInfoList.data(),
-      .groupCount = 4,
-      .pGroups = rayTracingShaderGroupCreateInfoList.data(),
-      .maxPipelineRayRecursionDepth = 1,
-      .pLibraryInfo = NULL,
-      .pLibraryInterface = NULL,
-      .pDynamicState = NULL,
-      .layout = pipelineLayoutHandle,
-      .basePipelineHandle = VK_NULL_HANDLE,
-      .basePipelineIndex = 0};
+  VkResult result;
 
-  VkPipeline rayTracingPipelineHandle = VK_NULL_HANDLE;
-  result = pvkCreateRayTracingPipelinesKHR(
-      deviceHandle, VK_NULL_HANDLE, VK_NULL_HANDLE, 1,
-      &rayTracingPipelineCreateInfo, NULL, &rayTracingPipelineHandle);
+  uint32_t extensionPropertyCount = 0;
+  result = vkEnumerateDeviceExtensionProperties(
+      physicalDeviceHandle, NULL, &extensionPropertyCount, NULL);
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateRayTracingPipelinesKHR");
+    throwExceptionVulkanAPI(result, "vkEnumerateDeviceExtensionProperties");
   }
 
-  // =========================================================================
-  // OBJ Model
+  std::vector<VkExtensionProperties> extensionPropertiesList(
+      extensionPropertyCount);
+  result = vkEnumerateDeviceExtensionProperties(
+      physicalDeviceHandle, NULL, &extensionPropertyCount,
+      extensionPropertiesList.data());
 
-  tinyobj::ObjReaderConfig reader_config;
-  tinyobj::ObjReader reader;
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEnumerateDeviceExtensionProperties");
+  }
 
-  if (!reader.ParseFromFile("resources/cube_scene.obj", reader_config)) {
-    if (!reader.Error().empty()) {
-      std::cerr << "TinyObjReader: " << reader.Error();
+  for (const char *extensionName : deviceExtensionList) {
+    bool isExtensionSupported = false;
+    for (VkExtensionProperties &extensionProperties : extensionPropertiesList) {
+      if (strcmp(extensionProperties.extensionName, extensionName) == 0) {
+        isExtensionSupported = true;
+        break;
+      }
     }
-    exit(1);
-  }
 
-  if (!reader.Warning().empty()) {
-    std::cout << "TinyObjReader: " << reader.Warning();
+    if (!isExtensionSupported) {
+      return -1;
+    }
   }
 
-  const tinyobj::attrib_t &attrib = reader.GetAttrib();
-  const std::vector<tinyobj::shape_t> &shapes = reader.GetShapes();
-  const std::vector<tinyobj::material_t> &materials = reader.GetMaterials();
-
-  uint32_t primitiveCount = 0;
-  std::vector<uint32_t> indexList;
-  for (tinyobj::shape_t shape : shapes) {
+  VkPhysicalDeviceTimelineSemaphoreFeatures
+      physicalDeviceTimelineSemaphoreFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+          .pNext = NULL};
 
-    primitiveCount += shape.mesh.num_face_vertices.size();
+  VkPhysicalDeviceBufferDeviceAddressFeatures
+      physicalDeviceBufferDeviceAddressFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES,
+          .pNext = &physicalDeviceTimelineSemaphoreFeatures};
 
-    for (tinyobj::index_t index : shape.mesh.indices) {
-      indexList.push_back(index.vertex_index);
-    }
-  }
+  VkPhysicalDeviceAccelerationStructureFeaturesKHR
+      physicalDeviceAccelerationStructureFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+          .pNext = &physicalDeviceBufferDeviceAddressFeatures};
 
-  // =========================================================================
-  // Vertex Buffer
+  VkPhysicalDeviceRayTracingPipelineFeaturesKHR
+      physicalDeviceRayTracingPipelineFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR,
+          .pNext = &physicalDeviceAccelerationStructureFeatures};
 
-  VkBufferCreateInfo vertexBufferCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .size = sizeof(float) * attrib.vertices.size() * 3,
-      .usage =
-          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
-          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-      .queueFamilyIndexCount = 1,
-      .pQueueFamilyIndices = &queueFamilyIndex};
+  VkPhysicalDeviceFeatures2 physicalDeviceFeatures2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &physicalDeviceRayTracingPipelineFeatures};
 
-  VkBuffer vertexBufferHandle = VK_NULL_HANDLE;
-  result = vkCreateBuffer(deviceHandle, &vertexBufferCreateInfo, NULL,
-                          &vertexBufferHandle);
+  vkGetPhysicalDeviceFeatures2(physicalDeviceHandle, &physicalDeviceFeatures2);
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  if (!physicalDeviceTimelineSemaphoreFeatures.timelineSemaphore ||
+      !physicalDeviceBufferDeviceAddressFeatures.bufferDeviceAddress ||
+      !physicalDeviceAccelerationStructureFeatures.accelerationStructure ||
+      !physicalDeviceRayTracingPipelineFeatures.rayTracingPipeline ||
+      !physicalDeviceFeatures2.features.geometryShader) {
+    return -1;
   }
 
-  VkMemoryRequirements vertexMemoryRequirements;
-  vkGetBufferMemoryRequirements(deviceHandle, vertexBufferHandle,
-                                &vertexMemoryRequirements);
+  uint32_t queueFamilyPropertyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDeviceHandle,
+                                           &queueFamilyPropertyCount, NULL);
 
-  uint32_t vertexMemoryTypeIndex = -1;
-  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
-       x++) {
-    if ((vertexMemoryRequirements.memoryTypeBits & (1 << x)) &&
-        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
+  std::vector<VkQueueFamilyProperties> queueFamilyPropertiesList(
+      queueFamilyPropertyCount);
+
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDeviceHandle,
+                                           &queueFamilyPropertyCount,
+                                           queueFamilyPropertiesList.data());
+
+  bool isQueueFamilyFound = false;
+  for (uint32_t x = 0; x < queueFamilyPropertiesList.size(); x++) {
+    if (queueFamilyPropertiesList[x].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+
+      VkBool32 isPresentSupported = false;
+      result = vkGetPhysicalDeviceSurfaceSupportKHR(
+          physicalDeviceHandle, x, surfaceHandle, &isPresentSupported);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkGetPhysicalDeviceSurfaceSupportKHR");
+      }
+
+      if (isPresentSupported) {
+        isQueueFamilyFound = true;
+        break;
+      }
+    }
+  }
+
+  if (!isQueueFamilyFound) {
+    return -1;
+  }
+
+  VkPhysicalDeviceRayTracingPipelinePropertiesKHR
+      physicalDeviceRayTracingPipelineProperties = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR,
+          .pNext = NULL};
+
+  VkPhysicalDeviceProperties2 physicalDeviceProperties2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &physicalDeviceRayTracingPipelineProperties};
+
+  vkGetPhysicalDeviceProperties2(physicalDeviceHandle,
+                                 &physicalDeviceProperties2);
+
+  VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDeviceHandle,
+                                      &physicalDeviceMemoryProperties);
+
+  int64_t deviceTypeScore = 0;
+  switch (physicalDeviceProperties2.properties.deviceType) {
+  case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+    deviceTypeScore = 4;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+    deviceTypeScore = 3;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+    deviceTypeScore = 2;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_CPU:
+    deviceTypeScore = 1;
+    break;
+  default:
+    break;
+  }
+
+  VkDeviceSize deviceLocalHeapSize = 0;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryHeapCount;
+       x++) {
+    if (physicalDeviceMemoryProperties.memoryHeaps[x].flags &
+        VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      deviceLocalHeapSize = std::max(
+          deviceLocalHeapSize, physicalDeviceMemoryProperties.memoryHeaps[x].size);
+    }
+  }
+
+  int64_t deviceLocalHeapScore =
+      std::min<int64_t>(deviceLocalHeapSize / (1024 * 1024), 0xFFFFFFFF);
+  int64_t rayRecursionDepthScore = std::min<int64_t>(
+      physicalDeviceRayTracingPipelineProperties.maxRayRecursionDepth, 0xFF);
+  int64_t shaderGroupHandleSizeScore =
+      0xFF - std::min<int64_t>(
+                 physicalDeviceRayTracingPipelineProperties.shaderGroupHandleSize,
+                 0xFF);
+
+  return (deviceTypeScore << 48) | (deviceLocalHeapScore << 16) |
+         (rayRecursionDepthScore << 8) | shaderGroupHandleSizeScore;
+}
+
+bool exitWindow = false;
+static bool isMoveForward = false, isMoveBack = false;
+static bool isTurnLeft = false, isTurnRight = false;
+static bool isWindowResized = false;
+static bool isRotateModel = false;
+static bool isHeatmapWriteRequested = false;
+static bool isMemoryReportRequested = false;
+
+#if defined(PLATFORM_WINDOWS)
+LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+  if (uMsg == WM_KEYDOWN) {
+    switch (wParam) {
+    case VK_UP:
+      isMoveForward = true;
+      break;
+    case VK_DOWN:
+      isMoveBack = true;
+      break;
+    case VK_LEFT:
+      isTurnLeft = true;
+      break;
+    case VK_RIGHT:
+      isTurnRight = true;
+      break;
+    case 'R':
+      isRotateModel = true;
+      break;
+    case 'M':
+      isMemoryReportRequested = true;
+      break;
+#if defined(HEATMAP_ENABLED)
+    case 'H':
+      isHeatmapWriteRequested = true;
+      break;
+#endif
+    case VK_ESCAPE:
+      exitWindow = true;
+      break;
+    default:
+      break;
+    }
+  }
+  else if (uMsg == WM_KEYUP) {
+    switch (wParam) {
+    case VK_UP:
+      isMoveForward = false;
+      break;
+    case VK_DOWN:
+      isMoveBack = false;
+      break;
+    case VK_LEFT:
+      isTurnLeft = false;
+      break;
+    case VK_RIGHT:
+      isTurnRight = false;
+      break;
+    case 'R':
+      isRotateModel = false;
+      break;
+    default:
+      break;
+    }
+  } else if (uMsg == WM_SIZE) {
+    isWindowResized = true;
+  } else if (uMsg == WM_CLOSE) {
+    exitWindow = true;
+  }
+
+  return (DefWindowProc(hWnd, uMsg, wParam, lParam));
+}
+
+_Use_decl_annotations_ int APIENTRY WinMain(HINSTANCE hInstance,
+                                            HINSTANCE hPrevInstance,
+                                            LPSTR pCmdLine,
+                                            int nCmdShow) {
+#else
+void handleEvent(Display *displayPtr, XEvent *eventPtr) {
+  if (eventPtr->type == KeyPress) {
+    int keySymCount = 0;
+    KeySym *keySym = XGetKeyboardMapping(displayPtr, eventPtr->xkey.keycode, 1,
+                                         &keySymCount);
+    switch (*keySym) {
+    case XK_Up:
+      isMoveForward = true;
+      break;
+    case XK_Down:
+      isMoveBack = true;
+      break;
+    case XK_Left:
+      isTurnLeft = true;
+      break;
+    case XK_Right:
+      isTurnRight = true;
+      break;
+    case XK_r:
+      isRotateModel = true;
+      break;
+    case XK_m:
+      isMemoryReportRequested = true;
+      break;
+#if defined(HEATMAP_ENABLED)
+    case XK_h:
+      isHeatmapWriteRequested = true;
+      break;
+#endif
+    case XK_Escape:
+      exitWindow = true;
+      break;
+    default:
+      break;
+    }
+
+    free(keySym);
+  }
+  else if (eventPtr->type == KeyRelease) {
+    int keySymCount = 0;
+    KeySym *keySym = XGetKeyboardMapping(displayPtr, eventPtr->xkey.keycode, 1,
+                                         &keySymCount);
+
+    switch (*keySym) {
+    case XK_Up:
+      isMoveForward = false;
+      break;
+    case XK_Down:
+      isMoveBack = false;
+      break;
+    case XK_Left:
+      isTurnLeft = false;
+      break;
+    case XK_Right:
+      isTurnRight = false;
+      break;
+    case XK_r:
+      isRotateModel = false;
+      break;
+    default:
+      break;
+    }
+
+    free(keySym);
+  }
+  else if (eventPtr->type == ConfigureNotify) {
+    isWindowResized = true;
+  }
+}
+
+int main() {
+#endif
+  VkResult result;
+
+  TraceSection mainTraceSection = {.trackIndex = addTraceTrack("Main thread")};
+  uint32_t graphicsQueueTraceTrackIndex = addTraceTrack("Graphics queue");
+  uint32_t computeQueueTraceTrackIndex = addTraceTrack("Compute queue");
+
+  // =========================================================================
+  // Window
+
+  beginTraceSection(mainTraceSection, "Window");
+
+#if defined(PLATFORM_LINUX)
+  Display *displayPtr = XOpenDisplay(NULL);
+  int screen = DefaultScreen(displayPtr);
+
+  Window windowLinux = XCreateSimpleWindow(
+      displayPtr, RootWindow(displayPtr, screen), 10, 10, 100, 100, 1,
+      BlackPixel(displayPtr, screen), WhitePixel(displayPtr, screen));
+
+  XSelectInput(displayPtr, windowLinux, ExposureMask | KeyPressMask |
+                                        KeyReleaseMask | StructureNotifyMask);
+  XMapWindow(displayPtr, windowLinux);
+#elif defined(PLATFORM_WINDOWS)
+  WNDCLASS wc = {
+    .lpfnWndProc = WindowProc,
+    .hInstance = hInstance,
+    .lpszClassName = "WINDOW_CLASS"};
+
+  if (!RegisterClass(&wc)) {
+    throwExceptionVulkanAPI((VkResult)0, "RegisterClass");
+  }
+
+  HWND windowWindows = CreateWindowEx(
+      0,
+      "WINDOW_CLASS",
+      "Triangle",
+      WS_OVERLAPPEDWINDOW | WS_CLIPSIBLINGS | WS_CLIPCHILDREN,
+      0, 0, 800, 600,
+      NULL,
+      NULL,
+      hInstance,
+      NULL);
+
+  if (!windowWindows) {
+    throwExceptionVulkanAPI((VkResult)0, "CreateWindowEx");
+  }
+
+  ShowWindow(windowWindows, SW_SHOW);
+  SetForegroundWindow(windowWindows);
+  SetFocus(windowWindows);
+#endif
+
+  // =========================================================================
+  // Vulkan Instance
+
+  beginTraceSection(mainTraceSection, "Vulkan Instance");
+
+  VkDebugUtilsMessengerCreateInfoEXT *debugUtilsMessengerCreateInfoPtr = NULL;
+
+#if defined(VALIDATION_ENABLED)
+  std::vector<VkValidationFeatureEnableEXT> validationFeatureEnableList = {
+      // VK_VALIDATION_FEATURE_ENABLE_BEST_PRACTICES_EXT,
+      VK_VALIDATION_FEATURE_ENABLE_DEBUG_PRINTF_EXT,
+      VK_VALIDATION_FEATURE_ENABLE_SYNCHRONIZATION_VALIDATION_EXT};
+
+  VkDebugUtilsMessageSeverityFlagBitsEXT debugUtilsMessageSeverityFlagBits =
+      (VkDebugUtilsMessageSeverityFlagBitsEXT)(
+          // VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+          VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
+          VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+          VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT);
+
+  VkDebugUtilsMessageTypeFlagBitsEXT debugUtilsMessageTypeFlagBits =
+      (VkDebugUtilsMessageTypeFlagBitsEXT)(
+          // VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+          VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+          VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT);
+
+  VkValidationFeaturesEXT validationFeatures = {
+      .sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT,
+      .pNext = NULL,
+      .enabledValidationFeatureCount =
+          (uint32_t)validationFeatureEnableList.size(),
+      .pEnabledValidationFeatures = validationFeatureEnableList.data(),
+      .disabledValidationFeatureCount = 0,
+      .pDisabledValidationFeatures = NULL};
+
+  VkDebugUtilsMessengerCreateInfoEXT debugUtilsMessengerCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
+      .pNext = &validationFeatures,
+      .flags = 0,
+      .messageSeverity =
+          (VkDebugUtilsMessageSeverityFlagsEXT)debugUtilsMessageSeverityFlagBits,
+      .messageType =
+          (VkDebugUtilsMessageTypeFlagsEXT)debugUtilsMessageTypeFlagBits,
+      .pfnUserCallback = &debugCallback,
+      .pUserData = NULL};
+
+  debugUtilsMessengerCreateInfoPtr = &debugUtilsMessengerCreateInfo;
+#endif
+
+  VkApplicationInfo applicationInfo = {
+      .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+      .pNext = NULL,
+      .pApplicationName = "Ray Tracing Pipeline Example",
+      .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+      .pEngineName = "",
+      .engineVersion = VK_MAKE_VERSION(1, 0, 0),
+      .apiVersion = VK_API_VERSION_1_3};
+
+  std::vector<const char *> instanceLayerList = {};
+  std::vector<const char *> instanceExtensionList = {
+#if defined(PLATFORM_LINUX)
+      "VK_KHR_xlib_surface",
+#elif defined(PLATFORM_ANDROID)
+      "VK_KHR_android_surface",
+#elif defined(PLATFORM_WINDOWS)
+      "VK_KHR_win32_surface",
+#endif
+      "VK_KHR_surface"};
+
+#if defined(VALIDATION_ENABLED)
+  instanceLayerList.push_back("VK_LAYER_KHRONOS_validation");
+  instanceExtensionList.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+#endif
+
+  VkInstanceCreateInfo instanceCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+      .pNext = debugUtilsMessengerCreateInfoPtr,
+      .flags = 0,
+      .pApplicationInfo = &applicationInfo,
+      .enabledLayerCount = (uint32_t)instanceLayerList.size(),
+      .ppEnabledLayerNames = instanceLayerList.data(),
+      .enabledExtensionCount = (uint32_t)instanceExtensionList.size(),
+      .ppEnabledExtensionNames = instanceExtensionList.data(),
+  };
+
+  VkInstance instanceHandle = VK_NULL_HANDLE;
+  result = vkCreateInstance(&instanceCreateInfo, NULL, &instanceHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateInstance");
+  }
+
+  // =========================================================================
+  // Window Surface
+
+  beginTraceSection(mainTraceSection, "Window Surface");
+
+  VkSurfaceKHR surfaceHandle = VK_NULL_HANDLE;
+
+#if defined(PLATFORM_LINUX)
+  VkXlibSurfaceCreateInfoKHR xlibSurfaceCreateInfo = {
+    .sType = VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR,
+    .pNext = NULL,
+    .flags = 0,
+    .dpy = displayPtr,
+    .window = windowLinux
+  };
+
+  result = vkCreateXlibSurfaceKHR(instanceHandle, &xlibSurfaceCreateInfo, NULL,
+                                  &surfaceHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateXlibSurfaceKHR");
+  }
+#elif defined(PLATFORM_WINDOWS)
+  VkWin32SurfaceCreateInfoKHR windowsSurfaceCreateInfo {
+      .sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR,
+      .pNext = NULL,
+      .flags = 0,
+      .hinstance = hInstance,
+      .hwnd = windowWindows
+  };
+
+  result = vkCreateWin32SurfaceKHR(instanceHandle, &windowsSurfaceCreateInfo,
+                                   NULL, &surfaceHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateWin32SurfaceKHR");
+  }
+#endif
+
+  // =========================================================================
+  // Physical Device
+
+  beginTraceSection(mainTraceSection, "Physical Device");
+
+  uint32_t physicalDeviceCount = 0;
+  result =
+      vkEnumeratePhysicalDevices(instanceHandle, &physicalDeviceCount, NULL);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEnumeratePhysicalDevices");
+  }
+
+  std::vector<VkPhysicalDevice> physicalDeviceHandleList(physicalDeviceCount);
+  result = vkEnumeratePhysicalDevices(instanceHandle, &physicalDeviceCount,
+                                      physicalDeviceHandleList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEnumeratePhysicalDevices");
+  }
+
+  std::vector<const char *> deviceExtensionList = {
+      "VK_KHR_ray_tracing_pipeline",
+      "VK_KHR_acceleration_structure",
+      "VK_EXT_descriptor_indexing",
+      "VK_KHR_maintenance3",
+      "VK_KHR_buffer_device_address",
+      "VK_KHR_deferred_host_operations",
+      "VK_KHR_swapchain"};
+
+  // PHYSICAL_DEVICE_INDEX or PHYSICAL_DEVICE_UUID select a device explicitly,
+  // otherwise the highest scoring capable device is used
+  const char *physicalDeviceIndexString = std::getenv("PHYSICAL_DEVICE_INDEX");
+  std::string physicalDeviceUUIDString =
+      std::getenv("PHYSICAL_DEVICE_UUID") != NULL
+          ? std::getenv("PHYSICAL_DEVICE_UUID")
+          : "";
+
+  physicalDeviceUUIDString.erase(std::remove(physicalDeviceUUIDString.begin(),
+                                             physicalDeviceUUIDString.end(),
+                                             '-'),
+                                 physicalDeviceUUIDString.end());
+  std::transform(physicalDeviceUUIDString.begin(),
+                 physicalDeviceUUIDString.end(),
+                 physicalDeviceUUIDString.begin(), ::tolower);
+
+  bool isPhysicalDeviceOverride =
+      physicalDeviceIndexString != NULL || !physicalDeviceUUIDString.empty();
+
+  // The whole index must parse and name an enumerated device
+  uint32_t physicalDeviceIndex = -1;
+  if (physicalDeviceIndexString != NULL) {
+    const char *physicalDeviceIndexStringEnd =
+        physicalDeviceIndexString + strlen(physicalDeviceIndexString);
+
+    std::from_chars_result fromCharsResult =
+        std::from_chars(physicalDeviceIndexString,
+                        physicalDeviceIndexStringEnd, physicalDeviceIndex);
+
+    if (fromCharsResult.ec != std::errc() ||
+        fromCharsResult.ptr != physicalDeviceIndexStringEnd ||
+        physicalDeviceIndex >= physicalDeviceHandleList.size()) {
+      throw std::runtime_error(
+          "PHYSICAL_DEVICE_INDEX " + std::string(physicalDeviceIndexString) +
+          " out of range (" + std::to_string(physicalDeviceHandleList.size()) +
+          " devices)");
+    }
+  }
+
+  VkPhysicalDevice activePhysicalDeviceHandle = VK_NULL_HANDLE;
+  int64_t activePhysicalDeviceScore = -1;
+
+  for (uint32_t x = 0; x < physicalDeviceHandleList.size(); x++) {
+    VkPhysicalDeviceProperties candidatePhysicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDeviceHandleList[x],
+                                  &candidatePhysicalDeviceProperties);
+
+    std::string uuidString =
+        getPhysicalDeviceUUIDString(physicalDeviceHandleList[x]);
+    int64_t score =
+        scorePhysicalDevice(physicalDeviceHandleList[x], surfaceHandle,
+                            deviceExtensionList);
+
+    std::cout << "[" << x << "] "
+              << candidatePhysicalDeviceProperties.deviceName << " ("
+              << uuidString << ") score " << score << std::endl;
+
+    if (isPhysicalDeviceOverride) {
+      bool isMatch = physicalDeviceIndexString != NULL
+                         ? physicalDeviceIndex == x
+                         : physicalDeviceUUIDString == uuidString;
+
+      if (isMatch && score < 0) {
+        std::cerr << candidatePhysicalDeviceProperties.deviceName
+                  << " is missing a required extension, feature or queue"
+                  << std::endl;
+        throwExceptionVulkanAPI(VK_ERROR_FEATURE_NOT_PRESENT,
+                                "scorePhysicalDevice");
+      }
+
+      if (isMatch) {
+        activePhysicalDeviceHandle = physicalDeviceHandleList[x];
+      }
+    } else if (score > activePhysicalDeviceScore) {
+      activePhysicalDeviceHandle = physicalDeviceHandleList[x];
+      activePhysicalDeviceScore = score;
+    }
+  }
+
+  if (activePhysicalDeviceHandle == VK_NULL_HANDLE) {
+    throwExceptionVulkanAPI(VK_ERROR_INCOMPATIBLE_DRIVER,
+                            "vkEnumeratePhysicalDevices");
+  }
+
+  VkPhysicalDeviceProperties physicalDeviceProperties;
+  vkGetPhysicalDeviceProperties(activePhysicalDeviceHandle,
+                                &physicalDeviceProperties);
+
+  VkPhysicalDeviceAccelerationStructurePropertiesKHR
+      physicalDeviceAccelerationStructureProperties = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR,
+          .pNext = NULL};
+
+  VkPhysicalDeviceRayTracingPipelinePropertiesKHR
+      physicalDeviceRayTracingPipelineProperties = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR,
+          .pNext = &physicalDeviceAccelerationStructureProperties};
+
+  VkPhysicalDeviceProperties2 physicalDeviceProperties2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &physicalDeviceRayTracingPipelineProperties,
+      .properties = physicalDeviceProperties};
+
+  vkGetPhysicalDeviceProperties2(activePhysicalDeviceHandle,
+                                 &physicalDeviceProperties2);
+
+  VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(activePhysicalDeviceHandle,
+                                      &physicalDeviceMemoryProperties);
+
+  std::cout << physicalDeviceProperties.deviceName << std::endl;
+
+  // =========================================================================
+  // Physical Device Features
+
+  beginTraceSection(mainTraceSection, "Physical Device Features");
+
+  VkPhysicalDeviceTimelineSemaphoreFeatures
+      physicalDeviceTimelineSemaphoreFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+          .pNext = NULL,
+          .timelineSemaphore = VK_TRUE};
+
+  VkPhysicalDeviceBufferDeviceAddressFeatures
+      physicalDeviceBufferDeviceAddressFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES,
+          .pNext = &physicalDeviceTimelineSemaphoreFeatures,
+          .bufferDeviceAddress = VK_TRUE,
+          .bufferDeviceAddressCaptureReplay = VK_FALSE,
+          .bufferDeviceAddressMultiDevice = VK_FALSE};
+
+  VkPhysicalDeviceAccelerationStructureFeaturesKHR
+      physicalDeviceAccelerationStructureFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+          .pNext = &physicalDeviceBufferDeviceAddressFeatures,
+          .accelerationStructure = VK_TRUE,
+          .accelerationStructureCaptureReplay = VK_FALSE,
+          .accelerationStructureIndirectBuild = VK_FALSE,
+          .accelerationStructureHostCommands = VK_FALSE,
+          .descriptorBindingAccelerationStructureUpdateAfterBind = VK_FALSE};
+
+  VkPhysicalDeviceRayTracingPipelineFeaturesKHR
+      physicalDeviceRayTracingPipelineFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR,
+          .pNext = &physicalDeviceAccelerationStructureFeatures,
+          .rayTracingPipeline = VK_TRUE,
+          .rayTracingPipelineShaderGroupHandleCaptureReplay = VK_FALSE,
+          .rayTracingPipelineShaderGroupHandleCaptureReplayMixed = VK_FALSE,
+          .rayTracingPipelineTraceRaysIndirect = VK_FALSE,
+          .rayTraversalPrimitiveCulling = VK_FALSE};
+  VkPhysicalDeviceFeatures deviceFeatures = {.geometryShader = VK_TRUE};
+
+#if defined(HEATMAP_ENABLED)
+  // The shader clock is optional, without it the heatmap has no clock channel
+  VkPhysicalDeviceShaderClockFeaturesKHR physicalDeviceShaderClockFeatures = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_CLOCK_FEATURES_KHR,
+      .pNext = NULL,
+      .shaderSubgroupClock = VK_FALSE,
+      .shaderDeviceClock = VK_FALSE};
+
+  bool isShaderClockSupported = false;
+  if (isDeviceExtensionSupported(activePhysicalDeviceHandle,
+                                 "VK_KHR_shader_clock")) {
+    VkPhysicalDeviceFeatures2 physicalDeviceFeatures2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &physicalDeviceShaderClockFeatures};
+
+    vkGetPhysicalDeviceFeatures2(activePhysicalDeviceHandle,
+                                 &physicalDeviceFeatures2);
+
+    isShaderClockSupported =
+        physicalDeviceShaderClockFeatures.shaderSubgroupClock;
+  }
+
+  physicalDeviceShaderClockFeatures.pNext = NULL;
+  physicalDeviceShaderClockFeatures.shaderDeviceClock = VK_FALSE;
+#endif
+
+  // VK_EXT_memory_budget is optional, it reports the heap budgets the memory
+  // ledger is checked against
+  MemoryLedger memoryLedger = {
+      .physicalDeviceHandle = activePhysicalDeviceHandle,
+      .isMemoryBudgetSupported = isDeviceExtensionSupported(
+          activePhysicalDeviceHandle, "VK_EXT_memory_budget")};
+
+  // =========================================================================
+  // Physical Device Submission Queue Families
+
+  beginTraceSection(mainTraceSection,
+                    "Physical Device Submission Queue Families");
+
+  uint32_t queueFamilyPropertyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(activePhysicalDeviceHandle,
+                                           &queueFamilyPropertyCount, NULL);
+
+  std::vector<VkQueueFamilyProperties> queueFamilyPropertiesList(
+      queueFamilyPropertyCount);
+
+  vkGetPhysicalDeviceQueueFamilyProperties(activePhysicalDeviceHandle,
+                                           &queueFamilyPropertyCount,
+                                           queueFamilyPropertiesList.data());
+
+  uint32_t queueFamilyIndex = -1;
+  for (uint32_t x = 0; x < queueFamilyPropertiesList.size(); x++) {
+    if (queueFamilyPropertiesList[x].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+
+      VkBool32 isPresentSupported = false;
+      result = vkGetPhysicalDeviceSurfaceSupportKHR(
+          activePhysicalDeviceHandle, x, surfaceHandle, &isPresentSupported);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkGetPhysicalDeviceSurfaceSupportKHR");
+      }
+
+      if (isPresentSupported) {
+        queueFamilyIndex = x;
+        break;
+      }
+    }
+  }
+
+  // Acceleration structure builds prefer a compute family without graphics
+  // so they can overlap tracing, otherwise they share the graphics family
+  uint32_t computeQueueFamilyIndex = queueFamilyIndex;
+  for (uint32_t x = 0; x < queueFamilyPropertiesList.size(); x++) {
+    if ((queueFamilyPropertiesList[x].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+        !(queueFamilyPropertiesList[x].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+      computeQueueFamilyIndex = x;
+      break;
+    }
+  }
+
+  std::vector<uint32_t> queueFamilyIndexList = {queueFamilyIndex};
+  if (computeQueueFamilyIndex != queueFamilyIndex) {
+    queueFamilyIndexList.push_back(computeQueueFamilyIndex);
+  }
+
+  // Buffers read by the build on the compute queue and by the shaders on the
+  // graphics queue are shared rather than transferred between families
+  VkSharingMode accelerationStructureSharingMode =
+      queueFamilyIndexList.size() > 1 ? VK_SHARING_MODE_CONCURRENT
+                                      : VK_SHARING_MODE_EXCLUSIVE;
+
+  std::vector<float> queuePrioritiesList = {1.0f};
+  std::vector<VkDeviceQueueCreateInfo> deviceQueueCreateInfoList;
+  for (uint32_t queueFamilyIndexItem : queueFamilyIndexList) {
+    deviceQueueCreateInfoList.push_back(
+        {.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+         .pNext = NULL,
+         .flags = 0,
+         .queueFamilyIndex = queueFamilyIndexItem,
+         .queueCount = 1,
+         .pQueuePriorities = queuePrioritiesList.data()});
+  }
+
+  // =========================================================================
+  // Logical Device
+
+  beginTraceSection(mainTraceSection, "Logical Device");
+
+  if (memoryLedger.isMemoryBudgetSupported) {
+    deviceExtensionList.push_back("VK_EXT_memory_budget");
+  }
+
+#if defined(HEATMAP_ENABLED)
+  if (isShaderClockSupported) {
+    deviceExtensionList.push_back("VK_KHR_shader_clock");
+  }
+#endif
+
+  VkDeviceCreateInfo deviceCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+      .pNext = &physicalDeviceRayTracingPipelineFeatures,
+      .flags = 0,
+      .queueCreateInfoCount = (uint32_t)deviceQueueCreateInfoList.size(),
+      .pQueueCreateInfos = deviceQueueCreateInfoList.data(),
+      .enabledLayerCount = 0,
+      .ppEnabledLayerNames = NULL,
+      .enabledExtensionCount = (uint32_t)deviceExtensionList.size(),
+      .ppEnabledExtensionNames = deviceExtensionList.data(),
+      .pEnabledFeatures = &deviceFeatures};
+
+#if defined(HEATMAP_ENABLED)
+  if (isShaderClockSupported) {
+    physicalDeviceShaderClockFeatures.pNext = (void *)deviceCreateInfo.pNext;
+    deviceCreateInfo.pNext = &physicalDeviceShaderClockFeatures;
+  }
+#endif
+
+  VkDevice deviceHandle = VK_NULL_HANDLE;
+  result = vkCreateDevice(activePhysicalDeviceHandle, &deviceCreateInfo, NULL,
+                          &deviceHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateDevice");
+  }
+
+  // =========================================================================
+  // Submission Queue
+
+  beginTraceSection(mainTraceSection, "Submission Queue");
+
+  VkQueue queueHandle = VK_NULL_HANDLE;
+  vkGetDeviceQueue(deviceHandle, queueFamilyIndex, 0, &queueHandle);
+
+  VkQueue computeQueueHandle = VK_NULL_HANDLE;
+  vkGetDeviceQueue(deviceHandle, computeQueueFamilyIndex, 0,
+                   &computeQueueHandle);
+
+  // =========================================================================
+  // Device Pointer Functions
+
+  beginTraceSection(mainTraceSection, "Device Pointer Functions");
+
+  PFN_vkGetBufferDeviceAddressKHR pvkGetBufferDeviceAddressKHR =
+      (PFN_vkGetBufferDeviceAddressKHR)vkGetDeviceProcAddr(
+          deviceHandle, "vkGetBufferDeviceAddressKHR");
+
+  PFN_vkCreateRayTracingPipelinesKHR pvkCreateRayTracingPipelinesKHR =
+      (PFN_vkCreateRayTracingPipelinesKHR)vkGetDeviceProcAddr(
+          deviceHandle, "vkCreateRayTracingPipelinesKHR");
+
+  PFN_vkGetAccelerationStructureBuildSizesKHR
+      pvkGetAccelerationStructureBuildSizesKHR =
+          (PFN_vkGetAccelerationStructureBuildSizesKHR)vkGetDeviceProcAddr(
+              deviceHandle, "vkGetAccelerationStructureBuildSizesKHR");
+
+  PFN_vkCreateAccelerationStructureKHR pvkCreateAccelerationStructureKHR =
+      (PFN_vkCreateAccelerationStructureKHR)vkGetDeviceProcAddr(
+          deviceHandle, "vkCreateAccelerationStructureKHR");
+
+  PFN_vkDestroyAccelerationStructureKHR pvkDestroyAccelerationStructureKHR =
+      (PFN_vkDestroyAccelerationStructureKHR)vkGetDeviceProcAddr(
+          deviceHandle, "vkDestroyAccelerationStructureKHR");
+
+  PFN_vkGetAccelerationStructureDeviceAddressKHR
+      pvkGetAccelerationStructureDeviceAddressKHR =
+          (PFN_vkGetAccelerationStructureDeviceAddressKHR)vkGetDeviceProcAddr(
+              deviceHandle, "vkGetAccelerationStructureDeviceAddressKHR");
+
+  PFN_vkCmdBuildAccelerationStructuresKHR pvkCmdBuildAccelerationStructuresKHR =
+      (PFN_vkCmdBuildAccelerationStructuresKHR)vkGetDeviceProcAddr(
+          deviceHandle, "vkCmdBuildAccelerationStructuresKHR");
+
+  PFN_vkGetRayTracingShaderGroupHandlesKHR
+      pvkGetRayTracingShaderGroupHandlesKHR =
+          (PFN_vkGetRayTracingShaderGroupHandlesKHR)vkGetDeviceProcAddr(
+              deviceHandle, "vkGetRayTracingShaderGroupHandlesKHR");
+
+  PFN_vkCmdTraceRaysKHR pvkCmdTraceRaysKHR =
+      (PFN_vkCmdTraceRaysKHR)vkGetDeviceProcAddr(deviceHandle,
+                                                 "vkCmdTraceRaysKHR");
+
+  VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+      .pNext = NULL,
+      .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+      .deviceMask = 0};
+
+  // =========================================================================
+  // Command Pool
+
+  beginTraceSection(mainTraceSection, "Command Pool");
+
+  VkCommandPoolCreateInfo commandPoolCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .pNext = NULL,
+      .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = queueFamilyIndex};
+
+  VkCommandPool commandPoolHandle = VK_NULL_HANDLE;
+  result = vkCreateCommandPool(deviceHandle, &commandPoolCreateInfo, NULL,
+                               &commandPoolHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateCommandPool");
+  }
+
+  // =========================================================================
+  // Command Buffers
+
+  beginTraceSection(mainTraceSection, "Command Buffers");
+
+  VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .pNext = NULL,
+      .commandPool = commandPoolHandle,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = FRAMES_IN_FLIGHT + 1};
+
+  // One per frame in flight, the last is used for one time setup commands
+  std::vector<VkCommandBuffer> commandBufferHandleList =
+      std::vector<VkCommandBuffer>(FRAMES_IN_FLIGHT + 1, VK_NULL_HANDLE);
+
+  result = vkAllocateCommandBuffers(deviceHandle, &commandBufferAllocateInfo,
+                                    commandBufferHandleList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateCommandBuffers");
+  }
+
+  // =========================================================================
+  // Compute Command Pool
+
+  beginTraceSection(mainTraceSection, "Compute Command Pool");
+
+  VkCommandPoolCreateInfo computeCommandPoolCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .pNext = NULL,
+      .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = computeQueueFamilyIndex};
+
+  VkCommandPool computeCommandPoolHandle = VK_NULL_HANDLE;
+  result = vkCreateCommandPool(deviceHandle, &computeCommandPoolCreateInfo,
+                               NULL, &computeCommandPoolHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateCommandPool");
+  }
+
+  // =========================================================================
+  // Compute Command Buffers
+
+  beginTraceSection(mainTraceSection, "Compute Command Buffers");
+
+  VkCommandBufferAllocateInfo computeCommandBufferAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .pNext = NULL,
+      .commandPool = computeCommandPoolHandle,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 3};
+
+  std::vector<VkCommandBuffer> computeCommandBufferHandleList =
+      std::vector<VkCommandBuffer>(3, VK_NULL_HANDLE);
+
+  result = vkAllocateCommandBuffers(deviceHandle,
+                                    &computeCommandBufferAllocateInfo,
+                                    computeCommandBufferHandleList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateCommandBuffers");
+  }
+
+  // =========================================================================
+  // Timeline Semaphores
+
+  beginTraceSection(mainTraceSection, "Timeline Semaphores");
+
+  VkSemaphoreTypeCreateInfo timelineSemaphoreTypeCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+      .pNext = NULL,
+      .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+      .initialValue = 0};
+
+  VkSemaphoreCreateInfo timelineSemaphoreCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      .pNext = &timelineSemaphoreTypeCreateInfo,
+      .flags = 0};
+
+  // Signalled by the graphics queue after each frame
+  VkSemaphore renderTimelineSemaphoreHandle = VK_NULL_HANDLE;
+  result = vkCreateSemaphore(deviceHandle, &timelineSemaphoreCreateInfo, NULL,
+                             &renderTimelineSemaphoreHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateSemaphore");
+  }
+
+  // Signalled by the compute queue after each acceleration structure build
+  VkSemaphore accelerationStructureTimelineSemaphoreHandle = VK_NULL_HANDLE;
+  result = vkCreateSemaphore(deviceHandle, &timelineSemaphoreCreateInfo, NULL,
+                             &accelerationStructureTimelineSemaphoreHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateSemaphore");
+  }
+
+  uint64_t renderTimelineValue = 0;
+  uint64_t accelerationStructureTimelineValue = 0;
+
+  // =========================================================================
+  // Timestamp Query Pools
+
+  beginTraceSection(mainTraceSection, "Timestamp Query Pools");
+
+  // Frames write three timestamps: before the trace, after the trace and after
+  // the present blit. Each compute command buffer brackets its acceleration
+  // structure build with two. Results are only read once the work is known to
+  // be complete.
+  bool isTimestampSupported =
+      queueFamilyPropertiesList[queueFamilyIndex].timestampValidBits > 0;
+
+  bool isComputeTimestampSupported =
+      queueFamilyPropertiesList[computeQueueFamilyIndex].timestampValidBits > 0;
+
+  VkQueryPoolCreateInfo timestampQueryPoolCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = FRAMES_IN_FLIGHT * 3,
+      .pipelineStatistics = 0};
+
+  VkQueryPool timestampQueryPoolHandle = VK_NULL_HANDLE;
+  result = vkCreateQueryPool(deviceHandle, &timestampQueryPoolCreateInfo, NULL,
+                             &timestampQueryPoolHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateQueryPool");
+  }
+
+  VkQueryPoolCreateInfo accelerationStructureTimestampQueryPoolCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = (uint32_t)computeCommandBufferHandleList.size() * 2,
+      .pipelineStatistics = 0};
+
+  VkQueryPool accelerationStructureTimestampQueryPoolHandle = VK_NULL_HANDLE;
+  result = vkCreateQueryPool(
+      deviceHandle, &accelerationStructureTimestampQueryPoolCreateInfo, NULL,
+      &accelerationStructureTimestampQueryPoolHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateQueryPool");
+  }
+
+  std::vector<bool> isTimestampWrittenList(FRAMES_IN_FLIGHT, false);
+
+  TimestampStatistics traceTimestampStatistics;
+  TimestampStatistics blitTimestampStatistics;
+  TimestampStatistics topLevelBuildTimestampStatistics;
+
+  // Milliseconds between two consecutive timestamps of a pool
+  auto getTimestampMilliseconds = [&](VkQueryPool queryPoolHandle,
+                                      uint32_t firstQuery,
+                                      VkQueryResultFlags queryResultFlags) {
+    uint64_t timestampList[2];
+    result = vkGetQueryPoolResults(
+        deviceHandle, queryPoolHandle, firstQuery, 2, sizeof(timestampList),
+        timestampList, sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | queryResultFlags);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkGetQueryPoolResults");
+    }
+
+    return (timestampList[1] - timestampList[0]) *
+           (double)physicalDeviceProperties.limits.timestampPeriod / 1000000.0;
+  };
+
+  // =========================================================================
+  // Surface Features
+
+  beginTraceSection(mainTraceSection, "Surface Features");
+
+  VkSurfaceCapabilitiesKHR surfaceCapabilities;
+  result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+      activePhysicalDeviceHandle, surfaceHandle, &surfaceCapabilities);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result,
+                            "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
+  }
+
+  uint32_t surfaceFormatCount = 0;
+  result = vkGetPhysicalDeviceSurfaceFormatsKHR(
+      activePhysicalDeviceHandle, surfaceHandle, &surfaceFormatCount, NULL);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkGetPhysicalDeviceSurfaceFormatsKHR");
+  }
+
+  std::vector<VkSurfaceFormatKHR> surfaceFormatList(surfaceFormatCount);
+  result = vkGetPhysicalDeviceSurfaceFormatsKHR(
+      activePhysicalDeviceHandle, surfaceHandle, &surfaceFormatCount,
+      surfaceFormatList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkGetPhysicalDeviceSurfaceFormatsKHR");
+  }
+
+  uint32_t presentModeCount = 0;
+  result = vkGetPhysicalDeviceSurfacePresentModesKHR(
+      activePhysicalDeviceHandle, surfaceHandle, &presentModeCount, NULL);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result,
+                            "vkGetPhysicalDeviceSurfacePresentModesKHR");
+  }
+
+  std::vector<VkPresentModeKHR> presentModeList(presentModeCount);
+  result = vkGetPhysicalDeviceSurfacePresentModesKHR(
+      activePhysicalDeviceHandle, surfaceHandle, &presentModeCount,
+      presentModeList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result,
+                            "vkGetPhysicalDeviceSurfacePresentModesKHR");
+  }
+
+  // Prefer an 8-bit UNORM format, presenting blits the accumulated color into
+  // it without an sRGB encode
+  VkSurfaceFormatKHR surfaceFormat = surfaceFormatList[0];
+  for (VkSurfaceFormatKHR &surfaceFormatCandidate : surfaceFormatList) {
+    if (surfaceFormatCandidate.format == VK_FORMAT_B8G8R8A8_UNORM ||
+        surfaceFormatCandidate.format == VK_FORMAT_R8G8B8A8_UNORM) {
+      surfaceFormat = surfaceFormatCandidate;
+      break;
+    }
+  }
+
+  // PRESENT_MODE selects MAILBOX for low latency, IMMEDIATE for benchmarking
+  // without vsync or FIFO_RELAXED. FIFO is the default since it is always
+  // supported and idles the device between vertical blanks.
+  VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+  if (std::getenv("PRESENT_MODE") != NULL) {
+    std::string presentModeString = std::getenv("PRESENT_MODE");
+
+    VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    if (presentModeString == "MAILBOX") {
+      requestedPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+    } else if (presentModeString == "IMMEDIATE") {
+      requestedPresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+    } else if (presentModeString == "FIFO_RELAXED") {
+      requestedPresentMode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+    }
+
+    if (std::find(presentModeList.begin(), presentModeList.end(),
+                  requestedPresentMode) != presentModeList.end()) {
+      presentMode = requestedPresentMode;
+    } else {
+      std::cerr << "PRESENT_MODE " << presentModeString
+                << " is not supported, using FIFO" << std::endl;
+    }
+  }
+
+  // =========================================================================
+  // Swapchain, Swapchain Images, Swapchain Image Views
+
+  beginTraceSection(mainTraceSection,
+                    "Swapchain, Swapchain Images, Swapchain Image Views");
+
+  VkSwapchainKHR swapchainHandle = VK_NULL_HANDLE;
+  VkExtent2D swapchainExtent = surfaceCapabilities.currentExtent;
+  uint32_t swapchainImageCount = 0;
+  std::vector<VkImage> swapchainImageHandleList;
+  std::vector<VkImageView> swapchainImageViewHandleList;
+
+  // Creates everything sized to the surface at its current extent. Called
+  // again from the main loop when the window is resized or presentation
+  // reports the swapchain out of date, the previous swapchain is retired
+  // through oldSwapchainHandle.
+  auto createSwapchain = [&](VkSwapchainKHR oldSwapchainHandle) {
+    swapchainExtent = surfaceCapabilities.currentExtent;
+
+    VkSwapchainCreateInfoKHR swapchainCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+        .pNext = NULL,
+        .flags = 0,
+        .surface = surfaceHandle,
+        .minImageCount = surfaceCapabilities.minImageCount + 1,
+        .imageFormat = surfaceFormat.format,
+        .imageColorSpace = surfaceFormat.colorSpace,
+        .imageExtent = swapchainExtent,
+        .imageArrayLayers = 1,
+        .imageUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices = &queueFamilyIndex,
+        .preTransform = surfaceCapabilities.currentTransform,
+        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+        .presentMode = presentMode,
+        .clipped = VK_TRUE,
+        .oldSwapchain = oldSwapchainHandle};
+
+    result = vkCreateSwapchainKHR(deviceHandle, &swapchainCreateInfo, NULL,
+                                  &swapchainHandle);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateSwapchainKHR");
+    }
+
+    result = vkGetSwapchainImagesKHR(deviceHandle, swapchainHandle,
+                                     &swapchainImageCount, NULL);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkGetSwapchainImagesKHR");
+    }
+
+    swapchainImageHandleList.assign(swapchainImageCount, VK_NULL_HANDLE);
+    result = vkGetSwapchainImagesKHR(deviceHandle, swapchainHandle,
+                                     &swapchainImageCount,
+                                     swapchainImageHandleList.data());
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkGetSwapchainImagesKHR");
+    }
+
+    swapchainImageViewHandleList.assign(swapchainImageCount, VK_NULL_HANDLE);
+
+    for (uint32_t x = 0; x < swapchainImageCount; x++) {
+      VkImageViewCreateInfo imageViewCreateInfo = {
+          .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+          .pNext = NULL,
+          .flags = 0,
+          .image = swapchainImageHandleList[x],
+          .viewType = VK_IMAGE_VIEW_TYPE_2D,
+          .format = surfaceFormat.format,
+          .components = {VK_COMPONENT_SWIZZLE_IDENTITY,
+                         VK_COMPONENT_SWIZZLE_IDENTITY,
+                         VK_COMPONENT_SWIZZLE_IDENTITY,
+                         VK_COMPONENT_SWIZZLE_IDENTITY},
+          .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}};
+
+      result = vkCreateImageView(deviceHandle, &imageViewCreateInfo, NULL,
+                                 &swapchainImageViewHandleList[x]);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkCreateImageView");
+      }
+    }
+  };
+
+  createSwapchain(VK_NULL_HANDLE);
+
+  // =========================================================================
+  // Descriptor Pool
+
+  beginTraceSection(mainTraceSection, "Descriptor Pool");
+
+  // One descriptor set per top level acceleration structure, so the frame can
+  // switch between them without updating a set that is still in flight
+  std::vector<VkDescriptorPoolSize> descriptorPoolSizeList = {
+      {.type = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
+       .descriptorCount = 2},
+      {.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, .descriptorCount = 2},
+      {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 6},
+      {.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, .descriptorCount = 2}};
+
+#if defined(RAY_COUNTERS_ENABLED)
+  descriptorPoolSizeList.push_back(
+      {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+       .descriptorCount = 2});
+#endif
+
+#if defined(HEATMAP_ENABLED)
+  descriptorPoolSizeList.push_back(
+      {.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, .descriptorCount = 2});
+#endif
+
+  VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+      .pNext = NULL,
+      .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+      .maxSets = 3,
+      .poolSizeCount = (uint32_t)descriptorPoolSizeList.size(),
+      .pPoolSizes = descriptorPoolSizeList.data()};
+
+  VkDescriptorPool descriptorPoolHandle = VK_NULL_HANDLE;
+  result = vkCreateDescriptorPool(deviceHandle, &descriptorPoolCreateInfo, NULL,
+                                  &descriptorPoolHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateDescriptorPool");
+  }
+
+  // =========================================================================
+  // Descriptor Set Layout
+
+  beginTraceSection(mainTraceSection, "Descriptor Set Layout");
+
+  std::vector<VkDescriptorSetLayoutBinding> descriptorSetLayoutBindingList = {
+      {.binding = 0,
+       .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
+       .descriptorCount = 1,
+       .stageFlags =
+           VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+       .pImmutableSamplers = NULL},
+      {.binding = 1,
+       .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+       .descriptorCount = 1,
+       .stageFlags =
+           VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+       .pImmutableSamplers = NULL},
+      {.binding = 2,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+       .descriptorCount = 1,
+       .stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+       .pImmutableSamplers = NULL},
+      {.binding = 3,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+       .descriptorCount = 1,
+       .stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+       .pImmutableSamplers = NULL},
+      {.binding = 4,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+       .descriptorCount = 1,
+       .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+       .pImmutableSamplers = NULL}};
+
+#if defined(RAY_COUNTERS_ENABLED)
+  descriptorSetLayoutBindingList.push_back(
+      {.binding = 5,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+       .descriptorCount = 1,
+       .stageFlags =
+           VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+       .pImmutableSamplers = NULL});
+#endif
+
+#if defined(HEATMAP_ENABLED)
+  descriptorSetLayoutBindingList.push_back(
+      {.binding = 6,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+       .descriptorCount = 1,
+       .stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+       .pImmutableSamplers = NULL});
+#endif
+
+  VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .bindingCount = (uint32_t)descriptorSetLayoutBindingList.size(),
+      .pBindings = descriptorSetLayoutBindingList.data()};
+
+  VkDescriptorSetLayout descriptorSetLayoutHandle = VK_NULL_HANDLE;
+  result =
+      vkCreateDescriptorSetLayout(deviceHandle, &descriptorSetLayoutCreateInfo,
+                                  NULL, &descriptorSetLayoutHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateDescriptorSetLayout");
+  }
+
+  // =========================================================================
+  // Material Descriptor Set Layout
+
+  beginTraceSection(mainTraceSection, "Material Descriptor Set Layout");
+
+  std::vector<VkDescriptorSetLayoutBinding>
+      materialDescriptorSetLayoutBindingList = {
+          {.binding = 0,
+           .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+           .descriptorCount = 1,
+           .stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+           .pImmutableSamplers = NULL},
+          {.binding = 1,
+           .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+           .descriptorCount = 1,
+           .stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+           .pImmutableSamplers = NULL}};
+
+  VkDescriptorSetLayoutCreateInfo materialDescriptorSetLayoutCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .bindingCount = (uint32_t)materialDescriptorSetLayoutBindingList.size(),
+      .pBindings = materialDescriptorSetLayoutBindingList.data()};
+
+  VkDescriptorSetLayout materialDescriptorSetLayoutHandle = VK_NULL_HANDLE;
+  result = vkCreateDescriptorSetLayout(
+      deviceHandle, &materialDescriptorSetLayoutCreateInfo, NULL,
+      &materialDescriptorSetLayoutHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateDescriptorSetLayout");
+  }
+
+  // =========================================================================
+  // Allocate Descriptor Sets
+
+  beginTraceSection(mainTraceSection, "Allocate Descriptor Sets");
+
+  std::vector<VkDescriptorSetLayout> descriptorSetLayoutHandleList = {
+      descriptorSetLayoutHandle, materialDescriptorSetLayoutHandle};
+
+  // Set 0 once per top level acceleration structure, material set last
+  std::vector<VkDescriptorSetLayout> allocateDescriptorSetLayoutHandleList = {
+      descriptorSetLayoutHandle, descriptorSetLayoutHandle,
+      materialDescriptorSetLayoutHandle};
+
+  VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .pNext = NULL,
+      .descriptorPool = descriptorPoolHandle,
+      .descriptorSetCount =
+          (uint32_t)allocateDescriptorSetLayoutHandleList.size(),
+      .pSetLayouts = allocateDescriptorSetLayoutHandleList.data()};
+
+  std::vector<VkDescriptorSet> descriptorSetHandleList =
+      std::vector<VkDescriptorSet>(3, VK_NULL_HANDLE);
+
+  result = vkAllocateDescriptorSets(deviceHandle, &descriptorSetAllocateInfo,
+                                    descriptorSetHandleList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateDescriptorSets");
+  }
+
+  // =========================================================================
+  // Pipeline Layout
+
+  beginTraceSection(mainTraceSection, "Pipeline Layout");
+
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .setLayoutCount = (uint32_t)descriptorSetLayoutHandleList.size(),
+      .pSetLayouts = descriptorSetLayoutHandleList.data(),
+      .pushConstantRangeCount = 0,
+      .pPushConstantRanges = NULL};
+
+  VkPipelineLayout pipelineLayoutHandle = VK_NULL_HANDLE;
+  result = vkCreatePipelineLayout(deviceHandle, &pipelineLayoutCreateInfo, NULL,
+                                  &pipelineLayoutHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreatePipelineLayout");
+  }
+
+  // =========================================================================
+  // Ray Closest Hit Shader Module
+
+  beginTraceSection(mainTraceSection, "Ray Closest Hit Shader Module");
+
+  std::ifstream rayClosestHitFile("shaders/shader.rchit.spv",
+                                  std::ios::binary | std::ios::ate);
+  std::streamsize rayClosestHitFileSize = rayClosestHitFile.tellg();
+  rayClosestHitFile.seekg(0, std::ios::beg);
+  std::vector<uint32_t> rayClosestHitShaderSource(rayClosestHitFileSize /
+                                                  sizeof(uint32_t));
+
+  rayClosestHitFile.read(
+      reinterpret_cast<char *>(rayClosestHitShaderSource.data()),
+      rayClosestHitFileSize);
+
+  rayClosestHitFile.close();
+
+  VkShaderModuleCreateInfo rayClosestHitShaderModuleCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .codeSize = (uint32_t)rayClosestHitShaderSource.size() * sizeof(uint32_t),
+      .pCode = rayClosestHitShaderSource.data()};
+
+  VkShaderModule rayClosestHitShaderModuleHandle = VK_NULL_HANDLE;
+  result =
+      vkCreateShaderModule(deviceHandle, &rayClosestHitShaderModuleCreateInfo,
+                           NULL, &rayClosestHitShaderModuleHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateShaderModule");
+  }
+
+  // =========================================================================
+  // Ray Generate Shader Module
+
+  beginTraceSection(mainTraceSection, "Ray Generate Shader Module");
+
+  std::string rayGenerateFileName = "shaders/shader.rgen.spv";
+
+#if defined(HEATMAP_ENABLED)
+  if (isShaderClockSupported) {
+    rayGenerateFileName = "shaders/shader_clock.rgen.spv";
+  }
+#endif
+
+  std::ifstream rayGenerateFile(rayGenerateFileName,
+                                std::ios::binary | std::ios::ate);
+  std::streamsize rayGenerateFileSize = rayGenerateFile.tellg();
+  rayGenerateFile.seekg(0, std::ios::beg);
+  std::vector<uint32_t> rayGenerateShaderSource(rayGenerateFileSize /
+                                                sizeof(uint32_t));
+
+  rayGenerateFile.read(reinterpret_cast<char *>(rayGenerateShaderSource.data()),
+                       rayGenerateFileSize);
+
+  rayGenerateFile.close();
+
+  VkShaderModuleCreateInfo rayGenerateShaderModuleCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .codeSize = (uint32_t)rayGenerateShaderSource.size() * sizeof(uint32_t),
+      .pCode = rayGenerateShaderSource.data()};
+
+  VkShaderModule rayGenerateShaderModuleHandle = VK_NULL_HANDLE;
+  result =
+      vkCreateShaderModule(deviceHandle, &rayGenerateShaderModuleCreateInfo,
+                           NULL, &rayGenerateShaderModuleHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateShaderModule");
+  }
+
+  // =========================================================================
+  // Ray Miss Shader Module
+
+  beginTraceSection(mainTraceSection, "Ray Miss Shader Module");
+
+  std::ifstream rayMissFile("shaders/shader.rmiss.spv",
+                            std::ios::binary | std::ios::ate);
+  std::streamsize rayMissFileSize = rayMissFile.tellg();
+  rayMissFile.seekg(0, std::ios::beg);
+  std::vector<uint32_t> rayMissShaderSource(rayMissFileSize / sizeof(uint32_t));
+
+  rayMissFile.read(reinterpret_cast<char *>(rayMissShaderSource.data()),
+                   rayMissFileSize);
+
+  rayMissFile.close();
+
+  VkShaderModuleCreateInfo rayMissShaderModuleCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .codeSize = (uint32_t)rayMissShaderSource.size() * sizeof(uint32_t),
+      .pCode = rayMissShaderSource.data()};
+
+  VkShaderModule rayMissShaderModuleHandle = VK_NULL_HANDLE;
+  result = vkCreateShaderModule(deviceHandle, &rayMissShaderModuleCreateInfo,
+                                NULL, &rayMissShaderModuleHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateShaderModule");
+  }
+
+  // =========================================================================
+  // Ray Miss Shader Module (Shadow)
+
+  beginTraceSection(mainTraceSection, "Ray Miss Shader Module (Shadow)");
+
+  std::ifstream rayMissShadowFile("shaders/shader_shadow.rmiss.spv",
+                                  std::ios::binary | std::ios::ate);
+  std::streamsize rayMissShadowFileSize = rayMissShadowFile.tellg();
+  rayMissShadowFile.seekg(0, std::ios::beg);
+  std::vector<uint32_t> rayMissShadowShaderSource(rayMissShadowFileSize /
+                                                  sizeof(uint32_t));
+
+  rayMissShadowFile.read(
+      reinterpret_cast<char *>(rayMissShadowShaderSource.data()),
+      rayMissShadowFileSize);
+
+  rayMissShadowFile.close();
+
+  VkShaderModuleCreateInfo rayMissShadowShaderModuleCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .codeSize = (uint32_t)rayMissShadowShaderSource.size() * sizeof(uint32_t),
+      .pCode = rayMissShadowShaderSource.data()};
+
+  VkShaderModule rayMissShadowShaderModuleHandle = VK_NULL_HANDLE;
+  result =
+      vkCreateShaderModule(deviceHandle, &rayMissShadowShaderModuleCreateInfo,
+                           NULL, &rayMissShadowShaderModuleHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateShaderModule");
+  }
+
+  // =========================================================================
+  // Scene
+
+  beginTraceSection(mainTraceSection, "Scene");
+
+  Scene scene;
+  loadScene("resources/cube_scene.obj", scene);
+
+#if defined(LOD_ENABLED)
+  SceneLevelsOfDetail levelsOfDetail;
+  buildSceneLevelsOfDetail(scene, levelsOfDetail);
+#endif
+
+  // =========================================================================
+  // Ray Tracing Pipeline
+
+  beginTraceSection(mainTraceSection, "Ray Tracing Pipeline");
+
+  // The closest hit shader reads 16 bit indices when its constant 0 is set.
+  // Constants 1 and 2 are the triangles per cluster and the 32 bit word where
+  // the scene primitive indices of the clustered triangles start in the index
+  // buffer, constant 3 the word where the level of detail table starts.
+  uint32_t indexSpecializationData[4] = {
+      scene.indexSize == sizeof(uint16_t), SCENE_CLUSTER_PRIMITIVE_COUNT,
+      (uint32_t)(2 * getSceneIndexDataSize(scene) / sizeof(uint32_t)),
+      (uint32_t)(getSceneIndexBufferSize(scene) / sizeof(uint32_t))};
+
+  std::vector<VkSpecializationMapEntry> indexSpecializationMapEntryList = {
+      {.constantID = 0, .offset = 0, .size = sizeof(VkBool32)},
+      {.constantID = 1, .offset = sizeof(uint32_t), .size = sizeof(uint32_t)},
+      {.constantID = 2,
+       .offset = sizeof(uint32_t) * 2,
+       .size = sizeof(uint32_t)},
+      {.constantID = 3,
+       .offset = sizeof(uint32_t) * 3,
+       .size = sizeof(uint32_t)}};
+
+  VkSpecializationInfo indexSpecializationInfo = {
+      .mapEntryCount = (uint32_t)indexSpecializationMapEntryList.size(),
+      .pMapEntries = indexSpecializationMapEntryList.data(),
+      .dataSize = sizeof(indexSpecializationData),
+      .pData = indexSpecializationData};
+
+  std::vector<VkPipelineShaderStageCreateInfo>
+      pipelineShaderStageCreateInfoList = {
+          {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+           .pNext = NULL,
+           .flags = 0,
+           .stage = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
+           .module = rayClosestHitShaderModuleHandle,
+           .pName = "main",
+           .pSpecializationInfo = &indexSpecializationInfo},
+          {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+           .pNext = NULL,
+           .flags = 0,
+           .stage = VK_SHADER_STAGE_RAYGEN_BIT_KHR,
+           .module = rayGenerateShaderModuleHandle,
+           .pName = "main",
+           .pSpecializationInfo = NULL},
+          {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+           .pNext = NULL,
+           .flags = 0,
+           .stage = VK_SHADER_STAGE_MISS_BIT_KHR,
+           .module = rayMissShaderModuleHandle,
+           .pName = "main",
+           .pSpecializationInfo = NULL},
+          {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+           .pNext = NULL,
+           .flags = 0,
+           .stage = VK_SHADER_STAGE_MISS_BIT_KHR,
+           .module = rayMissShadowShaderModuleHandle,
+           .pName = "main",
+           .pSpecializationInfo = NULL}};
+
+  std::vector<VkRayTracingShaderGroupCreateInfoKHR>
+      rayTracingShaderGroupCreateInfoList = {
+          {.sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+           .pNext = NULL,
+           .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR,
+           .generalShader = VK_SHADER_UNUSED_KHR,
+           .closestHitShader = 0,
+           .anyHitShader = VK_SHADER_UNUSED_KHR,
+           .intersectionShader = VK_SHADER_UNUSED_KHR,
+           .pShaderGroupCaptureReplayHandle = NULL},
+          {.sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+           .pNext = NULL,
+           .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR,
+           .generalShader = 1,
+           .closestHitShader = VK_SHADER_UNUSED_KHR,
+           .anyHitShader = VK_SHADER_UNUSED_KHR,
+           .intersectionShader = VK_SHADER_UNUSED_KHR,
+           .pShaderGroupCaptureReplayHandle = NULL},
+          {.sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+           .pNext = NULL,
+           .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR,
+           .generalShader = 2,
+           .closestHitShader = VK_SHADER_UNUSED_KHR,
+           .anyHitShader = VK_SHADER_UNUSED_KHR,
+           .intersectionShader = VK_SHADER_UNUSED_KHR,
+           .pShaderGroupCaptureReplayHandle = NULL},
+          {.sType = VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_KHR,
+           .pNext = NULL,
+           .type = VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_KHR,
+           .generalShader = 3,
+           .closestHitShader = VK_SHADER_UNUSED_KHR,
+           .anyHitShader = VK_SHADER_UNUSED_KHR,
+           .intersectionShader = VK_SHADER_UNUSED_KHR,
+           .pShaderGroupCaptureReplayHandle = NULL}};
+
+  VkRayTracingPipelineCreateInfoKHR rayTracingPipelineCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR,
+      .pNext = NULL,
+      .flags = 0,
+      .stageCount = 4,
+      .pStages = pipelineShaderStageCreateInfoList.data(),
+      .groupCount = 4,
+      .pGroups = rayTracingShaderGroupCreateInfoList.data(),
+      .maxPipelineRayRecursionDepth = 1,
+      .pLibraryInfo = NULL,
+      .pLibraryInterface = NULL,
+      .pDynamicState = NULL,
+      .layout = pipelineLayoutHandle,
+      .basePipelineHandle = VK_NULL_HANDLE,
+      .basePipelineIndex = 0};
+
+  VkPipeline rayTracingPipelineHandle = VK_NULL_HANDLE;
+  result = pvkCreateRayTracingPipelinesKHR(
+      deviceHandle, VK_NULL_HANDLE, VK_NULL_HANDLE, 1,
+      &rayTracingPipelineCreateInfo, NULL, &rayTracingPipelineHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateRayTracingPipelinesKHR");
+  }
+
+  // =========================================================================
+  // Vertex Buffer
+
+  beginTraceSection(mainTraceSection, "Vertex Buffer");
+
+  VkBufferCreateInfo vertexBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = getSceneVertexBufferSize(scene),
+      .usage =
+          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      .sharingMode = accelerationStructureSharingMode,
+      .queueFamilyIndexCount = (uint32_t)queueFamilyIndexList.size(),
+      .pQueueFamilyIndices = queueFamilyIndexList.data()};
+
+  VkBuffer vertexBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &vertexBufferCreateInfo, NULL,
+                          &vertexBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements vertexMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, vertexBufferHandle,
+                                &vertexMemoryRequirements);
+
+  uint32_t vertexMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+    if ((vertexMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+
+      vertexMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo vertexMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = &memoryAllocateFlagsInfo,
+      .allocationSize = vertexMemoryRequirements.size,
+      .memoryTypeIndex = vertexMemoryTypeIndex};
+
+  VkDeviceMemory vertexDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Vertex",
+                                &vertexMemoryAllocateInfo,
+                                &vertexDeviceMemoryHandle);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(deviceHandle, vertexBufferHandle,
+                              vertexDeviceMemoryHandle, 0);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  void *hostVertexMemoryBuffer;
+  result = vkMapMemory(deviceHandle, vertexDeviceMemoryHandle, 0,
+                       getSceneVertexBufferSize(scene), 0,
+                       &hostVertexMemoryBuffer);
+
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+  memcpy(hostVertexMemoryBuffer, scene.quantizationTransform,
+         sizeof(scene.quantizationTransform));
+  memcpy((char *)hostVertexMemoryBuffer + SCENE_VERTEX_DATA_OFFSET,
+         scene.quantizedVertexList.data(),
+         SCENE_VERTEX_STRIDE * scene.vertexCount);
+#else
+  memcpy(hostVertexMemoryBuffer, scene.vertexData,
+         sizeof(float) * 3 * scene.vertexCount);
+#endif
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkMapMemory");
+  }
+
+  vkUnmapMemory(deviceHandle, vertexDeviceMemoryHandle);
+
+  VkBufferDeviceAddressInfo vertexBufferDeviceAddressInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .pNext = NULL,
+      .buffer = vertexBufferHandle};
+
+  VkDeviceAddress vertexBufferDeviceAddress = pvkGetBufferDeviceAddressKHR(
+      deviceHandle, &vertexBufferDeviceAddressInfo);
+
+  // =========================================================================
+  // Index Buffer
+
+  beginTraceSection(mainTraceSection, "Index Buffer");
+
+#if defined(LOD_ENABLED)
+  // The level of detail table follows the scene's index data with two uints
+  // per mesh, the position of its first index and the uint where its scene
+  // primitive indices start. The simplified levels' indices and primitive
+  // indices follow the table.
+  uint64_t levelOfDetailMeshCount = scene.clusterCount * LOD_COUNT;
+
+  VkDeviceSize levelOfDetailTableOffset = getSceneIndexBufferSize(scene);
+  VkDeviceSize levelOfDetailIndexOffset =
+      levelOfDetailTableOffset + sizeof(uint32_t) * 2 * levelOfDetailMeshCount;
+  VkDeviceSize levelOfDetailPrimitiveIndexOffset =
+      levelOfDetailIndexOffset +
+      sizeof(uint32_t) * levelsOfDetail.indexList.size();
+
+  VkDeviceSize indexBufferSize =
+      levelOfDetailPrimitiveIndexOffset +
+      sizeof(uint32_t) * levelsOfDetail.primitiveIndexList.size();
+#else
+  VkDeviceSize indexBufferSize = getSceneIndexBufferSize(scene);
+#endif
+
+  VkBufferCreateInfo indexBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = indexBufferSize,
+      .usage =
+          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      .sharingMode = accelerationStructureSharingMode,
+      .queueFamilyIndexCount = (uint32_t)queueFamilyIndexList.size(),
+      .pQueueFamilyIndices = queueFamilyIndexList.data()};
+
+  VkBuffer indexBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &indexBufferCreateInfo, NULL,
+                          &indexBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements indexMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, indexBufferHandle,
+                                &indexMemoryRequirements);
+
+  uint32_t indexMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+    if ((indexMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+
+      indexMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo indexMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = &memoryAllocateFlagsInfo,
+      .allocationSize = indexMemoryRequirements.size,
+      .memoryTypeIndex = indexMemoryTypeIndex};
+
+  VkDeviceMemory indexDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Index",
+                                &indexMemoryAllocateInfo,
+                                &indexDeviceMemoryHandle);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(deviceHandle, indexBufferHandle,
+                              indexDeviceMemoryHandle, 0);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  void *hostIndexMemoryBuffer;
+  result = vkMapMemory(deviceHandle, indexDeviceMemoryHandle, 0,
+                       indexBufferSize, 0, &hostIndexMemoryBuffer);
+
+  memcpy(hostIndexMemoryBuffer, scene.indexData,
+         scene.indexSize * scene.indexCount);
+
+#if defined(BLAS_CLUSTERING_ENABLED)
+  waitForSceneClusters(scene);
+
+  memcpy((char *)hostIndexMemoryBuffer + getSceneIndexDataSize(scene),
+         scene.clusterIndexList.data(), scene.indexSize * scene.indexCount);
+  memcpy((char *)hostIndexMemoryBuffer + 2 * getSceneIndexDataSize(scene),
+         scene.clusterPrimitiveIndexList.data(),
+         sizeof(uint32_t) * scene.primitiveCount);
+#endif
+
+#if defined(LOD_ENABLED)
+  uint32_t *hostLevelOfDetailTable =
+      (uint32_t *)((char *)hostIndexMemoryBuffer + levelOfDetailTableOffset);
+
+  for (uint64_t x = 0; x < levelOfDetailMeshCount; x++) {
+    uint64_t meshPrimitiveOffset = levelsOfDetail.meshPrimitiveOffsetList[x];
+
+    if (x < scene.clusterCount) {
+      hostLevelOfDetailTable[x * 2] =
+          getSceneIndexDataSize(scene) / scene.indexSize +
+          meshPrimitiveOffset * 3;
+      hostLevelOfDetailTable[x * 2 + 1] =
+          2 * getSceneIndexDataSize(scene) / sizeof(uint32_t) +
+          meshPrimitiveOffset;
+    } else {
+      hostLevelOfDetailTable[x * 2] =
+          levelOfDetailIndexOffset / scene.indexSize + meshPrimitiveOffset * 3;
+      hostLevelOfDetailTable[x * 2 + 1] =
+          levelOfDetailPrimitiveIndexOffset / sizeof(uint32_t) +
+          meshPrimitiveOffset;
+    }
+  }
+
+  memcpy((char *)hostIndexMemoryBuffer + levelOfDetailIndexOffset,
+         levelsOfDetail.indexList.data(),
+         sizeof(uint32_t) * levelsOfDetail.indexList.size());
+  memcpy((char *)hostIndexMemoryBuffer + levelOfDetailPrimitiveIndexOffset,
+         levelsOfDetail.primitiveIndexList.data(),
+         sizeof(uint32_t) * levelsOfDetail.primitiveIndexList.size());
+#endif
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkMapMemory");
+  }
+
+  vkUnmapMemory(deviceHandle, indexDeviceMemoryHandle);
+
+  VkBufferDeviceAddressInfo indexBufferDeviceAddressInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .pNext = NULL,
+      .buffer = indexBufferHandle};
+
+  VkDeviceAddress indexBufferDeviceAddress =
+      pvkGetBufferDeviceAddressKHR(deviceHandle, &indexBufferDeviceAddressInfo);
+
+#if defined(RESIDENCY_ENABLED)
+  // =========================================================================
+  // Proxy Buffer
+
+  beginTraceSection(mainTraceSection, "Proxy Buffer");
+
+  // The unit box a cluster without a resident bottom level acceleration
+  // structure is traced as, its instance transform scales it to the cluster's
+  // bounds. The 12 triangles' indices follow the 8 corners.
+  std::vector<float> proxyVertexList = {0, 0, 0, 1, 0, 0, 0, 1, 0, 1, 1, 0,
+                                        0, 0, 1, 1, 0, 1, 0, 1, 1, 1, 1, 1};
+
+  std::vector<uint32_t> proxyIndexList = {
+      0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6, 0, 1, 4, 1, 5, 4,
+      2, 6, 3, 3, 6, 7, 0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5};
+
+  VkDeviceSize proxyIndexOffset = sizeof(float) * proxyVertexList.size();
+  VkDeviceSize proxyBufferSize =
+      proxyIndexOffset + sizeof(uint32_t) * proxyIndexList.size();
+
+  VkBufferCreateInfo proxyBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = proxyBufferSize,
+      .usage =
+          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = 1,
+      .pQueueFamilyIndices = &computeQueueFamilyIndex};
+
+  VkBuffer proxyBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &proxyBufferCreateInfo, NULL,
+                          &proxyBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements proxyMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, proxyBufferHandle,
+                                &proxyMemoryRequirements);
+
+  uint32_t proxyMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+    if ((proxyMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
 
-      vertexMemoryTypeIndex = x;
+      proxyMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo proxyMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = &memoryAllocateFlagsInfo,
+      .allocationSize = proxyMemoryRequirements.size,
+      .memoryTypeIndex = proxyMemoryTypeIndex};
+
+  VkDeviceMemory proxyDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Proxy",
+                                &proxyMemoryAllocateInfo,
+                                &proxyDeviceMemoryHandle);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(deviceHandle, proxyBufferHandle,
+                              proxyDeviceMemoryHandle, 0);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  void *hostProxyMemoryBuffer;
+  result = vkMapMemory(deviceHandle, proxyDeviceMemoryHandle, 0,
+                       proxyBufferSize, 0, &hostProxyMemoryBuffer);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkMapMemory");
+  }
+
+  memcpy(hostProxyMemoryBuffer, proxyVertexList.data(), proxyIndexOffset);
+  memcpy((char *)hostProxyMemoryBuffer + proxyIndexOffset,
+         proxyIndexList.data(), sizeof(uint32_t) * proxyIndexList.size());
+
+  vkUnmapMemory(deviceHandle, proxyDeviceMemoryHandle);
+
+  VkBufferDeviceAddressInfo proxyBufferDeviceAddressInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .pNext = NULL,
+      .buffer = proxyBufferHandle};
+
+  VkDeviceAddress proxyBufferDeviceAddress =
+      pvkGetBufferDeviceAddressKHR(deviceHandle, &proxyBufferDeviceAddressInfo);
+#endif
+
+  // =========================================================================
+  // Bottom Level Acceleration Structure
+
+  beginTraceSection(mainTraceSection, "Bottom Level Acceleration Structure");
+
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+  // The transform decoding the quantized positions starts the vertex buffer
+  VkDeviceAddress vertexTransformDeviceAddress = vertexBufferDeviceAddress;
+#else
+  VkDeviceAddress vertexTransformDeviceAddress = 0;
+#endif
+
+  VkAccelerationStructureGeometryDataKHR
+      bottomLevelAccelerationStructureGeometryData = {
+          .triangles = {
+              .sType =
+                  VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+              .pNext = NULL,
+              .vertexFormat = SCENE_VERTEX_FORMAT,
+              .vertexData = {.deviceAddress = vertexBufferDeviceAddress +
+                                              SCENE_VERTEX_DATA_OFFSET},
+              .vertexStride = SCENE_VERTEX_STRIDE,
+              .maxVertex = (uint32_t)scene.vertexCount,
+              .indexType = scene.indexSize == sizeof(uint16_t)
+                               ? VK_INDEX_TYPE_UINT16
+                               : VK_INDEX_TYPE_UINT32,
+              .indexData = {.deviceAddress = indexBufferDeviceAddress},
+              .transformData = {.deviceAddress =
+                                    vertexTransformDeviceAddress}}};
+
+  VkAccelerationStructureGeometryKHR bottomLevelAccelerationStructureGeometry =
+      {.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+       .pNext = NULL,
+       .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+       .geometry = bottomLevelAccelerationStructureGeometryData,
+       .flags = VK_GEOMETRY_OPAQUE_BIT_KHR};
+
+#if defined(LOD_ENABLED)
+  // Every cluster is built at every level of detail instead of the whole
+  // scene. Level 0 reads the cluster indices that follow the scene indices,
+  // the simplified levels read the indices after the level of detail table.
+  VkAccelerationStructureGeometryKHR clusterAccelerationStructureGeometry =
+      bottomLevelAccelerationStructureGeometry;
+
+  clusterAccelerationStructureGeometry.geometry.triangles.indexData = {
+      .deviceAddress = indexBufferDeviceAddress + getSceneIndexDataSize(scene)};
+
+  VkAccelerationStructureGeometryKHR
+      levelOfDetailAccelerationStructureGeometry =
+          bottomLevelAccelerationStructureGeometry;
+
+  levelOfDetailAccelerationStructureGeometry.geometry.triangles.indexData = {
+      .deviceAddress = indexBufferDeviceAddress + levelOfDetailIndexOffset};
+
+  std::vector<VkAccelerationStructureBuildGeometryInfoKHR>
+      levelOfDetailBuildGeometryInfoList(
+          levelOfDetailMeshCount,
+          {.sType =
+               VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+           .pNext = NULL,
+           .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+           .flags = 0,
+           .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+           .srcAccelerationStructure = VK_NULL_HANDLE,
+           .dstAccelerationStructure = VK_NULL_HANDLE,
+           .geometryCount = 1,
+           .pGeometries = &levelOfDetailAccelerationStructureGeometry,
+           .ppGeometries = NULL,
+           .scratchData = {.deviceAddress = 0}});
+
+  std::vector<VkAccelerationStructureBuildRangeInfoKHR>
+      levelOfDetailBuildRangeInfoList(levelOfDetailMeshCount);
+
+  // The acceleration structures share one buffer and the builds one scratch
+  // buffer, each at its own aligned offset
+  std::vector<VkDeviceSize> levelOfDetailOffsetList(levelOfDetailMeshCount);
+  std::vector<VkDeviceSize> levelOfDetailSizeList(levelOfDetailMeshCount);
+  std::vector<VkDeviceSize> levelOfDetailScratchOffsetList(
+      levelOfDetailMeshCount);
+
+  VkDeviceSize levelOfDetailBufferSize = 0;
+  VkDeviceSize levelOfDetailClusterSize = 0;
+  VkDeviceSize levelOfDetailScratchBufferSize = 0;
+  VkDeviceSize levelOfDetailScratchAlignment =
+      physicalDeviceAccelerationStructureProperties
+          .minAccelerationStructureScratchOffsetAlignment;
+
+  for (uint64_t x = 0; x < levelOfDetailMeshCount; x++) {
+    if (x < scene.clusterCount) {
+      levelOfDetailBuildGeometryInfoList[x].pGeometries =
+          &clusterAccelerationStructureGeometry;
+    }
+
+    uint32_t meshPrimitiveCount = levelsOfDetail.meshPrimitiveCountList[x];
+
+    levelOfDetailBuildRangeInfoList[x] = {
+        .primitiveCount = meshPrimitiveCount,
+        .primitiveOffset =
+            (uint32_t)(scene.indexSize * 3 *
+                       levelsOfDetail.meshPrimitiveOffsetList[x]),
+        .firstVertex = 0,
+        .transformOffset = 0};
+
+    VkAccelerationStructureBuildSizesInfoKHR levelOfDetailBuildSizesInfo = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+        .pNext = NULL,
+        .accelerationStructureSize = 0,
+        .updateScratchSize = 0,
+        .buildScratchSize = 0};
+
+    pvkGetAccelerationStructureBuildSizesKHR(
+        deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+        &levelOfDetailBuildGeometryInfoList[x], &meshPrimitiveCount,
+        &levelOfDetailBuildSizesInfo);
+
+    // Acceleration structure offsets are multiples of 256 bytes
+    levelOfDetailOffsetList[x] = levelOfDetailBufferSize;
+    levelOfDetailSizeList[x] =
+        levelOfDetailBuildSizesInfo.accelerationStructureSize;
+    levelOfDetailBufferSize +=
+        (levelOfDetailBuildSizesInfo.accelerationStructureSize + 255) / 256 *
+        256;
+    if (x < scene.clusterCount) {
+      levelOfDetailClusterSize = levelOfDetailBufferSize;
+    }
+
+    levelOfDetailScratchOffsetList[x] = levelOfDetailScratchBufferSize;
+    levelOfDetailScratchBufferSize +=
+        (levelOfDetailBuildSizesInfo.buildScratchSize +
+         levelOfDetailScratchAlignment - 1) /
+        levelOfDetailScratchAlignment * levelOfDetailScratchAlignment;
+  }
+
+  VkBufferCreateInfo levelOfDetailBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = levelOfDetailBufferSize,
+      .usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+      .sharingMode = accelerationStructureSharingMode,
+      .queueFamilyIndexCount = (uint32_t)queueFamilyIndexList.size(),
+      .pQueueFamilyIndices = queueFamilyIndexList.data()};
+
+  VkBuffer levelOfDetailBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &levelOfDetailBufferCreateInfo, NULL,
+                          &levelOfDetailBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements levelOfDetailMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, levelOfDetailBufferHandle,
+                                &levelOfDetailMemoryRequirements);
+
+  uint32_t levelOfDetailMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+
+    if ((levelOfDetailMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+      levelOfDetailMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo levelOfDetailMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = NULL,
+      .allocationSize = levelOfDetailMemoryRequirements.size,
+      .memoryTypeIndex = levelOfDetailMemoryTypeIndex};
+
+  VkDeviceMemory levelOfDetailDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger,
+                                "Acceleration structure",
+                                &levelOfDetailMemoryAllocateInfo,
+                                &levelOfDetailDeviceMemoryHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(deviceHandle, levelOfDetailBufferHandle,
+                              levelOfDetailDeviceMemoryHandle, 0);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  VkBufferCreateInfo levelOfDetailScratchBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = levelOfDetailScratchBufferSize,
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = 1,
+      .pQueueFamilyIndices = &computeQueueFamilyIndex};
+
+  VkBuffer levelOfDetailScratchBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &levelOfDetailScratchBufferCreateInfo,
+                          NULL, &levelOfDetailScratchBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements levelOfDetailScratchMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, levelOfDetailScratchBufferHandle,
+                                &levelOfDetailScratchMemoryRequirements);
+
+  uint32_t levelOfDetailScratchMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+
+    if ((levelOfDetailScratchMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+      levelOfDetailScratchMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo levelOfDetailScratchMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = &memoryAllocateFlagsInfo,
+      .allocationSize = levelOfDetailScratchMemoryRequirements.size,
+      .memoryTypeIndex = levelOfDetailScratchMemoryTypeIndex};
+
+  VkDeviceMemory levelOfDetailScratchDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Scratch",
+                                &levelOfDetailScratchMemoryAllocateInfo,
+                                &levelOfDetailScratchDeviceMemoryHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(deviceHandle, levelOfDetailScratchBufferHandle,
+                              levelOfDetailScratchDeviceMemoryHandle, 0);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  VkBufferDeviceAddressInfo levelOfDetailScratchBufferDeviceAddressInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .pNext = NULL,
+      .buffer = levelOfDetailScratchBufferHandle};
+
+  VkDeviceAddress levelOfDetailScratchBufferDeviceAddress =
+      pvkGetBufferDeviceAddressKHR(
+          deviceHandle, &levelOfDetailScratchBufferDeviceAddressInfo);
+
+  std::vector<VkAccelerationStructureKHR> levelOfDetailHandleList(
+      levelOfDetailMeshCount, VK_NULL_HANDLE);
+  std::vector<VkDeviceAddress> levelOfDetailDeviceAddressList(
+      levelOfDetailMeshCount, 0);
+  std::vector<const VkAccelerationStructureBuildRangeInfoKHR *>
+      levelOfDetailBuildRangeInfoPointerList(levelOfDetailMeshCount);
+
+  for (uint64_t x = 0; x < levelOfDetailMeshCount; x++) {
+    VkAccelerationStructureCreateInfoKHR levelOfDetailCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+        .pNext = NULL,
+        .createFlags = 0,
+        .buffer = levelOfDetailBufferHandle,
+        .offset = levelOfDetailOffsetList[x],
+        .size = levelOfDetailSizeList[x],
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .deviceAddress = 0};
+
+    result = pvkCreateAccelerationStructureKHR(deviceHandle,
+                                               &levelOfDetailCreateInfo, NULL,
+                                               &levelOfDetailHandleList[x]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
+    }
+
+    VkAccelerationStructureDeviceAddressInfoKHR levelOfDetailDeviceAddressInfo =
+        {.sType =
+             VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+         .pNext = NULL,
+         .accelerationStructure = levelOfDetailHandleList[x]};
+
+    levelOfDetailDeviceAddressList[x] =
+        pvkGetAccelerationStructureDeviceAddressKHR(
+            deviceHandle, &levelOfDetailDeviceAddressInfo);
+
+    levelOfDetailBuildGeometryInfoList[x].dstAccelerationStructure =
+        levelOfDetailHandleList[x];
+    levelOfDetailBuildGeometryInfoList[x].scratchData = {
+        .deviceAddress = levelOfDetailScratchBufferDeviceAddress +
+                         levelOfDetailScratchOffsetList[x]};
+
+    levelOfDetailBuildRangeInfoPointerList[x] =
+        &levelOfDetailBuildRangeInfoList[x];
+  }
+
+  std::cout << "LOD: " << levelOfDetailMeshCount
+            << " bottom level acceleration structures in "
+            << getMebibytes(levelOfDetailBufferSize) << " MiB, "
+            << getMebibytes(levelOfDetailClusterSize) << " MiB of them level 0"
+            << std::endl;
+
+  // =========================================================================
+  // Build Bottom Level Acceleration Structure
+
+  beginTraceSection(mainTraceSection,
+                    "Build Bottom Level Acceleration Structure");
+
+  VkCommandBufferBeginInfo bottomLevelCommandBufferBeginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .pNext = NULL,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+      .pInheritanceInfo = NULL};
+
+  result = vkBeginCommandBuffer(computeCommandBufferHandleList.back(),
+                                &bottomLevelCommandBufferBeginInfo);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+  }
+
+  uint32_t bottomLevelTimestampQueryIndex =
+      ((uint32_t)computeCommandBufferHandleList.size() - 1) * 2;
+
+  if (isComputeTimestampSupported) {
+    vkCmdResetQueryPool(computeCommandBufferHandleList.back(),
+                        accelerationStructureTimestampQueryPoolHandle,
+                        bottomLevelTimestampQueryIndex, 2);
+
+    vkCmdWriteTimestamp(computeCommandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        accelerationStructureTimestampQueryPoolHandle,
+                        bottomLevelTimestampQueryIndex);
+  }
+
+  pvkCmdBuildAccelerationStructuresKHR(
+      computeCommandBufferHandleList.back(), (uint32_t)levelOfDetailMeshCount,
+      levelOfDetailBuildGeometryInfoList.data(),
+      levelOfDetailBuildRangeInfoPointerList.data());
+
+  if (isComputeTimestampSupported) {
+    vkCmdWriteTimestamp(computeCommandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                        accelerationStructureTimestampQueryPoolHandle,
+                        bottomLevelTimestampQueryIndex + 1);
+  }
+
+  result = vkEndCommandBuffer(computeCommandBufferHandleList.back());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+  }
+
+  // The top level build waits on this value instead of the host
+  uint64_t bottomLevelAccelerationStructureTimelineValue =
+      ++accelerationStructureTimelineValue;
+
+  VkTimelineSemaphoreSubmitInfo
+      bottomLevelAccelerationStructureBuildTimelineSemaphoreSubmitInfo = {
+          .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+          .pNext = NULL,
+          .waitSemaphoreValueCount = 0,
+          .pWaitSemaphoreValues = NULL,
+          .signalSemaphoreValueCount = 1,
+          .pSignalSemaphoreValues =
+              &bottomLevelAccelerationStructureTimelineValue};
+
+  VkSubmitInfo bottomLevelAccelerationStructureBuildSubmitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .pNext = &bottomLevelAccelerationStructureBuildTimelineSemaphoreSubmitInfo,
+      .waitSemaphoreCount = 0,
+      .pWaitSemaphores = NULL,
+      .pWaitDstStageMask = NULL,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &computeCommandBufferHandleList.back(),
+      .signalSemaphoreCount = 1,
+      .pSignalSemaphores = &accelerationStructureTimelineSemaphoreHandle};
+
+  double bottomLevelSubmitMicroseconds = getTraceMicroseconds();
+  result = vkQueueSubmit(computeQueueHandle, 1,
+                         &bottomLevelAccelerationStructureBuildSubmitInfo,
+                         VK_NULL_HANDLE);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkQueueSubmit");
+  }
+
+  // Level of detail of every cluster's instance
+  std::vector<uint32_t> clusterLevelOfDetailList(scene.clusterCount, 0);
+
+  // Selects for every cluster the coarsest level whose grid cells project to
+  // at most LOD_PIXEL_ERROR pixels at the distance of the cluster's bounds.
+  // The ray generation shader spans a 90 degree vertical field of view over
+  // traceHeight pixels. Returns whether any cluster's level changed.
+  auto selectLevelsOfDetail = [&](const float *cameraPosition, float yaw,
+                                  uint32_t traceHeight) {
+    bool isLevelChanged = false;
+
+    for (uint32_t x = 0; x < scene.clusterCount; x++) {
+      float offset[3];
+      float radius =
+          getClusterCameraOffset(&levelsOfDetail.clusterBoundsList[x * 6],
+                                 cameraPosition, yaw, offset);
+
+      float distance = std::max(
+          sqrtf(offset[0] * offset[0] + offset[1] * offset[1] +
+                offset[2] * offset[2]) -
+              radius,
+          0.0f);
+
+      uint32_t level = 0;
+      for (uint32_t y = LOD_COUNT - 1; y > 0 && distance > 0.0f; y--) {
+        float cellSize =
+            2.0f * radius / std::max(LOD_GRID_RESOLUTION >> (y - 1), 1);
+
+        if (cellSize / distance * traceHeight * 0.5f <= LOD_PIXEL_ERROR) {
+          level = y;
+          break;
+        }
+      }
+
+      if (clusterLevelOfDetailList[x] != level) {
+        clusterLevelOfDetailList[x] = level;
+        isLevelChanged = true;
+      }
+    }
+
+    return isLevelChanged;
+  };
+
+  // Instances reference their cluster's selected level instead
+  VkDeviceAddress bottomLevelAccelerationStructureDeviceAddress = 0;
+#else
+#if defined(RESIDENCY_ENABLED)
+  // The scene is never built whole. Its clusters are built into residency
+  // slots on demand, the bottom level acceleration structure holds the proxy
+  // box instead.
+  VkAccelerationStructureGeometryKHR proxyAccelerationStructureGeometry = {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+      .pNext = NULL,
+      .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+      .geometry =
+          {.triangles =
+               {.sType =
+                    VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+                .pNext = NULL,
+                .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+                .vertexData = {.deviceAddress = proxyBufferDeviceAddress},
+                .vertexStride = sizeof(float) * 3,
+                .maxVertex = (uint32_t)proxyVertexList.size() / 3,
+                .indexType = VK_INDEX_TYPE_UINT32,
+                .indexData = {.deviceAddress =
+                                  proxyBufferDeviceAddress + proxyIndexOffset},
+                .transformData = {.deviceAddress = 0}}},
+      .flags = VK_GEOMETRY_OPAQUE_BIT_KHR};
+
+  const VkAccelerationStructureGeometryKHR
+      *bottomLevelAccelerationStructureGeometryPointer =
+          &proxyAccelerationStructureGeometry;
+  uint32_t bottomLevelPrimitiveCount = (uint32_t)proxyIndexList.size() / 3;
+#else
+  const VkAccelerationStructureGeometryKHR
+      *bottomLevelAccelerationStructureGeometryPointer =
+          &bottomLevelAccelerationStructureGeometry;
+  uint32_t bottomLevelPrimitiveCount = (uint32_t)scene.primitiveCount;
+#endif
+
+  VkAccelerationStructureBuildGeometryInfoKHR
+      bottomLevelAccelerationStructureBuildGeometryInfo = {
+          .sType =
+              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+          .pNext = NULL,
+          .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+          .flags = 0,
+          .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+          .srcAccelerationStructure = VK_NULL_HANDLE,
+          .dstAccelerationStructure = VK_NULL_HANDLE,
+          .geometryCount = 1,
+          .pGeometries = bottomLevelAccelerationStructureGeometryPointer,
+          .ppGeometries = NULL,
+          .scratchData = {.deviceAddress = 0}};
+
+  VkAccelerationStructureBuildSizesInfoKHR
+      bottomLevelAccelerationStructureBuildSizesInfo = {
+          .sType =
+              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+          .pNext = NULL,
+          .accelerationStructureSize = 0,
+          .updateScratchSize = 0,
+          .buildScratchSize = 0};
+
+  std::vector<uint32_t> bottomLevelMaxPrimitiveCountList = {
+      bottomLevelPrimitiveCount};
+
+  pvkGetAccelerationStructureBuildSizesKHR(
+      deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+      &bottomLevelAccelerationStructureBuildGeometryInfo,
+      bottomLevelMaxPrimitiveCountList.data(),
+      &bottomLevelAccelerationStructureBuildSizesInfo);
+
+  VkBufferCreateInfo bottomLevelAccelerationStructureBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = bottomLevelAccelerationStructureBuildSizesInfo
+                  .accelerationStructureSize,
+      .usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+      .sharingMode = accelerationStructureSharingMode,
+      .queueFamilyIndexCount = (uint32_t)queueFamilyIndexList.size(),
+      .pQueueFamilyIndices = queueFamilyIndexList.data()};
+
+  VkBuffer bottomLevelAccelerationStructureBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle,
+                          &bottomLevelAccelerationStructureBufferCreateInfo,
+                          NULL, &bottomLevelAccelerationStructureBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements bottomLevelAccelerationStructureMemoryRequirements;
+  vkGetBufferMemoryRequirements(
+      deviceHandle, bottomLevelAccelerationStructureBufferHandle,
+      &bottomLevelAccelerationStructureMemoryRequirements);
+
+  uint32_t bottomLevelAccelerationStructureMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+
+    if ((bottomLevelAccelerationStructureMemoryRequirements.memoryTypeBits &
+         (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+      bottomLevelAccelerationStructureMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo bottomLevelAccelerationStructureMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = NULL,
+      .allocationSize = bottomLevelAccelerationStructureMemoryRequirements.size,
+      .memoryTypeIndex = bottomLevelAccelerationStructureMemoryTypeIndex};
+
+  VkDeviceMemory bottomLevelAccelerationStructureDeviceMemoryHandle =
+      VK_NULL_HANDLE;
+
+  result = allocateDeviceMemory(
+      deviceHandle, memoryLedger, "Acceleration structure",
+      &bottomLevelAccelerationStructureMemoryAllocateInfo,
+      &bottomLevelAccelerationStructureDeviceMemoryHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(
+      deviceHandle, bottomLevelAccelerationStructureBufferHandle,
+      bottomLevelAccelerationStructureDeviceMemoryHandle, 0);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  VkAccelerationStructureCreateInfoKHR
+      bottomLevelAccelerationStructureCreateInfo = {
+          .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+          .pNext = NULL,
+          .createFlags = 0,
+          .buffer = bottomLevelAccelerationStructureBufferHandle,
+          .offset = 0,
+          .size = bottomLevelAccelerationStructureBuildSizesInfo
+                      .accelerationStructureSize,
+          .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+          .deviceAddress = 0};
+
+  VkAccelerationStructureKHR bottomLevelAccelerationStructureHandle =
+      VK_NULL_HANDLE;
+
+  result = pvkCreateAccelerationStructureKHR(
+      deviceHandle, &bottomLevelAccelerationStructureCreateInfo, NULL,
+      &bottomLevelAccelerationStructureHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
+  }
+
+  // =========================================================================
+  // Build Bottom Level Acceleration Structure
+
+  beginTraceSection(mainTraceSection,
+                    "Build Bottom Level Acceleration Structure");
+
+  VkAccelerationStructureDeviceAddressInfoKHR
+      bottomLevelAccelerationStructureDeviceAddressInfo = {
+          .sType =
+              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+          .pNext = NULL,
+          .accelerationStructure = bottomLevelAccelerationStructureHandle};
+
+  VkDeviceAddress bottomLevelAccelerationStructureDeviceAddress =
+      pvkGetAccelerationStructureDeviceAddressKHR(
+          deviceHandle, &bottomLevelAccelerationStructureDeviceAddressInfo);
+
+  VkBufferCreateInfo bottomLevelAccelerationStructureScratchBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = bottomLevelAccelerationStructureBuildSizesInfo.buildScratchSize,
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = 1,
+      .pQueueFamilyIndices = &computeQueueFamilyIndex};
+
+  VkBuffer bottomLevelAccelerationStructureScratchBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(
+      deviceHandle, &bottomLevelAccelerationStructureScratchBufferCreateInfo,
+      NULL, &bottomLevelAccelerationStructureScratchBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements
+      bottomLevelAccelerationStructureScratchMemoryRequirements;
+  vkGetBufferMemoryRequirements(
+      deviceHandle, bottomLevelAccelerationStructureScratchBufferHandle,
+      &bottomLevelAccelerationStructureScratchMemoryRequirements);
+
+  uint32_t bottomLevelAccelerationStructureScratchMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+
+    if ((bottomLevelAccelerationStructureScratchMemoryRequirements
+             .memoryTypeBits &
+         (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+      bottomLevelAccelerationStructureScratchMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo
+      bottomLevelAccelerationStructureScratchMemoryAllocateInfo = {
+          .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+          .pNext = &memoryAllocateFlagsInfo,
+          .allocationSize =
+              bottomLevelAccelerationStructureScratchMemoryRequirements.size,
+          .memoryTypeIndex =
+              bottomLevelAccelerationStructureScratchMemoryTypeIndex};
+
+  VkDeviceMemory bottomLevelAccelerationStructureDeviceScratchMemoryHandle =
+      VK_NULL_HANDLE;
+
+  result = allocateDeviceMemory(
+      deviceHandle, memoryLedger, "Scratch",
+      &bottomLevelAccelerationStructureScratchMemoryAllocateInfo,
+      &bottomLevelAccelerationStructureDeviceScratchMemoryHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(
+      deviceHandle, bottomLevelAccelerationStructureScratchBufferHandle,
+      bottomLevelAccelerationStructureDeviceScratchMemoryHandle, 0);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  VkBufferDeviceAddressInfo
+      bottomLevelAccelerationStructureScratchBufferDeviceAddressInfo = {
+          .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+          .pNext = NULL,
+          .buffer = bottomLevelAccelerationStructureScratchBufferHandle};
+
+  VkDeviceAddress bottomLevelAccelerationStructureScratchBufferDeviceAddress =
+      pvkGetBufferDeviceAddressKHR(
+          deviceHandle,
+          &bottomLevelAccelerationStructureScratchBufferDeviceAddressInfo);
+
+  bottomLevelAccelerationStructureBuildGeometryInfo.dstAccelerationStructure =
+      bottomLevelAccelerationStructureHandle;
+
+  bottomLevelAccelerationStructureBuildGeometryInfo.scratchData = {
+      .deviceAddress =
+          bottomLevelAccelerationStructureScratchBufferDeviceAddress};
+
+  VkAccelerationStructureBuildRangeInfoKHR
+      bottomLevelAccelerationStructureBuildRangeInfo = {
+          .primitiveCount = bottomLevelPrimitiveCount,
+          .primitiveOffset = 0,
+          .firstVertex = 0,
+          .transformOffset = 0};
+
+  const VkAccelerationStructureBuildRangeInfoKHR
+      *bottomLevelAccelerationStructureBuildRangeInfos =
+          &bottomLevelAccelerationStructureBuildRangeInfo;
+
+  VkCommandBufferBeginInfo bottomLevelCommandBufferBeginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .pNext = NULL,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+      .pInheritanceInfo = NULL};
+
+  result = vkBeginCommandBuffer(computeCommandBufferHandleList.back(),
+                                &bottomLevelCommandBufferBeginInfo);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+  }
+
+  uint32_t bottomLevelTimestampQueryIndex =
+      ((uint32_t)computeCommandBufferHandleList.size() - 1) * 2;
+
+  if (isComputeTimestampSupported) {
+    vkCmdResetQueryPool(computeCommandBufferHandleList.back(),
+                        accelerationStructureTimestampQueryPoolHandle,
+                        bottomLevelTimestampQueryIndex, 2);
+
+    vkCmdWriteTimestamp(computeCommandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        accelerationStructureTimestampQueryPoolHandle,
+                        bottomLevelTimestampQueryIndex);
+  }
+
+  pvkCmdBuildAccelerationStructuresKHR(
+      computeCommandBufferHandleList.back(), 1,
+      &bottomLevelAccelerationStructureBuildGeometryInfo,
+      &bottomLevelAccelerationStructureBuildRangeInfos);
+
+  if (isComputeTimestampSupported) {
+    vkCmdWriteTimestamp(computeCommandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                        accelerationStructureTimestampQueryPoolHandle,
+                        bottomLevelTimestampQueryIndex + 1);
+  }
+
+  result = vkEndCommandBuffer(computeCommandBufferHandleList.back());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+  }
+
+  // The top level build waits on this value instead of the host
+  uint64_t bottomLevelAccelerationStructureTimelineValue =
+      ++accelerationStructureTimelineValue;
+
+  VkTimelineSemaphoreSubmitInfo
+      bottomLevelAccelerationStructureBuildTimelineSemaphoreSubmitInfo = {
+          .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+          .pNext = NULL,
+          .waitSemaphoreValueCount = 0,
+          .pWaitSemaphoreValues = NULL,
+          .signalSemaphoreValueCount = 1,
+          .pSignalSemaphoreValues =
+              &bottomLevelAccelerationStructureTimelineValue};
+
+  VkSubmitInfo bottomLevelAccelerationStructureBuildSubmitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .pNext = &bottomLevelAccelerationStructureBuildTimelineSemaphoreSubmitInfo,
+      .waitSemaphoreCount = 0,
+      .pWaitSemaphores = NULL,
+      .pWaitDstStageMask = NULL,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &computeCommandBufferHandleList.back(),
+      .signalSemaphoreCount = 1,
+      .pSignalSemaphores = &accelerationStructureTimelineSemaphoreHandle};
+
+  double bottomLevelSubmitMicroseconds = getTraceMicroseconds();
+  result = vkQueueSubmit(computeQueueHandle, 1,
+                         &bottomLevelAccelerationStructureBuildSubmitInfo,
+                         VK_NULL_HANDLE);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkQueueSubmit");
+  }
+#endif
+
+#if defined(RESIDENCY_ENABLED)
+  // =========================================================================
+  // Resident Bottom Level Acceleration Structures
+
+  beginTraceSection(mainTraceSection,
+                    "Resident Bottom Level Acceleration Structures");
+
+  // Model space bounds of every cluster, minimum then maximum
+  std::vector<float> clusterBoundsList(scene.clusterCount * 6);
+
+  runTasksInParallel(scene.clusterCount, [&](uint32_t clusterIndex) {
+    getSceneClusterBounds(scene, clusterIndex,
+                          &clusterBoundsList[clusterIndex * 6]);
+  });
+
+  // Every cluster reads its triangles from the cluster indices, which follow
+  // the scene indices in the index buffer. The build range offset selects the
+  // cluster.
+  VkAccelerationStructureGeometryKHR clusterAccelerationStructureGeometry =
+      bottomLevelAccelerationStructureGeometry;
+
+  clusterAccelerationStructureGeometry.geometry.triangles.indexData = {
+      .deviceAddress = indexBufferDeviceAddress + getSceneIndexDataSize(scene)};
+
+  VkAccelerationStructureBuildGeometryInfoKHR
+      clusterAccelerationStructureBuildGeometryInfo = {
+          .sType =
+              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+          .pNext = NULL,
+          .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+          .flags = 0,
+          .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+          .srcAccelerationStructure = VK_NULL_HANDLE,
+          .dstAccelerationStructure = VK_NULL_HANDLE,
+          .geometryCount = 1,
+          .pGeometries = &clusterAccelerationStructureGeometry,
+          .ppGeometries = NULL,
+          .scratchData = {.deviceAddress = 0}};
+
+  VkAccelerationStructureBuildSizesInfoKHR
+      clusterAccelerationStructureBuildSizesInfo = {
+          .sType =
+              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+          .pNext = NULL,
+          .accelerationStructureSize = 0,
+          .updateScratchSize = 0,
+          .buildScratchSize = 0};
+
+  // Only the last cluster can have fewer triangles, so every slot is sized
+  // for a full one and any cluster can be built into any slot
+  uint32_t clusterMaxPrimitiveCount = (uint32_t)std::min<uint64_t>(
+      SCENE_CLUSTER_PRIMITIVE_COUNT, scene.primitiveCount);
+
+  pvkGetAccelerationStructureBuildSizesKHR(
+      deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+      &clusterAccelerationStructureBuildGeometryInfo, &clusterMaxPrimitiveCount,
+      &clusterAccelerationStructureBuildSizesInfo);
+
+  // Acceleration structure offsets are multiples of 256 bytes
+  VkDeviceSize residencySlotSize =
+      (clusterAccelerationStructureBuildSizesInfo.accelerationStructureSize +
+       255) /
+      256 * 256;
+
+  uint32_t residencySlotCount = (uint32_t)std::clamp<uint64_t>(
+      (uint64_t)RESIDENCY_BUDGET_MEBIBYTES * 1024 * 1024 / residencySlotSize, 1,
+      scene.clusterCount);
+
+  VkBufferCreateInfo residencyBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = residencySlotSize * residencySlotCount,
+      .usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+      .sharingMode = accelerationStructureSharingMode,
+      .queueFamilyIndexCount = (uint32_t)queueFamilyIndexList.size(),
+      .pQueueFamilyIndices = queueFamilyIndexList.data()};
+
+  VkBuffer residencyBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &residencyBufferCreateInfo, NULL,
+                          &residencyBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements residencyMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, residencyBufferHandle,
+                                &residencyMemoryRequirements);
+
+  uint32_t residencyMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+
+    if ((residencyMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+      residencyMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo residencyMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = NULL,
+      .allocationSize = residencyMemoryRequirements.size,
+      .memoryTypeIndex = residencyMemoryTypeIndex};
+
+  VkDeviceMemory residencyDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger,
+                                "Acceleration structure",
+                                &residencyMemoryAllocateInfo,
+                                &residencyDeviceMemoryHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(deviceHandle, residencyBufferHandle,
+                              residencyDeviceMemoryHandle, 0);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  // One acceleration structure per slot, created once. Paging a cluster in
+  // rebuilds the slot's structure from that cluster's triangles.
+  std::vector<VkAccelerationStructureKHR> residencySlotHandleList(
+      residencySlotCount, VK_NULL_HANDLE);
+
+  std::vector<VkDeviceAddress> residencySlotDeviceAddressList(
+      residencySlotCount, 0);
+
+  for (uint32_t x = 0; x < residencySlotCount; x++) {
+    VkAccelerationStructureCreateInfoKHR residencySlotCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+        .pNext = NULL,
+        .createFlags = 0,
+        .buffer = residencyBufferHandle,
+        .offset = residencySlotSize * x,
+        .size = residencySlotSize,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .deviceAddress = 0};
+
+    result = pvkCreateAccelerationStructureKHR(
+        deviceHandle, &residencySlotCreateInfo, NULL,
+        &residencySlotHandleList[x]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
+    }
+
+    VkAccelerationStructureDeviceAddressInfoKHR residencySlotDeviceAddressInfo =
+        {.sType =
+             VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+         .pNext = NULL,
+         .accelerationStructure = residencySlotHandleList[x]};
+
+    residencySlotDeviceAddressList[x] =
+        pvkGetAccelerationStructureDeviceAddressKHR(
+            deviceHandle, &residencySlotDeviceAddressInfo);
+  }
+
+  // The builds of one update run together, each at its own aligned offset
+  VkDeviceSize residencyScratchAlignment =
+      physicalDeviceAccelerationStructureProperties
+          .minAccelerationStructureScratchOffsetAlignment;
+
+  VkDeviceSize residencyScratchStride =
+      (clusterAccelerationStructureBuildSizesInfo.buildScratchSize +
+       residencyScratchAlignment - 1) /
+      residencyScratchAlignment * residencyScratchAlignment;
+
+  VkBufferCreateInfo residencyScratchBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = residencyScratchStride * RESIDENCY_BUILDS_PER_UPDATE,
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = 1,
+      .pQueueFamilyIndices = &computeQueueFamilyIndex};
+
+  VkBuffer residencyScratchBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &residencyScratchBufferCreateInfo,
+                          NULL, &residencyScratchBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements residencyScratchMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, residencyScratchBufferHandle,
+                                &residencyScratchMemoryRequirements);
+
+  uint32_t residencyScratchMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+
+    if ((residencyScratchMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+      residencyScratchMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo residencyScratchMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = &memoryAllocateFlagsInfo,
+      .allocationSize = residencyScratchMemoryRequirements.size,
+      .memoryTypeIndex = residencyScratchMemoryTypeIndex};
+
+  VkDeviceMemory residencyScratchDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Scratch",
+                                &residencyScratchMemoryAllocateInfo,
+                                &residencyScratchDeviceMemoryHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(deviceHandle, residencyScratchBufferHandle,
+                              residencyScratchDeviceMemoryHandle, 0);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  VkBufferDeviceAddressInfo residencyScratchBufferDeviceAddressInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .pNext = NULL,
+      .buffer = residencyScratchBufferHandle};
+
+  VkDeviceAddress residencyScratchBufferDeviceAddress =
+      pvkGetBufferDeviceAddressKHR(deviceHandle,
+                                   &residencyScratchBufferDeviceAddressInfo);
+
+  std::cout << "Residency: " << residencySlotCount << " of "
+            << scene.clusterCount << " clusters in "
+            << getMebibytes(residencySlotSize * residencySlotCount) << " MiB"
+            << std::endl;
+
+  // Slot of every cluster's resident acceleration structure or -1, the
+  // cluster in every slot or -1, and the last update that ranked the slot's
+  // cluster among the nearest
+  std::vector<uint32_t> clusterResidencySlotIndexList(scene.clusterCount, -1);
+  std::vector<uint32_t> residencySlotClusterIndexList(residencySlotCount, -1);
+  std::vector<uint64_t> residencySlotUpdateIndexList(residencySlotCount, 0);
+  uint64_t residencyUpdateIndex = 0;
+
+  // An evicted slot can still be traced through the active top level
+  // acceleration structure. It is released once the rebuild without it is
+  // switched to, the next rebuild then waits for the last frame tracing the
+  // old one.
+  std::vector<uint32_t> freeResidencySlotIndexList;
+  std::vector<uint32_t> evictedResidencySlotIndexList;
+  for (uint32_t x = residencySlotCount; x > 0; x--) {
+    freeResidencySlotIndexList.push_back(x - 1);
+  }
+
+  // Slots paged in since the last top level rebuild, built at its start
+  std::vector<uint32_t> pendingResidencySlotIndexList;
+
+  std::vector<float> clusterDistanceList(scene.clusterCount, 0.0f);
+  std::vector<uint32_t> clusterOrderList(scene.clusterCount, 0);
+  bool isResidencyConverged = false;
+
+  // Clusters holding the light triangles, 40 and 41 as in the closest hit
+  // shader. They always rank nearest, so they are paged in first and never
+  // evicted, and the light is never traced as a proxy box.
+  std::vector<bool> isLightClusterList(scene.clusterCount, false);
+  for (uint64_t x = 0; x < scene.primitiveCount; x++) {
+    uint32_t primitiveIndex = scene.clusterPrimitiveIndexList[x];
+    if (primitiveIndex == 40 || primitiveIndex == 41) {
+      isLightClusterList[x / SCENE_CLUSTER_PRIMITIVE_COUNT] = true;
+    }
+  }
+
+  // Ranks the clusters by distance from the camera to their bounds and wants
+  // the nearest residencySlotCount resident. Pages in up to
+  // RESIDENCY_BUILDS_PER_UPDATE of them, nearest first, evicting the least
+  // recently wanted clusters once no slot is free. Returns whether any
+  // cluster was paged in or evicted.
+  auto updateResidency = [&](const float *cameraPosition, float cameraYaw,
+                             float cameraPitch, float yaw) {
+    residencyUpdateIndex += 1;
+
+    float cameraForward[3] = {
+        cosf(cameraPitch) * cosf(-cameraYaw - (3.141592 / 2.0)),
+        sinf(cameraPitch),
+        cosf(cameraPitch) * sinf(-cameraYaw - (3.141592 / 2.0))};
+
+    for (uint32_t x = 0; x < scene.clusterCount; x++) {
+      float offset[3];
+      float radius = getClusterCameraOffset(&clusterBoundsList[x * 6],
+                                            cameraPosition, yaw, offset);
+
+      float distance = sqrtf(offset[0] * offset[0] + offset[1] * offset[1] +
+                             offset[2] * offset[2]);
+
+      clusterDistanceList[x] = std::max(distance - radius, 0.0f);
+      if (offset[0] * cameraForward[0] + offset[1] * cameraForward[1] +
+              offset[2] * cameraForward[2] <
+          -radius) {
+        clusterDistanceList[x] *= RESIDENCY_BEHIND_CAMERA_SCALE;
+      }
+      if (isLightClusterList[x]) {
+        clusterDistanceList[x] = -1.0f;
+      }
+
+      clusterOrderList[x] = x;
+    }
+
+    std::partial_sort(clusterOrderList.begin(),
+                      clusterOrderList.begin() + residencySlotCount,
+                      clusterOrderList.end(), [&](uint32_t a, uint32_t b) {
+                        return clusterDistanceList[a] < clusterDistanceList[b];
+                      });
+
+    for (uint32_t x = 0; x < residencySlotCount; x++) {
+      uint32_t slotIndex = clusterResidencySlotIndexList[clusterOrderList[x]];
+      if (slotIndex != (uint32_t)-1) {
+        residencySlotUpdateIndexList[slotIndex] = residencyUpdateIndex;
+      }
+    }
+
+    uint32_t changeCount = 0;
+    isResidencyConverged = evictedResidencySlotIndexList.empty();
+
+    for (uint32_t x = 0; x < residencySlotCount; x++) {
+      uint32_t clusterIndex = clusterOrderList[x];
+      if (clusterResidencySlotIndexList[clusterIndex] != (uint32_t)-1) {
+        continue;
+      }
+
+      isResidencyConverged = false;
+      if (changeCount == RESIDENCY_BUILDS_PER_UPDATE) {
+        break;
+      }
+
+      if (freeResidencySlotIndexList.empty()) {
+        uint32_t evictedSlotIndex = -1;
+        for (uint32_t y = 0; y < residencySlotCount; y++) {
+          if (residencySlotClusterIndexList[y] != (uint32_t)-1 &&
+              residencySlotUpdateIndexList[y] < residencyUpdateIndex &&
+              (evictedSlotIndex == (uint32_t)-1 ||
+               residencySlotUpdateIndexList[y] <
+                   residencySlotUpdateIndexList[evictedSlotIndex])) {
+            evictedSlotIndex = y;
+          }
+        }
+
+        // The remaining slots were evicted and are not released yet
+        if (evictedSlotIndex == (uint32_t)-1) {
+          break;
+        }
+
+        clusterResidencySlotIndexList
+            [residencySlotClusterIndexList[evictedSlotIndex]] = -1;
+        residencySlotClusterIndexList[evictedSlotIndex] = -1;
+        evictedResidencySlotIndexList.push_back(evictedSlotIndex);
+
+        changeCount += 1;
+        continue;
+      }
+
+      uint32_t slotIndex = freeResidencySlotIndexList.back();
+      freeResidencySlotIndexList.pop_back();
+
+      clusterResidencySlotIndexList[clusterIndex] = slotIndex;
+      residencySlotClusterIndexList[slotIndex] = clusterIndex;
+      residencySlotUpdateIndexList[slotIndex] = residencyUpdateIndex;
+      pendingResidencySlotIndexList.push_back(slotIndex);
+
+      changeCount += 1;
+    }
+
+    return changeCount > 0;
+  };
+
+  // Records the builds of the slots paged in since the last top level
+  // rebuild, ahead of that rebuild in the same command buffer
+  auto recordResidencyBuilds = [&](VkCommandBuffer commandBufferHandle) {
+    if (pendingResidencySlotIndexList.empty()) {
+      return;
+    }
+
+    uint32_t buildCount = (uint32_t)pendingResidencySlotIndexList.size();
+
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR>
+        residencyBuildGeometryInfoList(
+            buildCount, clusterAccelerationStructureBuildGeometryInfo);
+
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR>
+        residencyBuildRangeInfoList(buildCount);
+
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR *>
+        residencyBuildRangeInfoPointerList(buildCount);
+
+    for (uint32_t x = 0; x < buildCount; x++) {
+      uint32_t slotIndex = pendingResidencySlotIndexList[x];
+      uint64_t clusterIndex = residencySlotClusterIndexList[slotIndex];
+
+      residencyBuildGeometryInfoList[x].dstAccelerationStructure =
+          residencySlotHandleList[slotIndex];
+      residencyBuildGeometryInfoList[x].scratchData = {
+          .deviceAddress = residencyScratchBufferDeviceAddress +
+                           residencyScratchStride * x};
+
+      residencyBuildRangeInfoList[x] = {
+          .primitiveCount = (uint32_t)std::min<uint64_t>(
+              SCENE_CLUSTER_PRIMITIVE_COUNT,
+              scene.primitiveCount -
+                  clusterIndex * SCENE_CLUSTER_PRIMITIVE_COUNT),
+          .primitiveOffset = (uint32_t)(scene.indexSize * 3 * clusterIndex *
+                                        SCENE_CLUSTER_PRIMITIVE_COUNT),
+          .firstVertex = 0,
+          .transformOffset = 0};
+
+      residencyBuildRangeInfoPointerList[x] = &residencyBuildRangeInfoList[x];
+    }
+
+    // The previous update's builds used the same scratch memory, and the top
+    // level build that follows reads these
+    VkMemoryBarrier residencyBuildMemoryBarrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+                         VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR};
+
+    vkCmdPipelineBarrier(commandBufferHandle,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         0, 1, &residencyBuildMemoryBarrier, 0, NULL, 0, NULL);
+
+    pvkCmdBuildAccelerationStructuresKHR(
+        commandBufferHandle, buildCount, residencyBuildGeometryInfoList.data(),
+        residencyBuildRangeInfoPointerList.data());
+
+    vkCmdPipelineBarrier(commandBufferHandle,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         0, 1, &residencyBuildMemoryBarrier, 0, NULL, 0, NULL);
+
+    pendingResidencySlotIndexList.clear();
+  };
+#endif
+
+  // =========================================================================
+  // Top Level Acceleration Structure
+
+  beginTraceSection(mainTraceSection, "Top Level Acceleration Structure");
+
+  // Two top level acceleration structures are kept so the compute queue can
+  // rebuild one while the graphics queue traces the other. The rebuild only
+  // changes the instance transform, the bottom level is shared.
+  uint32_t topLevelAccelerationStructureCount = 2;
+
+#if defined(RESIDENCY_ENABLED)
+  // One instance per cluster, of its resident structure or of the proxy box
+  uint32_t topLevelInstanceCount = (uint32_t)scene.clusterCount;
+#elif defined(LOD_ENABLED)
+  // One instance per cluster, of its selected level of detail
+  uint32_t topLevelInstanceCount = (uint32_t)scene.clusterCount;
+#else
+  uint32_t topLevelInstanceCount = 1;
+#endif
+
+  std::vector<VkBuffer> bottomLevelGeometryInstanceBufferHandleList(
+      topLevelAccelerationStructureCount, VK_NULL_HANDLE);
+
+  std::vector<VkDeviceMemory> bottomLevelGeometryInstanceDeviceMemoryHandleList(
+      topLevelAccelerationStructureCount, VK_NULL_HANDLE);
+
+  std::vector<void *> hostBottomLevelGeometryInstanceMemoryBufferList(
+      topLevelAccelerationStructureCount, NULL);
+
+  std::vector<VkDeviceAddress> bottomLevelGeometryInstanceDeviceAddressList(
+      topLevelAccelerationStructureCount, 0);
+
+  for (uint32_t x = 0; x < topLevelAccelerationStructureCount; x++) {
+    VkBufferCreateInfo bottomLevelGeometryInstanceBufferCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .size =
+            sizeof(VkAccelerationStructureInstanceKHR) * topLevelInstanceCount,
+        .usage =
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices = &computeQueueFamilyIndex};
+
+    result = vkCreateBuffer(deviceHandle,
+                            &bottomLevelGeometryInstanceBufferCreateInfo, NULL,
+                            &bottomLevelGeometryInstanceBufferHandleList[x]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateBuffer");
+    }
+
+    VkMemoryRequirements bottomLevelGeometryInstanceMemoryRequirements;
+    vkGetBufferMemoryRequirements(
+        deviceHandle, bottomLevelGeometryInstanceBufferHandleList[x],
+        &bottomLevelGeometryInstanceMemoryRequirements);
+
+    uint32_t bottomLevelGeometryInstanceMemoryTypeIndex = -1;
+    for (uint32_t y = 0; y < physicalDeviceMemoryProperties.memoryTypeCount;
+         y++) {
+
+      if ((bottomLevelGeometryInstanceMemoryRequirements.memoryTypeBits &
+           (1 << y)) &&
+          (physicalDeviceMemoryProperties.memoryTypes[y].propertyFlags &
+           (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) ==
+              (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+
+        bottomLevelGeometryInstanceMemoryTypeIndex = y;
+        break;
+      }
+    }
+
+    VkMemoryAllocateInfo bottomLevelGeometryInstanceMemoryAllocateInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = &memoryAllocateFlagsInfo,
+        .allocationSize = bottomLevelGeometryInstanceMemoryRequirements.size,
+        .memoryTypeIndex = bottomLevelGeometryInstanceMemoryTypeIndex};
+
+    result = allocateDeviceMemory(
+        deviceHandle, memoryLedger, "Instance",
+        &bottomLevelGeometryInstanceMemoryAllocateInfo,
+        &bottomLevelGeometryInstanceDeviceMemoryHandleList[x]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkAllocateMemory");
+    }
+
+    result = vkBindBufferMemory(
+        deviceHandle, bottomLevelGeometryInstanceBufferHandleList[x],
+        bottomLevelGeometryInstanceDeviceMemoryHandleList[x], 0);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+    }
+
+    // Left mapped, the transform is rewritten before each rebuild
+    result = vkMapMemory(
+        deviceHandle, bottomLevelGeometryInstanceDeviceMemoryHandleList[x], 0,
+        sizeof(VkAccelerationStructureInstanceKHR) * topLevelInstanceCount, 0,
+        &hostBottomLevelGeometryInstanceMemoryBufferList[x]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkMapMemory");
+    }
+
+    VkBufferDeviceAddressInfo bottomLevelGeometryInstanceDeviceAddressInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .pNext = NULL,
+        .buffer = bottomLevelGeometryInstanceBufferHandleList[x]};
+
+    bottomLevelGeometryInstanceDeviceAddressList[x] =
+        pvkGetBufferDeviceAddressKHR(
+            deviceHandle, &bottomLevelGeometryInstanceDeviceAddressInfo);
+  }
+
+  VkAccelerationStructureGeometryDataKHR topLevelAccelerationStructureGeometryData =
+      {.instances = {
+           .sType =
+               VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+           .pNext = NULL,
+           .arrayOfPointers = VK_FALSE,
+           .data = {.deviceAddress =
+                        bottomLevelGeometryInstanceDeviceAddressList[0]}}};
+
+  VkAccelerationStructureGeometryKHR topLevelAccelerationStructureGeometry = {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+      .pNext = NULL,
+      .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+      .geometry = topLevelAccelerationStructureGeometryData,
+      .flags = VK_GEOMETRY_OPAQUE_BIT_KHR};
+
+  VkAccelerationStructureBuildGeometryInfoKHR
+      topLevelAccelerationStructureBuildGeometryInfo = {
+          .sType =
+              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+          .pNext = NULL,
+          .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+          .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR,
+          .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+          .srcAccelerationStructure = VK_NULL_HANDLE,
+          .dstAccelerationStructure = VK_NULL_HANDLE,
+          .geometryCount = 1,
+          .pGeometries = &topLevelAccelerationStructureGeometry,
+          .ppGeometries = NULL,
+          .scratchData = {.deviceAddress = 0}};
+
+  VkAccelerationStructureBuildSizesInfoKHR
+      topLevelAccelerationStructureBuildSizesInfo = {
+          .sType =
+              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+          .pNext = NULL,
+          .accelerationStructureSize = 0,
+          .updateScratchSize = 0,
+          .buildScratchSize = 0};
+
+  std::vector<uint32_t> topLevelMaxPrimitiveCountList = {
+      topLevelInstanceCount};
+
+  pvkGetAccelerationStructureBuildSizesKHR(
+      deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+      &topLevelAccelerationStructureBuildGeometryInfo,
+      topLevelMaxPrimitiveCountList.data(),
+      &topLevelAccelerationStructureBuildSizesInfo);
+
+  std::vector<VkBuffer> topLevelAccelerationStructureBufferHandleList(
+      topLevelAccelerationStructureCount, VK_NULL_HANDLE);
+
+  std::vector<VkDeviceMemory>
+      topLevelAccelerationStructureDeviceMemoryHandleList(
+          topLevelAccelerationStructureCount, VK_NULL_HANDLE);
+
+  std::vector<VkAccelerationStructureKHR>
+      topLevelAccelerationStructureHandleList(
+          topLevelAccelerationStructureCount, VK_NULL_HANDLE);
+
+  for (uint32_t x = 0; x < topLevelAccelerationStructureCount; x++) {
+    VkBufferCreateInfo topLevelAccelerationStructureBufferCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .size = topLevelAccelerationStructureBuildSizesInfo
+                    .accelerationStructureSize,
+        .usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+        .sharingMode = accelerationStructureSharingMode,
+        .queueFamilyIndexCount = (uint32_t)queueFamilyIndexList.size(),
+        .pQueueFamilyIndices = queueFamilyIndexList.data()};
+
+    result = vkCreateBuffer(
+        deviceHandle, &topLevelAccelerationStructureBufferCreateInfo, NULL,
+        &topLevelAccelerationStructureBufferHandleList[x]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateBuffer");
+    }
+
+    VkMemoryRequirements topLevelAccelerationStructureMemoryRequirements;
+    vkGetBufferMemoryRequirements(
+        deviceHandle, topLevelAccelerationStructureBufferHandleList[x],
+        &topLevelAccelerationStructureMemoryRequirements);
+
+    uint32_t topLevelAccelerationStructureMemoryTypeIndex = -1;
+    for (uint32_t y = 0; y < physicalDeviceMemoryProperties.memoryTypeCount;
+         y++) {
+
+      if ((topLevelAccelerationStructureMemoryRequirements.memoryTypeBits &
+           (1 << y)) &&
+          (physicalDeviceMemoryProperties.memoryTypes[y].propertyFlags &
+           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+        topLevelAccelerationStructureMemoryTypeIndex = y;
+        break;
+      }
+    }
+
+    VkMemoryAllocateInfo topLevelAccelerationStructureMemoryAllocateInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = NULL,
+        .allocationSize = topLevelAccelerationStructureMemoryRequirements.size,
+        .memoryTypeIndex = topLevelAccelerationStructureMemoryTypeIndex};
+
+    result = allocateDeviceMemory(
+        deviceHandle, memoryLedger, "Acceleration structure",
+        &topLevelAccelerationStructureMemoryAllocateInfo,
+        &topLevelAccelerationStructureDeviceMemoryHandleList[x]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkAllocateMemory");
+    }
+
+    result = vkBindBufferMemory(
+        deviceHandle, topLevelAccelerationStructureBufferHandleList[x],
+        topLevelAccelerationStructureDeviceMemoryHandleList[x], 0);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+    }
+
+    VkAccelerationStructureCreateInfoKHR
+        topLevelAccelerationStructureCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+            .pNext = NULL,
+            .createFlags = 0,
+            .buffer = topLevelAccelerationStructureBufferHandleList[x],
+            .offset = 0,
+            .size = topLevelAccelerationStructureBuildSizesInfo
+                        .accelerationStructureSize,
+            .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+            .deviceAddress = 0};
+
+    result = pvkCreateAccelerationStructureKHR(
+        deviceHandle, &topLevelAccelerationStructureCreateInfo, NULL,
+        &topLevelAccelerationStructureHandleList[x]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
+    }
+  }
+
+  // =========================================================================
+  // Build Top Level Acceleration Structure
+
+  beginTraceSection(mainTraceSection, "Build Top Level Acceleration Structure");
+
+  // Builds are serialized on the compute queue, so one scratch buffer is
+  // shared by both top level acceleration structures
+  VkBufferCreateInfo topLevelAccelerationStructureScratchBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = topLevelAccelerationStructureBuildSizesInfo.buildScratchSize,
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = 1,
+      .pQueueFamilyIndices = &computeQueueFamilyIndex};
+
+  VkBuffer topLevelAccelerationStructureScratchBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(
+      deviceHandle, &topLevelAccelerationStructureScratchBufferCreateInfo, NULL,
+      &topLevelAccelerationStructureScratchBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements topLevelAccelerationStructureScratchMemoryRequirements;
+  vkGetBufferMemoryRequirements(
+      deviceHandle, topLevelAccelerationStructureScratchBufferHandle,
+      &topLevelAccelerationStructureScratchMemoryRequirements);
+
+  uint32_t topLevelAccelerationStructureScratchMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+
+    if ((topLevelAccelerationStructureScratchMemoryRequirements.memoryTypeBits &
+         (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+      topLevelAccelerationStructureScratchMemoryTypeIndex = x;
       break;
     }
   }
 
-  VkMemoryAllocateInfo vertexMemoryAllocateInfo = {
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .pNext = &memoryAllocateFlagsInfo,
-      .allocationSize = vertexMemoryRequirements.size,
-      .memoryTypeIndex = vertexMemoryTypeIndex};
+  VkMemoryAllocateInfo topLevelAccelerationStructureScratchMemoryAllocateInfo =
+      {.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+       .pNext = &memoryAllocateFlagsInfo,
+       .allocationSize =
+           topLevelAccelerationStructureScratchMemoryRequirements.size,
+       .memoryTypeIndex = topLevelAccelerationStructureScratchMemoryTypeIndex};
+
+  VkDeviceMemory topLevelAccelerationStructureDeviceScratchMemoryHandle =
+      VK_NULL_HANDLE;
+
+  result = allocateDeviceMemory(
+      deviceHandle, memoryLedger, "Scratch",
+      &topLevelAccelerationStructureScratchMemoryAllocateInfo,
+      &topLevelAccelerationStructureDeviceScratchMemoryHandle);
 
-  VkDeviceMemory vertexDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &vertexMemoryAllocateInfo, NULL,
-                            &vertexDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
 
-  result = vkBindBufferMemory(deviceHandle, vertexBufferHandle,
-                              vertexDeviceMemoryHandle, 0);
+  result = vkBindBufferMemory(
+      deviceHandle, topLevelAccelerationStructureScratchBufferHandle,
+      topLevelAccelerationStructureDeviceScratchMemoryHandle, 0);
+
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkBindBufferMemory");
   }
 
-  void *hostVertexMemoryBuffer;
-  result = vkMapMemory(deviceHandle, vertexDeviceMemoryHandle, 0,
-                       sizeof(float) * attrib.vertices.size() * 3, 0,
-                       &hostVertexMemoryBuffer);
+  VkBufferDeviceAddressInfo
+      topLevelAccelerationStructureScratchBufferDeviceAddressInfo = {
+          .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+          .pNext = NULL,
+          .buffer = topLevelAccelerationStructureScratchBufferHandle};
+
+  VkDeviceAddress topLevelAccelerationStructureScratchBufferDeviceAddress =
+      pvkGetBufferDeviceAddressKHR(
+          deviceHandle,
+          &topLevelAccelerationStructureScratchBufferDeviceAddressInfo);
+
+  topLevelAccelerationStructureBuildGeometryInfo.scratchData = {
+      .deviceAddress = topLevelAccelerationStructureScratchBufferDeviceAddress};
+
+  VkAccelerationStructureBuildRangeInfoKHR
+      topLevelAccelerationStructureBuildRangeInfo = {
+          .primitiveCount = topLevelInstanceCount,
+          .primitiveOffset = 0,
+          .firstVertex = 0,
+          .transformOffset = 0};
+
+  const VkAccelerationStructureBuildRangeInfoKHR
+      *topLevelAccelerationStructureBuildRangeInfos =
+          &topLevelAccelerationStructureBuildRangeInfo;
+
+  // Compute timeline value that completes the latest build of each top level
+  // acceleration structure, and render timeline value of the last frame that
+  // traced it
+  std::vector<uint64_t> topLevelAccelerationStructureTimelineValueList(
+      topLevelAccelerationStructureCount, 0);
+
+  std::vector<uint64_t> topLevelRenderTimelineValueList(
+      topLevelAccelerationStructureCount, 0);
+
+  std::vector<double> topLevelSubmitMicrosecondsList(
+      topLevelAccelerationStructureCount, 0.0);
+
+  // Records and submits a build on the compute queue without waiting for it,
+  // the frame that first traces the result waits on its timeline value
+  auto buildTopLevelAccelerationStructure = [&](uint32_t index, float yaw) {
+    VkAccelerationStructureInstanceKHR bottomLevelAccelerationStructureInstance =
+        {.transform = {.matrix = {{cosf(yaw), 0.0, sinf(yaw), 0.0},
+                                  {0.0, 1.0, 0.0, 0.0},
+                                  {-sinf(yaw), 0.0, cosf(yaw), 0.0}}},
+         .instanceCustomIndex = 0,
+         .mask = 0xFF,
+         .instanceShaderBindingTableRecordOffset = 0,
+         .flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR,
+         .accelerationStructureReference =
+             bottomLevelAccelerationStructureDeviceAddress};
+
+#if defined(RESIDENCY_ENABLED)
+    // A resident cluster's custom index is its cluster index plus one. A
+    // cluster without a resident structure also sets RESIDENCY_PROXY_BIT, and
+    // its transform maps the proxy box to the cluster's bounds before the
+    // rotation.
+    VkAccelerationStructureInstanceKHR *hostClusterInstanceList =
+        (VkAccelerationStructureInstanceKHR *)
+            hostBottomLevelGeometryInstanceMemoryBufferList[index];
+
+    for (uint32_t x = 0; x < scene.clusterCount; x++) {
+      VkAccelerationStructureInstanceKHR clusterInstance =
+          bottomLevelAccelerationStructureInstance;
+
+      uint32_t slotIndex = clusterResidencySlotIndexList[x];
+      if (slotIndex != (uint32_t)-1) {
+        clusterInstance.instanceCustomIndex = x + 1;
+        clusterInstance.accelerationStructureReference =
+            residencySlotDeviceAddressList[slotIndex];
+      } else {
+        const float *clusterBounds = &clusterBoundsList[x * 6];
+        VkTransformMatrixKHR &transform = clusterInstance.transform;
+
+        // Flat clusters keep some thickness so the box normal stays defined
+        for (uint32_t y = 0; y < 3; y++) {
+          float translation = 0.0f;
+          for (uint32_t z = 0; z < 3; z++) {
+            translation += transform.matrix[y][z] * clusterBounds[z];
+            transform.matrix[y][z] *=
+                std::max(clusterBounds[z + 3] - clusterBounds[z], 0.0001f);
+          }
+          transform.matrix[y][3] = translation;
+        }
+
+        clusterInstance.instanceCustomIndex = (x + 1) | RESIDENCY_PROXY_BIT;
+        clusterInstance.mask = RESIDENCY_PROXY_MASK;
+      }
+
+      hostClusterInstanceList[x] = clusterInstance;
+    }
+#elif defined(LOD_ENABLED)
+    // The custom index is the level of detail mesh index plus one
+    VkAccelerationStructureInstanceKHR *hostClusterInstanceList =
+        (VkAccelerationStructureInstanceKHR *)
+            hostBottomLevelGeometryInstanceMemoryBufferList[index];
+
+    for (uint32_t x = 0; x < scene.clusterCount; x++) {
+      uint32_t meshIndex =
+          clusterLevelOfDetailList[x] * (uint32_t)scene.clusterCount + x;
+
+      hostClusterInstanceList[x] = bottomLevelAccelerationStructureInstance;
+      hostClusterInstanceList[x].instanceCustomIndex = meshIndex + 1;
+      hostClusterInstanceList[x].accelerationStructureReference =
+          levelOfDetailDeviceAddressList[meshIndex];
+    }
+#else
+    memcpy(hostBottomLevelGeometryInstanceMemoryBufferList[index],
+           &bottomLevelAccelerationStructureInstance,
+           sizeof(VkAccelerationStructureInstanceKHR));
+#endif
+
+    topLevelAccelerationStructureGeometry.geometry.instances.data
+        .deviceAddress = bottomLevelGeometryInstanceDeviceAddressList[index];
+
+    topLevelAccelerationStructureBuildGeometryInfo.dstAccelerationStructure =
+        topLevelAccelerationStructureHandleList[index];
+
+    VkCommandBufferBeginInfo topLevelCommandBufferBeginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = NULL};
+
+    result = vkBeginCommandBuffer(computeCommandBufferHandleList[index],
+                                  &topLevelCommandBufferBeginInfo);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+    }
+
+    if (isComputeTimestampSupported) {
+      vkCmdResetQueryPool(computeCommandBufferHandleList[index],
+                          accelerationStructureTimestampQueryPoolHandle,
+                          index * 2, 2);
+
+      vkCmdWriteTimestamp(computeCommandBufferHandleList[index],
+                          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          accelerationStructureTimestampQueryPoolHandle,
+                          index * 2);
+    }
+
+#if defined(RESIDENCY_ENABLED)
+    recordResidencyBuilds(computeCommandBufferHandleList[index]);
+#endif
+
+    pvkCmdBuildAccelerationStructuresKHR(
+        computeCommandBufferHandleList[index], 1,
+        &topLevelAccelerationStructureBuildGeometryInfo,
+        &topLevelAccelerationStructureBuildRangeInfos);
+
+    if (isComputeTimestampSupported) {
+      vkCmdWriteTimestamp(
+          computeCommandBufferHandleList[index],
+          VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+          accelerationStructureTimestampQueryPoolHandle, index * 2 + 1);
+    }
+
+    result = vkEndCommandBuffer(computeCommandBufferHandleList[index]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+    }
+
+    // Wait for the bottom level build, and for the last frame that traced
+    // this acceleration structure before it is overwritten
+    std::vector<VkSemaphore> topLevelWaitSemaphoreHandleList = {
+        accelerationStructureTimelineSemaphoreHandle,
+        renderTimelineSemaphoreHandle};
+
+    std::vector<uint64_t> topLevelWaitSemaphoreValueList = {
+        bottomLevelAccelerationStructureTimelineValue,
+        topLevelRenderTimelineValueList[index]};
+
+    std::vector<VkPipelineStageFlags> topLevelWaitPipelineStageFlagsList(
+        topLevelWaitSemaphoreHandleList.size(),
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR);
+
+    topLevelAccelerationStructureTimelineValueList[index] =
+        ++accelerationStructureTimelineValue;
+
+    VkTimelineSemaphoreSubmitInfo
+        topLevelAccelerationStructureBuildTimelineSemaphoreSubmitInfo = {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .pNext = NULL,
+            .waitSemaphoreValueCount =
+                (uint32_t)topLevelWaitSemaphoreValueList.size(),
+            .pWaitSemaphoreValues = topLevelWaitSemaphoreValueList.data(),
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues =
+                &topLevelAccelerationStructureTimelineValueList[index]};
+
+    VkSubmitInfo topLevelAccelerationStructureBuildSubmitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &topLevelAccelerationStructureBuildTimelineSemaphoreSubmitInfo,
+        .waitSemaphoreCount = (uint32_t)topLevelWaitSemaphoreHandleList.size(),
+        .pWaitSemaphores = topLevelWaitSemaphoreHandleList.data(),
+        .pWaitDstStageMask = topLevelWaitPipelineStageFlagsList.data(),
+        .commandBufferCount = 1,
+        .pCommandBuffers = &computeCommandBufferHandleList[index],
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &accelerationStructureTimelineSemaphoreHandle};
+
+    topLevelSubmitMicrosecondsList[index] = getTraceMicroseconds();
+    result = vkQueueSubmit(computeQueueHandle, 1,
+                           &topLevelAccelerationStructureBuildSubmitInfo,
+                           VK_NULL_HANDLE);
 
-  memcpy(hostVertexMemoryBuffer, attrib.vertices.data(),
-         sizeof(float) * attrib.vertices.size() * 3);
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkQueueSubmit");
+    }
+  };
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkMapMemory");
-  }
+  uint32_t activeTopLevelAccelerationStructureIndex = 0;
+  buildTopLevelAccelerationStructure(activeTopLevelAccelerationStructureIndex,
+                                     0.0);
 
-  vkUnmapMemory(deviceHandle, vertexDeviceMemoryHandle);
+  // =========================================================================
+  // Uniform Buffer
 
-  VkBufferDeviceAddressInfo vertexBufferDeviceAddressInfo = {
-      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-      .pNext = NULL,
-      .buffer = vertexBufferHandle};
+  beginTraceSection(mainTraceSection, "Uniform Buffer");
 
-  VkDeviceAddress vertexBufferDeviceAddress = pvkGetBufferDeviceAddressKHR(
-      deviceHandle, &vertexBufferDeviceAddressInfo);
+  struct UniformStructure {
+    float cameraPosition[4] = {0, 0, 0, 1};
+    float cameraRight[4] = {1, 0, 0, 1};
+    float cameraUp[4] = {0, 1, 0, 1};
+    float cameraForward[4] = {0, 0, 1, 1};
 
-  // =========================================================================
-  // Index Buffer
+    uint32_t frameCount = 0;
+  } uniformStructure;
 
-  VkBufferCreateInfo indexBufferCreateInfo = {
+  // One slice per frame in flight, selected with a dynamic offset
+  VkDeviceSize uniformBufferOffsetAlignment =
+      physicalDeviceProperties.limits.minUniformBufferOffsetAlignment;
+
+  VkDeviceSize uniformSliceSize =
+      (sizeof(UniformStructure) + uniformBufferOffsetAlignment - 1) &
+      ~(uniformBufferOffsetAlignment - 1);
+
+  VkBufferCreateInfo uniformBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = sizeof(uint32_t) * indexList.size(),
-      .usage =
-          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
-          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      .size = uniformSliceSize * FRAMES_IN_FLIGHT,
+      .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
       .pQueueFamilyIndices = &queueFamilyIndex};
 
-  VkBuffer indexBufferHandle = VK_NULL_HANDLE;
-  result = vkCreateBuffer(deviceHandle, &indexBufferCreateInfo, NULL,
-                          &indexBufferHandle);
+  VkBuffer uniformBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &uniformBufferCreateInfo, NULL,
+                          &uniformBufferHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkCreateBuffer");
   }
 
-  VkMemoryRequirements indexMemoryRequirements;
-  vkGetBufferMemoryRequirements(deviceHandle, indexBufferHandle,
-                                &indexMemoryRequirements);
+  VkMemoryRequirements uniformMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, uniformBufferHandle,
+                                &uniformMemoryRequirements);
 
-  uint32_t indexMemoryTypeIndex = -1;
+  uint32_t uniformMemoryTypeIndex = -1;
   for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
        x++) {
-    if ((indexMemoryRequirements.memoryTypeBits & (1 << x)) &&
+    if ((uniformMemoryRequirements.memoryTypeBits & (1 << x)) &&
         (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+         (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) ==
+            (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
 
-      indexMemoryTypeIndex = x;
+      uniformMemoryTypeIndex = x;
       break;
     }
   }
 
-  VkMemoryAllocateInfo indexMemoryAllocateInfo = {
+  VkMemoryAllocateInfo uniformMemoryAllocateInfo = {
       .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
       .pNext = &memoryAllocateFlagsInfo,
-      .allocationSize = indexMemoryRequirements.size,
-      .memoryTypeIndex = indexMemoryTypeIndex};
+      .allocationSize = uniformMemoryRequirements.size,
+      .memoryTypeIndex = uniformMemoryTypeIndex};
 
-  VkDeviceMemory indexDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &indexMemoryAllocateInfo, NULL,
-                            &indexDeviceMemoryHandle);
+  VkDeviceMemory uniformDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Uniform",
+                                &uniformMemoryAllocateInfo,
+                                &uniformDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
 
-  result = vkBindBufferMemory(deviceHandle, indexBufferHandle,
-                              indexDeviceMemoryHandle, 0);
+  result = vkBindBufferMemory(deviceHandle, uniformBufferHandle,
+                              uniformDeviceMemoryHandle, 0);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkBindBufferMemory");
   }
 
-  void *hostIndexMemoryBuffer;
-  result = vkMapMemory(deviceHandle, indexDeviceMemoryHandle, 0,
-                       sizeof(uint32_t) * indexList.size(), 0,
-                       &hostIndexMemoryBuffer);
-
-  memcpy(hostIndexMemoryBuffer, indexList.data(),
-         sizeof(uint32_t) * indexList.size());
+  // Left mapped, each frame writes its slice after waiting on its fence
+  void *hostUniformMemoryBuffer;
+  result = vkMapMemory(deviceHandle, uniformDeviceMemoryHandle, 0,
+                       VK_WHOLE_SIZE, 0, &hostUniformMemoryBuffer);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkMapMemory");
   }
 
-  vkUnmapMemory(deviceHandle, indexDeviceMemoryHandle);
+  for (uint32_t x = 0; x < FRAMES_IN_FLIGHT; x++) {
+    memcpy((uint8_t *)hostUniformMemoryBuffer + x * uniformSliceSize,
+           &uniformStructure, sizeof(UniformStructure));
+  }
 
-  VkBufferDeviceAddressInfo indexBufferDeviceAddressInfo = {
-      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-      .pNext = NULL,
-      .buffer = indexBufferHandle};
+  // =========================================================================
+  // Ray Trace Image
 
-  VkDeviceAddress indexBufferDeviceAddress =
-      pvkGetBufferDeviceAddressKHR(deviceHandle, &indexBufferDeviceAddressInfo);
+  beginTraceSection(mainTraceSection, "Ray Trace Image");
 
-  // =========================================================================
-  // Bottom Level Acceleration Structure
+  VkFenceCreateInfo
+      rayTraceImageBarrierAccelerationStructureBuildFenceCreateInfo = {
+          .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+          .pNext = NULL,
+          .flags = 0};
 
-  VkAccelerationStructureGeometryDataKHR
-      bottomLevelAccelerationStructureGeometryData = {
-          .triangles = {
-              .sType =
-                  VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
-              .pNext = NULL,
-              .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
-              .vertexData = {.deviceAddress = vertexBufferDeviceAddress},
-              .vertexStride = sizeof(float) * 3,
-              .maxVertex = (uint32_t)attrib.vertices.size(),
-              .indexType = VK_INDEX_TYPE_UINT32,
-              .indexData = {.deviceAddress = indexBufferDeviceAddress},
-              .transformData = {.deviceAddress = 0}}};
+  VkFence rayTraceImageBarrierAccelerationStructureBuildFenceHandle =
+      VK_NULL_HANDLE;
+  result = vkCreateFence(
+      deviceHandle,
+      &rayTraceImageBarrierAccelerationStructureBuildFenceCreateInfo, NULL,
+      &rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
 
-  VkAccelerationStructureGeometryKHR bottomLevelAccelerationStructureGeometry =
-      {.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
-       .pNext = NULL,
-       .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
-       .geometry = bottomLevelAccelerationStructureGeometryData,
-       .flags = VK_GEOMETRY_OPAQUE_BIT_KHR};
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateFence");
+  }
 
-  VkAccelerationStructureBuildGeometryInfoKHR
-      bottomLevelAccelerationStructureBuildGeometryInfo = {
-          .sType =
-              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-          .pNext = NULL,
-          .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-          .flags = 0,
-          .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
-          .srcAccelerationStructure = VK_NULL_HANDLE,
-          .dstAccelerationStructure = VK_NULL_HANDLE,
-          .geometryCount = 1,
-          .pGeometries = &bottomLevelAccelerationStructureGeometry,
-          .ppGeometries = NULL,
-          .scratchData = {.deviceAddress = 0}};
+  // Accumulation runs in 32-bit float, independent of the swapchain format.
+  // Presenting blits it into the swapchain image, converting the format and
+  // scaling from the render extent to the window.
+  VkFormat rayTraceImageFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+
+  VkFormatProperties rayTraceImageFormatProperties;
+  vkGetPhysicalDeviceFormatProperties(activePhysicalDeviceHandle,
+                                      rayTraceImageFormat,
+                                      &rayTraceImageFormatProperties);
+
+  VkFormatProperties swapchainFormatProperties;
+  vkGetPhysicalDeviceFormatProperties(activePhysicalDeviceHandle,
+                                      surfaceFormat.format,
+                                      &swapchainFormatProperties);
+
+  if (!(rayTraceImageFormatProperties.optimalTilingFeatures &
+        VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) ||
+      !(rayTraceImageFormatProperties.optimalTilingFeatures &
+        VK_FORMAT_FEATURE_BLIT_SRC_BIT) ||
+      !(swapchainFormatProperties.optimalTilingFeatures &
+        VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
+    throwExceptionVulkanAPI(VK_ERROR_FORMAT_NOT_SUPPORTED,
+                            "vkGetPhysicalDeviceFormatProperties");
+  }
 
-  VkAccelerationStructureBuildSizesInfoKHR
-      bottomLevelAccelerationStructureBuildSizesInfo = {
-          .sType =
-              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
-          .pNext = NULL,
-          .accelerationStructureSize = 0,
-          .updateScratchSize = 0,
-          .buildScratchSize = 0};
+  // Linear filtering of 32-bit float images is optional
+  VkFilter presentBlitFilter =
+      (rayTraceImageFormatProperties.optimalTilingFeatures &
+       VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)
+          ? VK_FILTER_LINEAR
+          : VK_FILTER_NEAREST;
 
-  std::vector<uint32_t> bottomLevelMaxPrimitiveCountList = {primitiveCount};
+  // The image is allocated at RENDER_SCALE, the trace covers the top left
+  // renderExtent of it, adjusted at runtime by dynamicResolutionScale
+  VkExtent2D rayTraceImageExtent = swapchainExtent;
+  float dynamicResolutionScale = 1.0f;
+  VkExtent2D renderExtent = swapchainExtent;
 
-  pvkGetAccelerationStructureBuildSizesKHR(
-      deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-      &bottomLevelAccelerationStructureBuildGeometryInfo,
-      bottomLevelMaxPrimitiveCountList.data(),
-      &bottomLevelAccelerationStructureBuildSizesInfo);
+  VkImage rayTraceImageHandle = VK_NULL_HANDLE;
+  VkDeviceMemory rayTraceImageDeviceMemoryHandle = VK_NULL_HANDLE;
+  VkImageView rayTraceImageViewHandle = VK_NULL_HANDLE;
 
-  VkBufferCreateInfo bottomLevelAccelerationStructureBufferCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .size = bottomLevelAccelerationStructureBuildSizesInfo
-                  .accelerationStructureSize,
-      .usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
-      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-      .queueFamilyIndexCount = 1,
-      .pQueueFamilyIndices = &queueFamilyIndex};
+#if defined(HEATMAP_ENABLED)
+  VkImage heatmapImageHandle = VK_NULL_HANDLE;
+  VkDeviceMemory heatmapImageDeviceMemoryHandle = VK_NULL_HANDLE;
+  VkImageView heatmapImageViewHandle = VK_NULL_HANDLE;
+
+  // Extent of the last recorded trace, the part of the heatmap that is valid
+  VkExtent2D heatmapExtent = {.width = 0, .height = 0};
+#endif
+
+  // Sized to the swapchain by RENDER_SCALE, recreated along with it
+  auto createRayTraceImage = [&]() {
+    rayTraceImageExtent = {
+        .width = std::max((uint32_t)(swapchainExtent.width * RENDER_SCALE), 1u),
+        .height =
+            std::max((uint32_t)(swapchainExtent.height * RENDER_SCALE), 1u)};
+
+    renderExtent = {
+        .width = std::max(
+            (uint32_t)(rayTraceImageExtent.width * dynamicResolutionScale), 1u),
+        .height = std::max(
+            (uint32_t)(rayTraceImageExtent.height * dynamicResolutionScale),
+            1u)};
+
+    VkImageCreateInfo rayTraceImageCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = rayTraceImageFormat,
+        .extent = {.width = rayTraceImageExtent.width,
+                   .height = rayTraceImageExtent.height,
+                   .depth = 1},
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices = &queueFamilyIndex,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
+
+    result = vkCreateImage(deviceHandle, &rayTraceImageCreateInfo, NULL,
+                           &rayTraceImageHandle);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateImage");
+    }
+
+    VkMemoryRequirements rayTraceImageMemoryRequirements;
+    vkGetImageMemoryRequirements(deviceHandle, rayTraceImageHandle,
+                                 &rayTraceImageMemoryRequirements);
+
+    uint32_t rayTraceImageMemoryTypeIndex = -1;
+    for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+         x++) {
+      if ((rayTraceImageMemoryRequirements.memoryTypeBits & (1 << x)) &&
+          (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+        rayTraceImageMemoryTypeIndex = x;
+        break;
+      }
+    }
+
+    VkMemoryAllocateInfo rayTraceImageMemoryAllocateInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = NULL,
+        .allocationSize = rayTraceImageMemoryRequirements.size,
+        .memoryTypeIndex = rayTraceImageMemoryTypeIndex};
+
+    result = allocateDeviceMemory(deviceHandle, memoryLedger, "Image",
+                                  &rayTraceImageMemoryAllocateInfo,
+                                  &rayTraceImageDeviceMemoryHandle);
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkAllocateMemory");
+    }
+
+    result = vkBindImageMemory(deviceHandle, rayTraceImageHandle,
+                               rayTraceImageDeviceMemoryHandle, 0);
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkBindImageMemory");
+    }
+
+    VkImageViewCreateInfo rayTraceImageViewCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .image = rayTraceImageHandle,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = rayTraceImageFormat,
+        .components = {.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                       .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                       .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                       .a = VK_COMPONENT_SWIZZLE_IDENTITY},
+        .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .baseMipLevel = 0,
+                             .levelCount = 1,
+                             .baseArrayLayer = 0,
+                             .layerCount = 1}};
+
+    result = vkCreateImageView(deviceHandle, &rayTraceImageViewCreateInfo, NULL,
+                               &rayTraceImageViewHandle);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateImageView");
+    }
+
+#if defined(HEATMAP_ENABLED)
+    VkImageCreateInfo heatmapImageCreateInfo = rayTraceImageCreateInfo;
+    heatmapImageCreateInfo.format = VK_FORMAT_R32G32B32A32_UINT;
+
+    result = vkCreateImage(deviceHandle, &heatmapImageCreateInfo, NULL,
+                           &heatmapImageHandle);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateImage");
+    }
+
+    VkMemoryRequirements heatmapImageMemoryRequirements;
+    vkGetImageMemoryRequirements(deviceHandle, heatmapImageHandle,
+                                 &heatmapImageMemoryRequirements);
+
+    uint32_t heatmapImageMemoryTypeIndex = -1;
+    for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+         x++) {
+      if ((heatmapImageMemoryRequirements.memoryTypeBits & (1 << x)) &&
+          (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+        heatmapImageMemoryTypeIndex = x;
+        break;
+      }
+    }
+
+    VkMemoryAllocateInfo heatmapImageMemoryAllocateInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = NULL,
+        .allocationSize = heatmapImageMemoryRequirements.size,
+        .memoryTypeIndex = heatmapImageMemoryTypeIndex};
+
+    result = allocateDeviceMemory(deviceHandle, memoryLedger, "Image",
+                                  &heatmapImageMemoryAllocateInfo,
+                                  &heatmapImageDeviceMemoryHandle);
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkAllocateMemory");
+    }
+
+    result = vkBindImageMemory(deviceHandle, heatmapImageHandle,
+                               heatmapImageDeviceMemoryHandle, 0);
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkBindImageMemory");
+    }
+
+    VkImageViewCreateInfo heatmapImageViewCreateInfo =
+        rayTraceImageViewCreateInfo;
+    heatmapImageViewCreateInfo.image = heatmapImageHandle;
+    heatmapImageViewCreateInfo.format = VK_FORMAT_R32G32B32A32_UINT;
+
+    result = vkCreateImageView(deviceHandle, &heatmapImageViewCreateInfo, NULL,
+                               &heatmapImageViewHandle);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateImageView");
+    }
+
+    heatmapExtent = {.width = 0, .height = 0};
+#endif
+
+    // Ray Trace Image Barrier
+    // (VK_IMAGE_LAYOUT_UNDEFINED -> VK_IMAGE_LAYOUT_GENERAL)
+
+    VkCommandBufferBeginInfo rayTraceImageBarrierCommandBufferBeginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = NULL};
+
+    result = vkBeginCommandBuffer(commandBufferHandleList.back(),
+                                  &rayTraceImageBarrierCommandBufferBeginInfo);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+    }
+
+    VkImageMemoryBarrier rayTraceGeneralMemoryBarrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = 0,
+        .dstAccessMask = 0,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = queueFamilyIndex,
+        .dstQueueFamilyIndex = queueFamilyIndex,
+        .image = rayTraceImageHandle,
+        .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .baseMipLevel = 0,
+                             .levelCount = 1,
+                             .baseArrayLayer = 0,
+                             .layerCount = 1}};
+
+    std::vector<VkImageMemoryBarrier> generalMemoryBarrierList = {
+        rayTraceGeneralMemoryBarrier};
+
+#if defined(HEATMAP_ENABLED)
+    VkImageMemoryBarrier heatmapGeneralMemoryBarrier =
+        rayTraceGeneralMemoryBarrier;
+    heatmapGeneralMemoryBarrier.image = heatmapImageHandle;
+
+    generalMemoryBarrierList.push_back(heatmapGeneralMemoryBarrier);
+#endif
+
+    vkCmdPipelineBarrier(commandBufferHandleList.back(),
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0,
+                         NULL, (uint32_t)generalMemoryBarrierList.size(),
+                         generalMemoryBarrierList.data());
+
+    result = vkEndCommandBuffer(commandBufferHandleList.back());
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+    }
+
+    VkSubmitInfo rayTraceImageBarrierAccelerationStructureBuildSubmitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = NULL,
+        .waitSemaphoreCount = 0,
+        .pWaitSemaphores = NULL,
+        .pWaitDstStageMask = NULL,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBufferHandleList.back(),
+        .signalSemaphoreCount = 0,
+        .pSignalSemaphores = NULL};
 
-  VkBuffer bottomLevelAccelerationStructureBufferHandle = VK_NULL_HANDLE;
-  result = vkCreateBuffer(deviceHandle,
-                          &bottomLevelAccelerationStructureBufferCreateInfo,
-                          NULL, &bottomLevelAccelerationStructureBufferHandle);
+    result = vkQueueSubmit(
+        queueHandle, 1,
+        &rayTraceImageBarrierAccelerationStructureBuildSubmitInfo,
+        rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateBuffer");
-  }
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkQueueSubmit");
+    }
 
-  VkMemoryRequirements bottomLevelAccelerationStructureMemoryRequirements;
-  vkGetBufferMemoryRequirements(
-      deviceHandle, bottomLevelAccelerationStructureBufferHandle,
-      &bottomLevelAccelerationStructureMemoryRequirements);
+    result = vkWaitForFences(
+        deviceHandle, 1,
+        &rayTraceImageBarrierAccelerationStructureBuildFenceHandle, true,
+        UINT32_MAX);
 
-  uint32_t bottomLevelAccelerationStructureMemoryTypeIndex = -1;
-  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
-       x++) {
+    if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+      throwExceptionVulkanAPI(result, "vkWaitForFences");
+    }
 
-    if ((bottomLevelAccelerationStructureMemoryRequirements.memoryTypeBits &
-         (1 << x)) &&
-        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+    result = vkResetFences(
+        deviceHandle, 1,
+        &rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
 
-      bottomLevelAccelerationStructureMemoryTypeIndex = x;
-      break;
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkResetFences");
     }
-  }
+  };
 
-  VkMemoryAllocateInfo bottomLevelAccelerationStructureMemoryAllocateInfo = {
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .pNext = NULL,
-      .allocationSize = bottomLevelAccelerationStructureMemoryRequirements.size,
-      .memoryTypeIndex = bottomLevelAccelerationStructureMemoryTypeIndex};
+  createRayTraceImage();
 
-  VkDeviceMemory bottomLevelAccelerationStructureDeviceMemoryHandle =
-      VK_NULL_HANDLE;
+  // =========================================================================
+  // Update Descriptor Set
 
-  result = vkAllocateMemory(
-      deviceHandle, &bottomLevelAccelerationStructureMemoryAllocateInfo, NULL,
-      &bottomLevelAccelerationStructureDeviceMemoryHandle);
+  beginTraceSection(mainTraceSection, "Update Descriptor Set");
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkAllocateMemory");
-  }
+  VkDescriptorBufferInfo uniformDescriptorInfo = {
+      .buffer = uniformBufferHandle,
+      .offset = 0,
+      .range = sizeof(UniformStructure)};
 
-  result = vkBindBufferMemory(
-      deviceHandle, bottomLevelAccelerationStructureBufferHandle,
-      bottomLevelAccelerationStructureDeviceMemoryHandle, 0);
+  VkDescriptorBufferInfo indexDescriptorInfo = {
+      .buffer = indexBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
-  }
+  VkDescriptorBufferInfo vertexDescriptorInfo = {
+      .buffer = vertexBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
 
-  VkAccelerationStructureCreateInfoKHR
-      bottomLevelAccelerationStructureCreateInfo = {
-          .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
-          .pNext = NULL,
-          .createFlags = 0,
-          .buffer = bottomLevelAccelerationStructureBufferHandle,
-          .offset = 0,
-          .size = bottomLevelAccelerationStructureBuildSizesInfo
-                      .accelerationStructureSize,
-          .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-          .deviceAddress = 0};
+  VkDescriptorImageInfo rayTraceImageDescriptorInfo = {
+      .sampler = VK_NULL_HANDLE,
+      .imageView = rayTraceImageViewHandle,
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
 
-  VkAccelerationStructureKHR bottomLevelAccelerationStructureHandle =
-      VK_NULL_HANDLE;
+#if defined(HEATMAP_ENABLED)
+  VkDescriptorImageInfo heatmapImageDescriptorInfo = {
+      .sampler = VK_NULL_HANDLE,
+      .imageView = heatmapImageViewHandle,
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+#endif
 
-  result = pvkCreateAccelerationStructureKHR(
-      deviceHandle, &bottomLevelAccelerationStructureCreateInfo, NULL,
-      &bottomLevelAccelerationStructureHandle);
+  // The acceleration structure handles never change, only their contents, so
+  // each set is written once. Only the ray trace image binding is rewritten
+  // when the swapchain is recreated.
+  for (uint32_t x = 0; x < topLevelAccelerationStructureCount; x++) {
+    VkWriteDescriptorSetAccelerationStructureKHR
+        accelerationStructureDescriptorInfo = {
+            .sType =
+                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR,
+            .pNext = NULL,
+            .accelerationStructureCount = 1,
+            .pAccelerationStructures =
+                &topLevelAccelerationStructureHandleList[x]};
+
+    std::vector<VkWriteDescriptorSet> writeDescriptorSetList = {
+        {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .pNext = &accelerationStructureDescriptorInfo,
+         .dstSet = descriptorSetHandleList[x],
+         .dstBinding = 0,
+         .dstArrayElement = 0,
+         .descriptorCount = 1,
+         .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
+         .pImageInfo = NULL,
+         .pBufferInfo = NULL,
+         .pTexelBufferView = NULL},
+        {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .pNext = NULL,
+         .dstSet = descriptorSetHandleList[x],
+         .dstBinding = 1,
+         .dstArrayElement = 0,
+         .descriptorCount = 1,
+         .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+         .pImageInfo = NULL,
+         .pBufferInfo = &uniformDescriptorInfo,
+         .pTexelBufferView = NULL},
+        {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .pNext = NULL,
+         .dstSet = descriptorSetHandleList[x],
+         .dstBinding = 2,
+         .dstArrayElement = 0,
+         .descriptorCount = 1,
+         .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .pImageInfo = NULL,
+         .pBufferInfo = &indexDescriptorInfo,
+         .pTexelBufferView = NULL},
+        {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .pNext = NULL,
+         .dstSet = descriptorSetHandleList[x],
+         .dstBinding = 3,
+         .dstArrayElement = 0,
+         .descriptorCount = 1,
+         .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+         .pImageInfo = NULL,
+         .pBufferInfo = &vertexDescriptorInfo,
+         .pTexelBufferView = NULL},
+        {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .pNext = NULL,
+         .dstSet = descriptorSetHandleList[x],
+         .dstBinding = 4,
+         .dstArrayElement = 0,
+         .descriptorCount = 1,
+         .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+         .pImageInfo = &rayTraceImageDescriptorInfo,
+         .pBufferInfo = NULL,
+         .pTexelBufferView = NULL}};
+
+#if defined(HEATMAP_ENABLED)
+    writeDescriptorSetList.push_back(
+        {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+         .pNext = NULL,
+         .dstSet = descriptorSetHandleList[x],
+         .dstBinding = 6,
+         .dstArrayElement = 0,
+         .descriptorCount = 1,
+         .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+         .pImageInfo = &heatmapImageDescriptorInfo,
+         .pBufferInfo = NULL,
+         .pTexelBufferView = NULL});
+#endif
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
+    vkUpdateDescriptorSets(deviceHandle, writeDescriptorSetList.size(),
+                           writeDescriptorSetList.data(), 0, NULL);
   }
 
+#if defined(RAY_COUNTERS_ENABLED)
   // =========================================================================
-  // Build Bottom Level Acceleration Structure
+  // Ray Counter Buffer
 
-  VkAccelerationStructureDeviceAddressInfoKHR
-      bottomLevelAccelerationStructureDeviceAddressInfo = {
-          .sType =
-              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
-          .pNext = NULL,
-          .accelerationStructure = bottomLevelAccelerationStructureHandle};
+  beginTraceSection(mainTraceSection, "Ray Counter Buffer");
 
-  VkDeviceAddress bottomLevelAccelerationStructureDeviceAddress =
-      pvkGetAccelerationStructureDeviceAddressKHR(
-          deviceHandle, &bottomLevelAccelerationStructureDeviceAddressInfo);
+  // One slice of counters per frame in flight, selected with a dynamic offset
+  VkDeviceSize storageBufferOffsetAlignment =
+      physicalDeviceProperties.limits.minStorageBufferOffsetAlignment;
 
-  VkBufferCreateInfo bottomLevelAccelerationStructureScratchBufferCreateInfo = {
+  VkDeviceSize rayCounterSliceSize =
+      (rayTypeNameList.size() * sizeof(uint32_t) +
+       storageBufferOffsetAlignment - 1) &
+      ~(storageBufferOffsetAlignment - 1);
+
+  VkBufferCreateInfo rayCounterBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = bottomLevelAccelerationStructureBuildSizesInfo.buildScratchSize,
-      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      .size = rayCounterSliceSize * FRAMES_IN_FLIGHT,
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
       .pQueueFamilyIndices = &queueFamilyIndex};
 
-  VkBuffer bottomLevelAccelerationStructureScratchBufferHandle = VK_NULL_HANDLE;
-  result = vkCreateBuffer(
-      deviceHandle, &bottomLevelAccelerationStructureScratchBufferCreateInfo,
-      NULL, &bottomLevelAccelerationStructureScratchBufferHandle);
+  VkBuffer rayCounterBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &rayCounterBufferCreateInfo, NULL,
+                          &rayCounterBufferHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkCreateBuffer");
   }
 
-  VkMemoryRequirements
-      bottomLevelAccelerationStructureScratchMemoryRequirements;
-  vkGetBufferMemoryRequirements(
-      deviceHandle, bottomLevelAccelerationStructureScratchBufferHandle,
-      &bottomLevelAccelerationStructureScratchMemoryRequirements);
+  VkMemoryRequirements rayCounterMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, rayCounterBufferHandle,
+                                &rayCounterMemoryRequirements);
 
-  uint32_t bottomLevelAccelerationStructureScratchMemoryTypeIndex = -1;
+  uint32_t rayCounterMemoryTypeIndex = -1;
   for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
        x++) {
-
-    if ((bottomLevelAccelerationStructureScratchMemoryRequirements
-             .memoryTypeBits &
-         (1 << x)) &&
+    if ((rayCounterMemoryRequirements.memoryTypeBits & (1 << x)) &&
         (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+         (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) ==
+            (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
 
-      bottomLevelAccelerationStructureScratchMemoryTypeIndex = x;
+      rayCounterMemoryTypeIndex = x;
       break;
     }
   }
 
-  VkMemoryAllocateInfo
-      bottomLevelAccelerationStructureScratchMemoryAllocateInfo = {
-          .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-          .pNext = &memoryAllocateFlagsInfo,
-          .allocationSize =
-              bottomLevelAccelerationStructureScratchMemoryRequirements.size,
-          .memoryTypeIndex =
-              bottomLevelAccelerationStructureScratchMemoryTypeIndex};
-
-  VkDeviceMemory bottomLevelAccelerationStructureDeviceScratchMemoryHandle =
-      VK_NULL_HANDLE;
-
-  result = vkAllocateMemory(
-      deviceHandle, &bottomLevelAccelerationStructureScratchMemoryAllocateInfo,
-      NULL, &bottomLevelAccelerationStructureDeviceScratchMemoryHandle);
+  VkMemoryAllocateInfo rayCounterMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = NULL,
+      .allocationSize = rayCounterMemoryRequirements.size,
+      .memoryTypeIndex = rayCounterMemoryTypeIndex};
 
+  VkDeviceMemory rayCounterDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Ray counter",
+                                &rayCounterMemoryAllocateInfo,
+                                &rayCounterDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
 
-  result = vkBindBufferMemory(
-      deviceHandle, bottomLevelAccelerationStructureScratchBufferHandle,
-      bottomLevelAccelerationStructureDeviceScratchMemoryHandle, 0);
-
+  result = vkBindBufferMemory(deviceHandle, rayCounterBufferHandle,
+                              rayCounterDeviceMemoryHandle, 0);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkBindBufferMemory");
   }
 
-  VkBufferDeviceAddressInfo
-      bottomLevelAccelerationStructureScratchBufferDeviceAddressInfo = {
-          .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-          .pNext = NULL,
-          .buffer = bottomLevelAccelerationStructureScratchBufferHandle};
-
-  VkDeviceAddress bottomLevelAccelerationStructureScratchBufferDeviceAddress =
-      pvkGetBufferDeviceAddressKHR(
-          deviceHandle,
-          &bottomLevelAccelerationStructureScratchBufferDeviceAddressInfo);
-
-  bottomLevelAccelerationStructureBuildGeometryInfo.dstAccelerationStructure =
-      bottomLevelAccelerationStructureHandle;
-
-  bottomLevelAccelerationStructureBuildGeometryInfo.scratchData = {
-      .deviceAddress =
-          bottomLevelAccelerationStructureScratchBufferDeviceAddress};
-
-  VkAccelerationStructureBuildRangeInfoKHR
-      bottomLevelAccelerationStructureBuildRangeInfo = {.primitiveCount =
-                                                            primitiveCount,
-                                                        .primitiveOffset = 0,
-                                                        .firstVertex = 0,
-                                                        .transformOffset = 0};
-
-  const VkAccelerationStructureBuildRangeInfoKHR
-      *bottomLevelAccelerationStructureBuildRangeInfos =
-          &bottomLevelAccelerationStructureBuildRangeInfo;
-
-  VkCommandBufferBeginInfo bottomLevelCommandBufferBeginInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-      .pNext = NULL,
-      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-      .pInheritanceInfo = NULL};
-
-  result = vkBeginCommandBuffer(commandBufferHandleList.back(),
-                                &bottomLevelCommandBufferBeginInfo);
-
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
-  }
-
-  pvkCmdBuildAccelerationStructuresKHR(
-      commandBufferHandleList.back(), 1,
-      &bottomLevelAccelerationStructureBuildGeometryInfo,
-      &bottomLevelAccelerationStructureBuildRangeInfos);
-
-  result = vkEndCommandBuffer(commandBufferHandleList.back());
+  // Left mapped, each frame reads and clears its slice after waiting on its
+  // fence
+  void *hostRayCounterMemoryBuffer;
+  result = vkMapMemory(deviceHandle, rayCounterDeviceMemoryHandle, 0,
+                       VK_WHOLE_SIZE, 0, &hostRayCounterMemoryBuffer);
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+    throwExceptionVulkanAPI(result, "vkMapMemory");
   }
 
-  VkSubmitInfo bottomLevelAccelerationStructureBuildSubmitInfo = {
-      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-      .pNext = NULL,
-      .waitSemaphoreCount = 0,
-      .pWaitSemaphores = NULL,
-      .pWaitDstStageMask = NULL,
-      .commandBufferCount = 1,
-      .pCommandBuffers = &commandBufferHandleList.back(),
-      .signalSemaphoreCount = 0,
-      .pSignalSemaphores = NULL};
-
-  VkFenceCreateInfo bottomLevelAccelerationStructureBuildFenceCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, .pNext = NULL, .flags = 0};
-
-  VkFence bottomLevelAccelerationStructureBuildFenceHandle = VK_NULL_HANDLE;
-  result = vkCreateFence(
-      deviceHandle, &bottomLevelAccelerationStructureBuildFenceCreateInfo, NULL,
-      &bottomLevelAccelerationStructureBuildFenceHandle);
-
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateFence");
-  }
+  memset(hostRayCounterMemoryBuffer, 0, rayCounterBufferCreateInfo.size);
 
-  result = vkQueueSubmit(queueHandle, 1,
-                         &bottomLevelAccelerationStructureBuildSubmitInfo,
-                         bottomLevelAccelerationStructureBuildFenceHandle);
+  VkDescriptorBufferInfo rayCounterDescriptorInfo = {
+      .buffer = rayCounterBufferHandle,
+      .offset = 0,
+      .range = rayTypeNameList.size() * sizeof(uint32_t)};
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkQueueSubmit");
+  for (uint32_t x = 0; x < topLevelAccelerationStructureCount; x++) {
+    VkWriteDescriptorSet rayCounterWriteDescriptorSet = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .pNext = NULL,
+        .dstSet = descriptorSetHandleList[x],
+        .dstBinding = 5,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+        .pImageInfo = NULL,
+        .pBufferInfo = &rayCounterDescriptorInfo,
+        .pTexelBufferView = NULL};
+
+    vkUpdateDescriptorSets(deviceHandle, 1, &rayCounterWriteDescriptorSet, 0,
+                           NULL);
   }
 
-  result = vkWaitForFences(deviceHandle, 1,
-                           &bottomLevelAccelerationStructureBuildFenceHandle,
-                           true, UINT32_MAX);
-
-  if (result != VK_SUCCESS && result != VK_TIMEOUT) {
-    throwExceptionVulkanAPI(result, "vkWaitForFences");
-  }
+  std::vector<uint64_t> windowRayCountList(rayTypeNameList.size(), 0);
+  double windowTraceMilliseconds = 0.0;
+#endif
 
   // =========================================================================
-  // Top Level Acceleration Structure
+  // Material Index Buffer
 
-  VkAccelerationStructureInstanceKHR bottomLevelAccelerationStructureInstance =
-      {.transform = {.matrix = {{1.0, 0.0, 0.0, 0.0},
-                                {0.0, 1.0, 0.0, 0.0},
-                                {0.0, 0.0, 1.0, 0.0}}},
-       .instanceCustomIndex = 0,
-       .mask = 0xFF,
-       .instanceShaderBindingTableRecordOffset = 0,
-       .flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR,
-       .accelerationStructureReference =
-           bottomLevelAccelerationStructureDeviceAddress};
-
-  VkBufferCreateInfo bottomLevelGeometryInstanceBufferCreateInfo = {
+  beginTraceSection(mainTraceSection, "Material Index Buffer");
+
+  VkBufferCreateInfo materialIndexBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = sizeof(VkAccelerationStructureInstanceKHR),
-      .usage =
-          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
-          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      .size = sizeof(uint32_t) * scene.primitiveCount,
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
       .pQueueFamilyIndices = &queueFamilyIndex};
 
-  VkBuffer bottomLevelGeometryInstanceBufferHandle = VK_NULL_HANDLE;
-  result =
-      vkCreateBuffer(deviceHandle, &bottomLevelGeometryInstanceBufferCreateInfo,
-                     NULL, &bottomLevelGeometryInstanceBufferHandle);
+  VkBuffer materialIndexBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &materialIndexBufferCreateInfo, NULL,
+                          &materialIndexBufferHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkCreateBuffer");
   }
 
-  VkMemoryRequirements bottomLevelGeometryInstanceMemoryRequirements;
-  vkGetBufferMemoryRequirements(deviceHandle,
-                                bottomLevelGeometryInstanceBufferHandle,
-                                &bottomLevelGeometryInstanceMemoryRequirements);
+  VkMemoryRequirements materialIndexMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, materialIndexBufferHandle,
+                                &materialIndexMemoryRequirements);
 
-  uint32_t bottomLevelGeometryInstanceMemoryTypeIndex = -1;
+  uint32_t materialIndexMemoryTypeIndex = -1;
   for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
        x++) {
-
-    if ((bottomLevelGeometryInstanceMemoryRequirements.memoryTypeBits &
-         (1 << x)) &&
+    if ((materialIndexMemoryRequirements.memoryTypeBits & (1 << x)) &&
         (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
 
-      bottomLevelGeometryInstanceMemoryTypeIndex = x;
+      materialIndexMemoryTypeIndex = x;
       break;
     }
   }
 
-  VkMemoryAllocateInfo bottomLevelGeometryInstanceMemoryAllocateInfo = {
+  VkMemoryAllocateInfo materialIndexMemoryAllocateInfo = {
       .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
       .pNext = &memoryAllocateFlagsInfo,
-      .allocationSize = bottomLevelGeometryInstanceMemoryRequirements.size,
-      .memoryTypeIndex = bottomLevelGeometryInstanceMemoryTypeIndex};
-
-  VkDeviceMemory bottomLevelGeometryInstanceDeviceMemoryHandle = VK_NULL_HANDLE;
-
-  result = vkAllocateMemory(
-      deviceHandle, &bottomLevelGeometryInstanceMemoryAllocateInfo, NULL,
-      &bottomLevelGeometryInstanceDeviceMemoryHandle);
+      .allocationSize = materialIndexMemoryRequirements.size,
+      .memoryTypeIndex = materialIndexMemoryTypeIndex};
 
+  VkDeviceMemory materialIndexDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Material",
+                                &materialIndexMemoryAllocateInfo,
+                                &materialIndexDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
 
-  result =
-      vkBindBufferMemory(deviceHandle, bottomLevelGeometryInstanceBufferHandle,
-                         bottomLevelGeometryInstanceDeviceMemoryHandle, 0);
-
+  result = vkBindBufferMemory(deviceHandle, materialIndexBufferHandle,
+                              materialIndexDeviceMemoryHandle, 0);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkBindBufferMemory");
   }
 
-  void *hostbottomLevelGeometryInstanceMemoryBuffer;
-  result =
-      vkMapMemory(deviceHandle, bottomLevelGeometryInstanceDeviceMemoryHandle,
-                  0, sizeof(VkAccelerationStructureInstanceKHR), 0,
-                  &hostbottomLevelGeometryInstanceMemoryBuffer);
-
-  memcpy(hostbottomLevelGeometryInstanceMemoryBuffer,
-         &bottomLevelAccelerationStructureInstance,
-         sizeof(VkAccelerationStructureInstanceKHR));
-
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkMapMemory");
-  }
-
-  vkUnmapMemory(deviceHandle, bottomLevelGeometryInstanceDeviceMemoryHandle);
-
-  VkBufferDeviceAddressInfo bottomLevelGeometryInstanceDeviceAddressInfo = {
-      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-      .pNext = NULL,
-      .buffer = bottomLevelGeometryInstanceBufferHandle};
-
-  VkDeviceAddress bottomLevelGeometryInstanceDeviceAddress =
-      pvkGetBufferDeviceAddressKHR(
-          deviceHandle, &bottomLevelGeometryInstanceDeviceAddressInfo);
-
-  VkAccelerationStructureGeometryDataKHR topLevelAccelerationStructureGeometryData =
-      {.instances = {
-           .sType =
-               VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
-           .pNext = NULL,
-           .arrayOfPointers = VK_FALSE,
-           .data = {.deviceAddress =
-                        bottomLevelGeometryInstanceDeviceAddress}}};
-
-  VkAccelerationStructureGeometryKHR topLevelAccelerationStructureGeometry = {
-      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
-      .pNext = NULL,
-      .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
-      .geometry = topLevelAccelerationStructureGeometryData,
-      .flags = VK_GEOMETRY_OPAQUE_BIT_KHR};
+  void *hostMaterialIndexMemoryBuffer;
+  result = vkMapMemory(deviceHandle, materialIndexDeviceMemoryHandle, 0,
+                       sizeof(uint32_t) * scene.primitiveCount, 0,
+                       &hostMaterialIndexMemoryBuffer);
 
-  VkAccelerationStructureBuildGeometryInfoKHR
-      topLevelAccelerationStructureBuildGeometryInfo = {
-          .sType =
-              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-          .pNext = NULL,
-          .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
-          .flags = 0,
-          .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
-          .srcAccelerationStructure = VK_NULL_HANDLE,
-          .dstAccelerationStructure = VK_NULL_HANDLE,
-          .geometryCount = 1,
-          .pGeometries = &topLevelAccelerationStructureGeometry,
-          .ppGeometries = NULL,
-          .scratchData = {.deviceAddress = 0}};
+  memcpy(hostMaterialIndexMemoryBuffer, scene.materialIndexData,
+         sizeof(uint32_t) * scene.primitiveCount);
 
-  VkAccelerationStructureBuildSizesInfoKHR
-      topLevelAccelerationStructureBuildSizesInfo = {
-          .sType =
-              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
-          .pNext = NULL,
-          .accelerationStructureSize = 0,
-          .updateScratchSize = 0,
-          .buildScratchSize = 0};
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkMapMemory");
+  }
 
-  std::vector<uint32_t> topLevelMaxPrimitiveCountList = {1};
+  vkUnmapMemory(deviceHandle, materialIndexDeviceMemoryHandle);
 
-  pvkGetAccelerationStructureBuildSizesKHR(
-      deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-      &topLevelAccelerationStructureBuildGeometryInfo,
-      topLevelMaxPrimitiveCountList.data(),
-      &topLevelAccelerationStructureBuildSizesInfo);
+  // =========================================================================
+  // Material Buffer
 
-  VkBufferCreateInfo topLevelAccelerationStructureBufferCreateInfo = {
+  beginTraceSection(mainTraceSection, "Material Buffer");
+
+  VkBufferCreateInfo materialBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size =
-          topLevelAccelerationStructureBuildSizesInfo.accelerationStructureSize,
-      .usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+      .size = sizeof(Material) * scene.materialCount,
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
       .pQueueFamilyIndices = &queueFamilyIndex};
 
-  VkBuffer topLevelAccelerationStructureBufferHandle = VK_NULL_HANDLE;
-  result = vkCreateBuffer(deviceHandle,
-                          &topLevelAccelerationStructureBufferCreateInfo, NULL,
-                          &topLevelAccelerationStructureBufferHandle);
+  VkBuffer materialBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &materialBufferCreateInfo, NULL,
+                          &materialBufferHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkCreateBuffer");
   }
 
-  VkMemoryRequirements topLevelAccelerationStructureMemoryRequirements;
-  vkGetBufferMemoryRequirements(
-      deviceHandle, topLevelAccelerationStructureBufferHandle,
-      &topLevelAccelerationStructureMemoryRequirements);
+  VkMemoryRequirements materialMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, materialBufferHandle,
+                                &materialMemoryRequirements);
 
-  uint32_t topLevelAccelerationStructureMemoryTypeIndex = -1;
+  uint32_t materialMemoryTypeIndex = -1;
   for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
        x++) {
-
-    if ((topLevelAccelerationStructureMemoryRequirements.memoryTypeBits &
-         (1 << x)) &&
+    if ((materialMemoryRequirements.memoryTypeBits & (1 << x)) &&
         (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
 
-      topLevelAccelerationStructureMemoryTypeIndex = x;
+      materialMemoryTypeIndex = x;
       break;
     }
   }
 
-  VkMemoryAllocateInfo topLevelAccelerationStructureMemoryAllocateInfo = {
+  VkMemoryAllocateInfo materialMemoryAllocateInfo = {
       .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .pNext = NULL,
-      .allocationSize = topLevelAccelerationStructureMemoryRequirements.size,
-      .memoryTypeIndex = topLevelAccelerationStructureMemoryTypeIndex};
-
-  VkDeviceMemory topLevelAccelerationStructureDeviceMemoryHandle =
-      VK_NULL_HANDLE;
-
-  result = vkAllocateMemory(
-      deviceHandle, &topLevelAccelerationStructureMemoryAllocateInfo, NULL,
-      &topLevelAccelerationStructureDeviceMemoryHandle);
+      .pNext = &memoryAllocateFlagsInfo,
+      .allocationSize = materialMemoryRequirements.size,
+      .memoryTypeIndex = materialMemoryTypeIndex};
 
+  VkDeviceMemory materialDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Material",
+                                &materialMemoryAllocateInfo,
+                                &materialDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
 
-  result = vkBindBufferMemory(
-      deviceHandle, topLevelAccelerationStructureBufferHandle,
-      topLevelAccelerationStructureDeviceMemoryHandle, 0);
-
+  result = vkBindBufferMemory(deviceHandle, materialBufferHandle,
+                              materialDeviceMemoryHandle, 0);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkBindBufferMemory");
   }
 
-  VkAccelerationStructureCreateInfoKHR topLevelAccelerationStructureCreateInfo =
-      {.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
-       .pNext = NULL,
-       .createFlags = 0,
-       .buffer = topLevelAccelerationStructureBufferHandle,
-       .offset = 0,
-       .size = topLevelAccelerationStructureBuildSizesInfo
-                   .accelerationStructureSize,
-       .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
-       .deviceAddress = 0};
-
-  VkAccelerationStructureKHR topLevelAccelerationStructureHandle =
-      VK_NULL_HANDLE;
+  void *hostMaterialMemoryBuffer;
+  result = vkMapMemory(deviceHandle, materialDeviceMemoryHandle, 0,
+                       sizeof(Material) * scene.materialCount, 0,
+                       &hostMaterialMemoryBuffer);
 
-  result = pvkCreateAccelerationStructureKHR(
-      deviceHandle, &topLevelAccelerationStructureCreateInfo, NULL,
-      &topLevelAccelerationStructureHandle);
+  memcpy(hostMaterialMemoryBuffer, scene.materialData,
+         sizeof(Material) * scene.materialCount);
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateAccelerationStructureKHR");
+    throwExceptionVulkanAPI(result, "vkMapMemory");
   }
 
+  vkUnmapMemory(deviceHandle, materialDeviceMemoryHandle);
+
   // =========================================================================
-  // Build Top Level Acceleration Structure
+  // Update Material Descriptor Set
 
-  VkAccelerationStructureDeviceAddressInfoKHR
-      topLevelAccelerationStructureDeviceAddressInfo = {
-          .sType =
-              VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
-          .pNext = NULL,
-          .accelerationStructure = topLevelAccelerationStructureHandle};
+  beginTraceSection(mainTraceSection, "Update Material Descriptor Set");
 
-  VkDeviceAddress topLevelAccelerationStructureDeviceAddress =
-      pvkGetAccelerationStructureDeviceAddressKHR(
-          deviceHandle, &topLevelAccelerationStructureDeviceAddressInfo);
+  VkDescriptorBufferInfo materialIndexDescriptorInfo = {
+      .buffer = materialIndexBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
 
-  VkBufferCreateInfo topLevelAccelerationStructureScratchBufferCreateInfo = {
+  VkDescriptorBufferInfo materialDescriptorInfo = {
+      .buffer = materialBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
+
+  std::vector<VkWriteDescriptorSet> materialWriteDescriptorSetList = {
+      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+       .pNext = NULL,
+       .dstSet = descriptorSetHandleList.back(),
+       .dstBinding = 0,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+       .pImageInfo = NULL,
+       .pBufferInfo = &materialIndexDescriptorInfo,
+       .pTexelBufferView = NULL},
+      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+       .pNext = NULL,
+       .dstSet = descriptorSetHandleList.back(),
+       .dstBinding = 1,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+       .pImageInfo = NULL,
+       .pBufferInfo = &materialDescriptorInfo,
+       .pTexelBufferView = NULL}};
+
+  vkUpdateDescriptorSets(deviceHandle, materialWriteDescriptorSetList.size(),
+                         materialWriteDescriptorSetList.data(), 0, NULL);
+
+  // =========================================================================
+  // Shader Binding Table
+
+  beginTraceSection(mainTraceSection, "Shader Binding Table");
+
+  VkDeviceSize progSize =
+      physicalDeviceRayTracingPipelineProperties.shaderGroupBaseAlignment;
+
+  VkDeviceSize shaderBindingTableSize = progSize * 4;
+
+  VkBufferCreateInfo shaderBindingTableBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = topLevelAccelerationStructureBuildSizesInfo.buildScratchSize,
-      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+      .size = shaderBindingTableSize,
+      .usage = VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR |
                VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
       .pQueueFamilyIndices = &queueFamilyIndex};
 
-  VkBuffer topLevelAccelerationStructureScratchBufferHandle = VK_NULL_HANDLE;
-  result = vkCreateBuffer(
-      deviceHandle, &topLevelAccelerationStructureScratchBufferCreateInfo, NULL,
-      &topLevelAccelerationStructureScratchBufferHandle);
+  VkBuffer shaderBindingTableBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &shaderBindingTableBufferCreateInfo,
+                          NULL, &shaderBindingTableBufferHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkCreateBuffer");
   }
 
-  VkMemoryRequirements topLevelAccelerationStructureScratchMemoryRequirements;
-  vkGetBufferMemoryRequirements(
-      deviceHandle, topLevelAccelerationStructureScratchBufferHandle,
-      &topLevelAccelerationStructureScratchMemoryRequirements);
+  VkMemoryRequirements shaderBindingTableMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, shaderBindingTableBufferHandle,
+                                &shaderBindingTableMemoryRequirements);
 
-  uint32_t topLevelAccelerationStructureScratchMemoryTypeIndex = -1;
+  uint32_t shaderBindingTableMemoryTypeIndex = -1;
   for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
        x++) {
-
-    if ((topLevelAccelerationStructureScratchMemoryRequirements.memoryTypeBits &
-         (1 << x)) &&
+    if ((shaderBindingTableMemoryRequirements.memoryTypeBits & (1 << x)) &&
         (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
 
-      topLevelAccelerationStructureScratchMemoryTypeIndex = x;
+      shaderBindingTableMemoryTypeIndex = x;
       break;
     }
   }
 
-  VkMemoryAllocateInfo topLevelAccelerationStructureScratchMemoryAllocateInfo =
-      {.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-       .pNext = &memoryAllocateFlagsInfo,
-       .allocationSize =
-           topLevelAccelerationStructureScratchMemoryRequirements.size,
-       .memoryTypeIndex = topLevelAccelerationStructureScratchMemoryTypeIndex};
-
-  VkDeviceMemory topLevelAccelerationStructureDeviceScratchMemoryHandle =
-      VK_NULL_HANDLE;
-
-  result = vkAllocateMemory(
-      deviceHandle, &topLevelAccelerationStructureScratchMemoryAllocateInfo,
-      NULL, &topLevelAccelerationStructureDeviceScratchMemoryHandle);
+  VkMemoryAllocateInfo shaderBindingTableMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = &memoryAllocateFlagsInfo,
+      .allocationSize = shaderBindingTableMemoryRequirements.size,
+      .memoryTypeIndex = shaderBindingTableMemoryTypeIndex};
 
+  VkDeviceMemory shaderBindingTableDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger,
+                                "Shader binding table",
+                                &shaderBindingTableMemoryAllocateInfo,
+                                &shaderBindingTableDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
 
-  result = vkBindBufferMemory(
-      deviceHandle, topLevelAccelerationStructureScratchBufferHandle,
-      topLevelAccelerationStructureDeviceScratchMemoryHandle, 0);
-
+  result = vkBindBufferMemory(deviceHandle, shaderBindingTableBufferHandle,
+                              shaderBindingTableDeviceMemoryHandle, 0);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkBindBufferMemory");
   }
 
-  VkBufferDeviceAddressInfo
-      topLevelAccelerationStructureScratchBufferDeviceAddressInfo = {
-          .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-          .pNext = NULL,
-          .buffer = topLevelAccelerationStructureScratchBufferHandle};
-
-  VkDeviceAddress topLevelAccelerationStructureScratchBufferDeviceAddress =
-      pvkGetBufferDeviceAddressKHR(
-          deviceHandle,
-          &topLevelAccelerationStructureScratchBufferDeviceAddressInfo);
-
-  topLevelAccelerationStructureBuildGeometryInfo.dstAccelerationStructure =
-      topLevelAccelerationStructureHandle;
-
-  topLevelAccelerationStructureBuildGeometryInfo.scratchData = {
-      .deviceAddress = topLevelAccelerationStructureScratchBufferDeviceAddress};
-
-  VkAccelerationStructureBuildRangeInfoKHR
-      topLevelAccelerationStructureBuildRangeInfo = {.primitiveCount = 1,
-                                                     .primitiveOffset = 0,
-                                                     .firstVertex = 0,
-                                                     .transformOffset = 0};
-
-  const VkAccelerationStructureBuildRangeInfoKHR
-      *topLevelAccelerationStructureBuildRangeInfos =
-          &topLevelAccelerationStructureBuildRangeInfo;
-
-  VkCommandBufferBeginInfo topLevelCommandBufferBeginInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-      .pNext = NULL,
-      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-      .pInheritanceInfo = NULL};
-
-  result = vkBeginCommandBuffer(commandBufferHandleList.back(),
-                                &topLevelCommandBufferBeginInfo);
+  char *shaderHandleBuffer = new char[shaderBindingTableSize];
+  result = pvkGetRayTracingShaderGroupHandlesKHR(
+      deviceHandle, rayTracingPipelineHandle, 0, 4, shaderBindingTableSize,
+      shaderHandleBuffer);
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+    throwExceptionVulkanAPI(result, "vkGetRayTracingShaderGroupHandlesKHR");
   }
 
-  pvkCmdBuildAccelerationStructuresKHR(
-      commandBufferHandleList.back(), 1,
-      &topLevelAccelerationStructureBuildGeometryInfo,
-      &topLevelAccelerationStructureBuildRangeInfos);
+  void *hostShaderBindingTableMemoryBuffer;
+  result = vkMapMemory(deviceHandle, shaderBindingTableDeviceMemoryHandle, 0,
+                       shaderBindingTableSize, 0,
+                       &hostShaderBindingTableMemoryBuffer);
+
+  for (uint32_t x = 0; x < 4; x++) {
+    memcpy(hostShaderBindingTableMemoryBuffer,
+           shaderHandleBuffer + x * physicalDeviceRayTracingPipelineProperties
+                                        .shaderGroupHandleSize,
+           physicalDeviceRayTracingPipelineProperties.shaderGroupHandleSize);
 
-  result = vkEndCommandBuffer(commandBufferHandleList.back());
+    hostShaderBindingTableMemoryBuffer =
+        reinterpret_cast<char *>(hostShaderBindingTableMemoryBuffer) +
+        physicalDeviceRayTracingPipelineProperties.shaderGroupBaseAlignment;
+  }
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+    throwExceptionVulkanAPI(result, "vkMapMemory");
   }
 
-  VkSubmitInfo topLevelAccelerationStructureBuildSubmitInfo = {
-      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-      .pNext = NULL,
-      .waitSemaphoreCount = 0,
-      .pWaitSemaphores = NULL,
-      .pWaitDstStageMask = NULL,
-      .commandBufferCount = 1,
-      .pCommandBuffers = &commandBufferHandleList.back(),
-      .signalSemaphoreCount = 0,
-      .pSignalSemaphores = NULL};
+  vkUnmapMemory(deviceHandle, shaderBindingTableDeviceMemoryHandle);
 
-  VkFenceCreateInfo topLevelAccelerationStructureBuildFenceCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, .pNext = NULL, .flags = 0};
+  VkBufferDeviceAddressInfo shaderBindingTableBufferDeviceAddressInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .pNext = NULL,
+      .buffer = shaderBindingTableBufferHandle};
 
-  VkFence topLevelAccelerationStructureBuildFenceHandle = VK_NULL_HANDLE;
-  result = vkCreateFence(deviceHandle,
-                         &topLevelAccelerationStructureBuildFenceCreateInfo,
-                         NULL, &topLevelAccelerationStructureBuildFenceHandle);
+  VkDeviceAddress shaderBindingTableBufferDeviceAddress =
+      pvkGetBufferDeviceAddressKHR(deviceHandle,
+                                   &shaderBindingTableBufferDeviceAddressInfo);
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateFence");
-  }
+  VkDeviceSize hitGroupOffset = 0u * progSize;
+  VkDeviceSize rayGenOffset = 1u * progSize;
+  VkDeviceSize missOffset = 2u * progSize;
 
-  result = vkQueueSubmit(queueHandle, 1,
-                         &topLevelAccelerationStructureBuildSubmitInfo,
-                         topLevelAccelerationStructureBuildFenceHandle);
+  const VkStridedDeviceAddressRegionKHR rchitShaderBindingTable = {
+      .deviceAddress = shaderBindingTableBufferDeviceAddress + hitGroupOffset,
+      .stride = progSize,
+      .size = progSize};
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkQueueSubmit");
-  }
+  const VkStridedDeviceAddressRegionKHR rgenShaderBindingTable = {
+      .deviceAddress = shaderBindingTableBufferDeviceAddress + rayGenOffset,
+      .stride = progSize,
+      .size = progSize};
 
-  result = vkWaitForFences(deviceHandle, 1,
-                           &topLevelAccelerationStructureBuildFenceHandle, true,
-                           UINT32_MAX);
+  const VkStridedDeviceAddressRegionKHR rmissShaderBindingTable = {
+      .deviceAddress = shaderBindingTableBufferDeviceAddress + missOffset,
+      .stride = progSize,
+      .size = progSize * 2};
 
-  if (result != VK_SUCCESS && result != VK_TIMEOUT) {
-    throwExceptionVulkanAPI(result, "vkWaitForFences");
-  }
+  const VkStridedDeviceAddressRegionKHR callableShaderBindingTable = {};
 
   // =========================================================================
-  // Uniform Buffer
-
-  struct UniformStructure {
-    float cameraPosition[4] = {0, 0, 0, 1};
-    float cameraRight[4] = {1, 0, 0, 1};
-    float cameraUp[4] = {0, 1, 0, 1};
-    float cameraForward[4] = {0, 0, 1, 1};
+  // Fences, Semaphores
 
-    uint32_t frameCount = 0;
-  } uniformStructure;
+  beginTraceSection(mainTraceSection, "Fences, Semaphores");
 
-  VkBufferCreateInfo uniformBufferCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .size = sizeof(UniformStructure),
-      .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-      .queueFamilyIndexCount = 1,
-      .pQueueFamilyIndices = &queueFamilyIndex};
+  // Fences and acquire semaphores are per frame in flight, write semaphores
+  // are per swapchain image since presentation holds them until the image is
+  // acquired again
+  std::vector<VkFence> imageAvailableFenceHandleList(FRAMES_IN_FLIGHT,
+                                                     VK_NULL_HANDLE);
 
-  VkBuffer uniformBufferHandle = VK_NULL_HANDLE;
-  result = vkCreateBuffer(deviceHandle, &uniformBufferCreateInfo, NULL,
-                          &uniformBufferHandle);
+  std::vector<VkSemaphore> acquireImageSemaphoreHandleList(FRAMES_IN_FLIGHT,
+                                                           VK_NULL_HANDLE);
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateBuffer");
-  }
+  std::vector<VkSemaphore> writeImageSemaphoreHandleList(swapchainImageCount,
+                                                         VK_NULL_HANDLE);
 
-  VkMemoryRequirements uniformMemoryRequirements;
-  vkGetBufferMemoryRequirements(deviceHandle, uniformBufferHandle,
-                                &uniformMemoryRequirements);
+  for (uint32_t x = 0; x < FRAMES_IN_FLIGHT; x++) {
+    VkFenceCreateInfo imageAvailableFenceCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = VK_FENCE_CREATE_SIGNALED_BIT};
 
-  uint32_t uniformMemoryTypeIndex = -1;
-  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
-       x++) {
-    if ((uniformMemoryRequirements.memoryTypeBits & (1 << x)) &&
-        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    result = vkCreateFence(deviceHandle, &imageAvailableFenceCreateInfo, NULL,
+                           &imageAvailableFenceHandleList[x]);
 
-      uniformMemoryTypeIndex = x;
-      break;
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateFence");
     }
-  }
 
-  VkMemoryAllocateInfo uniformMemoryAllocateInfo = {
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .pNext = &memoryAllocateFlagsInfo,
-      .allocationSize = uniformMemoryRequirements.size,
-      .memoryTypeIndex = uniformMemoryTypeIndex};
+    VkSemaphoreCreateInfo acquireImageSemaphoreCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0};
 
-  VkDeviceMemory uniformDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &uniformMemoryAllocateInfo, NULL,
-                            &uniformDeviceMemoryHandle);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkAllocateMemory");
-  }
+    result = vkCreateSemaphore(deviceHandle, &acquireImageSemaphoreCreateInfo,
+                               NULL, &acquireImageSemaphoreHandleList[x]);
 
-  result = vkBindBufferMemory(deviceHandle, uniformBufferHandle,
-                              uniformDeviceMemoryHandle, 0);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateSemaphore");
+    }
   }
 
-  void *hostUniformMemoryBuffer;
-  result = vkMapMemory(deviceHandle, uniformDeviceMemoryHandle, 0,
-                       sizeof(UniformStructure), 0, &hostUniformMemoryBuffer);
+  for (uint32_t x = 0; x < swapchainImageCount; x++) {
+    VkSemaphoreCreateInfo writeImageSemaphoreCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0};
 
-  memcpy(hostUniformMemoryBuffer, &uniformStructure, sizeof(UniformStructure));
+    result = vkCreateSemaphore(deviceHandle, &writeImageSemaphoreCreateInfo,
+                               NULL, &writeImageSemaphoreHandleList[x]);
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkMapMemory");
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateSemaphore");
+    }
   }
 
-  vkUnmapMemory(deviceHandle, uniformDeviceMemoryHandle);
-
   // =========================================================================
-  // Ray Trace Image
+  // Main Loop
 
-  VkImageCreateInfo rayTraceImageCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+  beginTraceSection(mainTraceSection, "Main Loop");
+
+#if defined(LOD_ENABLED)
+  // The scratch buffer is only used by the startup level of detail builds, so
+  // it is released once they have finished rather than at exit
+  VkSemaphoreWaitInfo levelOfDetailBuildSemaphoreWaitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
       .pNext = NULL,
       .flags = 0,
-      .imageType = VK_IMAGE_TYPE_2D,
-      .format = surfaceFormatList[0].format,
-      .extent = {.width = surfaceCapabilities.currentExtent.width,
-                 .height = surfaceCapabilities.currentExtent.height,
-                 .depth = 1},
-      .mipLevels = 1,
-      .arrayLayers = 1,
-      .samples = VK_SAMPLE_COUNT_1_BIT,
-      .tiling = VK_IMAGE_TILING_OPTIMAL,
-      .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-      .queueFamilyIndexCount = 1,
-      .pQueueFamilyIndices = &queueFamilyIndex,
-      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
+      .semaphoreCount = 1,
+      .pSemaphores = &accelerationStructureTimelineSemaphoreHandle,
+      .pValues = &bottomLevelAccelerationStructureTimelineValue};
 
-  VkImage rayTraceImageHandle = VK_NULL_HANDLE;
-  result = vkCreateImage(deviceHandle, &rayTraceImageCreateInfo, NULL,
-                         &rayTraceImageHandle);
+  result = vkWaitSemaphores(deviceHandle, &levelOfDetailBuildSemaphoreWaitInfo,
+                            UINT64_MAX);
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateImage");
+    throwExceptionVulkanAPI(result, "vkWaitSemaphores");
   }
 
-  VkMemoryRequirements rayTraceImageMemoryRequirements;
-  vkGetImageMemoryRequirements(deviceHandle, rayTraceImageHandle,
-                               &rayTraceImageMemoryRequirements);
+  freeDeviceMemory(deviceHandle, memoryLedger,
+                   levelOfDetailScratchDeviceMemoryHandle);
+  vkDestroyBuffer(deviceHandle, levelOfDetailScratchBufferHandle, NULL);
+#endif
 
-  uint32_t rayTraceImageMemoryTypeIndex = -1;
-  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
-       x++) {
-    if ((rayTraceImageMemoryRequirements.memoryTypeBits & (1 << x)) &&
-        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+  printMemoryReport(physicalDeviceProperties.deviceName, memoryLedger);
 
-      rayTraceImageMemoryTypeIndex = x;
-      break;
-    }
-  }
+  // The first frame waits on the startup builds anyway, so waiting on their
+  // timestamps here costs nothing
+  if (isComputeTimestampSupported) {
+    double bottomLevelBuildMilliseconds = getTimestampMilliseconds(
+        accelerationStructureTimestampQueryPoolHandle,
+        bottomLevelTimestampQueryIndex, VK_QUERY_RESULT_WAIT_BIT);
 
-  VkMemoryAllocateInfo rayTraceImageMemoryAllocateInfo = {
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .pNext = NULL,
-      .allocationSize = rayTraceImageMemoryRequirements.size,
-      .memoryTypeIndex = rayTraceImageMemoryTypeIndex};
+    double topLevelBuildMilliseconds = getTimestampMilliseconds(
+        accelerationStructureTimestampQueryPoolHandle,
+        activeTopLevelAccelerationStructureIndex * 2, VK_QUERY_RESULT_WAIT_BIT);
 
-  VkDeviceMemory rayTraceImageDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &rayTraceImageMemoryAllocateInfo,
-                            NULL, &rayTraceImageDeviceMemoryHandle);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkAllocateMemory");
-  }
+    std::cout << "Bottom level acceleration structure build: "
+              << bottomLevelBuildMilliseconds << " ms" << std::endl;
 
-  result = vkBindImageMemory(deviceHandle, rayTraceImageHandle,
-                             rayTraceImageDeviceMemoryHandle, 0);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBindImageMemory");
-  }
+    addTimestampSample(topLevelBuildTimestampStatistics,
+                       topLevelBuildMilliseconds);
 
-  VkImageViewCreateInfo rayTraceImageViewCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .image = rayTraceImageHandle,
-      .viewType = VK_IMAGE_VIEW_TYPE_2D,
-      .format = surfaceFormatList[0].format,
-      .components = {.r = VK_COMPONENT_SWIZZLE_IDENTITY,
-                     .g = VK_COMPONENT_SWIZZLE_IDENTITY,
-                     .b = VK_COMPONENT_SWIZZLE_IDENTITY,
-                     .a = VK_COMPONENT_SWIZZLE_IDENTITY},
-      .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                           .baseMipLevel = 0,
-                           .levelCount = 1,
-                           .baseArrayLayer = 0,
-                           .layerCount = 1}};
+    addQueueTraceEvent("Bottom level build", computeQueueTraceTrackIndex,
+                       bottomLevelSubmitMicroseconds,
+                       bottomLevelBuildMilliseconds * 1000.0);
+    addQueueTraceEvent("Top level build", computeQueueTraceTrackIndex,
+                       topLevelSubmitMicrosecondsList
+                           [activeTopLevelAccelerationStructureIndex],
+                       topLevelBuildMilliseconds * 1000.0);
+  }
 
-  VkImageView rayTraceImageViewHandle = VK_NULL_HANDLE;
-  result = vkCreateImageView(deviceHandle, &rayTraceImageViewCreateInfo, NULL,
-                             &rayTraceImageViewHandle);
+  TraceSection frameTraceSection = {.trackIndex = mainTraceSection.trackIndex};
+  std::vector<double> frameSubmitMicrosecondsList(FRAMES_IN_FLIGHT, 0.0);
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateImageView");
-  }
+  uint32_t currentFrame = 0;
+  uint32_t timedFrameCount = 0;
+  std::chrono::steady_clock::time_point previousFrameTimePoint =
+      std::chrono::steady_clock::now();
+
+  // Holding R rotates the model, each edit is rebuilt on the compute queue
+  // into the top level acceleration structure that is not being traced
+  float modelYaw = 0.0;
+  bool isSceneEdited = false;
+  bool isTopLevelBuildPending = false;
+  uint32_t pendingTopLevelAccelerationStructureIndex = 0;
+
+  bool isSwapchainOutOfDate = false;
+  while (!exitWindow) {
+    // Render continuously until the image converges, then block until input
+    // arrives instead of spinning on an unchanged frame
+    bool isIdle = uniformStructure.frameCount >= CONVERGED_FRAME_COUNT &&
+                  !isMoveForward && !isMoveBack && !isTurnLeft &&
+                  !isTurnRight && !isRotateModel && !isSceneEdited &&
+                  !isTopLevelBuildPending;
+#if defined(RESIDENCY_ENABLED)
+    isIdle = isIdle && isResidencyConverged;
+#endif
 
-  // =========================================================================
-  // Ray Trace Image Barrier
-  // (VK_IMAGE_LAYOUT_UNDEFINED -> VK_IMAGE_LAYOUT_GENERAL)
+    // An out of date swapchain is recreated right away, unless the window is
+    // minimized and has nothing to present to until it is restored
+    if (isSwapchainOutOfDate) {
+      isIdle = surfaceCapabilities.currentExtent.width == 0 ||
+               surfaceCapabilities.currentExtent.height == 0;
+    }
 
-  VkCommandBufferBeginInfo rayTraceImageBarrierCommandBufferBeginInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-      .pNext = NULL,
-      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-      .pInheritanceInfo = NULL};
+#if defined(PLATFORM_LINUX)
+    if (isIdle && XPending(displayPtr) == 0) {
+      pollfd displayPollFileDescriptor = {
+          .fd = ConnectionNumber(displayPtr), .events = POLLIN, .revents = 0};
 
-  result = vkBeginCommandBuffer(commandBufferHandleList.back(),
-                                &rayTraceImageBarrierCommandBufferBeginInfo);
+      poll(&displayPollFileDescriptor, 1, -1);
+    }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
-  }
+    while (XPending(displayPtr) > 0) {
+      XEvent event;
+      XNextEvent(displayPtr, &event);
+      handleEvent(displayPtr, &event);
+    }
+#elif defined(PLATFORM_WINDOWS)
+    if (isIdle) {
+      WaitMessage();
+    }
 
-  VkImageMemoryBarrier rayTraceGeneralMemoryBarrier = {
-      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-      .pNext = NULL,
-      .srcAccessMask = 0,
-      .dstAccessMask = 0,
-      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-      .newLayout = VK_IMAGE_LAYOUT_GENERAL,
-      .srcQueueFamilyIndex = queueFamilyIndex,
-      .dstQueueFamilyIndex = queueFamilyIndex,
-      .image = rayTraceImageHandle,
-      .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                           .baseMipLevel = 0,
-                           .levelCount = 1,
-                           .baseArrayLayer = 0,
-                           .layerCount = 1}};
+    MSG msg;
+    while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+      TranslateMessage(&msg);
+      DispatchMessage(&msg);
+    }
+#endif
 
-  vkCmdPipelineBarrier(commandBufferHandleList.back(),
-                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0, NULL,
-                       1, &rayTraceGeneralMemoryBarrier);
+    if (exitWindow) {
+      break;
+    }
 
-  result = vkEndCommandBuffer(commandBufferHandleList.back());
+    // Input is applied per second of wall time rather than per frame, capped
+    // so that waking from an idle wait does not jump the camera
+    std::chrono::steady_clock::time_point frameTimePoint =
+        std::chrono::steady_clock::now();
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
-  }
+    float frameSeconds = std::min(
+        std::chrono::duration<float>(frameTimePoint - previousFrameTimePoint)
+            .count(),
+        0.1f);
 
-  VkSubmitInfo rayTraceImageBarrierAccelerationStructureBuildSubmitInfo = {
-      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-      .pNext = NULL,
-      .waitSemaphoreCount = 0,
-      .pWaitSemaphores = NULL,
-      .pWaitDstStageMask = NULL,
-      .commandBufferCount = 1,
-      .pCommandBuffers = &commandBufferHandleList.back(),
-      .signalSemaphoreCount = 0,
-      .pSignalSemaphores = NULL};
+    previousFrameTimePoint = frameTimePoint;
 
-  VkFenceCreateInfo
-      rayTraceImageBarrierAccelerationStructureBuildFenceCreateInfo = {
-          .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-          .pNext = NULL,
-          .flags = 0};
+    static bool isCameraMoved = true;
+    static float cameraPosition[3] = { 1.5, 4.0, 10.0 };
+    static float cameraYaw = 0.0;
+    static float cameraPitch = 0.0;
 
-  VkFence rayTraceImageBarrierAccelerationStructureBuildFenceHandle =
-      VK_NULL_HANDLE;
-  result = vkCreateFence(
-      deviceHandle,
-      &rayTraceImageBarrierAccelerationStructureBuildFenceCreateInfo, NULL,
-      &rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
+    if (isMoveForward) {
+      cameraPosition[0] += cos(-cameraYaw - (3.141592 / 2)) *
+                           CAMERA_MOVE_SPEED * frameSeconds;
+      cameraPosition[2] += sin(-cameraYaw - (3.141592 / 2)) *
+                           CAMERA_MOVE_SPEED * frameSeconds;
+      isCameraMoved = true;
+    }
+    if (isMoveBack) {
+      cameraPosition[0] -= cos(-cameraYaw - (3.141592 / 2)) *
+                           CAMERA_MOVE_SPEED * frameSeconds;
+      cameraPosition[2] -= sin(-cameraYaw - (3.141592 / 2)) *
+                           CAMERA_MOVE_SPEED * frameSeconds;
+      isCameraMoved = true;
+    }
+    if (isTurnLeft) {
+      cameraYaw += CAMERA_TURN_SPEED * frameSeconds;
+      isCameraMoved = true;
+    }
+    if (isTurnRight) {
+      cameraYaw -= CAMERA_TURN_SPEED * frameSeconds;
+      isCameraMoved = true;
+    }
+    if (isRotateModel) {
+      modelYaw += CAMERA_TURN_SPEED * 2.0f * frameSeconds;
+      isSceneEdited = true;
+    }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateFence");
-  }
+    // Keep tracing the current acceleration structure until the compute queue
+    // has finished the rebuild, then switch and restart accumulation
+    if (isTopLevelBuildPending) {
+      uint64_t completedTimelineValue = 0;
+      result = vkGetSemaphoreCounterValue(
+          deviceHandle, accelerationStructureTimelineSemaphoreHandle,
+          &completedTimelineValue);
 
-  result = vkQueueSubmit(
-      queueHandle, 1, &rayTraceImageBarrierAccelerationStructureBuildSubmitInfo,
-      rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkGetSemaphoreCounterValue");
+      }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkQueueSubmit");
-  }
+      if (completedTimelineValue >=
+          topLevelAccelerationStructureTimelineValueList
+              [pendingTopLevelAccelerationStructureIndex]) {
+        activeTopLevelAccelerationStructureIndex =
+            pendingTopLevelAccelerationStructureIndex;
+        isTopLevelBuildPending = false;
+        isCameraMoved = true;
+
+#if defined(RESIDENCY_ENABLED)
+        freeResidencySlotIndexList.insert(freeResidencySlotIndexList.end(),
+                                          evictedResidencySlotIndexList.begin(),
+                                          evictedResidencySlotIndexList.end());
+        evictedResidencySlotIndexList.clear();
+#endif
 
-  result = vkWaitForFences(
-      deviceHandle, 1,
-      &rayTraceImageBarrierAccelerationStructureBuildFenceHandle, true,
-      UINT32_MAX);
+        if (isComputeTimestampSupported) {
+          double topLevelBuildMilliseconds = getTimestampMilliseconds(
+              accelerationStructureTimestampQueryPoolHandle,
+              activeTopLevelAccelerationStructureIndex * 2, 0);
 
-  if (result != VK_SUCCESS && result != VK_TIMEOUT) {
-    throwExceptionVulkanAPI(result, "vkWaitForFences");
-  }
+          addTimestampSample(topLevelBuildTimestampStatistics,
+                             topLevelBuildMilliseconds);
 
-  // =========================================================================
-  // Update Descriptor Set
+          addQueueTraceEvent("Top level build", computeQueueTraceTrackIndex,
+                             topLevelSubmitMicrosecondsList
+                                 [activeTopLevelAccelerationStructureIndex],
+                             topLevelBuildMilliseconds * 1000.0);
+        }
+      }
+    }
 
-  VkWriteDescriptorSetAccelerationStructureKHR
-      accelerationStructureDescriptorInfo = {
-          .sType =
-              VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR,
-          .pNext = NULL,
-          .accelerationStructureCount = 1,
-          .pAccelerationStructures = &topLevelAccelerationStructureHandle};
+#if defined(RESIDENCY_ENABLED)
+    // Paging in or evicting clusters rebuilds the top level acceleration
+    // structure like an edit, the next update waits for it to be switched to
+    if (!isTopLevelBuildPending &&
+        (isCameraMoved || isSceneEdited || !isResidencyConverged) &&
+        updateResidency(cameraPosition, cameraYaw, cameraPitch, modelYaw)) {
+      isSceneEdited = true;
+    }
+#elif defined(LOD_ENABLED)
+    // A cluster changing its level of detail rebuilds the top level
+    // acceleration structure like an edit
+    if (!isTopLevelBuildPending && (isCameraMoved || isSceneEdited) &&
+        selectLevelsOfDetail(cameraPosition, modelYaw, renderExtent.height)) {
+      isSceneEdited = true;
+    }
+#endif
 
-  VkDescriptorBufferInfo uniformDescriptorInfo = {
-      .buffer = uniformBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
+    if (isSceneEdited && !isTopLevelBuildPending) {
+      pendingTopLevelAccelerationStructureIndex =
+          (activeTopLevelAccelerationStructureIndex + 1) %
+          topLevelAccelerationStructureCount;
 
-  VkDescriptorBufferInfo indexDescriptorInfo = {
-      .buffer = indexBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
+      buildTopLevelAccelerationStructure(
+          pendingTopLevelAccelerationStructureIndex, modelYaw);
 
-  VkDescriptorBufferInfo vertexDescriptorInfo = {
-      .buffer = vertexBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
+      isTopLevelBuildPending = true;
+      isSceneEdited = false;
+    }
 
-  VkDescriptorImageInfo rayTraceImageDescriptorInfo = {
-      .sampler = VK_NULL_HANDLE,
-      .imageView = rayTraceImageViewHandle,
-      .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+    if (isCameraMoved) {
+      uniformStructure.cameraPosition[0] = cameraPosition[0];
+      uniformStructure.cameraPosition[1] = cameraPosition[1];
+      uniformStructure.cameraPosition[2] = cameraPosition[2];
 
-  std::vector<VkWriteDescriptorSet> writeDescriptorSetList = {
-      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-       .pNext = &accelerationStructureDescriptorInfo,
-       .dstSet = descriptorSetHandleList[0],
-       .dstBinding = 0,
-       .dstArrayElement = 0,
-       .descriptorCount = 1,
-       .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
-       .pImageInfo = NULL,
-       .pBufferInfo = NULL,
-       .pTexelBufferView = NULL},
-      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-       .pNext = NULL,
-       .dstSet = descriptorSetHandleList[0],
-       .dstBinding = 1,
-       .dstArrayElement = 0,
-       .descriptorCount = 1,
-       .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-       .pImageInfo = NULL,
-       .pBufferInfo = &uniformDescriptorInfo,
-       .pTexelBufferView = NULL},
-      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-       .pNext = NULL,
-       .dstSet = descriptorSetHandleList[0],
-       .dstBinding = 2,
-       .dstArrayElement = 0,
-       .descriptorCount = 1,
-       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-       .pImageInfo = NULL,
-       .pBufferInfo = &indexDescriptorInfo,
-       .pTexelBufferView = NULL},
-      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-       .pNext = NULL,
-       .dstSet = descriptorSetHandleList[0],
-       .dstBinding = 3,
-       .dstArrayElement = 0,
-       .descriptorCount = 1,
-       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-       .pImageInfo = NULL,
-       .pBufferInfo = &vertexDescriptorInfo,
-       .pTexelBufferView = NULL},
-      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-       .pNext = NULL,
-       .dstSet = descriptorSetHandleList[0],
-       .dstBinding = 4,
-       .dstArrayElement = 0,
-       .descriptorCount = 1,
-       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-       .pImageInfo = &rayTraceImageDescriptorInfo,
-       .pBufferInfo = NULL,
-       .pTexelBufferView = NULL}};
+      uniformStructure.cameraForward[0] =
+          cosf(cameraPitch) * cosf(-cameraYaw - (3.141592 / 2.0));
+      uniformStructure.cameraForward[1] = sinf(cameraPitch);
+      uniformStructure.cameraForward[2] =
+          cosf(cameraPitch) * sinf(-cameraYaw - (3.141592 / 2.0));
 
-  vkUpdateDescriptorSets(deviceHandle, writeDescriptorSetList.size(),
-                         writeDescriptorSetList.data(), 0, NULL);
+      uniformStructure.cameraRight[0] =
+          uniformStructure.cameraForward[1] * uniformStructure.cameraUp[2] -
+          uniformStructure.cameraForward[2] * uniformStructure.cameraUp[1];
+      uniformStructure.cameraRight[1] =
+          uniformStructure.cameraForward[2] * uniformStructure.cameraUp[0] -
+          uniformStructure.cameraForward[0] * uniformStructure.cameraUp[2];
+      uniformStructure.cameraRight[2] =
+          uniformStructure.cameraForward[0] * uniformStructure.cameraUp[1] -
+          uniformStructure.cameraForward[1] * uniformStructure.cameraUp[0];
 
-  // =========================================================================
-  // Material Index Buffer
+      uniformStructure.frameCount = 0;
 
-  std::vector<uint32_t> materialIndexList;
-  for (tinyobj::shape_t shape : shapes) {
-    for (int index : shape.mesh.material_ids) {
-      materialIndexList.push_back(index);
+      isCameraMoved = false;
+    } else {
+      uniformStructure.frameCount += 1;
     }
-  }
 
-  VkBufferCreateInfo materialIndexBufferCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .size = sizeof(uint32_t) * materialIndexList.size(),
-      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-      .queueFamilyIndexCount = 1,
-      .pQueueFamilyIndices = &queueFamilyIndex};
+    // Moves also generate resize events on X11, only an extent change
+    // requires a new swapchain
+    if (isWindowResized) {
+      result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+          activePhysicalDeviceHandle, surfaceHandle, &surfaceCapabilities);
 
-  VkBuffer materialIndexBufferHandle = VK_NULL_HANDLE;
-  result = vkCreateBuffer(deviceHandle, &materialIndexBufferCreateInfo, NULL,
-                          &materialIndexBufferHandle);
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result,
+                                "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
+      }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateBuffer");
-  }
+      if (surfaceCapabilities.currentExtent.width != swapchainExtent.width ||
+          surfaceCapabilities.currentExtent.height != swapchainExtent.height) {
+        isSwapchainOutOfDate = true;
+      }
 
-  VkMemoryRequirements materialIndexMemoryRequirements;
-  vkGetBufferMemoryRequirements(deviceHandle, materialIndexBufferHandle,
-                                &materialIndexMemoryRequirements);
+      isWindowResized = false;
+    }
 
-  uint32_t materialIndexMemoryTypeIndex = -1;
-  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
-       x++) {
-    if ((materialIndexMemoryRequirements.memoryTypeBits & (1 << x)) &&
-        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    // Recreate the swapchain and everything sized to it. Pipelines and
+    // acceleration structures do not depend on the extent and are kept.
+    if (isSwapchainOutOfDate) {
+      result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+          activePhysicalDeviceHandle, surfaceHandle, &surfaceCapabilities);
 
-      materialIndexMemoryTypeIndex = x;
-      break;
-    }
-  }
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result,
+                                "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
+      }
 
-  VkMemoryAllocateInfo materialIndexMemoryAllocateInfo = {
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .pNext = &memoryAllocateFlagsInfo,
-      .allocationSize = materialIndexMemoryRequirements.size,
-      .memoryTypeIndex = materialIndexMemoryTypeIndex};
+      if (surfaceCapabilities.currentExtent.width == 0 ||
+          surfaceCapabilities.currentExtent.height == 0) {
+        continue;
+      }
 
-  VkDeviceMemory materialIndexDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &materialIndexMemoryAllocateInfo,
-                            NULL, &materialIndexDeviceMemoryHandle);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkAllocateMemory");
-  }
+      result = vkDeviceWaitIdle(deviceHandle);
 
-  result = vkBindBufferMemory(deviceHandle, materialIndexBufferHandle,
-                              materialIndexDeviceMemoryHandle, 0);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
-  }
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkDeviceWaitIdle");
+      }
 
-  void *hostMaterialIndexMemoryBuffer;
-  result = vkMapMemory(deviceHandle, materialIndexDeviceMemoryHandle, 0,
-                       sizeof(uint32_t) * materialIndexList.size(), 0,
-                       &hostMaterialIndexMemoryBuffer);
+      for (uint32_t x = 0; x < swapchainImageCount; x++) {
+        vkDestroySemaphore(deviceHandle, writeImageSemaphoreHandleList[x],
+                           NULL);
+        vkDestroyImageView(deviceHandle, swapchainImageViewHandleList[x],
+                           NULL);
+      }
 
-  memcpy(hostMaterialIndexMemoryBuffer, materialIndexList.data(),
-         sizeof(uint32_t) * materialIndexList.size());
+      VkSwapchainKHR oldSwapchainHandle = swapchainHandle;
+      createSwapchain(oldSwapchainHandle);
+      vkDestroySwapchainKHR(deviceHandle, oldSwapchainHandle, NULL);
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkMapMemory");
-  }
+      // The image count may change with the new swapchain
+      writeImageSemaphoreHandleList.assign(swapchainImageCount,
+                                           VK_NULL_HANDLE);
 
-  vkUnmapMemory(deviceHandle, materialIndexDeviceMemoryHandle);
+      for (uint32_t x = 0; x < swapchainImageCount; x++) {
+        VkSemaphoreCreateInfo writeImageSemaphoreCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0};
 
-  // =========================================================================
-  // Material Buffer
+        result =
+            vkCreateSemaphore(deviceHandle, &writeImageSemaphoreCreateInfo,
+                              NULL, &writeImageSemaphoreHandleList[x]);
 
-  struct Material {
-    float ambient[4] = {0, 0, 0, 0};
-    float diffuse[4] = {0, 0, 0, 0};
-    float specular[4] = {0, 0, 0, 0};
-    float emission[4] = {0, 0, 0, 0};
-  };
+        if (result != VK_SUCCESS) {
+          throwExceptionVulkanAPI(result, "vkCreateSemaphore");
+        }
+      }
 
-  std::vector<Material> materialList(materials.size());
-  for (uint32_t x = 0; x < materials.size(); x++) {
-    memcpy(materialList[x].ambient, materials[x].ambient, sizeof(float) * 3);
-    memcpy(materialList[x].diffuse, materials[x].diffuse, sizeof(float) * 3);
-    memcpy(materialList[x].specular, materials[x].specular, sizeof(float) * 3);
-    memcpy(materialList[x].emission, materials[x].emission, sizeof(float) * 3);
-  }
+      vkDestroyImageView(deviceHandle, rayTraceImageViewHandle, NULL);
+      freeDeviceMemory(deviceHandle, memoryLedger,
+                       rayTraceImageDeviceMemoryHandle);
+      vkDestroyImage(deviceHandle, rayTraceImageHandle, NULL);
+#if defined(HEATMAP_ENABLED)
+      vkDestroyImageView(deviceHandle, heatmapImageViewHandle, NULL);
+      freeDeviceMemory(deviceHandle, memoryLedger,
+                       heatmapImageDeviceMemoryHandle);
+      vkDestroyImage(deviceHandle, heatmapImageHandle, NULL);
+#endif
+      createRayTraceImage();
+
+      rayTraceImageDescriptorInfo.imageView = rayTraceImageViewHandle;
+      for (uint32_t x = 0; x < topLevelAccelerationStructureCount; x++) {
+        VkWriteDescriptorSet rayTraceImageWriteDescriptorSet = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .pNext = NULL,
+            .dstSet = descriptorSetHandleList[x],
+            .dstBinding = 4,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .pImageInfo = &rayTraceImageDescriptorInfo,
+            .pBufferInfo = NULL,
+            .pTexelBufferView = NULL};
+
+        vkUpdateDescriptorSets(deviceHandle, 1,
+                               &rayTraceImageWriteDescriptorSet, 0, NULL);
+      }
 
-  VkBufferCreateInfo materialBufferCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .size = sizeof(Material) * materialList.size(),
-      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-      .queueFamilyIndexCount = 1,
-      .pQueueFamilyIndices = &queueFamilyIndex};
+#if defined(HEATMAP_ENABLED)
+      heatmapImageDescriptorInfo.imageView = heatmapImageViewHandle;
+      for (uint32_t x = 0; x < topLevelAccelerationStructureCount; x++) {
+        VkWriteDescriptorSet heatmapImageWriteDescriptorSet = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .pNext = NULL,
+            .dstSet = descriptorSetHandleList[x],
+            .dstBinding = 6,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .pImageInfo = &heatmapImageDescriptorInfo,
+            .pBufferInfo = NULL,
+            .pTexelBufferView = NULL};
+
+        vkUpdateDescriptorSets(deviceHandle, 1,
+                               &heatmapImageWriteDescriptorSet, 0, NULL);
+      }
+#endif
 
-  VkBuffer materialBufferHandle = VK_NULL_HANDLE;
-  result = vkCreateBuffer(deviceHandle, &materialBufferCreateInfo, NULL,
-                          &materialBufferHandle);
+      uniformStructure.frameCount = 0;
+      isSwapchainOutOfDate = false;
+    }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateBuffer");
-  }
+    // M prints the memory ledger against the current heap budgets
+    if (isMemoryReportRequested) {
+      isMemoryReportRequested = false;
+      printMemoryReport(physicalDeviceProperties.deviceName, memoryLedger);
+    }
 
-  VkMemoryRequirements materialMemoryRequirements;
-  vkGetBufferMemoryRequirements(deviceHandle, materialBufferHandle,
-                                &materialMemoryRequirements);
+#if defined(HEATMAP_ENABLED)
+    // H writes the heatmap of the last traced frame, once the device is idle
+    if (isHeatmapWriteRequested && heatmapExtent.width > 0) {
+      isHeatmapWriteRequested = false;
 
-  uint32_t materialMemoryTypeIndex = -1;
-  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
-       x++) {
-    if ((materialMemoryRequirements.memoryTypeBits & (1 << x)) &&
-        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+      result = vkDeviceWaitIdle(deviceHandle);
 
-      materialMemoryTypeIndex = x;
-      break;
-    }
-  }
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkDeviceWaitIdle");
+      }
 
-  VkMemoryAllocateInfo materialMemoryAllocateInfo = {
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .pNext = &memoryAllocateFlagsInfo,
-      .allocationSize = materialMemoryRequirements.size,
-      .memoryTypeIndex = materialMemoryTypeIndex};
+      VkDeviceSize heatmapBufferSize = (VkDeviceSize)heatmapExtent.width *
+                                       heatmapExtent.height * 4 *
+                                       sizeof(uint32_t);
 
-  VkDeviceMemory materialDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &materialMemoryAllocateInfo, NULL,
-                            &materialDeviceMemoryHandle);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkAllocateMemory");
-  }
+      VkBufferCreateInfo heatmapBufferCreateInfo = {
+          .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+          .pNext = NULL,
+          .flags = 0,
+          .size = heatmapBufferSize,
+          .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+          .queueFamilyIndexCount = 1,
+          .pQueueFamilyIndices = &queueFamilyIndex};
 
-  result = vkBindBufferMemory(deviceHandle, materialBufferHandle,
-                              materialDeviceMemoryHandle, 0);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
-  }
+      VkBuffer heatmapBufferHandle = VK_NULL_HANDLE;
+      result = vkCreateBuffer(deviceHandle, &heatmapBufferCreateInfo, NULL,
+                              &heatmapBufferHandle);
 
-  void *hostMaterialMemoryBuffer;
-  result = vkMapMemory(deviceHandle, materialDeviceMemoryHandle, 0,
-                       sizeof(Material) * materialList.size(), 0,
-                       &hostMaterialMemoryBuffer);
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkCreateBuffer");
+      }
 
-  memcpy(hostMaterialMemoryBuffer, materialList.data(),
-         sizeof(Material) * materialList.size());
+      VkMemoryRequirements heatmapMemoryRequirements;
+      vkGetBufferMemoryRequirements(deviceHandle, heatmapBufferHandle,
+                                    &heatmapMemoryRequirements);
+
+      uint32_t heatmapMemoryTypeIndex = -1;
+      for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+           x++) {
+        if ((heatmapMemoryRequirements.memoryTypeBits & (1 << x)) &&
+            (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+             (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) ==
+                (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+
+          heatmapMemoryTypeIndex = x;
+          break;
+        }
+      }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkMapMemory");
-  }
+      VkMemoryAllocateInfo heatmapMemoryAllocateInfo = {
+          .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+          .pNext = NULL,
+          .allocationSize = heatmapMemoryRequirements.size,
+          .memoryTypeIndex = heatmapMemoryTypeIndex};
 
-  vkUnmapMemory(deviceHandle, materialDeviceMemoryHandle);
+      VkDeviceMemory heatmapDeviceMemoryHandle = VK_NULL_HANDLE;
+      result = allocateDeviceMemory(deviceHandle, memoryLedger, "Readback",
+                                    &heatmapMemoryAllocateInfo,
+                                    &heatmapDeviceMemoryHandle);
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkAllocateMemory");
+      }
 
-  // =========================================================================
-  // Update Material Descriptor Set
+      result = vkBindBufferMemory(deviceHandle, heatmapBufferHandle,
+                                  heatmapDeviceMemoryHandle, 0);
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+      }
 
-  VkDescriptorBufferInfo materialIndexDescriptorInfo = {
-      .buffer = materialIndexBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
+      VkCommandBufferBeginInfo heatmapCommandBufferBeginInfo = {
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+          .pNext = NULL,
+          .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+          .pInheritanceInfo = NULL};
 
-  VkDescriptorBufferInfo materialDescriptorInfo = {
-      .buffer = materialBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
+      result = vkBeginCommandBuffer(commandBufferHandleList.back(),
+                                    &heatmapCommandBufferBeginInfo);
 
-  std::vector<VkWriteDescriptorSet> materialWriteDescriptorSetList = {
-      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-       .pNext = NULL,
-       .dstSet = descriptorSetHandleList[1],
-       .dstBinding = 0,
-       .dstArrayElement = 0,
-       .descriptorCount = 1,
-       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-       .pImageInfo = NULL,
-       .pBufferInfo = &materialIndexDescriptorInfo,
-       .pTexelBufferView = NULL},
-      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-       .pNext = NULL,
-       .dstSet = descriptorSetHandleList[1],
-       .dstBinding = 1,
-       .dstArrayElement = 0,
-       .descriptorCount = 1,
-       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-       .pImageInfo = NULL,
-       .pBufferInfo = &materialDescriptorInfo,
-       .pTexelBufferView = NULL}};
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+      }
 
-  vkUpdateDescriptorSets(deviceHandle, materialWriteDescriptorSetList.size(),
-                         materialWriteDescriptorSetList.data(), 0, NULL);
+      VkMemoryBarrier heatmapTraceMemoryBarrier = {
+          .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+          .pNext = NULL,
+          .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT};
+
+      vkCmdPipelineBarrier(commandBufferHandleList.back(),
+                           VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+                           &heatmapTraceMemoryBarrier, 0, NULL, 0, NULL);
+
+      VkBufferImageCopy heatmapImageCopy = {
+          .bufferOffset = 0,
+          .bufferRowLength = 0,
+          .bufferImageHeight = 0,
+          .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                               .mipLevel = 0,
+                               .baseArrayLayer = 0,
+                               .layerCount = 1},
+          .imageOffset = {.x = 0, .y = 0, .z = 0},
+          .imageExtent = {.width = heatmapExtent.width,
+                          .height = heatmapExtent.height,
+                          .depth = 1}};
+
+      vkCmdCopyImageToBuffer(commandBufferHandleList.back(),
+                             heatmapImageHandle, VK_IMAGE_LAYOUT_GENERAL,
+                             heatmapBufferHandle, 1, &heatmapImageCopy);
+
+      VkMemoryBarrier heatmapReadbackMemoryBarrier = {
+          .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+          .pNext = NULL,
+          .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_HOST_READ_BIT};
 
-  // =========================================================================
-  // Shader Binding Table
+      vkCmdPipelineBarrier(commandBufferHandleList.back(),
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_HOST_BIT, 0, 1,
+                           &heatmapReadbackMemoryBarrier, 0, NULL, 0, NULL);
 
-  VkDeviceSize progSize =
-      physicalDeviceRayTracingPipelineProperties.shaderGroupBaseAlignment;
+      result = vkEndCommandBuffer(commandBufferHandleList.back());
 
-  VkDeviceSize shaderBindingTableSize = progSize * 4;
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+      }
 
-  VkBufferCreateInfo shaderBindingTableBufferCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .size = shaderBindingTableSize,
-      .usage = VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR |
-               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-      .queueFamilyIndexCount = 1,
-      .pQueueFamilyIndices = &queueFamilyIndex};
+      VkSubmitInfo heatmapSubmitInfo = {
+          .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+          .pNext = NULL,
+          .waitSemaphoreCount = 0,
+          .pWaitSemaphores = NULL,
+          .pWaitDstStageMask = NULL,
+          .commandBufferCount = 1,
+          .pCommandBuffers = &commandBufferHandleList.back(),
+          .signalSemaphoreCount = 0,
+          .pSignalSemaphores = NULL};
+
+      result = vkQueueSubmit(
+          queueHandle, 1, &heatmapSubmitInfo,
+          rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
 
-  VkBuffer shaderBindingTableBufferHandle = VK_NULL_HANDLE;
-  result = vkCreateBuffer(deviceHandle, &shaderBindingTableBufferCreateInfo,
-                          NULL, &shaderBindingTableBufferHandle);
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkQueueSubmit");
+      }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateBuffer");
-  }
+      result = vkWaitForFences(
+          deviceHandle, 1,
+          &rayTraceImageBarrierAccelerationStructureBuildFenceHandle, true,
+          UINT32_MAX);
 
-  VkMemoryRequirements shaderBindingTableMemoryRequirements;
-  vkGetBufferMemoryRequirements(deviceHandle, shaderBindingTableBufferHandle,
-                                &shaderBindingTableMemoryRequirements);
+      if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+        throwExceptionVulkanAPI(result, "vkWaitForFences");
+      }
 
-  uint32_t shaderBindingTableMemoryTypeIndex = -1;
-  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
-       x++) {
-    if ((shaderBindingTableMemoryRequirements.memoryTypeBits & (1 << x)) &&
-        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+      result = vkResetFences(
+          deviceHandle, 1,
+          &rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
 
-      shaderBindingTableMemoryTypeIndex = x;
-      break;
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkResetFences");
+      }
+
+      void *hostHeatmapMemoryBuffer;
+      result = vkMapMemory(deviceHandle, heatmapDeviceMemoryHandle, 0,
+                           heatmapBufferSize, 0, &hostHeatmapMemoryBuffer);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkMapMemory");
+      }
+
+      for (uint32_t x = 0; x < heatmapNameList.size(); x++) {
+        writeHeatmapImage((uint32_t *)hostHeatmapMemoryBuffer, x,
+                          heatmapExtent.width, heatmapExtent.height);
+      }
+
+      vkUnmapMemory(deviceHandle, heatmapDeviceMemoryHandle);
+      freeDeviceMemory(deviceHandle, memoryLedger, heatmapDeviceMemoryHandle);
+      vkDestroyBuffer(deviceHandle, heatmapBufferHandle, NULL);
     }
-  }
+#endif
 
-  VkMemoryAllocateInfo shaderBindingTableMemoryAllocateInfo = {
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .pNext = &memoryAllocateFlagsInfo,
-      .allocationSize = shaderBindingTableMemoryRequirements.size,
-      .memoryTypeIndex = shaderBindingTableMemoryTypeIndex};
+    beginTraceSection(frameTraceSection, "Fence wait");
 
-  VkDeviceMemory shaderBindingTableDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &shaderBindingTableMemoryAllocateInfo,
-                            NULL, &shaderBindingTableDeviceMemoryHandle);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkAllocateMemory");
-  }
+    result = vkWaitForFences(deviceHandle, 1,
+                             &imageAvailableFenceHandleList[currentFrame], true,
+                             UINT32_MAX);
+
+    if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+      throwExceptionVulkanAPI(result, "vkWaitForFences");
+    }
 
-  result = vkBindBufferMemory(deviceHandle, shaderBindingTableBufferHandle,
-                              shaderBindingTableDeviceMemoryHandle, 0);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
-  }
+    // Acquire before resetting the fence, an out of date swapchain skips the
+    // frame and the fence must stay signaled for the next attempt
+    uint32_t currentImageIndex = -1;
+    result =
+        vkAcquireNextImageKHR(deviceHandle, swapchainHandle, UINT32_MAX,
+                              acquireImageSemaphoreHandleList[currentFrame],
+                              VK_NULL_HANDLE, &currentImageIndex);
 
-  char *shaderHandleBuffer = new char[shaderBindingTableSize];
-  result = pvkGetRayTracingShaderGroupHandlesKHR(
-      deviceHandle, rayTracingPipelineHandle, 0, 4, shaderBindingTableSize,
-      shaderHandleBuffer);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+      isSwapchainOutOfDate = true;
+      continue;
+    } else if (result == VK_SUBOPTIMAL_KHR) {
+      isSwapchainOutOfDate = true;
+    } else if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkAcquireNextImageKHR");
+    }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkGetRayTracingShaderGroupHandlesKHR");
-  }
+    result = vkResetFences(deviceHandle, 1,
+                           &imageAvailableFenceHandleList[currentFrame]);
 
-  void *hostShaderBindingTableMemoryBuffer;
-  result = vkMapMemory(deviceHandle, shaderBindingTableDeviceMemoryHandle, 0,
-                       shaderBindingTableSize, 0,
-                       &hostShaderBindingTableMemoryBuffer);
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkResetFences");
+    }
 
-  for (uint32_t x = 0; x < 4; x++) {
-    memcpy(hostShaderBindingTableMemoryBuffer,
-           shaderHandleBuffer + x * physicalDeviceRayTracingPipelineProperties
-                                        .shaderGroupHandleSize,
-           physicalDeviceRayTracingPipelineProperties.shaderGroupHandleSize);
+#if defined(RAY_COUNTERS_ENABLED)
+    // Rays from this slot's previous frame, cleared before it is reused
+    uint32_t *frameRayCountList =
+        (uint32_t *)((uint8_t *)hostRayCounterMemoryBuffer +
+                     currentFrame * rayCounterSliceSize);
 
-    hostShaderBindingTableMemoryBuffer =
-        reinterpret_cast<char *>(hostShaderBindingTableMemoryBuffer) +
-        physicalDeviceRayTracingPipelineProperties.shaderGroupBaseAlignment;
-  }
+    for (uint32_t x = 0; x < rayTypeNameList.size(); x++) {
+      windowRayCountList[x] += frameRayCountList[x];
+      frameRayCountList[x] = 0;
+    }
+#endif
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkMapMemory");
-  }
+    // The fence also guarantees this frame's previous timestamps are written
+    if (isTimestampWrittenList[currentFrame]) {
+      double traceMilliseconds = getTimestampMilliseconds(
+          timestampQueryPoolHandle, currentFrame * 3, 0);
 
-  vkUnmapMemory(deviceHandle, shaderBindingTableDeviceMemoryHandle);
+      double blitMilliseconds = getTimestampMilliseconds(
+          timestampQueryPoolHandle, currentFrame * 3 + 1, 0);
 
-  VkBufferDeviceAddressInfo shaderBindingTableBufferDeviceAddressInfo = {
-      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-      .pNext = NULL,
-      .buffer = shaderBindingTableBufferHandle};
+      addTimestampSample(traceTimestampStatistics, traceMilliseconds);
+      addTimestampSample(blitTimestampStatistics, blitMilliseconds);
 
-  VkDeviceAddress shaderBindingTableBufferDeviceAddress =
-      pvkGetBufferDeviceAddressKHR(deviceHandle,
-                                   &shaderBindingTableBufferDeviceAddressInfo);
+      addQueueTraceEvent("Trace", graphicsQueueTraceTrackIndex,
+                         frameSubmitMicrosecondsList[currentFrame],
+                         traceMilliseconds * 1000.0);
+      addQueueTraceEvent("Present blit", graphicsQueueTraceTrackIndex,
+                         frameSubmitMicrosecondsList[currentFrame],
+                         blitMilliseconds * 1000.0);
 
-  VkDeviceSize hitGroupOffset = 0u * progSize;
-  VkDeviceSize rayGenOffset = 1u * progSize;
-  VkDeviceSize missOffset = 2u * progSize;
+#if defined(RAY_COUNTERS_ENABLED)
+      windowTraceMilliseconds += traceMilliseconds;
+#endif
 
-  const VkStridedDeviceAddressRegionKHR rchitShaderBindingTable = {
-      .deviceAddress = shaderBindingTableBufferDeviceAddress + hitGroupOffset,
-      .stride = progSize,
-      .size = progSize};
+      timedFrameCount += 1;
+      if (timedFrameCount % TIMESTAMP_WINDOW_SIZE == 0) {
+        printTimestampStatistics("Trace", traceTimestampStatistics);
+        printTimestampStatistics("Present blit", blitTimestampStatistics);
+        printTimestampStatistics("Top level acceleration structure build",
+                                 topLevelBuildTimestampStatistics);
+
+#if defined(RAY_COUNTERS_ENABLED)
+        for (uint32_t x = 0; x < rayTypeNameList.size(); x++) {
+          printRayThroughput(rayTypeNameList[x], windowRayCountList[x],
+                             windowTraceMilliseconds);
+          windowRayCountList[x] = 0;
+        }
+
+        windowTraceMilliseconds = 0.0;
+#endif
+      }
 
-  const VkStridedDeviceAddressRegionKHR rgenShaderBindingTable = {
-      .deviceAddress = shaderBindingTableBufferDeviceAddress + rayGenOffset,
-      .stride = progSize,
-      .size = progSize};
+#if defined(TARGET_FRAME_TIME_MS)
+      // Trace cost follows the pixel count, so the extent moves with a damped
+      // root of the time ratio. Small errors are ignored, every change
+      // restarts accumulation.
+      float frameTimeRatio =
+          TARGET_FRAME_TIME_MS / std::max((float)traceMilliseconds, 0.001f);
+
+      if (frameTimeRatio < 0.9f ||
+          (frameTimeRatio > 1.25f && dynamicResolutionScale < 1.0f)) {
+        dynamicResolutionScale =
+            std::clamp(dynamicResolutionScale * powf(frameTimeRatio, 0.25f),
+                       MIN_DYNAMIC_RESOLUTION_SCALE, 1.0f);
+
+        renderExtent = {
+            .width = std::max((uint32_t)(rayTraceImageExtent.width *
+                                         dynamicResolutionScale),
+                              1u),
+            .height = std::max((uint32_t)(rayTraceImageExtent.height *
+                                          dynamicResolutionScale),
+                               1u)};
+
+        uniformStructure.frameCount = 0;
+      }
+#endif
+    }
 
-  const VkStridedDeviceAddressRegionKHR rmissShaderBindingTable = {
-      .deviceAddress = shaderBindingTableBufferDeviceAddress + missOffset,
-      .stride = progSize,
-      .size = progSize * 2};
+    beginTraceSection(frameTraceSection, "Record");
 
-  const VkStridedDeviceAddressRegionKHR callableShaderBindingTable = {};
+    // The fence guarantees the device is done with this frame's slice
+    uint32_t uniformDynamicOffset = currentFrame * uniformSliceSize;
+    memcpy((uint8_t *)hostUniformMemoryBuffer + uniformDynamicOffset,
+           &uniformStructure, sizeof(UniformStructure));
 
-  // =========================================================================
-  // Record Render Pass Command Buffers
+    // Recorded every frame against the acquired image and the descriptor set
+    // of the active top level acceleration structure
+    std::vector<VkDescriptorSet> frameDescriptorSetHandleList = {
+        descriptorSetHandleList[activeTopLevelAccelerationStructureIndex],
+        descriptorSetHandleList.back()};
 
-  for (uint32_t x = 0; x < swapchainImageCount; x++) {
     VkCommandBufferBeginInfo renderCommandBufferBeginInfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .pNext = NULL,
-        .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
         .pInheritanceInfo = NULL};
 
-    result = vkBeginCommandBuffer(commandBufferHandleList[x],
+    result = vkBeginCommandBuffer(commandBufferHandleList[currentFrame],
                                   &renderCommandBufferBeginInfo);
 
     if (result != VK_SUCCESS) {
       throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
     }
 
-    vkCmdBindPipeline(commandBufferHandleList[x],
+    if (isTimestampSupported) {
+      vkCmdResetQueryPool(commandBufferHandleList[currentFrame],
+                          timestampQueryPoolHandle, currentFrame * 3, 3);
+
+      vkCmdWriteTimestamp(commandBufferHandleList[currentFrame],
+                          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          timestampQueryPoolHandle, currentFrame * 3);
+    }
+
+    vkCmdBindPipeline(commandBufferHandleList[currentFrame],
                       VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
                       rayTracingPipelineHandle);
 
-    vkCmdBindDescriptorSets(
-        commandBufferHandleList[x], VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
-        pipelineLayoutHandle, 0, (uint32_t)descriptorSetHandleList.size(),
-        descriptorSetHandleList.data(), 0, NULL);
+    std::vector<uint32_t> dynamicOffsetList = {uniformDynamicOffset};
+#if defined(RAY_COUNTERS_ENABLED)
+    dynamicOffsetList.push_back(currentFrame * rayCounterSliceSize);
+#endif
+
+    vkCmdBindDescriptorSets(commandBufferHandleList[currentFrame],
+                            VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
+                            pipelineLayoutHandle, 0,
+                            (uint32_t)frameDescriptorSetHandleList.size(),
+                            frameDescriptorSetHandleList.data(),
+                            (uint32_t)dynamicOffsetList.size(),
+                            dynamicOffsetList.data());
+
+    pvkCmdTraceRaysKHR(commandBufferHandleList[currentFrame],
+                       &rgenShaderBindingTable, &rmissShaderBindingTable,
+                       &rchitShaderBindingTable, &callableShaderBindingTable,
+                       renderExtent.width, renderExtent.height, 1);
+
+#if defined(HEATMAP_ENABLED)
+    heatmapExtent = renderExtent;
+#endif
+
+    if (isTimestampSupported) {
+      vkCmdWriteTimestamp(commandBufferHandleList[currentFrame],
+                          VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                          timestampQueryPoolHandle, currentFrame * 3 + 1);
+    }
+
+#if defined(RAY_COUNTERS_ENABLED)
+    VkMemoryBarrier rayCounterMemoryBarrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT};
 
-    pvkCmdTraceRaysKHR(commandBufferHandleList[x], &rgenShaderBindingTable,
-                       &rmissShaderBindingTable, &rchitShaderBindingTable,
-                       &callableShaderBindingTable,
-                       surfaceCapabilities.currentExtent.width,
-                       surfaceCapabilities.currentExtent.height, 1);
+    vkCmdPipelineBarrier(commandBufferHandleList[currentFrame],
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1,
+                         &rayCounterMemoryBarrier, 0, NULL, 0, NULL);
+#endif
 
     VkImageMemoryBarrier swapchainCopyMemoryBarrier = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
@@ -2705,14 +7761,14 @@ int main() {
         .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         .srcQueueFamilyIndex = queueFamilyIndex,
         .dstQueueFamilyIndex = queueFamilyIndex,
-        .image = swapchainImageHandleList[x],
+        .image = swapchainImageHandleList[currentImageIndex],
         .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                              .baseMipLevel = 0,
                              .levelCount = 1,
                              .baseArrayLayer = 0,
                              .layerCount = 1}};
 
-    vkCmdPipelineBarrier(commandBufferHandleList[x],
+    vkCmdPipelineBarrier(commandBufferHandleList[currentFrame],
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0,
                          NULL, 1, &swapchainCopyMemoryBarrier);
@@ -2733,30 +7789,44 @@ int main() {
                              .baseArrayLayer = 0,
                              .layerCount = 1}};
 
-    vkCmdPipelineBarrier(commandBufferHandleList[x],
+    vkCmdPipelineBarrier(commandBufferHandleList[currentFrame],
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0,
                          NULL, 1, &rayTraceCopyMemoryBarrier);
 
-    VkImageCopy imageCopy = {
+    // Converts the float accumulation to the swapchain format and scales the
+    // render extent to the window
+    VkImageBlit imageBlit = {
         .srcSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                            .mipLevel = 0,
                            .baseArrayLayer = 0,
                            .layerCount = 1},
-        .srcOffset = {.x = 0, .y = 0, .z = 0},
+        .srcOffsets = {{.x = 0, .y = 0, .z = 0},
+                       {.x = (int32_t)renderExtent.width,
+                        .y = (int32_t)renderExtent.height,
+                        .z = 1}},
         .dstSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                            .mipLevel = 0,
                            .baseArrayLayer = 0,
                            .layerCount = 1},
-        .dstOffset = {.x = 0, .y = 0, .z = 0},
-        .extent = {.width = surfaceCapabilities.currentExtent.width,
-                   .height = surfaceCapabilities.currentExtent.height,
-                   .depth = 1}};
+        .dstOffsets = {{.x = 0, .y = 0, .z = 0},
+                       {.x = (int32_t)swapchainExtent.width,
+                        .y = (int32_t)swapchainExtent.height,
+                        .z = 1}}};
 
-    vkCmdCopyImage(commandBufferHandleList[x], rayTraceImageHandle,
+    vkCmdBlitImage(commandBufferHandleList[currentFrame], rayTraceImageHandle,
                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                   swapchainImageHandleList[x],
-                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageCopy);
+                   swapchainImageHandleList[currentImageIndex],
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlit,
+                   presentBlitFilter);
+
+    if (isTimestampSupported) {
+      vkCmdWriteTimestamp(commandBufferHandleList[currentFrame],
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          timestampQueryPoolHandle, currentFrame * 3 + 2);
+
+      isTimestampWrittenList[currentFrame] = true;
+    }
 
     VkImageMemoryBarrier swapchainPresentMemoryBarrier = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
@@ -2767,14 +7837,14 @@ int main() {
         .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
         .srcQueueFamilyIndex = queueFamilyIndex,
         .dstQueueFamilyIndex = queueFamilyIndex,
-        .image = swapchainImageHandleList[x],
+        .image = swapchainImageHandleList[currentImageIndex],
         .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                              .baseMipLevel = 0,
                              .levelCount = 1,
                              .baseArrayLayer = 0,
                              .layerCount = 1}};
 
-    vkCmdPipelineBarrier(commandBufferHandleList[x],
+    vkCmdPipelineBarrier(commandBufferHandleList[currentFrame],
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0,
                          NULL, 1, &swapchainPresentMemoryBarrier);
@@ -2795,191 +7865,62 @@ int main() {
                              .baseArrayLayer = 0,
                              .layerCount = 1}};
 
-    vkCmdPipelineBarrier(commandBufferHandleList[x],
+    vkCmdPipelineBarrier(commandBufferHandleList[currentFrame],
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0,
                          NULL, 1, &rayTraceWriteMemoryBarrier);
 
-    result = vkEndCommandBuffer(commandBufferHandleList[x]);
+    result = vkEndCommandBuffer(commandBufferHandleList[currentFrame]);
 
     if (result != VK_SUCCESS) {
       throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
     }
-  }
-
-  // =========================================================================
-  // Fences, Semaphores
-
-  std::vector<VkFence> imageAvailableFenceHandleList(swapchainImageCount,
-                                                     VK_NULL_HANDLE);
-
-  std::vector<VkSemaphore> acquireImageSemaphoreHandleList(swapchainImageCount,
-                                                           VK_NULL_HANDLE);
 
-  std::vector<VkSemaphore> writeImageSemaphoreHandleList(swapchainImageCount,
-                                                         VK_NULL_HANDLE);
-
-  for (uint32_t x = 0; x < swapchainImageCount; x++) {
-    VkFenceCreateInfo imageAvailableFenceCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .pNext = NULL,
-        .flags = VK_FENCE_CREATE_SIGNALED_BIT};
+    // The trace waits for the build of the acceleration structure it reads,
+    // and the render timeline tells the next rebuild when it is free again
+    std::vector<VkSemaphore> waitSemaphoreHandleList = {
+        acquireImageSemaphoreHandleList[currentFrame],
+        accelerationStructureTimelineSemaphoreHandle};
 
-    result = vkCreateFence(deviceHandle, &imageAvailableFenceCreateInfo, NULL,
-                           &imageAvailableFenceHandleList[x]);
+    std::vector<uint64_t> waitSemaphoreValueList = {
+        0, topLevelAccelerationStructureTimelineValueList
+               [activeTopLevelAccelerationStructureIndex]};
 
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkCreateFence");
-    }
+    std::vector<VkPipelineStageFlags> waitPipelineStageFlagsList = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR};
 
-    VkSemaphoreCreateInfo acquireImageSemaphoreCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0};
+    topLevelRenderTimelineValueList[activeTopLevelAccelerationStructureIndex] =
+        ++renderTimelineValue;
 
-    result = vkCreateSemaphore(deviceHandle, &acquireImageSemaphoreCreateInfo,
-                               NULL, &acquireImageSemaphoreHandleList[x]);
+    std::vector<VkSemaphore> signalSemaphoreHandleList = {
+        writeImageSemaphoreHandleList[currentImageIndex],
+        renderTimelineSemaphoreHandle};
 
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkCreateSemaphore");
-    }
+    std::vector<uint64_t> signalSemaphoreValueList = {0, renderTimelineValue};
 
-    VkSemaphoreCreateInfo writeImageSemaphoreCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    VkTimelineSemaphoreSubmitInfo timelineSemaphoreSubmitInfo = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
         .pNext = NULL,
-        .flags = 0};
-
-    result = vkCreateSemaphore(deviceHandle, &writeImageSemaphoreCreateInfo,
-                               NULL, &writeImageSemaphoreHandleList[x]);
-
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkCreateSemaphore");
-    }
-  }
-
-  // =========================================================================
-  // Main Loop
-
-  uint32_t currentFrame = 0;
-  while (!exitWindow) {
-#if defined(PLATFORM_LINUX)
-    XEvent event;
-    XNextEvent(displayPtr, &event);
-    handleEvent(displayPtr, &event);
-#elif defined(PLATFORM_WINDOWS)
-    MSG msg;
-    PeekMessage(&msg, NULL, 0, 0, PM_REMOVE);
-    TranslateMessage(&msg);
-    DispatchMessage(&msg);
-
-    if (exitWindow) {
-      break;
-    }
-#endif
-
-    static bool isCameraMoved = true;
-    static float cameraPosition[3] = { 1.5, 4.0, 10.0 };
-    static float cameraYaw = 0.0;
-    static float cameraPitch = 0.0;
-
-    if (isMoveForward) {
-      cameraPosition[0] += cos(-cameraYaw - (3.141592 / 2)) * 0.01f;
-      cameraPosition[2] += sin(-cameraYaw - (3.141592 / 2)) * 0.01f;
-      isCameraMoved = true;
-    }
-    if (isMoveBack) {
-      cameraPosition[0] -= cos(-cameraYaw - (3.141592 / 2)) * 0.01f;
-      cameraPosition[2] -= sin(-cameraYaw - (3.141592 / 2)) * 0.01f;
-      isCameraMoved = true;
-    }
-    if (isTurnLeft) {
-      cameraYaw += 0.005f;
-      isCameraMoved = true;
-    }
-    if (isTurnRight) {
-      cameraYaw -= 0.005f;
-      isCameraMoved = true;
-    }
-
-    if (isCameraMoved) {
-      uniformStructure.cameraPosition[0] = cameraPosition[0];
-      uniformStructure.cameraPosition[1] = cameraPosition[1];
-      uniformStructure.cameraPosition[2] = cameraPosition[2];
-
-      uniformStructure.cameraForward[0] =
-          cosf(cameraPitch) * cosf(-cameraYaw - (3.141592 / 2.0));
-      uniformStructure.cameraForward[1] = sinf(cameraPitch);
-      uniformStructure.cameraForward[2] =
-          cosf(cameraPitch) * sinf(-cameraYaw - (3.141592 / 2.0));
-
-      uniformStructure.cameraRight[0] =
-          uniformStructure.cameraForward[1] * uniformStructure.cameraUp[2] -
-          uniformStructure.cameraForward[2] * uniformStructure.cameraUp[1];
-      uniformStructure.cameraRight[1] =
-          uniformStructure.cameraForward[2] * uniformStructure.cameraUp[0] -
-          uniformStructure.cameraForward[0] * uniformStructure.cameraUp[2];
-      uniformStructure.cameraRight[2] =
-          uniformStructure.cameraForward[0] * uniformStructure.cameraUp[1] -
-          uniformStructure.cameraForward[1] * uniformStructure.cameraUp[0];
-
-      uniformStructure.frameCount = 0;
-
-      isCameraMoved = false;
-    } else {
-      uniformStructure.frameCount += 1;
-    }
-
-    result = vkMapMemory(deviceHandle, uniformDeviceMemoryHandle, 0,
-                         sizeof(UniformStructure), 0, &hostUniformMemoryBuffer);
-
-    memcpy(hostUniformMemoryBuffer, &uniformStructure,
-           sizeof(UniformStructure));
-
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkMapMemory");
-    }
-
-    vkUnmapMemory(deviceHandle, uniformDeviceMemoryHandle);
-
-    result = vkWaitForFences(deviceHandle, 1,
-                             &imageAvailableFenceHandleList[currentFrame], true,
-                             UINT32_MAX);
-
-    if (result != VK_SUCCESS && result != VK_TIMEOUT) {
-      throwExceptionVulkanAPI(result, "vkWaitForFences");
-    }
-
-    result = vkResetFences(deviceHandle, 1,
-                           &imageAvailableFenceHandleList[currentFrame]);
-
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkResetFences");
-    }
-
-    uint32_t currentImageIndex = -1;
-    result =
-        vkAcquireNextImageKHR(deviceHandle, swapchainHandle, UINT32_MAX,
-                              acquireImageSemaphoreHandleList[currentFrame],
-                              VK_NULL_HANDLE, &currentImageIndex);
-
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkAcquireNextImageKHR");
-    }
-
-    VkPipelineStageFlags pipelineStageFlags =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        .waitSemaphoreValueCount = (uint32_t)waitSemaphoreValueList.size(),
+        .pWaitSemaphoreValues = waitSemaphoreValueList.data(),
+        .signalSemaphoreValueCount = (uint32_t)signalSemaphoreValueList.size(),
+        .pSignalSemaphoreValues = signalSemaphoreValueList.data()};
 
     VkSubmitInfo submitInfo = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .pNext = NULL,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &acquireImageSemaphoreHandleList[currentFrame],
-        .pWaitDstStageMask = &pipelineStageFlags,
+        .pNext = &timelineSemaphoreSubmitInfo,
+        .waitSemaphoreCount = (uint32_t)waitSemaphoreHandleList.size(),
+        .pWaitSemaphores = waitSemaphoreHandleList.data(),
+        .pWaitDstStageMask = waitPipelineStageFlagsList.data(),
         .commandBufferCount = 1,
         .pCommandBuffers = &commandBufferHandleList[currentFrame],
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &writeImageSemaphoreHandleList[currentFrame]};
+        .signalSemaphoreCount = (uint32_t)signalSemaphoreHandleList.size(),
+        .pSignalSemaphores = signalSemaphoreHandleList.data()};
+
+    beginTraceSection(frameTraceSection, "Submit and present");
 
+    frameSubmitMicrosecondsList[currentFrame] = getTraceMicroseconds();
     result = vkQueueSubmit(queueHandle, 1, &submitInfo,
                            imageAvailableFenceHandleList[currentFrame]);
 
@@ -2991,7 +7932,7 @@ int main() {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         .pNext = NULL,
         .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &writeImageSemaphoreHandleList[currentFrame],
+        .pWaitSemaphores = &writeImageSemaphoreHandleList[currentImageIndex],
         .swapchainCount = 1,
         .pSwapchains = &swapchainHandle,
         .pImageIndices = &currentImageIndex,
@@ -2999,16 +7940,22 @@ int main() {
 
     result = vkQueuePresentKHR(queueHandle, &presentInfo);
 
-    if (result != VK_SUCCESS) {
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+      isSwapchainOutOfDate = true;
+    } else if (result != VK_SUCCESS) {
       throwExceptionVulkanAPI(result, "vkQueuePresentKHR");
     }
 
-    currentFrame = (currentFrame + 1) % swapchainImageCount;
+    endTraceSection(frameTraceSection);
+
+    currentFrame = (currentFrame + 1) % FRAMES_IN_FLIGHT;
   }
 
   // =========================================================================
   // Cleanup
 
+  beginTraceSection(mainTraceSection, "Cleanup");
+
   result = vkDeviceWaitIdle(deviceHandle);
 
   if (result != VK_SUCCESS) {
@@ -3017,6 +7964,13 @@ int main() {
 
   for (uint32_t x = 0; x < swapchainImageCount; x++) {
     vkDestroySemaphore(deviceHandle, writeImageSemaphoreHandleList[x], NULL);
+  }
+
+  vkDestroyQueryPool(deviceHandle,
+                     accelerationStructureTimestampQueryPoolHandle, NULL);
+  vkDestroyQueryPool(deviceHandle, timestampQueryPoolHandle, NULL);
+
+  for (uint32_t x = 0; x < FRAMES_IN_FLIGHT; x++) {
     vkDestroySemaphore(deviceHandle, acquireImageSemaphoreHandleList[x], NULL);
     vkDestroyFence(deviceHandle, imageAvailableFenceHandleList[x], NULL);
   }
@@ -3036,33 +7990,67 @@ int main() {
   vkDestroyImageView(deviceHandle, rayTraceImageViewHandle, NULL);
   vkFreeMemory(deviceHandle, rayTraceImageDeviceMemoryHandle, NULL);
   vkDestroyImage(deviceHandle, rayTraceImageHandle, NULL);
+#if defined(HEATMAP_ENABLED)
+  vkDestroyImageView(deviceHandle, heatmapImageViewHandle, NULL);
+  vkFreeMemory(deviceHandle, heatmapImageDeviceMemoryHandle, NULL);
+  vkDestroyImage(deviceHandle, heatmapImageHandle, NULL);
+#endif
+#if defined(RAY_COUNTERS_ENABLED)
+  vkUnmapMemory(deviceHandle, rayCounterDeviceMemoryHandle);
+  vkFreeMemory(deviceHandle, rayCounterDeviceMemoryHandle, NULL);
+  vkDestroyBuffer(deviceHandle, rayCounterBufferHandle, NULL);
+#endif
+  vkUnmapMemory(deviceHandle, uniformDeviceMemoryHandle);
   vkFreeMemory(deviceHandle, uniformDeviceMemoryHandle, NULL);
   vkDestroyBuffer(deviceHandle, uniformBufferHandle, NULL);
-  vkDestroyFence(deviceHandle, topLevelAccelerationStructureBuildFenceHandle,
-                 NULL);
-
   vkFreeMemory(deviceHandle,
                topLevelAccelerationStructureDeviceScratchMemoryHandle, NULL);
 
   vkDestroyBuffer(deviceHandle,
                   topLevelAccelerationStructureScratchBufferHandle, NULL);
 
-  pvkDestroyAccelerationStructureKHR(deviceHandle,
-                                     topLevelAccelerationStructureHandle, NULL);
+  for (uint32_t x = 0; x < topLevelAccelerationStructureCount; x++) {
+    pvkDestroyAccelerationStructureKHR(
+        deviceHandle, topLevelAccelerationStructureHandleList[x], NULL);
 
-  vkFreeMemory(deviceHandle, topLevelAccelerationStructureDeviceMemoryHandle,
-               NULL);
+    vkFreeMemory(deviceHandle,
+                 topLevelAccelerationStructureDeviceMemoryHandleList[x], NULL);
 
-  vkDestroyBuffer(deviceHandle, topLevelAccelerationStructureBufferHandle,
-                  NULL);
+    vkDestroyBuffer(deviceHandle,
+                    topLevelAccelerationStructureBufferHandleList[x], NULL);
 
-  vkFreeMemory(deviceHandle, bottomLevelGeometryInstanceDeviceMemoryHandle,
-               NULL);
+    vkUnmapMemory(deviceHandle,
+                  bottomLevelGeometryInstanceDeviceMemoryHandleList[x]);
 
-  vkDestroyBuffer(deviceHandle, bottomLevelGeometryInstanceBufferHandle, NULL);
-  vkDestroyFence(deviceHandle, bottomLevelAccelerationStructureBuildFenceHandle,
-                 NULL);
+    vkFreeMemory(deviceHandle,
+                 bottomLevelGeometryInstanceDeviceMemoryHandleList[x], NULL);
+
+    vkDestroyBuffer(deviceHandle,
+                    bottomLevelGeometryInstanceBufferHandleList[x], NULL);
+  }
+
+#if defined(RESIDENCY_ENABLED)
+  vkFreeMemory(deviceHandle, residencyScratchDeviceMemoryHandle, NULL);
+  vkDestroyBuffer(deviceHandle, residencyScratchBufferHandle, NULL);
+
+  for (VkAccelerationStructureKHR residencySlotHandle :
+       residencySlotHandleList) {
+    pvkDestroyAccelerationStructureKHR(deviceHandle, residencySlotHandle, NULL);
+  }
+
+  vkFreeMemory(deviceHandle, residencyDeviceMemoryHandle, NULL);
+  vkDestroyBuffer(deviceHandle, residencyBufferHandle, NULL);
+#endif
 
+#if defined(LOD_ENABLED)
+  for (VkAccelerationStructureKHR levelOfDetailHandle :
+       levelOfDetailHandleList) {
+    pvkDestroyAccelerationStructureKHR(deviceHandle, levelOfDetailHandle, NULL);
+  }
+
+  vkFreeMemory(deviceHandle, levelOfDetailDeviceMemoryHandle, NULL);
+  vkDestroyBuffer(deviceHandle, levelOfDetailBufferHandle, NULL);
+#else
   vkFreeMemory(deviceHandle,
                bottomLevelAccelerationStructureDeviceScratchMemoryHandle, NULL);
 
@@ -3077,7 +8065,12 @@ int main() {
 
   vkDestroyBuffer(deviceHandle, bottomLevelAccelerationStructureBufferHandle,
                   NULL);
+#endif
 
+#if defined(RESIDENCY_ENABLED)
+  vkFreeMemory(deviceHandle, proxyDeviceMemoryHandle, NULL);
+  vkDestroyBuffer(deviceHandle, proxyBufferHandle, NULL);
+#endif
   vkFreeMemory(deviceHandle, indexDeviceMemoryHandle, NULL);
   vkDestroyBuffer(deviceHandle, indexBufferHandle, NULL);
   vkFreeMemory(deviceHandle, vertexDeviceMemoryHandle, NULL);
@@ -3099,10 +8092,20 @@ int main() {
   }
 
   vkDestroySwapchainKHR(deviceHandle, swapchainHandle, NULL);
+  vkDestroySemaphore(deviceHandle, accelerationStructureTimelineSemaphoreHandle,
+                     NULL);
+
+  vkDestroySemaphore(deviceHandle, renderTimelineSemaphoreHandle, NULL);
+  vkDestroyCommandPool(deviceHandle, computeCommandPoolHandle, NULL);
   vkDestroyCommandPool(deviceHandle, commandPoolHandle, NULL);
   vkDestroyDevice(deviceHandle, NULL);
   vkDestroySurfaceKHR(instanceHandle, surfaceHandle, NULL);
   vkDestroyInstance(instanceHandle, NULL);
 
+  unloadScene(scene);
+
+  endTraceSection(mainTraceSection);
+  writeTraceFile();
+
   return 0;
 }
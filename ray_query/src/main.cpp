@@ -3,19 +3,60 @@
 
 #include <vulkan/vulkan.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #if defined(PLATFORM_LINUX)
 #include <X11/Xlib.h>
 #include <X11/keysym.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vulkan/vulkan_xlib.h>
 #elif defined(PLATFORM_WINDOWS)
 #include <windows.h>
 #include <vulkan/vulkan_win32.h>
 #endif
 
+// Accumulated frames after which an idle camera stops rendering and the loop
+// sleeps until the next input event
+#define CONVERGED_FRAME_COUNT 4096
+
+// Camera speed in units and radians per second
+#define CAMERA_MOVE_SPEED 1.5f
+#define CAMERA_TURN_SPEED 0.75f
+
+// Frames the host may record ahead of the device, each with its own uniform
+// slice, command buffer and fence. Independent of the swapchain image count.
+#if !defined(FRAMES_IN_FLIGHT)
+#define FRAMES_IN_FLIGHT 2
+#endif
+
+// Frames kept for the rolling device timing statistics, which are printed
+// each time the window fills
+#define TIMESTAMP_WINDOW_SIZE 256
+
+// Trace events kept for TRACE_FILE, later events are dropped
+#define TRACE_EVENT_LIMIT 1000000
+
 #if defined(VALIDATION_ENABLED)
 #define STRING_RESET "\033[0m"
 #define STRING_INFO "\033[37m"
@@ -35,32 +76,1682 @@ debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
     std::cout << message.c_str() << std::endl;
   }
 
-  if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
-    message = STRING_WARNING + message + STRING_RESET;
-    std::cerr << message.c_str() << std::endl;
-  }
+  if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+    message = STRING_WARNING + message + STRING_RESET;
+    std::cerr << message.c_str() << std::endl;
+  }
+
+  if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+    message = STRING_ERROR + message + STRING_RESET;
+    std::cerr << message.c_str() << std::endl;
+  }
+
+  return VK_FALSE;
+}
+#endif
+
+void throwExceptionVulkanAPI(VkResult result, const std::string &functionName) {
+  std::string message = "Vulkan API exception: return code " +
+                        std::to_string(result) + " (" + functionName + ")";
+
+  std::cerr << message.c_str() << std::endl;
+
+  throw std::runtime_error(message);
+}
+
+// Rolling window of device timings, reported as min, average and 99th
+// percentile in milliseconds
+struct TimestampStatistics {
+  std::vector<double> millisecondsList;
+  uint32_t nextIndex = 0;
+};
+
+void addTimestampSample(TimestampStatistics &timestampStatistics,
+                        double milliseconds) {
+  if (timestampStatistics.millisecondsList.size() < TIMESTAMP_WINDOW_SIZE) {
+    timestampStatistics.millisecondsList.push_back(milliseconds);
+  } else {
+    timestampStatistics.millisecondsList[timestampStatistics.nextIndex] =
+        milliseconds;
+  }
+
+  timestampStatistics.nextIndex =
+      (timestampStatistics.nextIndex + 1) % TIMESTAMP_WINDOW_SIZE;
+}
+
+void printTimestampStatistics(const std::string &name,
+                              const TimestampStatistics &timestampStatistics) {
+  if (timestampStatistics.millisecondsList.empty()) {
+    return;
+  }
+
+  std::vector<double> sortedMillisecondsList =
+      timestampStatistics.millisecondsList;
+  std::sort(sortedMillisecondsList.begin(), sortedMillisecondsList.end());
+
+  double totalMilliseconds = 0.0;
+  for (double milliseconds : sortedMillisecondsList) {
+    totalMilliseconds += milliseconds;
+  }
+
+  size_t percentileIndex = std::min(sortedMillisecondsList.size() - 1,
+                                    sortedMillisecondsList.size() * 99 / 100);
+
+  std::cout << name << ": min " << sortedMillisecondsList.front()
+            << " ms, avg " << totalMilliseconds / sortedMillisecondsList.size()
+            << " ms, p99 " << sortedMillisecondsList[percentileIndex] << " ms"
+            << std::endl;
+}
+
+// Chrome trace events, collected when TRACE_FILE is set and written to that
+// path on exit for loading into Perfetto or chrome://tracing. Times are in
+// microseconds since startup, each track shows as one thread.
+struct TraceEvent {
+  std::string name;
+  uint32_t trackIndex;
+  double startMicroseconds;
+  double durationMicroseconds;
+};
+
+struct TraceRecorder {
+  const char *filePath = getenv("TRACE_FILE");
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+  std::vector<std::string> trackNameList;
+  std::vector<double> trackEndMicrosecondsList;
+  std::vector<TraceEvent> eventList;
+};
+
+static TraceRecorder traceRecorder;
+
+double getTraceMicroseconds() {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - traceRecorder.startTimePoint)
+      .count();
+}
+
+uint32_t addTraceTrack(const std::string &name) {
+  traceRecorder.trackNameList.push_back(name);
+  traceRecorder.trackEndMicrosecondsList.push_back(0.0);
+  return (uint32_t)traceRecorder.trackNameList.size() - 1;
+}
+
+void addTraceEvent(const std::string &name, uint32_t trackIndex,
+                   double startMicroseconds, double durationMicroseconds) {
+  if (traceRecorder.filePath == NULL) {
+    return;
+  }
+
+  if (traceRecorder.eventList.size() < TRACE_EVENT_LIMIT) {
+    traceRecorder.eventList.push_back({.name = name,
+                                       .trackIndex = trackIndex,
+                                       .startMicroseconds = startMicroseconds,
+                                       .durationMicroseconds =
+                                           durationMicroseconds});
+  }
+}
+
+// Device timestamps share no clock with the host, so device work is placed
+// at its submission time, or after the previous work on the same queue track
+void addQueueTraceEvent(const std::string &name, uint32_t trackIndex,
+                        double submitMicroseconds,
+                        double durationMicroseconds) {
+  double startMicroseconds = 0.0;
+  {
+    double &trackEndMicroseconds =
+        traceRecorder.trackEndMicrosecondsList[trackIndex];
+
+    startMicroseconds = std::max(submitMicroseconds, trackEndMicroseconds);
+    trackEndMicroseconds = startMicroseconds + durationMicroseconds;
+  }
+
+  addTraceEvent(name, trackIndex, startMicroseconds, durationMicroseconds);
+}
+
+// Consecutive sections of one function on one track, beginning a section
+// ends the one before it
+struct TraceSection {
+  uint32_t trackIndex = 0;
+  std::string name;
+  double startMicroseconds = 0.0;
+};
+
+void endTraceSection(TraceSection &traceSection) {
+  if (traceSection.name.empty()) {
+    return;
+  }
+
+  addTraceEvent(traceSection.name, traceSection.trackIndex,
+                traceSection.startMicroseconds,
+                getTraceMicroseconds() - traceSection.startMicroseconds);
+  traceSection.name.clear();
+}
+
+void beginTraceSection(TraceSection &traceSection, const std::string &name) {
+  if (traceRecorder.filePath == NULL) {
+    return;
+  }
+
+  endTraceSection(traceSection);
+  traceSection.name = name;
+  traceSection.startMicroseconds = getTraceMicroseconds();
+}
+
+// Escapes quotes, backslashes and control characters, such as in device
+// names, for a JSON string
+std::string getJSONString(const std::string &value) {
+  std::string jsonString;
+  for (char character : value) {
+    if (character == '"' || character == '\\') {
+      jsonString += '\\';
+      jsonString += character;
+    } else if ((unsigned char)character < 0x20) {
+      char escapeString[7];
+      snprintf(escapeString, sizeof(escapeString), "\\u%04x",
+               (unsigned char)character);
+      jsonString += escapeString;
+    } else {
+      jsonString += character;
+    }
+  }
+
+  return jsonString;
+}
+
+// Times are written in microseconds with fixed nanosecond precision, so long
+// sessions keep their spans apart
+void writeTraceFile() {
+  if (traceRecorder.filePath == NULL) {
+    return;
+  }
+
+  std::ofstream traceFile(traceRecorder.filePath);
+  traceFile << std::fixed << std::setprecision(3);
+  traceFile << "{\"traceEvents\": [\n";
+
+  for (uint32_t x = 0; x < traceRecorder.trackNameList.size(); x++) {
+    traceFile << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+              << "\"tid\": " << x << ", \"args\": {\"name\": \""
+              << getJSONString(traceRecorder.trackNameList[x]) << "\"}},\n";
+  }
+
+  for (uint32_t x = 0; x < traceRecorder.eventList.size(); x++) {
+    const TraceEvent &traceEvent = traceRecorder.eventList[x];
+    traceFile << "{\"name\": \"" << getJSONString(traceEvent.name)
+              << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": "
+              << traceEvent.trackIndex
+              << ", \"ts\": " << traceEvent.startMicroseconds
+              << ", \"dur\": " << traceEvent.durationMicroseconds << "}"
+              << (x + 1 < traceRecorder.eventList.size() ? ",\n" : "\n");
+  }
+
+  traceFile << "]}" << std::endl;
+}
+
+#if defined(RAY_COUNTERS_ENABLED)
+// Order of the counters in the RayCounter block of the shaders
+const std::vector<std::string> rayTypeNameList = {"Extension", "Shadow"};
+
+void printRayThroughput(const std::string &name, uint64_t rayCount,
+                        double traceMilliseconds) {
+  if (traceMilliseconds <= 0.0) {
+    return;
+  }
+
+  std::cout << name << " rays: " << rayCount / (traceMilliseconds * 1000.0)
+            << " Mrays/s" << std::endl;
+}
+#endif
+
+bool isDeviceExtensionSupported(VkPhysicalDevice physicalDeviceHandle,
+                                const char *extensionName) {
+  uint32_t extensionPropertyCount = 0;
+  VkResult result = vkEnumerateDeviceExtensionProperties(
+      physicalDeviceHandle, NULL, &extensionPropertyCount, NULL);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEnumerateDeviceExtensionProperties");
+  }
+
+  std::vector<VkExtensionProperties> extensionPropertiesList(
+      extensionPropertyCount);
+  result = vkEnumerateDeviceExtensionProperties(
+      physicalDeviceHandle, NULL, &extensionPropertyCount,
+      extensionPropertiesList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEnumerateDeviceExtensionProperties");
+  }
+
+  for (VkExtensionProperties &extensionProperties : extensionPropertiesList) {
+    if (strcmp(extensionProperties.extensionName, extensionName) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Device memory allocated by the example, by category. Allocations go through
+// allocateDeviceMemory, and memory released before shutdown goes through
+// freeDeviceMemory so the ledger stays current.
+struct MemoryAllocation {
+  VkDeviceMemory memoryHandle;
+  std::string category;
+  uint32_t heapIndex;
+  VkDeviceSize size;
+};
+
+struct MemoryLedger {
+  VkPhysicalDevice physicalDeviceHandle = VK_NULL_HANDLE;
+  bool isMemoryBudgetSupported = false;
+  std::vector<MemoryAllocation> allocationList;
+};
+
+double getMebibytes(VkDeviceSize size) { return size / (1024.0 * 1024.0); }
+
+VkDeviceSize getLedgerHeapSize(const MemoryLedger &memoryLedger,
+                               uint32_t heapIndex) {
+  VkDeviceSize heapSize = 0;
+  for (const MemoryAllocation &memoryAllocation :
+       memoryLedger.allocationList) {
+    if (memoryAllocation.heapIndex == heapIndex) {
+      heapSize += memoryAllocation.size;
+    }
+  }
+
+  return heapSize;
+}
+
+// Heap budgets and usage of the whole process from VK_EXT_memory_budget.
+// Without it the budget is the heap size and the usage is the ledger's.
+VkPhysicalDeviceMemoryBudgetPropertiesEXT
+getMemoryBudget(const MemoryLedger &memoryLedger,
+                VkPhysicalDeviceMemoryProperties &memoryProperties) {
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT memoryBudgetProperties = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+      .pNext = NULL};
+
+  VkPhysicalDeviceMemoryProperties2 memoryProperties2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+      .pNext = memoryLedger.isMemoryBudgetSupported ? &memoryBudgetProperties
+                                                    : NULL};
+
+  vkGetPhysicalDeviceMemoryProperties2(memoryLedger.physicalDeviceHandle,
+                                       &memoryProperties2);
+
+  memoryProperties = memoryProperties2.memoryProperties;
+
+  if (!memoryLedger.isMemoryBudgetSupported) {
+    for (uint32_t x = 0; x < memoryProperties.memoryHeapCount; x++) {
+      memoryBudgetProperties.heapBudget[x] =
+          memoryProperties.memoryHeaps[x].size;
+      memoryBudgetProperties.heapUsage[x] = getLedgerHeapSize(memoryLedger, x);
+    }
+  }
+
+  return memoryBudgetProperties;
+}
+
+void printMemoryReport(const std::string &name,
+                       const MemoryLedger &memoryLedger) {
+  std::cout << name << " memory:" << std::endl;
+
+  std::vector<std::string> categoryList;
+  for (const MemoryAllocation &memoryAllocation :
+       memoryLedger.allocationList) {
+    if (std::find(categoryList.begin(), categoryList.end(),
+                  memoryAllocation.category) == categoryList.end()) {
+      categoryList.push_back(memoryAllocation.category);
+    }
+  }
+
+  for (const std::string &category : categoryList) {
+    VkDeviceSize categorySize = 0;
+    uint32_t categoryAllocationCount = 0;
+    for (const MemoryAllocation &memoryAllocation :
+         memoryLedger.allocationList) {
+      if (memoryAllocation.category == category) {
+        categorySize += memoryAllocation.size;
+        categoryAllocationCount += 1;
+      }
+    }
+
+    std::cout << "  " << category << ": " << getMebibytes(categorySize)
+              << " MiB in " << categoryAllocationCount << " allocations"
+              << std::endl;
+  }
+
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT memoryBudgetProperties =
+      getMemoryBudget(memoryLedger, memoryProperties);
+
+  for (uint32_t x = 0; x < memoryProperties.memoryHeapCount; x++) {
+    VkDeviceSize ledgerHeapSize = getLedgerHeapSize(memoryLedger, x);
+    if (ledgerHeapSize == 0) {
+      continue;
+    }
+
+    VkDeviceSize heapBudget = memoryBudgetProperties.heapBudget[x];
+    VkDeviceSize heapUsage = memoryBudgetProperties.heapUsage[x];
+
+    std::cout << "  Heap " << x
+              << ((memoryProperties.memoryHeaps[x].flags &
+                   VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+                      ? " (device local): "
+                      : " (host): ")
+              << getMebibytes(ledgerHeapSize) << " MiB allocated, "
+              << getMebibytes(heapUsage) << " MiB used of "
+              << getMebibytes(heapBudget) << " MiB budget, "
+              << getMebibytes(heapBudget - std::min(heapUsage, heapBudget))
+              << " MiB headroom" << std::endl;
+  }
+}
+
+// Warns before an allocation that would exceed its heap's budget, where the
+// driver may start evicting or fail, and prints the report if it does fail
+VkResult allocateDeviceMemory(VkDevice deviceHandle,
+                              MemoryLedger &memoryLedger,
+                              const std::string &category,
+                              const VkMemoryAllocateInfo *memoryAllocateInfoPtr,
+                              VkDeviceMemory *memoryHandlePtr) {
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT memoryBudgetProperties =
+      getMemoryBudget(memoryLedger, memoryProperties);
+
+  uint32_t heapIndex = 0;
+  if (memoryAllocateInfoPtr->memoryTypeIndex <
+      memoryProperties.memoryTypeCount) {
+    heapIndex =
+        memoryProperties.memoryTypes[memoryAllocateInfoPtr->memoryTypeIndex]
+            .heapIndex;
+
+    VkDeviceSize heapBudget = memoryBudgetProperties.heapBudget[heapIndex];
+    VkDeviceSize heapUsage = memoryBudgetProperties.heapUsage[heapIndex];
+
+    if (heapUsage + memoryAllocateInfoPtr->allocationSize > heapBudget) {
+      std::cerr << "Warning: " << category << " allocation of "
+                << getMebibytes(memoryAllocateInfoPtr->allocationSize)
+                << " MiB exceeds the "
+                << getMebibytes(heapBudget - std::min(heapUsage, heapBudget))
+                << " MiB left in the budget of heap " << heapIndex
+                << std::endl;
+    }
+  }
+
+  VkResult result = vkAllocateMemory(deviceHandle, memoryAllocateInfoPtr, NULL,
+                                     memoryHandlePtr);
+
+  if (result == VK_SUCCESS) {
+    memoryLedger.allocationList.push_back(
+        {.memoryHandle = *memoryHandlePtr,
+         .category = category,
+         .heapIndex = heapIndex,
+         .size = memoryAllocateInfoPtr->allocationSize});
+  } else if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY ||
+             result == VK_ERROR_OUT_OF_HOST_MEMORY) {
+    printMemoryReport("Out of memory allocating " + category, memoryLedger);
+  }
+
+  return result;
+}
+
+void freeDeviceMemory(VkDevice deviceHandle, MemoryLedger &memoryLedger,
+                      VkDeviceMemory memoryHandle) {
+  for (uint32_t x = 0; x < memoryLedger.allocationList.size(); x++) {
+    if (memoryLedger.allocationList[x].memoryHandle == memoryHandle) {
+      memoryLedger.allocationList.erase(memoryLedger.allocationList.begin() +
+                                        x);
+      break;
+    }
+  }
+
+  vkFreeMemory(deviceHandle, memoryHandle, NULL);
+}
+
+
+// Magic ("RTSC") and version at the start of the scene cache, see loadScene
+#define SCENE_CACHE_MAGIC 0x43535452
+#define SCENE_CACHE_VERSION 3
+
+// Sections of the scene cache start on this boundary, so a mapped section can
+// be copied into a mapped buffer without realignment
+#define SCENE_CACHE_ALIGNMENT 256
+
+// OBJ files are parsed in line aligned chunks of about this many bytes
+#define OBJ_CHUNK_SIZE (16 * 1024 * 1024)
+
+// Vertices in the same grid cell of this size are welded into one when the
+// cache is written. Zero welds only vertices at exactly the same position.
+#if !defined(SCENE_WELD_EPSILON)
+#define SCENE_WELD_EPSILON 0.0f
+#endif
+
+// Layout of the device vertex buffer. Quantized positions are four signed
+// normalized 16 bit values each, the last unused, and follow the row major
+// 3x4 transform decoding them.
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+#define SCENE_VERTEX_FORMAT VK_FORMAT_R16G16B16A16_SNORM
+#define SCENE_VERTEX_STRIDE (sizeof(int16_t) * 4)
+#define SCENE_VERTEX_DATA_OFFSET (sizeof(float) * 12)
+#else
+#define SCENE_VERTEX_FORMAT VK_FORMAT_R32G32B32_SFLOAT
+#define SCENE_VERTEX_STRIDE (sizeof(float) * 3)
+#define SCENE_VERTEX_DATA_OFFSET 0
+#endif
+
+// Vertices quantized by one task
+#define QUANTIZATION_TASK_VERTEX_COUNT (1024 * 1024)
+
+struct Material {
+  float ambient[4] = {0, 0, 0, 0};
+  float diffuse[4] = {0, 0, 0, 0};
+  float specular[4] = {0, 0, 0, 0};
+  float emission[4] = {0, 0, 0, 0};
+};
+
+// Offsets are in bytes from the start of the file, counts in elements. The
+// source size and write time identify the OBJ the cache was generated from,
+// and weldEpsilon the SCENE_WELD_EPSILON its vertices were welded with.
+// Indices are indexSize (2 or 4) bytes each.
+struct SceneCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceFileSize;
+  int64_t sourceWriteTime;
+  double weldEpsilon;
+  uint64_t fileSize;
+  uint64_t vertexCount;
+  uint64_t vertexOffset;
+  uint64_t indexCount;
+  uint64_t indexSize;
+  uint64_t indexOffset;
+  uint64_t primitiveCount;
+  uint64_t materialIndexOffset;
+  uint64_t materialCount;
+  uint64_t materialOffset;
+};
+
+// Vertices and triangles written by one parse task
+struct SceneRange {
+  uint64_t vertexOffset;
+  uint64_t vertexCount;
+  uint64_t primitiveOffset;
+  uint64_t primitiveCount;
+};
+
+// Vertex positions (three floats each), triangle indices, one material index
+// per triangle and the materials, laid out as the device buffers expect them.
+// Indices are 16 bit when indexSize is 2, 32 bit otherwise. The data pointers
+// point into the mapped cache, or into the lists when the cache cannot be
+// written.
+struct Scene {
+  uint64_t vertexCount = 0;
+  const float *vertexData = NULL;
+  uint64_t indexCount = 0;
+  uint32_t indexSize = sizeof(uint32_t);
+  const void *indexData = NULL;
+  uint64_t primitiveCount = 0;
+  const uint32_t *materialIndexData = NULL;
+  uint64_t materialCount = 0;
+  const Material *materialData = NULL;
+
+  std::vector<float> vertexList;
+  std::vector<uint32_t> indexList;
+  std::vector<uint32_t> materialIndexList;
+  std::vector<Material> materialList;
+
+  void *mappedFileBuffer = NULL;
+  uint64_t mappedFileSize = 0;
+
+  // The unoptimized scene a first run renders is parsed into this file,
+  // deleted by unloadScene
+  std::string temporaryFileName;
+
+  // Quantized positions in the SCENE_VERTEX_FORMAT layout and the transform
+  // decoding them, set once isQuantized is. Only built with
+  // VERTEX_QUANTIZATION_ENABLED.
+  std::vector<int16_t> quantizedVertexList;
+  float quantizationTransform[3][4] = {};
+  bool isQuantized = false;
+
+  // Lets other threads upload the scene while it is parsed. The counts, the
+  // materials and rangeList are set once isSizeKnown is, the data of each
+  // range once it is marked ready. isLoadFailed wakes every wait to throw.
+  std::mutex mutex;
+  std::condition_variable conditionVariable;
+  bool isSizeKnown = false;
+  bool isLoadFailed = false;
+  std::vector<SceneRange> rangeList;
+  std::vector<bool> isRangeReadyList;
+};
+
+uint64_t alignSceneCacheOffset(uint64_t offset) {
+  return (offset + SCENE_CACHE_ALIGNMENT - 1) &
+         ~(uint64_t)(SCENE_CACHE_ALIGNMENT - 1);
+}
+
+// Indices are 16 bit when every vertex can be addressed with them
+uint32_t getSceneIndexSize(uint64_t vertexCount) {
+  return vertexCount <= 0x10000 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+uint32_t getSceneIndex(const void *indexData, uint32_t indexSize,
+                       uint64_t position) {
+  return indexSize == sizeof(uint16_t)
+             ? ((const uint16_t *)indexData)[position]
+             : ((const uint32_t *)indexData)[position];
+}
+
+void setSceneIndex(void *indexData, uint32_t indexSize, uint64_t position,
+                   uint32_t index) {
+  if (indexSize == sizeof(uint16_t)) {
+    ((uint16_t *)indexData)[position] = index;
+  } else {
+    ((uint32_t *)indexData)[position] = index;
+  }
+}
+
+uint64_t getSceneVertexBufferSize(const Scene &scene) {
+  return SCENE_VERTEX_DATA_OFFSET + SCENE_VERTEX_STRIDE * scene.vertexCount;
+}
+
+// Size of the index buffer, padded to whole 32 bit words for the shaders that
+// read 16 bit indices in pairs
+uint64_t getSceneIndexBufferSize(const Scene &scene) {
+  return (scene.indexSize * scene.indexCount + 3) / 4 * 4;
+}
+
+// Maps a whole file read only, returns NULL if it cannot be mapped
+void *mapFile(const std::string &fileName, uint64_t &fileSize) {
+  void *fileBuffer = NULL;
+
+#if defined(PLATFORM_WINDOWS)
+  HANDLE fileHandle =
+      CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (fileHandle == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  LARGE_INTEGER largeFileSize;
+  HANDLE fileMappingHandle = NULL;
+  if (GetFileSizeEx(fileHandle, &largeFileSize) &&
+      largeFileSize.QuadPart > 0) {
+    fileSize = largeFileSize.QuadPart;
+    fileMappingHandle =
+        CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+  }
+
+  // The view keeps the mapping alive after both handles are closed
+  if (fileMappingHandle != NULL) {
+    fileBuffer = MapViewOfFile(fileMappingHandle, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(fileMappingHandle);
+  }
+  CloseHandle(fileHandle);
+#elif defined(PLATFORM_LINUX)
+  int fileDescriptor = open(fileName.c_str(), O_RDONLY);
+  if (fileDescriptor == -1) {
+    return NULL;
+  }
+
+  struct stat fileStat;
+  if (fstat(fileDescriptor, &fileStat) == 0 && fileStat.st_size > 0) {
+    fileSize = fileStat.st_size;
+    fileBuffer = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE,
+                      fileDescriptor, 0);
+
+    if (fileBuffer == MAP_FAILED) {
+      fileBuffer = NULL;
+    } else {
+      madvise(fileBuffer, fileSize, MADV_SEQUENTIAL);
+    }
+  }
+  close(fileDescriptor);
+#endif
+
+  return fileBuffer;
+}
+
+void unmapFile(void *fileBuffer, uint64_t fileSize) {
+#if defined(PLATFORM_WINDOWS)
+  UnmapViewOfFile(fileBuffer);
+#elif defined(PLATFORM_LINUX)
+  munmap(fileBuffer, fileSize);
+#endif
+}
+
+// Creates a file of fileSize bytes, replacing any existing one, and maps it
+// for writing. Returns NULL if it cannot be created.
+void *createMappedFile(const std::string &fileName, uint64_t fileSize) {
+  void *fileBuffer = NULL;
+
+#if defined(PLATFORM_WINDOWS)
+  HANDLE fileHandle =
+      CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                  CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (fileHandle == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  HANDLE fileMappingHandle =
+      CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE,
+                         (DWORD)(fileSize >> 32), (DWORD)fileSize, NULL);
+  if (fileMappingHandle != NULL) {
+    fileBuffer = MapViewOfFile(fileMappingHandle, FILE_MAP_WRITE, 0, 0, 0);
+    CloseHandle(fileMappingHandle);
+  }
+  CloseHandle(fileHandle);
+#elif defined(PLATFORM_LINUX)
+  int fileDescriptor =
+      open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fileDescriptor == -1) {
+    return NULL;
+  }
+
+  if (ftruncate(fileDescriptor, fileSize) == 0) {
+    fileBuffer = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fileDescriptor, 0);
+
+    if (fileBuffer == MAP_FAILED) {
+      fileBuffer = NULL;
+    }
+  }
+  close(fileDescriptor);
+#endif
+
+  return fileBuffer;
+}
+
+// Maps the cache and points the scene at its sections. Returns false, leaving
+// the scene empty, when the cache is missing, was generated from a different
+// OBJ or with a different SCENE_WELD_EPSILON, or is truncated.
+bool loadSceneCache(const std::string &cacheFileName, uint64_t sourceFileSize,
+                    int64_t sourceWriteTime, Scene &scene) {
+  uint64_t fileSize = 0;
+  void *fileBuffer = mapFile(cacheFileName, fileSize);
+  if (fileBuffer == NULL) {
+    return false;
+  }
+
+  SceneCacheHeader header = {};
+  if (fileSize >= sizeof(SceneCacheHeader)) {
+    memcpy(&header, fileBuffer, sizeof(SceneCacheHeader));
+  }
+
+  auto isSectionInFile = [&](uint64_t offset, uint64_t count,
+                             uint64_t elementSize) {
+    return offset % SCENE_CACHE_ALIGNMENT == 0 && offset <= fileSize &&
+           count <= (fileSize - offset) / elementSize;
+  };
+
+  if (header.magic != SCENE_CACHE_MAGIC ||
+      header.version != SCENE_CACHE_VERSION ||
+      (header.indexSize != sizeof(uint16_t) &&
+       header.indexSize != sizeof(uint32_t)) ||
+      header.sourceFileSize != sourceFileSize ||
+      header.sourceWriteTime != sourceWriteTime ||
+      header.weldEpsilon != (double)SCENE_WELD_EPSILON ||
+      header.fileSize != fileSize ||
+      !isSectionInFile(header.vertexOffset, header.vertexCount,
+                       sizeof(float) * 3) ||
+      !isSectionInFile(header.indexOffset, header.indexCount,
+                       header.indexSize) ||
+      !isSectionInFile(header.materialIndexOffset, header.primitiveCount,
+                       sizeof(uint32_t)) ||
+      !isSectionInFile(header.materialOffset, header.materialCount,
+                       sizeof(Material))) {
+    unmapFile(fileBuffer, fileSize);
+    return false;
+  }
+
+  const char *cacheBuffer = (const char *)fileBuffer;
+
+  scene.vertexCount = header.vertexCount;
+  scene.vertexData = (const float *)(cacheBuffer + header.vertexOffset);
+  scene.indexCount = header.indexCount;
+  scene.indexSize = header.indexSize;
+  scene.indexData = cacheBuffer + header.indexOffset;
+  scene.primitiveCount = header.primitiveCount;
+  scene.materialIndexData =
+      (const uint32_t *)(cacheBuffer + header.materialIndexOffset);
+  scene.materialCount = header.materialCount;
+  scene.materialData = (const Material *)(cacheBuffer + header.materialOffset);
+
+  scene.mappedFileBuffer = fileBuffer;
+  scene.mappedFileSize = fileSize;
+
+  return true;
+}
+
+// Lays out the sections of a cache for the given counts
+SceneCacheHeader getSceneCacheHeader(uint64_t sourceFileSize,
+                                     int64_t sourceWriteTime,
+                                     uint64_t vertexCount,
+                                     uint32_t indexSize,
+                                     uint64_t primitiveCount,
+                                     uint64_t materialCount) {
+  SceneCacheHeader header = {
+      .magic = SCENE_CACHE_MAGIC,
+      .version = SCENE_CACHE_VERSION,
+      .sourceFileSize = sourceFileSize,
+      .sourceWriteTime = sourceWriteTime,
+      .weldEpsilon = SCENE_WELD_EPSILON,
+      .fileSize = 0,
+      .vertexCount = vertexCount,
+      .vertexOffset = alignSceneCacheOffset(sizeof(SceneCacheHeader)),
+      .indexCount = primitiveCount * 3,
+      .indexSize = indexSize,
+      .indexOffset = 0,
+      .primitiveCount = primitiveCount,
+      .materialIndexOffset = 0,
+      .materialCount = materialCount,
+      .materialOffset = 0};
+
+  header.indexOffset = alignSceneCacheOffset(
+      header.vertexOffset + sizeof(float) * 3 * header.vertexCount);
+  header.materialIndexOffset = alignSceneCacheOffset(
+      header.indexOffset + header.indexSize * header.indexCount);
+  header.materialOffset = alignSceneCacheOffset(
+      header.materialIndexOffset + sizeof(uint32_t) * header.primitiveCount);
+  header.fileSize =
+      header.materialOffset + sizeof(Material) * header.materialCount;
+
+  return header;
+}
+
+// Runs taskFunction for every task index on up to one thread per hardware
+// thread, each thread claiming the next task that has not started. Returns
+// the number of threads used.
+uint32_t runTasksInParallel(uint32_t taskCount,
+                            const std::function<void(uint32_t)> &taskFunction) {
+  std::atomic<uint32_t> nextTaskIndex = 0;
+
+  auto workerFunction = [&]() {
+    for (uint32_t taskIndex = nextTaskIndex++; taskIndex < taskCount;
+         taskIndex = nextTaskIndex++) {
+      taskFunction(taskIndex);
+    }
+  };
+
+  uint32_t threadCount =
+      std::min(std::max(std::thread::hardware_concurrency(), 1u), taskCount);
+
+  std::vector<std::thread> threadList;
+  for (uint32_t x = 1; x < threadCount; x++) {
+    threadList.emplace_back(workerFunction);
+  }
+
+  workerFunction();
+
+  for (std::thread &thread : threadList) {
+    thread.join();
+  }
+
+  return threadCount;
+}
+
+// One line aligned range of an OBJ file. The first pass counts what the
+// range contains, so the second pass can write it straight to its offsets in
+// the scene lists.
+struct OBJChunk {
+  const char *begin;
+  const char *end;
+
+  uint64_t vertexCount = 0;
+  uint64_t primitiveCount = 0;
+  std::vector<std::string> materialLibraryList;
+  std::string lastMaterialName;
+  bool isMaterialNameSet = false;
+
+  uint64_t vertexOffset = 0;
+  uint64_t primitiveOffset = 0;
+  uint32_t initialMaterialIndex = -1;
+};
+
+// Returns the next whitespace separated token before lineEnd and moves
+// linePosition past it. The token is empty at the end of the line.
+std::string_view getOBJToken(const char *&linePosition, const char *lineEnd) {
+  while (linePosition < lineEnd &&
+         (*linePosition == ' ' || *linePosition == '\t' ||
+          *linePosition == '\r')) {
+    linePosition++;
+  }
+
+  const char *tokenBegin = linePosition;
+  while (linePosition < lineEnd && *linePosition != ' ' &&
+         *linePosition != '\t' && *linePosition != '\r') {
+    linePosition++;
+  }
+
+  return std::string_view(tokenBegin, linePosition - tokenBegin);
+}
+
+// Calls lineFunction with the keyword of every line in the chunk and the
+// position after it
+void forEachOBJLine(const OBJChunk &chunk,
+                    const std::function<void(std::string_view, const char *,
+                                             const char *)> &lineFunction) {
+  const char *lineBegin = chunk.begin;
+  while (lineBegin < chunk.end) {
+    const char *lineEnd =
+        (const char *)memchr(lineBegin, '\n', chunk.end - lineBegin);
+    if (lineEnd == NULL) {
+      lineEnd = chunk.end;
+    }
+
+    const char *linePosition = lineBegin;
+    std::string_view keyword = getOBJToken(linePosition, lineEnd);
+    if (!keyword.empty() && keyword[0] != '#') {
+      lineFunction(keyword, linePosition, lineEnd);
+    }
+
+    lineBegin = lineEnd + 1;
+  }
+}
+
+// Parses the OBJ in line aligned chunks of OBJ_CHUNK_SIZE on every hardware
+// thread, straight into the sections of a temporary file laid out like the
+// cache. Only positions, faces, usemtl and mtllib are read. Polygons are split
+// into triangle fans. Materials are read with tinyobj::LoadMtl.
+void parseSceneOBJ(const std::string &objFileName,
+                   const std::string &temporaryFileName, Scene &scene) {
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+
+  uint64_t fileSize = 0;
+  const char *fileBuffer = (const char *)mapFile(objFileName, fileSize);
+  if (fileBuffer == NULL) {
+    throw std::runtime_error("OBJ: could not open " + objFileName);
+  }
+
+  std::vector<OBJChunk> chunkList;
+  for (uint64_t chunkBegin = 0; chunkBegin < fileSize;) {
+    uint64_t chunkEnd = std::min(chunkBegin + OBJ_CHUNK_SIZE, fileSize);
+    while (chunkEnd < fileSize && fileBuffer[chunkEnd - 1] != '\n') {
+      chunkEnd++;
+    }
+
+    chunkList.push_back(
+        {.begin = fileBuffer + chunkBegin, .end = fileBuffer + chunkEnd});
+    chunkBegin = chunkEnd;
+  }
+
+  // Count every chunk's vertices and triangles
+  runTasksInParallel(chunkList.size(), [&](uint32_t chunkIndex) {
+    OBJChunk &chunk = chunkList[chunkIndex];
+
+    forEachOBJLine(chunk, [&](std::string_view keyword,
+                              const char *linePosition, const char *lineEnd) {
+      if (keyword == "v") {
+        chunk.vertexCount += 1;
+      } else if (keyword == "f") {
+        uint32_t faceVertexCount = 0;
+        while (!getOBJToken(linePosition, lineEnd).empty()) {
+          faceVertexCount += 1;
+        }
+
+        if (faceVertexCount >= 3) {
+          chunk.primitiveCount += faceVertexCount - 2;
+        }
+      } else if (keyword == "usemtl") {
+        chunk.lastMaterialName = getOBJToken(linePosition, lineEnd);
+        chunk.isMaterialNameSet = true;
+      } else if (keyword == "mtllib") {
+        for (std::string_view token = getOBJToken(linePosition, lineEnd);
+             !token.empty(); token = getOBJToken(linePosition, lineEnd)) {
+          chunk.materialLibraryList.push_back(std::string(token));
+        }
+      }
+    });
+  });
+
+  std::map<std::string, int> materialMap;
+  std::vector<tinyobj::material_t> materials;
+  std::vector<std::string> loadedMaterialLibraryList;
+
+  uint64_t vertexCount = 0;
+  uint64_t primitiveCount = 0;
+  for (OBJChunk &chunk : chunkList) {
+    chunk.vertexOffset = vertexCount;
+    chunk.primitiveOffset = primitiveCount;
+    vertexCount += chunk.vertexCount;
+    primitiveCount += chunk.primitiveCount;
+
+    for (const std::string &materialLibrary : chunk.materialLibraryList) {
+      if (std::find(loadedMaterialLibraryList.begin(),
+                    loadedMaterialLibraryList.end(),
+                    materialLibrary) != loadedMaterialLibraryList.end()) {
+        continue;
+      }
+      loadedMaterialLibraryList.push_back(materialLibrary);
+
+      std::ifstream materialFile(
+          std::filesystem::path(objFileName).parent_path() / materialLibrary);
+      if (!materialFile.is_open()) {
+        std::cout << "OBJ: could not open " << materialLibrary << std::endl;
+        continue;
+      }
+
+      std::string warning;
+      std::string error;
+      tinyobj::LoadMtl(&materialMap, &materials, &materialFile, &warning,
+                       &error);
+
+      if (!warning.empty()) {
+        std::cout << "TinyObjReader: " << warning;
+      }
+      if (!error.empty()) {
+        std::cerr << "TinyObjReader: " << error;
+      }
+    }
+  }
+
+  auto getMaterialIndex = [&](std::string_view materialName) {
+    auto materialIterator = materialMap.find(std::string(materialName));
+    return materialIterator == materialMap.end()
+               ? (uint32_t)-1
+               : (uint32_t)materialIterator->second;
+  };
+
+  // A chunk starts with the material of the last usemtl before it
+  uint32_t materialIndex = -1;
+  for (OBJChunk &chunk : chunkList) {
+    chunk.initialMaterialIndex = materialIndex;
+    if (chunk.isMaterialNameSet) {
+      materialIndex = getMaterialIndex(chunk.lastMaterialName);
+    }
+  }
+
+  std::vector<Material> materialList(materials.size());
+  for (uint32_t x = 0; x < materials.size(); x++) {
+    memcpy(materialList[x].ambient, materials[x].ambient, sizeof(float) * 3);
+    memcpy(materialList[x].diffuse, materials[x].diffuse, sizeof(float) * 3);
+    memcpy(materialList[x].specular, materials[x].specular, sizeof(float) * 3);
+    memcpy(materialList[x].emission, materials[x].emission, sizeof(float) * 3);
+  }
+
+  uint32_t indexSize = getSceneIndexSize(vertexCount);
+  SceneCacheHeader header = getSceneCacheHeader(
+      0, 0, vertexCount, indexSize, primitiveCount, materialList.size());
+
+  char *cacheBuffer =
+      (char *)createMappedFile(temporaryFileName, header.fileSize);
+
+  float *vertexData = NULL;
+  void *indexData = NULL;
+  uint32_t *materialIndexData = NULL;
+  Material *materialData = NULL;
+
+  if (cacheBuffer != NULL) {
+    vertexData = (float *)(cacheBuffer + header.vertexOffset);
+    indexData = cacheBuffer + header.indexOffset;
+    materialIndexData = (uint32_t *)(cacheBuffer + header.materialIndexOffset);
+    materialData = (Material *)(cacheBuffer + header.materialOffset);
+
+    memcpy(materialData, materialList.data(),
+           sizeof(Material) * materialList.size());
+  } else {
+    std::cerr << "Scene cache: could not write " << temporaryFileName
+              << std::endl;
+
+    scene.vertexList.resize(vertexCount * 3);
+    scene.indexList.resize((indexSize * primitiveCount * 3 + 3) / 4);
+    scene.materialIndexList.resize(primitiveCount);
+    scene.materialList = materialList;
+
+    vertexData = scene.vertexList.data();
+    indexData = scene.indexList.data();
+    materialIndexData = scene.materialIndexList.data();
+    materialData = scene.materialList.data();
+  }
+
+  {
+    std::lock_guard<std::mutex> sceneLock(scene.mutex);
+
+    scene.vertexCount = vertexCount;
+    scene.vertexData = vertexData;
+    scene.indexCount = primitiveCount * 3;
+    scene.indexSize = indexSize;
+    scene.indexData = indexData;
+    scene.primitiveCount = primitiveCount;
+    scene.materialIndexData = materialIndexData;
+    scene.materialCount = materialList.size();
+    scene.materialData = materialData;
+
+    scene.mappedFileBuffer = cacheBuffer;
+    scene.mappedFileSize = header.fileSize;
+    if (cacheBuffer != NULL) {
+      scene.temporaryFileName = temporaryFileName;
+    }
+
+    for (const OBJChunk &chunk : chunkList) {
+      scene.rangeList.push_back({.vertexOffset = chunk.vertexOffset,
+                                 .vertexCount = chunk.vertexCount,
+                                 .primitiveOffset = chunk.primitiveOffset,
+                                 .primitiveCount = chunk.primitiveCount});
+    }
+    scene.isRangeReadyList.resize(chunkList.size(), false);
+    scene.isSizeKnown = true;
+  }
+  scene.conditionVariable.notify_all();
+
+  std::atomic<bool> isFaceInvalid = false;
+  std::atomic<uint64_t> parsedByteCount = 0;
+  std::atomic<uint32_t> printedPercent = 0;
+
+  // Parse every chunk into its range of the scene
+  uint32_t threadCount =
+      runTasksInParallel(chunkList.size(), [&](uint32_t chunkIndex) {
+        const OBJChunk &chunk = chunkList[chunkIndex];
+
+        float *chunkVertexData = vertexData + chunk.vertexOffset * 3;
+        uint64_t chunkIndexPosition = chunk.primitiveOffset * 3;
+        uint32_t *chunkMaterialIndexData =
+            materialIndexData + chunk.primitiveOffset;
+
+        uint64_t chunkVertexCount = 0;
+        uint32_t chunkMaterialIndex = chunk.initialMaterialIndex;
+        std::vector<uint32_t> faceIndexList;
+        bool isChunkFaceInvalid = false;
+
+        forEachOBJLine(chunk, [&](std::string_view keyword,
+                                  const char *linePosition,
+                                  const char *lineEnd) {
+          if (keyword == "v") {
+            for (uint32_t x = 0; x < 3; x++) {
+              std::string_view token = getOBJToken(linePosition, lineEnd);
+              if (!token.empty() && token[0] == '+') {
+                token.remove_prefix(1);
+              }
+
+              float value = 0.0f;
+              std::from_chars(token.data(), token.data() + token.size(),
+                              value);
+              chunkVertexData[chunkVertexCount * 3 + x] = value;
+            }
+
+            chunkVertexCount += 1;
+          } else if (keyword == "f") {
+            faceIndexList.clear();
+            for (std::string_view token = getOBJToken(linePosition, lineEnd);
+                 !token.empty(); token = getOBJToken(linePosition, lineEnd)) {
+
+              // Positive indices count from one, negative ones back from
+              // the last vertex read
+              int64_t index = 0;
+              std::from_chars(token.data(), token.data() + token.size(),
+                              index);
+              if (index < 0) {
+                index += chunk.vertexOffset + chunkVertexCount;
+              } else {
+                index -= 1;
+              }
+
+              if (index < 0 || index >= (int64_t)vertexCount) {
+                isChunkFaceInvalid = true;
+                index = 0;
+              }
+
+              faceIndexList.push_back(index);
+            }
+
+            for (uint32_t x = 2; x < faceIndexList.size(); x++) {
+              setSceneIndex(indexData, indexSize, chunkIndexPosition++,
+                            faceIndexList[0]);
+              setSceneIndex(indexData, indexSize, chunkIndexPosition++,
+                            faceIndexList[x - 1]);
+              setSceneIndex(indexData, indexSize, chunkIndexPosition++,
+                            faceIndexList[x]);
+
+              *chunkMaterialIndexData++ = chunkMaterialIndex;
+            }
+          } else if (keyword == "usemtl") {
+            chunkMaterialIndex =
+                getMaterialIndex(getOBJToken(linePosition, lineEnd));
+          }
+        });
+
+        // An invalid range is never marked ready, so no device uploads it
+        if (isChunkFaceInvalid) {
+          isFaceInvalid = true;
+          return;
+        }
+
+        {
+          std::lock_guard<std::mutex> sceneLock(scene.mutex);
+          scene.isRangeReadyList[chunkIndex] = true;
+        }
+        scene.conditionVariable.notify_all();
+
+        uint64_t chunkSize = chunk.end - chunk.begin;
+        uint32_t percent =
+            (parsedByteCount += chunkSize) * 10 / fileSize * 10;
+        uint32_t previousPercent = printedPercent;
+
+        if (chunkList.size() > 1 && percent > previousPercent &&
+            printedPercent.compare_exchange_strong(previousPercent, percent)) {
+          std::cout << "OBJ: " << percent << "%" << std::endl;
+        }
+      });
+
+  unmapFile((void *)fileBuffer, fileSize);
+
+  if (isFaceInvalid) {
+    throw std::runtime_error("OBJ: face with invalid vertex index in " +
+                             objFileName);
+  }
+
+  double parseMilliseconds = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() -
+                                 startTimePoint)
+                                 .count();
+
+  std::cout << "OBJ: " << fileSize / (1024.0 * 1024.0) << " MiB in "
+            << parseMilliseconds << " ms ("
+            << fileSize / (1024.0 * 1024.0) / (parseMilliseconds / 1000.0)
+            << " MiB/s) on " << threadCount << " threads" << std::endl;
+}
+
+// Welds the vertices of each SCENE_WELD_EPSILON grid cell, or at each exact
+// position, into the first of them, drops vertices no triangle uses and
+// numbers the rest in the order the triangles first use them, so the vertices
+// of nearby triangles are stored together. Triangles keep their order, as the
+// shaders and the material indices address them by primitive index. The
+// result is written to the cache with 16 bit indices when the remaining
+// vertices allow. The header is written last, so a cache left incomplete is
+// never loaded.
+void writeOptimizedSceneCache(const std::string &cacheFileName,
+                              uint64_t sourceFileSize, int64_t sourceWriteTime,
+                              const Scene &scene) {
+  std::chrono::steady_clock::time_point startTimePoint =
+      std::chrono::steady_clock::now();
+
+  // Grid cells, or the bits of each coordinate with -0 folded into 0
+  std::vector<std::array<int64_t, 3>> weldKeyList(scene.vertexCount);
+  std::vector<uint32_t> sortedVertexIndexList(scene.vertexCount);
+  for (uint64_t x = 0; x < scene.vertexCount; x++) {
+    for (uint32_t y = 0; y < 3; y++) {
+      float value = scene.vertexData[x * 3 + y] + 0.0f;
+
+      if (SCENE_WELD_EPSILON > 0.0f) {
+        weldKeyList[x][y] = (int64_t)std::floor(value / SCENE_WELD_EPSILON);
+      } else {
+        uint32_t valueBits;
+        memcpy(&valueBits, &value, sizeof(float));
+        weldKeyList[x][y] = valueBits;
+      }
+    }
+    sortedVertexIndexList[x] = x;
+  }
+
+  std::sort(sortedVertexIndexList.begin(), sortedVertexIndexList.end(),
+            [&](uint32_t vertexIndexA, uint32_t vertexIndexB) {
+              if (weldKeyList[vertexIndexA] != weldKeyList[vertexIndexB]) {
+                return weldKeyList[vertexIndexA] < weldKeyList[vertexIndexB];
+              }
+              return vertexIndexA < vertexIndexB;
+            });
+
+  std::vector<uint32_t> weldedVertexIndexList(scene.vertexCount);
+  for (uint64_t x = 0; x < scene.vertexCount; x++) {
+    uint32_t vertexIndex = sortedVertexIndexList[x];
+    weldedVertexIndexList[vertexIndex] = vertexIndex;
+
+    if (x > 0) {
+      uint32_t previousVertexIndex = sortedVertexIndexList[x - 1];
+      if (weldKeyList[vertexIndex] == weldKeyList[previousVertexIndex]) {
+        weldedVertexIndexList[vertexIndex] =
+            weldedVertexIndexList[previousVertexIndex];
+      }
+    }
+  }
+
+  // Old index of every new vertex and new index of every old one
+  std::vector<uint32_t> sourceVertexIndexList;
+  std::vector<uint32_t> remappedVertexIndexList(scene.vertexCount, -1);
+  for (uint64_t x = 0; x < scene.indexCount; x++) {
+    uint32_t vertexIndex = weldedVertexIndexList[getSceneIndex(
+        scene.indexData, scene.indexSize, x)];
+
+    if (remappedVertexIndexList[vertexIndex] == (uint32_t)-1) {
+      remappedVertexIndexList[vertexIndex] = sourceVertexIndexList.size();
+      sourceVertexIndexList.push_back(vertexIndex);
+    }
+  }
+
+  uint32_t indexSize = getSceneIndexSize(sourceVertexIndexList.size());
+  SceneCacheHeader header = getSceneCacheHeader(
+      sourceFileSize, sourceWriteTime, sourceVertexIndexList.size(),
+      indexSize, scene.primitiveCount, scene.materialCount);
+
+  char *cacheBuffer = (char *)createMappedFile(cacheFileName, header.fileSize);
+  if (cacheBuffer == NULL) {
+    std::cerr << "Scene cache: could not write " << cacheFileName
+              << std::endl;
+    return;
+  }
+
+  float *vertexData = (float *)(cacheBuffer + header.vertexOffset);
+  for (uint64_t x = 0; x < sourceVertexIndexList.size(); x++) {
+    memcpy(vertexData + x * 3,
+           scene.vertexData + (uint64_t)sourceVertexIndexList[x] * 3,
+           sizeof(float) * 3);
+  }
+
+  void *indexData = cacheBuffer + header.indexOffset;
+  for (uint64_t x = 0; x < scene.indexCount; x++) {
+    uint32_t vertexIndex = weldedVertexIndexList[getSceneIndex(
+        scene.indexData, scene.indexSize, x)];
+    setSceneIndex(indexData, indexSize, x,
+                  remappedVertexIndexList[vertexIndex]);
+  }
+
+  memcpy(cacheBuffer + header.materialIndexOffset, scene.materialIndexData,
+         sizeof(uint32_t) * scene.primitiveCount);
+  memcpy(cacheBuffer + header.materialOffset, scene.materialData,
+         sizeof(Material) * scene.materialCount);
+  memcpy(cacheBuffer, &header, sizeof(SceneCacheHeader));
+
+  unmapFile(cacheBuffer, header.fileSize);
+
+  double optimizeMilliseconds = std::chrono::duration<double, std::milli>(
+                                    std::chrono::steady_clock::now() -
+                                    startTimePoint)
+                                    .count();
+
+  std::cout << "Scene cache: " << scene.vertexCount << " vertices welded to "
+            << sourceVertexIndexList.size() << ", " << 8 * indexSize
+            << " bit indices, in " << optimizeMilliseconds << " ms"
+            << std::endl;
+}
+
+// Quantizes the positions relative to the scene bounds and reports how far
+// the decoded positions are from the float ones
+void quantizeSceneVertices(Scene &scene) {
+  float boundsMin[3] = {0.0f, 0.0f, 0.0f};
+  float boundsMax[3] = {0.0f, 0.0f, 0.0f};
+  for (uint64_t x = 0; x < scene.vertexCount; x++) {
+    for (uint32_t y = 0; y < 3; y++) {
+      float value = scene.vertexData[x * 3 + y];
+      boundsMin[y] = x == 0 ? value : std::min(boundsMin[y], value);
+      boundsMax[y] = x == 0 ? value : std::max(boundsMax[y], value);
+    }
+  }
+
+  // A flat axis keeps a scale of one, as every value on it encodes to zero
+  float center[3];
+  float extent[3];
+  float boundsSize = 0.0f;
+  for (uint32_t y = 0; y < 3; y++) {
+    center[y] = 0.5f * (boundsMin[y] + boundsMax[y]);
+    extent[y] = 0.5f * (boundsMax[y] - boundsMin[y]);
+    if (extent[y] == 0.0f) {
+      extent[y] = 1.0f;
+    }
+
+    boundsSize += (boundsMax[y] - boundsMin[y]) * (boundsMax[y] - boundsMin[y]);
+  }
+  boundsSize = std::sqrt(boundsSize);
+
+  uint32_t taskCount =
+      (scene.vertexCount + QUANTIZATION_TASK_VERTEX_COUNT - 1) /
+      QUANTIZATION_TASK_VERTEX_COUNT;
+  std::vector<double> taskErrorSumList(taskCount, 0.0);
+  std::vector<double> taskErrorMaxList(taskCount, 0.0);
+  std::vector<int16_t> quantizedVertexList(scene.vertexCount * 4);
+
+  runTasksInParallel(taskCount, [&](uint32_t taskIndex) {
+    uint64_t vertexBegin = (uint64_t)taskIndex * QUANTIZATION_TASK_VERTEX_COUNT;
+    uint64_t vertexEnd = std::min<uint64_t>(
+        vertexBegin + QUANTIZATION_TASK_VERTEX_COUNT, scene.vertexCount);
+
+    for (uint64_t x = vertexBegin; x < vertexEnd; x++) {
+      double errorSquared = 0.0;
+      for (uint32_t y = 0; y < 3; y++) {
+        float value = scene.vertexData[x * 3 + y];
+        float normalized =
+            std::clamp((value - center[y]) / extent[y], -1.0f, 1.0f);
+        int16_t quantized = (int16_t)std::lround(normalized * 32767.0f);
+
+        // As the device decodes it
+        float decoded = extent[y] * (quantized / 32767.0f) + center[y];
+        errorSquared += (decoded - value) * (decoded - value);
+
+        quantizedVertexList[x * 4 + y] = quantized;
+      }
+      quantizedVertexList[x * 4 + 3] = 0;
+
+      double error = std::sqrt(errorSquared);
+      taskErrorSumList[taskIndex] += error;
+      taskErrorMaxList[taskIndex] =
+          std::max(taskErrorMaxList[taskIndex], error);
+    }
+  });
+
+  double errorSum = 0.0;
+  double errorMax = 0.0;
+  for (uint32_t x = 0; x < taskCount; x++) {
+    errorSum += taskErrorSumList[x];
+    errorMax = std::max(errorMax, taskErrorMaxList[x]);
+  }
+
+  {
+    std::lock_guard<std::mutex> sceneLock(scene.mutex);
+
+    scene.quantizedVertexList = std::move(quantizedVertexList);
+    for (uint32_t y = 0; y < 3; y++) {
+      for (uint32_t x = 0; x < 4; x++) {
+        scene.quantizationTransform[y][x] =
+            x == y ? extent[y] : (x == 3 ? center[y] : 0.0f);
+      }
+    }
+    scene.isQuantized = true;
+  }
+  scene.conditionVariable.notify_all();
+
+  double errorMean = scene.vertexCount > 0 ? errorSum / scene.vertexCount : 0;
+  std::cout << "Vertex quantization: " << SCENE_VERTEX_STRIDE
+            << " bytes per vertex instead of " << sizeof(float) * 3
+            << ", error mean " << errorMean << " max " << errorMax << " ("
+            << (boundsSize > 0.0f ? 100.0 * errorMax / boundsSize : 0.0)
+            << "% of the scene size)" << std::endl;
+}
+
+// Loads the scene from <objFileName>.cache when the cache was generated from
+// an OBJ of the same size and write time. Otherwise parses the OBJ, renders
+// it as parsed and writes the optimized cache for the next run. Changes to the
+// MTL alone need the cache deleted.
+// Other threads can wait for parts of the scene while this runs, see
+// waitForSceneSize and waitForSceneRange.
+void loadScene(const std::string &objFileName, Scene &scene) {
+  std::string cacheFileName = objFileName + ".cache";
+
+  std::error_code errorCode;
+  uint64_t sourceFileSize = std::filesystem::file_size(objFileName, errorCode);
+  int64_t sourceWriteTime =
+      std::filesystem::last_write_time(objFileName, errorCode)
+          .time_since_epoch()
+          .count();
+
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  if (loadSceneCache(cacheFileName, sourceFileSize, sourceWriteTime, scene)) {
+    scene.rangeList = {{.vertexOffset = 0,
+                        .vertexCount = scene.vertexCount,
+                        .primitiveOffset = 0,
+                        .primitiveCount = scene.primitiveCount}};
+    scene.isRangeReadyList = {true};
+    scene.isSizeKnown = true;
+
+    sceneLock.unlock();
+    scene.conditionVariable.notify_all();
+
+    std::cout << "Scene: " << scene.primitiveCount << " triangles from "
+              << cacheFileName << std::endl;
+
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+    quantizeSceneVertices(scene);
+#endif
+    return;
+  }
+  sceneLock.unlock();
+
+  parseSceneOBJ(objFileName, cacheFileName + ".tmp", scene);
+
+  std::cout << "Scene: " << scene.primitiveCount << " triangles from "
+            << objFileName << std::endl;
+
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+  quantizeSceneVertices(scene);
+#endif
+
+  writeOptimizedSceneCache(cacheFileName, sourceFileSize, sourceWriteTime,
+                           scene);
+}
+
+// Called by the thread loading the scene when loadScene throws, so that the
+// threads waiting on the scene throw instead of blocking
+void failSceneLoad(Scene &scene) {
+  {
+    std::lock_guard<std::mutex> sceneLock(scene.mutex);
+    scene.isLoadFailed = true;
+  }
+  scene.conditionVariable.notify_all();
+}
+
+// Throws from a wait that was woken by failSceneLoad, with the scene locked
+void checkSceneLoad(const Scene &scene) {
+  if (scene.isLoadFailed) {
+    throw std::runtime_error("Scene: loading failed");
+  }
+}
+
+// Blocks until the scene's counts, materials and ranges are known
+void waitForSceneSize(Scene &scene) {
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  scene.conditionVariable.wait(
+      sceneLock, [&]() { return scene.isSizeKnown || scene.isLoadFailed; });
+  checkSceneLoad(scene);
+}
+
+// Blocks until the data of one range of the scene has been written
+void waitForSceneRange(Scene &scene, uint32_t rangeIndex) {
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  scene.conditionVariable.wait(sceneLock, [&]() {
+    return scene.isRangeReadyList[rangeIndex] || scene.isLoadFailed;
+  });
+  checkSceneLoad(scene);
+}
+
+// Blocks until the quantized positions have been written
+void waitForSceneQuantization(Scene &scene) {
+  std::unique_lock<std::mutex> sceneLock(scene.mutex);
+  scene.conditionVariable.wait(
+      sceneLock, [&]() { return scene.isQuantized || scene.isLoadFailed; });
+  checkSceneLoad(scene);
+}
+
+void unloadScene(Scene &scene) {
+  if (scene.mappedFileBuffer != NULL) {
+    unmapFile(scene.mappedFileBuffer, scene.mappedFileSize);
+    scene.mappedFileBuffer = NULL;
+  }
+
+  if (!scene.temporaryFileName.empty()) {
+    std::error_code errorCode;
+    std::filesystem::remove(scene.temporaryFileName, errorCode);
+    scene.temporaryFileName.clear();
+  }
+}
+
+std::string getPhysicalDeviceUUIDString(VkPhysicalDevice physicalDeviceHandle) {
+  VkPhysicalDeviceIDProperties physicalDeviceIDProperties = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+      .pNext = NULL};
+
+  VkPhysicalDeviceProperties2 physicalDeviceProperties2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &physicalDeviceIDProperties};
+
+  vkGetPhysicalDeviceProperties2(physicalDeviceHandle,
+                                 &physicalDeviceProperties2);
+
+  std::string uuidString;
+  for (uint32_t x = 0; x < VK_UUID_SIZE; x++) {
+    char hexString[3];
+    snprintf(hexString, sizeof(hexString), "%02x",
+             physicalDeviceIDProperties.deviceUUID[x]);
+    uuidString += hexString;
+  }
+
+  return uuidString;
+}
+
+// Returns -1 if the device is missing a required extension, feature or queue
+// family. Otherwise devices are ranked by type, then device local memory, then
+// acceleration structure properties.
+int64_t scorePhysicalDevice(
+    VkPhysicalDevice physicalDeviceHandle, VkSurfaceKHR surfaceHandle,
+    const std::vector<const char *> &deviceExtensionList) {
+
+  VkResult result;
+
+  uint32_t extensionPropertyCount = 0;
+  result = vkEnumerateDeviceExtensionProperties(
+      physicalDeviceHandle, NULL, &extensionPropertyCount, NULL);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEnumerateDeviceExtensionProperties");
+  }
+
+  std::vector<VkExtensionProperties> extensionPropertiesList(
+      extensionPropertyCount);
+  result = vkEnumerateDeviceExtensionProperties(
+      physicalDeviceHandle, NULL, &extensionPropertyCount,
+      extensionPropertiesList.data());
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkEnumerateDeviceExtensionProperties");
+  }
+
+  for (const char *extensionName : deviceExtensionList) {
+    bool isExtensionSupported = false;
+    for (VkExtensionProperties &extensionProperties : extensionPropertiesList) {
+      if (strcmp(extensionProperties.extensionName, extensionName) == 0) {
+        isExtensionSupported = true;
+        break;
+      }
+    }
+
+    if (!isExtensionSupported) {
+      return -1;
+    }
+  }
+
+  VkPhysicalDeviceBufferDeviceAddressFeatures
+      physicalDeviceBufferDeviceAddressFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES,
+          .pNext = NULL};
+
+  VkPhysicalDeviceAccelerationStructureFeaturesKHR
+      physicalDeviceAccelerationStructureFeatures = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+          .pNext = &physicalDeviceBufferDeviceAddressFeatures};
+
+  VkPhysicalDeviceRayQueryFeaturesKHR physicalDeviceRayQueryFeatures = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR,
+      .pNext = &physicalDeviceAccelerationStructureFeatures};
+
+  VkPhysicalDeviceFeatures2 physicalDeviceFeatures2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &physicalDeviceRayQueryFeatures};
+
+  vkGetPhysicalDeviceFeatures2(physicalDeviceHandle, &physicalDeviceFeatures2);
+
+  if (!physicalDeviceBufferDeviceAddressFeatures.bufferDeviceAddress ||
+      !physicalDeviceAccelerationStructureFeatures.accelerationStructure ||
+      !physicalDeviceRayQueryFeatures.rayQuery ||
+      !physicalDeviceFeatures2.features.geometryShader ||
+      !physicalDeviceFeatures2.features.fragmentStoresAndAtomics) {
+    return -1;
+  }
+
+  uint32_t queueFamilyPropertyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDeviceHandle,
+                                           &queueFamilyPropertyCount, NULL);
+
+  std::vector<VkQueueFamilyProperties> queueFamilyPropertiesList(
+      queueFamilyPropertyCount);
+
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDeviceHandle,
+                                           &queueFamilyPropertyCount,
+                                           queueFamilyPropertiesList.data());
+
+  bool isQueueFamilyFound = false;
+  for (uint32_t x = 0; x < queueFamilyPropertiesList.size(); x++) {
+    if (queueFamilyPropertiesList[x].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+
+      VkBool32 isPresentSupported = false;
+      result = vkGetPhysicalDeviceSurfaceSupportKHR(
+          physicalDeviceHandle, x, surfaceHandle, &isPresentSupported);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkGetPhysicalDeviceSurfaceSupportKHR");
+      }
+
+      if (isPresentSupported) {
+        isQueueFamilyFound = true;
+        break;
+      }
+    }
+  }
+
+  if (!isQueueFamilyFound) {
+    return -1;
+  }
+
+  VkPhysicalDeviceAccelerationStructurePropertiesKHR
+      physicalDeviceAccelerationStructureProperties = {
+          .sType =
+              VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR,
+          .pNext = NULL};
+
+  VkPhysicalDeviceProperties2 physicalDeviceProperties2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &physicalDeviceAccelerationStructureProperties};
+
+  vkGetPhysicalDeviceProperties2(physicalDeviceHandle,
+                                 &physicalDeviceProperties2);
+
+  VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDeviceHandle,
+                                      &physicalDeviceMemoryProperties);
 
-  if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
-    message = STRING_ERROR + message + STRING_RESET;
-    std::cerr << message.c_str() << std::endl;
+  int64_t deviceTypeScore = 0;
+  switch (physicalDeviceProperties2.properties.deviceType) {
+  case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+    deviceTypeScore = 4;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+    deviceTypeScore = 3;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+    deviceTypeScore = 2;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_CPU:
+    deviceTypeScore = 1;
+    break;
+  default:
+    break;
   }
 
-  return VK_FALSE;
-}
-#endif
-
-void throwExceptionVulkanAPI(VkResult result, const std::string &functionName) {
-  std::string message = "Vulkan API exception: return code " +
-                        std::to_string(result) + " (" + functionName + ")";
+  VkDeviceSize deviceLocalHeapSize = 0;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryHeapCount;
+       x++) {
+    if (physicalDeviceMemoryProperties.memoryHeaps[x].flags &
+        VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      deviceLocalHeapSize = std::max(
+          deviceLocalHeapSize, physicalDeviceMemoryProperties.memoryHeaps[x].size);
+    }
+  }
 
-  std::cerr << message.c_str() << std::endl;
+  int64_t deviceLocalHeapScore =
+      std::min<int64_t>(deviceLocalHeapSize / (1024 * 1024), 0xFFFFFFFF);
+  int64_t primitiveCountScore = std::min<int64_t>(
+      physicalDeviceAccelerationStructureProperties.maxPrimitiveCount >> 24,
+      0xFFFF);
 
-  throw std::runtime_error(message);
+  return (deviceTypeScore << 48) | (deviceLocalHeapScore << 16) |
+         primitiveCountScore;
 }
 
 bool exitWindow = false;
 static bool isMoveForward = false, isMoveBack = false;
 static bool isTurnLeft = false, isTurnRight = false;
+static bool isWindowResized = false;
+static bool isMemoryReportRequested = false;
 
 #if defined(PLATFORM_WINDOWS)
 LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
@@ -79,6 +1770,9 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     case VK_RIGHT:
       isTurnRight = true;
       break;
+    case 'M':
+      isMemoryReportRequested = true;
+      break;
     case VK_ESCAPE:
       exitWindow = true;
       break;
@@ -103,6 +1797,8 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     default:
       break;
     }
+  } else if (uMsg == WM_SIZE) {
+    isWindowResized = true;
   } else if (uMsg == WM_CLOSE) {
     exitWindow = true;
   }
@@ -133,6 +1829,9 @@ void handleEvent(Display *displayPtr, XEvent *eventPtr) {
     case XK_Right:
       isTurnRight = true;
       break;
+    case XK_m:
+      isMemoryReportRequested = true;
+      break;
     case XK_Escape:
       exitWindow = true;
       break;
@@ -166,15 +1865,23 @@ void handleEvent(Display *displayPtr, XEvent *eventPtr) {
 
     free(keySym);
   }
+  else if (eventPtr->type == ConfigureNotify) {
+    isWindowResized = true;
+  }
 }
 
 int main() {
 #endif
   VkResult result;
 
+  TraceSection mainTraceSection = {.trackIndex = addTraceTrack("Main thread")};
+  uint32_t graphicsQueueTraceTrackIndex = addTraceTrack("Graphics queue");
+
   // =========================================================================
   // Window
 
+  beginTraceSection(mainTraceSection, "Window");
+
 #if defined(PLATFORM_LINUX)
   Display *displayPtr = XOpenDisplay(NULL);
   int screen = DefaultScreen(displayPtr);
@@ -184,7 +1891,7 @@ int main() {
       BlackPixel(displayPtr, screen), WhitePixel(displayPtr, screen));
 
   XSelectInput(displayPtr, windowLinux, ExposureMask | KeyPressMask |
-                                        KeyReleaseMask);
+                                        KeyReleaseMask | StructureNotifyMask);
   XMapWindow(displayPtr, windowLinux);
 #elif defined(PLATFORM_WINDOWS)
   WNDCLASS wc = {
@@ -219,6 +1926,8 @@ int main() {
   // =========================================================================
   // Vulkan Instance
 
+  beginTraceSection(mainTraceSection, "Vulkan Instance");
+
   VkDebugUtilsMessengerCreateInfoEXT *debugUtilsMessengerCreateInfoPtr = NULL;
 
 #if defined(VALIDATION_ENABLED)
@@ -309,6 +2018,8 @@ int main() {
   // =========================================================================
   // Window Surface
 
+  beginTraceSection(mainTraceSection, "Window Surface");
+
   VkSurfaceKHR surfaceHandle = VK_NULL_HANDLE;
 
 #if defined(PLATFORM_LINUX)
@@ -346,6 +2057,8 @@ int main() {
   // =========================================================================
   // Physical Device
 
+  beginTraceSection(mainTraceSection, "Physical Device");
+
   uint32_t physicalDeviceCount = 0;
   result =
       vkEnumeratePhysicalDevices(instanceHandle, &physicalDeviceCount, NULL);
@@ -362,7 +2075,100 @@ int main() {
     throwExceptionVulkanAPI(result, "vkEnumeratePhysicalDevices");
   }
 
-  VkPhysicalDevice activePhysicalDeviceHandle = physicalDeviceHandleList[0];
+  std::vector<const char *> deviceExtensionList = {
+      "VK_KHR_ray_query",
+      "VK_KHR_spirv_1_4",
+      "VK_KHR_shader_float_controls",
+      "VK_KHR_acceleration_structure",
+      "VK_EXT_descriptor_indexing",
+      "VK_KHR_maintenance3",
+      "VK_KHR_buffer_device_address",
+      "VK_KHR_deferred_host_operations",
+      "VK_KHR_swapchain"};
+
+  // PHYSICAL_DEVICE_INDEX or PHYSICAL_DEVICE_UUID select a device explicitly,
+  // otherwise the highest scoring capable device is used
+  const char *physicalDeviceIndexString = std::getenv("PHYSICAL_DEVICE_INDEX");
+  std::string physicalDeviceUUIDString =
+      std::getenv("PHYSICAL_DEVICE_UUID") != NULL
+          ? std::getenv("PHYSICAL_DEVICE_UUID")
+          : "";
+
+  physicalDeviceUUIDString.erase(std::remove(physicalDeviceUUIDString.begin(),
+                                             physicalDeviceUUIDString.end(),
+                                             '-'),
+                                 physicalDeviceUUIDString.end());
+  std::transform(physicalDeviceUUIDString.begin(),
+                 physicalDeviceUUIDString.end(),
+                 physicalDeviceUUIDString.begin(), ::tolower);
+
+  bool isPhysicalDeviceOverride =
+      physicalDeviceIndexString != NULL || !physicalDeviceUUIDString.empty();
+
+  // The whole index must parse and name an enumerated device
+  uint32_t physicalDeviceIndex = -1;
+  if (physicalDeviceIndexString != NULL) {
+    const char *physicalDeviceIndexStringEnd =
+        physicalDeviceIndexString + strlen(physicalDeviceIndexString);
+
+    std::from_chars_result fromCharsResult =
+        std::from_chars(physicalDeviceIndexString,
+                        physicalDeviceIndexStringEnd, physicalDeviceIndex);
+
+    if (fromCharsResult.ec != std::errc() ||
+        fromCharsResult.ptr != physicalDeviceIndexStringEnd ||
+        physicalDeviceIndex >= physicalDeviceHandleList.size()) {
+      throw std::runtime_error(
+          "PHYSICAL_DEVICE_INDEX " + std::string(physicalDeviceIndexString) +
+          " out of range (" + std::to_string(physicalDeviceHandleList.size()) +
+          " devices)");
+    }
+  }
+
+  VkPhysicalDevice activePhysicalDeviceHandle = VK_NULL_HANDLE;
+  int64_t activePhysicalDeviceScore = -1;
+
+  for (uint32_t x = 0; x < physicalDeviceHandleList.size(); x++) {
+    VkPhysicalDeviceProperties candidatePhysicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDeviceHandleList[x],
+                                  &candidatePhysicalDeviceProperties);
+
+    std::string uuidString =
+        getPhysicalDeviceUUIDString(physicalDeviceHandleList[x]);
+    int64_t score =
+        scorePhysicalDevice(physicalDeviceHandleList[x], surfaceHandle,
+                            deviceExtensionList);
+
+    std::cout << "[" << x << "] "
+              << candidatePhysicalDeviceProperties.deviceName << " ("
+              << uuidString << ") score " << score << std::endl;
+
+    if (isPhysicalDeviceOverride) {
+      bool isMatch = physicalDeviceIndexString != NULL
+                         ? physicalDeviceIndex == x
+                         : physicalDeviceUUIDString == uuidString;
+
+      if (isMatch && score < 0) {
+        std::cerr << candidatePhysicalDeviceProperties.deviceName
+                  << " is missing a required extension, feature or queue"
+                  << std::endl;
+        throwExceptionVulkanAPI(VK_ERROR_FEATURE_NOT_PRESENT,
+                                "scorePhysicalDevice");
+      }
+
+      if (isMatch) {
+        activePhysicalDeviceHandle = physicalDeviceHandleList[x];
+      }
+    } else if (score > activePhysicalDeviceScore) {
+      activePhysicalDeviceHandle = physicalDeviceHandleList[x];
+      activePhysicalDeviceScore = score;
+    }
+  }
+
+  if (activePhysicalDeviceHandle == VK_NULL_HANDLE) {
+    throwExceptionVulkanAPI(VK_ERROR_INCOMPATIBLE_DRIVER,
+                            "vkEnumeratePhysicalDevices");
+  }
 
   VkPhysicalDeviceProperties physicalDeviceProperties;
   vkGetPhysicalDeviceProperties(activePhysicalDeviceHandle,
@@ -377,6 +2183,8 @@ int main() {
   // =========================================================================
   // Physical Device Features
 
+  beginTraceSection(mainTraceSection, "Physical Device Features");
+
   VkPhysicalDeviceBufferDeviceAddressFeatures
       physicalDeviceBufferDeviceAddressFeatures = {
           .sType =
@@ -406,9 +2214,19 @@ int main() {
       .geometryShader = VK_TRUE,
       .fragmentStoresAndAtomics = VK_TRUE};
 
+  // VK_EXT_memory_budget is optional, it reports the heap budgets the memory
+  // ledger is checked against
+  MemoryLedger memoryLedger = {
+      .physicalDeviceHandle = activePhysicalDeviceHandle,
+      .isMemoryBudgetSupported = isDeviceExtensionSupported(
+          activePhysicalDeviceHandle, "VK_EXT_memory_budget")};
+
   // =========================================================================
   // Physical Device Submission Queue Families
 
+  beginTraceSection(mainTraceSection,
+                    "Physical Device Submission Queue Families");
+
   uint32_t queueFamilyPropertyCount = 0;
   vkGetPhysicalDeviceQueueFamilyProperties(activePhysicalDeviceHandle,
                                            &queueFamilyPropertyCount, NULL);
@@ -451,16 +2269,11 @@ int main() {
   // =========================================================================
   // Logical Device
 
-  std::vector<const char *> deviceExtensionList = {
-      "VK_KHR_ray_query",
-      "VK_KHR_spirv_1_4",
-      "VK_KHR_shader_float_controls",
-      "VK_KHR_acceleration_structure",
-      "VK_EXT_descriptor_indexing",
-      "VK_KHR_maintenance3",
-      "VK_KHR_buffer_device_address",
-      "VK_KHR_deferred_host_operations",
-      "VK_KHR_swapchain"};
+  beginTraceSection(mainTraceSection, "Logical Device");
+
+  if (memoryLedger.isMemoryBudgetSupported) {
+    deviceExtensionList.push_back("VK_EXT_memory_budget");
+  }
 
   VkDeviceCreateInfo deviceCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
@@ -485,12 +2298,16 @@ int main() {
   // =========================================================================
   // Submission Queue
 
+  beginTraceSection(mainTraceSection, "Submission Queue");
+
   VkQueue queueHandle = VK_NULL_HANDLE;
   vkGetDeviceQueue(deviceHandle, queueFamilyIndex, 0, &queueHandle);
 
   // =========================================================================
   // Device Pointer Functions
 
+  beginTraceSection(mainTraceSection, "Device Pointer Functions");
+
   PFN_vkGetBufferDeviceAddressKHR pvkGetBufferDeviceAddressKHR =
       (PFN_vkGetBufferDeviceAddressKHR)vkGetDeviceProcAddr(
           deviceHandle, "vkGetBufferDeviceAddressKHR");
@@ -526,6 +2343,8 @@ int main() {
   // =========================================================================
   // Command Pool
 
+  beginTraceSection(mainTraceSection, "Command Pool");
+
   VkCommandPoolCreateInfo commandPoolCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
       .pNext = NULL,
@@ -543,15 +2362,18 @@ int main() {
   // =========================================================================
   // Command Buffers
 
+  beginTraceSection(mainTraceSection, "Command Buffers");
+
   VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
       .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
       .pNext = NULL,
       .commandPool = commandPoolHandle,
       .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-      .commandBufferCount = 16};
+      .commandBufferCount = FRAMES_IN_FLIGHT + 1};
 
+  // One per frame in flight, the last is used for one time setup commands
   std::vector<VkCommandBuffer> commandBufferHandleList =
-      std::vector<VkCommandBuffer>(16, VK_NULL_HANDLE);
+      std::vector<VkCommandBuffer>(FRAMES_IN_FLIGHT + 1, VK_NULL_HANDLE);
 
   result = vkAllocateCommandBuffers(deviceHandle, &commandBufferAllocateInfo,
                                     commandBufferHandleList.data());
@@ -560,9 +2382,77 @@ int main() {
     throwExceptionVulkanAPI(result, "vkAllocateCommandBuffers");
   }
 
+  // =========================================================================
+  // Timestamp Query Pools
+
+  beginTraceSection(mainTraceSection, "Timestamp Query Pools");
+
+  // Frames write three timestamps: before the render pass, after it and after
+  // the ray trace image copy. The startup bottom and top level builds are
+  // bracketed with two each. Results are only read once the work is known to
+  // be complete.
+  bool isTimestampSupported =
+      queueFamilyPropertiesList[queueFamilyIndex].timestampValidBits > 0;
+
+  VkQueryPoolCreateInfo timestampQueryPoolCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = FRAMES_IN_FLIGHT * 3,
+      .pipelineStatistics = 0};
+
+  VkQueryPool timestampQueryPoolHandle = VK_NULL_HANDLE;
+  result = vkCreateQueryPool(deviceHandle, &timestampQueryPoolCreateInfo, NULL,
+                             &timestampQueryPoolHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateQueryPool");
+  }
+
+  VkQueryPoolCreateInfo accelerationStructureTimestampQueryPoolCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = 4,
+      .pipelineStatistics = 0};
+
+  VkQueryPool accelerationStructureTimestampQueryPoolHandle = VK_NULL_HANDLE;
+  result = vkCreateQueryPool(
+      deviceHandle, &accelerationStructureTimestampQueryPoolCreateInfo, NULL,
+      &accelerationStructureTimestampQueryPoolHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateQueryPool");
+  }
+
+  std::vector<bool> isTimestampWrittenList(FRAMES_IN_FLIGHT, false);
+
+  TimestampStatistics renderPassTimestampStatistics;
+  TimestampStatistics copyTimestampStatistics;
+
+  // Milliseconds between two consecutive timestamps of a pool
+  auto getTimestampMilliseconds = [&](VkQueryPool queryPoolHandle,
+                                      uint32_t firstQuery) {
+    uint64_t timestampList[2];
+    result = vkGetQueryPoolResults(deviceHandle, queryPoolHandle, firstQuery,
+                                   2, sizeof(timestampList), timestampList,
+                                   sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkGetQueryPoolResults");
+    }
+
+    return (timestampList[1] - timestampList[0]) *
+           (double)physicalDeviceProperties.limits.timestampPeriod / 1000000.0;
+  };
+
   // =========================================================================
   // Surface Features
 
+  beginTraceSection(mainTraceSection, "Surface Features");
+
   VkSurfaceCapabilitiesKHR surfaceCapabilities;
   result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
       activePhysicalDeviceHandle, surfaceHandle, &surfaceCapabilities);
@@ -608,44 +2498,50 @@ int main() {
                             "vkGetPhysicalDeviceSurfacePresentModesKHR");
   }
 
-  // =========================================================================
-  // Swapchain
-
-  VkSwapchainCreateInfoKHR swapchainCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-      .pNext = NULL,
-      .flags = 0,
-      .surface = surfaceHandle,
-      .minImageCount = surfaceCapabilities.minImageCount + 1,
-      .imageFormat = surfaceFormatList[0].format,
-      .imageColorSpace = surfaceFormatList[0].colorSpace,
-      .imageExtent = surfaceCapabilities.currentExtent,
-      .imageArrayLayers = 1,
-      .imageUsage =
-          VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-      .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
-      .queueFamilyIndexCount = 1,
-      .pQueueFamilyIndices = &queueFamilyIndex,
-      .preTransform = surfaceCapabilities.currentTransform,
-      .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-      .presentMode = presentModeList[0],
-      .clipped = VK_TRUE,
-      .oldSwapchain = VK_NULL_HANDLE};
+  // Prefer an 8-bit UNORM format, the ray trace image is created with the
+  // swapchain format and written as a storage image
+  VkSurfaceFormatKHR surfaceFormat = surfaceFormatList[0];
+  for (VkSurfaceFormatKHR &surfaceFormatCandidate : surfaceFormatList) {
+    if (surfaceFormatCandidate.format == VK_FORMAT_B8G8R8A8_UNORM ||
+        surfaceFormatCandidate.format == VK_FORMAT_R8G8B8A8_UNORM) {
+      surfaceFormat = surfaceFormatCandidate;
+      break;
+    }
+  }
 
-  VkSwapchainKHR swapchainHandle = VK_NULL_HANDLE;
-  result = vkCreateSwapchainKHR(deviceHandle, &swapchainCreateInfo, NULL,
-                                &swapchainHandle);
+  // PRESENT_MODE selects MAILBOX for low latency, IMMEDIATE for benchmarking
+  // without vsync or FIFO_RELAXED. FIFO is the default since it is always
+  // supported and idles the device between vertical blanks.
+  VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+  if (std::getenv("PRESENT_MODE") != NULL) {
+    std::string presentModeString = std::getenv("PRESENT_MODE");
+
+    VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    if (presentModeString == "MAILBOX") {
+      requestedPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+    } else if (presentModeString == "IMMEDIATE") {
+      requestedPresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+    } else if (presentModeString == "FIFO_RELAXED") {
+      requestedPresentMode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+    }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateSwapchainKHR");
+    if (std::find(presentModeList.begin(), presentModeList.end(),
+                  requestedPresentMode) != presentModeList.end()) {
+      presentMode = requestedPresentMode;
+    } else {
+      std::cerr << "PRESENT_MODE " << presentModeString
+                << " is not supported, using FIFO" << std::endl;
+    }
   }
 
   // =========================================================================
   // Render Pass
 
+  beginTraceSection(mainTraceSection, "Render Pass");
+
   std::vector<VkAttachmentDescription> attachmentDescriptionList = {
       {.flags = 0,
-       .format = surfaceFormatList[0].format,
+       .format = surfaceFormat.format,
        .samples = VK_SAMPLE_COUNT_1_BIT,
        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
@@ -700,181 +2596,229 @@ int main() {
   }
 
   // =========================================================================
-  // Swapchain Images
-
-  uint32_t swapchainImageCount = 0;
-  result = vkGetSwapchainImagesKHR(deviceHandle, swapchainHandle,
-                                   &swapchainImageCount, NULL);
-
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkGetSwapchainImagesKHR");
-  }
-
-  std::vector<VkImage> swapchainImageHandleList(swapchainImageCount);
-  result = vkGetSwapchainImagesKHR(deviceHandle, swapchainHandle,
-                                   &swapchainImageCount,
-                                   swapchainImageHandleList.data());
-
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkGetSwapchainImagesKHR");
-  }
-
-  // =========================================================================
-  // Swapchain Image Views, Depth Images, Framebuffers
-
-  std::vector<VkImageView> swapchainImageViewHandleList(swapchainImageCount,
-                                                        VK_NULL_HANDLE);
-
-  std::vector<VkImage> depthImageHandleList(swapchainImageCount,
-                                            VK_NULL_HANDLE);
+  // Swapchain, Swapchain Images, Image Views, Depth Images, Framebuffers
 
-  std::vector<VkDeviceMemory> depthImageDeviceMemoryHandleList(
-      swapchainImageCount, VK_NULL_HANDLE);
+  beginTraceSection(mainTraceSection, "Swapchain, Swapchain Images, Image "
+                                      "Views, Depth Images, Framebuffers");
 
-  std::vector<VkImageView> depthImageViewHandleList(swapchainImageCount,
-                                                    VK_NULL_HANDLE);
-
-  std::vector<VkFramebuffer> framebufferHandleList(swapchainImageCount,
-                                                   VK_NULL_HANDLE);
-
-  for (uint32_t x = 0; x < swapchainImageCount; x++) {
-    VkImageViewCreateInfo imageViewCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+  VkSwapchainKHR swapchainHandle = VK_NULL_HANDLE;
+  VkExtent2D swapchainExtent = surfaceCapabilities.currentExtent;
+  uint32_t swapchainImageCount = 0;
+  std::vector<VkImage> swapchainImageHandleList;
+  std::vector<VkImageView> swapchainImageViewHandleList;
+  std::vector<VkImage> depthImageHandleList;
+  std::vector<VkDeviceMemory> depthImageDeviceMemoryHandleList;
+  std::vector<VkImageView> depthImageViewHandleList;
+  std::vector<VkFramebuffer> framebufferHandleList;
+
+  // Creates everything sized to the surface at its current extent. Called
+  // again from the main loop when the window is resized or presentation
+  // reports the swapchain out of date, the previous swapchain is retired
+  // through oldSwapchainHandle.
+  auto createSwapchain = [&](VkSwapchainKHR oldSwapchainHandle) {
+    swapchainExtent = surfaceCapabilities.currentExtent;
+
+    VkSwapchainCreateInfoKHR swapchainCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
         .pNext = NULL,
         .flags = 0,
-        .image = swapchainImageHandleList[x],
-        .viewType = VK_IMAGE_VIEW_TYPE_2D,
-        .format = surfaceFormatList[0].format,
-        .components = {VK_COMPONENT_SWIZZLE_IDENTITY,
-                       VK_COMPONENT_SWIZZLE_IDENTITY,
-                       VK_COMPONENT_SWIZZLE_IDENTITY,
-                       VK_COMPONENT_SWIZZLE_IDENTITY},
-        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}};
+        .surface = surfaceHandle,
+        .minImageCount = surfaceCapabilities.minImageCount + 1,
+        .imageFormat = surfaceFormat.format,
+        .imageColorSpace = surfaceFormat.colorSpace,
+        .imageExtent = swapchainExtent,
+        .imageArrayLayers = 1,
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                      VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices = &queueFamilyIndex,
+        .preTransform = surfaceCapabilities.currentTransform,
+        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+        .presentMode = presentMode,
+        .clipped = VK_TRUE,
+        .oldSwapchain = oldSwapchainHandle};
 
-    result = vkCreateImageView(deviceHandle, &imageViewCreateInfo, NULL,
-                               &swapchainImageViewHandleList[x]);
+    result = vkCreateSwapchainKHR(deviceHandle, &swapchainCreateInfo, NULL,
+                                  &swapchainHandle);
 
     if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkCreateImageView");
+      throwExceptionVulkanAPI(result, "vkCreateSwapchainKHR");
     }
 
-    VkImageCreateInfo depthImageCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0,
-        .imageType = VK_IMAGE_TYPE_2D,
-        .format = VK_FORMAT_D32_SFLOAT,
-        .extent = {.width = surfaceCapabilities.currentExtent.width,
-                   .height = surfaceCapabilities.currentExtent.height,
-                   .depth = 1},
-        .mipLevels = 1,
-        .arrayLayers = 1,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .tiling = VK_IMAGE_TILING_OPTIMAL,
-        .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-        .queueFamilyIndexCount = 1,
-        .pQueueFamilyIndices = &queueFamilyIndex,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
+    result = vkGetSwapchainImagesKHR(deviceHandle, swapchainHandle,
+                                     &swapchainImageCount, NULL);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkGetSwapchainImagesKHR");
+    }
 
-    result = vkCreateImage(deviceHandle, &depthImageCreateInfo, NULL,
-                           &depthImageHandleList[x]);
+    swapchainImageHandleList.assign(swapchainImageCount, VK_NULL_HANDLE);
+    result = vkGetSwapchainImagesKHR(deviceHandle, swapchainHandle,
+                                     &swapchainImageCount,
+                                     swapchainImageHandleList.data());
 
     if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkCreateImage");
+      throwExceptionVulkanAPI(result, "vkGetSwapchainImagesKHR");
     }
 
-    VkMemoryRequirements depthImageMemoryRequirements;
-    vkGetImageMemoryRequirements(deviceHandle, depthImageHandleList[x],
-                                 &depthImageMemoryRequirements);
+    swapchainImageViewHandleList.assign(swapchainImageCount, VK_NULL_HANDLE);
+    depthImageHandleList.assign(swapchainImageCount, VK_NULL_HANDLE);
+    depthImageDeviceMemoryHandleList.assign(swapchainImageCount,
+                                            VK_NULL_HANDLE);
+    depthImageViewHandleList.assign(swapchainImageCount, VK_NULL_HANDLE);
+    framebufferHandleList.assign(swapchainImageCount, VK_NULL_HANDLE);
 
-    uint32_t depthImageMemoryTypeIndex = -1;
-    for (uint32_t y = 0; y < physicalDeviceMemoryProperties.memoryTypeCount;
-         y++) {
-      if ((depthImageMemoryRequirements.memoryTypeBits & (1 << y)) &&
-          (physicalDeviceMemoryProperties.memoryTypes[y].propertyFlags &
-           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
-              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+    for (uint32_t x = 0; x < swapchainImageCount; x++) {
+      VkImageViewCreateInfo imageViewCreateInfo = {
+          .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+          .pNext = NULL,
+          .flags = 0,
+          .image = swapchainImageHandleList[x],
+          .viewType = VK_IMAGE_VIEW_TYPE_2D,
+          .format = surfaceFormat.format,
+          .components = {VK_COMPONENT_SWIZZLE_IDENTITY,
+                         VK_COMPONENT_SWIZZLE_IDENTITY,
+                         VK_COMPONENT_SWIZZLE_IDENTITY,
+                         VK_COMPONENT_SWIZZLE_IDENTITY},
+          .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}};
+
+      result = vkCreateImageView(deviceHandle, &imageViewCreateInfo, NULL,
+                                 &swapchainImageViewHandleList[x]);
 
-        depthImageMemoryTypeIndex = y;
-        break;
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkCreateImageView");
       }
-    }
 
-    VkMemoryAllocateInfo depthImageMemoryAllocateInfo = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .pNext = NULL,
-        .allocationSize = depthImageMemoryRequirements.size,
-        .memoryTypeIndex = depthImageMemoryTypeIndex};
+      VkImageCreateInfo depthImageCreateInfo = {
+          .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+          .pNext = NULL,
+          .flags = 0,
+          .imageType = VK_IMAGE_TYPE_2D,
+          .format = VK_FORMAT_D32_SFLOAT,
+          .extent = {.width = swapchainExtent.width,
+                     .height = swapchainExtent.height,
+                     .depth = 1},
+          .mipLevels = 1,
+          .arrayLayers = 1,
+          .samples = VK_SAMPLE_COUNT_1_BIT,
+          .tiling = VK_IMAGE_TILING_OPTIMAL,
+          .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+          .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+          .queueFamilyIndexCount = 1,
+          .pQueueFamilyIndices = &queueFamilyIndex,
+          .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
+
+      result = vkCreateImage(deviceHandle, &depthImageCreateInfo, NULL,
+                             &depthImageHandleList[x]);
 
-    result = vkAllocateMemory(deviceHandle, &depthImageMemoryAllocateInfo, NULL,
-                              &depthImageDeviceMemoryHandleList[x]);
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkAllocateMemory");
-    }
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkCreateImage");
+      }
 
-    result = vkBindImageMemory(deviceHandle, depthImageHandleList[x],
-                               depthImageDeviceMemoryHandleList[x], 0);
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkBindImageMemory");
-    }
+      VkMemoryRequirements depthImageMemoryRequirements;
+      vkGetImageMemoryRequirements(deviceHandle, depthImageHandleList[x],
+                                   &depthImageMemoryRequirements);
+
+      uint32_t depthImageMemoryTypeIndex = -1;
+      for (uint32_t y = 0; y < physicalDeviceMemoryProperties.memoryTypeCount;
+           y++) {
+        if ((depthImageMemoryRequirements.memoryTypeBits & (1 << y)) &&
+            (physicalDeviceMemoryProperties.memoryTypes[y].propertyFlags &
+             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+
+          depthImageMemoryTypeIndex = y;
+          break;
+        }
+      }
 
-    VkImageViewCreateInfo depthImageViewCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0,
-        .image = depthImageHandleList[x],
-        .viewType = VK_IMAGE_VIEW_TYPE_2D,
-        .format = VK_FORMAT_D32_SFLOAT,
-        .components = {.r = VK_COMPONENT_SWIZZLE_IDENTITY,
-                       .g = VK_COMPONENT_SWIZZLE_IDENTITY,
-                       .b = VK_COMPONENT_SWIZZLE_IDENTITY,
-                       .a = VK_COMPONENT_SWIZZLE_IDENTITY},
-        .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
-                             .baseMipLevel = 0,
-                             .levelCount = 1,
-                             .baseArrayLayer = 0,
-                             .layerCount = 1}};
+      VkMemoryAllocateInfo depthImageMemoryAllocateInfo = {
+          .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+          .pNext = NULL,
+          .allocationSize = depthImageMemoryRequirements.size,
+          .memoryTypeIndex = depthImageMemoryTypeIndex};
 
-    result = vkCreateImageView(deviceHandle, &depthImageViewCreateInfo, NULL,
-                               &depthImageViewHandleList[x]);
+      result = allocateDeviceMemory(deviceHandle, memoryLedger, "Image",
+                                    &depthImageMemoryAllocateInfo,
+                                    &depthImageDeviceMemoryHandleList[x]);
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkAllocateMemory");
+      }
 
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkCreateImageView");
-    }
+      result = vkBindImageMemory(deviceHandle, depthImageHandleList[x],
+                                 depthImageDeviceMemoryHandleList[x], 0);
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkBindImageMemory");
+      }
 
-    std::vector<VkImageView> imageViewHandleList = {
-        swapchainImageViewHandleList[x], depthImageViewHandleList[x]};
+      VkImageViewCreateInfo depthImageViewCreateInfo = {
+          .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+          .pNext = NULL,
+          .flags = 0,
+          .image = depthImageHandleList[x],
+          .viewType = VK_IMAGE_VIEW_TYPE_2D,
+          .format = VK_FORMAT_D32_SFLOAT,
+          .components = {.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                         .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                         .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                         .a = VK_COMPONENT_SWIZZLE_IDENTITY},
+          .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+                               .baseMipLevel = 0,
+                               .levelCount = 1,
+                               .baseArrayLayer = 0,
+                               .layerCount = 1}};
+
+      result = vkCreateImageView(deviceHandle, &depthImageViewCreateInfo, NULL,
+                                 &depthImageViewHandleList[x]);
 
-    VkFramebufferCreateInfo framebufferCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0,
-        .renderPass = renderPassHandle,
-        .attachmentCount = 2,
-        .pAttachments = imageViewHandleList.data(),
-        .width = surfaceCapabilities.currentExtent.width,
-        .height = surfaceCapabilities.currentExtent.height,
-        .layers = 1};
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkCreateImageView");
+      }
 
-    result = vkCreateFramebuffer(deviceHandle, &framebufferCreateInfo, NULL,
-                                 &framebufferHandleList[x]);
+      std::vector<VkImageView> imageViewHandleList = {
+          swapchainImageViewHandleList[x], depthImageViewHandleList[x]};
 
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkCreateFramebuffer");
+      VkFramebufferCreateInfo framebufferCreateInfo = {
+          .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+          .pNext = NULL,
+          .flags = 0,
+          .renderPass = renderPassHandle,
+          .attachmentCount = 2,
+          .pAttachments = imageViewHandleList.data(),
+          .width = swapchainExtent.width,
+          .height = swapchainExtent.height,
+          .layers = 1};
+
+      result = vkCreateFramebuffer(deviceHandle, &framebufferCreateInfo, NULL,
+                                   &framebufferHandleList[x]);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkCreateFramebuffer");
+      }
     }
-  }
+  };
+
+  createSwapchain(VK_NULL_HANDLE);
 
   // =========================================================================
   // Descriptor Pool
 
+  beginTraceSection(mainTraceSection, "Descriptor Pool");
+
   std::vector<VkDescriptorPoolSize> descriptorPoolSizeList = {
       {.type = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
        .descriptorCount = 1},
-      {.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, .descriptorCount = 1},
+      {.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, .descriptorCount = 1},
       {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = 4},
       {.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, .descriptorCount = 1}};
 
+#if defined(RAY_COUNTERS_ENABLED)
+  descriptorPoolSizeList.push_back(
+      {.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+       .descriptorCount = 1});
+#endif
+
   VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
       .pNext = NULL,
@@ -894,6 +2838,8 @@ int main() {
   // =========================================================================
   // Descriptor Set Layout
 
+  beginTraceSection(mainTraceSection, "Descriptor Set Layout");
+
   std::vector<VkDescriptorSetLayoutBinding> descriptorSetLayoutBindingList = {
       {.binding = 0,
        .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
@@ -901,7 +2847,7 @@ int main() {
        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
        .pImmutableSamplers = NULL},
       {.binding = 1,
-       .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+       .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
        .descriptorCount = 1,
        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
        .pImmutableSamplers = NULL},
@@ -913,7 +2859,7 @@ int main() {
       {.binding = 3,
        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
        .descriptorCount = 1,
-       .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+       .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
        .pImmutableSamplers = NULL},
       {.binding = 4,
        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
@@ -921,6 +2867,15 @@ int main() {
        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
        .pImmutableSamplers = NULL}};
 
+#if defined(RAY_COUNTERS_ENABLED)
+  descriptorSetLayoutBindingList.push_back(
+      {.binding = 5,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+       .descriptorCount = 1,
+       .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+       .pImmutableSamplers = NULL});
+#endif
+
   VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
       .pNext = NULL,
@@ -940,6 +2895,8 @@ int main() {
   // =========================================================================
   // Material Descriptor Set Layout
 
+  beginTraceSection(mainTraceSection, "Material Descriptor Set Layout");
+
   std::vector<VkDescriptorSetLayoutBinding>
       materialDescriptorSetLayoutBindingList = {
           {.binding = 0,
@@ -974,6 +2931,8 @@ int main() {
   // =========================================================================
   // Allocate Descriptor Sets
 
+  beginTraceSection(mainTraceSection, "Allocate Descriptor Sets");
+
   std::vector<VkDescriptorSetLayout> descriptorSetLayoutHandleList = {
       descriptorSetLayoutHandle, materialDescriptorSetLayoutHandle};
 
@@ -997,6 +2956,8 @@ int main() {
   // =========================================================================
   // Pipeline Layout
 
+  beginTraceSection(mainTraceSection, "Pipeline Layout");
+
   VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
       .pNext = NULL,
@@ -1017,6 +2978,8 @@ int main() {
   // =========================================================================
   // Vertex Shader Module
 
+  beginTraceSection(mainTraceSection, "Vertex Shader Module");
+
   std::ifstream vertexFile("shaders/shader.vert.spv",
                            std::ios::binary | std::ios::ate);
   std::streamsize vertexFileSize = vertexFile.tellg();
@@ -1046,6 +3009,8 @@ int main() {
   // =========================================================================
   // Fragment Shader Module
 
+  beginTraceSection(mainTraceSection, "Fragment Shader Module");
+
   std::ifstream fragmentFile("shaders/shader.frag.spv",
                              std::ios::binary | std::ios::ate);
   std::streamsize fragmentFileSize = fragmentFile.tellg();
@@ -1073,9 +3038,31 @@ int main() {
     throwExceptionVulkanAPI(result, "vkCreateShaderModule");
   }
 
+  // =========================================================================
+  // Scene
+
+  beginTraceSection(mainTraceSection, "Scene");
+
+  Scene scene;
+  loadScene("resources/cube_scene.obj", scene);
+
   // =========================================================================
   // Graphics Pipeline
 
+  beginTraceSection(mainTraceSection, "Graphics Pipeline");
+
+  // The fragment shader reads 16 bit indices when its constant 0 is set
+  VkBool32 isIndex16 = scene.indexSize == sizeof(uint16_t);
+
+  VkSpecializationMapEntry indexSpecializationMapEntry = {
+      .constantID = 0, .offset = 0, .size = sizeof(VkBool32)};
+
+  VkSpecializationInfo indexSpecializationInfo = {
+      .mapEntryCount = 1,
+      .pMapEntries = &indexSpecializationMapEntry,
+      .dataSize = sizeof(VkBool32),
+      .pData = &isIndex16};
+
   std::vector<VkPipelineShaderStageCreateInfo>
       pipelineShaderStageCreateInfoList = {
           {.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
@@ -1091,17 +3078,17 @@ int main() {
            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
            .module = fragmentShaderModuleHandle,
            .pName = "main",
-           .pSpecializationInfo = NULL}};
+           .pSpecializationInfo = &indexSpecializationInfo}};
 
   VkVertexInputBindingDescription vertexInputBindingDescription = {
       .binding = 0,
-      .stride = sizeof(float) * 3,
+      .stride = SCENE_VERTEX_STRIDE,
       .inputRate = VK_VERTEX_INPUT_RATE_VERTEX};
 
   VkVertexInputAttributeDescription vertexInputAttributeDescription = {
       .location = 0,
       .binding = 0,
-      .format = VK_FORMAT_R32G32B32_SFLOAT,
+      .format = SCENE_VERTEX_FORMAT,
       .offset = 0};
 
   VkPipelineVertexInputStateCreateInfo pipelineVertexInputStateCreateInfo = {
@@ -1120,25 +3107,16 @@ int main() {
        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
        .primitiveRestartEnable = VK_FALSE};
 
-  VkViewport viewport = {
-      .x = 0,
-      .y = (float)surfaceCapabilities.currentExtent.height,
-      .width = (float)surfaceCapabilities.currentExtent.width,
-      .height = -(float)surfaceCapabilities.currentExtent.height,
-      .minDepth = 0,
-      .maxDepth = 1};
-
-  VkRect2D screenRect2D = {.offset = {.x = 0, .y = 0},
-                           .extent = surfaceCapabilities.currentExtent};
-
+  // Viewport and scissor are set per frame so the pipeline survives swapchain
+  // recreation
   VkPipelineViewportStateCreateInfo pipelineViewportStateCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
       .viewportCount = 1,
-      .pViewports = &viewport,
+      .pViewports = NULL,
       .scissorCount = 1,
-      .pScissors = &screenRect2D};
+      .pScissors = NULL};
 
   VkPipelineRasterizationStateCreateInfo pipelineRasterizationStateCreateInfo =
       {.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
@@ -1201,6 +3179,16 @@ int main() {
       .pAttachments = &pipelineColorBlendAttachmentState,
       .blendConstants = {0, 0, 0, 0}};
 
+  std::vector<VkDynamicState> dynamicStateList = {VK_DYNAMIC_STATE_VIEWPORT,
+                                                  VK_DYNAMIC_STATE_SCISSOR};
+
+  VkPipelineDynamicStateCreateInfo pipelineDynamicStateCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .dynamicStateCount = (uint32_t)dynamicStateList.size(),
+      .pDynamicStates = dynamicStateList.data()};
+
   VkGraphicsPipelineCreateInfo graphicsPipelineCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
       .pNext = NULL,
@@ -1215,7 +3203,7 @@ int main() {
       .pMultisampleState = &pipelineMultisampleStateCreateInfo,
       .pDepthStencilState = &pipelineDepthStencilStateCreateInfo,
       .pColorBlendState = &pipelineColorBlendStateCreateInfo,
-      .pDynamicState = NULL,
+      .pDynamicState = &pipelineDynamicStateCreateInfo,
       .layout = pipelineLayoutHandle,
       .renderPass = renderPassHandle,
       .subpass = 0,
@@ -1225,52 +3213,22 @@ int main() {
   VkPipeline graphicsPipelineHandle = VK_NULL_HANDLE;
   result = vkCreateGraphicsPipelines(deviceHandle, VK_NULL_HANDLE, 1,
                                      &graphicsPipelineCreateInfo, NULL,
-                                     &graphicsPipelineHandle);
-
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateGraphicsPipelines");
-  }
-
-  // =========================================================================
-  // OBJ Model
-
-  tinyobj::ObjReaderConfig reader_config;
-  tinyobj::ObjReader reader;
-
-  if (!reader.ParseFromFile("resources/cube_scene.obj", reader_config)) {
-    if (!reader.Error().empty()) {
-      std::cerr << "TinyObjReader: " << reader.Error();
-    }
-    exit(1);
-  }
-
-  if (!reader.Warning().empty()) {
-    std::cout << "TinyObjReader: " << reader.Warning();
-  }
-
-  const tinyobj::attrib_t &attrib = reader.GetAttrib();
-  const std::vector<tinyobj::shape_t> &shapes = reader.GetShapes();
-  const std::vector<tinyobj::material_t> &materials = reader.GetMaterials();
-
-  uint32_t primitiveCount = 0;
-  std::vector<uint32_t> indexList;
-  for (tinyobj::shape_t shape : shapes) {
-
-    primitiveCount += shape.mesh.num_face_vertices.size();
+                                     &graphicsPipelineHandle);
 
-    for (tinyobj::index_t index : shape.mesh.indices) {
-      indexList.push_back(index.vertex_index);
-    }
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateGraphicsPipelines");
   }
 
   // =========================================================================
   // Vertex Buffer
 
+  beginTraceSection(mainTraceSection, "Vertex Buffer");
+
   VkBufferCreateInfo vertexBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = sizeof(float) * attrib.vertices.size() * 3,
+      .size = getSceneVertexBufferSize(scene),
       .usage =
           VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
           VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
@@ -1312,8 +3270,9 @@ int main() {
       .memoryTypeIndex = vertexMemoryTypeIndex};
 
   VkDeviceMemory vertexDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &vertexMemoryAllocateInfo, NULL,
-                            &vertexDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Vertex",
+                                &vertexMemoryAllocateInfo,
+                                &vertexDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
@@ -1326,11 +3285,19 @@ int main() {
 
   void *hostVertexMemoryBuffer;
   result = vkMapMemory(deviceHandle, vertexDeviceMemoryHandle, 0,
-                       sizeof(float) * attrib.vertices.size() * 3, 0,
+                       getSceneVertexBufferSize(scene), 0,
                        &hostVertexMemoryBuffer);
 
-  memcpy(hostVertexMemoryBuffer, attrib.vertices.data(),
-         sizeof(float) * attrib.vertices.size() * 3);
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+  memcpy(hostVertexMemoryBuffer, scene.quantizationTransform,
+         sizeof(scene.quantizationTransform));
+  memcpy((char *)hostVertexMemoryBuffer + SCENE_VERTEX_DATA_OFFSET,
+         scene.quantizedVertexList.data(),
+         SCENE_VERTEX_STRIDE * scene.vertexCount);
+#else
+  memcpy(hostVertexMemoryBuffer, scene.vertexData,
+         sizeof(float) * 3 * scene.vertexCount);
+#endif
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkMapMemory");
@@ -1349,11 +3316,13 @@ int main() {
   // =========================================================================
   // Index Buffer
 
+  beginTraceSection(mainTraceSection, "Index Buffer");
+
   VkBufferCreateInfo indexBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = sizeof(uint32_t) * indexList.size(),
+      .size = getSceneIndexBufferSize(scene),
       .usage =
           VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
           VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
@@ -1395,8 +3364,9 @@ int main() {
       .memoryTypeIndex = indexMemoryTypeIndex};
 
   VkDeviceMemory indexDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &indexMemoryAllocateInfo, NULL,
-                            &indexDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Index",
+                                &indexMemoryAllocateInfo,
+                                &indexDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
@@ -1409,11 +3379,11 @@ int main() {
 
   void *hostIndexMemoryBuffer;
   result = vkMapMemory(deviceHandle, indexDeviceMemoryHandle, 0,
-                       sizeof(uint32_t) * indexList.size(), 0,
+                       getSceneIndexBufferSize(scene), 0,
                        &hostIndexMemoryBuffer);
 
-  memcpy(hostIndexMemoryBuffer, indexList.data(),
-         sizeof(uint32_t) * indexList.size());
+  memcpy(hostIndexMemoryBuffer, scene.indexData,
+         scene.indexSize * scene.indexCount);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkMapMemory");
@@ -1432,19 +3402,32 @@ int main() {
   // =========================================================================
   // Bottom Level Acceleration Structure
 
+  beginTraceSection(mainTraceSection, "Bottom Level Acceleration Structure");
+
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+  // The transform decoding the quantized positions starts the vertex buffer
+  VkDeviceAddress vertexTransformDeviceAddress = vertexBufferDeviceAddress;
+#else
+  VkDeviceAddress vertexTransformDeviceAddress = 0;
+#endif
+
   VkAccelerationStructureGeometryDataKHR
       bottomLevelAccelerationStructureGeometryData = {
           .triangles = {
               .sType =
                   VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
               .pNext = NULL,
-              .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
-              .vertexData = {.deviceAddress = vertexBufferDeviceAddress},
-              .vertexStride = sizeof(float) * 3,
-              .maxVertex = (uint32_t)attrib.vertices.size(),
-              .indexType = VK_INDEX_TYPE_UINT32,
+              .vertexFormat = SCENE_VERTEX_FORMAT,
+              .vertexData = {.deviceAddress = vertexBufferDeviceAddress +
+                                              SCENE_VERTEX_DATA_OFFSET},
+              .vertexStride = SCENE_VERTEX_STRIDE,
+              .maxVertex = (uint32_t)scene.vertexCount,
+              .indexType = scene.indexSize == sizeof(uint16_t)
+                               ? VK_INDEX_TYPE_UINT16
+                               : VK_INDEX_TYPE_UINT32,
               .indexData = {.deviceAddress = indexBufferDeviceAddress},
-              .transformData = {.deviceAddress = 0}}};
+              .transformData = {.deviceAddress =
+                                    vertexTransformDeviceAddress}}};
 
   VkAccelerationStructureGeometryKHR bottomLevelAccelerationStructureGeometry =
       {.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
@@ -1477,7 +3460,8 @@ int main() {
           .updateScratchSize = 0,
           .buildScratchSize = 0};
 
-  std::vector<uint32_t> bottomLevelMaxPrimitiveCountList = {primitiveCount};
+  std::vector<uint32_t> bottomLevelMaxPrimitiveCountList = {
+      (uint32_t)scene.primitiveCount};
 
   pvkGetAccelerationStructureBuildSizesKHR(
       deviceHandle, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
@@ -1535,8 +3519,9 @@ int main() {
   VkDeviceMemory bottomLevelAccelerationStructureDeviceMemoryHandle =
       VK_NULL_HANDLE;
 
-  result = vkAllocateMemory(
-      deviceHandle, &bottomLevelAccelerationStructureMemoryAllocateInfo, NULL,
+  result = allocateDeviceMemory(
+      deviceHandle, memoryLedger, "Acceleration structure",
+      &bottomLevelAccelerationStructureMemoryAllocateInfo,
       &bottomLevelAccelerationStructureDeviceMemoryHandle);
 
   if (result != VK_SUCCESS) {
@@ -1577,6 +3562,9 @@ int main() {
   // =========================================================================
   // Build Bottom Level Acceleration Structure
 
+  beginTraceSection(mainTraceSection,
+                    "Build Bottom Level Acceleration Structure");
+
   VkAccelerationStructureDeviceAddressInfoKHR
       bottomLevelAccelerationStructureDeviceAddressInfo = {
           .sType =
@@ -1642,9 +3630,10 @@ int main() {
   VkDeviceMemory bottomLevelAccelerationStructureDeviceScratchMemoryHandle =
       VK_NULL_HANDLE;
 
-  result = vkAllocateMemory(
-      deviceHandle, &bottomLevelAccelerationStructureScratchMemoryAllocateInfo,
-      NULL, &bottomLevelAccelerationStructureDeviceScratchMemoryHandle);
+  result = allocateDeviceMemory(
+      deviceHandle, memoryLedger, "Scratch",
+      &bottomLevelAccelerationStructureScratchMemoryAllocateInfo,
+      &bottomLevelAccelerationStructureDeviceScratchMemoryHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
@@ -1677,11 +3666,11 @@ int main() {
           bottomLevelAccelerationStructureScratchBufferDeviceAddress};
 
   VkAccelerationStructureBuildRangeInfoKHR
-      bottomLevelAccelerationStructureBuildRangeInfo = {.primitiveCount =
-                                                            primitiveCount,
-                                                        .primitiveOffset = 0,
-                                                        .firstVertex = 0,
-                                                        .transformOffset = 0};
+      bottomLevelAccelerationStructureBuildRangeInfo = {
+          .primitiveCount = (uint32_t)scene.primitiveCount,
+          .primitiveOffset = 0,
+          .firstVertex = 0,
+          .transformOffset = 0};
 
   const VkAccelerationStructureBuildRangeInfoKHR
       *bottomLevelAccelerationStructureBuildRangeInfos =
@@ -1700,11 +3689,26 @@ int main() {
     throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
   }
 
+  if (isTimestampSupported) {
+    vkCmdResetQueryPool(commandBufferHandleList.back(),
+                        accelerationStructureTimestampQueryPoolHandle, 0, 2);
+
+    vkCmdWriteTimestamp(commandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        accelerationStructureTimestampQueryPoolHandle, 0);
+  }
+
   pvkCmdBuildAccelerationStructuresKHR(
       commandBufferHandleList.back(), 1,
       &bottomLevelAccelerationStructureBuildGeometryInfo,
       &bottomLevelAccelerationStructureBuildRangeInfos);
 
+  if (isTimestampSupported) {
+    vkCmdWriteTimestamp(commandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                        accelerationStructureTimestampQueryPoolHandle, 1);
+  }
+
   result = vkEndCommandBuffer(commandBufferHandleList.back());
 
   if (result != VK_SUCCESS) {
@@ -1734,6 +3738,7 @@ int main() {
     throwExceptionVulkanAPI(result, "vkCreateFence");
   }
 
+  double bottomLevelSubmitMicroseconds = getTraceMicroseconds();
   result = vkQueueSubmit(queueHandle, 1,
                          &bottomLevelAccelerationStructureBuildSubmitInfo,
                          bottomLevelAccelerationStructureBuildFenceHandle);
@@ -1750,9 +3755,23 @@ int main() {
     throwExceptionVulkanAPI(result, "vkWaitForFences");
   }
 
+  if (isTimestampSupported) {
+    double bottomLevelBuildMilliseconds = getTimestampMilliseconds(
+        accelerationStructureTimestampQueryPoolHandle, 0);
+
+    std::cout << "Bottom level acceleration structure build: "
+              << bottomLevelBuildMilliseconds << " ms" << std::endl;
+
+    addQueueTraceEvent("Bottom level build", graphicsQueueTraceTrackIndex,
+                       bottomLevelSubmitMicroseconds,
+                       bottomLevelBuildMilliseconds * 1000.0);
+  }
+
   // =========================================================================
   // Top Level Acceleration Structure
 
+  beginTraceSection(mainTraceSection, "Top Level Acceleration Structure");
+
   VkAccelerationStructureInstanceKHR bottomLevelAccelerationStructureInstance =
       {.transform = {.matrix = {{1.0, 0.0, 0.0, 0.0},
                                 {0.0, 1.0, 0.0, 0.0},
@@ -1813,9 +3832,9 @@ int main() {
 
   VkDeviceMemory bottomLevelGeometryInstanceDeviceMemoryHandle = VK_NULL_HANDLE;
 
-  result = vkAllocateMemory(
-      deviceHandle, &bottomLevelGeometryInstanceMemoryAllocateInfo, NULL,
-      &bottomLevelGeometryInstanceDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Instance",
+                                &bottomLevelGeometryInstanceMemoryAllocateInfo,
+                                &bottomLevelGeometryInstanceDeviceMemoryHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
@@ -1952,8 +3971,9 @@ int main() {
   VkDeviceMemory topLevelAccelerationStructureDeviceMemoryHandle =
       VK_NULL_HANDLE;
 
-  result = vkAllocateMemory(
-      deviceHandle, &topLevelAccelerationStructureMemoryAllocateInfo, NULL,
+  result = allocateDeviceMemory(
+      deviceHandle, memoryLedger, "Acceleration structure",
+      &topLevelAccelerationStructureMemoryAllocateInfo,
       &topLevelAccelerationStructureDeviceMemoryHandle);
 
   if (result != VK_SUCCESS) {
@@ -1993,6 +4013,8 @@ int main() {
   // =========================================================================
   // Build Top Level Acceleration Structure
 
+  beginTraceSection(mainTraceSection, "Build Top Level Acceleration Structure");
+
   VkAccelerationStructureDeviceAddressInfoKHR
       topLevelAccelerationStructureDeviceAddressInfo = {
           .sType =
@@ -2054,9 +4076,10 @@ int main() {
   VkDeviceMemory topLevelAccelerationStructureDeviceScratchMemoryHandle =
       VK_NULL_HANDLE;
 
-  result = vkAllocateMemory(
-      deviceHandle, &topLevelAccelerationStructureScratchMemoryAllocateInfo,
-      NULL, &topLevelAccelerationStructureDeviceScratchMemoryHandle);
+  result = allocateDeviceMemory(
+      deviceHandle, memoryLedger, "Scratch",
+      &topLevelAccelerationStructureScratchMemoryAllocateInfo,
+      &topLevelAccelerationStructureDeviceScratchMemoryHandle);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
@@ -2110,11 +4133,26 @@ int main() {
     throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
   }
 
+  if (isTimestampSupported) {
+    vkCmdResetQueryPool(commandBufferHandleList.back(),
+                        accelerationStructureTimestampQueryPoolHandle, 2, 2);
+
+    vkCmdWriteTimestamp(commandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        accelerationStructureTimestampQueryPoolHandle, 2);
+  }
+
   pvkCmdBuildAccelerationStructuresKHR(
       commandBufferHandleList.back(), 1,
       &topLevelAccelerationStructureBuildGeometryInfo,
       &topLevelAccelerationStructureBuildRangeInfos);
 
+  if (isTimestampSupported) {
+    vkCmdWriteTimestamp(commandBufferHandleList.back(),
+                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                        accelerationStructureTimestampQueryPoolHandle, 3);
+  }
+
   result = vkEndCommandBuffer(commandBufferHandleList.back());
 
   if (result != VK_SUCCESS) {
@@ -2144,6 +4182,7 @@ int main() {
     throwExceptionVulkanAPI(result, "vkCreateFence");
   }
 
+  double topLevelSubmitMicroseconds = getTraceMicroseconds();
   result = vkQueueSubmit(queueHandle, 1,
                          &topLevelAccelerationStructureBuildSubmitInfo,
                          topLevelAccelerationStructureBuildFenceHandle);
@@ -2160,9 +4199,23 @@ int main() {
     throwExceptionVulkanAPI(result, "vkWaitForFences");
   }
 
+  if (isTimestampSupported) {
+    double topLevelBuildMilliseconds = getTimestampMilliseconds(
+        accelerationStructureTimestampQueryPoolHandle, 2);
+
+    std::cout << "Top level acceleration structure build: "
+              << topLevelBuildMilliseconds << " ms" << std::endl;
+
+    addQueueTraceEvent("Top level build", graphicsQueueTraceTrackIndex,
+                       topLevelSubmitMicroseconds,
+                       topLevelBuildMilliseconds * 1000.0);
+  }
+
   // =========================================================================
   // Uniform Buffer
 
+  beginTraceSection(mainTraceSection, "Uniform Buffer");
+
   struct UniformStructure {
     float cameraPosition[4] = {0, 0, 0, 1};
     float cameraRight[4] = {1, 0, 0, 1};
@@ -2172,11 +4225,19 @@ int main() {
     uint32_t frameCount = 0;
   } uniformStructure;
 
+  // One slice per frame in flight, selected with a dynamic offset
+  VkDeviceSize uniformBufferOffsetAlignment =
+      physicalDeviceProperties.limits.minUniformBufferOffsetAlignment;
+
+  VkDeviceSize uniformSliceSize =
+      (sizeof(UniformStructure) + uniformBufferOffsetAlignment - 1) &
+      ~(uniformBufferOffsetAlignment - 1);
+
   VkBufferCreateInfo uniformBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = sizeof(UniformStructure),
+      .size = uniformSliceSize * FRAMES_IN_FLIGHT,
       .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
@@ -2199,8 +4260,10 @@ int main() {
        x++) {
     if ((uniformMemoryRequirements.memoryTypeBits & (1 << x)) &&
         (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+         (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) ==
+            (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
 
       uniformMemoryTypeIndex = x;
       break;
@@ -2214,8 +4277,9 @@ int main() {
       .memoryTypeIndex = uniformMemoryTypeIndex};
 
   VkDeviceMemory uniformDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &uniformMemoryAllocateInfo, NULL,
-                            &uniformDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Uniform",
+                                &uniformMemoryAllocateInfo,
+                                &uniformDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
@@ -2226,201 +4290,222 @@ int main() {
     throwExceptionVulkanAPI(result, "vkBindBufferMemory");
   }
 
+  // Left mapped, each frame writes its slice after waiting on its fence
   void *hostUniformMemoryBuffer;
   result = vkMapMemory(deviceHandle, uniformDeviceMemoryHandle, 0,
-                       sizeof(UniformStructure), 0, &hostUniformMemoryBuffer);
-
-  memcpy(hostUniformMemoryBuffer, &uniformStructure, sizeof(UniformStructure));
+                       VK_WHOLE_SIZE, 0, &hostUniformMemoryBuffer);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkMapMemory");
   }
 
-  vkUnmapMemory(deviceHandle, uniformDeviceMemoryHandle);
+  for (uint32_t x = 0; x < FRAMES_IN_FLIGHT; x++) {
+    memcpy((uint8_t *)hostUniformMemoryBuffer + x * uniformSliceSize,
+           &uniformStructure, sizeof(UniformStructure));
+  }
 
   // =========================================================================
   // Ray Trace Image
 
-  VkImageCreateInfo rayTraceImageCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .imageType = VK_IMAGE_TYPE_2D,
-      .format = surfaceFormatList[0].format,
-      .extent = {.width = surfaceCapabilities.currentExtent.width,
-                 .height = surfaceCapabilities.currentExtent.height,
-                 .depth = 1},
-      .mipLevels = 1,
-      .arrayLayers = 1,
-      .samples = VK_SAMPLE_COUNT_1_BIT,
-      .tiling = VK_IMAGE_TILING_OPTIMAL,
-      .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-      .queueFamilyIndexCount = 1,
-      .pQueueFamilyIndices = &queueFamilyIndex,
-      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
+  beginTraceSection(mainTraceSection, "Ray Trace Image");
 
-  VkImage rayTraceImageHandle = VK_NULL_HANDLE;
-  result = vkCreateImage(deviceHandle, &rayTraceImageCreateInfo, NULL,
-                         &rayTraceImageHandle);
+  VkFenceCreateInfo
+      rayTraceImageBarrierAccelerationStructureBuildFenceCreateInfo = {
+          .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+          .pNext = NULL,
+          .flags = 0};
+
+  VkFence rayTraceImageBarrierAccelerationStructureBuildFenceHandle =
+      VK_NULL_HANDLE;
+  result = vkCreateFence(
+      deviceHandle,
+      &rayTraceImageBarrierAccelerationStructureBuildFenceCreateInfo, NULL,
+      &rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
 
   if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateImage");
+    throwExceptionVulkanAPI(result, "vkCreateFence");
   }
 
-  VkMemoryRequirements rayTraceImageMemoryRequirements;
-  vkGetImageMemoryRequirements(deviceHandle, rayTraceImageHandle,
-                               &rayTraceImageMemoryRequirements);
+  VkImage rayTraceImageHandle = VK_NULL_HANDLE;
+  VkDeviceMemory rayTraceImageDeviceMemoryHandle = VK_NULL_HANDLE;
+  VkImageView rayTraceImageViewHandle = VK_NULL_HANDLE;
 
-  uint32_t rayTraceImageMemoryTypeIndex = -1;
-  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
-       x++) {
-    if ((rayTraceImageMemoryRequirements.memoryTypeBits & (1 << x)) &&
-        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+  // Sized to the swapchain, recreated along with it
+  auto createRayTraceImage = [&]() {
+    VkImageCreateInfo rayTraceImageCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = surfaceFormat.format,
+        .extent = {.width = swapchainExtent.width,
+                   .height = swapchainExtent.height,
+                   .depth = 1},
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 1,
+        .pQueueFamilyIndices = &queueFamilyIndex,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
 
-      rayTraceImageMemoryTypeIndex = x;
-      break;
+    result = vkCreateImage(deviceHandle, &rayTraceImageCreateInfo, NULL,
+                           &rayTraceImageHandle);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateImage");
     }
-  }
 
-  VkMemoryAllocateInfo rayTraceImageMemoryAllocateInfo = {
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .pNext = NULL,
-      .allocationSize = rayTraceImageMemoryRequirements.size,
-      .memoryTypeIndex = rayTraceImageMemoryTypeIndex};
+    VkMemoryRequirements rayTraceImageMemoryRequirements;
+    vkGetImageMemoryRequirements(deviceHandle, rayTraceImageHandle,
+                                 &rayTraceImageMemoryRequirements);
 
-  VkDeviceMemory rayTraceImageDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &rayTraceImageMemoryAllocateInfo,
-                            NULL, &rayTraceImageDeviceMemoryHandle);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkAllocateMemory");
-  }
+    uint32_t rayTraceImageMemoryTypeIndex = -1;
+    for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+         x++) {
+      if ((rayTraceImageMemoryRequirements.memoryTypeBits & (1 << x)) &&
+          (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ==
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
 
-  result = vkBindImageMemory(deviceHandle, rayTraceImageHandle,
-                             rayTraceImageDeviceMemoryHandle, 0);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBindImageMemory");
-  }
+        rayTraceImageMemoryTypeIndex = x;
+        break;
+      }
+    }
 
-  VkImageViewCreateInfo rayTraceImageViewCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-      .pNext = NULL,
-      .flags = 0,
-      .image = rayTraceImageHandle,
-      .viewType = VK_IMAGE_VIEW_TYPE_2D,
-      .format = surfaceFormatList[0].format,
-      .components = {.r = VK_COMPONENT_SWIZZLE_IDENTITY,
-                     .g = VK_COMPONENT_SWIZZLE_IDENTITY,
-                     .b = VK_COMPONENT_SWIZZLE_IDENTITY,
-                     .a = VK_COMPONENT_SWIZZLE_IDENTITY},
-      .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                           .baseMipLevel = 0,
-                           .levelCount = 1,
-                           .baseArrayLayer = 0,
-                           .layerCount = 1}};
+    VkMemoryAllocateInfo rayTraceImageMemoryAllocateInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = NULL,
+        .allocationSize = rayTraceImageMemoryRequirements.size,
+        .memoryTypeIndex = rayTraceImageMemoryTypeIndex};
 
-  VkImageView rayTraceImageViewHandle = VK_NULL_HANDLE;
-  result = vkCreateImageView(deviceHandle, &rayTraceImageViewCreateInfo, NULL,
-                             &rayTraceImageViewHandle);
+    result = allocateDeviceMemory(deviceHandle, memoryLedger, "Image",
+                                  &rayTraceImageMemoryAllocateInfo,
+                                  &rayTraceImageDeviceMemoryHandle);
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkAllocateMemory");
+    }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateImageView");
-  }
+    result = vkBindImageMemory(deviceHandle, rayTraceImageHandle,
+                               rayTraceImageDeviceMemoryHandle, 0);
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkBindImageMemory");
+    }
 
-  // =========================================================================
-  // Ray Trace Image Barrier
-  // (VK_IMAGE_LAYOUT_UNDEFINED -> VK_IMAGE_LAYOUT_GENERAL)
+    VkImageViewCreateInfo rayTraceImageViewCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .image = rayTraceImageHandle,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = surfaceFormat.format,
+        .components = {.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                       .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                       .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                       .a = VK_COMPONENT_SWIZZLE_IDENTITY},
+        .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .baseMipLevel = 0,
+                             .levelCount = 1,
+                             .baseArrayLayer = 0,
+                             .layerCount = 1}};
 
-  VkCommandBufferBeginInfo rayTraceImageBarrierCommandBufferBeginInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-      .pNext = NULL,
-      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-      .pInheritanceInfo = NULL};
+    result = vkCreateImageView(deviceHandle, &rayTraceImageViewCreateInfo, NULL,
+                               &rayTraceImageViewHandle);
 
-  result = vkBeginCommandBuffer(commandBufferHandleList.back(),
-                                &rayTraceImageBarrierCommandBufferBeginInfo);
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateImageView");
+    }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
-  }
+    // Ray Trace Image Barrier
+    // (VK_IMAGE_LAYOUT_UNDEFINED -> VK_IMAGE_LAYOUT_GENERAL)
 
-  VkImageMemoryBarrier rayTraceGeneralMemoryBarrier = {
-      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-      .pNext = NULL,
-      .srcAccessMask = 0,
-      .dstAccessMask = 0,
-      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-      .newLayout = VK_IMAGE_LAYOUT_GENERAL,
-      .srcQueueFamilyIndex = queueFamilyIndex,
-      .dstQueueFamilyIndex = queueFamilyIndex,
-      .image = rayTraceImageHandle,
-      .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                           .baseMipLevel = 0,
-                           .levelCount = 1,
-                           .baseArrayLayer = 0,
-                           .layerCount = 1}};
+    VkCommandBufferBeginInfo rayTraceImageBarrierCommandBufferBeginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = NULL};
 
-  vkCmdPipelineBarrier(commandBufferHandleList.back(),
-                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0, NULL,
-                       1, &rayTraceGeneralMemoryBarrier);
+    result = vkBeginCommandBuffer(commandBufferHandleList.back(),
+                                  &rayTraceImageBarrierCommandBufferBeginInfo);
 
-  result = vkEndCommandBuffer(commandBufferHandleList.back());
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkBeginCommandBuffer");
+    }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
-  }
+    VkImageMemoryBarrier rayTraceGeneralMemoryBarrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = 0,
+        .dstAccessMask = 0,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = queueFamilyIndex,
+        .dstQueueFamilyIndex = queueFamilyIndex,
+        .image = rayTraceImageHandle,
+        .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .baseMipLevel = 0,
+                             .levelCount = 1,
+                             .baseArrayLayer = 0,
+                             .layerCount = 1}};
 
-  VkSubmitInfo rayTraceImageBarrierAccelerationStructureBuildSubmitInfo = {
-      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-      .pNext = NULL,
-      .waitSemaphoreCount = 0,
-      .pWaitSemaphores = NULL,
-      .pWaitDstStageMask = NULL,
-      .commandBufferCount = 1,
-      .pCommandBuffers = &commandBufferHandleList.back(),
-      .signalSemaphoreCount = 0,
-      .pSignalSemaphores = NULL};
+    vkCmdPipelineBarrier(commandBufferHandleList.back(),
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0,
+                         NULL, 1, &rayTraceGeneralMemoryBarrier);
 
-  VkFenceCreateInfo
-      rayTraceImageBarrierAccelerationStructureBuildFenceCreateInfo = {
-          .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-          .pNext = NULL,
-          .flags = 0};
+    result = vkEndCommandBuffer(commandBufferHandleList.back());
 
-  VkFence rayTraceImageBarrierAccelerationStructureBuildFenceHandle =
-      VK_NULL_HANDLE;
-  result = vkCreateFence(
-      deviceHandle,
-      &rayTraceImageBarrierAccelerationStructureBuildFenceCreateInfo, NULL,
-      &rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
+    }
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkCreateFence");
-  }
+    VkSubmitInfo rayTraceImageBarrierAccelerationStructureBuildSubmitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = NULL,
+        .waitSemaphoreCount = 0,
+        .pWaitSemaphores = NULL,
+        .pWaitDstStageMask = NULL,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBufferHandleList.back(),
+        .signalSemaphoreCount = 0,
+        .pSignalSemaphores = NULL};
 
-  result = vkQueueSubmit(
-      queueHandle, 1, &rayTraceImageBarrierAccelerationStructureBuildSubmitInfo,
-      rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
+    result = vkQueueSubmit(
+        queueHandle, 1,
+        &rayTraceImageBarrierAccelerationStructureBuildSubmitInfo,
+        rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkQueueSubmit");
-  }
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkQueueSubmit");
+    }
 
-  result = vkWaitForFences(
-      deviceHandle, 1,
-      &rayTraceImageBarrierAccelerationStructureBuildFenceHandle, true,
-      UINT32_MAX);
+    result = vkWaitForFences(
+        deviceHandle, 1,
+        &rayTraceImageBarrierAccelerationStructureBuildFenceHandle, true,
+        UINT32_MAX);
 
-  if (result != VK_SUCCESS && result != VK_TIMEOUT) {
-    throwExceptionVulkanAPI(result, "vkWaitForFences");
-  }
+    if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+      throwExceptionVulkanAPI(result, "vkWaitForFences");
+    }
+
+    result = vkResetFences(
+        deviceHandle, 1,
+        &rayTraceImageBarrierAccelerationStructureBuildFenceHandle);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkResetFences");
+    }
+  };
+
+  createRayTraceImage();
 
   // =========================================================================
   // Update Descriptor Set
 
+  beginTraceSection(mainTraceSection, "Update Descriptor Set");
+
   VkWriteDescriptorSetAccelerationStructureKHR
       accelerationStructureDescriptorInfo = {
           .sType =
@@ -2430,7 +4515,9 @@ int main() {
           .pAccelerationStructures = &topLevelAccelerationStructureHandle};
 
   VkDescriptorBufferInfo uniformDescriptorInfo = {
-      .buffer = uniformBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
+      .buffer = uniformBufferHandle,
+      .offset = 0,
+      .range = sizeof(UniformStructure)};
 
   VkDescriptorBufferInfo indexDescriptorInfo = {
       .buffer = indexBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
@@ -2460,7 +4547,7 @@ int main() {
        .dstBinding = 1,
        .dstArrayElement = 0,
        .descriptorCount = 1,
-       .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+       .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
        .pImageInfo = NULL,
        .pBufferInfo = &uniformDescriptorInfo,
        .pTexelBufferView = NULL},
@@ -2495,24 +4582,127 @@ int main() {
        .pBufferInfo = NULL,
        .pTexelBufferView = NULL}};
 
-  vkUpdateDescriptorSets(deviceHandle, writeDescriptorSetList.size(),
-                         writeDescriptorSetList.data(), 0, NULL);
+  vkUpdateDescriptorSets(deviceHandle, writeDescriptorSetList.size(),
+                         writeDescriptorSetList.data(), 0, NULL);
+
+#if defined(RAY_COUNTERS_ENABLED)
+  // =========================================================================
+  // Ray Counter Buffer
+
+  beginTraceSection(mainTraceSection, "Ray Counter Buffer");
+
+  // One slice of counters per frame in flight, selected with a dynamic offset
+  VkDeviceSize storageBufferOffsetAlignment =
+      physicalDeviceProperties.limits.minStorageBufferOffsetAlignment;
+
+  VkDeviceSize rayCounterSliceSize =
+      (rayTypeNameList.size() * sizeof(uint32_t) +
+       storageBufferOffsetAlignment - 1) &
+      ~(storageBufferOffsetAlignment - 1);
+
+  VkBufferCreateInfo rayCounterBufferCreateInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .pNext = NULL,
+      .flags = 0,
+      .size = rayCounterSliceSize * FRAMES_IN_FLIGHT,
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = 1,
+      .pQueueFamilyIndices = &queueFamilyIndex};
+
+  VkBuffer rayCounterBufferHandle = VK_NULL_HANDLE;
+  result = vkCreateBuffer(deviceHandle, &rayCounterBufferCreateInfo, NULL,
+                          &rayCounterBufferHandle);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkCreateBuffer");
+  }
+
+  VkMemoryRequirements rayCounterMemoryRequirements;
+  vkGetBufferMemoryRequirements(deviceHandle, rayCounterBufferHandle,
+                                &rayCounterMemoryRequirements);
+
+  uint32_t rayCounterMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+    if ((rayCounterMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) ==
+            (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+
+      rayCounterMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo rayCounterMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = NULL,
+      .allocationSize = rayCounterMemoryRequirements.size,
+      .memoryTypeIndex = rayCounterMemoryTypeIndex};
+
+  VkDeviceMemory rayCounterDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Ray counter",
+                                &rayCounterMemoryAllocateInfo,
+                                &rayCounterDeviceMemoryHandle);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(deviceHandle, rayCounterBufferHandle,
+                              rayCounterDeviceMemoryHandle, 0);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  // Left mapped, each frame reads and clears its slice after waiting on its
+  // fence
+  void *hostRayCounterMemoryBuffer;
+  result = vkMapMemory(deviceHandle, rayCounterDeviceMemoryHandle, 0,
+                       VK_WHOLE_SIZE, 0, &hostRayCounterMemoryBuffer);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkMapMemory");
+  }
+
+  memset(hostRayCounterMemoryBuffer, 0, rayCounterBufferCreateInfo.size);
+
+  VkDescriptorBufferInfo rayCounterDescriptorInfo = {
+      .buffer = rayCounterBufferHandle,
+      .offset = 0,
+      .range = rayTypeNameList.size() * sizeof(uint32_t)};
+
+  VkWriteDescriptorSet rayCounterWriteDescriptorSet = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .pNext = NULL,
+      .dstSet = descriptorSetHandleList[0],
+      .dstBinding = 5,
+      .dstArrayElement = 0,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+      .pImageInfo = NULL,
+      .pBufferInfo = &rayCounterDescriptorInfo,
+      .pTexelBufferView = NULL};
+
+  vkUpdateDescriptorSets(deviceHandle, 1, &rayCounterWriteDescriptorSet, 0,
+                         NULL);
+
+  std::vector<uint64_t> windowRayCountList(rayTypeNameList.size(), 0);
+  double windowTraceMilliseconds = 0.0;
+#endif
 
   // =========================================================================
   // Material Index Buffer
 
-  std::vector<uint32_t> materialIndexList;
-  for (tinyobj::shape_t shape : shapes) {
-    for (int index : shape.mesh.material_ids) {
-      materialIndexList.push_back(index);
-    }
-  }
+  beginTraceSection(mainTraceSection, "Material Index Buffer");
 
   VkBufferCreateInfo materialIndexBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = sizeof(uint32_t) * materialIndexList.size(),
+      .size = sizeof(uint32_t) * scene.primitiveCount,
       .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
@@ -2550,8 +4740,9 @@ int main() {
       .memoryTypeIndex = materialIndexMemoryTypeIndex};
 
   VkDeviceMemory materialIndexDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &materialIndexMemoryAllocateInfo,
-                            NULL, &materialIndexDeviceMemoryHandle);
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Material",
+                                &materialIndexMemoryAllocateInfo,
+                                &materialIndexDeviceMemoryHandle);
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkAllocateMemory");
   }
@@ -2564,11 +4755,11 @@ int main() {
 
   void *hostMaterialIndexMemoryBuffer;
   result = vkMapMemory(deviceHandle, materialIndexDeviceMemoryHandle, 0,
-                       sizeof(uint32_t) * materialIndexList.size(), 0,
+                       sizeof(uint32_t) * scene.primitiveCount, 0,
                        &hostMaterialIndexMemoryBuffer);
 
-  memcpy(hostMaterialIndexMemoryBuffer, materialIndexList.data(),
-         sizeof(uint32_t) * materialIndexList.size());
+  memcpy(hostMaterialIndexMemoryBuffer, scene.materialIndexData,
+         sizeof(uint32_t) * scene.primitiveCount);
 
   if (result != VK_SUCCESS) {
     throwExceptionVulkanAPI(result, "vkMapMemory");
@@ -2579,26 +4770,13 @@ int main() {
   // =========================================================================
   // Material Buffer
 
-  struct Material {
-    float ambient[4] = {0, 0, 0, 0};
-    float diffuse[4] = {0, 0, 0, 0};
-    float specular[4] = {0, 0, 0, 0};
-    float emission[4] = {0, 0, 0, 0};
-  };
-
-  std::vector<Material> materialList(materials.size());
-  for (uint32_t x = 0; x < materials.size(); x++) {
-    memcpy(materialList[x].ambient, materials[x].ambient, sizeof(float) * 3);
-    memcpy(materialList[x].diffuse, materials[x].diffuse, sizeof(float) * 3);
-    memcpy(materialList[x].specular, materials[x].specular, sizeof(float) * 3);
-    memcpy(materialList[x].emission, materials[x].emission, sizeof(float) * 3);
-  }
+  beginTraceSection(mainTraceSection, "Material Buffer");
 
   VkBufferCreateInfo materialBufferCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .pNext = NULL,
       .flags = 0,
-      .size = sizeof(Material) * materialList.size(),
+      .size = sizeof(Material) * scene.materialCount,
       .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
@@ -2616,97 +4794,471 @@ int main() {
   vkGetBufferMemoryRequirements(deviceHandle, materialBufferHandle,
                                 &materialMemoryRequirements);
 
-  uint32_t materialMemoryTypeIndex = -1;
-  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
-       x++) {
-    if ((materialMemoryRequirements.memoryTypeBits & (1 << x)) &&
-        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
-         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+  uint32_t materialMemoryTypeIndex = -1;
+  for (uint32_t x = 0; x < physicalDeviceMemoryProperties.memoryTypeCount;
+       x++) {
+    if ((materialMemoryRequirements.memoryTypeBits & (1 << x)) &&
+        (physicalDeviceMemoryProperties.memoryTypes[x].propertyFlags &
+         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ==
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+
+      materialMemoryTypeIndex = x;
+      break;
+    }
+  }
+
+  VkMemoryAllocateInfo materialMemoryAllocateInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = &memoryAllocateFlagsInfo,
+      .allocationSize = materialMemoryRequirements.size,
+      .memoryTypeIndex = materialMemoryTypeIndex};
+
+  VkDeviceMemory materialDeviceMemoryHandle = VK_NULL_HANDLE;
+  result = allocateDeviceMemory(deviceHandle, memoryLedger, "Material",
+                                &materialMemoryAllocateInfo,
+                                &materialDeviceMemoryHandle);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkAllocateMemory");
+  }
+
+  result = vkBindBufferMemory(deviceHandle, materialBufferHandle,
+                              materialDeviceMemoryHandle, 0);
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
+  }
+
+  void *hostMaterialMemoryBuffer;
+  result = vkMapMemory(deviceHandle, materialDeviceMemoryHandle, 0,
+                       sizeof(Material) * scene.materialCount, 0,
+                       &hostMaterialMemoryBuffer);
+
+  memcpy(hostMaterialMemoryBuffer, scene.materialData,
+         sizeof(Material) * scene.materialCount);
+
+  if (result != VK_SUCCESS) {
+    throwExceptionVulkanAPI(result, "vkMapMemory");
+  }
+
+  vkUnmapMemory(deviceHandle, materialDeviceMemoryHandle);
+
+  // =========================================================================
+  // Update Material Descriptor Set
+
+  beginTraceSection(mainTraceSection, "Update Material Descriptor Set");
+
+  VkDescriptorBufferInfo materialIndexDescriptorInfo = {
+      .buffer = materialIndexBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
+
+  VkDescriptorBufferInfo materialDescriptorInfo = {
+      .buffer = materialBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
+
+  std::vector<VkWriteDescriptorSet> materialWriteDescriptorSetList = {
+      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+       .pNext = NULL,
+       .dstSet = descriptorSetHandleList[1],
+       .dstBinding = 0,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+       .pImageInfo = NULL,
+       .pBufferInfo = &materialIndexDescriptorInfo,
+       .pTexelBufferView = NULL},
+      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+       .pNext = NULL,
+       .dstSet = descriptorSetHandleList[1],
+       .dstBinding = 1,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+       .pImageInfo = NULL,
+       .pBufferInfo = &materialDescriptorInfo,
+       .pTexelBufferView = NULL}};
+
+  vkUpdateDescriptorSets(deviceHandle, materialWriteDescriptorSetList.size(),
+                         materialWriteDescriptorSetList.data(), 0, NULL);
+
+  // =========================================================================
+  // Fences, Semaphores
+
+  beginTraceSection(mainTraceSection, "Fences, Semaphores");
+
+  // Fences and acquire semaphores are per frame in flight, write semaphores
+  // are per swapchain image since presentation holds them until the image is
+  // acquired again
+  std::vector<VkFence> imageAvailableFenceHandleList(FRAMES_IN_FLIGHT,
+                                                     VK_NULL_HANDLE);
+
+  std::vector<VkSemaphore> acquireImageSemaphoreHandleList(FRAMES_IN_FLIGHT,
+                                                           VK_NULL_HANDLE);
+
+  std::vector<VkSemaphore> writeImageSemaphoreHandleList(swapchainImageCount,
+                                                         VK_NULL_HANDLE);
+
+  for (uint32_t x = 0; x < FRAMES_IN_FLIGHT; x++) {
+    VkFenceCreateInfo imageAvailableFenceCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = VK_FENCE_CREATE_SIGNALED_BIT};
+
+    result = vkCreateFence(deviceHandle, &imageAvailableFenceCreateInfo, NULL,
+                           &imageAvailableFenceHandleList[x]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateFence");
+    }
+
+    VkSemaphoreCreateInfo acquireImageSemaphoreCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0};
+
+    result = vkCreateSemaphore(deviceHandle, &acquireImageSemaphoreCreateInfo,
+                               NULL, &acquireImageSemaphoreHandleList[x]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateSemaphore");
+    }
+  }
+
+  for (uint32_t x = 0; x < swapchainImageCount; x++) {
+    VkSemaphoreCreateInfo writeImageSemaphoreCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0};
+
+    result = vkCreateSemaphore(deviceHandle, &writeImageSemaphoreCreateInfo,
+                               NULL, &writeImageSemaphoreHandleList[x]);
+
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkCreateSemaphore");
+    }
+  }
+
+  // =========================================================================
+  // Main Loop
+
+  beginTraceSection(mainTraceSection, "Main Loop");
+
+  printMemoryReport(physicalDeviceProperties.deviceName, memoryLedger);
+
+  uint32_t currentFrame = 0;
+  uint32_t timedFrameCount = 0;
+
+  TraceSection frameTraceSection = {.trackIndex = mainTraceSection.trackIndex};
+  std::vector<double> frameSubmitMicrosecondsList(FRAMES_IN_FLIGHT, 0.0);
+  bool isSwapchainOutOfDate = false;
+  std::chrono::steady_clock::time_point previousFrameTimePoint =
+      std::chrono::steady_clock::now();
+  while (!exitWindow) {
+    // Render continuously until the image converges, then block until input
+    // arrives instead of spinning on an unchanged frame
+    bool isIdle = uniformStructure.frameCount >= CONVERGED_FRAME_COUNT &&
+                  !isMoveForward && !isMoveBack && !isTurnLeft &&
+                  !isTurnRight;
+
+    // An out of date swapchain is recreated right away, unless the window is
+    // minimized and has nothing to present to until it is restored
+    if (isSwapchainOutOfDate) {
+      isIdle = surfaceCapabilities.currentExtent.width == 0 ||
+               surfaceCapabilities.currentExtent.height == 0;
+    }
+
+#if defined(PLATFORM_LINUX)
+    if (isIdle && XPending(displayPtr) == 0) {
+      pollfd displayPollFileDescriptor = {
+          .fd = ConnectionNumber(displayPtr), .events = POLLIN, .revents = 0};
+
+      poll(&displayPollFileDescriptor, 1, -1);
+    }
+
+    while (XPending(displayPtr) > 0) {
+      XEvent event;
+      XNextEvent(displayPtr, &event);
+      handleEvent(displayPtr, &event);
+    }
+#elif defined(PLATFORM_WINDOWS)
+    if (isIdle) {
+      WaitMessage();
+    }
+
+    MSG msg;
+    while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+      TranslateMessage(&msg);
+      DispatchMessage(&msg);
+    }
+#endif
+
+    if (exitWindow) {
+      break;
+    }
+
+    // Input is applied per second of wall time rather than per frame, capped
+    // so that waking from an idle wait does not jump the camera
+    std::chrono::steady_clock::time_point frameTimePoint =
+        std::chrono::steady_clock::now();
+
+    float frameSeconds = std::min(
+        std::chrono::duration<float>(frameTimePoint - previousFrameTimePoint)
+            .count(),
+        0.1f);
+
+    previousFrameTimePoint = frameTimePoint;
+
+    static bool isCameraMoved = true;
+    static float cameraPosition[3] = { 1.5, 4.0, 10.0 };
+    static float cameraYaw = 0.0;
+    static float cameraPitch = 0.0;
+
+    if (isMoveForward) {
+      cameraPosition[0] += cos(-cameraYaw - (3.141592 / 2)) *
+                           CAMERA_MOVE_SPEED * frameSeconds;
+      cameraPosition[2] += sin(-cameraYaw - (3.141592 / 2)) *
+                           CAMERA_MOVE_SPEED * frameSeconds;
+      isCameraMoved = true;
+    }
+    if (isMoveBack) {
+      cameraPosition[0] -= cos(-cameraYaw - (3.141592 / 2)) *
+                           CAMERA_MOVE_SPEED * frameSeconds;
+      cameraPosition[2] -= sin(-cameraYaw - (3.141592 / 2)) *
+                           CAMERA_MOVE_SPEED * frameSeconds;
+      isCameraMoved = true;
+    }
+    if (isTurnLeft) {
+      cameraYaw += CAMERA_TURN_SPEED * frameSeconds;
+      isCameraMoved = true;
+    }
+    if (isTurnRight) {
+      cameraYaw -= CAMERA_TURN_SPEED * frameSeconds;
+      isCameraMoved = true;
+    }
+
+    if (isCameraMoved) {
+      uniformStructure.cameraPosition[0] = cameraPosition[0];
+      uniformStructure.cameraPosition[1] = cameraPosition[1];
+      uniformStructure.cameraPosition[2] = cameraPosition[2];
+
+      uniformStructure.cameraForward[0] =
+          cosf(cameraPitch) * cosf(-cameraYaw - (3.141592 / 2.0));
+      uniformStructure.cameraForward[1] = sinf(cameraPitch);
+      uniformStructure.cameraForward[2] =
+          cosf(cameraPitch) * sinf(-cameraYaw - (3.141592 / 2.0));
+
+      uniformStructure.cameraRight[0] =
+          uniformStructure.cameraForward[1] * uniformStructure.cameraUp[2] -
+          uniformStructure.cameraForward[2] * uniformStructure.cameraUp[1];
+      uniformStructure.cameraRight[1] =
+          uniformStructure.cameraForward[2] * uniformStructure.cameraUp[0] -
+          uniformStructure.cameraForward[0] * uniformStructure.cameraUp[2];
+      uniformStructure.cameraRight[2] =
+          uniformStructure.cameraForward[0] * uniformStructure.cameraUp[1] -
+          uniformStructure.cameraForward[1] * uniformStructure.cameraUp[0];
+
+      uniformStructure.frameCount = 0;
+
+      isCameraMoved = false;
+    } else {
+      uniformStructure.frameCount += 1;
+    }
+
+    // Moves also generate resize events on X11, only an extent change
+    // requires a new swapchain
+    if (isWindowResized) {
+      result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+          activePhysicalDeviceHandle, surfaceHandle, &surfaceCapabilities);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result,
+                                "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
+      }
+
+      if (surfaceCapabilities.currentExtent.width != swapchainExtent.width ||
+          surfaceCapabilities.currentExtent.height != swapchainExtent.height) {
+        isSwapchainOutOfDate = true;
+      }
+
+      isWindowResized = false;
+    }
+
+    // Recreate the swapchain and everything sized to it. Pipelines and
+    // acceleration structures do not depend on the extent and are kept.
+    if (isSwapchainOutOfDate) {
+      result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+          activePhysicalDeviceHandle, surfaceHandle, &surfaceCapabilities);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result,
+                                "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
+      }
+
+      if (surfaceCapabilities.currentExtent.width == 0 ||
+          surfaceCapabilities.currentExtent.height == 0) {
+        continue;
+      }
+
+      result = vkDeviceWaitIdle(deviceHandle);
+
+      if (result != VK_SUCCESS) {
+        throwExceptionVulkanAPI(result, "vkDeviceWaitIdle");
+      }
+
+      for (uint32_t x = 0; x < swapchainImageCount; x++) {
+        vkDestroySemaphore(deviceHandle, writeImageSemaphoreHandleList[x],
+                           NULL);
+        vkDestroyFramebuffer(deviceHandle, framebufferHandleList[x], NULL);
+        vkDestroyImageView(deviceHandle, depthImageViewHandleList[x], NULL);
+        freeDeviceMemory(deviceHandle, memoryLedger,
+                         depthImageDeviceMemoryHandleList[x]);
+        vkDestroyImage(deviceHandle, depthImageHandleList[x], NULL);
+        vkDestroyImageView(deviceHandle, swapchainImageViewHandleList[x],
+                           NULL);
+      }
+
+      VkSwapchainKHR oldSwapchainHandle = swapchainHandle;
+      createSwapchain(oldSwapchainHandle);
+      vkDestroySwapchainKHR(deviceHandle, oldSwapchainHandle, NULL);
+
+      // The image count may change with the new swapchain
+      writeImageSemaphoreHandleList.assign(swapchainImageCount,
+                                           VK_NULL_HANDLE);
+
+      for (uint32_t x = 0; x < swapchainImageCount; x++) {
+        VkSemaphoreCreateInfo writeImageSemaphoreCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0};
+
+        result =
+            vkCreateSemaphore(deviceHandle, &writeImageSemaphoreCreateInfo,
+                              NULL, &writeImageSemaphoreHandleList[x]);
+
+        if (result != VK_SUCCESS) {
+          throwExceptionVulkanAPI(result, "vkCreateSemaphore");
+        }
+      }
+
+      vkDestroyImageView(deviceHandle, rayTraceImageViewHandle, NULL);
+      freeDeviceMemory(deviceHandle, memoryLedger,
+                       rayTraceImageDeviceMemoryHandle);
+      vkDestroyImage(deviceHandle, rayTraceImageHandle, NULL);
+      createRayTraceImage();
+
+      rayTraceImageDescriptorInfo.imageView = rayTraceImageViewHandle;
+      vkUpdateDescriptorSets(deviceHandle, 1, &writeDescriptorSetList.back(),
+                             0, NULL);
+
+      uniformStructure.frameCount = 0;
+      isSwapchainOutOfDate = false;
+    }
+
+    // M prints the memory ledger against the current heap budgets
+    if (isMemoryReportRequested) {
+      isMemoryReportRequested = false;
+      printMemoryReport(physicalDeviceProperties.deviceName, memoryLedger);
+    }
+
+    beginTraceSection(frameTraceSection, "Fence wait");
 
-      materialMemoryTypeIndex = x;
-      break;
+    result = vkWaitForFences(deviceHandle, 1,
+                             &imageAvailableFenceHandleList[currentFrame], true,
+                             UINT32_MAX);
+
+    if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+      throwExceptionVulkanAPI(result, "vkWaitForFences");
     }
-  }
 
-  VkMemoryAllocateInfo materialMemoryAllocateInfo = {
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .pNext = &memoryAllocateFlagsInfo,
-      .allocationSize = materialMemoryRequirements.size,
-      .memoryTypeIndex = materialMemoryTypeIndex};
+    // Acquire before resetting the fence, an out of date swapchain skips the
+    // frame and the fence must stay signaled for the next attempt
+    uint32_t currentImageIndex = -1;
+    result =
+        vkAcquireNextImageKHR(deviceHandle, swapchainHandle, UINT32_MAX,
+                              acquireImageSemaphoreHandleList[currentFrame],
+                              VK_NULL_HANDLE, &currentImageIndex);
 
-  VkDeviceMemory materialDeviceMemoryHandle = VK_NULL_HANDLE;
-  result = vkAllocateMemory(deviceHandle, &materialMemoryAllocateInfo, NULL,
-                            &materialDeviceMemoryHandle);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkAllocateMemory");
-  }
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+      isSwapchainOutOfDate = true;
+      continue;
+    } else if (result == VK_SUBOPTIMAL_KHR) {
+      isSwapchainOutOfDate = true;
+    } else if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkAcquireNextImageKHR");
+    }
 
-  result = vkBindBufferMemory(deviceHandle, materialBufferHandle,
-                              materialDeviceMemoryHandle, 0);
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkBindBufferMemory");
-  }
+    result = vkResetFences(deviceHandle, 1,
+                           &imageAvailableFenceHandleList[currentFrame]);
 
-  void *hostMaterialMemoryBuffer;
-  result = vkMapMemory(deviceHandle, materialDeviceMemoryHandle, 0,
-                       sizeof(Material) * materialList.size(), 0,
-                       &hostMaterialMemoryBuffer);
+    if (result != VK_SUCCESS) {
+      throwExceptionVulkanAPI(result, "vkResetFences");
+    }
 
-  memcpy(hostMaterialMemoryBuffer, materialList.data(),
-         sizeof(Material) * materialList.size());
+#if defined(RAY_COUNTERS_ENABLED)
+    // Rays from this slot's previous frame, cleared before it is reused
+    uint32_t *frameRayCountList =
+        (uint32_t *)((uint8_t *)hostRayCounterMemoryBuffer +
+                     currentFrame * rayCounterSliceSize);
 
-  if (result != VK_SUCCESS) {
-    throwExceptionVulkanAPI(result, "vkMapMemory");
-  }
+    for (uint32_t x = 0; x < rayTypeNameList.size(); x++) {
+      windowRayCountList[x] += frameRayCountList[x];
+      frameRayCountList[x] = 0;
+    }
+#endif
 
-  vkUnmapMemory(deviceHandle, materialDeviceMemoryHandle);
+    // The fence also guarantees this frame's previous timestamps are written
+    if (isTimestampWrittenList[currentFrame]) {
+      double renderPassMilliseconds =
+          getTimestampMilliseconds(timestampQueryPoolHandle, currentFrame * 3);
 
-  // =========================================================================
-  // Update Material Descriptor Set
+      double copyMilliseconds = getTimestampMilliseconds(
+          timestampQueryPoolHandle, currentFrame * 3 + 1);
 
-  VkDescriptorBufferInfo materialIndexDescriptorInfo = {
-      .buffer = materialIndexBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
+      addTimestampSample(renderPassTimestampStatistics, renderPassMilliseconds);
+      addTimestampSample(copyTimestampStatistics, copyMilliseconds);
 
-  VkDescriptorBufferInfo materialDescriptorInfo = {
-      .buffer = materialBufferHandle, .offset = 0, .range = VK_WHOLE_SIZE};
+      addQueueTraceEvent("Render pass", graphicsQueueTraceTrackIndex,
+                         frameSubmitMicrosecondsList[currentFrame],
+                         renderPassMilliseconds * 1000.0);
+      addQueueTraceEvent("Ray trace image copy", graphicsQueueTraceTrackIndex,
+                         frameSubmitMicrosecondsList[currentFrame],
+                         copyMilliseconds * 1000.0);
 
-  std::vector<VkWriteDescriptorSet> materialWriteDescriptorSetList = {
-      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-       .pNext = NULL,
-       .dstSet = descriptorSetHandleList[1],
-       .dstBinding = 0,
-       .dstArrayElement = 0,
-       .descriptorCount = 1,
-       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-       .pImageInfo = NULL,
-       .pBufferInfo = &materialIndexDescriptorInfo,
-       .pTexelBufferView = NULL},
-      {.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-       .pNext = NULL,
-       .dstSet = descriptorSetHandleList[1],
-       .dstBinding = 1,
-       .dstArrayElement = 0,
-       .descriptorCount = 1,
-       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-       .pImageInfo = NULL,
-       .pBufferInfo = &materialDescriptorInfo,
-       .pTexelBufferView = NULL}};
+#if defined(RAY_COUNTERS_ENABLED)
+      windowTraceMilliseconds += renderPassMilliseconds;
+#endif
 
-  vkUpdateDescriptorSets(deviceHandle, materialWriteDescriptorSetList.size(),
-                         materialWriteDescriptorSetList.data(), 0, NULL);
+      timedFrameCount += 1;
+      if (timedFrameCount % TIMESTAMP_WINDOW_SIZE == 0) {
+        printTimestampStatistics("Render pass", renderPassTimestampStatistics);
+        printTimestampStatistics("Ray trace image copy",
+                                 copyTimestampStatistics);
+
+#if defined(RAY_COUNTERS_ENABLED)
+        // Measured against the whole render pass, rasterization included
+        for (uint32_t x = 0; x < rayTypeNameList.size(); x++) {
+          printRayThroughput(rayTypeNameList[x], windowRayCountList[x],
+                             windowTraceMilliseconds);
+          windowRayCountList[x] = 0;
+        }
+
+        windowTraceMilliseconds = 0.0;
+#endif
+      }
+    }
 
-  // =========================================================================
-  // Record Render Pass Command Buffers
+    beginTraceSection(frameTraceSection, "Record");
 
-  for (uint32_t x = 0; x < swapchainImageCount; x++) {
+    // The fence guarantees the device is done with this frame's slice
+    uint32_t uniformDynamicOffset = currentFrame * uniformSliceSize;
+    memcpy((uint8_t *)hostUniformMemoryBuffer + uniformDynamicOffset,
+           &uniformStructure, sizeof(UniformStructure));
+
+    // Recorded every frame against the acquired image and this frame's
+    // uniform slice
     VkCommandBufferBeginInfo renderCommandBufferBeginInfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .pNext = NULL,
-        .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
         .pInheritanceInfo = NULL};
 
-    result = vkBeginCommandBuffer(commandBufferHandleList[x],
+    result = vkBeginCommandBuffer(commandBufferHandleList[currentFrame],
                                   &renderCommandBufferBeginInfo);
 
     if (result != VK_SUCCESS) {
@@ -2716,36 +5268,89 @@ int main() {
     std::vector<VkClearValue> clearValueList = {
         {.color = {0.0f, 0.0f, 0.0f, 1.0f}}, {.depthStencil = {1.0f, 0}}};
 
+    VkRect2D screenRect2D = {.offset = {.x = 0, .y = 0},
+                             .extent = swapchainExtent};
+
+    if (isTimestampSupported) {
+      vkCmdResetQueryPool(commandBufferHandleList[currentFrame],
+                          timestampQueryPoolHandle, currentFrame * 3, 3);
+
+      vkCmdWriteTimestamp(commandBufferHandleList[currentFrame],
+                          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          timestampQueryPoolHandle, currentFrame * 3);
+    }
+
     VkRenderPassBeginInfo renderPassBeginInfo = {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
         .pNext = NULL,
         .renderPass = renderPassHandle,
-        .framebuffer = framebufferHandleList[x],
+        .framebuffer = framebufferHandleList[currentImageIndex],
         .renderArea = screenRect2D,
         .clearValueCount = (uint32_t)clearValueList.size(),
         .pClearValues = clearValueList.data()};
 
-    vkCmdBeginRenderPass(commandBufferHandleList[x], &renderPassBeginInfo,
-                         VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(commandBufferHandleList[currentFrame],
+                         &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-    vkCmdBindPipeline(commandBufferHandleList[x],
+    vkCmdBindPipeline(commandBufferHandleList[currentFrame],
                       VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineHandle);
 
-    VkDeviceSize offset = 0;
-    vkCmdBindVertexBuffers(commandBufferHandleList[x], 0, 1,
+    VkViewport viewport = {
+        .x = 0,
+        .y = (float)swapchainExtent.height,
+        .width = (float)swapchainExtent.width,
+        .height = -(float)swapchainExtent.height,
+        .minDepth = 0,
+        .maxDepth = 1};
+
+    vkCmdSetViewport(commandBufferHandleList[currentFrame], 0, 1, &viewport);
+    vkCmdSetScissor(commandBufferHandleList[currentFrame], 0, 1,
+                    &screenRect2D);
+
+    VkDeviceSize offset = SCENE_VERTEX_DATA_OFFSET;
+    vkCmdBindVertexBuffers(commandBufferHandleList[currentFrame], 0, 1,
                            &vertexBufferHandle, &offset);
 
-    vkCmdBindIndexBuffer(commandBufferHandleList[x], indexBufferHandle, 0,
-                         VK_INDEX_TYPE_UINT32);
+    vkCmdBindIndexBuffer(commandBufferHandleList[currentFrame],
+                         indexBufferHandle, 0,
+                         scene.indexSize == sizeof(uint16_t)
+                             ? VK_INDEX_TYPE_UINT16
+                             : VK_INDEX_TYPE_UINT32);
+
+    std::vector<uint32_t> dynamicOffsetList = {uniformDynamicOffset};
+#if defined(RAY_COUNTERS_ENABLED)
+    dynamicOffsetList.push_back(currentFrame * rayCounterSliceSize);
+#endif
 
     vkCmdBindDescriptorSets(
-        commandBufferHandleList[x], VK_PIPELINE_BIND_POINT_GRAPHICS,
+        commandBufferHandleList[currentFrame], VK_PIPELINE_BIND_POINT_GRAPHICS,
         pipelineLayoutHandle, 0, (uint32_t)descriptorSetHandleList.size(),
-        descriptorSetHandleList.data(), 0, NULL);
+        descriptorSetHandleList.data(), (uint32_t)dynamicOffsetList.size(),
+        dynamicOffsetList.data());
 
-    vkCmdDrawIndexed(commandBufferHandleList[x], indexList.size(), 1, 0, 0, 0);
+    vkCmdDrawIndexed(commandBufferHandleList[currentFrame],
+                     (uint32_t)scene.indexCount, 1, 0, 0, 0);
 
-    vkCmdEndRenderPass(commandBufferHandleList[x]);
+    vkCmdEndRenderPass(commandBufferHandleList[currentFrame]);
+
+    if (isTimestampSupported) {
+      vkCmdWriteTimestamp(commandBufferHandleList[currentFrame],
+                          VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                          timestampQueryPoolHandle, currentFrame * 3 + 1);
+    }
+
+#if defined(RAY_COUNTERS_ENABLED)
+    VkMemoryBarrier rayCounterMemoryBarrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_HOST_READ_BIT};
+
+    vkCmdPipelineBarrier(commandBufferHandleList[currentFrame],
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1,
+                         &rayCounterMemoryBarrier, 0, NULL, 0, NULL);
+#endif
 
     VkImageMemoryBarrier swapchainCopyMemoryBarrier = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
@@ -2756,14 +5361,14 @@ int main() {
         .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
         .srcQueueFamilyIndex = queueFamilyIndex,
         .dstQueueFamilyIndex = queueFamilyIndex,
-        .image = swapchainImageHandleList[x],
+        .image = swapchainImageHandleList[currentImageIndex],
         .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                              .baseMipLevel = 0,
                              .levelCount = 1,
                              .baseArrayLayer = 0,
                              .layerCount = 1}};
 
-    vkCmdPipelineBarrier(commandBufferHandleList[x],
+    vkCmdPipelineBarrier(commandBufferHandleList[currentFrame],
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0,
                          NULL, 1, &swapchainCopyMemoryBarrier);
@@ -2784,7 +5389,7 @@ int main() {
                              .baseArrayLayer = 0,
                              .layerCount = 1}};
 
-    vkCmdPipelineBarrier(commandBufferHandleList[x],
+    vkCmdPipelineBarrier(commandBufferHandleList[currentFrame],
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0,
                          NULL, 1, &rayTraceCopyMemoryBarrier);
@@ -2800,14 +5405,23 @@ int main() {
                            .baseArrayLayer = 0,
                            .layerCount = 1},
         .dstOffset = {.x = 0, .y = 0, .z = 0},
-        .extent = {.width = surfaceCapabilities.currentExtent.width,
-                   .height = surfaceCapabilities.currentExtent.height,
+        .extent = {.width = swapchainExtent.width,
+                   .height = swapchainExtent.height,
                    .depth = 1}};
 
-    vkCmdCopyImage(commandBufferHandleList[x], swapchainImageHandleList[x],
+    vkCmdCopyImage(commandBufferHandleList[currentFrame],
+                   swapchainImageHandleList[currentImageIndex],
                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, rayTraceImageHandle,
                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageCopy);
 
+    if (isTimestampSupported) {
+      vkCmdWriteTimestamp(commandBufferHandleList[currentFrame],
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          timestampQueryPoolHandle, currentFrame * 3 + 2);
+
+      isTimestampWrittenList[currentFrame] = true;
+    }
+
     VkImageMemoryBarrier swapchainPresentMemoryBarrier = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
         .pNext = NULL,
@@ -2817,14 +5431,14 @@ int main() {
         .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
         .srcQueueFamilyIndex = queueFamilyIndex,
         .dstQueueFamilyIndex = queueFamilyIndex,
-        .image = swapchainImageHandleList[x],
+        .image = swapchainImageHandleList[currentImageIndex],
         .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                              .baseMipLevel = 0,
                              .levelCount = 1,
                              .baseArrayLayer = 0,
                              .layerCount = 1}};
 
-    vkCmdPipelineBarrier(commandBufferHandleList[x],
+    vkCmdPipelineBarrier(commandBufferHandleList[currentFrame],
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0,
                          NULL, 1, &swapchainPresentMemoryBarrier);
@@ -2845,176 +5459,16 @@ int main() {
                              .baseArrayLayer = 0,
                              .layerCount = 1}};
 
-    vkCmdPipelineBarrier(commandBufferHandleList[x],
+    vkCmdPipelineBarrier(commandBufferHandleList[currentFrame],
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
                          VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 0,
                          NULL, 1, &rayTraceWriteMemoryBarrier);
 
-    result = vkEndCommandBuffer(commandBufferHandleList[x]);
+    result = vkEndCommandBuffer(commandBufferHandleList[currentFrame]);
 
     if (result != VK_SUCCESS) {
       throwExceptionVulkanAPI(result, "vkEndCommandBuffer");
     }
-  }
-
-  // =========================================================================
-  // Fences, Semaphores
-
-  std::vector<VkFence> imageAvailableFenceHandleList(swapchainImageCount,
-                                                     VK_NULL_HANDLE);
-
-  std::vector<VkSemaphore> acquireImageSemaphoreHandleList(swapchainImageCount,
-                                                           VK_NULL_HANDLE);
-
-  std::vector<VkSemaphore> writeImageSemaphoreHandleList(swapchainImageCount,
-                                                         VK_NULL_HANDLE);
-
-  for (uint32_t x = 0; x < swapchainImageCount; x++) {
-    VkFenceCreateInfo imageAvailableFenceCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .pNext = NULL,
-        .flags = VK_FENCE_CREATE_SIGNALED_BIT};
-
-    result = vkCreateFence(deviceHandle, &imageAvailableFenceCreateInfo, NULL,
-                           &imageAvailableFenceHandleList[x]);
-
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkCreateFence");
-    }
-
-    VkSemaphoreCreateInfo acquireImageSemaphoreCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0};
-
-    result = vkCreateSemaphore(deviceHandle, &acquireImageSemaphoreCreateInfo,
-                               NULL, &acquireImageSemaphoreHandleList[x]);
-
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkCreateSemaphore");
-    }
-
-    VkSemaphoreCreateInfo writeImageSemaphoreCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0};
-
-    result = vkCreateSemaphore(deviceHandle, &writeImageSemaphoreCreateInfo,
-                               NULL, &writeImageSemaphoreHandleList[x]);
-
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkCreateSemaphore");
-    }
-  }
-
-  // =========================================================================
-  // Main Loop
-
-  uint32_t currentFrame = 0;
-  while (!exitWindow) {
-#if defined(PLATFORM_LINUX)
-    XEvent event;
-    XNextEvent(displayPtr, &event);
-    handleEvent(displayPtr, &event);
-#elif defined(PLATFORM_WINDOWS)
-    MSG msg;
-    PeekMessage(&msg, NULL, 0, 0, PM_REMOVE);
-    TranslateMessage(&msg);
-    DispatchMessage(&msg);
-
-    if (exitWindow) {
-      break;
-    }
-#endif
-
-    static bool isCameraMoved = true;
-    static float cameraPosition[3] = { 1.5, 4.0, 10.0 };
-    static float cameraYaw = 0.0;
-    static float cameraPitch = 0.0;
-
-    if (isMoveForward) {
-      cameraPosition[0] += cos(-cameraYaw - (3.141592 / 2)) * 0.01f;
-      cameraPosition[2] += sin(-cameraYaw - (3.141592 / 2)) * 0.01f;
-      isCameraMoved = true;
-    }
-    if (isMoveBack) {
-      cameraPosition[0] -= cos(-cameraYaw - (3.141592 / 2)) * 0.01f;
-      cameraPosition[2] -= sin(-cameraYaw - (3.141592 / 2)) * 0.01f;
-      isCameraMoved = true;
-    }
-    if (isTurnLeft) {
-      cameraYaw += 0.005f;
-      isCameraMoved = true;
-    }
-    if (isTurnRight) {
-      cameraYaw -= 0.005f;
-      isCameraMoved = true;
-    }
-
-    if (isCameraMoved) {
-      uniformStructure.cameraPosition[0] = cameraPosition[0];
-      uniformStructure.cameraPosition[1] = cameraPosition[1];
-      uniformStructure.cameraPosition[2] = cameraPosition[2];
-
-      uniformStructure.cameraForward[0] =
-          cosf(cameraPitch) * cosf(-cameraYaw - (3.141592 / 2.0));
-      uniformStructure.cameraForward[1] = sinf(cameraPitch);
-      uniformStructure.cameraForward[2] =
-          cosf(cameraPitch) * sinf(-cameraYaw - (3.141592 / 2.0));
-
-      uniformStructure.cameraRight[0] =
-          uniformStructure.cameraForward[1] * uniformStructure.cameraUp[2] -
-          uniformStructure.cameraForward[2] * uniformStructure.cameraUp[1];
-      uniformStructure.cameraRight[1] =
-          uniformStructure.cameraForward[2] * uniformStructure.cameraUp[0] -
-          uniformStructure.cameraForward[0] * uniformStructure.cameraUp[2];
-      uniformStructure.cameraRight[2] =
-          uniformStructure.cameraForward[0] * uniformStructure.cameraUp[1] -
-          uniformStructure.cameraForward[1] * uniformStructure.cameraUp[0];
-
-      uniformStructure.frameCount = 0;
-
-      isCameraMoved = false;
-    } else {
-      uniformStructure.frameCount += 1;
-    }
-
-    result = vkMapMemory(deviceHandle, uniformDeviceMemoryHandle, 0,
-                         sizeof(UniformStructure), 0, &hostUniformMemoryBuffer);
-
-    memcpy(hostUniformMemoryBuffer, &uniformStructure,
-           sizeof(UniformStructure));
-
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkMapMemory");
-    }
-
-    vkUnmapMemory(deviceHandle, uniformDeviceMemoryHandle);
-
-    result = vkWaitForFences(deviceHandle, 1,
-                             &imageAvailableFenceHandleList[currentFrame], true,
-                             UINT32_MAX);
-
-    if (result != VK_SUCCESS && result != VK_TIMEOUT) {
-      throwExceptionVulkanAPI(result, "vkWaitForFences");
-    }
-
-    result = vkResetFences(deviceHandle, 1,
-                           &imageAvailableFenceHandleList[currentFrame]);
-
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkResetFences");
-    }
-
-    uint32_t currentImageIndex = -1;
-    result =
-        vkAcquireNextImageKHR(deviceHandle, swapchainHandle, UINT32_MAX,
-                              acquireImageSemaphoreHandleList[currentFrame],
-                              VK_NULL_HANDLE, &currentImageIndex);
-
-    if (result != VK_SUCCESS) {
-      throwExceptionVulkanAPI(result, "vkAcquireNextImageKHR");
-    }
 
     VkPipelineStageFlags pipelineStageFlags =
         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
@@ -3028,8 +5482,11 @@ int main() {
         .commandBufferCount = 1,
         .pCommandBuffers = &commandBufferHandleList[currentFrame],
         .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &writeImageSemaphoreHandleList[currentFrame]};
+        .pSignalSemaphores = &writeImageSemaphoreHandleList[currentImageIndex]};
+
+    beginTraceSection(frameTraceSection, "Submit and present");
 
+    frameSubmitMicrosecondsList[currentFrame] = getTraceMicroseconds();
     result = vkQueueSubmit(queueHandle, 1, &submitInfo,
                            imageAvailableFenceHandleList[currentFrame]);
 
@@ -3041,7 +5498,7 @@ int main() {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         .pNext = NULL,
         .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &writeImageSemaphoreHandleList[currentFrame],
+        .pWaitSemaphores = &writeImageSemaphoreHandleList[currentImageIndex],
         .swapchainCount = 1,
         .pSwapchains = &swapchainHandle,
         .pImageIndices = &currentImageIndex,
@@ -3049,16 +5506,22 @@ int main() {
 
     result = vkQueuePresentKHR(queueHandle, &presentInfo);
 
-    if (result != VK_SUCCESS) {
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+      isSwapchainOutOfDate = true;
+    } else if (result != VK_SUCCESS) {
       throwExceptionVulkanAPI(result, "vkQueuePresentKHR");
     }
 
-    currentFrame = (currentFrame + 1) % swapchainImageCount;
+    endTraceSection(frameTraceSection);
+
+    currentFrame = (currentFrame + 1) % FRAMES_IN_FLIGHT;
   }
 
   // =========================================================================
   // Cleanup
 
+  beginTraceSection(mainTraceSection, "Cleanup");
+
   result = vkDeviceWaitIdle(deviceHandle);
 
   if (result != VK_SUCCESS) {
@@ -3067,6 +5530,13 @@ int main() {
 
   for (uint32_t x = 0; x < swapchainImageCount; x++) {
     vkDestroySemaphore(deviceHandle, writeImageSemaphoreHandleList[x], NULL);
+  }
+
+  vkDestroyQueryPool(deviceHandle,
+                     accelerationStructureTimestampQueryPoolHandle, NULL);
+  vkDestroyQueryPool(deviceHandle, timestampQueryPoolHandle, NULL);
+
+  for (uint32_t x = 0; x < FRAMES_IN_FLIGHT; x++) {
     vkDestroySemaphore(deviceHandle, acquireImageSemaphoreHandleList[x], NULL);
     vkDestroyFence(deviceHandle, imageAvailableFenceHandleList[x], NULL);
   }
@@ -3082,6 +5552,12 @@ int main() {
   vkDestroyImageView(deviceHandle, rayTraceImageViewHandle, NULL);
   vkFreeMemory(deviceHandle, rayTraceImageDeviceMemoryHandle, NULL);
   vkDestroyImage(deviceHandle, rayTraceImageHandle, NULL);
+#if defined(RAY_COUNTERS_ENABLED)
+  vkUnmapMemory(deviceHandle, rayCounterDeviceMemoryHandle);
+  vkFreeMemory(deviceHandle, rayCounterDeviceMemoryHandle, NULL);
+  vkDestroyBuffer(deviceHandle, rayCounterBufferHandle, NULL);
+#endif
+  vkUnmapMemory(deviceHandle, uniformDeviceMemoryHandle);
   vkFreeMemory(deviceHandle, uniformDeviceMemoryHandle, NULL);
   vkDestroyBuffer(deviceHandle, uniformBufferHandle, NULL);
   vkDestroyFence(deviceHandle, topLevelAccelerationStructureBuildFenceHandle,
@@ -3153,5 +5629,10 @@ int main() {
   vkDestroySurfaceKHR(instanceHandle, surfaceHandle, NULL);
   vkDestroyInstance(instanceHandle, NULL);
 
+  unloadScene(scene);
+
+  endTraceSection(mainTraceSection);
+  writeTraceFile();
+
   return 0;
 }
@@ -29,8 +29,18 @@ camera;
 
 layout(binding = 2, set = 0) buffer IndexBuffer { uint data[]; }
 indexBuffer;
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+// Four signed normalized 16 bit values per position, after the row major 3x4
+// transform decoding them
+layout(binding = 3, set = 0) buffer VertexBuffer {
+  vec4 transform[3];
+  uvec2 data[];
+}
+vertexBuffer;
+#else
 layout(binding = 3, set = 0) buffer VertexBuffer { float data[]; }
 vertexBuffer;
+#endif
 layout(binding = 4, set = 0, rgba32f) uniform image2D image;
 
 layout(binding = 0, set = 1) buffer MaterialIndexBuffer { uint data[]; }
@@ -38,6 +48,42 @@ materialIndexBuffer;
 layout(binding = 1, set = 1) buffer MaterialBuffer { Material data[]; }
 materialBuffer;
 
+// Primary visibility is rasterized, only ray queries are counted
+#if defined(RAY_COUNTERS_ENABLED)
+layout(binding = 5, set = 0) buffer RayCounter {
+  uint extension;
+  uint shadow;
+}
+rayCounter;
+#endif
+
+// Set when the index buffer holds 16 bit indices, two to a uint
+layout(constant_id = 0) const bool isIndex16 = false;
+
+uint getIndex(uint position) {
+  if (isIndex16) {
+    return (indexBuffer.data[position / 2] >> (16 * (position % 2))) & 0xFFFF;
+  }
+
+  return indexBuffer.data[position];
+}
+
+vec3 getVertex(uint index) {
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+  uvec2 quantizedVertex = vertexBuffer.data[index];
+  vec4 vertex = vec4(unpackSnorm2x16(quantizedVertex.x),
+                     unpackSnorm2x16(quantizedVertex.y).x, 1.0);
+
+  return vec3(dot(vertexBuffer.transform[0], vertex),
+              dot(vertexBuffer.transform[1], vertex),
+              dot(vertexBuffer.transform[2], vertex));
+#else
+  return vec3(vertexBuffer.data[3 * index + 0],
+              vertexBuffer.data[3 * index + 1],
+              vertexBuffer.data[3 * index + 2]);
+#endif
+}
+
 float random(vec2 uv, float seed) {
   return fract(sin(mod(dot(uv, vec2(12.9898, 78.233)) + 1113.1 * seed, M_PI)) *
                43758.5453);
@@ -63,19 +109,13 @@ void main() {
   vec3 directColor = vec3(0.0, 0.0, 0.0);
   vec3 indirectColor = vec3(0.0, 0.0, 0.0);
 
-  ivec3 indices = ivec3(indexBuffer.data[3 * gl_PrimitiveID + 0],
-                        indexBuffer.data[3 * gl_PrimitiveID + 1],
-                        indexBuffer.data[3 * gl_PrimitiveID + 2]);
+  ivec3 indices = ivec3(getIndex(3 * gl_PrimitiveID + 0),
+                        getIndex(3 * gl_PrimitiveID + 1),
+                        getIndex(3 * gl_PrimitiveID + 2));
 
-  vec3 vertexA = vec3(vertexBuffer.data[3 * indices.x + 0],
-                      vertexBuffer.data[3 * indices.x + 1],
-                      vertexBuffer.data[3 * indices.x + 2]);
-  vec3 vertexB = vec3(vertexBuffer.data[3 * indices.y + 0],
-                      vertexBuffer.data[3 * indices.y + 1],
-                      vertexBuffer.data[3 * indices.y + 2]);
-  vec3 vertexC = vec3(vertexBuffer.data[3 * indices.z + 0],
-                      vertexBuffer.data[3 * indices.z + 1],
-                      vertexBuffer.data[3 * indices.z + 2]);
+  vec3 vertexA = getVertex(indices.x);
+  vec3 vertexB = getVertex(indices.y);
+  vec3 vertexC = getVertex(indices.z);
 
   vec3 geometricNormal = normalize(cross(vertexB - vertexA, vertexC - vertexA));
 
@@ -90,19 +130,13 @@ void main() {
     int randomIndex = int(random(gl_FragCoord.xy, camera.frameCount) * 2 + 40);
     vec3 lightColor = vec3(0.6, 0.6, 0.6);
 
-    ivec3 lightIndices = ivec3(indexBuffer.data[3 * randomIndex + 0],
-                               indexBuffer.data[3 * randomIndex + 1],
-                               indexBuffer.data[3 * randomIndex + 2]);
+    ivec3 lightIndices = ivec3(getIndex(3 * randomIndex + 0),
+                               getIndex(3 * randomIndex + 1),
+                               getIndex(3 * randomIndex + 2));
 
-    vec3 lightVertexA = vec3(vertexBuffer.data[3 * lightIndices.x + 0],
-                             vertexBuffer.data[3 * lightIndices.x + 1],
-                             vertexBuffer.data[3 * lightIndices.x + 2]);
-    vec3 lightVertexB = vec3(vertexBuffer.data[3 * lightIndices.y + 0],
-                             vertexBuffer.data[3 * lightIndices.y + 1],
-                             vertexBuffer.data[3 * lightIndices.y + 2]);
-    vec3 lightVertexC = vec3(vertexBuffer.data[3 * lightIndices.z + 0],
-                             vertexBuffer.data[3 * lightIndices.z + 1],
-                             vertexBuffer.data[3 * lightIndices.z + 2]);
+    vec3 lightVertexA = getVertex(lightIndices.x);
+    vec3 lightVertexB = getVertex(lightIndices.y);
+    vec3 lightVertexC = getVertex(lightIndices.z);
 
     vec2 uv = vec2(random(gl_FragCoord.xy, camera.frameCount),
                    random(gl_FragCoord.xy, camera.frameCount + 1));
@@ -129,6 +163,10 @@ void main() {
         rayQuery, topLevelAS, gl_RayFlagsTerminateOnFirstHitEXT, 0xFF,
         shadowRayOrigin, 0.001f, shadowRayDirection, shadowRayDistance);
 
+#if defined(RAY_COUNTERS_ENABLED)
+    atomicAdd(rayCounter.shadow, 1);
+#endif
+
     while (rayQueryProceedEXT(rayQuery))
       ;
 
@@ -159,6 +197,10 @@ void main() {
                           gl_RayFlagsTerminateOnFirstHitEXT, 0xFF, rayOrigin,
                           0.001f, rayDirection, 1000.0f);
 
+#if defined(RAY_COUNTERS_ENABLED)
+    atomicAdd(rayCounter.extension, 1);
+#endif
+
     while (rayQueryProceedEXT(rayQuery))
       ;
 
@@ -170,9 +212,9 @@ void main() {
           rayQueryGetIntersectionBarycentricsEXT(rayQuery, true);
 
       ivec3 extensionIndices =
-          ivec3(indexBuffer.data[3 * extensionPrimitiveIndex + 0],
-                indexBuffer.data[3 * extensionPrimitiveIndex + 1],
-                indexBuffer.data[3 * extensionPrimitiveIndex + 2]);
+          ivec3(getIndex(3 * extensionPrimitiveIndex + 0),
+                getIndex(3 * extensionPrimitiveIndex + 1),
+                getIndex(3 * extensionPrimitiveIndex + 2));
       vec3 extensionBarycentric =
           vec3(1.0 - extensionIntersectionBarycentric.x -
                    extensionIntersectionBarycentric.y,
@@ -180,17 +222,11 @@ void main() {
                extensionIntersectionBarycentric.y);
 
       vec3 extensionVertexA =
-          vec3(vertexBuffer.data[3 * extensionIndices.x + 0],
-               vertexBuffer.data[3 * extensionIndices.x + 1],
-               vertexBuffer.data[3 * extensionIndices.x + 2]);
+          getVertex(extensionIndices.x);
       vec3 extensionVertexB =
-          vec3(vertexBuffer.data[3 * extensionIndices.y + 0],
-               vertexBuffer.data[3 * extensionIndices.y + 1],
-               vertexBuffer.data[3 * extensionIndices.y + 2]);
+          getVertex(extensionIndices.y);
       vec3 extensionVertexC =
-          vec3(vertexBuffer.data[3 * extensionIndices.z + 0],
-               vertexBuffer.data[3 * extensionIndices.z + 1],
-               vertexBuffer.data[3 * extensionIndices.z + 2]);
+          getVertex(extensionIndices.z);
 
       vec3 extensionPosition = extensionVertexA * extensionBarycentric.x +
                                extensionVertexB * extensionBarycentric.y +
@@ -215,19 +251,13 @@ void main() {
             int(random(gl_FragCoord.xy, camera.frameCount + rayDepth) * 2 + 40);
         vec3 lightColor = vec3(0.6, 0.6, 0.6);
 
-        ivec3 lightIndices = ivec3(indexBuffer.data[3 * randomIndex + 0],
-                                   indexBuffer.data[3 * randomIndex + 1],
-                                   indexBuffer.data[3 * randomIndex + 2]);
+        ivec3 lightIndices = ivec3(getIndex(3 * randomIndex + 0),
+                                   getIndex(3 * randomIndex + 1),
+                                   getIndex(3 * randomIndex + 2));
 
-        vec3 lightVertexA = vec3(vertexBuffer.data[3 * lightIndices.x + 0],
-                                 vertexBuffer.data[3 * lightIndices.x + 1],
-                                 vertexBuffer.data[3 * lightIndices.x + 2]);
-        vec3 lightVertexB = vec3(vertexBuffer.data[3 * lightIndices.y + 0],
-                                 vertexBuffer.data[3 * lightIndices.y + 1],
-                                 vertexBuffer.data[3 * lightIndices.y + 2]);
-        vec3 lightVertexC = vec3(vertexBuffer.data[3 * lightIndices.z + 0],
-                                 vertexBuffer.data[3 * lightIndices.z + 1],
-                                 vertexBuffer.data[3 * lightIndices.z + 2]);
+        vec3 lightVertexA = getVertex(lightIndices.x);
+        vec3 lightVertexB = getVertex(lightIndices.y);
+        vec3 lightVertexC = getVertex(lightIndices.z);
 
         vec2 uv =
             vec2(random(gl_FragCoord.xy, camera.frameCount + rayDepth),
@@ -255,6 +285,10 @@ void main() {
             rayQuery, topLevelAS, gl_RayFlagsTerminateOnFirstHitEXT, 0xFF,
             shadowRayOrigin, 0.001f, shadowRayDirection, shadowRayDistance);
 
+#if defined(RAY_COUNTERS_ENABLED)
+        atomicAdd(rayCounter.shadow, 1);
+#endif
+
         while (rayQueryProceedEXT(rayQuery))
           ;
 
@@ -15,7 +15,22 @@ layout(binding = 1, set = 0) uniform Camera {
 }
 camera;
 
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+// The transform decoding the quantized positions, see shader.frag
+layout(binding = 3, set = 0) readonly buffer VertexBuffer { vec4 transform[3]; }
+vertexBuffer;
+#endif
+
 void main() {
+#if defined(VERTEX_QUANTIZATION_ENABLED)
+  vec4 quantizedPosition = vec4(inPosition, 1.0);
+  vec3 position = vec3(dot(vertexBuffer.transform[0], quantizedPosition),
+                       dot(vertexBuffer.transform[1], quantizedPosition),
+                       dot(vertexBuffer.transform[2], quantizedPosition));
+#else
+  vec3 position = inPosition;
+#endif
+
   vec4 positionVector = camera.position - vec4(0.0, 0.0, 0.0, 1.0);
   mat4 viewMatrix = {vec4(camera.right.x, camera.up.x, camera.forward.x, 0),
                      vec4(camera.right.y, camera.up.y, camera.forward.y, 0),
@@ -36,7 +51,7 @@ void main() {
                            vec4(0, 0, farDist * oneOverDepth, 1),
                            vec4(0, 0, (-farDist * nearDist) * oneOverDepth, 0)};
 
-  gl_Position = projectionMatrix * viewMatrix * vec4(inPosition, 1.0);
+  gl_Position = projectionMatrix * viewMatrix * vec4(position, 1.0);
 
-  interpolatedPosition = inPosition;
+  interpolatedPosition = position;
 }